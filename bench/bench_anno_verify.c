@@ -0,0 +1,452 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_anno_verify.c
+ *  @brief  announcement signature verification benchmark
+ *
+ *  gossip(channel_announcement, channel_update, node_announcement)を#ln_anno_verify_push()で積み、
+ *  1, 4, 8 worker threadで全件の検証・保存が終わるまでの、1秒あたりの検証数を出力する。
+ *  保存はカウントするだけで、DBは使わない。
+ *
+ *  -fで記録したgossipを読み込む(1 messageごとに[2:len(big endian)][len:message])。
+ *  chain_hashは確認しない。
+ *  指定しない場合は、mainnetと同じ形式・署名数のgossipを生成する
+ *  (channelごとにchannel_announcement 1, channel_update 2, nodeごとにnode_announcement 1)。
+ *
+ *      usage: bench_anno_verify [-f gossip_file] [-c channels] [-w workers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "utl_int.h"
+
+#include "btc.h"
+#include "btc_crypto.h"
+#include "btc_keys.h"
+#include "btc_sig.h"
+
+#include "ln.h"
+#include "ln_anno_verify.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CHANNELS_DEFAULT  (500)           ///< 生成するchannel数
+#define M_NODES_DIV         (4)             ///< 生成するnode数(channel数 / M_NODES_DIV)
+
+#define M_TYPE_CNLANNO      ((uint16_t)0x0100)
+#define M_TYPE_NODEANNO     ((uint16_t)0x0101)
+#define M_TYPE_CNLUPD       ((uint16_t)0x0102)
+
+#define M_SZ_SIG            (64)
+#define M_SZ_CNLANNO        (2 + M_SZ_SIG * 4 + 2 + 32 + 8 + BTC_SZ_PUBKEY * 4)
+#define M_SZ_CNLUPD         (2 + M_SZ_SIG + 32 + 8 + 4 + 1 + 1 + 2 + 8 + 4 + 4 + 8)
+#define M_SZ_NODEANNO       (2 + M_SZ_SIG + 2 + 4 + BTC_SZ_PUBKEY + 3 + 32 + 2 + 7)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+typedef struct {
+    uint16_t        len;
+    uint8_t         *p_data;
+} msg_t;
+
+
+/** channel_announcementのnode_id(#p_node_id()用)
+ *
+ */
+typedef struct {
+    uint64_t        short_channel_id;
+    uint8_t         node_id[2][BTC_SZ_PUBKEY];
+} cnl_t;
+
+
+typedef struct {
+    uint8_t         priv[BTC_SZ_PRIVKEY];
+    uint8_t         pub[BTC_SZ_PUBKEY];
+} keypair_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static msg_t        *mpMsgs;
+static int          mMsgNum;
+static cnl_t        *mpCnls;
+static int          mCnlNum;
+static int          mStored;
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static void create_key(keypair_t *pKey)
+{
+    do {
+        btc_rng_rand(pKey->priv, BTC_SZ_PRIVKEY);
+    } while (!btc_keys_check_priv(pKey->priv));
+    btc_keys_priv2pub(pKey->pub, pKey->priv);
+}
+
+
+static void sign(uint8_t *pSig, const uint8_t *pData, uint16_t Len, uint16_t Offset, const uint8_t *pPriv)
+{
+    uint8_t hash[BTC_SZ_HASH256];
+    btc_md_hash256(hash, pData + Offset, Len - Offset);
+    btc_sig_sign_rs(pSig, hash, pPriv);
+}
+
+
+static uint8_t *msg_add(uint16_t Len)
+{
+    msg_t *p_msg = &mpMsgs[mMsgNum++];
+    p_msg->len = Len;
+    p_msg->p_data = (uint8_t *)malloc(Len);
+    return p_msg->p_data;
+}
+
+
+static int cnl_cmp(const void *pA, const void *pB)
+{
+    uint64_t a = ((const cnl_t *)pA)->short_channel_id;
+    uint64_t b = ((const cnl_t *)pB)->short_channel_id;
+    return (a < b) ? -1 : (a > b);
+}
+
+
+/** gossip生成
+ *
+ * @param[in]       Channels        channel数
+ */
+static void create_gossip(int Channels)
+{
+    int nodes = Channels / M_NODES_DIV;
+    if (nodes < 2) {
+        nodes = 2;
+    }
+    keypair_t *p_nodes = (keypair_t *)malloc(sizeof(keypair_t) * nodes);
+    for (int lp = 0; lp < nodes; lp++) {
+        create_key(&p_nodes[lp]);
+    }
+    mpMsgs = (msg_t *)malloc(sizeof(msg_t) * (Channels * 3 + nodes));
+
+    for (int lp = 0; lp < Channels; lp++) {
+        //node_id昇順
+        const keypair_t *p_node[2] = { &p_nodes[lp % nodes], &p_nodes[(lp * 7 + 1) % nodes] };
+        if (p_node[0] == p_node[1]) {
+            p_node[1] = &p_nodes[(lp + 1) % nodes];
+        }
+        if (memcmp(p_node[0]->pub, p_node[1]->pub, BTC_SZ_PUBKEY) > 0) {
+            const keypair_t *p_tmp = p_node[0];
+            p_node[0] = p_node[1];
+            p_node[1] = p_tmp;
+        }
+        keypair_t btc_key[2];
+        create_key(&btc_key[0]);
+        create_key(&btc_key[1]);
+        uint64_t short_channel_id = ((uint64_t)(500000 + lp) << 40) | ((uint64_t)(lp % 2000) << 16) | 1;
+
+        //channel_announcement
+        uint8_t *p = msg_add(M_SZ_CNLANNO);
+        uint8_t *p_anno = p;
+        utl_int_unpack_u16be(p, M_TYPE_CNLANNO);
+        p += 2 + M_SZ_SIG * 4;
+        utl_int_unpack_u16be(p, 0);             //features
+        p += 2;
+        memset(p, 0x6f, 32);                    //chain_hash
+        p += 32;
+        utl_int_unpack_u64be(p, short_channel_id);
+        p += 8;
+        memcpy(p, p_node[0]->pub, BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memcpy(p, p_node[1]->pub, BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memcpy(p, btc_key[0].pub, BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memcpy(p, btc_key[1].pub, BTC_SZ_PUBKEY);
+        const uint16_t offset = 2 + M_SZ_SIG * 4;
+        sign(p_anno + 2, p_anno, M_SZ_CNLANNO, offset, p_node[0]->priv);
+        sign(p_anno + 2 + M_SZ_SIG, p_anno, M_SZ_CNLANNO, offset, p_node[1]->priv);
+        sign(p_anno + 2 + M_SZ_SIG * 2, p_anno, M_SZ_CNLANNO, offset, btc_key[0].priv);
+        sign(p_anno + 2 + M_SZ_SIG * 3, p_anno, M_SZ_CNLANNO, offset, btc_key[1].priv);
+
+        //channel_update(dir=0,1)
+        for (int dir = 0; dir < 2; dir++) {
+            p = msg_add(M_SZ_CNLUPD);
+            uint8_t *p_upd = p;
+            utl_int_unpack_u16be(p, M_TYPE_CNLUPD);
+            p += 2 + M_SZ_SIG;
+            memset(p, 0x6f, 32);
+            p += 32;
+            utl_int_unpack_u64be(p, short_channel_id);
+            p += 8;
+            utl_int_unpack_u32be(p, 1550000000 + lp);
+            p += 4;
+            *p++ = 0x01;                        //message_flags: option_channel_htlc_max
+            *p++ = (uint8_t)dir;
+            utl_int_unpack_u16be(p, 144);
+            p += 2;
+            utl_int_unpack_u64be(p, 1000);
+            p += 8;
+            utl_int_unpack_u32be(p, 1000);
+            p += 4;
+            utl_int_unpack_u32be(p, 1);
+            p += 4;
+            utl_int_unpack_u64be(p, 16777215000ULL);
+            sign(p_upd + 2, p_upd, M_SZ_CNLUPD, 2 + M_SZ_SIG, p_node[dir]->priv);
+        }
+    }
+
+    for (int lp = 0; lp < nodes; lp++) {
+        //node_announcement(IPv4 address 1つ)
+        uint8_t *p = msg_add(M_SZ_NODEANNO);
+        uint8_t *p_node = p;
+        utl_int_unpack_u16be(p, M_TYPE_NODEANNO);
+        p += 2 + M_SZ_SIG;
+        utl_int_unpack_u16be(p, 0);             //features
+        p += 2;
+        utl_int_unpack_u32be(p, 1550000000 + lp);
+        p += 4;
+        memcpy(p, p_nodes[lp].pub, BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memset(p, 0x80, 3);                     //rgb_color
+        p += 3;
+        memset(p, 0, 32);                       //alias
+        snprintf((char *)p, 32, "node%d", lp);
+        p += 32;
+        utl_int_unpack_u16be(p, 7);
+        p += 2;
+        *p++ = 1;                               //IPv4
+        p[0] = 192; p[1] = 168; p[2] = (uint8_t)(lp >> 8); p[3] = (uint8_t)lp;
+        utl_int_unpack_u16be(p + 4, 9735);
+        sign(p_node + 2, p_node, M_SZ_NODEANNO, 2 + M_SZ_SIG, p_nodes[lp].priv);
+    }
+    free(p_nodes);
+}
+
+
+/** 記録したgossipの読込
+ *
+ * @param[in]       pFile           gossip file
+ * @retval  true    成功
+ */
+static bool load_gossip(const char *pFile)
+{
+    FILE *fp = fopen(pFile, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "fail: open %s\n", pFile);
+        return false;
+    }
+    int capacity = 0;
+    uint8_t hdr[2];
+    while (fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr)) {
+        uint16_t len = utl_int_pack_u16be(hdr);
+        if (mMsgNum == capacity) {
+            capacity = (capacity == 0) ? 4096 : capacity * 2;
+            mpMsgs = (msg_t *)realloc(mpMsgs, sizeof(msg_t) * capacity);
+        }
+        uint8_t *p = msg_add(len);
+        if ((len < 2) || (fread(p, 1, len, fp) != len)) {
+            mMsgNum--;
+            free(p);
+            break;
+        }
+        uint16_t type = utl_int_pack_u16be(p);
+        if ((type != M_TYPE_CNLANNO) && (type != M_TYPE_NODEANNO) && (type != M_TYPE_CNLUPD)) {
+            //announcement以外は使わない
+            mMsgNum--;
+            free(p);
+        }
+    }
+    fclose(fp);
+    return mMsgNum > 0;
+}
+
+
+/** channel_announcementのnode_id一覧作成
+ *
+ */
+static void load_channels(void)
+{
+    mpCnls = (cnl_t *)malloc(sizeof(cnl_t) * (mMsgNum + 1));
+    for (int lp = 0; lp < mMsgNum; lp++) {
+        const uint8_t *p = mpMsgs[lp].p_data;
+        if ((utl_int_pack_u16be(p) != M_TYPE_CNLANNO) || (mpMsgs[lp].len < M_SZ_CNLANNO)) {
+            continue;
+        }
+        p += 2 + M_SZ_SIG * 4;
+        uint16_t flen = utl_int_pack_u16be(p);
+        if (mpMsgs[lp].len < M_SZ_CNLANNO + flen) {
+            continue;
+        }
+        p += 2 + flen + 32;
+        cnl_t *p_cnl = &mpCnls[mCnlNum++];
+        p_cnl->short_channel_id = utl_int_pack_u64be(p);
+        memcpy(p_cnl->node_id[0], p + 8, BTC_SZ_PUBKEY);
+        memcpy(p_cnl->node_id[1], p + 8 + BTC_SZ_PUBKEY, BTC_SZ_PUBKEY);
+    }
+    qsort(mpCnls, mCnlNum, sizeof(cnl_t), cnl_cmp);
+}
+
+
+/** #ln_anno_verify_func_t.p_node_id(DBの代わり)
+ *
+ */
+static bool p_node_id(uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir)
+{
+    cnl_t key;
+    key.short_channel_id = ShortChannelId;
+    const cnl_t *p_cnl = (const cnl_t *)bsearch(&key, mpCnls, mCnlNum, sizeof(cnl_t), cnl_cmp);
+    if (p_cnl == NULL) {
+        return false;
+    }
+    memcpy(pNodeId, p_cnl->node_id[Dir], BTC_SZ_PUBKEY);
+    return true;
+}
+
+
+/** #ln_anno_verify_func_t.p_store(カウントのみ)
+ *
+ */
+static void p_store(uint16_t Type, const uint8_t *pData, uint16_t Len, const uint8_t *pSendId)
+{
+    (void)Type; (void)pData; (void)Len; (void)pSendId;
+    mStored++;
+}
+
+
+/** 検証時間計測
+ *
+ * @param[in]       Workers         worker thread数
+ */
+static void bench_run(int Workers)
+{
+    const ln_anno_verify_func_t func = { p_node_id, p_store };
+    uint8_t send_id[BTC_SZ_PUBKEY];
+    memset(send_id, 0x02, sizeof(send_id));
+
+    mStored = 0;
+    if (!ln_anno_verify_start(Workers, &func)) {
+        fprintf(stderr, "fail: start\n");
+        return;
+    }
+    int pushed = 0;
+    double start = now_usec();
+    for (int lp = 0; lp < mMsgNum; lp++) {
+        uint16_t type = utl_int_pack_u16be(mpMsgs[lp].p_data);
+        if (ln_anno_verify_push(type, mpMsgs[lp].p_data, mpMsgs[lp].len, send_id, NULL)) {
+            pushed++;
+        }
+    }
+    ln_anno_verify_flush();
+    double elapsed = now_usec() - start;
+    ln_anno_verify_stop();
+
+    printf("workers=%d announcements=%d elapsed=%.0fus announcements/sec=%.1f stored=%d invalid=%d\n",
+        Workers, pushed, elapsed, pushed * 1000000.0 / elapsed, mStored, pushed - mStored);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    const char *p_file = NULL;
+    int channels = M_CHANNELS_DEFAULT;
+    int workers = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:c:w:")) != -1) {
+        switch (opt) {
+        case 'f':
+            p_file = optarg;
+            break;
+        case 'c':
+            channels = atoi(optarg);
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f gossip_file] [-c channels] [-w workers]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (channels <= 0) {
+        channels = M_CHANNELS_DEFAULT;
+    }
+    if (workers > LN_ANNO_VERIFY_WORKERS_MAX) {
+        fprintf(stderr, "workers <= %d\n", LN_ANNO_VERIFY_WORKERS_MAX);
+        return -1;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCMAIN, true);
+
+    if (p_file != NULL) {
+        if (!load_gossip(p_file)) {
+            fprintf(stderr, "fail: no announcement in %s\n", p_file);
+            return -1;
+        }
+    } else {
+        create_gossip(channels);
+    }
+    load_channels();
+    printf("announcements=%d channels=%d\n", mMsgNum, mCnlNum);
+
+    if (workers > 0) {
+        bench_run(workers);
+    } else {
+        const int WORKERS[] = { 1, 4, 8 };
+        for (size_t lp = 0; lp < ARRAY_SIZE(WORKERS); lp++) {
+            bench_run(WORKERS[lp]);
+        }
+    }
+
+    for (int lp = 0; lp < mMsgNum; lp++) {
+        free(mpMsgs[lp].p_data);
+    }
+    free(mpMsgs);
+    free(mpCnls);
+    btc_term();
+    return 0;
+}
@@ -0,0 +1,513 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_btcrpc.c
+ *  @brief  bitcoind JSON-RPC client benchmark
+ *
+ *  同一プロセス内で動かすmock bitcoind(HTTP/1.1)に対して btcrpc_*()を呼び出し、
+ *  calls/sとp99 latencyを出力する。
+ *
+ *      usage: bench_btcrpc [-n calls/thread] [-d server delay(usec)] [-c] [-s txs/block]
+ *          -c: mock serverが応答ごとに接続を切る(keep-aliveなしの比較用)
+ *          -s: btcrpc_search_vout()でのblock走査を計測する(raw block取得とtransaction毎取得の比較)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "btcrpc.h"
+#include "utl_str.h"
+#include "btc_block.h"
+#include "btc_buf.h"
+#include "btc_tx_buf.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CALLS_DEFAULT     (2000)          ///< 1threadあたりの呼び出し回数
+#define M_REQ_MAX           (1024 * 1024)   ///< mock serverの受信バッファ
+#define M_RES_MAX           (8 * 1024 * 1024)
+#define M_SCAN_BLOCKS       (10)            ///< 走査するblock数
+#define M_SCAN_TXS_DEFAULT  (2000)          ///< 1blockあたりのtransaction数
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+typedef struct {
+    int         calls;
+    double      *p_lat;         ///< 1呼び出しごとのlatency[usec]
+    int         fail;
+} bench_thread_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static int      mListenFd;
+static uint16_t mPort;
+static int      mDelayUsec;
+static bool     mCloseEach;
+
+//block走査用
+static bool     mNoRawBlock;                ///< true: getblock(verbosity=0)を失敗させる
+static int      mScanTxs;
+static char     *mBlockHex;                 ///< raw block(hex文字列)
+static char     *mTxidsJson;                ///< TXID文字列のJSON配列
+static char     **mTxHex;                   ///< transaction(hex文字列)
+
+
+/**************************************************************************
+ * ptarmd stub
+ **************************************************************************/
+
+void ln_creationhash_set(const uint8_t *pHash)
+{
+    (void)pHash;
+}
+
+
+/**************************************************************************
+ * mock bitcoind
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int mock_result(char *pRes, size_t Len, const char *pReq, int Id, bool IdNum)
+{
+    char id[32];
+    if (IdNum) {
+        snprintf(id, sizeof(id), "%d", Id);
+    } else {
+        snprintf(id, sizeof(id), "\"ptarmdrpc\"");
+    }
+
+    if (strstr(pReq, "\"getnetworkinfo\"") != NULL) {
+        return snprintf(pRes, Len, "{\"result\":{\"version\":170100},\"error\":null,\"id\":%s}", id);
+    } else if (strstr(pReq, "\"getblockcount\"") != NULL) {
+        return snprintf(pRes, Len, "{\"result\":600000,\"error\":null,\"id\":%s}", id);
+    } else if (strstr(pReq, "\"getblockhash\"") != NULL) {
+        //block hashにheightを埋め込む
+        const char *p_param = strstr(pReq, "\"params\"");
+        int height = (p_param != NULL) ? atoi(strchr(p_param, '[') + 1) : 0;
+        return snprintf(pRes, Len, "{\"result\":\"%064d\",\"error\":null,\"id\":%s}", height, id);
+    } else if (strstr(pReq, "\"getblock\"") != NULL) {
+        const char *p_param = strstr(pReq, "\"params\"");
+        const char *p_hash = (p_param != NULL) ? strchr(p_param + 8, '"') : NULL;
+        if ((p_hash == NULL) || (mBlockHex == NULL)) {
+            return snprintf(pRes, Len, "{\"result\":null,\"error\":{\"code\":-5,\"message\":\"Block not found\"},\"id\":%s}", id);
+        }
+        int height = atoi(p_hash + 1);
+        int verbosity = atoi(strchr(p_hash + 1, '"') + 2);
+        if (verbosity == 0) {
+            if (mNoRawBlock) {
+                return snprintf(pRes, Len, "{\"result\":null,\"error\":null,\"id\":%s}", id);
+            }
+            return snprintf(pRes, Len, "{\"result\":\"%s\",\"error\":null,\"id\":%s}", mBlockHex, id);
+        }
+        return snprintf(pRes, Len, "{\"result\":{\"height\":%d,\"tx\":%s},\"error\":null,\"id\":%s}",
+                    height, mTxidsJson, id);
+    } else if ((strstr(pReq, "\"getrawtransaction\"") != NULL) && (mTxHex != NULL) && (strstr(pReq, "false]") != NULL)) {
+        return snprintf(pRes, Len, "{\"result\":\"%s\",\"error\":null,\"id\":%s}", mTxHex[Id % mScanTxs], id);
+    }
+    return snprintf(pRes, Len, "{\"result\":null,\"error\":{\"code\":-32601,\"message\":\"Method not found\"},\"id\":%s}", id);
+}
+
+
+/** 1要求分の応答JSONを作る
+ *
+ * batch(JSON配列)の場合は"id"ごとに応答を作り、逆順で返す(順序非保証の確認を兼ねる)。
+ */
+static int mock_response(char *pRes, size_t Len, const char *pBody)
+{
+    if (*pBody != '[') {
+        return mock_result(pRes, Len, pBody, 0, false);
+    }
+
+    int ids[2048];
+    const char *reqs[2048];
+    int num = 0;
+    const char *p = pBody;
+    while ((num < 2048) && ((p = strstr(p, "\"id\":")) != NULL)) {
+        p += 5;
+        ids[num] = atoi(p);
+        reqs[num] = p;
+        num++;
+    }
+
+    int pos = 0;
+    pRes[pos++] = '[';
+    for (int lp = num - 1; lp >= 0; lp--) {
+        if (lp != num - 1) {
+            pRes[pos++] = ',';
+        }
+        pos += mock_result(pRes + pos, Len - pos, reqs[lp], ids[lp], true);
+    }
+    pRes[pos++] = ']';
+    pRes[pos] = '\0';
+    return pos;
+}
+
+
+static void *mock_conn_thread(void *pArg)
+{
+    int fd = (int)(intptr_t)pArg;
+    char *p_req = (char *)malloc(M_REQ_MAX);
+    char *p_res = (char *)malloc(M_RES_MAX);
+    size_t len = 0;
+
+    p_req[0] = '\0';
+    for (;;) {
+        //header
+        char *p_hdr_end = NULL;
+        while ((p_hdr_end = strstr(p_req, "\r\n\r\n")) == NULL) {
+            ssize_t sz = recv(fd, p_req + len, M_REQ_MAX - len - 1, 0);
+            if (sz <= 0) {
+                goto LABEL_EXIT;
+            }
+            len += sz;
+            p_req[len] = '\0';
+        }
+        const char *p_cl = strcasestr(p_req, "Content-Length:");
+        size_t body_len = (p_cl != NULL) ? (size_t)atol(p_cl + 15) : 0;
+        size_t hdr_len = p_hdr_end + 4 - p_req;
+
+        //body
+        while (len < hdr_len + body_len) {
+            ssize_t sz = recv(fd, p_req + len, M_REQ_MAX - len - 1, 0);
+            if (sz <= 0) {
+                goto LABEL_EXIT;
+            }
+            len += sz;
+            p_req[len] = '\0';
+        }
+        char save = p_req[hdr_len + body_len];
+        p_req[hdr_len + body_len] = '\0';
+
+        if (mDelayUsec > 0) {
+            usleep(mDelayUsec);
+        }
+        char hdr[256];
+        int res_len = mock_response(p_res, M_RES_MAX, p_req + hdr_len);
+        int hdr_sz = snprintf(hdr, sizeof(hdr),
+                    "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: application/json\r\n"
+                    "Content-Length: %d\r\n"
+                    "Connection: %s\r\n\r\n", res_len, (mCloseEach) ? "close" : "keep-alive");
+        if ((send(fd, hdr, hdr_sz, MSG_NOSIGNAL | MSG_MORE) != hdr_sz) ||
+            (send(fd, p_res, res_len, MSG_NOSIGNAL) != res_len)) {
+            goto LABEL_EXIT;
+        }
+        if (mCloseEach) {
+            goto LABEL_EXIT;
+        }
+
+        //pipelined data
+        p_req[hdr_len + body_len] = save;
+        len -= hdr_len + body_len;
+        memmove(p_req, p_req + hdr_len + body_len, len);
+        p_req[len] = '\0';
+    }
+
+LABEL_EXIT:
+    close(fd);
+    free(p_res);
+    free(p_req);
+    return NULL;
+}
+
+
+static void *mock_server_thread(void *pArg)
+{
+    (void)pArg;
+
+    for (;;) {
+        int fd = accept(mListenFd, NULL, NULL);
+        if (fd < 0) {
+            break;
+        }
+        pthread_t th;
+        pthread_create(&th, NULL, mock_conn_thread, (void *)(intptr_t)fd);
+        pthread_detach(th);
+    }
+    return NULL;
+}
+
+
+static bool mock_start(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    mListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (mListenFd < 0) {
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if ((bind(mListenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (listen(mListenFd, 128) != 0) ||
+        (getsockname(mListenFd, (struct sockaddr *)&addr, &addr_len) != 0)) {
+        close(mListenFd);
+        return false;
+    }
+    mPort = ntohs(addr.sin_port);
+
+    pthread_t th;
+    pthread_create(&th, NULL, mock_server_thread, NULL);
+    pthread_detach(th);
+    return true;
+}
+
+
+/**************************************************************************
+ * benchmark
+ **************************************************************************/
+
+static void *bench_thread(void *pArg)
+{
+    bench_thread_t *p_bench = (bench_thread_t *)pArg;
+
+    for (int lp = 0; lp < p_bench->calls; lp++) {
+        double start = now_usec();
+        int32_t height;
+        bool ret = btcrpc_getblockcount(&height);
+        p_bench->p_lat[lp] = now_usec() - start;
+        if (!ret) {
+            p_bench->fail++;
+        }
+    }
+    return NULL;
+}
+
+
+/** block走査用のtransactionとraw blockを作る
+ *
+ * 検索対象とは一致しないvoutだけを持たせ、全transactionを走査させる。
+ */
+static void scan_setup(int Txs)
+{
+    btc_buf_w_t buf_w;
+    size_t pos = 0;
+
+    mScanTxs = Txs;
+    mTxHex = (char **)malloc(sizeof(char *) * Txs);
+    mTxidsJson = (char *)malloc((BTC_SZ_TXID * 2 + 3) * Txs + 3);
+    btc_buf_w_init(&buf_w, 0);
+    btc_buf_w_write_zeros(&buf_w, BTC_SZ_BLOCK_HEADER);
+    btc_tx_buf_w_write_varint_len(&buf_w, Txs);
+
+    mTxidsJson[pos++] = '[';
+    for (int lp = 0; lp < Txs; lp++) {
+        btc_tx_t tx = BTC_TX_INIT;
+        uint8_t txid[BTC_SZ_TXID];
+        memset(txid, 0, sizeof(txid));
+        memcpy(txid, &lp, sizeof(lp));
+        btc_vin_t *vin = btc_tx_add_vin(&tx, txid, 0);
+        btc_tx_add_wit(vin);
+        utl_buf_alloc(&vin->witness[0], 72);
+        for (int vout = 0; vout < 2; vout++) {
+            btc_vout_t *p_vout = btc_tx_add_vout(&tx, 10000);
+            utl_buf_alloc(&p_vout->script, 22);
+            memset(p_vout->script.buf, vout + 1, 22);
+        }
+
+        utl_buf_t buf = UTL_BUF_INIT;
+        btc_tx_write(&tx, &buf);
+        btc_buf_w_write_data(&buf_w, buf.buf, buf.len);
+        mTxHex[lp] = (char *)malloc(buf.len * 2 + 1);
+        utl_str_bin2str(mTxHex[lp], buf.buf, buf.len);
+        btc_tx_txid(&tx, txid);
+        pos += sprintf(mTxidsJson + pos, "%s\"", (lp == 0) ? "" : ",");
+        utl_str_bin2str_rev(mTxidsJson + pos, txid, BTC_SZ_TXID);
+        pos += BTC_SZ_TXID * 2;
+        mTxidsJson[pos++] = '"';
+        utl_buf_free(&buf);
+        btc_tx_free(&tx);
+    }
+    mTxidsJson[pos++] = ']';
+    mTxidsJson[pos] = '\0';
+
+    mBlockHex = (char *)malloc(btc_buf_w_get_len(&buf_w) * 2 + 1);
+    utl_str_bin2str(mBlockHex, btc_buf_w_get_data(&buf_w), btc_buf_w_get_len(&buf_w));
+    btc_buf_w_free(&buf_w);
+}
+
+
+/** btcrpc_search_vout()でM_SCAN_BLOCKS block走査する
+ *
+ * @param[in]   pName       表示名
+ * @param[in]   RawBlock    false: getblock(verbosity=0)を失敗させ、transaction毎の取得にする
+ * @param[in]   Loop        繰り返し回数
+ */
+static void scan_run(const char *pName, bool RawBlock, int Loop)
+{
+    utl_buf_t vout[1];
+    uint8_t script[22];
+    int fail = 0;
+
+    memset(script, 0xcc, sizeof(script));
+    utl_buf_init(&vout[0]);
+    utl_buf_alloccopy(&vout[0], script, sizeof(script));
+    utl_buf_t vouts = { (uint8_t *)vout, sizeof(vout) };
+
+    mNoRawBlock = !RawBlock;
+    double start = now_usec();
+    for (int lp = 0; lp < Loop; lp++) {
+        utl_buf_t txbuf = UTL_BUF_INIT;
+        if (btcrpc_search_vout(&txbuf, M_SCAN_BLOCKS, &vouts)) {
+            //一致しないはず
+            fail++;
+        }
+        utl_buf_free(&txbuf);
+    }
+    double elapsed = now_usec() - start;
+    int blocks = Loop * M_SCAN_BLOCKS;
+    printf("%-10s txs/block=%d blocks=%d  %8.1f blocks/s  %10.1f txs/s  avg=%8.1fms/block  fail=%d\n",
+                pName, mScanTxs, blocks, blocks * 1000000.0 / elapsed,
+                (double)blocks * mScanTxs * 1000000.0 / elapsed, elapsed / blocks / 1000.0, fail);
+    utl_buf_free(&vout[0]);
+}
+
+
+static int cmp_double(const void *pA, const void *pB)
+{
+    double a = *(const double *)pA;
+    double b = *(const double *)pB;
+    return (a > b) - (a < b);
+}
+
+
+static void bench_run(const char *pName, int Threads, int Calls)
+{
+    pthread_t th[64];
+    bench_thread_t param[64];
+    double *p_lat = (double *)malloc(sizeof(double) * Threads * Calls);
+    int fail = 0;
+
+    double start = now_usec();
+    for (int lp = 0; lp < Threads; lp++) {
+        param[lp].calls = Calls;
+        param[lp].p_lat = p_lat + lp * Calls;
+        param[lp].fail = 0;
+        pthread_create(&th[lp], NULL, bench_thread, &param[lp]);
+    }
+    for (int lp = 0; lp < Threads; lp++) {
+        pthread_join(th[lp], NULL);
+        fail += param[lp].fail;
+    }
+    double elapsed = now_usec() - start;
+
+    int total = Threads * Calls;
+    qsort(p_lat, total, sizeof(double), cmp_double);
+    double calls_per_sec = (double)total * 1000000.0 / elapsed;
+    printf("%-10s threads=%2d calls=%6d  %10.1f calls/s", pName, Threads, total, calls_per_sec);
+    printf("  p50=%8.1fus  p99=%8.1fus  fail=%d\n",
+                p_lat[total / 2], p_lat[(total * 99) / 100], fail);
+    free(p_lat);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int calls = M_CALLS_DEFAULT;
+    int scan_txs = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:cs:")) != -1) {
+        switch (opt) {
+        case 'n':
+            calls = atoi(optarg);
+            break;
+        case 'd':
+            mDelayUsec = atoi(optarg);
+            break;
+        case 'c':
+            mCloseEach = true;
+            break;
+        case 's':
+            scan_txs = atoi(optarg);
+            if (scan_txs <= 0) {
+                scan_txs = M_SCAN_TXS_DEFAULT;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n calls/thread] [-d server delay(usec)] [-c] [-s txs/block]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (calls <= 0) {
+        calls = M_CALLS_DEFAULT;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    if (!mock_start()) {
+        fprintf(stderr, "fail: mock server\n");
+        return -1;
+    }
+
+    rpc_conf_t conf;
+    memset(&conf, 0, sizeof(conf));
+    strcpy(conf.rpcuser, "user");
+    strcpy(conf.rpcpasswd, "pass");
+    strcpy(conf.rpcurl, "http://127.0.0.1");
+    conf.rpcport = mPort;
+    if (!btcrpc_init(&conf)) {
+        fprintf(stderr, "fail: btcrpc_init\n");
+        return -1;
+    }
+
+    printf("mock bitcoind: port=%d delay=%dus connection=%s\n",
+                mPort, mDelayUsec, (mCloseEach) ? "close" : "keep-alive");
+    if (scan_txs > 0) {
+        scan_setup(scan_txs);
+        scan_run("rawblock", true, 3);
+        scan_run("per-tx", false, 3);
+        btcrpc_term();
+        return 0;
+    }
+    const int THREADS[] = { 1, 4, 8 };
+    for (size_t lp = 0; lp < sizeof(THREADS) / sizeof(THREADS[0]); lp++) {
+        bench_run("single", THREADS[lp], calls);
+    }
+
+    btcrpc_term();
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_chachapoly.c
+ *  @brief  ChaCha20-Poly1305 benchmark
+ *
+ *  64byte, 1KB, 64KB(65535byte)のmessageをChaCha20-Poly1305で暗号化し、1秒あたりのmessage数とbyte数を出力する。
+ *  mbedtls_chachapoly_encrypt_and_tag() と、#btc_chachapoly_encrypt() の各backend(CPUが対応しているもの)を比較する。
+ *  計測前に、全backendの暗号文とtagがmbedtlsと一致することを確認する。
+ *
+ *      usage: bench_chachapoly [-m MB(message長毎の暗号化量)]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mbedtls/chachapoly.h"
+
+#include "btc_chachapoly.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_MBYTES_DEFAULT    (256)           ///< message長毎の暗号化量(MB)
+#define M_SZ_MAX            (UINT16_MAX)    ///< BOLT#8の最大message長
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static const uint32_t M_LENS[] = { 64, 1024, M_SZ_MAX };
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/** nonceの先頭4byteをmessage番号にする(BOLT#8と同じくnonceはmessage毎に変わる)
+ */
+static void set_nonce(uint8_t *pNonce, uint32_t Num)
+{
+    memset(pNonce, 0, BTC_SZ_CHACHA20_NONCE);
+    memcpy(pNonce + 4, &Num, sizeof(Num));
+}
+
+
+/** 全backendとmbedtlsの結果が一致するか
+ */
+static bool verify(const uint8_t *pKey, const uint8_t *pData, uint8_t *pOut, uint8_t *pRef)
+{
+    mbedtls_chachapoly_context ctx;
+    btc_chachapoly_t btc_ctx;
+    uint8_t nonce[BTC_SZ_CHACHA20_NONCE];
+    uint8_t tag_ref[BTC_SZ_POLY1305_TAG];
+    uint8_t tag[BTC_SZ_POLY1305_TAG];
+    bool ret = true;
+
+    mbedtls_chachapoly_init(&ctx);
+    mbedtls_chachapoly_setkey(&ctx, pKey);
+    btc_chachapoly_setkey(&btc_ctx, pKey);
+    for (uint32_t len = 0; len <= 2048 + 64; len++) {
+        set_nonce(nonce, len);
+        mbedtls_chachapoly_encrypt_and_tag(&ctx, len, nonce, NULL, 0, pData, pRef, tag_ref);
+        for (int backend = 0; backend < BTC_CHACHAPOLY_BACKEND_NUM; backend++) {
+            if (!btc_chachapoly_backend_set((btc_chachapoly_backend_t)backend)) {
+                continue;
+            }
+            btc_chachapoly_encrypt(&btc_ctx, nonce, NULL, 0, pData, len, pOut, tag);
+            if ((memcmp(pRef, pOut, len) != 0) || (memcmp(tag_ref, tag, sizeof(tag)) != 0)) {
+                fprintf(stderr, "fail: %s len=%u\n", btc_chachapoly_backend_str((btc_chachapoly_backend_t)backend), len);
+                ret = false;
+            }
+        }
+    }
+    mbedtls_chachapoly_free(&ctx);
+    return ret;
+}
+
+
+static void print_result(const char *pName, uint32_t Len, uint32_t Msgs, double Elapsed)
+{
+    printf("  %-8s len=%5u: msgs/sec=%10.0f MB/sec=%8.1f\n",
+        pName, Len,
+        (double)Msgs * 1000000.0 / Elapsed,
+        (double)Msgs * Len / Elapsed);
+}
+
+
+/** 計測
+ *
+ * @param[in]       MBytes          message長毎の暗号化量(MB)
+ */
+static void bench_run(int MBytes)
+{
+    uint8_t key[BTC_SZ_CHACHA20_KEY];
+    uint8_t nonce[BTC_SZ_CHACHA20_NONCE];
+    uint8_t tag[BTC_SZ_POLY1305_TAG];
+    uint8_t *p_data = (uint8_t *)malloc(M_SZ_MAX);
+    uint8_t *p_out = (uint8_t *)malloc(M_SZ_MAX);
+    uint8_t *p_ref = (uint8_t *)malloc(M_SZ_MAX);
+    uint8_t check = 0;
+
+    for (int lp = 0; lp < BTC_SZ_CHACHA20_KEY; lp++) {
+        key[lp] = (uint8_t)(0x80 + lp);
+    }
+    for (uint32_t lp = 0; lp < M_SZ_MAX; lp++) {
+        p_data[lp] = (uint8_t)(lp * 7);
+    }
+    if (!verify(key, p_data, p_out, p_ref)) {
+        goto LABEL_EXIT;
+    }
+
+    printf("MB=%d(message長毎)\n", MBytes);
+    for (size_t idx = 0; idx < sizeof(M_LENS) / sizeof(M_LENS[0]); idx++) {
+        uint32_t len = M_LENS[idx];
+        uint32_t msgs = (uint32_t)(((uint64_t)MBytes * 1024 * 1024 + len - 1) / len);
+
+        //mbedtls
+        mbedtls_chachapoly_context ctx;
+        mbedtls_chachapoly_init(&ctx);
+        mbedtls_chachapoly_setkey(&ctx, key);
+        double start = now_usec();
+        for (uint32_t lp = 0; lp < msgs; lp++) {
+            set_nonce(nonce, lp);
+            mbedtls_chachapoly_encrypt_and_tag(&ctx, len, nonce, NULL, 0, p_data, p_out, tag);
+            check ^= tag[0];
+        }
+        print_result("mbedtls", len, msgs, now_usec() - start);
+        mbedtls_chachapoly_free(&ctx);
+
+        //btc_chachapoly
+        btc_chachapoly_t btc_ctx;
+        btc_chachapoly_setkey(&btc_ctx, key);
+        for (int backend = 0; backend < BTC_CHACHAPOLY_BACKEND_NUM; backend++) {
+            if (!btc_chachapoly_backend_set((btc_chachapoly_backend_t)backend)) {
+                continue;
+            }
+            start = now_usec();
+            for (uint32_t lp = 0; lp < msgs; lp++) {
+                set_nonce(nonce, lp);
+                btc_chachapoly_encrypt(&btc_ctx, nonce, NULL, 0, p_data, len, p_out, tag);
+                check ^= tag[0];
+            }
+            print_result(btc_chachapoly_backend_str((btc_chachapoly_backend_t)backend), len, msgs, now_usec() - start);
+        }
+    }
+    printf("  (check=%02x)\n", check);
+
+LABEL_EXIT:
+    free(p_data);
+    free(p_out);
+    free(p_ref);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int mbytes = M_MBYTES_DEFAULT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        switch (opt) {
+        case 'm':
+            mbytes = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m MB]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (mbytes <= 0) {
+        fprintf(stderr, "MB > 0\n");
+        return -1;
+    }
+
+    //CPUが対応している中で最も速いbackend
+    btc_chachapoly_init();
+    printf("default backend: %s\n", btc_chachapoly_backend_str(btc_chachapoly_backend()));
+
+    bench_run(mbytes);
+    return 0;
+}
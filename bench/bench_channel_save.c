@@ -0,0 +1,211 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_channel_save.c
+ *  @brief  ln_db_channel_save() benchmark
+ *
+ *  有効なHTLC数が0, 1, LN_HTLC_MAXのchannelを、commitment_signed/revoke_and_ack相当の
+ *  更新(commit_num, 1HTLC分のflag)ごとに保存し、saves/sを出力する。
+ *  差分保存と、毎回 ln_db_channel_save_reset()した全項目保存を比較する。
+ *
+ *      usage: bench_channel_save [-n saves] [-d db dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <ftw.h>
+
+#include "btc.h"
+#include "btc_block.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_SAVES_DEFAULT     (2000)          ///< 1条件あたりの保存回数
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb)
+{
+    (void)pStat; (void)Type; (void)pFtwb;
+    return remove(pPath);
+}
+
+
+/** HTLCを持つchannelを作成
+ *
+ * @param[out]      pChannel
+ * @param[in]       HtlcNum         有効にするHTLC数
+ */
+static void channel_create(ln_channel_t *pChannel, int HtlcNum)
+{
+    ln_init(pChannel, NULL, NULL, NULL, NULL);
+    btc_rng_rand(pChannel->channel_id, LN_SZ_CHANNEL_ID);
+    btc_rng_rand(pChannel->peer_node_id, BTC_SZ_PUBKEY);
+    pChannel->status = LN_STATUS_NORMAL_OPE;
+    pChannel->short_channel_id = 0x0000010000020003ULL;
+
+    for (int lp = 0; lp < HtlcNum; lp++) {
+        ln_htlc_t *p_htlc = &pChannel->update_info.htlcs[lp];
+        p_htlc->enabled = true;
+        p_htlc->id = lp;
+        p_htlc->amount_msat = 100000;
+        p_htlc->cltv_expiry = 500 + lp;
+        btc_rng_rand(p_htlc->payment_hash, BTC_SZ_HASH256);
+        btc_rng_rand(p_htlc->remote_sig, LN_SZ_SIGNATURE);
+        utl_buf_alloc(&p_htlc->buf_onion_reason, LN_SZ_ONION_ROUTE);
+        btc_rng_rand(p_htlc->buf_onion_reason.buf, LN_SZ_ONION_ROUTE);
+        utl_buf_alloc(&p_htlc->buf_shared_secret, BTC_SZ_PRIVKEY);
+        btc_rng_rand(p_htlc->buf_shared_secret.buf, BTC_SZ_PRIVKEY);
+    }
+}
+
+
+/** 保存速度計測
+ *
+ * @param[in]       HtlcNum         有効にするHTLC数
+ * @param[in]       Saves           保存回数
+ * @param[in]       bFull           true:毎回全項目保存
+ */
+static void bench_run(int HtlcNum, int Saves, bool bFull)
+{
+    ln_channel_t channel;
+    channel_create(&channel, HtlcNum);
+
+    //初回は全項目保存
+    if (!ln_db_channel_save(&channel)) {
+        fprintf(stderr, "fail: first save\n");
+        ln_term(&channel);
+        return;
+    }
+
+    int fail = 0;
+    double start = now_usec();
+    for (int lp = 0; lp < Saves; lp++) {
+        channel.commit_info_local.commit_num++;
+        channel.commit_info_remote.commit_num++;
+        if (HtlcNum > 0) {
+            channel.update_info.htlcs[lp % HtlcNum].remote_sig[0]++;
+        }
+        if (bFull) {
+            ln_db_channel_save_reset(&channel);
+        }
+        if (!ln_db_channel_save(&channel)) {
+            fail++;
+        }
+    }
+    double elapsed = now_usec() - start;
+
+    printf("htlcs=%2d %-5s saves=%d elapsed=%.0fus saves/s=%.1f avg=%.1fus fail=%d\n",
+        HtlcNum, (bFull) ? "full" : "delta", Saves, elapsed,
+        (double)Saves * 1000000.0 / elapsed, elapsed / Saves, fail);
+
+    ln_db_channel_del(channel.channel_id);
+    ln_term(&channel);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int saves = M_SAVES_DEFAULT;
+    char dir[] = "/tmp/bench_channel_save_XXXXXX";
+    const char *p_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            saves = atoi(optarg);
+            break;
+        case 'd':
+            p_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n saves] [-d db dir]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (saves <= 0) {
+        saves = M_SAVES_DEFAULT;
+    }
+    if (p_dir == NULL) {
+        p_dir = mkdtemp(dir);
+        if (p_dir == NULL) {
+            fprintf(stderr, "fail: mkdtemp\n");
+            return -1;
+        }
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+    ln_genesishash_set(btc_block_get_genesis_hash(BTC_BLOCK_CHAIN_BTCREGTEST));
+    if (!ln_lmdb_set_home_dir(p_dir)) {
+        fprintf(stderr, "fail: db dir\n");
+        return -1;
+    }
+
+    char wif[BTC_SZ_WIF_STR_MAX + 1] = "";
+    char alias[LN_SZ_ALIAS_STR + 1] = "bench";
+    uint16_t port = 0;
+    if (!ln_db_init(wif, alias, &port, false)) {
+        fprintf(stderr, "fail: ln_db_init\n");
+        return -1;
+    }
+
+    printf("db: %s\n", p_dir);
+    const int HTLCS[] = { 0, 1, LN_HTLC_MAX };
+    for (size_t lp = 0; lp < ARRAY_SIZE(HTLCS); lp++) {
+        bench_run(HTLCS[lp], saves, true);
+        bench_run(HTLCS[lp], saves, false);
+    }
+
+    ln_db_term();
+    btc_term();
+    if (p_dir == dir) {
+        nftw(dir, rm_files, 10, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    }
+    return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_commit_htlc.c
+ *  @brief  commitment_signed HTLC signature benchmark
+ *
+ *  HTLC数1, 6, 12のcommit_txについて、commitment_signed 1回分の署名・検証時間を出力する。
+ *      - 送信側: commit_txの署名 + HTLCごとにHTLC tx作成・署名(create_remote_sign_htlcs())
+ *      - 受信側: commit_txの検証 + HTLCごとにHTLC tx作成・検証(create_local_verify_htlcs())
+ *  HTLCごとの処理は#ln_crypto_pool_run()で行い、thread数1(#ln_crypto_pool_start()しない)と
+ *  4(worker 3 + 呼び出し元)を比較する。
+ *  thread数によらず同じ署名になることも確認する。
+ *
+ *      usage: bench_commit_htlc [-n loops] [-w threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "btc.h"
+#include "btc_crypto.h"
+#include "btc_keys.h"
+#include "btc_sig.h"
+#include "btc_sw.h"
+
+#include "ln.h"
+#include "ln_script.h"
+#include "ln_htlc_tx.h"
+#include "ln_crypto_pool.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_LOOPS_DEFAULT     (200)           ///< commitment_signedの繰り返し回数
+#define M_HTLC_MAX          (12)            ///< 計測する最大HTLC数
+#define M_HTLC_FEE          (700)           ///< HTLC txのfee
+#define M_TO_SELF_DELAY     (144)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct htlc_job_t
+ *  @brief  HTLC 1つ分の署名・検証
+ */
+typedef struct {
+    uint32_t                    vout_idx;
+    ln_commit_tx_output_type_t  type;
+    uint32_t                    cltv_expiry;
+    uint8_t                     sig[LN_SZ_SIGNATURE];
+} htlc_job_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static btc_keys_t       mHtlcKey;           ///< HTLC署名鍵(送信側)
+static uint8_t          mFundPriv[BTC_SZ_PRIVKEY];
+static uint8_t          mFundPub[BTC_SZ_PUBKEY];
+static utl_buf_t        mWitToLocal = UTL_BUF_INIT;
+static utl_buf_t        mWitHtlc[M_HTLC_MAX];
+static btc_tx_t         mTxCommit = BTC_TX_INIT;
+static uint8_t          mTxid[BTC_SZ_TXID];
+static htlc_job_t       mJobs[M_HTLC_MAX];
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static void create_key(uint8_t *pPriv, uint8_t *pPub)
+{
+    do {
+        btc_rng_rand(pPriv, BTC_SZ_PRIVKEY);
+    } while (!btc_keys_check_priv(pPriv));
+    btc_keys_priv2pub(pPub, pPriv);
+}
+
+
+/** 計測用commit_tx作成
+ *
+ * vout[0]はto_local、以降はoffered/receivedを交互にしたHTLC。
+ */
+static bool create_commit_tx(int Htlcs)
+{
+    uint8_t local_htlc[BTC_SZ_PUBKEY];
+    uint8_t revo[BTC_SZ_PUBKEY];
+    uint8_t delayed[BTC_SZ_PUBKEY];
+    uint8_t priv[BTC_SZ_PRIVKEY];
+    uint8_t fund_txid[BTC_SZ_TXID];
+
+    create_key(priv, local_htlc);
+    create_key(priv, revo);
+    create_key(priv, delayed);
+    btc_rng_rand(fund_txid, sizeof(fund_txid));
+
+    btc_tx_free(&mTxCommit);
+    utl_buf_free(&mWitToLocal);
+    if (!ln_script_create_to_local(&mWitToLocal, revo, delayed, M_TO_SELF_DELAY)) return false;
+
+    btc_tx_add_vin(&mTxCommit, fund_txid, 0);
+    if (!btc_sw_add_vout_p2wsh_wit(&mTxCommit, 1000000, &mWitToLocal)) return false;
+    for (int lp = 0; lp < Htlcs; lp++) {
+        uint8_t payment_hash[BTC_SZ_HASH256];
+        btc_rng_rand(payment_hash, sizeof(payment_hash));
+
+        htlc_job_t *p_job = &mJobs[lp];
+        p_job->vout_idx = (uint32_t)(lp + 1);
+        p_job->type = (lp & 1) ? LN_COMMIT_TX_OUTPUT_TYPE_RECEIVED : LN_COMMIT_TX_OUTPUT_TYPE_OFFERED;
+        p_job->cltv_expiry = 600000 + lp;
+        utl_buf_free(&mWitHtlc[lp]);
+        if (!ln_script_create_htlc(
+            &mWitHtlc[lp], p_job->type, local_htlc, revo, mHtlcKey.pub,
+            payment_hash, p_job->cltv_expiry)) return false;
+        if (!btc_sw_add_vout_p2wsh_wit(&mTxCommit, 100000 + lp, &mWitHtlc[lp])) return false;
+    }
+    return btc_tx_txid(&mTxCommit, mTxid);
+}
+
+
+/** HTLC tx作成(ln_commit_tx.cと同じ)
+ *
+ */
+static bool create_htlc_tx(btc_tx_t *pTx, const htlc_job_t *pJob)
+{
+    return ln_htlc_tx_create(
+        pTx, mTxCommit.vout[pJob->vout_idx].value - M_HTLC_FEE, &mWitToLocal,
+        pJob->type, pJob->cltv_expiry, mTxid, pJob->vout_idx);
+}
+
+
+static bool job_sign(void *pJob)
+{
+    htlc_job_t *p_job = (htlc_job_t *)pJob;
+    int idx = (int)p_job->vout_idx - 1;
+
+    btc_tx_t tx = BTC_TX_INIT;
+    bool ret = create_htlc_tx(&tx, p_job) &&
+        ln_htlc_tx_sign_rs(&tx, p_job->sig, mTxCommit.vout[p_job->vout_idx].value, &mHtlcKey, &mWitHtlc[idx]);
+    btc_tx_free(&tx);
+    return ret;
+}
+
+
+static bool job_verify(void *pJob)
+{
+    htlc_job_t *p_job = (htlc_job_t *)pJob;
+    int idx = (int)p_job->vout_idx - 1;
+
+    btc_tx_t tx = BTC_TX_INIT;
+    utl_buf_t buf_sig = UTL_BUF_INIT;
+    bool ret = create_htlc_tx(&tx, p_job) &&
+        btc_sig_rs2der(&buf_sig, p_job->sig) &&
+        ln_htlc_tx_verify(
+            &tx, mTxCommit.vout[p_job->vout_idx].value, NULL, NULL, mHtlcKey.pub,
+            &buf_sig, &mWitHtlc[idx]);
+    utl_buf_free(&buf_sig);
+    btc_tx_free(&tx);
+    return ret;
+}
+
+
+/** commitment_signed 1回分
+ *
+ * commit_txの署名はsighashの代わりにtxidに対して行う(HTLC数によらず1回)。
+ *
+ * @param[in]       Htlcs       HTLC数
+ * @param[out]      pSignUsec   送信側の処理時間
+ * @param[out]      pVerifyUsec 受信側の処理時間
+ */
+static bool commitment_signed(int Htlcs, double *pSignUsec, double *pVerifyUsec)
+{
+    uint8_t commit_sig[LN_SZ_SIGNATURE];
+
+    double t0 = now_usec();
+    if (!btc_sig_sign_rs(commit_sig, mTxid, mFundPriv)) return false;
+    if (!ln_crypto_pool_run(job_sign, mJobs, sizeof(htlc_job_t), Htlcs)) return false;
+    double t1 = now_usec();
+    if (!btc_sig_verify_rs(commit_sig, mTxid, mFundPub)) return false;
+    if (!ln_crypto_pool_run(job_verify, mJobs, sizeof(htlc_job_t), Htlcs)) return false;
+    double t2 = now_usec();
+
+    *pSignUsec += t1 - t0;
+    *pVerifyUsec += t2 - t1;
+    return true;
+}
+
+
+/** 計測
+ *
+ * @param[in]       Htlcs       HTLC数
+ * @param[in]       Threads     thread数(1: #ln_crypto_pool_start()しない)
+ * @param[in]       Loops       繰り返し回数
+ * @param[in,out]   pSigs       最初の計測で作成したHTLC署名(比較用)
+ * @param[in,out]   pRef        true: pSigs設定済み
+ */
+static bool bench_run(int Htlcs, int Threads, int Loops, uint8_t (*pSigs)[LN_SZ_SIGNATURE], bool *pRef)
+{
+    if (Threads > 1) {
+        //呼び出し元threadも処理する
+        if (!ln_crypto_pool_start(Threads - 1)) return false;
+    }
+
+    double sign_usec = 0;
+    double verify_usec = 0;
+    bool ret = true;
+    for (int lp = 0; lp < Loops; lp++) {
+        if (!commitment_signed(Htlcs, &sign_usec, &verify_usec)) {
+            fprintf(stderr, "fail: commitment_signed\n");
+            ret = false;
+            break;
+        }
+    }
+    ln_crypto_pool_stop();
+    if (!ret) return false;
+
+    //同じcommit_txならthread数によらず同じ署名になる
+    bool same = true;
+    for (int lp = 0; lp < Htlcs; lp++) {
+        if (!*pRef) {
+            memcpy(pSigs[lp], mJobs[lp].sig, LN_SZ_SIGNATURE);
+        } else if (memcmp(pSigs[lp], mJobs[lp].sig, LN_SZ_SIGNATURE) != 0) {
+            same = false;
+        }
+    }
+    *pRef = true;
+    printf("htlcs=%2d threads=%d: sign=%8.1f usec verify=%8.1f usec total=%8.1f usec%s\n",
+        Htlcs, Threads, sign_usec / Loops, verify_usec / Loops,
+        (sign_usec + verify_usec) / Loops, same ? "" : " (signature mismatch)");
+    return same;
+}
+
+
+/********************************************************************
+ * main entry
+ ********************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int loops = M_LOOPS_DEFAULT;
+    int threads = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+        switch (opt) {
+        case 'n':
+            loops = atoi(optarg);
+            break;
+        case 'w':
+            threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n loops] [-w threads]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (loops <= 0) {
+        loops = M_LOOPS_DEFAULT;
+    }
+    if (threads > LN_CRYPTO_POOL_WORKERS_MAX + 1) {
+        fprintf(stderr, "threads <= %d\n", LN_CRYPTO_POOL_WORKERS_MAX + 1);
+        return -1;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCMAIN, true);
+    create_key(mHtlcKey.priv, mHtlcKey.pub);
+    create_key(mFundPriv, mFundPub);
+
+    int result = 0;
+    const int HTLCS[] = { 1, 6, M_HTLC_MAX };
+    for (size_t lp = 0; lp < ARRAY_SIZE(HTLCS); lp++) {
+        uint8_t sigs[M_HTLC_MAX][LN_SZ_SIGNATURE];
+        bool ref = false;
+
+        if (!create_commit_tx(HTLCS[lp])) {
+            fprintf(stderr, "fail: create commit_tx\n");
+            result = -1;
+            break;
+        }
+        if (threads > 0) {
+            if (!bench_run(HTLCS[lp], threads, loops, sigs, &ref)) result = -1;
+        } else {
+            const int THREADS[] = { 1, 4 };
+            for (size_t lp2 = 0; lp2 < ARRAY_SIZE(THREADS); lp2++) {
+                if (!bench_run(HTLCS[lp], THREADS[lp2], loops, sigs, &ref)) result = -1;
+            }
+        }
+    }
+
+    for (int lp = 0; lp < M_HTLC_MAX; lp++) {
+        utl_buf_free(&mWitHtlc[lp]);
+    }
+    utl_buf_free(&mWitToLocal);
+    btc_tx_free(&mTxCommit);
+    btc_term();
+    return result;
+}
@@ -0,0 +1,288 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_gossip.c
+ *  @brief  gossip log initial sync benchmark
+ *
+ *  channel_announcement, channel_update(dir=0,1), node_announcementをannouncement DBに保存し
+ *  (保存時にgossip logへ追加される)、
+ *  10, 100, 1000の模擬peerが同時に先頭から末尾まで#ln_gossip_next()で取得するまでの時間を出力する。
+ *  packetは#ln_gossip_next()がDBから読み込む。peerへの送信は行わない(取得したpacketを解放するだけ)。
+ *
+ *      usage: bench_gossip [-c channels] [-p peers] [-d db dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <ftw.h>
+#include <pthread.h>
+
+#include "btc.h"
+#include "btc_block.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+#include "ln_gossip.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CHANNELS_DEFAULT  (10000)         ///< channel数
+#define M_STACK_SIZE        (64 * 1024)     ///< 模擬peer threadのstack size
+
+#define M_SZ_CNLANNO        (432)           ///< channel_announcement(features無し)
+#define M_SZ_CNLUPD         (130)           ///< channel_update(htlc_maximum_msatあり)
+#define M_SZ_NODEANNO       (150)           ///< node_announcement(IPv4 address 1つ)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+typedef struct {
+    pthread_t       th;
+    uint8_t         node_id[BTC_SZ_PUBKEY];
+    uint32_t        msgs;
+    double          elapsed;
+} peer_t;
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb)
+{
+    (void)pStat; (void)Type; (void)pFtwb;
+    return remove(pPath);
+}
+
+
+static void packet_add(utl_buf_t *pBuf, uint32_t Len)
+{
+    utl_buf_alloc(pBuf, Len);
+    btc_rng_rand(pBuf->buf, Len);
+}
+
+
+/** announcement DB(gossip log)作成
+ *
+ * node数はchannel数の半分とし、隣接nodeどうしでchannelを張る。
+ * packetの中身は乱数で、DB保存に必要な項目だけを引数で渡す。
+ *
+ * @param[in]       Channels        channel数
+ */
+static void log_create(int Channels)
+{
+    int nodes = Channels / 2 + 2;
+    uint8_t (*p_node_ids)[BTC_SZ_PUBKEY] = (uint8_t (*)[BTC_SZ_PUBKEY])malloc(nodes * BTC_SZ_PUBKEY);
+    btc_rng_rand((uint8_t *)p_node_ids, nodes * BTC_SZ_PUBKEY);
+
+    uint8_t send_id[BTC_SZ_PUBKEY];
+    btc_rng_rand(send_id, sizeof(send_id));
+
+    utl_buf_t buf = UTL_BUF_INIT;
+    ln_msg_channel_update_t upd;
+    memset(&upd, 0, sizeof(upd));
+    upd.timestamp = (uint32_t)time(NULL);
+    for (int lp = 0; lp < Channels; lp++) {
+        uint64_t short_channel_id = ((uint64_t)(100 + lp) << 40) | 0x0000010000ULL;
+        int node1 = lp % nodes;
+        int node2 = (lp + 1) % nodes;
+
+        packet_add(&buf, M_SZ_CNLANNO);
+        (void)ln_db_cnlanno_save(&buf, short_channel_id, send_id, p_node_ids[node1], p_node_ids[node2]);
+        utl_buf_free(&buf);
+        upd.short_channel_id = short_channel_id;
+        for (uint8_t dir = 0; dir < 2; dir++) {
+            packet_add(&buf, M_SZ_CNLUPD);
+            upd.channel_flags = dir;
+            (void)ln_db_cnlupd_save(&buf, &upd, send_id);
+            utl_buf_free(&buf);
+        }
+    }
+    ln_msg_node_announcement_t anno;
+    memset(&anno, 0, sizeof(anno));
+    anno.timestamp = (uint32_t)time(NULL);
+    for (int lp = 0; lp < nodes; lp++) {
+        packet_add(&buf, M_SZ_NODEANNO);
+        anno.p_node_id = p_node_ids[lp];
+        (void)ln_db_nodeanno_save(&buf, &anno, send_id);
+        utl_buf_free(&buf);
+    }
+    free(p_node_ids);
+}
+
+
+static void *thread_peer(void *pArg)
+{
+    peer_t *p_peer = (peer_t *)pArg;
+    uint64_t cursor = LN_GOSSIP_CURSOR_INIT;
+    ln_gossip_entry_t entry;
+
+    double start = now_usec();
+    while (ln_gossip_next(&entry, &cursor, p_peer->node_id)) {
+        p_peer->msgs++;
+        utl_buf_free(&entry.buf);
+    }
+    p_peer->elapsed = now_usec() - start;
+    return NULL;
+}
+
+
+/** 初期同期時間計測
+ *
+ * @param[in]       Peers           同時に同期するpeer数
+ */
+static void bench_run(int Peers)
+{
+    peer_t *p_peers = (peer_t *)calloc(Peers, sizeof(peer_t));
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, M_STACK_SIZE);
+
+    int started = 0;
+    double start = now_usec();
+    for (int lp = 0; lp < Peers; lp++) {
+        btc_rng_rand(p_peers[lp].node_id, BTC_SZ_PUBKEY);
+        if (pthread_create(&p_peers[lp].th, &attr, thread_peer, &p_peers[lp]) != 0) {
+            fprintf(stderr, "fail: pthread_create(%d)\n", lp);
+            break;
+        }
+        started++;
+    }
+    uint64_t msgs = 0;
+    double max = 0.0;
+    double sum = 0.0;
+    for (int lp = 0; lp < started; lp++) {
+        pthread_join(p_peers[lp].th, NULL);
+        msgs += p_peers[lp].msgs;
+        sum += p_peers[lp].elapsed;
+        if (max < p_peers[lp].elapsed) {
+            max = p_peers[lp].elapsed;
+        }
+    }
+    double elapsed = now_usec() - start;
+    pthread_attr_destroy(&attr);
+
+    if (started > 0) {
+        printf("peers=%4d msgs/peer=%u elapsed=%.0fus msgs/s=%.1f peer sync avg=%.0fus max=%.0fus\n",
+            started, p_peers[0].msgs, elapsed,
+            (double)msgs * 1000000.0 / elapsed, sum / started, max);
+    }
+    free(p_peers);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int channels = M_CHANNELS_DEFAULT;
+    int peers = 0;
+    char dir[] = "/tmp/bench_gossip_XXXXXX";
+    const char *p_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:p:d:")) != -1) {
+        switch (opt) {
+        case 'c':
+            channels = atoi(optarg);
+            break;
+        case 'p':
+            peers = atoi(optarg);
+            break;
+        case 'd':
+            p_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c channels] [-p peers] [-d db dir]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (channels <= 0) {
+        channels = M_CHANNELS_DEFAULT;
+    }
+
+    if (p_dir == NULL) {
+        p_dir = mkdtemp(dir);
+        if (p_dir == NULL) {
+            fprintf(stderr, "fail: mkdtemp\n");
+            return -1;
+        }
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+    ln_genesishash_set(btc_block_get_genesis_hash(BTC_BLOCK_CHAIN_BTCREGTEST));
+    if (!ln_lmdb_set_home_dir(p_dir)) {
+        fprintf(stderr, "fail: db dir\n");
+        return -1;
+    }
+
+    char wif[BTC_SZ_WIF_STR_MAX + 1] = "";
+    char alias[LN_SZ_ALIAS_STR + 1] = "bench";
+    uint16_t port = 0;
+    if (!ln_db_init(wif, alias, &port, false)) {
+        fprintf(stderr, "fail: ln_db_init\n");
+        return -1;
+    }
+    printf("db: %s\n", p_dir);
+
+    double start = now_usec();
+    log_create(channels);
+    printf("channels=%d log tail=%" PRIu64 " create=%.0fus\n", channels, ln_gossip_tail(), now_usec() - start);
+
+    if (peers > 0) {
+        bench_run(peers);
+    } else {
+        const int PEERS[] = { 10, 100, 1000 };
+        for (size_t lp = 0; lp < ARRAY_SIZE(PEERS); lp++) {
+            bench_run(PEERS[lp]);
+        }
+    }
+
+    ln_gossip_term();
+    ln_db_term();
+    btc_term();
+    if (p_dir == dir) {
+        nftw(dir, rm_files, 10, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    }
+    return 0;
+}
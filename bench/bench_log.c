@@ -0,0 +1,187 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_log.c
+ *  @brief  utl_log throughput benchmark
+ *
+ *  1, 8, 64threadから同時にLOGD()を呼び出し、1秒あたりの出力行数を出力する。
+ *  計測は#utl_log_term()で全行を書き込み終わるまでを含み、最後にlog fileの行数と照合する。
+ *  log fileは一時directoryに作成し、終了時に削除する(rotationも発生する)。
+ *
+ *      usage: bench_log [-n lines] [-t threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define LOG_TAG     "bench"
+#include "utl_log.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_LINES_DEFAULT     (100000)        ///< 全threadで出力する行数(rotationで消えない量)
+#define M_THREADS_MAX       (256)
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static void *writer(void *pArg)
+{
+    int lines = *(int *)pArg;
+    for (int lp = 0; lp < lines; lp++) {
+        LOGD("short_channel_id=%016" PRIx64 ", amount_msat=%" PRIu64 ", line=%d\n",
+            (uint64_t)0x0000010000020003ULL, (uint64_t)100000 + lp, lp);
+    }
+    return NULL;
+}
+
+
+/** log directoryの行数(rotationしたfileを含む)
+ *
+ */
+static long count_lines(void)
+{
+    long lines = 0;
+    for (int lp = -1; lp < UTL_LOG_MAX; lp++) {
+        char fname[64];
+        if (lp < 0) {
+            snprintf(fname, sizeof(fname), "%s", UTL_LOG_NAME);
+        } else {
+            snprintf(fname, sizeof(fname), "%s.%d", UTL_LOG_NAME, lp);
+        }
+        FILE *fp = fopen(fname, "r");
+        if (fp == NULL) {
+            continue;
+        }
+        int c;
+        while ((c = fgetc(fp)) != EOF) {
+            if (c == '\n') {
+                lines++;
+            }
+        }
+        fclose(fp);
+        remove(fname);
+    }
+    return lines;
+}
+
+
+/** 出力時間計測
+ *
+ * @param[in]       Threads         thread数
+ * @param[in]       Lines           全threadの出力行数
+ */
+static void bench_run(int Threads, int Lines)
+{
+    pthread_t th[M_THREADS_MAX];
+    int lines = Lines / Threads;
+
+    utl_log_init();
+
+    double start = now_usec();
+    for (int lp = 0; lp < Threads; lp++) {
+        pthread_create(&th[lp], NULL, writer, &lines);
+    }
+    for (int lp = 0; lp < Threads; lp++) {
+        pthread_join(th[lp], NULL);
+    }
+    double logged = now_usec() - start;
+    utl_log_term();
+    double elapsed = now_usec() - start;
+
+    //START, stopの2行を除く
+    long written = count_lines() - 2;
+    long expected = (long)lines * Threads;
+    printf("threads=%2d lines=%ld elapsed=%.0fus (caller %.0fus) lines/sec=%.0f written=%ld%s\n",
+        Threads, expected, elapsed, logged, expected * 1000000.0 / elapsed,
+        written, (written == expected) ? "" : " NG");
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int lines = M_LINES_DEFAULT;
+    int threads = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n':
+            lines = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n lines] [-t threads]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (lines <= 0) {
+        lines = M_LINES_DEFAULT;
+    }
+    if (threads > M_THREADS_MAX) {
+        fprintf(stderr, "threads <= %d\n", M_THREADS_MAX);
+        return -1;
+    }
+
+    char dir[] = "/tmp/bench_log_XXXXXX";
+    if ((mkdtemp(dir) == NULL) || (chdir(dir) != 0)) {
+        fprintf(stderr, "fail: mkdtemp\n");
+        return -1;
+    }
+
+    if (threads > 0) {
+        bench_run(threads, lines);
+    } else {
+        const int THREADS[] = { 1, 8, 64 };
+        for (size_t lp = 0; lp < sizeof(THREADS) / sizeof(THREADS[0]); lp++) {
+            bench_run(THREADS[lp], lines);
+        }
+    }
+
+    rmdir(UTL_LOG_DIR);
+    rmdir(dir);
+    return 0;
+}
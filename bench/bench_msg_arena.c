@@ -0,0 +1,383 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_msg_arena.c
+ *  @brief  message receive/send allocation benchmark
+ *
+ *  channel_update:update_add_htlc:commitment_signed = 7:2:1 のmessage列(default: 1,000,000個)を
+ *  noise暗号化 → 復号 → decodeして、1秒あたりのmessage数とmessageあたりのmalloc回数を出力する。
+ *  送受信バッファをmessage毎にmalloc/freeする場合と、#utl_arena_t から確保してmessage毎にresetする場合を比較する。
+ *  malloc回数はリンク時の--wrap=mallocで数える(libln/libbtc/libutlからの呼び出しを含む)。
+ *
+ *      usage: bench_msg_arena [-n messages]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "utl_int.h"
+#include "utl_arena.h"
+
+#include "btc.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_noise.h"
+#include "ln_msg.h"
+#include "ln_msg_anno.h"
+#include "ln_msg_normalope.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_MESSAGES_DEFAULT  (1000000)       ///< replayするmessage数
+#define M_HTLCS             (5)             ///< commitment_signedのHTLC数
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+void *__real_malloc(size_t Size);
+void *__real_calloc(size_t Block, size_t Size);
+void *__real_realloc(void *pBuf, size_t Size);
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static uint64_t mMallocCnt;         ///< malloc/calloc/realloc回数
+
+static utl_buf_t mMsgs[3];          ///< channel_update, update_add_htlc, commitment_signed
+
+
+/**************************************************************************
+ * malloc hook(-Wl,--wrap)
+ **************************************************************************/
+
+void *__wrap_malloc(size_t Size)
+{
+    mMallocCnt++;
+    return __real_malloc(Size);
+}
+
+
+void *__wrap_calloc(size_t Block, size_t Size)
+{
+    mMallocCnt++;
+    return __real_calloc(Block, Size);
+}
+
+
+void *__wrap_realloc(void *pBuf, size_t Size)
+{
+    mMallocCnt++;
+    return __real_realloc(pBuf, Size);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/** 送信側・受信側のnoise鍵設定
+ *
+ * BOLT#8 test vectorの鍵を使う。
+ */
+static void noise_setup(ln_noise_t *pSend, ln_noise_t *pRecv)
+{
+    const uint8_t SK[] = {
+        0x96, 0x9a, 0xb3, 0x1b, 0x4d, 0x28, 0x8c, 0xed,
+        0xf6, 0x21, 0x88, 0x39, 0xb2, 0x7a, 0x3e, 0x21,
+        0x40, 0x82, 0x70, 0x47, 0xf2, 0xc0, 0xf0, 0x1b,
+        0xf5, 0xc0, 0x44, 0x35, 0xd4, 0x35, 0x11, 0xa9,
+    };
+    const uint8_t CK[] = {
+        0x91, 0x92, 0x19, 0xdb, 0xb2, 0x92, 0x0a, 0xfa,
+        0x8d, 0xb8, 0x0f, 0x9a, 0x51, 0x78, 0x7a, 0x84,
+        0x0b, 0xcf, 0x11, 0x1e, 0xd8, 0xd5, 0x88, 0xca,
+        0xf9, 0xab, 0x4b, 0xe7, 0x16, 0xe4, 0x2b, 0x01,
+    };
+
+    memset(pSend, 0, sizeof(ln_noise_t));
+    memset(pRecv, 0, sizeof(ln_noise_t));
+    memcpy(pSend->send_ctx.key, SK, sizeof(SK));
+    memcpy(pSend->send_ctx.ck, CK, sizeof(CK));
+    memcpy(pRecv->recv_ctx.key, SK, sizeof(SK));
+    memcpy(pRecv->recv_ctx.ck, CK, sizeof(CK));
+    ln_noise_cipher_init(pSend);
+    ln_noise_cipher_init(pRecv);
+}
+
+
+/** replayするmessage作成
+ */
+static bool create_msgs(void)
+{
+    uint8_t channel_id[LN_SZ_CHANNEL_ID];
+    uint8_t chain_hash[BTC_SZ_HASH256];
+    uint8_t sig[LN_SZ_SIGNATURE];
+    uint8_t payment_hash[BTC_SZ_HASH256];
+    uint8_t onion[LN_SZ_ONION_ROUTE];
+    uint8_t htlc_sigs[LN_SZ_SIGNATURE * M_HTLCS];
+
+    btc_rng_rand(channel_id, sizeof(channel_id));
+    btc_rng_rand(chain_hash, sizeof(chain_hash));
+    btc_rng_rand(sig, sizeof(sig));
+    btc_rng_rand(payment_hash, sizeof(payment_hash));
+    btc_rng_rand(onion, sizeof(onion));
+    btc_rng_rand(htlc_sigs, sizeof(htlc_sigs));
+
+    ln_msg_channel_update_t upd;
+    upd.p_signature = sig;
+    upd.p_chain_hash = chain_hash;
+    upd.short_channel_id = 0x0000010000020003ULL;
+    upd.timestamp = 1550000000;
+    upd.message_flags = LN_CHANNEL_UPDATE_MSGFLAGS_OPTION_CHANNEL_HTLC_MAX;
+    upd.channel_flags = 0;
+    upd.cltv_expiry_delta = 40;
+    upd.htlc_minimum_msat = 1000;
+    upd.fee_base_msat = 1000;
+    upd.fee_proportional_millionths = 1;
+    upd.htlc_maximum_msat = 1000000000;
+    if (!ln_msg_channel_update_write(&mMsgs[0], &upd)) return false;
+
+    ln_msg_update_add_htlc_t add;
+    add.p_channel_id = channel_id;
+    add.id = 1;
+    add.amount_msat = 100000;
+    add.p_payment_hash = payment_hash;
+    add.cltv_expiry = 600000;
+    add.p_onion_routing_packet = onion;
+    if (!ln_msg_update_add_htlc_write(&mMsgs[1], &add)) return false;
+
+    ln_msg_commitment_signed_t cs;
+    cs.p_channel_id = channel_id;
+    cs.p_signature = sig;
+    cs.num_htlcs = M_HTLCS;
+    cs.p_htlc_signature = htlc_sigs;
+    if (!ln_msg_commitment_signed_write(&mMsgs[2], &cs)) return false;
+    return true;
+}
+
+
+/** 受信messageのdecode
+ */
+static bool decode_msg(const utl_buf_t *pBuf)
+{
+    switch (utl_int_pack_u16be(pBuf->buf)) {
+    case MSGTYPE_CHANNEL_UPDATE:
+        {
+            ln_msg_channel_update_t msg;
+            return ln_msg_channel_update_read(&msg, pBuf->buf, pBuf->len);
+        }
+    case MSGTYPE_UPDATE_ADD_HTLC:
+        {
+            ln_msg_update_add_htlc_t msg;
+            return ln_msg_update_add_htlc_read(&msg, pBuf->buf, pBuf->len);
+        }
+    case MSGTYPE_COMMITMENT_SIGNED:
+        {
+            ln_msg_commitment_signed_t msg;
+            return ln_msg_commitment_signed_read(&msg, pBuf->buf, pBuf->len);
+        }
+    default:
+        return false;
+    }
+}
+
+
+/** replayするmessage(7:2:1)
+ */
+static const utl_buf_t *get_msg(int Index)
+{
+    int idx = Index % 10;
+    if (idx < 7) {
+        return &mMsgs[0];
+    } else if (idx < 9) {
+        return &mMsgs[1];
+    } else {
+        return &mMsgs[2];
+    }
+}
+
+
+/** 1message分の送受信(message毎にmalloc/free)
+ */
+static bool replay_heap(ln_noise_t *pSend, ln_noise_t *pRecv, const utl_buf_t *pMsg)
+{
+    bool ret = false;
+    utl_buf_t buf_enc = UTL_BUF_INIT;
+    utl_buf_t buf_body = UTL_BUF_INIT;
+
+    //send
+    if (!ln_noise_enc(pSend, &buf_enc, pMsg)) goto LABEL_EXIT;
+
+    //recv
+    uint32_t len = ln_noise_dec_len(pRecv, buf_enc.buf, LN_SZ_NOISE_HEADER);
+    if (len == 0) goto LABEL_EXIT;
+    if (!utl_buf_alloccopy(&buf_body, buf_enc.buf + LN_SZ_NOISE_HEADER, len)) goto LABEL_EXIT;
+    if (!ln_noise_dec_msg(pRecv, &buf_body)) goto LABEL_EXIT;
+    ret = decode_msg(&buf_body);
+
+LABEL_EXIT:
+    utl_buf_free(&buf_body);
+    utl_buf_free(&buf_enc);
+    return ret;
+}
+
+
+/** 1message分の送受信(arenaから確保し、message毎にreset)
+ */
+static bool replay_arena(ln_noise_t *pSend, ln_noise_t *pRecv, const utl_buf_t *pMsg,
+    utl_arena_t *pTxArena, utl_arena_t *pRxArena)
+{
+    bool ret = false;
+    utl_buf_t buf_enc = UTL_BUF_INIT;
+    utl_buf_t buf_body = UTL_BUF_INIT;
+
+    //send
+    if (!ln_noise_enc_arena(pSend, &buf_enc, pMsg, pTxArena)) goto LABEL_EXIT;
+
+    //recv
+    uint32_t len = ln_noise_dec_len(pRecv, buf_enc.buf, LN_SZ_NOISE_HEADER);
+    if (len == 0) goto LABEL_EXIT;
+    if (!utl_arena_buf_alloccopy(pRxArena, &buf_body, buf_enc.buf + LN_SZ_NOISE_HEADER, len)) goto LABEL_EXIT;
+    if (!ln_noise_dec_msg(pRecv, &buf_body)) goto LABEL_EXIT;
+    ret = decode_msg(&buf_body);
+
+LABEL_EXIT:
+    utl_arena_reset(pRxArena);
+    utl_arena_reset(pTxArena);
+    return ret;
+}
+
+
+/** 計測
+ *
+ * @param[in]       Messages        replayするmessage数
+ */
+static void bench_run(int Messages)
+{
+    ln_noise_t noise_send;
+    ln_noise_t noise_recv;
+    uint64_t bytes = 0;
+    int fail = 0;
+
+    for (int lp = 0; lp < Messages; lp++) {
+        bytes += get_msg(lp)->len;
+    }
+
+    //message毎にmalloc/free
+    noise_setup(&noise_send, &noise_recv);
+    uint64_t cnt = mMallocCnt;
+    double start = now_usec();
+    for (int lp = 0; lp < Messages; lp++) {
+        if (!replay_heap(&noise_send, &noise_recv, get_msg(lp))) {
+            fail++;
+        }
+    }
+    double elapsed_heap = now_usec() - start;
+    uint64_t malloc_heap = mMallocCnt - cnt;
+
+    //arena
+    utl_arena_t tx_arena;
+    utl_arena_t rx_arena;
+    utl_arena_init(&tx_arena, 4096);
+    utl_arena_init(&rx_arena, 4096);
+    noise_setup(&noise_send, &noise_recv);
+    cnt = mMallocCnt;
+    start = now_usec();
+    for (int lp = 0; lp < Messages; lp++) {
+        if (!replay_arena(&noise_send, &noise_recv, get_msg(lp), &tx_arena, &rx_arena)) {
+            fail++;
+        }
+    }
+    double elapsed_arena = now_usec() - start;
+    uint64_t malloc_arena = mMallocCnt - cnt;
+
+    printf("messages=%d(avg %.0f bytes)\n", Messages, (double)bytes / Messages);
+    printf("  heap  : msgs/sec=%.0f MB/s=%.1f malloc=%" PRIu64 "(%.2f/msg)\n",
+        Messages * 1000000.0 / elapsed_heap, bytes / elapsed_heap,
+        malloc_heap, (double)malloc_heap / Messages);
+    printf("  arena : msgs/sec=%.0f MB/s=%.1f malloc=%" PRIu64 "(%.2f/msg) arena_alloc=%" PRIu32 " chunks=%" PRIu32 "\n",
+        Messages * 1000000.0 / elapsed_arena, bytes / elapsed_arena,
+        malloc_arena, (double)malloc_arena / Messages,
+        tx_arena.alloc_cnt + rx_arena.alloc_cnt, tx_arena.chunk_cnt + rx_arena.chunk_cnt);
+    printf("  fail=%d\n", fail);
+
+    utl_arena_free(&tx_arena);
+    utl_arena_free(&rx_arena);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int messages = M_MESSAGES_DEFAULT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            messages = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n messages]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (messages <= 0) {
+        messages = M_MESSAGES_DEFAULT;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+
+    if (!create_msgs()) {
+        fprintf(stderr, "fail: create messages\n");
+        return -1;
+    }
+    bench_run(messages);
+
+    for (size_t lp = 0; lp < ARRAY_SIZE(mMsgs); lp++) {
+        utl_buf_free(&mMsgs[lp]);
+    }
+    btc_term();
+    return 0;
+}
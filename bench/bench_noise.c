@@ -0,0 +1,339 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_noise.c
+ *  @brief  noise transport benchmark
+ *
+ *  32byteと64KB(65535byte)のmessageをnoise暗号化 → 復号して、1秒あたりのmessage数とbyte数を出力する。
+ *  #ln_noise_enc() + 受信body毎のmalloc と、#ln_noise_enc_inplace() + 同じバッファでの復号 を比較する。
+ *  計測前にBOLT#8 test vector(message 0, 1000, 1001)と一致することを確認する。
+ *  malloc回数はリンク時の--wrap=mallocで数える。
+ *
+ *      usage: bench_noise [-n messages(32byte)] [-l messages(64KB)]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "btc.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_noise.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_SMALL_MESSAGES_DEFAULT    (1000000)   ///< 32byte messageの数
+#define M_LARGE_MESSAGES_DEFAULT    (20000)     ///< 64KB messageの数
+
+#define M_SZ_SMALL                  (32)
+#define M_SZ_LARGE                  (UINT16_MAX)    ///< BOLT#8の最大message長
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+void *__real_malloc(size_t Size);
+void *__real_calloc(size_t Block, size_t Size);
+void *__real_realloc(void *pBuf, size_t Size);
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static uint64_t mMallocCnt;         ///< malloc/calloc/realloc回数
+
+static const uint8_t SK[] = {
+    0x96, 0x9a, 0xb3, 0x1b, 0x4d, 0x28, 0x8c, 0xed,
+    0xf6, 0x21, 0x88, 0x39, 0xb2, 0x7a, 0x3e, 0x21,
+    0x40, 0x82, 0x70, 0x47, 0xf2, 0xc0, 0xf0, 0x1b,
+    0xf5, 0xc0, 0x44, 0x35, 0xd4, 0x35, 0x11, 0xa9,
+};
+static const uint8_t CK[] = {
+    0x91, 0x92, 0x19, 0xdb, 0xb2, 0x92, 0x0a, 0xfa,
+    0x8d, 0xb8, 0x0f, 0x9a, 0x51, 0x78, 0x7a, 0x84,
+    0x0b, 0xcf, 0x11, 0x1e, 0xd8, 0xd5, 0x88, 0xca,
+    0xf9, 0xab, 0x4b, 0xe7, 0x16, 0xe4, 0x2b, 0x01,
+};
+
+
+/**************************************************************************
+ * malloc hook(-Wl,--wrap)
+ **************************************************************************/
+
+void *__wrap_malloc(size_t Size)
+{
+    mMallocCnt++;
+    return __real_malloc(Size);
+}
+
+
+void *__wrap_calloc(size_t Block, size_t Size)
+{
+    mMallocCnt++;
+    return __real_calloc(Block, Size);
+}
+
+
+void *__wrap_realloc(void *pBuf, size_t Size)
+{
+    mMallocCnt++;
+    return __real_realloc(pBuf, Size);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/** 送信側・受信側のnoise鍵設定
+ *
+ * BOLT#8 test vectorの鍵を使う。
+ */
+static void noise_setup(ln_noise_t *pSend, ln_noise_t *pRecv)
+{
+    memset(pSend, 0, sizeof(ln_noise_t));
+    memset(pRecv, 0, sizeof(ln_noise_t));
+    memcpy(pSend->send_ctx.key, SK, sizeof(SK));
+    memcpy(pSend->send_ctx.ck, CK, sizeof(CK));
+    memcpy(pRecv->recv_ctx.key, SK, sizeof(SK));
+    memcpy(pRecv->recv_ctx.ck, CK, sizeof(CK));
+    ln_noise_cipher_init(pSend);
+    ln_noise_cipher_init(pRecv);
+}
+
+
+/** BOLT#8 test vector確認
+ *
+ * "hello"を1002回暗号化し、message 0, 1000, 1001の暗号文を比較する。
+ */
+static bool check_vector(void)
+{
+    const uint8_t OUTPUT0[] = {
+        0xcf, 0x2b, 0x30, 0xdd, 0xf0, 0xcf, 0x3f, 0x80,
+        0xe7, 0xc3, 0x5a, 0x6e, 0x67, 0x30, 0xb5, 0x9f,
+        0xe8, 0x02, 0x47, 0x31, 0x80, 0xf3, 0x96, 0xd8,
+        0x8a, 0x8f, 0xb0, 0xdb, 0x8c, 0xbc, 0xf2, 0x5d,
+        0x2f, 0x21, 0x4c, 0xf9, 0xea, 0x1d, 0x95,
+    };
+    const uint8_t OUTPUT1000[] = {
+        0x4a, 0x2f, 0x3c, 0xc3, 0xb5, 0xe7, 0x8d, 0xdb,
+        0x83, 0xdc, 0xb4, 0x26, 0xd9, 0x86, 0x3d, 0x9d,
+        0x9a, 0x72, 0x3b, 0x03, 0x37, 0xc8, 0x9d, 0xd0,
+        0xb0, 0x05, 0xd8, 0x9f, 0x8d, 0x3c, 0x05, 0xc5,
+        0x2b, 0x76, 0xb2, 0x9b, 0x74, 0x0f, 0x09,
+    };
+    const uint8_t OUTPUT1001[] = {
+        0x2e, 0xcd, 0x8c, 0x8a, 0x56, 0x29, 0xd0, 0xd0,
+        0x2a, 0xb4, 0x57, 0xa0, 0xfd, 0xd0, 0xf7, 0xb9,
+        0x0a, 0x19, 0x2c, 0xd4, 0x6b, 0xe5, 0xec, 0xb6,
+        0xca, 0x57, 0x0b, 0xfc, 0x5e, 0x26, 0x83, 0x38,
+        0xb1, 0xa1, 0x6c, 0xf4, 0xef, 0x2d, 0x36,
+    };
+    ln_noise_t noise_send;
+    ln_noise_t noise_recv;
+    uint8_t data[LN_SZ_NOISE_ENC(5)];
+
+    noise_setup(&noise_send, &noise_recv);
+    for (int lp = 0; lp < 1002; lp++) {
+        memcpy(data + LN_SZ_NOISE_HEADER, "hello", 5);
+        if (!ln_noise_enc_inplace(&noise_send, data, 5)) return false;
+        if ((lp == 0) && (memcmp(data, OUTPUT0, sizeof(OUTPUT0)) != 0)) return false;
+        if ((lp == 1000) && (memcmp(data, OUTPUT1000, sizeof(OUTPUT1000)) != 0)) return false;
+        if ((lp == 1001) && (memcmp(data, OUTPUT1001, sizeof(OUTPUT1001)) != 0)) return false;
+
+        utl_buf_t body;
+        body.len = ln_noise_dec_len(&noise_recv, data, LN_SZ_NOISE_HEADER);
+        body.buf = data + LN_SZ_NOISE_HEADER;
+        if (body.len != 5 + 16) return false;
+        if (!ln_noise_dec_msg(&noise_recv, &body)) return false;
+        if ((body.len != 5) || (memcmp(body.buf, "hello", 5) != 0)) return false;
+    }
+    return true;
+}
+
+
+/** 1message分の送受信(暗号化データと受信bodyをmessage毎にmalloc/free)
+ */
+static bool replay_heap(ln_noise_t *pSend, ln_noise_t *pRecv, const utl_buf_t *pMsg)
+{
+    bool ret = false;
+    utl_buf_t buf_enc = UTL_BUF_INIT;
+    utl_buf_t buf_body = UTL_BUF_INIT;
+
+    //send
+    if (!ln_noise_enc(pSend, &buf_enc, pMsg)) goto LABEL_EXIT;
+
+    //recv
+    uint32_t len = ln_noise_dec_len(pRecv, buf_enc.buf, LN_SZ_NOISE_HEADER);
+    if (len == 0) goto LABEL_EXIT;
+    if (!utl_buf_alloccopy(&buf_body, buf_enc.buf + LN_SZ_NOISE_HEADER, len)) goto LABEL_EXIT;
+    if (!ln_noise_dec_msg(pRecv, &buf_body)) goto LABEL_EXIT;
+    ret = (buf_body.len == pMsg->len);
+
+LABEL_EXIT:
+    utl_buf_free(&buf_body);
+    utl_buf_free(&buf_enc);
+    return ret;
+}
+
+
+/** 1message分の送受信(pDataの領域だけを使う)
+ *
+ * 平文をpData[#LN_SZ_NOISE_HEADER]に書き込むところから計測に含める。
+ */
+static bool replay_inplace(ln_noise_t *pSend, ln_noise_t *pRecv, const utl_buf_t *pMsg, uint8_t *pData)
+{
+    //send
+    memcpy(pData + LN_SZ_NOISE_HEADER, pMsg->buf, pMsg->len);
+    if (!ln_noise_enc_inplace(pSend, pData, (uint16_t)pMsg->len)) return false;
+
+    //recv
+    utl_buf_t body;
+    body.len = ln_noise_dec_len(pRecv, pData, LN_SZ_NOISE_HEADER);
+    if (body.len == 0) return false;
+    body.buf = pData + LN_SZ_NOISE_HEADER;
+    if (!ln_noise_dec_msg(pRecv, &body)) return false;
+    return body.len == pMsg->len;
+}
+
+
+/** 計測
+ *
+ * @param[in]       Size            message長
+ * @param[in]       Messages        message数
+ */
+static void bench_run(uint16_t Size, int Messages)
+{
+    ln_noise_t noise_send;
+    ln_noise_t noise_recv;
+    utl_buf_t msg = UTL_BUF_INIT;
+    uint8_t *p_data = (uint8_t *)malloc(LN_SZ_NOISE_ENC(Size));
+    double bytes = (double)Size * Messages;
+    int fail = 0;
+
+    utl_buf_alloc(&msg, Size);
+    btc_rng_rand(msg.buf, msg.len);
+
+    //ln_noise_enc()
+    noise_setup(&noise_send, &noise_recv);
+    uint64_t cnt = mMallocCnt;
+    double start = now_usec();
+    for (int lp = 0; lp < Messages; lp++) {
+        if (!replay_heap(&noise_send, &noise_recv, &msg)) {
+            fail++;
+        }
+    }
+    double elapsed_heap = now_usec() - start;
+    uint64_t malloc_heap = mMallocCnt - cnt;
+
+    //ln_noise_enc_inplace()
+    noise_setup(&noise_send, &noise_recv);
+    cnt = mMallocCnt;
+    start = now_usec();
+    for (int lp = 0; lp < Messages; lp++) {
+        if (!replay_inplace(&noise_send, &noise_recv, &msg, p_data)) {
+            fail++;
+        }
+    }
+    double elapsed_inplace = now_usec() - start;
+    uint64_t malloc_inplace = mMallocCnt - cnt;
+
+    //最後に復号した平文
+    if (memcmp(p_data + LN_SZ_NOISE_HEADER, msg.buf, msg.len) != 0) {
+        fail++;
+    }
+
+    printf("size=%" PRIu16 " messages=%d\n", Size, Messages);
+    printf("  enc        : msgs/sec=%.0f MB/s=%.1f malloc=%.2f/msg\n",
+        Messages * 1000000.0 / elapsed_heap, bytes / elapsed_heap,
+        (double)malloc_heap / Messages);
+    printf("  enc_inplace: msgs/sec=%.0f MB/s=%.1f malloc=%.2f/msg\n",
+        Messages * 1000000.0 / elapsed_inplace, bytes / elapsed_inplace,
+        (double)malloc_inplace / Messages);
+    printf("  fail=%d\n", fail);
+
+    utl_buf_free(&msg);
+    free(p_data);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int small = M_SMALL_MESSAGES_DEFAULT;
+    int large = M_LARGE_MESSAGES_DEFAULT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            small = atoi(optarg);
+            break;
+        case 'l':
+            large = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n messages(32byte)] [-l messages(64KB)]\n", argv[0]);
+            return -1;
+        }
+    }
+    if ((small <= 0) || (large <= 0)) {
+        fprintf(stderr, "messages > 0\n");
+        return -1;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+
+    if (!check_vector()) {
+        fprintf(stderr, "fail: BOLT#8 test vector\n");
+        btc_term();
+        return -1;
+    }
+    printf("BOLT#8 test vector: OK\n");
+
+    bench_run(M_SZ_SMALL, small);
+    bench_run(M_SZ_LARGE, large);
+
+    btc_term();
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_onion.c
+ *  @brief  onion packet construction benchmark
+ *
+ *  1, 5, 20hopのrouteで#ln_onion_create_packet()を繰り返し、1秒あたりの生成パケット数を出力する。
+ *
+ *      usage: bench_onion [-n packets] [-h hops]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "btc.h"
+#include "btc_crypto.h"
+#include "btc_keys.h"
+
+#include "ln.h"
+#include "ln_onion.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_PACKETS_DEFAULT   (200)           ///< 1hop数あたりの生成パケット数
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static void create_privkey(uint8_t *pPrivKey)
+{
+    do {
+        btc_rng_rand(pPrivKey, BTC_SZ_PRIVKEY);
+    } while (!btc_keys_check_priv(pPrivKey));
+}
+
+
+/** 生成時間計測
+ *
+ * @param[in]       Hops            route長
+ * @param[in]       Packets         生成パケット数
+ */
+static void bench_run(int Hops, int Packets)
+{
+    ln_hop_datain_t hop_data[LN_HOP_MAX];
+    uint8_t session_key[BTC_SZ_PRIVKEY];
+    uint8_t assoc_data[BTC_SZ_HASH256];
+    uint8_t packet[LN_SZ_ONION_ROUTE];
+
+    for (int lp = 0; lp < Hops; lp++) {
+        uint8_t priv[BTC_SZ_PRIVKEY];
+        create_privkey(priv);
+        btc_keys_priv2pub(hop_data[lp].pubkey, priv);
+        hop_data[lp].short_channel_id = 0x0000010000020003ULL + lp;
+        hop_data[lp].amt_to_forward = 100000 - lp;
+        hop_data[lp].outgoing_cltv_value = 500 + lp;
+    }
+    btc_rng_rand(assoc_data, sizeof(assoc_data));
+
+    int fail = 0;
+    double start = now_usec();
+    for (int lp = 0; lp < Packets; lp++) {
+        create_privkey(session_key);
+        if (!ln_onion_create_packet(packet, NULL, hop_data, Hops, 0, session_key, assoc_data, sizeof(assoc_data))) {
+            fail++;
+        }
+    }
+    double elapsed = now_usec() - start;
+    printf("hops=%2d packets=%d elapsed=%.0fus avg=%.1fus packets/sec=%.1f fail=%d\n",
+        Hops, Packets, elapsed, elapsed / Packets, Packets * 1000000.0 / elapsed, fail);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int packets = M_PACKETS_DEFAULT;
+    int hops = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h:")) != -1) {
+        switch (opt) {
+        case 'n':
+            packets = atoi(optarg);
+            break;
+        case 'h':
+            hops = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n packets] [-h hops]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (packets <= 0) {
+        packets = M_PACKETS_DEFAULT;
+    }
+    if (hops > LN_HOP_MAX) {
+        fprintf(stderr, "hops <= %d\n", LN_HOP_MAX);
+        return -1;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+
+    if (hops > 0) {
+        bench_run(hops, packets);
+    } else {
+        const int HOPS[] = { 1, 5, 20 };
+        for (size_t lp = 0; lp < ARRAY_SIZE(HOPS); lp++) {
+            bench_run(HOPS[lp], packets);
+        }
+    }
+
+    btc_term();
+    return 0;
+}
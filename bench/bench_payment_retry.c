@@ -0,0 +1,584 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_payment_retry.c
+ *  @brief  payment retry simulation
+ *
+ *  途中のchannelでN回失敗してから成功する送金について、最初の経路計算からN+1回目の経路が決まるまでの時間を比べる。
+ *      - legacy    : 試行ごとにinvoiceをdecodeし、#ln_routing_calculate()で検索し直す(従来のln_payment_retry())
+ *      - engine    : invoiceのdecodeは1回だけで、#ln_routing_calculate_k()で作った経路候補を
+ *                    #ln_routing_reprice()で使い回し、候補がなくなった場合だけ失敗channelを除外して検索し直す
+ *                    (ln_payment.cのretry context)
+ *      - searches  : 1送金あたりの経路検索回数
+ *
+ *  失敗したchannelは、ptarmdと同じく一時的なroute skipとして登録する。
+ *  invoiceは自nodeを宛先として作成するが、decodeは時間を計るためだけに行い、経路は合成graphのnode間で計算する。
+ *  DBアクセスやupdate_add_htlcの送信は含まない。
+ *
+ *  graphは合成したchannel_announcement/channel_updateから作る(bench_routing_profileと同じ)。
+ *
+ *      usage: bench_payment_retry [-n channels] [-p payments] [-r seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <ftw.h>
+
+#include "utl_int.h"
+#include "utl_dbg.h"
+#include "utl_time.h"
+
+#include "btc.h"
+#include "btc_block.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+#include "ln_node.h"
+#include "ln_invoice.h"
+#include "ln_routing.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CHANNELS_DEFAULT  (5000)          ///< 合成するchannel数
+#define M_PAYMENTS_DEFAULT  (200)           ///< Nごとの送金数
+#define M_CAPACITY_MIN      (100000000.0)   ///< 容量の最小[msat]
+#define M_CAPACITY_MAX      (10000000000.0) ///< 容量の最大[msat]
+#define M_NODES_DIV         (4)             ///< node数 = channel数 / M_NODES_DIV
+#define M_CLTV_EXPIRY       (100)
+#define M_AMOUNT_MSAT       (10000000)      ///< 送金額[msat]
+#define M_CANDIDATES        (4)             ///< engineの経路候補数(ln_payment.cのM_ROUTE_CANDIDATES)
+#define M_EXCLUDE_MAX       (20)            ///< engineの除外channel数(ln_payment.cのM_EXCLUDE_MAX)
+
+#define M_TYPE_CNLANNO      (0x0100)
+#define M_TYPE_CNLUPD       (0x0102)
+#define M_SZ_SIG            (64)
+#define M_SZ_CNLANNO        (2 + M_SZ_SIG * 4 + 2 + 32 + 8 + BTC_SZ_PUBKEY * 4)
+#define M_SZ_CNLUPD         (2 + M_SZ_SIG + 32 + 8 + 4 + 1 + 1 + 2 + 8 + 4 + 4 + 8)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** Nごとの結果
+ *
+ */
+typedef struct {
+    int         success;
+    double      usec;
+    uint64_t    searches;
+} result_t;
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static uint8_t          (*mpNodeIds)[BTC_SZ_PUBKEY];
+static int              mNodeNum;
+static uint64_t         mRand;
+static char             *mpInvoice;
+
+static const int        M_RETRIES[] = { 0, 1, 2, 4, 8 };
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb)
+{
+    (void)pStat; (void)Type; (void)pFtwb;
+    return remove(pPath);
+}
+
+
+/** 再現できる乱数(xorshift64*)
+ *
+ */
+static uint64_t rand_u64(void)
+{
+    mRand ^= mRand >> 12;
+    mRand ^= mRand << 25;
+    mRand ^= mRand >> 27;
+    return mRand * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+
+static double rand_double(void)
+{
+    return (double)(rand_u64() >> 11) / (double)(UINT64_C(1) << 53);
+}
+
+
+/** [Min, Max)の対数一様乱数
+ *
+ */
+static uint64_t rand_log(double Min, double Max)
+{
+    return (uint64_t)exp(log(Min) + (log(Max) - log(Min)) * rand_double());
+}
+
+
+static int cmp_node_id(const void *p1, const void *p2)
+{
+    return memcmp(p1, p2, BTC_SZ_PUBKEY);
+}
+
+
+/** channel_announcement, channel_update(dir=0,1)をDBに保存
+ *
+ * 署名は検証しないので0のままにする。
+ * channelの1/4はhtlc_maximum_msatを持たない(容量不明)。
+ *
+ * @param[in]       Channels        channel数
+ * @retval  true    成功
+ */
+static bool anno_create(int Channels)
+{
+    int nodes = Channels / M_NODES_DIV;
+    if (nodes < 2) {
+        nodes = 2;
+    }
+    uint8_t (*p_nodes)[BTC_SZ_PUBKEY] = (uint8_t (*)[BTC_SZ_PUBKEY])malloc(BTC_SZ_PUBKEY * nodes);
+    for (int lp = 0; lp < nodes; lp++) {
+        p_nodes[lp][0] = 0x02;
+        for (int lp2 = 1; lp2 < BTC_SZ_PUBKEY; lp2++) {
+            p_nodes[lp][lp2] = (uint8_t)rand_u64();
+        }
+    }
+
+    bool ret = true;
+    uint8_t anno[M_SZ_CNLANNO];
+    uint8_t upd[M_SZ_CNLUPD];
+    for (int lp = 0; lp < Channels; lp++) {
+        //node_id昇順
+        const uint8_t *p_node[2] = { p_nodes[lp % nodes], p_nodes[rand_u64() % nodes] };
+        if (p_node[0] == p_node[1]) {
+            p_node[1] = p_nodes[(lp + 1) % nodes];
+        }
+        if (memcmp(p_node[0], p_node[1], BTC_SZ_PUBKEY) > 0) {
+            const uint8_t *p_tmp = p_node[0];
+            p_node[0] = p_node[1];
+            p_node[1] = p_tmp;
+        }
+        uint64_t short_channel_id = ((uint64_t)(500000 + lp / 2000) << 40) | ((uint64_t)(lp % 2000) << 16) | 1;
+        uint64_t capacity = rand_log(M_CAPACITY_MIN, M_CAPACITY_MAX);
+        bool htlc_max = (lp % 4 != 0);
+
+        //channel_announcement
+        uint8_t *p = anno;
+        memset(anno, 0, sizeof(anno));
+        utl_int_unpack_u16be(p, M_TYPE_CNLANNO);
+        p += 2 + M_SZ_SIG * 4;
+        utl_int_unpack_u16be(p, 0);             //features
+        p += 2;
+        memset(p, 0x6f, 32);                    //chain_hash
+        p += 32;
+        utl_int_unpack_u64be(p, short_channel_id);
+        p += 8;
+        memcpy(p, p_node[0], BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memcpy(p, p_node[1], BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memset(p, 0x02, BTC_SZ_PUBKEY * 2);     //bitcoin_key_1, 2
+        utl_buf_t buf = { anno, sizeof(anno) };
+        if (!ln_db_cnlanno_save(&buf, short_channel_id, NULL, p_node[0], p_node[1])) {
+            fprintf(stderr, "fail: cnlanno save(%d)\n", lp);
+            ret = false;
+            break;
+        }
+
+        //channel_update(dir=0,1)
+        for (int dir = 0; dir < 2; dir++) {
+            p = upd;
+            memset(upd, 0, sizeof(upd));
+            utl_int_unpack_u16be(p, M_TYPE_CNLUPD);
+            p += 2 + M_SZ_SIG;
+            memset(p, 0x6f, 32);
+            p += 32;
+            utl_int_unpack_u64be(p, short_channel_id);
+            p += 8;
+            utl_int_unpack_u32be(p, (uint32_t)utl_time_time());
+            p += 4;
+            *p++ = (htlc_max) ? 0x01 : 0x00;    //message_flags: option_channel_htlc_max
+            *p++ = (uint8_t)dir;
+            utl_int_unpack_u16be(p, (uint16_t)(40 + rand_u64() % 105));
+            p += 2;
+            utl_int_unpack_u64be(p, 1000);
+            p += 8;
+            utl_int_unpack_u32be(p, (uint32_t)(rand_u64() % 2000));
+            p += 4;
+            utl_int_unpack_u32be(p, (uint32_t)(1 + rand_u64() % 1000));
+            p += 4;
+            if (htlc_max) {
+                utl_int_unpack_u64be(p, capacity);
+                p += 8;
+            }
+
+            ln_msg_channel_update_t msg;
+            buf.buf = upd;
+            buf.len = (uint32_t)(p - upd);
+            if (!ln_channel_update_get_params(&msg, buf.buf, (uint16_t)buf.len) ||
+                    !ln_db_cnlupd_save(&buf, &msg, NULL)) {
+                fprintf(stderr, "fail: cnlupd save(%d)\n", lp);
+                ret = false;
+                break;
+            }
+        }
+        if (!ret) {
+            break;
+        }
+    }
+    free(p_nodes);
+    return ret;
+}
+
+
+/** announcement DBからnode_id一覧を作る
+ *
+ * @retval  true    成功
+ */
+static bool node_load(void)
+{
+    if (!ln_db_anno_transaction()) {
+        fprintf(stderr, "fail: no announce DB\n");
+        return false;
+    }
+
+    int alloc = 0;
+    void *p_cur;
+    if (ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO)) {
+        uint64_t short_channel_id;
+        char type;
+        uint32_t timestamp;
+        utl_buf_t buf = UTL_BUF_INIT;
+
+        while (ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, &timestamp, &buf)) {
+            if (type == LN_DB_CNLANNO_ANNO) {
+                if (mNodeNum + 2 > alloc) {
+                    alloc = (alloc == 0) ? 1024 : alloc * 2;
+                    mpNodeIds = (uint8_t (*)[BTC_SZ_PUBKEY])realloc(mpNodeIds, BTC_SZ_PUBKEY * alloc);
+                }
+                uint64_t scid;
+                if (ln_get_ids_cnl_anno(&scid, mpNodeIds[mNodeNum], mpNodeIds[mNodeNum + 1], buf.buf, (uint16_t)buf.len)) {
+                    mNodeNum += 2;
+                }
+            }
+            utl_buf_free(&buf);
+        }
+        ln_db_anno_cur_close(p_cur);
+    }
+    ln_db_anno_commit(false);
+    if (mNodeNum == 0) {
+        fprintf(stderr, "fail: no channel\n");
+        return false;
+    }
+
+    qsort(mpNodeIds, mNodeNum, BTC_SZ_PUBKEY, cmp_node_id);
+    int num = 0;
+    for (int lp = 0; lp < mNodeNum; lp++) {
+        if ((num == 0) || (memcmp(mpNodeIds[num - 1], mpNodeIds[lp], BTC_SZ_PUBKEY) != 0)) {
+            memmove(mpNodeIds[num++], mpNodeIds[lp], BTC_SZ_PUBKEY);
+        }
+    }
+    mNodeNum = num;
+    return true;
+}
+
+
+/** 失敗させるchannel
+ *
+ * 自channel(hop_datain[0])以外から乱数で選ぶ。1hopの経路は先頭のchannel。
+ */
+static uint64_t fail_scid(const ln_routing_result_t *pResult)
+{
+    int hops = pResult->num_hops - 1;
+    int idx = (hops > 1) ? 1 + (int)(rand_u64() % (hops - 1)) : 0;
+    return pResult->hop_datain[idx].short_channel_id;
+}
+
+
+/** 従来の手順: 試行ごとにinvoiceのdecodeと経路検索
+ *
+ * @retval  true    N+1回目の経路が得られた
+ */
+static bool run_legacy(uint64_t *pSearches, int Payer, int Payee, int Retries)
+{
+    ln_routing_result_t result;
+
+    for (int attempt = 0; attempt <= Retries; attempt++) {
+        ln_invoice_t *p_invoice_data = NULL;
+        if (!ln_invoice_decode(&p_invoice_data, mpInvoice)) {
+            return false;
+        }
+        lnerr_route_t err = ln_routing_calculate(
+                    &result, mpNodeIds[Payer], mpNodeIds[Payee],
+                    M_CLTV_EXPIRY + p_invoice_data->min_final_cltv_expiry, p_invoice_data->amount_msat,
+                    0, NULL, LN_ROUTING_PROFILE_FEE);
+        ln_invoice_decode_free(p_invoice_data);
+        (*pSearches)++;
+        if (err != LNROUTE_OK) {
+            return false;
+        }
+        if (attempt < Retries) {
+            ln_routing_skip_add(fail_scid(&result), true, (uint64_t)utl_time_time() + LN_DB_ROUTE_SKIP_TEMP_SEC);
+        }
+    }
+    return true;
+}
+
+
+/** retry contextの手順: 経路候補の再計算と、候補がなくなった場合だけ除外channelを指定した検索
+ *
+ * @retval  true    N+1回目の経路が得られた
+ */
+static bool run_engine(uint64_t *pSearches, int Payer, int Payee, int Retries)
+{
+    ln_routing_result_t cand[M_CANDIDATES];
+    ln_routing_result_t result;
+    uint8_t cand_num = 0;
+    uint64_t exclude[M_EXCLUDE_MAX];
+    uint8_t exclude_num = 0;
+
+    ln_invoice_t *p_invoice_data = NULL;
+    if (!ln_invoice_decode(&p_invoice_data, mpInvoice)) {
+        return false;
+    }
+    uint32_t cltv_expiry = M_CLTV_EXPIRY + p_invoice_data->min_final_cltv_expiry;
+    uint64_t amount = p_invoice_data->amount_msat;
+
+    bool ret = true;
+    for (int attempt = 0; attempt <= Retries; attempt++) {
+        bool found = false;
+        while (!found && (cand_num > 0)) {
+            memcpy(&result, &cand[0], sizeof(result));
+            cand_num--;
+            memmove(&cand[0], &cand[1], sizeof(ln_routing_result_t) * cand_num);
+            found = (ln_routing_reprice(&result, cltv_expiry, amount, 0, NULL) == LNROUTE_OK);
+        }
+        if (!found) {
+            uint8_t num = 0;
+            lnerr_route_t err = ln_routing_calculate_k(
+                        cand, &num, M_CANDIDATES, mpNodeIds[Payer], mpNodeIds[Payee],
+                        cltv_expiry, amount, 0, NULL, exclude, exclude_num, LN_ROUTING_PROFILE_FEE);
+            (*pSearches)++;
+            if (err != LNROUTE_OK) {
+                ret = false;
+                break;
+            }
+            memcpy(&result, &cand[0], sizeof(result));
+            cand_num = num - 1;
+            memmove(&cand[0], &cand[1], sizeof(ln_routing_result_t) * cand_num);
+        }
+        if (attempt < Retries) {
+            uint64_t scid = fail_scid(&result);
+            ln_routing_skip_add(scid, true, (uint64_t)utl_time_time() + LN_DB_ROUTE_SKIP_TEMP_SEC);
+            if (exclude_num < M_EXCLUDE_MAX) {
+                exclude[exclude_num++] = scid;
+            }
+            //失敗したchannelを通る候補を捨てる(ln_payment_exclude())
+            uint8_t num = 0;
+            for (uint8_t lp = 0; lp < cand_num; lp++) {
+                bool use = true;
+                for (int hop = 0; hop < cand[lp].num_hops - 1; hop++) {
+                    if (cand[lp].hop_datain[hop].short_channel_id == scid) {
+                        use = false;
+                        break;
+                    }
+                }
+                if (use) {
+                    memmove(&cand[num++], &cand[lp], sizeof(ln_routing_result_t));
+                }
+            }
+            cand_num = num;
+        }
+    }
+    ln_invoice_decode_free(p_invoice_data);
+    return ret;
+}
+
+
+/** 1手順の評価
+ *
+ * 乱数は毎回初期化するので、どちらの手順も同じ送金・同じ位置の失敗になる。
+ *
+ * @param[out]      pResults        M_RETRIES個
+ */
+static void sim_run(result_t *pResults, bool bEngine, int Payments, uint64_t Seed)
+{
+    const int retries_num = (int)ARRAY_SIZE(M_RETRIES);
+
+    memset(pResults, 0, sizeof(result_t) * retries_num);
+    mRand = Seed;
+    for (int idx = 0; idx < retries_num; idx++) {
+        for (int lp = 0; lp < Payments; lp++) {
+            int payer = (int)(rand_u64() % mNodeNum);
+            int payee = (int)(rand_u64() % mNodeNum);
+            if (payer == payee) {
+                payee = (payee + 1) % mNodeNum;
+            }
+            uint64_t rand_bak = mRand;
+
+            //送金ごとに失敗履歴を消す
+            ln_routing_skip_drop(false);
+
+            uint64_t searches = 0;
+            double start = now_usec();
+            bool ret = (bEngine) ?
+                    run_engine(&searches, payer, payee, M_RETRIES[idx]) :
+                    run_legacy(&searches, payer, payee, M_RETRIES[idx]);
+            double elapsed = now_usec() - start;
+            if (ret) {
+                pResults[idx].success++;
+                pResults[idx].usec += elapsed;
+                pResults[idx].searches += searches;
+            }
+
+            //失敗位置の乱数消費が手順で異なっても、次の送金は同じにする
+            mRand = rand_bak;
+            rand_u64();
+        }
+    }
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int channels = M_CHANNELS_DEFAULT;
+    int payments = M_PAYMENTS_DEFAULT;
+    uint64_t seed = 1;
+    char dir[] = "/tmp/bench_payment_retry_XXXXXX";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            channels = atoi(optarg);
+            break;
+        case 'p':
+            payments = atoi(optarg);
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n channels] [-p payments] [-r seed]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (channels <= 0) {
+        channels = M_CHANNELS_DEFAULT;
+    }
+    if (payments <= 0) {
+        payments = M_PAYMENTS_DEFAULT;
+    }
+    if (seed == 0) {
+        seed = 1;
+    }
+    mRand = seed;
+
+    //logは出力しない(utl_log_init()しない)
+    const char *p_dir = mkdtemp(dir);
+    if (p_dir == NULL) {
+        fprintf(stderr, "fail: mkdtemp\n");
+        return -1;
+    }
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+    ln_genesishash_set(btc_block_get_genesis_hash(BTC_BLOCK_CHAIN_BTCREGTEST));
+    if (!ln_lmdb_set_home_dir(p_dir)) {
+        fprintf(stderr, "fail: db dir\n");
+        return -1;
+    }
+    //invoiceの署名にnode鍵を使う
+    ln_node_t node;
+    memset(&node, 0, sizeof(node));
+    strcpy(node.alias, "bench");
+    node.addr.type = LN_ADDR_DESC_TYPE_NONE;
+    if (!ln_node_init(&node)) {
+        fprintf(stderr, "fail: ln_node_init\n");
+        return -1;
+    }
+
+    uint8_t payment_hash[BTC_SZ_HASH256];
+    ln_invoice_desc_t desc;
+    desc.type = LN_INVOICE_DESC_TYPE_STRING;
+    utl_buf_init(&desc.data);
+    utl_buf_alloccopy(&desc.data, (const uint8_t *)"bench", 5);
+    btc_rng_rand(payment_hash, sizeof(payment_hash));
+    if (!ln_invoice_create(&mpInvoice, LN_INVOICE_REGTEST, payment_hash, M_AMOUNT_MSAT,
+                LN_INVOICE_EXPIRY, &desc, NULL, 0, LN_MIN_FINAL_CLTV_EXPIRY)) {
+        fprintf(stderr, "fail: ln_invoice_create\n");
+        return -1;
+    }
+    utl_buf_free(&desc.data);
+
+    if (anno_create(channels) && node_load()) {
+        printf("channels=%d nodes=%d payments=%d seed=%" PRIu64 " candidates=%d\n",
+            channels, mNodeNum, payments, seed, M_CANDIDATES);
+        result_t legacy[ARRAY_SIZE(M_RETRIES)];
+        result_t engine[ARRAY_SIZE(M_RETRIES)];
+        sim_run(legacy, false, payments, seed);
+        sim_run(engine, true, payments, seed);
+
+        for (size_t idx = 0; idx < ARRAY_SIZE(M_RETRIES); idx++) {
+            printf("retries=%d legacy_usec=%.1f legacy_searches=%.2f "
+                "engine_usec=%.1f engine_searches=%.2f success=%d/%d\n",
+                M_RETRIES[idx],
+                (legacy[idx].success > 0) ? legacy[idx].usec / legacy[idx].success : 0.0,
+                (legacy[idx].success > 0) ? (double)legacy[idx].searches / legacy[idx].success : 0.0,
+                (engine[idx].success > 0) ? engine[idx].usec / engine[idx].success : 0.0,
+                (engine[idx].success > 0) ? (double)engine[idx].searches / engine[idx].success : 0.0,
+                engine[idx].success, legacy[idx].success);
+        }
+    }
+
+    ln_routing_term();
+    UTL_DBG_FREE(mpInvoice);
+    free(mpNodeIds);
+    ln_node_term();
+    ln_db_term();
+    btc_term();
+    nftw(dir, rm_files, 10, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    return 0;
+}
@@ -0,0 +1,445 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_peers.c
+ *  @brief  peer scale benchmark
+ *
+ *  loopbackで1000(-pで変更)のTCP接続を張り、node側のsocketを#peer_engine_add()で登録する。
+ *  peer側は1threadで全socketからmessageを送り、node側callbackが返したmessageを受信したら次を送る。
+ *  接続後のRSS, thread数と、-s秒間のmessage往復数を出力する。
+ *
+ *  -tを指定すると、engineの代わりに1peerあたり4thread(変更前のlnappと同じ
+ *  channel, recv, poll, anno)を起動して比較する。
+ *
+ *      usage: bench_peers [-p peers] [-s sec] [-l msg len] [-w workers] [-t]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "peer_engine.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_PEERS_DEFAULT     (1000)          ///< peer数
+#define M_SEC_DEFAULT       (10)            ///< 計測時間[sec]
+#define M_MSG_LEN_DEFAULT   (64)            ///< message長(update_add_htlc程度はnoise込みで1500byte)
+#define M_MSG_LEN_MAX       (65535)
+#define M_WORKERS_DEFAULT   (4)             ///< engineのworker thread数(ptarmdと同じ)
+#define M_TICK_MSEC         (100)           ///< engineの周期処理間隔(ptarmdと同じ)
+#define M_THREADS_PER_PEER  (4)             ///< -t: 1peerあたりのthread数
+#define M_IDLE_MSEC         (100)           ///< -t: idle threadの待ち間隔
+#define M_EPOLL_EVENTS      (256)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+typedef struct {
+    int                     fd_node;        ///< node側socket
+    int                     fd_peer;        ///< peer側socket
+    peer_engine_handle_t    engine;
+    pthread_t               th[M_THREADS_PER_PEER];
+    int                     th_num;
+    uint32_t                rx_len;         ///< peer側受信済み長
+} peer_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static volatile bool    mLoop;
+static int              mMsgLen = M_MSG_LEN_DEFAULT;
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/** /proc/self/statusの値取得
+ *
+ * @param[in]   pKey        "VmRSS:"など
+ * @return  値(取得できない場合は-1)
+ */
+static long proc_status(const char *pKey)
+{
+    char line[256];
+    long val = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, pKey, strlen(pKey)) == 0) {
+            val = strtol(line + strlen(pKey), NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return val;
+}
+
+
+static bool write_all(int Fd, const uint8_t *pData, int Len)
+{
+    while (Len > 0) {
+        ssize_t sz = write(Fd, pData, Len);
+        if (sz < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) continue;
+            return false;
+        }
+        pData += sz;
+        Len -= sz;
+    }
+    return true;
+}
+
+
+/** loopback接続作成
+ *
+ * @param[out]      pPeers          接続したsocket
+ * @param[in]       Peers           接続数
+ * @retval  true    成功
+ */
+static bool connect_peers(peer_t *pPeers, int Peers)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+
+    int fd_listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_listen < 0) {
+        perror("socket");
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if ((bind(fd_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (getsockname(fd_listen, (struct sockaddr *)&addr, &addrlen) != 0) ||
+        (listen(fd_listen, SOMAXCONN) != 0)) {
+        perror("listen");
+        close(fd_listen);
+        return false;
+    }
+
+    for (int lp = 0; lp < Peers; lp++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if ((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+            fprintf(stderr, "fail: connect(%d): %s\n", lp, strerror(errno));
+            if (fd >= 0) close(fd);
+            close(fd_listen);
+            return false;
+        }
+        int fd_node = accept(fd_listen, NULL, NULL);
+        if (fd_node < 0) {
+            fprintf(stderr, "fail: accept(%d): %s\n", lp, strerror(errno));
+            close(fd);
+            close(fd_listen);
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd_node, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pPeers[lp].fd_peer = fd;
+        pPeers[lp].fd_node = fd_node;
+    }
+    close(fd_listen);
+    return true;
+}
+
+
+/** node側: 受信したmessageをそのまま返す(#peer_engine_cb_t)
+ *
+ */
+static bool echo_cb(void *pArg, uint32_t Events)
+{
+    peer_t *p_peer = (peer_t *)pArg;
+    uint8_t buf[4096];
+
+    if ((Events & PEER_ENGINE_EV_READ) == 0) {
+        return true;
+    }
+    for (;;) {
+        ssize_t sz = read(p_peer->fd_node, buf, sizeof(buf));
+        if (sz == 0) {
+            return false;
+        }
+        if (sz < 0) {
+            return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+        }
+        if (!write_all(p_peer->fd_node, buf, (int)sz)) {
+            return false;
+        }
+    }
+}
+
+
+/** -t: node側recv thread
+ *
+ */
+static void *thread_recv(void *pArg)
+{
+    peer_t *p_peer = (peer_t *)pArg;
+    uint8_t buf[4096];
+
+    for (;;) {
+        ssize_t sz = read(p_peer->fd_node, buf, sizeof(buf));
+        if (sz <= 0) {
+            break;
+        }
+        if (!write_all(p_peer->fd_node, buf, (int)sz)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+/** -t: node側channel/poll/anno thread
+ *
+ */
+static void *thread_idle(void *pArg)
+{
+    (void)pArg;
+
+    while (mLoop) {
+        usleep(M_IDLE_MSEC * 1000);
+    }
+    return NULL;
+}
+
+
+/** peer側: 全socketでmessage往復
+ *
+ * @param[in,out]   pPeers          peers
+ * @param[in]       Peers           peer数
+ * @param[in]       Sec             計測時間
+ * @return  受信message数
+ */
+static uint64_t drive_peers(peer_t *pPeers, int Peers, int Sec)
+{
+    uint64_t msgs = 0;
+    struct epoll_event ev;
+    struct epoll_event events[M_EPOLL_EVENTS];
+    uint8_t *p_msg = (uint8_t *)calloc(1, mMsgLen);
+    uint8_t *p_rx = (uint8_t *)malloc(mMsgLen);
+
+    int fd_ep = epoll_create1(0);
+    for (int lp = 0; lp < Peers; lp++) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &pPeers[lp];
+        epoll_ctl(fd_ep, EPOLL_CTL_ADD, pPeers[lp].fd_peer, &ev);
+        write_all(pPeers[lp].fd_peer, p_msg, mMsgLen);
+    }
+
+    double end = now_usec() + (double)Sec * 1000000.0;
+    while (now_usec() < end) {
+        int num = epoll_wait(fd_ep, events, M_EPOLL_EVENTS, 100);
+        for (int lp = 0; lp < num; lp++) {
+            peer_t *p_peer = (peer_t *)events[lp].data.ptr;
+            ssize_t sz = read(p_peer->fd_peer, p_rx, mMsgLen - p_peer->rx_len);
+            if (sz <= 0) {
+                continue;
+            }
+            p_peer->rx_len += (uint32_t)sz;
+            if (p_peer->rx_len < (uint32_t)mMsgLen) {
+                continue;
+            }
+            p_peer->rx_len = 0;
+            msgs++;
+            write_all(p_peer->fd_peer, p_msg, mMsgLen);
+        }
+    }
+    close(fd_ep);
+    free(p_rx);
+    free(p_msg);
+    return msgs;
+}
+
+
+/** 計測
+ *
+ * @param[in]       Peers           peer数
+ * @param[in]       Sec             計測時間
+ * @param[in]       Workers         engineのworker thread数
+ * @param[in]       bThread         true:1peerあたりM_THREADS_PER_PEERのthreadを使う
+ */
+static void bench_run(int Peers, int Sec, int Workers, bool bThread)
+{
+    peer_t *p_peers = (peer_t *)calloc(Peers, sizeof(peer_t));
+    long rss_base = proc_status("VmRSS:");
+
+    if (!connect_peers(p_peers, Peers)) {
+        free(p_peers);
+        return;
+    }
+
+    mLoop = true;
+    int started = 0;
+    if (bThread) {
+        for (int lp = 0; lp < Peers; lp++) {
+            peer_t *p_peer = &p_peers[lp];
+            if (pthread_create(&p_peer->th[p_peer->th_num], NULL, thread_recv, p_peer) != 0) break;
+            p_peer->th_num++;
+            for (int th = 1; th < M_THREADS_PER_PEER; th++) {
+                if (pthread_create(&p_peer->th[p_peer->th_num], NULL, thread_idle, p_peer) != 0) break;
+                p_peer->th_num++;
+            }
+            if (p_peer->th_num != M_THREADS_PER_PEER) break;
+            started++;
+        }
+    } else {
+        if (!peer_engine_init(Workers, M_TICK_MSEC)) {
+            fprintf(stderr, "fail: peer_engine_init\n");
+            free(p_peers);
+            return;
+        }
+        for (int lp = 0; lp < Peers; lp++) {
+            fcntl(p_peers[lp].fd_node, F_SETFL, fcntl(p_peers[lp].fd_node, F_GETFL) | O_NONBLOCK);
+            if (!peer_engine_add(&p_peers[lp].engine, p_peers[lp].fd_node, echo_cb, &p_peers[lp])) break;
+            started++;
+        }
+    }
+    if (started != Peers) {
+        fprintf(stderr, "fail: start peers(%d/%d): %s\n", started, Peers, strerror(errno));
+    }
+
+    long rss = proc_status("VmRSS:");
+    long threads = proc_status("Threads:");
+    uint64_t msgs = drive_peers(p_peers, started, Sec);
+
+    //peer側からcloseすると、node側はread()=0で終了する
+    mLoop = false;
+    for (int lp = 0; lp < Peers; lp++) {
+        close(p_peers[lp].fd_peer);
+    }
+    if (bThread) {
+        for (int lp = 0; lp < Peers; lp++) {
+            for (int th = 0; th < p_peers[lp].th_num; th++) {
+                pthread_join(p_peers[lp].th[th], NULL);
+            }
+            close(p_peers[lp].fd_node);
+        }
+    } else {
+        for (int lp = 0; lp < started; lp++) {
+            peer_engine_wait(&p_peers[lp].engine);
+        }
+        peer_engine_term();
+        for (int lp = started; lp < Peers; lp++) {
+            close(p_peers[lp].fd_node);
+        }
+    }
+
+    printf("%s peers=%d msg_len=%d threads=%ld rss=%ldkB (+%ldkB, %.1fkB/peer) msgs=%" PRIu64 " msgs/s=%.1f\n",
+        bThread ? "thread" : "engine", started, mMsgLen, threads, rss, rss - rss_base,
+        (started > 0) ? (double)(rss - rss_base) / started : 0.0,
+        msgs, (double)msgs / Sec);
+    free(p_peers);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int peers = M_PEERS_DEFAULT;
+    int sec = M_SEC_DEFAULT;
+    int workers = M_WORKERS_DEFAULT;
+    bool b_thread = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:l:w:t")) != -1) {
+        switch (opt) {
+        case 'p':
+            peers = atoi(optarg);
+            break;
+        case 's':
+            sec = atoi(optarg);
+            break;
+        case 'l':
+            mMsgLen = atoi(optarg);
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 't':
+            b_thread = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p peers] [-s sec] [-l msg len] [-w workers] [-t]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (peers <= 0) {
+        peers = M_PEERS_DEFAULT;
+    }
+    if (sec <= 0) {
+        sec = M_SEC_DEFAULT;
+    }
+    if ((mMsgLen <= 0) || (mMsgLen > M_MSG_LEN_MAX)) {
+        mMsgLen = M_MSG_LEN_DEFAULT;
+    }
+    if (workers <= 0) {
+        workers = M_WORKERS_DEFAULT;
+    }
+
+    //1peerあたりsocketを2つ使う
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < (rlim_t)peers * 2 + 64) {
+            fprintf(stderr, "warning: RLIMIT_NOFILE=%lu is too small for %d peers\n", (unsigned long)rl.rlim_cur, peers);
+        }
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    bench_run(peers, sec, workers, b_thread);
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_preimage.c
+ *  @brief  preimage lookup benchmark
+ *
+ *  10k, 1Mのinvoice(preimage)を保存し、update_add_htlc受信時のpayment_hash検索時間を出力する。
+ *  payment_hash index(#ln_db_preimage_search_hash())と、
+ *  全preimageのSHA256を比較する検索(#ln_db_preimage_search())を比較する。
+ *
+ *      usage: bench_preimage [-n invoices] [-l lookups] [-s scan lookups] [-d db dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <ftw.h>
+
+#include "btc.h"
+#include "btc_block.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_LOOKUPS_DEFAULT   (1000)          ///< index検索回数
+#define M_SCANS_DEFAULT     (10)            ///< 全件比較検索回数
+#define M_SAVE_UNIT         (10000)         ///< 1transactionで保存するinvoice数
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** #scan_func()用
+ *
+ */
+typedef struct {
+    const uint8_t   *p_hash;
+    uint8_t         preimage[LN_SZ_PREIMAGE];
+} scan_param_t;
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb)
+{
+    (void)pStat; (void)Type; (void)pFtwb;
+    return remove(pPath);
+}
+
+
+/** index追加前の検索方法(SHA256(preimage)を比較)
+ *
+ */
+static bool scan_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam)
+{
+    (void)Amount; (void)Expiry; (void)pDbParam;
+
+    scan_param_t *p_param = (scan_param_t *)pParam;
+    uint8_t payment_hash[BTC_SZ_HASH256];
+    ln_payment_hash_calc(payment_hash, pPreimage);
+    if (memcmp(payment_hash, p_param->p_hash, BTC_SZ_HASH256)) return false;
+    memcpy(p_param->preimage, pPreimage, LN_SZ_PREIMAGE);
+    return true;
+}
+
+
+/** invoice保存
+ *
+ * @param[out]      pHashes         検索対象にするpayment_hash(Lookups個)
+ * @param[in]       Invoices        保存するinvoice数
+ * @param[in]       Lookups         pHashes数
+ * @retval  true    成功
+ */
+static bool invoice_create(uint8_t (*pHashes)[BTC_SZ_HASH256], int Invoices, int Lookups)
+{
+    int step = (Invoices > Lookups) ? Invoices / Lookups : 1;
+    int hash_idx = 0;
+
+    for (int lp = 0; lp < Invoices; lp += M_SAVE_UNIT) {
+        void *p_cur;
+        if (!ln_db_preimage_cur_open(&p_cur)) {
+            fprintf(stderr, "fail: cur open\n");
+            return false;
+        }
+        int num = (Invoices - lp < M_SAVE_UNIT) ? Invoices - lp : M_SAVE_UNIT;
+        for (int idx = lp; idx < lp + num; idx++) {
+            ln_db_preimage_t preimage;
+            btc_rng_rand(preimage.preimage, LN_SZ_PREIMAGE);
+            preimage.amount_msat = 100000;
+            preimage.expiry = 3600;
+            if (!ln_db_preimage_save(&preimage, p_cur)) {
+                fprintf(stderr, "fail: save(%d)\n", idx);
+                ln_db_preimage_cur_close(p_cur, false);
+                return false;
+            }
+            if ((idx % step == 0) && (hash_idx < Lookups)) {
+                ln_payment_hash_calc(pHashes[hash_idx++], preimage.preimage);
+            }
+        }
+        ln_db_preimage_cur_close(p_cur, true);
+    }
+    return true;
+}
+
+
+/** 検索時間計測
+ *
+ * @param[in]       Invoices        保存するinvoice数
+ * @param[in]       Lookups         index検索回数
+ * @param[in]       Scans           全件比較検索回数
+ */
+static void bench_run(int Invoices, int Lookups, int Scans)
+{
+    if (Lookups > Invoices) {
+        Lookups = Invoices;
+    }
+    if (Scans > Lookups) {
+        Scans = Lookups;
+    }
+    uint8_t (*p_hashes)[BTC_SZ_HASH256] = (uint8_t (*)[BTC_SZ_HASH256])malloc(Lookups * BTC_SZ_HASH256);
+
+    double start = now_usec();
+    if (!invoice_create(p_hashes, Invoices, Lookups)) {
+        free(p_hashes);
+        ln_db_preimage_del(NULL);
+        return;
+    }
+    printf("invoices=%d create=%.0fus\n", Invoices, now_usec() - start);
+
+    int fail = 0;
+    start = now_usec();
+    for (int lp = 0; lp < Lookups; lp++) {
+        ln_db_preimage_t preimage;
+        if (!ln_db_preimage_search_hash(&preimage, p_hashes[lp], false)) {
+            fail++;
+        }
+    }
+    double elapsed = now_usec() - start;
+    printf("  index lookups=%d elapsed=%.0fus avg=%.1fus fail=%d\n",
+        Lookups, elapsed, elapsed / Lookups, fail);
+
+    fail = 0;
+    start = now_usec();
+    for (int lp = 0; lp < Scans; lp++) {
+        scan_param_t param;
+        param.p_hash = p_hashes[lp];
+        if (!ln_db_preimage_search(scan_func, &param)) {
+            fail++;
+        }
+    }
+    elapsed = now_usec() - start;
+    if (Scans > 0) {
+        printf("  scan  lookups=%d elapsed=%.0fus avg=%.1fus fail=%d\n",
+            Scans, elapsed, elapsed / Scans, fail);
+    }
+
+    free(p_hashes);
+    ln_db_preimage_del(NULL);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int invoices = 0;
+    int lookups = M_LOOKUPS_DEFAULT;
+    int scans = M_SCANS_DEFAULT;
+    char dir[] = "/tmp/bench_preimage_XXXXXX";
+    const char *p_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:s:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            invoices = atoi(optarg);
+            break;
+        case 'l':
+            lookups = atoi(optarg);
+            break;
+        case 's':
+            scans = atoi(optarg);
+            break;
+        case 'd':
+            p_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n invoices] [-l lookups] [-s scan lookups] [-d db dir]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (lookups <= 0) {
+        lookups = M_LOOKUPS_DEFAULT;
+    }
+    if (scans < 0) {
+        scans = 0;
+    }
+    if (p_dir == NULL) {
+        p_dir = mkdtemp(dir);
+        if (p_dir == NULL) {
+            fprintf(stderr, "fail: mkdtemp\n");
+            return -1;
+        }
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+    ln_genesishash_set(btc_block_get_genesis_hash(BTC_BLOCK_CHAIN_BTCREGTEST));
+    if (!ln_lmdb_set_home_dir(p_dir)) {
+        fprintf(stderr, "fail: db dir\n");
+        return -1;
+    }
+
+    char wif[BTC_SZ_WIF_STR_MAX + 1] = "";
+    char alias[LN_SZ_ALIAS_STR + 1] = "bench";
+    uint16_t port = 0;
+    if (!ln_db_init(wif, alias, &port, false)) {
+        fprintf(stderr, "fail: ln_db_init\n");
+        return -1;
+    }
+
+    printf("db: %s\n", p_dir);
+    if (invoices > 0) {
+        bench_run(invoices, lookups, scans);
+    } else {
+        const int INVOICES[] = { 10000, 1000000 };
+        for (size_t lp = 0; lp < ARRAY_SIZE(INVOICES); lp++) {
+            bench_run(INVOICES[lp], lookups, scans);
+        }
+    }
+
+    ln_db_term();
+    btc_term();
+    if (p_dir == dir) {
+        nftw(dir, rm_files, 10, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    }
+    return 0;
+}
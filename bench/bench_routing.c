@@ -0,0 +1,620 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_routing.c
+ *  @brief  route search benchmark
+ *
+ *  announcement DBを作成し、次をkey=value形式で1行ずつ出力する(行頭のphase=で区別する)。
+ *      - db    : DB作成時間
+ *      - build : #ln_routing_init()(graph構築)の時間とRSS増加量
+ *      - query : #ln_routing_calculate()の1回あたりの時間(平均, p50, p90, p99, 最大)
+ *      - total : 終了時の最大RSS(getrusage)
+ *
+ *  graphは次のどちらかから作る。
+ *      - 合成 : Barabasi-Albert modelのscale-free graph(-n node数, -c channel数)
+ *      - 記録 : -gで指定したgossip dump
+ *
+ *  gossip dumpは、[2byte big endianの長さ][gossip message]の繰り返しとする。
+ *  channel_announcementとchannel_updateだけを使用し、それ以外のmessageは読み飛ばす。
+ *  署名は検証しない。-wを指定すると、合成したgraphをこの形式で書き出す。
+ *
+ *  送金元, 送金先, 送金額は-rの値から決まる乱数で選ぶので、同じ引数なら同じqueryになる。
+ *
+ *      usage: bench_routing [-n nodes] [-c channels] [-g dump] [-w dump] [-q queries] [-a max amount_msat] [-m profile] [-r seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <ftw.h>
+#include <sys/resource.h>
+
+#include "utl_int.h"
+#include "utl_time.h"
+
+#include "btc.h"
+#include "btc_block.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+#include "ln_routing.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_NODES_DEFAULT     (2000)          ///< node数
+#define M_CHANNELS_DEFAULT  (10000)         ///< channel数
+#define M_QUERIES_DEFAULT   (5000)          ///< 経路検索回数
+#define M_AMOUNT_MIN        (1000)          ///< 送金額の最小[msat]
+#define M_AMOUNT_MAX        (100000000)     ///< 送金額の最大[msat](default)
+#define M_CAPACITY_MIN      (100000000.0)   ///< htlc_maximum_msatの最小
+#define M_CAPACITY_MAX      (10000000000.0) ///< htlc_maximum_msatの最大
+#define M_CLTV_EXPIRY       (100)
+#define M_PICK_RETRY        (10)            ///< 同じnodeを選んだ場合の選び直し回数
+
+#define M_TYPE_CNLANNO      (0x0100)
+#define M_TYPE_CNLUPD       (0x0102)
+#define M_SZ_SIG            (64)
+#define M_SZ_CNLANNO        (2 + M_SZ_SIG * 4 + 2 + 32 + 8 + BTC_SZ_PUBKEY * 4)
+#define M_SZ_CNLUPD         (2 + M_SZ_SIG + 32 + 8 + 4 + 1 + 1 + 2 + 8 + 4 + 4 + 8)
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static uint64_t         mRand;
+static FILE             *mpDump;            ///< -w
+
+static uint8_t          (*mpNodeIds)[BTC_SZ_PUBKEY];
+static int              mNodeNum;
+static int              mNodeAlloc;
+
+static int              mCnlAnno;           ///< 保存したchannel_announcement数
+static int              mCnlUpd;            ///< 保存したchannel_update数
+static int              mIgnored;           ///< 使用しなかったmessage数
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb)
+{
+    (void)pStat; (void)Type; (void)pFtwb;
+    return remove(pPath);
+}
+
+
+/** 現在のRSS[KB]
+ *
+ */
+static long rss_kb(void)
+{
+    long size = 0;
+    long pages = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%ld %ld", &size, &pages) != 2) {
+            pages = 0;
+        }
+        fclose(fp);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+/** 最大RSS[KB]
+ *
+ */
+static long maxrss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/** 再現できる乱数(xorshift64*)
+ *
+ */
+static uint64_t rand_u64(void)
+{
+    mRand ^= mRand >> 12;
+    mRand ^= mRand << 25;
+    mRand ^= mRand >> 27;
+    return mRand * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+
+/** [Min, Max)の対数一様乱数
+ *
+ */
+static uint64_t rand_log(double Min, double Max)
+{
+    double r = (double)(rand_u64() >> 11) / (double)(UINT64_C(1) << 53);
+    return (uint64_t)exp(log(Min) + (log(Max) - log(Min)) * r);
+}
+
+
+static int cmp_node_id(const void *p1, const void *p2)
+{
+    return memcmp(p1, p2, BTC_SZ_PUBKEY);
+}
+
+
+static int cmp_double(const void *p1, const void *p2)
+{
+    double d1 = *(const double *)p1;
+    double d2 = *(const double *)p2;
+    return (d1 < d2) ? -1 : (d1 > d2) ? 1 : 0;
+}
+
+
+/** query用node_id追加(重複は#node_uniq()で除く)
+ *
+ */
+static void node_add(const uint8_t *pNodeId)
+{
+    if (mNodeNum == mNodeAlloc) {
+        mNodeAlloc = (mNodeAlloc == 0) ? 1024 : mNodeAlloc * 2;
+        mpNodeIds = (uint8_t (*)[BTC_SZ_PUBKEY])realloc(mpNodeIds, BTC_SZ_PUBKEY * mNodeAlloc);
+    }
+    memcpy(mpNodeIds[mNodeNum++], pNodeId, BTC_SZ_PUBKEY);
+}
+
+
+static void node_uniq(void)
+{
+    qsort(mpNodeIds, mNodeNum, BTC_SZ_PUBKEY, cmp_node_id);
+    int num = 0;
+    for (int lp = 0; lp < mNodeNum; lp++) {
+        if ((num == 0) || (memcmp(mpNodeIds[num - 1], mpNodeIds[lp], BTC_SZ_PUBKEY) != 0)) {
+            memmove(mpNodeIds[num++], mpNodeIds[lp], BTC_SZ_PUBKEY);
+        }
+    }
+    mNodeNum = num;
+}
+
+
+/** gossip messageをDBに保存
+ *
+ * -wを指定していればgossip dumpにも書き出す。
+ *
+ * @param[in]       pData           gossip message
+ * @param[in]       Len             pData長
+ * @retval  true    成功(使用しないmessageも含む)
+ */
+static bool gossip_put(const uint8_t *pData, uint16_t Len)
+{
+    if (mpDump != NULL) {
+        uint8_t len[2];
+        utl_int_unpack_u16be(len, Len);
+        if ((fwrite(len, sizeof(len), 1, mpDump) != 1) || (fwrite(pData, Len, 1, mpDump) != 1)) {
+            fprintf(stderr, "fail: dump write\n");
+            return false;
+        }
+    }
+
+    if (Len < 2) {
+        mIgnored++;
+        return true;
+    }
+    utl_buf_t buf = { (CONST_CAST uint8_t *)pData, Len };
+    uint16_t type = utl_int_pack_u16be(pData);
+    if (type == M_TYPE_CNLANNO) {
+        uint64_t short_channel_id;
+        uint8_t node_id[2][BTC_SZ_PUBKEY];
+        if (!ln_get_ids_cnl_anno(&short_channel_id, node_id[0], node_id[1], pData, Len)) {
+            mIgnored++;
+            return true;
+        }
+        if (!ln_db_cnlanno_save(&buf, short_channel_id, NULL, node_id[0], node_id[1])) {
+            fprintf(stderr, "fail: cnlanno save\n");
+            return false;
+        }
+        node_add(node_id[0]);
+        node_add(node_id[1]);
+        mCnlAnno++;
+    } else if (type == M_TYPE_CNLUPD) {
+        ln_msg_channel_update_t msg;
+        if (!ln_channel_update_get_params(&msg, pData, Len)) {
+            mIgnored++;
+            return true;
+        }
+        if (!ln_db_cnlupd_save(&buf, &msg, NULL)) {
+            fprintf(stderr, "fail: cnlupd save\n");
+            return false;
+        }
+        mCnlUpd++;
+    } else {
+        mIgnored++;
+    }
+    return true;
+}
+
+
+/** 1channel分のchannel_announcement, channel_update(dir=0,1)を作成して保存
+ *
+ * 署名は検証しないので0のままにする。
+ *
+ * @param[in]       Index           channel番号
+ * @param[in]       pNode1          node_id
+ * @param[in]       pNode2          node_id
+ * @retval  true    成功
+ */
+static bool channel_put(int Index, const uint8_t *pNode1, const uint8_t *pNode2)
+{
+    uint8_t anno[M_SZ_CNLANNO];
+    uint8_t upd[M_SZ_CNLUPD];
+    const uint8_t *p_node[2] = { pNode1, pNode2 };
+    uint64_t short_channel_id = ((uint64_t)(500000 + Index / 2000) << 40) | ((uint64_t)(Index % 2000) << 16) | 1;
+    uint64_t capacity = rand_log(M_CAPACITY_MIN, M_CAPACITY_MAX);
+
+    //node_id昇順
+    if (memcmp(p_node[0], p_node[1], BTC_SZ_PUBKEY) > 0) {
+        p_node[0] = pNode2;
+        p_node[1] = pNode1;
+    }
+
+    //channel_announcement
+    uint8_t *p = anno;
+    memset(anno, 0, sizeof(anno));
+    utl_int_unpack_u16be(p, M_TYPE_CNLANNO);
+    p += 2 + M_SZ_SIG * 4;
+    utl_int_unpack_u16be(p, 0);             //features
+    p += 2;
+    memset(p, 0x6f, 32);                    //chain_hash
+    p += 32;
+    utl_int_unpack_u64be(p, short_channel_id);
+    p += 8;
+    memcpy(p, p_node[0], BTC_SZ_PUBKEY);
+    p += BTC_SZ_PUBKEY;
+    memcpy(p, p_node[1], BTC_SZ_PUBKEY);
+    p += BTC_SZ_PUBKEY;
+    memset(p, 0x02, BTC_SZ_PUBKEY * 2);     //bitcoin_key_1, 2
+    if (!gossip_put(anno, sizeof(anno))) {
+        return false;
+    }
+
+    //channel_update(dir=0,1)
+    for (int dir = 0; dir < 2; dir++) {
+        p = upd;
+        memset(upd, 0, sizeof(upd));
+        utl_int_unpack_u16be(p, M_TYPE_CNLUPD);
+        p += 2 + M_SZ_SIG;
+        memset(p, 0x6f, 32);
+        p += 32;
+        utl_int_unpack_u64be(p, short_channel_id);
+        p += 8;
+        utl_int_unpack_u32be(p, (uint32_t)utl_time_time());
+        p += 4;
+        *p++ = 0x01;                        //message_flags: option_channel_htlc_max
+        *p++ = (uint8_t)dir;
+        utl_int_unpack_u16be(p, (uint16_t)(40 + rand_u64() % 105));
+        p += 2;
+        utl_int_unpack_u64be(p, 1000);
+        p += 8;
+        utl_int_unpack_u32be(p, (uint32_t)(rand_u64() % 2000));
+        p += 4;
+        utl_int_unpack_u32be(p, (uint32_t)(1 + rand_u64() % 1000));
+        p += 4;
+        utl_int_unpack_u64be(p, capacity);
+        if (!gossip_put(upd, sizeof(upd))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** scale-free graph作成
+ *
+ * Barabasi-Albert model: 追加するnodeは、既存nodeを次数に比例した確率で選んでchannelを張る。
+ * 全node追加後にchannel数が足りなければ、両端とも次数に比例した確率で選んで追加する。
+ *
+ * @param[in]       Nodes           node数
+ * @param[in]       Channels        channel数
+ * @retval  true    成功
+ */
+static bool graph_create(int Nodes, int Channels)
+{
+    bool ret = true;
+    int per_node = Channels / Nodes;
+    if (per_node < 1) {
+        per_node = 1;
+    }
+
+    uint8_t (*p_nodes)[BTC_SZ_PUBKEY] = (uint8_t (*)[BTC_SZ_PUBKEY])malloc(BTC_SZ_PUBKEY * Nodes);
+    for (int lp = 0; lp < Nodes; lp++) {
+        p_nodes[lp][0] = 0x02;
+        for (int lp2 = 1; lp2 < BTC_SZ_PUBKEY; lp2++) {
+            p_nodes[lp][lp2] = (uint8_t)rand_u64();
+        }
+    }
+
+    //channelの両端を並べたもの。ここから一様に選ぶと次数に比例した確率になる
+    int *p_ends = (int *)malloc(sizeof(int) * 2 * Channels);
+    int ends = 0;
+    int channels = 0;
+    int node = 1;
+    int added = 0;
+    while (ret && (channels < Channels)) {
+        int node1;
+        int node2;
+        if (node < Nodes) {
+            //新しいnodeから既存nodeへ(最初のnodeは次数0なので直接選ぶ)
+            node1 = node;
+            node2 = (ends == 0) ? 0 : p_ends[rand_u64() % ends];
+            if (++added == per_node) {
+                node++;
+                added = 0;
+            }
+        } else {
+            node1 = p_ends[rand_u64() % ends];
+            node2 = p_ends[rand_u64() % ends];
+            for (int lp = 0; (node1 == node2) && (lp < M_PICK_RETRY); lp++) {
+                node2 = p_ends[rand_u64() % ends];
+            }
+            if (node1 == node2) {
+                node2 = (node1 + 1) % Nodes;
+            }
+        }
+        ret = channel_put(channels, p_nodes[node1], p_nodes[node2]);
+        p_ends[ends++] = node1;
+        p_ends[ends++] = node2;
+        channels++;
+    }
+    free(p_ends);
+    free(p_nodes);
+    return ret;
+}
+
+
+/** gossip dump読込み
+ *
+ * @param[in]       pPath           gossip dump
+ * @retval  true    成功
+ */
+static bool dump_load(const char *pPath)
+{
+    FILE *fp = fopen(pPath, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "fail: open %s\n", pPath);
+        return false;
+    }
+
+    bool ret = true;
+    uint8_t *p_data = (uint8_t *)malloc(UINT16_MAX);
+    uint8_t len[2];
+    while (fread(len, sizeof(len), 1, fp) == 1) {
+        uint16_t msg_len = utl_int_pack_u16be(len);
+        if ((msg_len > 0) && (fread(p_data, msg_len, 1, fp) != 1)) {
+            fprintf(stderr, "fail: truncated dump\n");
+            ret = false;
+            break;
+        }
+        if (!gossip_put(p_data, msg_len)) {
+            ret = false;
+            break;
+        }
+    }
+    free(p_data);
+    fclose(fp);
+    return ret;
+}
+
+
+/** 経路検索
+ *
+ * @param[in]       Queries         経路検索回数
+ * @param[in]       AmountMax       最大送金額[msat]
+ * @param[in]       Profile         edge cost profile
+ */
+static void query_run(int Queries, uint64_t AmountMax, ln_routing_profile_t Profile)
+{
+    double *p_elapsed = (double *)malloc(sizeof(double) * Queries);
+    double sum = 0.0;
+    int found = 0;
+
+    for (int lp = 0; lp < Queries; lp++) {
+        int payer = (int)(rand_u64() % mNodeNum);
+        int payee = (int)(rand_u64() % mNodeNum);
+        uint64_t amount = rand_log(M_AMOUNT_MIN, (double)AmountMax);
+        if (payer == payee) {
+            payee = (payee + 1) % mNodeNum;
+        }
+
+        ln_routing_result_t result;
+        double start = now_usec();
+        lnerr_route_t ret = ln_routing_calculate(
+                    &result, mpNodeIds[payer], mpNodeIds[payee], M_CLTV_EXPIRY, amount, 0, NULL, Profile);
+        p_elapsed[lp] = now_usec() - start;
+        sum += p_elapsed[lp];
+        if (ret == LNROUTE_OK) {
+            found++;
+        }
+    }
+    qsort(p_elapsed, Queries, sizeof(double), cmp_double);
+
+    printf("phase=query queries=%d found=%d mean_us=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f\n",
+        Queries, found, sum / Queries,
+        p_elapsed[Queries * 50 / 100], p_elapsed[Queries * 90 / 100], p_elapsed[Queries * 99 / 100],
+        p_elapsed[Queries - 1]);
+    free(p_elapsed);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int nodes = M_NODES_DEFAULT;
+    int channels = M_CHANNELS_DEFAULT;
+    int queries = M_QUERIES_DEFAULT;
+    uint64_t amount_max = M_AMOUNT_MAX;
+    uint64_t seed = 1;
+    ln_routing_profile_t profile = LN_ROUTING_PROFILE_FEE;
+    const char *p_load = NULL;
+    const char *p_write = NULL;
+    char dir[] = "/tmp/bench_routing_XXXXXX";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:g:w:q:a:m:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            nodes = atoi(optarg);
+            break;
+        case 'c':
+            channels = atoi(optarg);
+            break;
+        case 'g':
+            p_load = optarg;
+            break;
+        case 'w':
+            p_write = optarg;
+            break;
+        case 'q':
+            queries = atoi(optarg);
+            break;
+        case 'a':
+            amount_max = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (!ln_routing_profile_from_str(&profile, optarg)) {
+                fprintf(stderr, "fail: unknown profile: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n nodes] [-c channels] [-g dump] [-w dump] [-q queries] [-a max amount_msat] [-m profile] [-r seed]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (nodes < 2) {
+        nodes = M_NODES_DEFAULT;
+    }
+    if (channels <= 0) {
+        channels = M_CHANNELS_DEFAULT;
+    }
+    if (queries <= 0) {
+        queries = M_QUERIES_DEFAULT;
+    }
+    if (amount_max <= M_AMOUNT_MIN) {
+        amount_max = M_AMOUNT_MAX;
+    }
+    if (seed == 0) {
+        seed = 1;
+    }
+    mRand = seed;
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "fail: mkdtemp\n");
+        return -1;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+    ln_genesishash_set(btc_block_get_genesis_hash(BTC_BLOCK_CHAIN_BTCREGTEST));
+    if (!ln_lmdb_set_home_dir(dir)) {
+        fprintf(stderr, "fail: db dir\n");
+        return -1;
+    }
+    char wif[BTC_SZ_WIF_STR_MAX + 1] = "";
+    char alias[LN_SZ_ALIAS_STR + 1] = "bench";
+    uint16_t port = 0;
+    if (!ln_db_init(wif, alias, &port, false)) {
+        fprintf(stderr, "fail: ln_db_init\n");
+        return -1;
+    }
+
+    //DB作成
+    bool ret;
+    double start = now_usec();
+    if (p_load != NULL) {
+        ret = dump_load(p_load);
+    } else {
+        if (p_write != NULL) {
+            mpDump = fopen(p_write, "wb");
+            if (mpDump == NULL) {
+                fprintf(stderr, "fail: open %s\n", p_write);
+                return -1;
+            }
+        }
+        ret = graph_create(nodes, channels);
+        if (mpDump != NULL) {
+            fclose(mpDump);
+            mpDump = NULL;
+        }
+    }
+    double elapsed = now_usec() - start;
+    node_uniq();
+    if (ret && (mNodeNum < 2)) {
+        fprintf(stderr, "fail: no channel\n");
+        ret = false;
+    }
+    if (ret) {
+        printf("phase=db source=%s nodes=%d cnlanno=%d cnlupd=%d ignored=%d elapsed_us=%.0f seed=%" PRIu64 " profile=%s\n",
+            (p_load != NULL) ? "dump" : "synthetic", mNodeNum, mCnlAnno, mCnlUpd, mIgnored, elapsed,
+            seed, ln_routing_profile_str(profile));
+
+        //graph構築
+        long rss = rss_kb();
+        start = now_usec();
+        ret = ln_routing_init();
+        elapsed = now_usec() - start;
+        if (ret) {
+            printf("phase=build elapsed_us=%.0f rss_delta_kb=%ld\n", elapsed, rss_kb() - rss);
+            query_run(queries, amount_max, profile);
+        } else {
+            fprintf(stderr, "fail: ln_routing_init\n");
+        }
+    }
+    printf("phase=total maxrss_kb=%ld\n", maxrss_kb());
+
+    ln_routing_term();
+    free(mpNodeIds);
+    ln_db_term();
+    btc_term();
+    nftw(dir, rm_files, 10, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    return (ret) ? 0 : -1;
+}
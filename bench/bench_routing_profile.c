@@ -0,0 +1,615 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_routing_profile.c
+ *  @brief  routing edge cost profile evaluation
+ *
+ *  channelごとに残高を割り当てたgraphで送金を模擬し、edge cost profileごとに次を出力する。
+ *      - success   : 成功率
+ *      - attempts  : 成功した送金の平均試行回数 / 全送金の平均試行回数
+ *      - fee       : 成功した送金の平均fee[ppm]
+ *
+ *  送金は、routeの各channelで送金方向の残高がamt_to_forward以上であれば成功とする。
+ *  失敗したchannelはptarmdと同じく一時的なroute skipとして登録し(DBには書き込まない)、
+ *  最大M_ATTEMPTS_MAX回まで経路を再計算する。
+ *  送金ごとに#ln_routing_skip_work()でTEMP-->WORKにする(routepayと同じ)。
+ *
+ *  graphは、-dを指定しなければ合成したchannel_announcement/channel_updateから作る。
+ *  -dを指定した場合は、そのDB(ptarmdのDB directory)のannouncementを読み込む(DBは変更しない)。
+ *  残高はchannelの容量(htlc_maximum_msat, 無い場合は乱数)を乱数で分ける。
+ *
+ *      usage: bench_routing_profile [-n channels] [-p payments] [-a max amount_msat] [-r seed] [-d db dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <ftw.h>
+
+#include "utl_int.h"
+#include "utl_time.h"
+
+#include "btc.h"
+#include "btc_block.h"
+#include "btc_crypto.h"
+
+#include "ln.h"
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+#include "ln_routing.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CHANNELS_DEFAULT  (5000)          ///< 合成するchannel数
+#define M_PAYMENTS_DEFAULT  (500)           ///< 送金数
+#define M_AMOUNT_MIN        (10000)         ///< 送金額の最小[msat]
+#define M_AMOUNT_MAX        (1000000000)    ///< 送金額の最大[msat](default)
+#define M_CAPACITY_MIN      (100000000.0)   ///< 容量の最小[msat]
+#define M_CAPACITY_MAX      (10000000000.0) ///< 容量の最大[msat]
+#define M_ATTEMPTS_MAX      (1 + 10)        ///< 1回の送金の最大試行回数(ptarmdのM_RETRY_COUNT_MAX)
+#define M_NODES_DIV         (4)             ///< node数 = channel数 / M_NODES_DIV
+#define M_CLTV_EXPIRY       (100)
+
+#define M_TYPE_CNLANNO      (0x0100)
+#define M_TYPE_CNLUPD       (0x0102)
+#define M_SZ_SIG            (64)
+#define M_SZ_CNLANNO        (2 + M_SZ_SIG * 4 + 2 + 32 + 8 + BTC_SZ_PUBKEY * 4)
+#define M_SZ_CNLUPD         (2 + M_SZ_SIG + 32 + 8 + 4 + 1 + 1 + 2 + 8 + 4 + 4 + 8)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** 模擬するchannel
+ *
+ */
+typedef struct {
+    uint64_t    short_channel_id;
+    uint8_t     node_id[2][BTC_SZ_PUBKEY];
+    uint64_t    capacity;                   ///< htlc_maximum_msat(0: 不明)
+    uint64_t    balance[2];                 ///< [0]node_id_1 --> node_id_2, [1]node_id_2 --> node_id_1
+} sim_channel_t;
+
+
+/** profileごとの結果
+ *
+ */
+typedef struct {
+    int         success;
+    int         noroute;                    ///< 1回目から経路が無い
+    uint64_t    attempts_success;
+    uint64_t    attempts_all;
+    double      fee_ppm;
+    double      elapsed;                    ///< 経路計算時間[usec]
+} result_t;
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static sim_channel_t    *mpChannels;
+static int              mChannelNum;
+static uint8_t          (*mpNodeIds)[BTC_SZ_PUBKEY];
+static int              mNodeNum;
+static uint64_t         mRand;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+void ln_lmdb_set_env(MDB_env *pEnv, MDB_env *pNode, MDB_env *pAnno, MDB_env *pWallet);
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb)
+{
+    (void)pStat; (void)Type; (void)pFtwb;
+    return remove(pPath);
+}
+
+
+/** 再現できる乱数(xorshift64*)
+ *
+ */
+static uint64_t rand_u64(void)
+{
+    mRand ^= mRand >> 12;
+    mRand ^= mRand << 25;
+    mRand ^= mRand >> 27;
+    return mRand * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+
+static double rand_double(void)
+{
+    return (double)(rand_u64() >> 11) / (double)(UINT64_C(1) << 53);
+}
+
+
+/** [Min, Max)の対数一様乱数
+ *
+ */
+static uint64_t rand_log(double Min, double Max)
+{
+    return (uint64_t)exp(log(Min) + (log(Max) - log(Min)) * rand_double());
+}
+
+
+static int cmp_scid(const void *pKey, const void *pElem)
+{
+    uint64_t key = *(const uint64_t *)pKey;
+    const sim_channel_t *p_elem = (const sim_channel_t *)pElem;
+    return (key < p_elem->short_channel_id) ? -1 : (key > p_elem->short_channel_id) ? 1 : 0;
+}
+
+
+static int cmp_node_id(const void *p1, const void *p2)
+{
+    return memcmp(p1, p2, BTC_SZ_PUBKEY);
+}
+
+
+/** channel_announcement, channel_update(dir=0,1)をDBに保存
+ *
+ * 署名は検証しないので0のままにする。
+ * channelの1/4はhtlc_maximum_msatを持たない(容量不明)。
+ *
+ * @param[in]       Channels        channel数
+ * @retval  true    成功
+ */
+static bool anno_create(int Channels)
+{
+    int nodes = Channels / M_NODES_DIV;
+    if (nodes < 2) {
+        nodes = 2;
+    }
+    uint8_t (*p_nodes)[BTC_SZ_PUBKEY] = (uint8_t (*)[BTC_SZ_PUBKEY])malloc(BTC_SZ_PUBKEY * nodes);
+    for (int lp = 0; lp < nodes; lp++) {
+        p_nodes[lp][0] = 0x02;
+        for (int lp2 = 1; lp2 < BTC_SZ_PUBKEY; lp2++) {
+            p_nodes[lp][lp2] = (uint8_t)rand_u64();
+        }
+    }
+
+    bool ret = true;
+    uint8_t anno[M_SZ_CNLANNO];
+    uint8_t upd[M_SZ_CNLUPD];
+    for (int lp = 0; lp < Channels; lp++) {
+        //node_id昇順
+        const uint8_t *p_node[2] = { p_nodes[lp % nodes], p_nodes[rand_u64() % nodes] };
+        if (p_node[0] == p_node[1]) {
+            p_node[1] = p_nodes[(lp + 1) % nodes];
+        }
+        if (memcmp(p_node[0], p_node[1], BTC_SZ_PUBKEY) > 0) {
+            const uint8_t *p_tmp = p_node[0];
+            p_node[0] = p_node[1];
+            p_node[1] = p_tmp;
+        }
+        uint64_t short_channel_id = ((uint64_t)(500000 + lp / 2000) << 40) | ((uint64_t)(lp % 2000) << 16) | 1;
+        uint64_t capacity = rand_log(M_CAPACITY_MIN, M_CAPACITY_MAX);
+        bool htlc_max = (lp % 4 != 0);
+
+        //channel_announcement
+        uint8_t *p = anno;
+        memset(anno, 0, sizeof(anno));
+        utl_int_unpack_u16be(p, M_TYPE_CNLANNO);
+        p += 2 + M_SZ_SIG * 4;
+        utl_int_unpack_u16be(p, 0);             //features
+        p += 2;
+        memset(p, 0x6f, 32);                    //chain_hash
+        p += 32;
+        utl_int_unpack_u64be(p, short_channel_id);
+        p += 8;
+        memcpy(p, p_node[0], BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memcpy(p, p_node[1], BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memset(p, 0x02, BTC_SZ_PUBKEY * 2);     //bitcoin_key_1, 2
+        utl_buf_t buf = { anno, sizeof(anno) };
+        if (!ln_db_cnlanno_save(&buf, short_channel_id, NULL, p_node[0], p_node[1])) {
+            fprintf(stderr, "fail: cnlanno save(%d)\n", lp);
+            ret = false;
+            break;
+        }
+
+        //channel_update(dir=0,1)
+        for (int dir = 0; dir < 2; dir++) {
+            p = upd;
+            memset(upd, 0, sizeof(upd));
+            utl_int_unpack_u16be(p, M_TYPE_CNLUPD);
+            p += 2 + M_SZ_SIG;
+            memset(p, 0x6f, 32);
+            p += 32;
+            utl_int_unpack_u64be(p, short_channel_id);
+            p += 8;
+            utl_int_unpack_u32be(p, (uint32_t)utl_time_time());
+            p += 4;
+            *p++ = (htlc_max) ? 0x01 : 0x00;    //message_flags: option_channel_htlc_max
+            *p++ = (uint8_t)dir;
+            utl_int_unpack_u16be(p, (uint16_t)(40 + rand_u64() % 105));
+            p += 2;
+            utl_int_unpack_u64be(p, 1000);
+            p += 8;
+            utl_int_unpack_u32be(p, (uint32_t)(rand_u64() % 2000));
+            p += 4;
+            utl_int_unpack_u32be(p, (uint32_t)(1 + rand_u64() % 1000));
+            p += 4;
+            if (htlc_max) {
+                utl_int_unpack_u64be(p, capacity);
+                p += 8;
+            }
+
+            ln_msg_channel_update_t msg;
+            buf.buf = upd;
+            buf.len = (uint32_t)(p - upd);
+            if (!ln_channel_update_get_params(&msg, buf.buf, (uint16_t)buf.len) ||
+                    !ln_db_cnlupd_save(&buf, &msg, NULL)) {
+                fprintf(stderr, "fail: cnlupd save(%d)\n", lp);
+                ret = false;
+                break;
+            }
+        }
+        if (!ret) {
+            break;
+        }
+    }
+    free(p_nodes);
+    return ret;
+}
+
+
+/** 記録済みDBを開く(routingと同じ。書込みはしない)
+ *
+ * @param[in]       pDir            DB directory
+ * @retval  true    成功
+ */
+static bool db_open_recorded(const char *pDir)
+{
+    MDB_env *p_env[3] = { NULL, NULL, NULL };
+    const char *p_path[3];
+
+    if (!ln_lmdb_set_home_dir(pDir)) {
+        return false;
+    }
+    p_path[0] = ln_lmdb_get_channel_db_path();
+    p_path[1] = ln_lmdb_get_node_db_path();
+    p_path[2] = ln_lmdb_get_anno_db_path();
+    for (int lp = 0; lp < 3; lp++) {
+        if ((mdb_env_create(&p_env[lp]) != 0) ||
+                (mdb_env_set_maxdbs(p_env[lp], 10) != 0) ||
+                (mdb_env_open(p_env[lp], p_path[lp], 0, 0664) != 0)) {
+            fprintf(stderr, "fail: cannot open[%s]\n", p_path[lp]);
+            return false;
+        }
+    }
+    ln_lmdb_set_env(p_env[0], p_env[1], p_env[2], NULL);
+
+    uint8_t my_node_id[BTC_SZ_PUBKEY];
+    btc_block_chain_t gtype;
+    if (!ln_db_version_check(my_node_id, &gtype)) {
+        fprintf(stderr, "fail: DB version mismatch\n");
+        return false;
+    }
+    ln_genesishash_set(btc_block_get_genesis_hash(gtype));
+    btc_init(gtype, true);
+    return true;
+}
+
+
+/** announcement DBから模擬channelを作る
+ *
+ * 残高は容量(htlc_maximum_msat, 無い場合は対数一様乱数)を一様乱数で分ける。
+ *
+ * @retval  true    成功
+ */
+static bool sim_load(void)
+{
+    if (!ln_db_anno_transaction()) {
+        fprintf(stderr, "fail: no announce DB\n");
+        return false;
+    }
+
+    int alloc = 0;
+    void *p_cur;
+    if (ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO)) {
+        uint64_t short_channel_id;
+        char type;
+        uint32_t timestamp;
+        utl_buf_t buf = UTL_BUF_INIT;
+
+        while (ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, &timestamp, &buf)) {
+            if (type == LN_DB_CNLANNO_ANNO) {
+                if (mChannelNum == alloc) {
+                    alloc = (alloc == 0) ? 1024 : alloc * 2;
+                    mpChannels = (sim_channel_t *)realloc(mpChannels, sizeof(sim_channel_t) * alloc);
+                }
+                sim_channel_t *p_chan = &mpChannels[mChannelNum];
+                uint64_t scid;
+                if (ln_get_ids_cnl_anno(&scid, p_chan->node_id[0], p_chan->node_id[1], buf.buf, (uint16_t)buf.len)) {
+                    p_chan->short_channel_id = short_channel_id;
+                    p_chan->capacity = 0;
+                    mChannelNum++;
+                }
+            } else if ((mChannelNum > 0) && (mpChannels[mChannelNum - 1].short_channel_id == short_channel_id)) {
+                //channel_announcementの後ろに続く
+                ln_msg_channel_update_t upd;
+                if (ln_channel_update_get_params(&upd, buf.buf, (uint16_t)buf.len) &&
+                        (upd.htlc_maximum_msat > mpChannels[mChannelNum - 1].capacity)) {
+                    mpChannels[mChannelNum - 1].capacity = upd.htlc_maximum_msat;
+                }
+            }
+            utl_buf_free(&buf);
+        }
+        ln_db_anno_cur_close(p_cur);
+    }
+    ln_db_anno_commit(false);
+    if (mChannelNum == 0) {
+        fprintf(stderr, "fail: no channel\n");
+        return false;
+    }
+
+    //keyの昇順に並んでいるので、short_channel_idで二分探索できる
+    mpNodeIds = (uint8_t (*)[BTC_SZ_PUBKEY])malloc(BTC_SZ_PUBKEY * 2 * mChannelNum);
+    for (int lp = 0; lp < mChannelNum; lp++) {
+        sim_channel_t *p_chan = &mpChannels[lp];
+        uint64_t capacity = p_chan->capacity;
+        if (capacity == 0) {
+            capacity = rand_log(M_CAPACITY_MIN, M_CAPACITY_MAX);
+        }
+        p_chan->balance[0] = (uint64_t)(capacity * rand_double());
+        p_chan->balance[1] = capacity - p_chan->balance[0];
+        memcpy(mpNodeIds[lp * 2], p_chan->node_id[0], BTC_SZ_PUBKEY);
+        memcpy(mpNodeIds[lp * 2 + 1], p_chan->node_id[1], BTC_SZ_PUBKEY);
+    }
+    qsort(mpNodeIds, mChannelNum * 2, BTC_SZ_PUBKEY, cmp_node_id);
+    mNodeNum = 0;
+    for (int lp = 0; lp < mChannelNum * 2; lp++) {
+        if ((mNodeNum == 0) || (memcmp(mpNodeIds[mNodeNum - 1], mpNodeIds[lp], BTC_SZ_PUBKEY) != 0)) {
+            memmove(mpNodeIds[mNodeNum++], mpNodeIds[lp], BTC_SZ_PUBKEY);
+        }
+    }
+    return true;
+}
+
+
+/** routeを模擬する
+ *
+ * @param[out]      pFailScid       失敗したchannel
+ * @param[in]       pResult         route
+ * @retval  true    全channelの残高が足りる
+ */
+static bool sim_route(uint64_t *pFailScid, const ln_routing_result_t *pResult)
+{
+    for (int lp = 0; lp < pResult->num_hops - 1; lp++) {
+        const ln_hop_datain_t *p_hop = &pResult->hop_datain[lp];
+        sim_channel_t *p_chan = (sim_channel_t *)bsearch(
+                    &p_hop->short_channel_id, mpChannels, mChannelNum, sizeof(sim_channel_t), cmp_scid);
+        if (p_chan == NULL) {
+            *pFailScid = p_hop->short_channel_id;
+            return false;
+        }
+        int dir = (memcmp(p_hop->pubkey, p_chan->node_id[0], BTC_SZ_PUBKEY) == 0) ? 0 : 1;
+        if (p_chan->balance[dir] < p_hop->amt_to_forward) {
+            *pFailScid = p_hop->short_channel_id;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** 1 profileの評価
+ *
+ * 乱数はprofileごとに初期化するので、どのprofileも同じ送金を行う。
+ *
+ * @param[out]      pResult
+ * @param[in]       Profile
+ * @param[in]       Payments        送金数
+ * @param[in]       AmountMax       最大送金額[msat]
+ * @param[in]       Seed
+ */
+static void sim_run(result_t *pResult, ln_routing_profile_t Profile, int Payments, uint64_t AmountMax, uint64_t Seed)
+{
+    memset(pResult, 0, sizeof(result_t));
+
+    //失敗履歴を引き継がないよう、graphを作り直す
+    ln_routing_term();
+    if (!ln_routing_init()) {
+        fprintf(stderr, "fail: ln_routing_init\n");
+        return;
+    }
+    ln_routing_skip_drop(false);
+
+    mRand = Seed;
+    for (int lp = 0; lp < Payments; lp++) {
+        int payer = (int)(rand_u64() % mNodeNum);
+        int payee = (int)(rand_u64() % mNodeNum);
+        uint64_t amount = rand_log(M_AMOUNT_MIN, (double)AmountMax);
+        if (payer == payee) {
+            payee = (payee + 1) % mNodeNum;
+        }
+
+        //routepayと同じく、前回までの一時的なskipは低優先度にする
+        ln_routing_skip_work(true);
+
+        int attempts;
+        bool success = false;
+        for (attempts = 1; attempts <= M_ATTEMPTS_MAX; attempts++) {
+            ln_routing_result_t result;
+            double start = now_usec();
+            lnerr_route_t err = ln_routing_calculate(
+                        &result, mpNodeIds[payer], mpNodeIds[payee], M_CLTV_EXPIRY, amount, 0, NULL, Profile);
+            pResult->elapsed += now_usec() - start;
+            if (err != LNROUTE_OK) {
+                if (attempts == 1) {
+                    pResult->noroute++;
+                }
+                break;
+            }
+
+            uint64_t fail_scid;
+            if (sim_route(&fail_scid, &result)) {
+                success = true;
+                pResult->fee_ppm += (double)(result.hop_datain[0].amt_to_forward - amount) * 1000000.0 / amount;
+                break;
+            }
+            ln_routing_skip_add(fail_scid, true, (uint64_t)utl_time_time() + LN_DB_ROUTE_SKIP_TEMP_SEC);
+        }
+        if (attempts > M_ATTEMPTS_MAX) {
+            attempts = M_ATTEMPTS_MAX;
+        }
+        pResult->attempts_all += attempts;
+        if (success) {
+            pResult->success++;
+            pResult->attempts_success += attempts;
+        }
+    }
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int channels = M_CHANNELS_DEFAULT;
+    int payments = M_PAYMENTS_DEFAULT;
+    uint64_t amount_max = M_AMOUNT_MAX;
+    uint64_t seed = 1;
+    char dir[] = "/tmp/bench_routing_profile_XXXXXX";
+    const char *p_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:a:r:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            channels = atoi(optarg);
+            break;
+        case 'p':
+            payments = atoi(optarg);
+            break;
+        case 'a':
+            amount_max = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            p_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n channels] [-p payments] [-a max amount_msat] [-r seed] [-d db dir]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (channels <= 0) {
+        channels = M_CHANNELS_DEFAULT;
+    }
+    if (payments <= 0) {
+        payments = M_PAYMENTS_DEFAULT;
+    }
+    if (amount_max <= M_AMOUNT_MIN) {
+        amount_max = M_AMOUNT_MAX;
+    }
+    if (seed == 0) {
+        seed = 1;
+    }
+    mRand = seed;
+
+    //logは出力しない(utl_log_init()しない)
+    if (p_dir != NULL) {
+        if (!db_open_recorded(p_dir)) {
+            return -1;
+        }
+        printf("db: %s (recorded)\n", p_dir);
+    } else {
+        p_dir = mkdtemp(dir);
+        if (p_dir == NULL) {
+            fprintf(stderr, "fail: mkdtemp\n");
+            return -1;
+        }
+        btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+        ln_genesishash_set(btc_block_get_genesis_hash(BTC_BLOCK_CHAIN_BTCREGTEST));
+        if (!ln_lmdb_set_home_dir(p_dir)) {
+            fprintf(stderr, "fail: db dir\n");
+            return -1;
+        }
+        char wif[BTC_SZ_WIF_STR_MAX + 1] = "";
+        char alias[LN_SZ_ALIAS_STR + 1] = "bench";
+        uint16_t port = 0;
+        if (!ln_db_init(wif, alias, &port, false)) {
+            fprintf(stderr, "fail: ln_db_init\n");
+            return -1;
+        }
+        printf("db: %s (synthetic)\n", p_dir);
+        if (!anno_create(channels)) {
+            return -1;
+        }
+    }
+
+    if (sim_load()) {
+        printf("channels=%d nodes=%d payments=%d amount_msat=%d-%" PRIu64 " seed=%" PRIu64 "\n",
+            mChannelNum, mNodeNum, payments, M_AMOUNT_MIN, amount_max, seed);
+        for (int lp = 0; lp < LN_ROUTING_PROFILE_MAX; lp++) {
+            result_t result;
+            sim_run(&result, (ln_routing_profile_t)lp, payments, amount_max, seed);
+            printf("profile=%s success=%d/%d rate=%.3f noroute=%d attempts_success=%.2f attempts_all=%.2f fee_ppm=%.0f route_us=%.0f\n",
+                ln_routing_profile_str((ln_routing_profile_t)lp),
+                result.success, payments, (double)result.success / payments, result.noroute,
+                (result.success > 0) ? (double)result.attempts_success / result.success : 0.0,
+                (double)result.attempts_all / payments,
+                (result.success > 0) ? result.fee_ppm / result.success : 0.0,
+                result.elapsed / result.attempts_all);
+        }
+    }
+
+    ln_routing_term();
+    free(mpChannels);
+    free(mpNodeIds);
+    ln_db_term();
+    btc_term();
+    if (p_dir == dir) {
+        nftw(dir, rm_files, 10, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    }
+    return 0;
+}
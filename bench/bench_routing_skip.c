@@ -0,0 +1,360 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_routing_skip.c
+ *  @brief  route skip benchmark
+ *
+ *  channel_announcement/channel_updateをDBに保存し、route skip DBのentry数(0, 1k, 50k)ごとに次を出力する。
+ *      - build : #ln_routing_init()(graph構築 + route skip読込み)
+ *      - query : #ln_routing_calculate()の1回あたりの時間
+ *      - db    : 全channelを#ln_db_route_skip_search()した時間(常駐前は1queryごとにこの検索を行っていた)
+ *
+ *  route skipのentryは5%だけが存在するchannelで、残りは閉じたchannel(graphに無い)を想定している。
+ *
+ *      usage: bench_routing_skip [-n channels] [-q queries] [-s skips] [-d db dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <ftw.h>
+
+#include "btc.h"
+#include "btc_block.h"
+#include "btc_crypto.h"
+#include "utl_int.h"
+#include "utl_time.h"
+
+#include "ln.h"
+#include "ln_db.h"
+#include "ln_db_lmdb.h"
+#include "ln_routing.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CHANNELS_DEFAULT  (20000)         ///< channel数
+#define M_QUERIES_DEFAULT   (100)           ///< 経路検索回数
+#define M_NODES_DIV         (4)             ///< node数 = channel数 / M_NODES_DIV
+#define M_SKIP_REAL         (20)            ///< route skipのうち1/M_SKIP_REALが存在するchannel
+
+#define M_TYPE_CNLANNO      (0x0100)
+#define M_TYPE_CNLUPD       (0x0102)
+#define M_SZ_SIG            (64)
+#define M_SZ_CNLANNO        (2 + M_SZ_SIG * 4 + 2 + 32 + 8 + BTC_SZ_PUBKEY * 4)
+#define M_SZ_CNLUPD         (2 + M_SZ_SIG + 32 + 8 + 4 + 1 + 1 + 2 + 8 + 4 + 4 + 8)
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static int          mNodes;
+static uint8_t      (*mpNodeIds)[BTC_SZ_PUBKEY];
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb)
+{
+    (void)pStat; (void)Type; (void)pFtwb;
+    return remove(pPath);
+}
+
+
+static uint64_t channel_scid(int Index)
+{
+    return ((uint64_t)(500000 + Index / 2000) << 40) | ((uint64_t)(Index % 2000) << 16) | 1;
+}
+
+
+/** channel_announcement, channel_update(dir=0,1)をDBに保存
+ *
+ * 署名は検証しないので0のままにする。
+ *
+ * @param[in]       Channels        channel数
+ * @retval  true    成功
+ */
+static bool anno_create(int Channels)
+{
+    mNodes = Channels / M_NODES_DIV;
+    if (mNodes < 2) {
+        mNodes = 2;
+    }
+    mpNodeIds = (uint8_t (*)[BTC_SZ_PUBKEY])malloc(BTC_SZ_PUBKEY * mNodes);
+    for (int lp = 0; lp < mNodes; lp++) {
+        mpNodeIds[lp][0] = 0x02;
+        btc_rng_rand(mpNodeIds[lp] + 1, BTC_SZ_PUBKEY - 1);
+    }
+
+    uint8_t anno[M_SZ_CNLANNO];
+    uint8_t upd[M_SZ_CNLUPD];
+    for (int lp = 0; lp < Channels; lp++) {
+        //node_id昇順
+        const uint8_t *p_node[2] = { mpNodeIds[lp % mNodes], mpNodeIds[(lp * 7 + 1) % mNodes] };
+        if (p_node[0] == p_node[1]) {
+            p_node[1] = mpNodeIds[(lp + 1) % mNodes];
+        }
+        if (memcmp(p_node[0], p_node[1], BTC_SZ_PUBKEY) > 0) {
+            const uint8_t *p_tmp = p_node[0];
+            p_node[0] = p_node[1];
+            p_node[1] = p_tmp;
+        }
+        uint64_t short_channel_id = channel_scid(lp);
+
+        //channel_announcement
+        uint8_t *p = anno;
+        memset(anno, 0, sizeof(anno));
+        utl_int_unpack_u16be(p, M_TYPE_CNLANNO);
+        p += 2 + M_SZ_SIG * 4;
+        utl_int_unpack_u16be(p, 0);             //features
+        p += 2;
+        memset(p, 0x6f, 32);                    //chain_hash
+        p += 32;
+        utl_int_unpack_u64be(p, short_channel_id);
+        p += 8;
+        memcpy(p, p_node[0], BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memcpy(p, p_node[1], BTC_SZ_PUBKEY);
+        p += BTC_SZ_PUBKEY;
+        memset(p, 0x02, BTC_SZ_PUBKEY * 2);     //bitcoin_key_1, 2
+        utl_buf_t buf = { anno, sizeof(anno) };
+        if (!ln_db_cnlanno_save(&buf, short_channel_id, NULL, p_node[0], p_node[1])) {
+            fprintf(stderr, "fail: cnlanno save(%d)\n", lp);
+            return false;
+        }
+
+        //channel_update(dir=0,1)
+        for (int dir = 0; dir < 2; dir++) {
+            p = upd;
+            memset(upd, 0, sizeof(upd));
+            utl_int_unpack_u16be(p, M_TYPE_CNLUPD);
+            p += 2 + M_SZ_SIG;
+            memset(p, 0x6f, 32);
+            p += 32;
+            utl_int_unpack_u64be(p, short_channel_id);
+            p += 8;
+            utl_int_unpack_u32be(p, (uint32_t)utl_time_time());
+            p += 4;
+            *p++ = 0x01;                        //message_flags: option_channel_htlc_max
+            *p++ = (uint8_t)dir;
+            utl_int_unpack_u16be(p, 144);
+            p += 2;
+            utl_int_unpack_u64be(p, 1000);
+            p += 8;
+            utl_int_unpack_u32be(p, 1000 + lp % 100);
+            p += 4;
+            utl_int_unpack_u32be(p, 1 + lp % 1000);
+            p += 4;
+            utl_int_unpack_u64be(p, 1000000000);
+
+            ln_msg_channel_update_t msg;
+            buf.buf = upd;
+            buf.len = sizeof(upd);
+            if (!ln_channel_update_get_params(&msg, upd, sizeof(upd)) ||
+                    !ln_db_cnlupd_save(&buf, &msg, NULL)) {
+                fprintf(stderr, "fail: cnlupd save(%d)\n", lp);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+/** route skip DBを作り直す
+ *
+ * 1/3は有効期限付きの一時的なskip、残りは恒久的なskipにする。
+ *
+ * @param[in]       Channels        channel数
+ * @param[in]       Skips           route skip数
+ * @retval  true    成功
+ */
+static bool skip_create(int Channels, int Skips)
+{
+    uint64_t expiry = (uint64_t)utl_time_time() + LN_DB_ROUTE_SKIP_TEMP_SEC;
+
+    ln_db_route_skip_drop(false);
+    for (int lp = 0; lp < Skips; lp++) {
+        int idx = (lp % M_SKIP_REAL == 0) ? (lp / M_SKIP_REAL) % Channels : Channels + lp;
+        bool temp = (lp % 3 == 0);
+        if (!ln_db_route_skip_save(channel_scid(idx), temp, (temp) ? expiry : 0)) {
+            fprintf(stderr, "fail: skip save(%d)\n", lp);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** 計測
+ *
+ * @param[in]       Channels        channel数
+ * @param[in]       Skips           route skip数
+ * @param[in]       Queries         経路検索回数
+ */
+static void bench_run(int Channels, int Skips, int Queries)
+{
+    if (!skip_create(Channels, Skips)) {
+        return;
+    }
+
+    //graph構築
+    ln_routing_term();
+    double start = now_usec();
+    if (!ln_routing_init()) {
+        fprintf(stderr, "fail: ln_routing_init\n");
+        return;
+    }
+    double build = now_usec() - start;
+
+    //経路検索
+    int found = 0;
+    start = now_usec();
+    for (int lp = 0; lp < Queries; lp++) {
+        ln_routing_result_t result;
+        const uint8_t *p_payer = mpNodeIds[(lp * 13) % mNodes];
+        const uint8_t *p_payee = mpNodeIds[(lp * 31 + mNodes / 2) % mNodes];
+        if (p_payer == p_payee) {
+            continue;
+        }
+        lnerr_route_t ret = ln_routing_calculate(&result, p_payer, p_payee, 100, 10000000, 0, NULL, LN_ROUTING_PROFILE_FEE);
+        if (ret == LNROUTE_OK) {
+            found++;
+        }
+    }
+    double query = now_usec() - start;
+
+    //常駐前の1queryあたりのDB検索
+    int hit = 0;
+    start = now_usec();
+    for (int lp = 0; lp < Channels; lp++) {
+        if (ln_db_route_skip_search(channel_scid(lp)) != LN_DB_ROUTE_SKIP_NONE) {
+            hit++;
+        }
+    }
+    double db = now_usec() - start;
+
+    printf("skips=%-6d build=%.0fus query=%.0fus/query(found=%d/%d) db=%.0fus/query(hit=%d)\n",
+        Skips, build, query / Queries, found, Queries, db, hit);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int channels = M_CHANNELS_DEFAULT;
+    int queries = M_QUERIES_DEFAULT;
+    int skips = -1;
+    char dir[] = "/tmp/bench_routing_skip_XXXXXX";
+    const char *p_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:q:s:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            channels = atoi(optarg);
+            break;
+        case 'q':
+            queries = atoi(optarg);
+            break;
+        case 's':
+            skips = atoi(optarg);
+            break;
+        case 'd':
+            p_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n channels] [-q queries] [-s skips] [-d db dir]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (channels <= 0) {
+        channels = M_CHANNELS_DEFAULT;
+    }
+    if (queries <= 0) {
+        queries = M_QUERIES_DEFAULT;
+    }
+    if (p_dir == NULL) {
+        p_dir = mkdtemp(dir);
+        if (p_dir == NULL) {
+            fprintf(stderr, "fail: mkdtemp\n");
+            return -1;
+        }
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+    ln_genesishash_set(btc_block_get_genesis_hash(BTC_BLOCK_CHAIN_BTCREGTEST));
+    if (!ln_lmdb_set_home_dir(p_dir)) {
+        fprintf(stderr, "fail: db dir\n");
+        return -1;
+    }
+
+    char wif[BTC_SZ_WIF_STR_MAX + 1] = "";
+    char alias[LN_SZ_ALIAS_STR + 1] = "bench";
+    uint16_t port = 0;
+    if (!ln_db_init(wif, alias, &port, false)) {
+        fprintf(stderr, "fail: ln_db_init\n");
+        return -1;
+    }
+
+    printf("db: %s\n", p_dir);
+    double start = now_usec();
+    if (anno_create(channels)) {
+        printf("channels=%d nodes=%d create=%.0fus\n", channels, mNodes, now_usec() - start);
+        if (skips >= 0) {
+            bench_run(channels, skips, queries);
+        } else {
+            const int SKIPS[] = { 0, 1000, 50000 };
+            for (size_t lp = 0; lp < ARRAY_SIZE(SKIPS); lp++) {
+                bench_run(channels, SKIPS[lp], queries);
+            }
+        }
+    }
+
+    ln_routing_term();
+    free(mpNodeIds);
+    ln_db_term();
+    btc_term();
+    if (p_dir == dir) {
+        nftw(dir, rm_files, 10, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    }
+    return 0;
+}
@@ -0,0 +1,329 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_scid_cache.c
+ *  @brief  short_channel_id UTXO cache benchmark
+ *
+ *  channel_announcementの中継1周分(全short_channel_idの未使用確認)の時間を、次の順に出力する。
+ *      - none  : cacheを使わない(従来の#check_unspent_short_channel_id()と同じ2RPC/announcement)
+ *      - cold  : cacheが空
+ *      - warm  : 全short_channel_idが登録済み
+ *      - block : 連続したblock(M_SPENT個のfunding_txを使用)を反映した後
+ *      - resync: 連続しないblock(reorg)を反映した後(TXIDは保持しているので1RPC/announcement)
+ *
+ *  blockの反映はmonitoringと同じく#scid_cache_block()の後に#watch_block()で1回だけ走査する。
+ *  bitcoind RPCは呼び出し1回ごとに-lで指定した時間だけ待つstubで置き換える。
+ *
+ *      usage: bench_scid_cache [-n channels] [-l usec/RPC]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "btc.h"
+#include "btc_crypto.h"
+#include "btc_block.h"
+#include "btc_tx_buf.h"
+
+#include "ln.h"
+
+#include "btcrpc.h"
+#include "scid_cache.h"
+#include "watch.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CHANNELS_DEFAULT  (5000)          ///< short_channel_id数
+#define M_LATENCY_DEFAULT   (200)           ///< 1RPCあたりの待ち時間[usec]
+#define M_HEIGHT_BASE       (500000)        ///< short_channel_idのblock height
+#define M_CHANNELS_BLOCK    (1000)          ///< 1blockあたりのfunding_tx数
+#define M_TXS               (2000)          ///< 反映するblockのtransaction数
+#define M_SPENT             (10)            ///< 反映するblockで使用するfunding_tx数
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static useconds_t   mLatency = M_LATENCY_DEFAULT;
+static uint64_t     mRpcCount;
+
+
+/**************************************************************************
+ * bitcoind stub
+ **************************************************************************/
+
+/** short_channel_idのTXID
+ *
+ */
+static void make_txid(uint8_t *pTxid, uint32_t BHeight, uint32_t BIndex)
+{
+    uint8_t data[sizeof(uint32_t) * 2];
+    memcpy(data, &BHeight, sizeof(BHeight));
+    memcpy(data + sizeof(BHeight), &BIndex, sizeof(BIndex));
+    btc_md_hash256(pTxid, data, sizeof(data));
+}
+
+
+static void rpc_wait(void)
+{
+    mRpcCount++;
+    if (mLatency > 0) {
+        usleep(mLatency);
+    }
+}
+
+
+bool btcrpc_gettxid_from_short_channel(uint8_t *pTxid, int BHeight, int BIndex)
+{
+    rpc_wait();
+    make_txid(pTxid, (uint32_t)BHeight, (uint32_t)BIndex);
+    return true;
+}
+
+
+bool btcrpc_check_unspent(const uint8_t *pPeerId, bool *pUnspent, uint64_t *pSat, const uint8_t *pTxid, uint32_t VIndex)
+{
+    (void)pPeerId; (void)pSat; (void)pTxid; (void)VIndex;
+    rpc_wait();
+    *pUnspent = true;
+    return true;
+}
+
+
+bool btcrpc_gettxout(bool *pUnspent, utl_buf_t *pScriptPubKey, const uint8_t *pTxid, uint32_t VIndex)
+{
+    (void)pTxid; (void)VIndex;
+    rpc_wait();
+    *pUnspent = true;
+    utl_buf_alloc(pScriptPubKey, 34);
+    memset(pScriptPubKey->buf, 0, pScriptPubKey->len);
+    pScriptPubKey->buf[1] = 0x20;
+    return true;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+static uint64_t channel_scid(int Index)
+{
+    uint64_t bheight = M_HEIGHT_BASE + Index / M_CHANNELS_BLOCK;
+    uint64_t bindex = Index % M_CHANNELS_BLOCK;
+    return (bheight << 40) | (bindex << 16);
+}
+
+
+/** 合成block作成
+ *
+ * 各transactionのinputはrandomなoutpointを使用する。
+ * 先頭からM_SPENT個のtransactionだけ、vin[0]でfunding_txを使用する。
+ *
+ * @param[out]      pBlock          raw block
+ * @param[in]       pPrevHash       前のblock hash
+ * @param[in]       Channels        short_channel_id数
+ */
+static void create_block(utl_buf_t *pBlock, const uint8_t *pPrevHash, int Channels)
+{
+    btc_buf_w_t buf_w;
+    uint8_t header[BTC_SZ_BLOCK_HEADER];
+
+    btc_rng_rand(header, sizeof(header));
+    memcpy(header + sizeof(uint32_t), pPrevHash, BTC_SZ_HASH256);
+    btc_tx_buf_w_init(&buf_w, 0);
+    btc_tx_buf_w_write_data(&buf_w, header, sizeof(header));
+    btc_tx_buf_w_write_varint_len(&buf_w, M_TXS);
+    for (int lp = 0; lp < M_TXS; lp++) {
+        uint8_t txid[BTC_SZ_TXID];
+        if (lp < M_SPENT) {
+            //channelを均等に選ぶ
+            uint32_t bheight;
+            uint32_t bindex;
+            uint32_t vindex;
+            ln_short_channel_id_get_param(&bheight, &bindex, &vindex, channel_scid(Channels * lp / M_SPENT));
+            make_txid(txid, bheight, bindex);
+        } else {
+            btc_rng_rand(txid, sizeof(txid));
+        }
+        btc_tx_buf_w_write_u32le(&buf_w, 2);                //version
+        btc_tx_buf_w_write_varint_len(&buf_w, 1);
+        btc_tx_buf_w_write_data(&buf_w, txid, sizeof(txid));
+        btc_tx_buf_w_write_u32le(&buf_w, 0);                //index
+        btc_tx_buf_w_write_varint_len(&buf_w, 0);           //scriptSig
+        btc_tx_buf_w_write_u32le(&buf_w, 0xffffffff);       //sequence
+        btc_tx_buf_w_write_varint_len(&buf_w, 1);
+        btc_tx_buf_w_write_u64le(&buf_w, 100000);           //value
+        btc_tx_buf_w_write_varint_len(&buf_w, 0);           //scriptPubKey
+        btc_tx_buf_w_write_u32le(&buf_w, 0);                //locktime
+    }
+    btc_buf_w_move(&buf_w, pBlock);
+}
+
+
+/** #watch_block()のcallback
+ *
+ */
+static void watch_spent(const watch_outpoint_t *pWatch, const btc_tx_view_t *pView, void *pParam)
+{
+    (void)pView; (void)pParam;
+    if (pWatch->type == WATCH_TYPE_SCID) {
+        scid_cache_spent(pWatch->short_channel_id);
+    }
+}
+
+
+/** block反映
+ *
+ * @param[out]      pHash       反映したblockのhash
+ * @param[in]       pPrevHash   前のblock hash
+ * @param[in]       Channels    short_channel_id数
+ * @param[in]       Height      block height
+ */
+static void apply_block(uint8_t *pHash, const uint8_t *pPrevHash, int Channels, int32_t Height)
+{
+    utl_buf_t block = UTL_BUF_INIT;
+    create_block(&block, pPrevHash, Channels);
+    btc_md_hash256(pHash, block.buf, BTC_SZ_BLOCK_HEADER);
+
+    double start = now_usec();
+    bool ret = scid_cache_block(block.buf, block.len, Height) &&
+                watch_block(block.buf, block.len, watch_spent, NULL);
+    printf("  apply block: height=%" PRId32 " %.0fus%s\n", Height, now_usec() - start, ret ? "" : " (fail)");
+    utl_buf_free(&block);
+}
+
+
+/** 中継1周分
+ *
+ * @param[in]       pName       表示名
+ * @param[in]       Channels    short_channel_id数
+ * @param[in]       bCache      false:cacheを使わない
+ */
+static void relay_pass(const char *pName, int Channels, bool bCache)
+{
+    scid_cache_counter_t before;
+    scid_cache_counter_t after;
+    uint64_t rpc = mRpcCount;
+    int unspent = 0;
+
+    scid_cache_counter(&before);
+    double start = now_usec();
+    for (int lp = 0; lp < Channels; lp++) {
+        uint64_t scid = channel_scid(lp);
+        bool ret;
+        if (bCache) {
+            ret = scid_cache_unspent(scid);
+        } else {
+            uint32_t bheight;
+            uint32_t bindex;
+            uint32_t vindex;
+            uint8_t txid[BTC_SZ_TXID];
+            bool result = false;
+            ln_short_channel_id_get_param(&bheight, &bindex, &vindex, scid);
+            ret = btcrpc_gettxid_from_short_channel(txid, bheight, bindex) &&
+                    btcrpc_check_unspent(NULL, &result, NULL, txid, vindex) && result;
+        }
+        if (ret) {
+            unspent++;
+        }
+    }
+    double elapsed = now_usec() - start;
+    scid_cache_counter(&after);
+
+    printf("%-6s: channels=%d elapsed=%.0fus avg=%.2fus/anno %.0fanno/s rpc=%" PRIu64 " hit=%" PRIu64 " miss=%" PRIu64 " unspent=%d\n",
+        pName, Channels, elapsed, elapsed / Channels, Channels * 1000000.0 / elapsed,
+        mRpcCount - rpc, after.hit - before.hit, after.miss - before.miss, unspent);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int channels = M_CHANNELS_DEFAULT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            channels = atoi(optarg);
+            break;
+        case 'l':
+            mLatency = (useconds_t)atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n channels] [-l usec/RPC]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (channels < M_SPENT) {
+        channels = M_CHANNELS_DEFAULT;
+    }
+    printf("channels=%d latency=%uus/RPC\n", channels, (unsigned int)mLatency);
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+    scid_cache_init(NULL);
+
+    uint8_t prev_hash[BTC_SZ_HASH256];
+    uint8_t hash[BTC_SZ_HASH256];
+    int32_t height = M_HEIGHT_BASE + channels / M_CHANNELS_BLOCK + 6;
+
+    relay_pass("none", channels, false);
+
+    //起動時に現在のblockを反映する
+    memset(prev_hash, 0, sizeof(prev_hash));
+    apply_block(hash, prev_hash, channels, height);
+    relay_pass("cold", channels, true);
+    relay_pass("warm", channels, true);
+
+    memcpy(prev_hash, hash, sizeof(prev_hash));
+    apply_block(hash, prev_hash, channels, ++height);
+    relay_pass("block", channels, true);
+
+    btc_rng_rand(prev_hash, sizeof(prev_hash));
+    apply_block(hash, prev_hash, channels, ++height);
+    relay_pass("resync", channels, true);
+    relay_pass("warm", channels, true);
+
+    scid_cache_term();
+    watch_term();
+    btc_term();
+    return 0;
+}
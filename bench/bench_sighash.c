@@ -0,0 +1,202 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_sighash.c
+ *  @brief  BIP143 sighash benchmark
+ *
+ *  多INPUT(default: 50)のトランザクションで全INPUTのsighashを計算し、1秒あたりのsighash数を出力する。
+ *  INPUT毎に#btc_sw_sighash()を呼ぶ場合と、#btc_sw_sighash_ctx_init()の事前計算値を使い回す場合を比較する。
+ *
+ *      usage: bench_sighash [-n loops] [-i inputs] [-o outputs]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "btc.h"
+#include "btc_crypto.h"
+#include "btc_script.h"
+#include "btc_sw.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_LOOPS_DEFAULT     (200)           ///< 全INPUTのsighash計算を繰り返す回数
+#define M_INPUTS_DEFAULT    (50)            ///< INPUT数
+#define M_OUTPUTS_DEFAULT   (2)             ///< OUTPUT数
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/** 計測用トランザクション作成
+ *
+ * vinはP2WSH(2-of-2)、voutはP2WPKHとする。
+ *
+ * @param[out]      pTx             トランザクション
+ * @param[out]      pWitScript      vin共通のwitnessScript
+ * @param[in]       Inputs          INPUT数
+ * @param[in]       Outputs         OUTPUT数
+ */
+static bool create_tx(btc_tx_t *pTx, utl_buf_t *pWitScript, int Inputs, int Outputs)
+{
+    uint8_t pub1[BTC_SZ_PUBKEY];
+    uint8_t pub2[BTC_SZ_PUBKEY];
+    uint8_t pkh[BTC_SZ_HASH160];
+
+    pub1[0] = 0x02;
+    btc_rng_rand(pub1 + 1, BTC_SZ_PUBKEY - 1);
+    pub2[0] = 0x03;
+    btc_rng_rand(pub2 + 1, BTC_SZ_PUBKEY - 1);
+    if (!btc_script_2of2_create_redeem(pWitScript, pub1, pub2)) return false;
+
+    pTx->locktime = 500000;
+    for (int lp = 0; lp < Inputs; lp++) {
+        uint8_t txid[BTC_SZ_TXID];
+        btc_rng_rand(txid, sizeof(txid));
+        btc_vin_t *vin = btc_tx_add_vin(pTx, txid, lp);
+        if (!vin) return false;
+        vin->sequence = 0xfffffffd;
+    }
+    for (int lp = 0; lp < Outputs; lp++) {
+        btc_rng_rand(pkh, sizeof(pkh));
+        if (!btc_sw_add_vout_p2wpkh(pTx, 100000 + lp, pkh)) return false;
+    }
+    return true;
+}
+
+
+/** 計測
+ *
+ * @param[in]       Loops           全INPUTのsighash計算を繰り返す回数
+ * @param[in]       Inputs          INPUT数
+ * @param[in]       Outputs         OUTPUT数
+ */
+static void bench_run(int Loops, int Inputs, int Outputs)
+{
+    btc_tx_t tx = BTC_TX_INIT;
+    utl_buf_t wit_script = UTL_BUF_INIT;
+    uint8_t sighash[BTC_SZ_HASH256];
+    uint8_t check = 0;
+    int fail = 0;
+
+    if (!create_tx(&tx, &wit_script, Inputs, Outputs)) {
+        fprintf(stderr, "fail: create tx\n");
+        goto LABEL_EXIT;
+    }
+
+    //INPUT毎にhashPrevouts/hashSequence/hashOutputsを計算する
+    double start = now_usec();
+    for (int lp = 0; lp < Loops; lp++) {
+        for (int idx = 0; idx < Inputs; idx++) {
+            if (!btc_sw_sighash_p2wsh_wit(&tx, sighash, idx, 100000, &wit_script)) {
+                fail++;
+            }
+            check ^= sighash[0];
+        }
+    }
+    double elapsed_each = now_usec() - start;
+
+    //事前計算値を使い回す(btc_sw_sighash_ctx_init()の時間も含む)
+    start = now_usec();
+    for (int lp = 0; lp < Loops; lp++) {
+        btc_sw_sighash_ctx_t ctx;
+        if (!btc_sw_sighash_ctx_init(&ctx, &tx)) {
+            fail++;
+            continue;
+        }
+        for (int idx = 0; idx < Inputs; idx++) {
+            if (!btc_sw_sighash_ctx_calc_p2wsh_wit(&ctx, sighash, idx, 100000, &wit_script)) {
+                fail++;
+            }
+            check ^= sighash[0];
+        }
+    }
+    double elapsed_ctx = now_usec() - start;
+
+    double total = (double)Loops * Inputs;
+    printf("inputs=%d outputs=%d loops=%d\n", Inputs, Outputs, Loops);
+    printf("  each input : sighash/sec=%.0f avg=%.2fus\n",
+        total * 1000000.0 / elapsed_each, elapsed_each / total);
+    printf("  shared ctx : sighash/sec=%.0f avg=%.2fus\n",
+        total * 1000000.0 / elapsed_ctx, elapsed_ctx / total);
+    printf("  fail=%d (check=%02x)\n", fail, check);
+
+LABEL_EXIT:
+    utl_buf_free(&wit_script);
+    btc_tx_free(&tx);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int loops = M_LOOPS_DEFAULT;
+    int inputs = M_INPUTS_DEFAULT;
+    int outputs = M_OUTPUTS_DEFAULT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:o:")) != -1) {
+        switch (opt) {
+        case 'n':
+            loops = atoi(optarg);
+            break;
+        case 'i':
+            inputs = atoi(optarg);
+            break;
+        case 'o':
+            outputs = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n loops] [-i inputs] [-o outputs]\n", argv[0]);
+            return -1;
+        }
+    }
+    if ((loops <= 0) || (inputs <= 0) || (outputs <= 0)) {
+        fprintf(stderr, "loops, inputs, outputs > 0\n");
+        return -1;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+
+    bench_run(loops, inputs, outputs);
+
+    btc_term();
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_tx_view.c
+ *  @brief  transaction parse benchmark
+ *
+ *  segwit/非segwitを交互に並べたトランザクション(default: 1000個)を読み込み、1秒あたりのトランザクション数を出力する。
+ *  #btc_tx_read() + #btc_tx_txid() と、#btc_tx_view_read() + #btc_tx_view_txid() を比較する。
+ *  1トランザクションあたりのmalloc数は、btc/utlと本ファイルを PTARM_DEBUG_MEM 付きでbuildした場合のみ出力する。
+ *
+ *      usage: bench_tx_view [-n loops] [-t txs] [-i inputs] [-o outputs]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "utl_dbg.h"
+
+#include "btc.h"
+#include "btc_crypto.h"
+#include "btc_sw.h"
+#include "btc_tx_view.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_LOOPS_DEFAULT     (100)           ///< 全トランザクションの読込みを繰り返す回数
+#define M_TXS_DEFAULT       (1000)          ///< トランザクション数
+#define M_INPUTS_DEFAULT    (2)             ///< INPUT数
+#define M_OUTPUTS_DEFAULT   (2)             ///< OUTPUT数
+
+#define M_SZ_SIG            (72)            ///< witness/scriptSigの署名サイズ(DER + sighash type)
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/** 計測用トランザクション作成
+ *
+ * Segwitの場合、vinはP2WPKH(署名, 公開鍵)相当のwitnessを持つ。
+ * 非segwitの場合、vinはP2PKH相当のscriptSigを持つ。
+ *
+ * @param[out]      pBuf            トランザクション(serialized)
+ * @param[in]       Segwit          true:segwit
+ * @param[in]       Inputs          INPUT数
+ * @param[in]       Outputs         OUTPUT数
+ */
+static bool create_tx(utl_buf_t *pBuf, bool Segwit, int Inputs, int Outputs)
+{
+    bool ret = false;
+    btc_tx_t tx = BTC_TX_INIT;
+    uint8_t dummy[1 + M_SZ_SIG + 1 + BTC_SZ_PUBKEY];
+    uint8_t pkh[BTC_SZ_HASH160];
+
+    btc_rng_rand(dummy, sizeof(dummy));
+    tx.locktime = 500000;
+    for (int lp = 0; lp < Inputs; lp++) {
+        uint8_t txid[BTC_SZ_TXID];
+        btc_rng_rand(txid, sizeof(txid));
+        btc_vin_t *vin = btc_tx_add_vin(&tx, txid, lp);
+        if (!vin) goto LABEL_EXIT;
+        vin->sequence = 0xfffffffd;
+        if (Segwit) {
+            utl_buf_t *p_wit = btc_tx_add_wit(vin);
+            if (!p_wit) goto LABEL_EXIT;
+            if (!utl_buf_alloccopy(p_wit, dummy, M_SZ_SIG)) goto LABEL_EXIT;
+            p_wit = btc_tx_add_wit(vin);
+            if (!p_wit) goto LABEL_EXIT;
+            if (!utl_buf_alloccopy(p_wit, dummy, BTC_SZ_PUBKEY)) goto LABEL_EXIT;
+        } else {
+            if (!utl_buf_alloccopy(&vin->script, dummy, sizeof(dummy))) goto LABEL_EXIT;
+        }
+    }
+    for (int lp = 0; lp < Outputs; lp++) {
+        btc_rng_rand(pkh, sizeof(pkh));
+        if (!btc_sw_add_vout_p2wpkh(&tx, 100000 + lp, pkh)) goto LABEL_EXIT;
+    }
+    ret = btc_tx_write(&tx, pBuf);
+
+LABEL_EXIT:
+    btc_tx_free(&tx);
+    return ret;
+}
+
+
+/** 計測
+ *
+ * @param[in]       Loops           全トランザクションの読込みを繰り返す回数
+ * @param[in]       Txs             トランザクション数
+ * @param[in]       Inputs          INPUT数
+ * @param[in]       Outputs         OUTPUT数
+ */
+static void bench_run(int Loops, int Txs, int Inputs, int Outputs)
+{
+    utl_buf_t *p_txs = (utl_buf_t *)calloc(Txs, sizeof(utl_buf_t));
+    uint8_t txid[BTC_SZ_TXID];
+    uint8_t txid_view[BTC_SZ_TXID];
+    uint8_t check = 0;
+    uint64_t bytes = 0;
+    int fail = 0;
+
+    for (int lp = 0; lp < Txs; lp++) {
+        if (!create_tx(&p_txs[lp], (lp & 1) == 0, Inputs, Outputs)) {
+            fprintf(stderr, "fail: create tx\n");
+            goto LABEL_EXIT;
+        }
+        bytes += p_txs[lp].len;
+    }
+
+    //TXIDの一致と、1トランザクションあたりのmalloc数(free前の残数)
+#ifdef PTARM_DEBUG_MEM
+    int malloc_tx = 0;
+    int malloc_view = 0;
+#endif  //PTARM_DEBUG_MEM
+    for (int lp = 0; lp < Txs; lp++) {
+        btc_tx_t tx = BTC_TX_INIT;
+        btc_tx_view_t view;
+
+#ifdef PTARM_DEBUG_MEM
+        int cnt = utl_dbg_malloc_cnt();
+#endif  //PTARM_DEBUG_MEM
+        if (!btc_tx_read(&tx, p_txs[lp].buf, p_txs[lp].len)) {
+            fail++;
+        }
+        btc_tx_txid(&tx, txid);
+#ifdef PTARM_DEBUG_MEM
+        malloc_tx += utl_dbg_malloc_cnt() - cnt;
+#endif  //PTARM_DEBUG_MEM
+        btc_tx_free(&tx);
+
+#ifdef PTARM_DEBUG_MEM
+        cnt = utl_dbg_malloc_cnt();
+#endif  //PTARM_DEBUG_MEM
+        if (!btc_tx_view_read(&view, p_txs[lp].buf, p_txs[lp].len)) {
+            fail++;
+        }
+        btc_tx_view_txid(&view, txid_view);
+#ifdef PTARM_DEBUG_MEM
+        malloc_view += utl_dbg_malloc_cnt() - cnt;
+#endif  //PTARM_DEBUG_MEM
+
+        if (memcmp(txid, txid_view, BTC_SZ_TXID) != 0) {
+            fprintf(stderr, "fail: txid mismatch[%d]\n", lp);
+            fail++;
+        }
+    }
+
+    //btc_tx_t
+    double start = now_usec();
+    for (int lp = 0; lp < Loops; lp++) {
+        for (int idx = 0; idx < Txs; idx++) {
+            btc_tx_t tx = BTC_TX_INIT;
+            if (!btc_tx_read(&tx, p_txs[idx].buf, p_txs[idx].len)) {
+                fail++;
+            }
+            btc_tx_txid(&tx, txid);
+            check ^= txid[0];
+            btc_tx_free(&tx);
+        }
+    }
+    double elapsed_tx = now_usec() - start;
+
+    //btc_tx_view_t
+    start = now_usec();
+    for (int lp = 0; lp < Loops; lp++) {
+        for (int idx = 0; idx < Txs; idx++) {
+            btc_tx_view_t view;
+            if (!btc_tx_view_read(&view, p_txs[idx].buf, p_txs[idx].len)) {
+                fail++;
+            }
+            btc_tx_view_txid(&view, txid);
+            check ^= txid[0];
+        }
+    }
+    double elapsed_view = now_usec() - start;
+
+    double total = (double)Loops * Txs;
+    printf("txs=%d(avg %.0f bytes) inputs=%d outputs=%d loops=%d\n",
+        Txs, (double)bytes / Txs, Inputs, Outputs, Loops);
+    printf("  btc_tx_read     : txs/sec=%.0f avg=%.2fus",
+        total * 1000000.0 / elapsed_tx, elapsed_tx / total);
+#ifdef PTARM_DEBUG_MEM
+    printf(" malloc/tx=%.2f", (double)malloc_tx / Txs);
+#endif  //PTARM_DEBUG_MEM
+    printf("\n");
+    printf("  btc_tx_view_read: txs/sec=%.0f avg=%.2fus",
+        total * 1000000.0 / elapsed_view, elapsed_view / total);
+#ifdef PTARM_DEBUG_MEM
+    printf(" malloc/tx=%.2f", (double)malloc_view / Txs);
+#endif  //PTARM_DEBUG_MEM
+    printf("\n");
+    printf("  fail=%d (check=%02x)\n", fail, check);
+
+LABEL_EXIT:
+    for (int lp = 0; lp < Txs; lp++) {
+        utl_buf_free(&p_txs[lp]);
+    }
+    free(p_txs);
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int loops = M_LOOPS_DEFAULT;
+    int txs = M_TXS_DEFAULT;
+    int inputs = M_INPUTS_DEFAULT;
+    int outputs = M_OUTPUTS_DEFAULT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:i:o:")) != -1) {
+        switch (opt) {
+        case 'n':
+            loops = atoi(optarg);
+            break;
+        case 't':
+            txs = atoi(optarg);
+            break;
+        case 'i':
+            inputs = atoi(optarg);
+            break;
+        case 'o':
+            outputs = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n loops] [-t txs] [-i inputs] [-o outputs]\n", argv[0]);
+            return -1;
+        }
+    }
+    if ((loops <= 0) || (txs <= 0) || (inputs <= 0) || (outputs <= 0)) {
+        fprintf(stderr, "loops, txs, inputs, outputs > 0\n");
+        return -1;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+
+    bench_run(loops, txs, inputs, outputs);
+
+    btc_term();
+    return 0;
+}
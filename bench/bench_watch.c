@@ -0,0 +1,212 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   bench_watch.c
+ *  @brief  outpoint watch index benchmark
+ *
+ *  合成したblock(1tx 2input)を#watch_block()で照合し、1blockあたりの処理時間を出力する。
+ *  監視outpoint数は10, 1000, 100000で、そのうちM_MATCHES個だけがblockのvinと一致する。
+ *
+ *      usage: bench_watch [-t txs/block] [-n blocks] [-w outpoints]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "btc.h"
+#include "btc_crypto.h"
+#include "btc_block.h"
+#include "btc_tx_buf.h"
+
+#include "watch.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_TXS_DEFAULT       (2000)          ///< 1blockのtransaction数
+#define M_BLOCKS_DEFAULT    (50)            ///< 計測block数
+#define M_VINS              (2)             ///< 1transactionのinput数
+#define M_MATCHES           (5)             ///< blockのvinと一致させる監視outpoint数
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static double now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/** 合成block作成
+ *
+ * 各transactionのinputはrandomなoutpointを使用する。
+ * 一致用として、blockの先頭から末尾まで均等にM_MATCHES個のvin[0]を返す。
+ *
+ * @param[out]      pBlock          raw block
+ * @param[out]      pMatchTxid      一致用outpointのTXID
+ * @param[in]       Txs             transaction数
+ */
+static void create_block(utl_buf_t *pBlock, uint8_t pMatchTxid[][BTC_SZ_TXID], int Txs)
+{
+    btc_buf_w_t buf_w;
+    uint8_t header[BTC_SZ_BLOCK_HEADER];
+    int match = 0;
+
+    btc_rng_rand(header, sizeof(header));
+    btc_tx_buf_w_init(&buf_w, 0);
+    btc_tx_buf_w_write_data(&buf_w, header, sizeof(header));
+    btc_tx_buf_w_write_varint_len(&buf_w, Txs);
+    for (int lp = 0; lp < Txs; lp++) {
+        btc_tx_buf_w_write_u32le(&buf_w, 2);                //version
+        btc_tx_buf_w_write_varint_len(&buf_w, M_VINS);
+        for (int lp2 = 0; lp2 < M_VINS; lp2++) {
+            uint8_t txid[BTC_SZ_TXID];
+            btc_rng_rand(txid, sizeof(txid));
+            if ( (lp2 == 0) && (match < M_MATCHES) &&
+                 (lp == (Txs - 1) * match / (M_MATCHES - 1)) ) {
+                memcpy(pMatchTxid[match++], txid, sizeof(txid));
+            }
+            btc_tx_buf_w_write_data(&buf_w, txid, sizeof(txid));
+            btc_tx_buf_w_write_u32le(&buf_w, 0);            //index
+            btc_tx_buf_w_write_varint_len(&buf_w, 0);       //scriptSig
+            btc_tx_buf_w_write_u32le(&buf_w, 0xffffffff);   //sequence
+        }
+        btc_tx_buf_w_write_varint_len(&buf_w, 1);
+        btc_tx_buf_w_write_u64le(&buf_w, 100000);           //value
+        btc_tx_buf_w_write_varint_len(&buf_w, 0);           //scriptPubKey
+        btc_tx_buf_w_write_u32le(&buf_w, 0);                //locktime
+    }
+    btc_buf_w_move(&buf_w, pBlock);
+}
+
+
+static void spent_cb(const watch_outpoint_t *pWatch, const btc_tx_view_t *pView, void *pParam)
+{
+    (void)pWatch; (void)pView;
+    (*(int *)pParam)++;
+}
+
+
+/** 照合時間計測
+ *
+ * @param[in]       pBlock          raw block
+ * @param[in]       pMatchTxid      一致用outpointのTXID
+ * @param[in]       Txs             pBlockのtransaction数
+ * @param[in]       Blocks          照合回数
+ * @param[in]       Outpoints       監視outpoint数
+ */
+static void bench_run(const utl_buf_t *pBlock, uint8_t pMatchTxid[][BTC_SZ_TXID], int Txs, int Blocks, int Outpoints)
+{
+    uint8_t channel_id[LN_SZ_CHANNEL_ID];
+    memset(channel_id, 0, sizeof(channel_id));
+
+    watch_init();
+
+    int matches = (Outpoints < M_MATCHES) ? Outpoints : M_MATCHES;
+    for (int lp = 0; lp < matches; lp++) {
+        watch_add(pMatchTxid[lp], 0, channel_id, WATCH_TYPE_FUNDING, WATCH_STAT_UNSPENT);
+    }
+    for (int lp = matches; lp < Outpoints; lp++) {
+        uint8_t txid[BTC_SZ_TXID];
+        btc_rng_rand(txid, sizeof(txid));
+        watch_add(txid, lp & 0x03, channel_id, WATCH_TYPE_HTLC, WATCH_STAT_UNSPENT);
+    }
+
+    int detect = 0;
+    int fail = 0;
+    double start = now_usec();
+    for (int lp = 0; lp < Blocks; lp++) {
+        if (!watch_block(pBlock->buf, pBlock->len, spent_cb, &detect)) {
+            fail++;
+        }
+    }
+    double elapsed = now_usec() - start;
+    printf("outpoints=%6u txs=%d blocks=%d elapsed=%.0fus avg=%.1fus/block match=%d/%d fail=%d\n",
+        watch_count(), Txs, Blocks, elapsed, elapsed / Blocks,
+        detect / Blocks, matches, fail);
+
+    watch_term();
+}
+
+
+/**************************************************************************
+ * main
+ **************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    int txs = M_TXS_DEFAULT;
+    int blocks = M_BLOCKS_DEFAULT;
+    int outpoints = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:w:")) != -1) {
+        switch (opt) {
+        case 't':
+            txs = atoi(optarg);
+            break;
+        case 'n':
+            blocks = atoi(optarg);
+            break;
+        case 'w':
+            outpoints = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t txs/block] [-n blocks] [-w outpoints]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (txs < M_MATCHES) {
+        txs = M_TXS_DEFAULT;
+    }
+    if (blocks <= 0) {
+        blocks = M_BLOCKS_DEFAULT;
+    }
+
+    //logは出力しない(utl_log_init()しない)
+    btc_init(BTC_BLOCK_CHAIN_BTCREGTEST, true);
+
+    utl_buf_t block = UTL_BUF_INIT;
+    uint8_t match_txid[M_MATCHES][BTC_SZ_TXID];
+    create_block(&block, match_txid, txs);
+
+    if (outpoints > 0) {
+        bench_run(&block, match_txid, txs, blocks, outpoints);
+    } else {
+        const int OUTPOINTS[] = { 10, 1000, 100000 };
+        for (size_t lp = 0; lp < ARRAY_SIZE(OUTPOINTS); lp++) {
+            bench_run(&block, match_txid, txs, blocks, OUTPOINTS[lp]);
+        }
+    }
+
+    utl_buf_free(&block);
+    btc_term();
+    return 0;
+}
@@ -30,6 +30,7 @@
 #include "btc_crypto.h"
 #include "btc_local.h"
 #include "btc_block.h"
+#include "btc_tx_buf.h"
 
 
 /**************************************************************************
@@ -112,6 +113,84 @@ const uint8_t *btc_block_get_genesis_hash(btc_block_chain_t chain)
 }
 
 
+bool btc_block_read_txs(const uint8_t *pData, uint32_t Len, btc_block_tx_func_t pFunc, void *pParam)
+{
+    btc_buf_r_t buf_r;
+    uint64_t tx_num;
+
+    //block header
+    if (Len < BTC_SZ_BLOCK_HEADER) {
+        LOGE("fail: block header\n");
+        return false;
+    }
+    btc_tx_buf_r_init(&buf_r, pData + BTC_SZ_BLOCK_HEADER, Len - BTC_SZ_BLOCK_HEADER);
+
+    //txn_count
+    if (!btc_tx_buf_r_read_varint(&buf_r, &tx_num)) return false;
+    if (tx_num > UINT32_MAX) return false;
+
+    //txns
+    for (uint32_t lp = 0; lp < (uint32_t)tx_num; lp++) {
+        btc_tx_t tx = BTC_TX_INIT;
+        uint32_t read_len;
+
+        if (!btc_tx_read_2(&tx, btc_tx_buf_r_get_pos(&buf_r), btc_tx_buf_r_remains(&buf_r), &read_len)) {
+            LOGE("fail: read tx[%" PRIu32 "]\n", lp);
+            return false;
+        }
+        btc_tx_buf_r_seek(&buf_r, (int32_t)read_len);
+        bool next = (*pFunc)(&tx, lp, pParam);
+        btc_tx_free(&tx);
+        if (!next) {
+            return true;
+        }
+    }
+    if (btc_tx_buf_r_remains(&buf_r)) {
+        LOGE("fail: block size\n");
+        return false;
+    }
+    return true;
+}
+
+
+bool btc_block_read_tx_views(const uint8_t *pData, uint32_t Len, btc_block_tx_view_func_t pFunc, void *pParam)
+{
+    btc_buf_r_t buf_r;
+    uint64_t tx_num;
+
+    //block header
+    if (Len < BTC_SZ_BLOCK_HEADER) {
+        LOGE("fail: block header\n");
+        return false;
+    }
+    btc_tx_buf_r_init(&buf_r, pData + BTC_SZ_BLOCK_HEADER, Len - BTC_SZ_BLOCK_HEADER);
+
+    //txn_count
+    if (!btc_tx_buf_r_read_varint(&buf_r, &tx_num)) return false;
+    if (tx_num > UINT32_MAX) return false;
+
+    //txns
+    for (uint32_t lp = 0; lp < (uint32_t)tx_num; lp++) {
+        btc_tx_view_t view;
+        uint32_t read_len;
+
+        if (!btc_tx_view_read_2(&view, btc_tx_buf_r_get_pos(&buf_r), btc_tx_buf_r_remains(&buf_r), &read_len)) {
+            LOGE("fail: read tx[%" PRIu32 "]\n", lp);
+            return false;
+        }
+        btc_tx_buf_r_seek(&buf_r, (int32_t)read_len);
+        if (!(*pFunc)(&view, lp, pParam)) {
+            return true;
+        }
+    }
+    if (btc_tx_buf_r_remains(&buf_r)) {
+        LOGE("fail: block size\n");
+        return false;
+    }
+    return true;
+}
+
+
 /**************************************************************************
  * package functions
  **************************************************************************/
@@ -32,6 +32,45 @@
 #include <stdbool.h>
 
 #include "btc.h"
+#include "btc_tx.h"
+#include "btc_tx_view.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BTC_SZ_BLOCK_HEADER         (80)        ///< サイズ: block header
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** #btc_block_read_txs()のcallback
+ *
+ * pTxの中身を保持したい場合は、コピー後に #btc_tx_init(pTx)すること(呼び出し元でfreeさせない)。
+ *
+ * @param[in,out]   pTx         読み込んだtransaction
+ * @param[in]       Index       block内のindex
+ * @param[in,out]   pParam      #btc_block_read_txs()に渡したパラメータ
+ * @retval  true    次のtransactionを読み込む
+ * @retval  false   読込み終了
+ */
+typedef bool (*btc_block_tx_func_t)(btc_tx_t *pTx, uint32_t Index, void *pParam);
+
+
+/** #btc_block_read_tx_views()のcallback
+ *
+ * pViewはcallback内でのみ有効(raw blockを指している)。
+ *
+ * @param[in]       pView       読み込んだtransaction
+ * @param[in]       Index       block内のindex
+ * @param[in,out]   pParam      #btc_block_read_tx_views()に渡したパラメータ
+ * @retval  true    次のtransactionを読み込む
+ * @retval  false   読込み終了
+ */
+typedef bool (*btc_block_tx_view_func_t)(const btc_tx_view_t *pView, uint32_t Index, void *pParam);
 
 
 /**************************************************************************
@@ -54,4 +93,32 @@ btc_block_chain_t btc_block_get_chain(const uint8_t *pGenesisHash);
 const uint8_t *btc_block_get_genesis_hash(btc_block_chain_t chain);
 
 
+/** raw blockのtransactionを先頭から順に読み込む
+ *
+ * 1transaction読み込むごとに pFuncを呼び出す。
+ *
+ * @param[in]       pData       raw block(block header + txn_count + txns)
+ * @param[in]       Len         pData長
+ * @param[in]       pFunc       callback
+ * @param[in,out]   pParam      callbackに渡すパラメータ
+ * @retval  true    全transactionを読み込んだ、またはcallbackがfalseを返した
+ * @retval  false   blockとして不正
+ */
+bool btc_block_read_txs(const uint8_t *pData, uint32_t Len, btc_block_tx_func_t pFunc, void *pParam);
+
+
+/** raw blockのtransactionを先頭から順にviewで読み込む
+ *
+ * #btc_block_read_txs()と異なり、transactionごとのメモリ確保を行わない。
+ *
+ * @param[in]       pData       raw block(block header + txn_count + txns)
+ * @param[in]       Len         pData長
+ * @param[in]       pFunc       callback
+ * @param[in,out]   pParam      callbackに渡すパラメータ
+ * @retval  true    全transactionを読み込んだ、またはcallbackがfalseを返した
+ * @retval  false   blockとして不正
+ */
+bool btc_block_read_tx_views(const uint8_t *pData, uint32_t Len, btc_block_tx_view_func_t pFunc, void *pParam);
+
+
 #endif /* BTC_BLOCK_H__ */
@@ -0,0 +1,910 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   btc_chachapoly.c
+ *  @brief  ChaCha20-Poly1305(RFC 8439)
+ *  @sa     https://tools.ietf.org/html/rfc8439
+ *
+ *  Poly1305は26bit x 5limbで計算する(poly1305-donnaと同じ)。
+ *  SIMD版は連続するblockをlaneに振り分け、各laneを r^(lane数) 倍しながら足し込む。
+ *  最後のblock群だけlane毎に r^k (k = lane数 ... 1)を掛け、laneを合計すると通常の計算結果と一致する。
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define M_USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "btc_local.h"
+#include "btc_chachapoly.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CHACHA_BLOCK      (64)                ///< ChaCha20 block長
+#define M_POLY_BLOCK        (16)                ///< Poly1305 block長
+#define M_POLY_MASK         (0x3ffffff)         ///< 26bit
+#define M_POLY_HIBIT        (1UL << 24)         ///< 2^128(limb[4]の位置)
+#define M_POLY_POW_MAX      (8)                 ///< r^1 ... r^8
+
+#define M_ROTL32(v, n)      (((v) << (n)) | ((v) >> (32 - (n))))
+#define M_U8TO32(p)         ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define M_U32TO8(p, v)      { (p)[0] = (uint8_t)(v); (p)[1] = (uint8_t)((v) >> 8); (p)[2] = (uint8_t)((v) >> 16); (p)[3] = (uint8_t)((v) >> 24); }
+
+#define M_QR(a, b, c, d) { \
+    a += b; d ^= a; d = M_ROTL32(d, 16); \
+    c += d; b ^= c; b = M_ROTL32(b, 12); \
+    a += b; d ^= a; d = M_ROTL32(d, 8); \
+    c += d; b ^= c; b = M_ROTL32(b, 7); \
+}
+
+//a, b, c, dは配列x[]のindex
+#define M_DOUBLE_ROUND(QR, x) { \
+    QR(x[0], x[4], x[8],  x[12]); \
+    QR(x[1], x[5], x[9],  x[13]); \
+    QR(x[2], x[6], x[10], x[14]); \
+    QR(x[3], x[7], x[11], x[15]); \
+    QR(x[0], x[5], x[10], x[15]); \
+    QR(x[1], x[6], x[11], x[12]); \
+    QR(x[2], x[7], x[8],  x[13]); \
+    QR(x[3], x[4], x[9],  x[14]); \
+}
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct poly1305_t
+ *  @brief  Poly1305計算中の値
+ */
+typedef struct {
+    uint32_t    r[5];
+    uint32_t    h[5];
+    uint32_t    pad[4];
+    uint32_t    pow[M_POLY_POW_MAX][5];     ///< r^1 ... r^8(SIMD版で使う)
+    int         pow_num;                    ///< powの計算済み数
+} poly1305_t;
+
+
+/** @struct backend_t
+ *  @brief  backend実装
+ */
+typedef struct {
+    /** ChaCha20(State[12]のcounterを進める) */
+    void (*chacha20)(uint8_t *pOut, const uint8_t *pIn, uint32_t Len, uint32_t State[16]);
+    /** Poly1305(Blocks個の16byte block) */
+    void (*poly1305)(poly1305_t *pPoly, const uint8_t *pData, uint32_t Blocks);
+} backend_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void chacha20_state(uint32_t State[16], const uint32_t Key[8], const uint8_t *pNonce, uint32_t Counter);
+static void chacha20_block(uint32_t Out[16], const uint32_t State[16]);
+static void chacha20_portable(uint8_t *pOut, const uint8_t *pIn, uint32_t Len, uint32_t State[16]);
+static void poly1305_init(poly1305_t *pPoly, const uint8_t *pKey);
+static void poly1305_mul(uint32_t H[5], const uint32_t R[5]);
+static void poly1305_powers(poly1305_t *pPoly, int Num);
+static void poly1305_portable(poly1305_t *pPoly, const uint8_t *pData, uint32_t Blocks);
+static void poly1305_finish(poly1305_t *pPoly, uint8_t *pTag);
+static void aead_tag(const backend_t *pBackend, const uint32_t State[16],
+    const uint8_t *pAad, uint32_t AadLen, const uint8_t *pData, uint32_t Len, uint8_t *pTag);
+static void aead_poly_pad(const backend_t *pBackend, poly1305_t *pPoly, const uint8_t *pData, uint32_t Len);
+static const backend_t *get_backend(void);
+#ifdef M_USE_X86_SIMD
+static void chacha20_avx2(uint8_t *pOut, const uint8_t *pIn, uint32_t Len, uint32_t State[16]);
+static void poly1305_avx2(poly1305_t *pPoly, const uint8_t *pData, uint32_t Blocks);
+static void chacha20_avx512(uint8_t *pOut, const uint8_t *pIn, uint32_t Len, uint32_t State[16]);
+static void poly1305_avx512(poly1305_t *pPoly, const uint8_t *pData, uint32_t Blocks);
+#endif  //M_USE_X86_SIMD
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static const backend_t mBackends[BTC_CHACHAPOLY_BACKEND_NUM] = {
+    { chacha20_portable, poly1305_portable },
+#ifdef M_USE_X86_SIMD
+    { chacha20_avx2, poly1305_avx2 },
+    { chacha20_avx512, poly1305_avx512 },
+#else
+    { chacha20_portable, poly1305_portable },
+    { chacha20_portable, poly1305_portable },
+#endif  //M_USE_X86_SIMD
+};
+
+static const char *M_BACKEND_STR[BTC_CHACHAPOLY_BACKEND_NUM] = {
+    "portable", "avx2", "avx512"
+};
+
+static btc_chachapoly_backend_t mBackend = BTC_CHACHAPOLY_PORTABLE;
+static const backend_t          *mpBackend;         ///< NULL:未選択
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void btc_chachapoly_init(void)
+{
+    btc_chachapoly_backend_t backend = BTC_CHACHAPOLY_PORTABLE;
+    if (btc_chachapoly_backend_supported(BTC_CHACHAPOLY_AVX512)) {
+        backend = BTC_CHACHAPOLY_AVX512;
+    } else if (btc_chachapoly_backend_supported(BTC_CHACHAPOLY_AVX2)) {
+        backend = BTC_CHACHAPOLY_AVX2;
+    }
+    btc_chachapoly_backend_set(backend);
+}
+
+
+btc_chachapoly_backend_t btc_chachapoly_backend(void)
+{
+    (void)get_backend();
+    return mBackend;
+}
+
+
+bool btc_chachapoly_backend_set(btc_chachapoly_backend_t Backend)
+{
+    if (!btc_chachapoly_backend_supported(Backend)) {
+        return false;
+    }
+    mBackend = Backend;
+    mpBackend = &mBackends[Backend];
+    return true;
+}
+
+
+bool btc_chachapoly_backend_supported(btc_chachapoly_backend_t Backend)
+{
+    switch (Backend) {
+    case BTC_CHACHAPOLY_PORTABLE:
+        return true;
+#ifdef M_USE_X86_SIMD
+    case BTC_CHACHAPOLY_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case BTC_CHACHAPOLY_AVX512:
+        //端数はAVX2版で処理する
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+#endif  //M_USE_X86_SIMD
+    default:
+        return false;
+    }
+}
+
+
+const char *btc_chachapoly_backend_str(btc_chachapoly_backend_t Backend)
+{
+    if ((Backend < 0) || (Backend >= BTC_CHACHAPOLY_BACKEND_NUM)) {
+        return "unknown";
+    }
+    return M_BACKEND_STR[Backend];
+}
+
+
+void btc_chacha20_crypt(uint8_t *pOut, const uint8_t *pIn, uint32_t Len,
+    const uint8_t *pKey, const uint8_t *pNonce, uint32_t Counter)
+{
+    btc_chachapoly_t ctx;
+    uint32_t state[16];
+
+    btc_chachapoly_setkey(&ctx, pKey);
+    chacha20_state(state, ctx.key, pNonce, Counter);
+    get_backend()->chacha20(pOut, pIn, Len, state);
+}
+
+
+void btc_chachapoly_setkey(btc_chachapoly_t *pCtx, const uint8_t *pKey)
+{
+    for (int lp = 0; lp < 8; lp++) {
+        pCtx->key[lp] = M_U8TO32(pKey + 4 * lp);
+    }
+}
+
+
+void btc_chachapoly_encrypt(const btc_chachapoly_t *pCtx, const uint8_t *pNonce,
+    const uint8_t *pAad, uint32_t AadLen,
+    const uint8_t *pIn, uint32_t Len, uint8_t *pOut, uint8_t *pTag)
+{
+    const backend_t *p_backend = get_backend();
+    uint32_t state[16];
+
+    chacha20_state(state, pCtx->key, pNonce, 1);
+    p_backend->chacha20(pOut, pIn, Len, state);
+    aead_tag(p_backend, state, pAad, AadLen, pOut, Len, pTag);
+}
+
+
+bool btc_chachapoly_decrypt(const btc_chachapoly_t *pCtx, const uint8_t *pNonce,
+    const uint8_t *pAad, uint32_t AadLen,
+    const uint8_t *pIn, uint32_t Len, uint8_t *pOut, const uint8_t *pTag)
+{
+    const backend_t *p_backend = get_backend();
+    uint32_t state[16];
+    uint8_t tag[BTC_SZ_POLY1305_TAG];
+
+    chacha20_state(state, pCtx->key, pNonce, 1);
+    aead_tag(p_backend, state, pAad, AadLen, pIn, Len, tag);
+
+    //constant time
+    uint8_t diff = 0;
+    for (int lp = 0; lp < BTC_SZ_POLY1305_TAG; lp++) {
+        diff |= tag[lp] ^ pTag[lp];
+    }
+    if (diff != 0) {
+        return false;
+    }
+    p_backend->chacha20(pOut, pIn, Len, state);
+    return true;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+static const backend_t *get_backend(void)
+{
+    if (mpBackend == NULL) {
+        btc_chachapoly_init();
+    }
+    return mpBackend;
+}
+
+
+/** ChaCha20 state初期化
+ */
+static void chacha20_state(uint32_t State[16], const uint32_t Key[8], const uint8_t *pNonce, uint32_t Counter)
+{
+    //"expand 32-byte k"
+    State[0] = 0x61707865;
+    State[1] = 0x3320646e;
+    State[2] = 0x79622d32;
+    State[3] = 0x6b206574;
+    for (int lp = 0; lp < 8; lp++) {
+        State[4 + lp] = Key[lp];
+    }
+    State[12] = Counter;
+    State[13] = M_U8TO32(pNonce);
+    State[14] = M_U8TO32(pNonce + 4);
+    State[15] = M_U8TO32(pNonce + 8);
+}
+
+
+/** ChaCha20 block関数
+ */
+static void chacha20_block(uint32_t Out[16], const uint32_t State[16])
+{
+    uint32_t x[16];
+
+    memcpy(x, State, sizeof(x));
+    for (int lp = 0; lp < 10; lp++) {
+        M_DOUBLE_ROUND(M_QR, x);
+    }
+    for (int lp = 0; lp < 16; lp++) {
+        Out[lp] = x[lp] + State[lp];
+    }
+}
+
+
+static void chacha20_portable(uint8_t *pOut, const uint8_t *pIn, uint32_t Len, uint32_t State[16])
+{
+    uint32_t ks[16];
+    uint8_t ks8[M_CHACHA_BLOCK];
+
+    while (Len > 0) {
+        chacha20_block(ks, State);
+        State[12]++;
+        for (int lp = 0; lp < 16; lp++) {
+            M_U32TO8(ks8 + 4 * lp, ks[lp]);
+        }
+        uint32_t len = (Len < M_CHACHA_BLOCK) ? Len : M_CHACHA_BLOCK;
+        for (uint32_t lp = 0; lp < len; lp++) {
+            pOut[lp] = pIn[lp] ^ ks8[lp];
+        }
+        pIn += len;
+        pOut += len;
+        Len -= len;
+    }
+}
+
+
+/** Poly1305初期化
+ *
+ * @param[out]      pPoly
+ * @param[in]       pKey        one-time key(32byte)
+ */
+static void poly1305_init(poly1305_t *pPoly, const uint8_t *pKey)
+{
+    //r &= 0xffffffc0ffffffc0ffffffc0fffffff
+    pPoly->r[0] = (M_U8TO32(pKey + 0)) & 0x3ffffff;
+    pPoly->r[1] = (M_U8TO32(pKey + 3) >> 2) & 0x3ffff03;
+    pPoly->r[2] = (M_U8TO32(pKey + 6) >> 4) & 0x3ffc0ff;
+    pPoly->r[3] = (M_U8TO32(pKey + 9) >> 6) & 0x3f03fff;
+    pPoly->r[4] = (M_U8TO32(pKey + 12) >> 8) & 0x00fffff;
+    memset(pPoly->h, 0, sizeof(pPoly->h));
+    for (int lp = 0; lp < 4; lp++) {
+        pPoly->pad[lp] = M_U8TO32(pKey + 16 + 4 * lp);
+    }
+    pPoly->pow_num = 0;
+}
+
+
+/** H = H * R (mod 2^130 - 5)
+ *
+ * 結果の各limbは26bit程度まで縮める(完全には剰余を取らない)。
+ */
+static void poly1305_mul(uint32_t H[5], const uint32_t R[5])
+{
+    uint32_t s1 = R[1] * 5;
+    uint32_t s2 = R[2] * 5;
+    uint32_t s3 = R[3] * 5;
+    uint32_t s4 = R[4] * 5;
+    uint64_t d0 = (uint64_t)H[0] * R[0] + (uint64_t)H[1] * s4 + (uint64_t)H[2] * s3 + (uint64_t)H[3] * s2 + (uint64_t)H[4] * s1;
+    uint64_t d1 = (uint64_t)H[0] * R[1] + (uint64_t)H[1] * R[0] + (uint64_t)H[2] * s4 + (uint64_t)H[3] * s3 + (uint64_t)H[4] * s2;
+    uint64_t d2 = (uint64_t)H[0] * R[2] + (uint64_t)H[1] * R[1] + (uint64_t)H[2] * R[0] + (uint64_t)H[3] * s4 + (uint64_t)H[4] * s3;
+    uint64_t d3 = (uint64_t)H[0] * R[3] + (uint64_t)H[1] * R[2] + (uint64_t)H[2] * R[1] + (uint64_t)H[3] * R[0] + (uint64_t)H[4] * s4;
+    uint64_t d4 = (uint64_t)H[0] * R[4] + (uint64_t)H[1] * R[3] + (uint64_t)H[2] * R[2] + (uint64_t)H[3] * R[1] + (uint64_t)H[4] * R[0];
+    uint64_t c;
+
+    c = d0 >> 26; H[0] = (uint32_t)d0 & M_POLY_MASK;
+    d1 += c; c = d1 >> 26; H[1] = (uint32_t)d1 & M_POLY_MASK;
+    d2 += c; c = d2 >> 26; H[2] = (uint32_t)d2 & M_POLY_MASK;
+    d3 += c; c = d3 >> 26; H[3] = (uint32_t)d3 & M_POLY_MASK;
+    d4 += c; c = d4 >> 26; H[4] = (uint32_t)d4 & M_POLY_MASK;
+    c = H[0] + c * 5; H[0] = (uint32_t)c & M_POLY_MASK;
+    H[1] += (uint32_t)(c >> 26);
+}
+
+
+/** r^1 ... r^Num計算
+ */
+static void poly1305_powers(poly1305_t *pPoly, int Num)
+{
+    if (pPoly->pow_num == 0) {
+        memcpy(pPoly->pow[0], pPoly->r, sizeof(pPoly->r));
+        pPoly->pow_num = 1;
+    }
+    for (int lp = pPoly->pow_num; lp < Num; lp++) {
+        memcpy(pPoly->pow[lp], pPoly->pow[lp - 1], sizeof(pPoly->pow[lp]));
+        poly1305_mul(pPoly->pow[lp], pPoly->r);
+    }
+    if (pPoly->pow_num < Num) {
+        pPoly->pow_num = Num;
+    }
+}
+
+
+static void poly1305_portable(poly1305_t *pPoly, const uint8_t *pData, uint32_t Blocks)
+{
+    uint32_t *h = pPoly->h;
+
+    for (uint32_t lp = 0; lp < Blocks; lp++) {
+        h[0] += (M_U8TO32(pData + 0)) & M_POLY_MASK;
+        h[1] += (M_U8TO32(pData + 3) >> 2) & M_POLY_MASK;
+        h[2] += (M_U8TO32(pData + 6) >> 4) & M_POLY_MASK;
+        h[3] += (M_U8TO32(pData + 9) >> 6) & M_POLY_MASK;
+        h[4] += (M_U8TO32(pData + 12) >> 8) | M_POLY_HIBIT;
+        poly1305_mul(h, pPoly->r);
+        pData += M_POLY_BLOCK;
+    }
+}
+
+
+/** Poly1305 tag出力
+ */
+static void poly1305_finish(poly1305_t *pPoly, uint8_t *pTag)
+{
+    uint32_t h0 = pPoly->h[0];
+    uint32_t h1 = pPoly->h[1];
+    uint32_t h2 = pPoly->h[2];
+    uint32_t h3 = pPoly->h[3];
+    uint32_t h4 = pPoly->h[4];
+    uint32_t c;
+
+    //fully carry h
+    c = h1 >> 26; h1 &= M_POLY_MASK;
+    h2 += c; c = h2 >> 26; h2 &= M_POLY_MASK;
+    h3 += c; c = h3 >> 26; h3 &= M_POLY_MASK;
+    h4 += c; c = h4 >> 26; h4 &= M_POLY_MASK;
+    h0 += c * 5; c = h0 >> 26; h0 &= M_POLY_MASK;
+    h1 += c;
+
+    //g = h + -p
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= M_POLY_MASK;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= M_POLY_MASK;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= M_POLY_MASK;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= M_POLY_MASK;
+    uint32_t g4 = h4 + c - (1UL << 26);
+
+    //h >= p なら g を選ぶ
+    uint32_t mask = (g4 >> 31) - 1;
+    g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+    mask = ~mask;
+    h0 = (h0 & mask) | g0;
+    h1 = (h1 & mask) | g1;
+    h2 = (h2 & mask) | g2;
+    h3 = (h3 & mask) | g3;
+    h4 = (h4 & mask) | g4;
+
+    //h = h % 2^128
+    h0 = (h0      ) | (h1 << 26);
+    h1 = (h1 >>  6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 <<  8);
+
+    //tag = (h + pad) % 2^128
+    uint64_t f;
+    f = (uint64_t)h0 + pPoly->pad[0]; h0 = (uint32_t)f;
+    f = (uint64_t)h1 + pPoly->pad[1] + (f >> 32); h1 = (uint32_t)f;
+    f = (uint64_t)h2 + pPoly->pad[2] + (f >> 32); h2 = (uint32_t)f;
+    f = (uint64_t)h3 + pPoly->pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+    M_U32TO8(pTag + 0, h0);
+    M_U32TO8(pTag + 4, h1);
+    M_U32TO8(pTag + 8, h2);
+    M_U32TO8(pTag + 12, h3);
+}
+
+
+/** AEAD tag計算
+ *
+ * @param[in]       pBackend
+ * @param[in]       State       ChaCha20 state(counterは使わない)
+ * @param[in]       pAad        additional data
+ * @param[in]       AadLen      pAad長
+ * @param[in]       pData       暗号文
+ * @param[in]       Len         pData長
+ * @param[out]      pTag        tag
+ */
+static void aead_tag(const backend_t *pBackend, const uint32_t State[16],
+    const uint8_t *pAad, uint32_t AadLen, const uint8_t *pData, uint32_t Len, uint8_t *pTag)
+{
+    uint32_t state0[16];
+    uint32_t ks[16];
+    uint8_t key[32];
+    uint8_t lens[M_POLY_BLOCK];
+    poly1305_t poly;
+
+    //one-time key = ChaCha20(counter=0)の先頭32byte
+    memcpy(state0, State, sizeof(state0));
+    state0[12] = 0;
+    chacha20_block(ks, state0);
+    for (int lp = 0; lp < 8; lp++) {
+        M_U32TO8(key + 4 * lp, ks[lp]);
+    }
+    poly1305_init(&poly, key);
+
+    aead_poly_pad(pBackend, &poly, pAad, AadLen);
+    aead_poly_pad(pBackend, &poly, pData, Len);
+    M_U32TO8(lens + 0, AadLen);
+    M_U32TO8(lens + 4, 0);
+    M_U32TO8(lens + 8, Len);
+    M_U32TO8(lens + 12, 0);
+    pBackend->poly1305(&poly, lens, 1);
+    poly1305_finish(&poly, pTag);
+}
+
+
+/** 16byte境界まで0を詰めてPoly1305に入力する
+ */
+static void aead_poly_pad(const backend_t *pBackend, poly1305_t *pPoly, const uint8_t *pData, uint32_t Len)
+{
+    uint32_t blocks = Len / M_POLY_BLOCK;
+    uint32_t rem = Len % M_POLY_BLOCK;
+
+    if (blocks > 0) {
+        pBackend->poly1305(pPoly, pData, blocks);
+    }
+    if (rem > 0) {
+        uint8_t last[M_POLY_BLOCK] = {0};
+        memcpy(last, pData + blocks * M_POLY_BLOCK, rem);
+        pBackend->poly1305(pPoly, last, 1);
+    }
+}
+
+
+#ifdef M_USE_X86_SIMD
+/********************************************************************
+ * AVX2
+ ********************************************************************/
+
+#define M_AVX2_ROTL(v, n)   _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define M_AVX2_QR(a, b, c, d) { \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = M_AVX2_ROTL(b, 12); \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8); \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = M_AVX2_ROTL(b, 7); \
+}
+
+
+/** ChaCha20 8block(512byte)
+ *
+ * x[i]はblock 0...7のword iを持つ。
+ * 出力時に転置してblock毎の並びに戻す。
+ */
+__attribute__((target("avx2")))
+static void chacha20_avx2_8block(uint8_t *pOut, const uint8_t *pIn, const uint32_t State[16])
+{
+    const __m256i rot16 = _mm256_set_epi8(
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+    __m256i org[16];
+    __m256i x[16];
+
+    for (int lp = 0; lp < 16; lp++) {
+        org[lp] = _mm256_set1_epi32((int)State[lp]);
+    }
+    org[12] = _mm256_add_epi32(org[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    for (int lp = 0; lp < 16; lp++) {
+        x[lp] = org[lp];
+    }
+    for (int lp = 0; lp < 10; lp++) {
+        M_DOUBLE_ROUND(M_AVX2_QR, x);
+    }
+    for (int lp = 0; lp < 16; lp++) {
+        x[lp] = _mm256_add_epi32(x[lp], org[lp]);
+    }
+
+    //128bit laneの中で4x4転置: b[g][j]のlane kはblock(4k+j)のword 4g...4g+3
+    __m256i b[4][4];
+    for (int g = 0; g < 4; g++) {
+        __m256i t0 = _mm256_unpacklo_epi32(x[4 * g + 0], x[4 * g + 1]);
+        __m256i t1 = _mm256_unpackhi_epi32(x[4 * g + 0], x[4 * g + 1]);
+        __m256i t2 = _mm256_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+        __m256i t3 = _mm256_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+        b[g][0] = _mm256_unpacklo_epi64(t0, t2);
+        b[g][1] = _mm256_unpackhi_epi64(t0, t2);
+        b[g][2] = _mm256_unpacklo_epi64(t1, t3);
+        b[g][3] = _mm256_unpackhi_epi64(t1, t3);
+    }
+    for (int j = 0; j < 4; j++) {
+        __m256i ks[4];
+        ks[0] = _mm256_permute2x128_si256(b[0][j], b[1][j], 0x20);     //block j
+        ks[1] = _mm256_permute2x128_si256(b[2][j], b[3][j], 0x20);
+        ks[2] = _mm256_permute2x128_si256(b[0][j], b[1][j], 0x31);     //block 4+j
+        ks[3] = _mm256_permute2x128_si256(b[2][j], b[3][j], 0x31);
+        for (int lp = 0; lp < 4; lp++) {
+            uint32_t pos = M_CHACHA_BLOCK * (j + 4 * (lp / 2)) + 32 * (lp % 2);
+            __m256i in = _mm256_loadu_si256((const __m256i *)(pIn + pos));
+            _mm256_storeu_si256((__m256i *)(pOut + pos), _mm256_xor_si256(in, ks[lp]));
+        }
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void chacha20_avx2(uint8_t *pOut, const uint8_t *pIn, uint32_t Len, uint32_t State[16])
+{
+    while (Len >= 8 * M_CHACHA_BLOCK) {
+        chacha20_avx2_8block(pOut, pIn, State);
+        State[12] += 8;
+        pIn += 8 * M_CHACHA_BLOCK;
+        pOut += 8 * M_CHACHA_BLOCK;
+        Len -= 8 * M_CHACHA_BLOCK;
+    }
+    if (Len > 2 * M_CHACHA_BLOCK) {
+        //3block以上残っていれば、8block分のkey streamから使う
+        uint8_t buf[8 * M_CHACHA_BLOCK];
+        memcpy(buf, pIn, Len);
+        chacha20_avx2_8block(buf, buf, State);
+        memcpy(pOut, buf, Len);
+        State[12] += (Len + M_CHACHA_BLOCK - 1) / M_CHACHA_BLOCK;
+    } else if (Len > 0) {
+        chacha20_portable(pOut, pIn, Len, State);
+    }
+}
+
+
+/** H = H * R (4lane)
+ */
+__attribute__((target("avx2")))
+static void poly1305_avx2_mul(__m256i H[5], const __m256i R[5], const __m256i S[5])
+{
+    const __m256i mask = _mm256_set1_epi64x(M_POLY_MASK);
+    __m256i d0, d1, d2, d3, d4, c;
+
+#define M_MUL(a, b)     _mm256_mul_epu32(a, b)
+#define M_ADD(a, b)     _mm256_add_epi64(a, b)
+    d0 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[0]), M_MUL(H[1], S[4])), M_MUL(H[2], S[3])), M_MUL(H[3], S[2])), M_MUL(H[4], S[1]));
+    d1 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[1]), M_MUL(H[1], R[0])), M_MUL(H[2], S[4])), M_MUL(H[3], S[3])), M_MUL(H[4], S[2]));
+    d2 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[2]), M_MUL(H[1], R[1])), M_MUL(H[2], R[0])), M_MUL(H[3], S[4])), M_MUL(H[4], S[3]));
+    d3 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[3]), M_MUL(H[1], R[2])), M_MUL(H[2], R[1])), M_MUL(H[3], R[0])), M_MUL(H[4], S[4]));
+    d4 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[4]), M_MUL(H[1], R[3])), M_MUL(H[2], R[2])), M_MUL(H[3], R[1])), M_MUL(H[4], R[0]));
+
+    c = _mm256_srli_epi64(d0, 26); H[0] = _mm256_and_si256(d0, mask);
+    d1 = M_ADD(d1, c); c = _mm256_srli_epi64(d1, 26); H[1] = _mm256_and_si256(d1, mask);
+    d2 = M_ADD(d2, c); c = _mm256_srli_epi64(d2, 26); H[2] = _mm256_and_si256(d2, mask);
+    d3 = M_ADD(d3, c); c = _mm256_srli_epi64(d3, 26); H[3] = _mm256_and_si256(d3, mask);
+    d4 = M_ADD(d4, c); c = _mm256_srli_epi64(d4, 26); H[4] = _mm256_and_si256(d4, mask);
+    //c * 5 = c + c * 4
+    H[0] = M_ADD(H[0], M_ADD(c, _mm256_slli_epi64(c, 2)));
+    c = _mm256_srli_epi64(H[0], 26); H[0] = _mm256_and_si256(H[0], mask);
+    H[1] = M_ADD(H[1], c);
+#undef M_MUL
+#undef M_ADD
+}
+
+
+/** Poly1305 4lane
+ *
+ * 64byte(4block)を_mm256_unpack{lo,hi}_epi64で分けるとlaneはblock 0, 2, 1, 3の順になる。
+ * 最後のblock群は、それぞれ r^4, r^2, r^3, r^1 を掛ける。
+ */
+__attribute__((target("avx2")))
+static void poly1305_avx2(poly1305_t *pPoly, const uint8_t *pData, uint32_t Blocks)
+{
+    if (Blocks >= 8) {
+        const __m256i mask = _mm256_set1_epi64x(M_POLY_MASK);
+        const __m256i hibit = _mm256_set1_epi64x(M_POLY_HIBIT);
+        __m256i h[5], r4[5], s4[5], rl[5], sl[5];
+        uint32_t groups = Blocks / 4;
+
+        poly1305_powers(pPoly, 4);
+        for (int lp = 0; lp < 5; lp++) {
+            const uint32_t (*p)[5] = pPoly->pow;
+            h[lp] = _mm256_set_epi64x(0, 0, 0, pPoly->h[lp]);
+            r4[lp] = _mm256_set1_epi64x(p[3][lp]);
+            s4[lp] = _mm256_set1_epi64x((uint64_t)p[3][lp] * 5);
+            rl[lp] = _mm256_set_epi64x(p[0][lp], p[2][lp], p[1][lp], p[3][lp]);
+            sl[lp] = _mm256_set_epi64x((uint64_t)p[0][lp] * 5, (uint64_t)p[2][lp] * 5, (uint64_t)p[1][lp] * 5, (uint64_t)p[3][lp] * 5);
+        }
+        for (uint32_t lp = 0; lp < groups; lp++) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)pData);
+            __m256i b = _mm256_loadu_si256((const __m256i *)(pData + 32));
+            __m256i lo = _mm256_unpacklo_epi64(a, b);
+            __m256i hi = _mm256_unpackhi_epi64(a, b);
+            h[0] = _mm256_add_epi64(h[0], _mm256_and_si256(lo, mask));
+            h[1] = _mm256_add_epi64(h[1], _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask));
+            h[2] = _mm256_add_epi64(h[2], _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)), mask));
+            h[3] = _mm256_add_epi64(h[3], _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask));
+            h[4] = _mm256_add_epi64(h[4], _mm256_or_si256(_mm256_srli_epi64(hi, 40), hibit));
+            if (lp + 1 < groups) {
+                poly1305_avx2_mul(h, r4, s4);
+            } else {
+                poly1305_avx2_mul(h, rl, sl);
+            }
+            pData += 4 * M_POLY_BLOCK;
+        }
+
+        //laneの合計
+        uint64_t sum[5];
+        for (int lp = 0; lp < 5; lp++) {
+            uint64_t v[4];
+            _mm256_storeu_si256((__m256i *)v, h[lp]);
+            sum[lp] = v[0] + v[1] + v[2] + v[3];
+        }
+        uint64_t c;
+        c = sum[0] >> 26; pPoly->h[0] = (uint32_t)sum[0] & M_POLY_MASK;
+        sum[1] += c; c = sum[1] >> 26; pPoly->h[1] = (uint32_t)sum[1] & M_POLY_MASK;
+        sum[2] += c; c = sum[2] >> 26; pPoly->h[2] = (uint32_t)sum[2] & M_POLY_MASK;
+        sum[3] += c; c = sum[3] >> 26; pPoly->h[3] = (uint32_t)sum[3] & M_POLY_MASK;
+        sum[4] += c; c = sum[4] >> 26; pPoly->h[4] = (uint32_t)sum[4] & M_POLY_MASK;
+        c = pPoly->h[0] + c * 5; pPoly->h[0] = (uint32_t)c & M_POLY_MASK;
+        pPoly->h[1] += (uint32_t)(c >> 26);
+
+        Blocks -= groups * 4;
+    }
+    if (Blocks > 0) {
+        poly1305_portable(pPoly, pData, Blocks);
+    }
+}
+
+
+/********************************************************************
+ * AVX-512
+ ********************************************************************/
+
+//g++(12)ではimmintrin.h内の_mm512_undefined_epi32()で-W(maybe-)uninitializedが出る
+#if defined(__cplusplus) && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#define M_AVX512_QR(a, b, c, d) { \
+    a = _mm512_add_epi32(a, b); d = _mm512_xor_si512(d, a); d = _mm512_rol_epi32(d, 16); \
+    c = _mm512_add_epi32(c, d); b = _mm512_xor_si512(b, c); b = _mm512_rol_epi32(b, 12); \
+    a = _mm512_add_epi32(a, b); d = _mm512_xor_si512(d, a); d = _mm512_rol_epi32(d, 8); \
+    c = _mm512_add_epi32(c, d); b = _mm512_xor_si512(b, c); b = _mm512_rol_epi32(b, 7); \
+}
+
+
+/** ChaCha20 16block(1024byte)
+ *
+ * #chacha20_avx2_8block()と同じ転置の後、128bit単位の4x4転置を行う。
+ */
+__attribute__((target("avx512f")))
+static void chacha20_avx512_16block(uint8_t *pOut, const uint8_t *pIn, const uint32_t State[16])
+{
+    __m512i org[16];
+    __m512i x[16];
+
+    for (int lp = 0; lp < 16; lp++) {
+        org[lp] = _mm512_set1_epi32((int)State[lp]);
+    }
+    org[12] = _mm512_add_epi32(org[12], _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+    for (int lp = 0; lp < 16; lp++) {
+        x[lp] = org[lp];
+    }
+    for (int lp = 0; lp < 10; lp++) {
+        M_DOUBLE_ROUND(M_AVX512_QR, x);
+    }
+    for (int lp = 0; lp < 16; lp++) {
+        x[lp] = _mm512_add_epi32(x[lp], org[lp]);
+    }
+
+    //b[g][j]のlane kはblock(4k+j)のword 4g...4g+3
+    __m512i b[4][4];
+    for (int g = 0; g < 4; g++) {
+        __m512i t0 = _mm512_unpacklo_epi32(x[4 * g + 0], x[4 * g + 1]);
+        __m512i t1 = _mm512_unpackhi_epi32(x[4 * g + 0], x[4 * g + 1]);
+        __m512i t2 = _mm512_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+        __m512i t3 = _mm512_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+        b[g][0] = _mm512_unpacklo_epi64(t0, t2);
+        b[g][1] = _mm512_unpackhi_epi64(t0, t2);
+        b[g][2] = _mm512_unpacklo_epi64(t1, t3);
+        b[g][3] = _mm512_unpackhi_epi64(t1, t3);
+    }
+    for (int j = 0; j < 4; j++) {
+        __m512i s0 = _mm512_shuffle_i32x4(b[0][j], b[1][j], 0x44);
+        __m512i s1 = _mm512_shuffle_i32x4(b[0][j], b[1][j], 0xee);
+        __m512i s2 = _mm512_shuffle_i32x4(b[2][j], b[3][j], 0x44);
+        __m512i s3 = _mm512_shuffle_i32x4(b[2][j], b[3][j], 0xee);
+        __m512i ks[4];
+        ks[0] = _mm512_shuffle_i32x4(s0, s2, 0x88);     //block j
+        ks[1] = _mm512_shuffle_i32x4(s0, s2, 0xdd);     //block 4+j
+        ks[2] = _mm512_shuffle_i32x4(s1, s3, 0x88);     //block 8+j
+        ks[3] = _mm512_shuffle_i32x4(s1, s3, 0xdd);     //block 12+j
+        for (int k = 0; k < 4; k++) {
+            uint32_t pos = M_CHACHA_BLOCK * (4 * k + j);
+            __m512i in = _mm512_loadu_si512((const void *)(pIn + pos));
+            _mm512_storeu_si512((void *)(pOut + pos), _mm512_xor_si512(in, ks[k]));
+        }
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static void chacha20_avx512(uint8_t *pOut, const uint8_t *pIn, uint32_t Len, uint32_t State[16])
+{
+    while (Len >= 16 * M_CHACHA_BLOCK) {
+        chacha20_avx512_16block(pOut, pIn, State);
+        State[12] += 16;
+        pIn += 16 * M_CHACHA_BLOCK;
+        pOut += 16 * M_CHACHA_BLOCK;
+        Len -= 16 * M_CHACHA_BLOCK;
+    }
+    if (Len > 0) {
+        chacha20_avx2(pOut, pIn, Len, State);
+    }
+}
+
+
+/** H = H * R (8lane)
+ */
+__attribute__((target("avx512f")))
+static void poly1305_avx512_mul(__m512i H[5], const __m512i R[5], const __m512i S[5])
+{
+    const __m512i mask = _mm512_set1_epi64(M_POLY_MASK);
+    __m512i d0, d1, d2, d3, d4, c;
+
+#define M_MUL(a, b)     _mm512_mul_epu32(a, b)
+#define M_ADD(a, b)     _mm512_add_epi64(a, b)
+    d0 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[0]), M_MUL(H[1], S[4])), M_MUL(H[2], S[3])), M_MUL(H[3], S[2])), M_MUL(H[4], S[1]));
+    d1 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[1]), M_MUL(H[1], R[0])), M_MUL(H[2], S[4])), M_MUL(H[3], S[3])), M_MUL(H[4], S[2]));
+    d2 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[2]), M_MUL(H[1], R[1])), M_MUL(H[2], R[0])), M_MUL(H[3], S[4])), M_MUL(H[4], S[3]));
+    d3 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[3]), M_MUL(H[1], R[2])), M_MUL(H[2], R[1])), M_MUL(H[3], R[0])), M_MUL(H[4], S[4]));
+    d4 = M_ADD(M_ADD(M_ADD(M_ADD(M_MUL(H[0], R[4]), M_MUL(H[1], R[3])), M_MUL(H[2], R[2])), M_MUL(H[3], R[1])), M_MUL(H[4], R[0]));
+
+    c = _mm512_srli_epi64(d0, 26); H[0] = _mm512_and_si512(d0, mask);
+    d1 = M_ADD(d1, c); c = _mm512_srli_epi64(d1, 26); H[1] = _mm512_and_si512(d1, mask);
+    d2 = M_ADD(d2, c); c = _mm512_srli_epi64(d2, 26); H[2] = _mm512_and_si512(d2, mask);
+    d3 = M_ADD(d3, c); c = _mm512_srli_epi64(d3, 26); H[3] = _mm512_and_si512(d3, mask);
+    d4 = M_ADD(d4, c); c = _mm512_srli_epi64(d4, 26); H[4] = _mm512_and_si512(d4, mask);
+    H[0] = M_ADD(H[0], M_ADD(c, _mm512_slli_epi64(c, 2)));
+    c = _mm512_srli_epi64(H[0], 26); H[0] = _mm512_and_si512(H[0], mask);
+    H[1] = M_ADD(H[1], c);
+#undef M_MUL
+#undef M_ADD
+}
+
+
+/** Poly1305 8lane
+ *
+ * 128byte(8block)を_mm512_unpack{lo,hi}_epi64で分けるとlaneはblock 0, 4, 1, 5, 2, 6, 3, 7の順になる。
+ * 最後のblock群は、それぞれ r^8, r^4, r^7, r^3, r^6, r^2, r^5, r^1 を掛ける。
+ */
+__attribute__((target("avx512f")))
+static void poly1305_avx512(poly1305_t *pPoly, const uint8_t *pData, uint32_t Blocks)
+{
+    if (Blocks >= 16) {
+        const __m512i mask = _mm512_set1_epi64(M_POLY_MASK);
+        const __m512i hibit = _mm512_set1_epi64(M_POLY_HIBIT);
+        __m512i h[5], r8[5], s8[5], rl[5], sl[5];
+        uint32_t groups = Blocks / 8;
+
+        poly1305_powers(pPoly, 8);
+        for (int lp = 0; lp < 5; lp++) {
+            const uint32_t (*p)[5] = pPoly->pow;
+            h[lp] = _mm512_set_epi64(0, 0, 0, 0, 0, 0, 0, pPoly->h[lp]);
+            r8[lp] = _mm512_set1_epi64(p[7][lp]);
+            s8[lp] = _mm512_set1_epi64((uint64_t)p[7][lp] * 5);
+            rl[lp] = _mm512_set_epi64(p[0][lp], p[4][lp], p[1][lp], p[5][lp], p[2][lp], p[6][lp], p[3][lp], p[7][lp]);
+            sl[lp] = _mm512_set_epi64(
+                (uint64_t)p[0][lp] * 5, (uint64_t)p[4][lp] * 5, (uint64_t)p[1][lp] * 5, (uint64_t)p[5][lp] * 5,
+                (uint64_t)p[2][lp] * 5, (uint64_t)p[6][lp] * 5, (uint64_t)p[3][lp] * 5, (uint64_t)p[7][lp] * 5);
+        }
+        for (uint32_t lp = 0; lp < groups; lp++) {
+            __m512i a = _mm512_loadu_si512((const void *)pData);
+            __m512i b = _mm512_loadu_si512((const void *)(pData + 64));
+            __m512i lo = _mm512_unpacklo_epi64(a, b);
+            __m512i hi = _mm512_unpackhi_epi64(a, b);
+            h[0] = _mm512_add_epi64(h[0], _mm512_and_si512(lo, mask));
+            h[1] = _mm512_add_epi64(h[1], _mm512_and_si512(_mm512_srli_epi64(lo, 26), mask));
+            h[2] = _mm512_add_epi64(h[2], _mm512_and_si512(_mm512_or_si512(_mm512_srli_epi64(lo, 52), _mm512_slli_epi64(hi, 12)), mask));
+            h[3] = _mm512_add_epi64(h[3], _mm512_and_si512(_mm512_srli_epi64(hi, 14), mask));
+            h[4] = _mm512_add_epi64(h[4], _mm512_or_si512(_mm512_srli_epi64(hi, 40), hibit));
+            if (lp + 1 < groups) {
+                poly1305_avx512_mul(h, r8, s8);
+            } else {
+                poly1305_avx512_mul(h, rl, sl);
+            }
+            pData += 8 * M_POLY_BLOCK;
+        }
+
+        //laneの合計
+        uint64_t sum[5];
+        for (int lp = 0; lp < 5; lp++) {
+            uint64_t v[8];
+            _mm512_storeu_si512((void *)v, h[lp]);
+            sum[lp] = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+        }
+        uint64_t c;
+        c = sum[0] >> 26; pPoly->h[0] = (uint32_t)sum[0] & M_POLY_MASK;
+        sum[1] += c; c = sum[1] >> 26; pPoly->h[1] = (uint32_t)sum[1] & M_POLY_MASK;
+        sum[2] += c; c = sum[2] >> 26; pPoly->h[2] = (uint32_t)sum[2] & M_POLY_MASK;
+        sum[3] += c; c = sum[3] >> 26; pPoly->h[3] = (uint32_t)sum[3] & M_POLY_MASK;
+        sum[4] += c; c = sum[4] >> 26; pPoly->h[4] = (uint32_t)sum[4] & M_POLY_MASK;
+        c = pPoly->h[0] + c * 5; pPoly->h[0] = (uint32_t)c & M_POLY_MASK;
+        pPoly->h[1] += (uint32_t)(c >> 26);
+
+        Blocks -= groups * 8;
+    }
+    if (Blocks > 0) {
+        poly1305_avx2(pPoly, pData, Blocks);
+    }
+}
+
+#if defined(__cplusplus) && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif  //M_USE_X86_SIMD
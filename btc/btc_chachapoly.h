@@ -0,0 +1,183 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   btc_chachapoly.h
+ *  @brief  ChaCha20-Poly1305(RFC 8439)
+ *
+ *  CPUの機能を調べ、ChaCha20とPoly1305の実装(backend)を切り替える。
+ *      - PORTABLE: C実装(どのCPUでも使用できる)
+ *      - AVX2: ChaCha20は8block, Poly1305は4blockを並列に処理する
+ *      - AVX512: ChaCha20は16block, Poly1305は8blockを並列に処理する
+ *
+ *  backendは最初に使うときに選択する(#btc_chachapoly_init()で明示的に選択してもよい)。
+ *  どのbackendでも出力は同じ。
+ */
+#ifndef BTC_CHACHAPOLY_H__
+#define BTC_CHACHAPOLY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define BTC_SZ_CHACHA20_KEY     (32)        ///< サイズ:ChaCha20 key
+#define BTC_SZ_CHACHA20_NONCE   (12)        ///< サイズ:ChaCha20 nonce(IETF)
+#define BTC_SZ_POLY1305_TAG     (16)        ///< サイズ:Poly1305 tag
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @enum   btc_chachapoly_backend_t
+ *  @brief  ChaCha20-Poly1305実装
+ */
+typedef enum {
+    BTC_CHACHAPOLY_PORTABLE,
+    BTC_CHACHAPOLY_AVX2,
+    BTC_CHACHAPOLY_AVX512,
+
+    BTC_CHACHAPOLY_BACKEND_NUM
+} btc_chachapoly_backend_t;
+
+
+/** @struct btc_chachapoly_t
+ *  @brief  ChaCha20-Poly1305 context(key)
+ */
+typedef struct {
+    uint32_t    key[8];             ///< key(little endian)
+} btc_chachapoly_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** backend選択
+ *
+ * 使用できるbackendのうち、最も速いものを選択する。
+ */
+void btc_chachapoly_init(void);
+
+
+/** 選択中のbackend
+ *
+ * @return      backend
+ */
+btc_chachapoly_backend_t btc_chachapoly_backend(void);
+
+
+/** backend変更
+ *
+ * @param[in]       Backend     backend
+ * @retval  true    成功
+ * @retval  false   このCPUでは使用できない
+ * @note
+ *      - 計測やテストで使う
+ */
+bool btc_chachapoly_backend_set(btc_chachapoly_backend_t Backend);
+
+
+/** backendが使用できるか
+ *
+ * @param[in]       Backend     backend
+ * @retval  true    使用できる
+ */
+bool btc_chachapoly_backend_supported(btc_chachapoly_backend_t Backend);
+
+
+/** backend名
+ *
+ * @param[in]       Backend     backend
+ * @return      名前
+ */
+const char *btc_chachapoly_backend_str(btc_chachapoly_backend_t Backend);
+
+
+/** ChaCha20暗号化(復号)
+ *
+ * @param[out]      pOut        出力(Len byte)
+ * @param[in]       pIn         入力(Len byte, pOutと同じでもよい)
+ * @param[in]       Len         長さ
+ * @param[in]       pKey        key(#BTC_SZ_CHACHA20_KEY)
+ * @param[in]       pNonce      nonce(#BTC_SZ_CHACHA20_NONCE)
+ * @param[in]       Counter     block counter初期値
+ */
+void btc_chacha20_crypt(uint8_t *pOut, const uint8_t *pIn, uint32_t Len,
+    const uint8_t *pKey, const uint8_t *pNonce, uint32_t Counter);
+
+
+/** ChaCha20-Poly1305 key設定
+ *
+ * @param[out]      pCtx        context
+ * @param[in]       pKey        key(#BTC_SZ_CHACHA20_KEY)
+ */
+void btc_chachapoly_setkey(btc_chachapoly_t *pCtx, const uint8_t *pKey);
+
+
+/** ChaCha20-Poly1305暗号化
+ *
+ * @param[in]       pCtx        context
+ * @param[in]       pNonce      nonce(#BTC_SZ_CHACHA20_NONCE)
+ * @param[in]       pAad        additional data(AadLenが0ならNULL可)
+ * @param[in]       AadLen      pAad長
+ * @param[in]       pIn         平文
+ * @param[in]       Len         平文長
+ * @param[out]      pOut        暗号文(Len byte, pInと同じでもよい)
+ * @param[out]      pTag        tag(#BTC_SZ_POLY1305_TAG)
+ */
+void btc_chachapoly_encrypt(const btc_chachapoly_t *pCtx, const uint8_t *pNonce,
+    const uint8_t *pAad, uint32_t AadLen,
+    const uint8_t *pIn, uint32_t Len, uint8_t *pOut, uint8_t *pTag);
+
+
+/** ChaCha20-Poly1305復号
+ *
+ * tagを確認してから復号する。
+ *
+ * @param[in]       pCtx        context
+ * @param[in]       pNonce      nonce(#BTC_SZ_CHACHA20_NONCE)
+ * @param[in]       pAad        additional data(AadLenが0ならNULL可)
+ * @param[in]       AadLen      pAad長
+ * @param[in]       pIn         暗号文
+ * @param[in]       Len         暗号文長
+ * @param[out]      pOut        平文(Len byte, pInと同じでもよい)
+ * @param[in]       pTag        tag(#BTC_SZ_POLY1305_TAG)
+ * @retval  true    成功
+ * @retval  false   tag不一致(pOutには書き込まない)
+ */
+bool btc_chachapoly_decrypt(const btc_chachapoly_t *pCtx, const uint8_t *pNonce,
+    const uint8_t *pAad, uint32_t AadLen,
+    const uint8_t *pIn, uint32_t Len, uint8_t *pOut, const uint8_t *pTag);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* BTC_CHACHAPOLY_H__ */
@@ -24,6 +24,7 @@
  */
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 #include "mbedtls/error.h"
 #include "mbedtls/ctr_drbg.h"
@@ -66,11 +67,19 @@ static mbedtls_entropy_context  mEntropy;
 static mbedtls_ctr_drbg_context mRng;
 #endif
 
+static mbedtls_ecp_group        mEccGroup;          ///< secp256k1(#btc_ecc_group())
+static mbedtls_mpi              mEccSqrtExp;        ///< (P + 1) / 4
+static mbedtls_mpi              mEccRR;             ///< R^2 mod P
+static pthread_once_t           mEccOnce = PTHREAD_ONCE_INIT;
+
 
 /**************************************************************************
  * prototypes
  **************************************************************************/
 
+static void ecc_group_init(void);
+
+
 /**************************************************************************
  *const variables
  **************************************************************************/
@@ -120,21 +129,22 @@ void btc_md_sha256cat(uint8_t *pSha256, const uint8_t *pData1, uint16_t Len1, co
 }
 
 
+void *btc_ecc_group(void) //XXX: mbed
+{
+    pthread_once(&mEccOnce, ecc_group_init);
+    return &mEccGroup;
+}
+
+
 int btc_ecc_ecp_read_binary_pubkey(void *pPoint, const uint8_t *pPubKey) //XXX: mbed
 {
     int ret;
     uint8_t parity;
-    size_t plen;
-    mbedtls_mpi e, y2;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_mpi y2;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
     mbedtls_ecp_point *point = (mbedtls_ecp_point *)pPoint;
 
-    mbedtls_mpi_init(&e);
-    mbedtls_mpi_init(&y2);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
-    ret = mbedtls_ecp_point_read_binary(&keypair.grp, point, pPubKey, BTC_SZ_PUBKEY);
+    ret = mbedtls_ecp_point_read_binary(p_grp, point, pPubKey, BTC_SZ_PUBKEY);
     if (MBEDTLS_ERR_ECP_FEATURE_UNAVAILABLE != ret) {
         return ret;
     }
@@ -147,12 +157,9 @@ int btc_ecc_ecp_read_binary_pubkey(void *pPoint, const uint8_t *pPubKey) //XXX:
         return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
     }
 
-    plen = mbedtls_mpi_size(&keypair.grp.P);
-    if (BTC_SZ_PUBKEY != plen + 1) {
-        return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
-    }
+    mbedtls_mpi_init(&y2);
 
-    ret = mbedtls_mpi_read_binary(&point->X, pPubKey + 1, plen);
+    ret = mbedtls_mpi_read_binary(&point->X, pPubKey + 1, BTC_SZ_PUBKEY - 1);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
@@ -169,47 +176,23 @@ int btc_ecc_ecp_read_binary_pubkey(void *pPoint, const uint8_t *pPubKey) //XXX:
         assert(0);
         goto LABEL_EXIT;
     }
-#if 0
-    ret = mbedtls_mpi_mod_mpi(&y2, &y2, &keypair.grp.P);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-#else
-    keypair.grp.modp(&y2);
-#endif
+    p_grp->modp(&y2);
     ret = mbedtls_mpi_mul_mpi(&y2, &y2, &point->X);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
     }
-    ret = mbedtls_mpi_add_mpi(&y2, &y2, &keypair.grp.B);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-#if 0
-    ret = mbedtls_mpi_mod_mpi(&y2, &y2, &keypair.grp.P);
+    ret = mbedtls_mpi_add_mpi(&y2, &y2, &p_grp->B);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
     }
-#else
-    keypair.grp.modp(&y2);
-#endif
+    p_grp->modp(&y2);
 
     // Compute square root of y2
-    ret = mbedtls_mpi_add_int(&e, &keypair.grp.P, 1);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    ret = mbedtls_mpi_shift_r(&e, 2);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    ret = mbedtls_mpi_exp_mod(&point->Y, &y2, &e, &keypair.grp.P, NULL);
+    //  Y = y2^((P+1)/4) mod P
+    //  指数とR^2 mod Pは#ecc_group_init()で計算済み
+    ret = mbedtls_mpi_exp_mod(&point->Y, &y2, &mEccSqrtExp, &p_grp->P, &mEccRR);
     if (ret) {
         assert(0);
         goto LABEL_EXIT;
@@ -217,12 +200,10 @@ int btc_ecc_ecp_read_binary_pubkey(void *pPoint, const uint8_t *pPubKey) //XXX:
 
     // Set parity
     if (mbedtls_mpi_get_bit(&point->Y, 0) != parity) {
-        ret = mbedtls_mpi_sub_mpi(&point->Y, &keypair.grp.P, &point->Y);
+        ret = mbedtls_mpi_sub_mpi(&point->Y, &p_grp->P, &point->Y);
     }
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
-    mbedtls_mpi_free(&e);
     mbedtls_mpi_free(&y2);
 
     return ret;
@@ -235,13 +216,11 @@ int btc_ecc_ecp_add(uint8_t *pResult, const uint8_t *pPubKeyIn, const void *pA)
     mbedtls_ecp_point P1;
     mbedtls_ecp_point P2;
     mbedtls_mpi one;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
 
     mbedtls_ecp_point_init(&P1);
     mbedtls_ecp_point_init(&P2);
     mbedtls_mpi_init(&one);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
 
     //P1: 前の公開鍵座標
     ret = btc_ecc_ecp_read_binary_pubkey(&P1, pPubKeyIn);
@@ -255,8 +234,8 @@ int btc_ecc_ecp_add(uint8_t *pResult, const uint8_t *pPubKeyIn, const void *pA)
     if (ret) {
         goto LABEL_EXIT;
     }
-    ret = mbedtls_ecp_muladd(&keypair.grp, &P2,
-        (const mbedtls_mpi *)pA, &keypair.grp.G,
+    ret = mbedtls_ecp_muladd(p_grp, &P2,
+        (const mbedtls_mpi *)pA, &p_grp->G,
         &one, &P1);
     if (ret) {
         goto LABEL_EXIT;
@@ -270,10 +249,9 @@ int btc_ecc_ecp_add(uint8_t *pResult, const uint8_t *pPubKeyIn, const void *pA)
 
     //圧縮公開鍵
     size_t sz;
-    ret = mbedtls_ecp_point_write_binary(&keypair.grp, &P2, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, BTC_SZ_PUBKEY);
+    ret = mbedtls_ecp_point_write_binary(p_grp, &P2, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, BTC_SZ_PUBKEY);
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_mpi_free(&one);
     mbedtls_ecp_point_free(&P2);
     mbedtls_ecp_point_free(&P1);
@@ -284,30 +262,36 @@ LABEL_EXIT:
 
 bool btc_ecc_mul_pubkey(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pMul, int MulLen) //XXX: mbed
 {
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
-    int ret = btc_ecc_set_keypair(&keypair, pPubKey);
-    if (!ret) {
-        // keypair.Qに公開鍵(x, y)が入っている
-        mbedtls_ecp_point pnt;
-        mbedtls_mpi m;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
+    mbedtls_ecp_point pub;
+    mbedtls_ecp_point pnt;
+    mbedtls_mpi m;
 
-        mbedtls_ecp_point_init(&pnt);
-        mbedtls_mpi_init(&m);
+    mbedtls_ecp_point_init(&pub);
+    mbedtls_ecp_point_init(&pnt);
+    mbedtls_mpi_init(&m);
 
-        mbedtls_mpi_read_binary(&m, pMul, MulLen);
-        mbedtls_ecp_mul(&keypair.grp, &pnt, &m, &keypair.Q, NULL, NULL);  //TODO: RNGを指定すべきか？
+    int ret = btc_ecc_ecp_read_binary_pubkey(&pub, pPubKey);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_read_binary(&m, pMul, MulLen);
+    if (ret) {
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_ecp_mul(p_grp, &pnt, &m, &pub, NULL, NULL);  //TODO: RNGを指定すべきか？
+    if (ret) {
+        goto LABEL_EXIT;
+    }
 
-        //圧縮公開鍵
-        size_t sz;
-        ret = mbedtls_ecp_point_write_binary(&keypair.grp, &pnt, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, BTC_SZ_PUBKEY);
+    //圧縮公開鍵
+    size_t sz;
+    ret = mbedtls_ecp_point_write_binary(p_grp, &pnt, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, BTC_SZ_PUBKEY);
 
-        mbedtls_ecp_point_free(&pnt);
-        mbedtls_mpi_free(&m);
-    }
-    mbedtls_ecp_keypair_free(&keypair);
+LABEL_EXIT:
+    mbedtls_mpi_free(&m);
+    mbedtls_ecp_point_free(&pnt);
+    mbedtls_ecp_point_free(&pub);
 
     return ret == 0;
 }
@@ -415,4 +399,48 @@ int btc_ecc_set_keypair(void *pKeyPair, const uint8_t *pPubKey) //XXX: mbed
  * private functions
  **************************************************************************/
 
+/** secp256k1 group初期化(#btc_ecc_group()から1回だけ呼ばれる)
+ *
+ * mbedtlsは以下の値を初回の演算時にgroupやmpiへ書き込むため、ここで作成しておく。
+ * 作成後は読み込みのみとなるため、lockなしで複数threadから参照できる。
+ *      - mEccGroup.T : G乗算用のcomb table(ecdsa sign/verify, muladd, G乗算で使用)
+ *      - mEccRR      : 公開鍵展開のexp_mod用 R^2 mod P
+ */
+static void ecc_group_init(void) //XXX: mbed
+{
+    int ret;
+    mbedtls_ecp_point pnt;
+    mbedtls_mpi one;
+
+    mbedtls_ecp_group_init(&mEccGroup);
+    mbedtls_mpi_init(&mEccSqrtExp);
+    mbedtls_mpi_init(&mEccRR);
+    mbedtls_ecp_point_init(&pnt);
+    mbedtls_mpi_init(&one);
+
+    ret = mbedtls_ecp_group_load(&mEccGroup, MBEDTLS_ECP_DP_SECP256K1);
+    assert(ret == 0);
+
+    //1 * G : comb table作成
+    ret = mbedtls_mpi_lset(&one, 1);
+    assert(ret == 0);
+    ret = mbedtls_ecp_mul(&mEccGroup, &pnt, &one, &mEccGroup.G, NULL, NULL);
+    assert(ret == 0);
+    assert(mEccGroup.T != NULL);
+
+    //(P + 1) / 4
+    ret = mbedtls_mpi_add_int(&mEccSqrtExp, &mEccGroup.P, 1);
+    assert(ret == 0);
+    ret = mbedtls_mpi_shift_r(&mEccSqrtExp, 2);
+    assert(ret == 0);
+
+    //R^2 mod P
+    ret = mbedtls_mpi_exp_mod(&one, &mEccGroup.G.Y, &mEccSqrtExp, &mEccGroup.P, &mEccRR);
+    assert(ret == 0);
+
+    mbedtls_mpi_free(&one);
+    mbedtls_ecp_point_free(&pnt);
+    (void)ret;
+}
+
 
@@ -110,6 +110,16 @@ void btc_md_sha256cat(uint8_t *pSha256, const uint8_t *pData1, uint16_t Len1, co
  * prototypes (btc_ecc)
  **************************************************************************/
 
+/** secp256k1 group取得
+ *
+ * 初回呼び出し時にgroupを読み込み、base point(G)の乗算用tableを作成する。
+ * 以降は全threadで同じgroupを共有する(読み込み専用として扱うこと)。
+ *
+ * @return      mbedtls_ecp_group *
+ */
+void *btc_ecc_group(void);
+
+
 /** 圧縮公開鍵を非圧縮公開鍵展開
  *
  * @param[out]  point       非圧縮公開鍵座標
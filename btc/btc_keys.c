@@ -145,12 +145,10 @@ bool btc_keys_priv2pub(uint8_t *pPubKey, const uint8_t *pPrivKey) //XXX: mbed
 
     mbedtls_ecp_point P;
     mbedtls_mpi m;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
 
     mbedtls_ecp_point_init(&P);
     mbedtls_mpi_init(&m);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
 
     //P: The destination point
     //m: The integer by which to multiply
@@ -159,16 +157,15 @@ bool btc_keys_priv2pub(uint8_t *pPubKey, const uint8_t *pPrivKey) //XXX: mbed
     if (ret) {
         goto LABEL_EXIT;
     }
-    ret = mbedtls_ecp_mul(&keypair.grp, &P, &m, &keypair.grp.G, NULL, NULL);
+    ret = mbedtls_ecp_mul(p_grp, &P, &m, &p_grp->G, NULL, NULL);
     if (ret) {
         goto LABEL_EXIT;
     }
 
     size_t sz;
-    ret = mbedtls_ecp_point_write_binary(&keypair.grp, &P, MBEDTLS_ECP_PF_COMPRESSED, &sz, pPubKey, BTC_SZ_PUBKEY);
+    ret = mbedtls_ecp_point_write_binary(p_grp, &P, MBEDTLS_ECP_PF_COMPRESSED, &sz, pPubKey, BTC_SZ_PUBKEY);
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_ecp_point_free(&P);
     mbedtls_mpi_lset(&m, 0);            //clear for security
     mbedtls_mpi_free(&m);
@@ -253,16 +250,15 @@ bool btc_keys_wit2waddr(char *pWAddr, const utl_buf_t *pWitnessScript)
 
 bool btc_keys_uncomp_pub(uint8_t *pUncomp, const uint8_t *pPubKey) //XXX: mbed
 {
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_point_init(&Q);
 
-    int ret = btc_ecc_set_keypair(&keypair, pPubKey);
+    int ret = btc_ecc_ecp_read_binary_pubkey(&Q, pPubKey);
     if (!ret) {
-        mbedtls_mpi_write_binary(&(keypair.Q.X), pUncomp, BTC_SZ_PUBKEY - 1);
-        mbedtls_mpi_write_binary(&(keypair.Q.Y), pUncomp + BTC_SZ_PUBKEY - 1, BTC_SZ_PUBKEY - 1);
+        mbedtls_mpi_write_binary(&(Q.X), pUncomp, BTC_SZ_PUBKEY - 1);
+        mbedtls_mpi_write_binary(&(Q.Y), pUncomp + BTC_SZ_PUBKEY - 1, BTC_SZ_PUBKEY - 1);
     }
-    mbedtls_ecp_keypair_free(&keypair);
+    mbedtls_ecp_point_free(&Q);
 
     return ret == 0;
 }
@@ -272,9 +268,7 @@ bool btc_keys_check_priv(const uint8_t *pPrivKey) //XXX: mbed
 {
     bool cmp;
     mbedtls_mpi priv;
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
 
     mbedtls_mpi_init(&priv);
     mbedtls_mpi_read_binary(&priv, pPrivKey, BTC_SZ_PRIVKEY);
@@ -285,11 +279,10 @@ bool btc_keys_check_priv(const uint8_t *pPrivKey) //XXX: mbed
     if (cmp) {
         //N: order of G
         //check that priv is lesser than N
-        cmp = (mbedtls_mpi_cmp_mpi(&priv, &keypair.grp.N) == -1);
+        cmp = (mbedtls_mpi_cmp_mpi(&priv, &p_grp->N) == -1);
     }
 
     mbedtls_mpi_free(&priv);
-    mbedtls_ecp_keypair_free(&keypair);
 
     return cmp;
 }
@@ -297,12 +290,11 @@ bool btc_keys_check_priv(const uint8_t *pPrivKey) //XXX: mbed
 
 bool btc_keys_check_pub(const uint8_t *pPubKey) //XXX: mbed
 {
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_point_init(&Q);
 
-    int ret = btc_ecc_set_keypair(&keypair, pPubKey);
-    mbedtls_ecp_keypair_free(&keypair);
+    int ret = btc_ecc_ecp_read_binary_pubkey(&Q, pPubKey);
+    mbedtls_ecp_point_free(&Q);
 
     return ret == 0;
 }
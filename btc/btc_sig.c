@@ -40,6 +40,7 @@
  **************************************************************************/
 
 static bool is_valid_signature_encoding(const uint8_t *sig, uint16_t size);
+static int verify_rs(const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPubKey);
 static int sign_rs(mbedtls_mpi *p_r, mbedtls_mpi *p_s, const uint8_t *pTxHash, const uint8_t *pPrivKey);
 static int rs_to_asn1( const mbedtls_mpi *r, const mbedtls_mpi *s, unsigned char *sig, size_t *slen );
 static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pOrgPubKey);
@@ -142,9 +143,7 @@ bool btc_sig_verify_2(const uint8_t *pSig, uint32_t Len, const uint8_t *pTxHash,
 {
     int ret;
     bool bret;
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
+    uint8_t rs[BTC_SZ_SIGN_RS];
 
     if (pSig[Len - 1] != SIGHASH_ALL) {
         LOGE("fail: not SIGHASH_ALL\n");
@@ -159,14 +158,16 @@ bool btc_sig_verify_2(const uint8_t *pSig, uint32_t Len, const uint8_t *pTxHash,
         goto LABEL_EXIT;
     }
 
-    ret = btc_ecc_set_keypair(&keypair, pPubKey);
-    if (ret) {
-        LOGE("fail keypair\n");
+    //mbedtls_ecdsa_read_signature()はcontext内にgroupが必要なため、
+    //  r, sを取り出して共有groupで検証する
+    bret = btc_sig_der2rs(rs, pSig, Len);
+    if (!bret) {
+        LOGE("fail: invalid sig\n");
+        ret = -1;
         goto LABEL_EXIT;
     }
 
-    ret = mbedtls_ecdsa_read_signature((mbedtls_ecdsa_context *)&keypair,
-                pTxHash, BTC_SZ_HASH256, pSig, Len - 1);
+    ret = verify_rs(rs, pTxHash, pPubKey);
     if (ret) {
         LOGE("fail verify sig\n");
         goto LABEL_EXIT;
@@ -174,8 +175,6 @@ bool btc_sig_verify_2(const uint8_t *pSig, uint32_t Len, const uint8_t *pTxHash,
 
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
-
     if (ret == 0) {
         LOGD("ok: verify\n");
     } else {
@@ -193,43 +192,7 @@ LABEL_EXIT:
 
 bool btc_sig_verify_rs(const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPubKey) //XXX: mbed
 {
-    int ret;
-    mbedtls_mpi r, s;
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
-    mbedtls_mpi_init(&r);
-    mbedtls_mpi_init(&s);
-
-    ret = mbedtls_mpi_read_binary(&r, pRS, 32);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-    ret = mbedtls_mpi_read_binary(&s, pRS + 32, 32);
-    if (ret) {
-        assert(0);
-        goto LABEL_EXIT;
-    }
-
-    ret = btc_ecc_set_keypair(&keypair, pPubKey);
-    if (ret) {
-        LOGE("fail keypair\n");
-        goto LABEL_EXIT;
-    }
-
-    ret = mbedtls_ecdsa_verify(&keypair.grp, pTxHash, BTC_SZ_HASH256, &keypair.Q, &r, &s);
-    if (ret) {
-        LOGE("fail verify\n");
-        goto LABEL_EXIT;
-    }
-
-LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
-    mbedtls_mpi_free( &r );
-    mbedtls_mpi_free( &s );
-
+    int ret = verify_rs(pRS, pTxHash, pPubKey);
     if (ret == 0) {
         //LOGD("ok: verify\n");
     } else {
@@ -473,23 +436,66 @@ static bool is_valid_signature_encoding(const uint8_t *sig, uint16_t size)
 /** Sign to the hash
  *
  */
+static int verify_rs(const uint8_t *pRS, const uint8_t *pTxHash, const uint8_t *pPubKey)
+{
+    int ret;
+    mbedtls_mpi r, s;
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
+
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    mbedtls_ecp_point_init(&Q);
+
+    ret = mbedtls_mpi_read_binary(&r, pRS, 32);
+    if (ret) {
+        assert(0);
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_read_binary(&s, pRS + 32, 32);
+    if (ret) {
+        assert(0);
+        goto LABEL_EXIT;
+    }
+
+    ret = btc_ecc_ecp_read_binary_pubkey(&Q, pPubKey);
+    if (ret) {
+        LOGE("fail keypair\n");
+        goto LABEL_EXIT;
+    }
+
+    ret = mbedtls_ecdsa_verify(p_grp, pTxHash, BTC_SZ_HASH256, &Q, &r, &s);
+    if (ret) {
+        LOGE("fail verify\n");
+        goto LABEL_EXIT;
+    }
+
+LABEL_EXIT:
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_mpi_free( &r );
+    mbedtls_mpi_free( &s );
+
+    return ret;
+}
+
+
 static int sign_rs(mbedtls_mpi *p_r, mbedtls_mpi *p_s, const uint8_t *pTxHash, const uint8_t *pPrivKey)
 {
     int ret;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_mpi d;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
 
     mbedtls_mpi_init(p_r);
     mbedtls_mpi_init(p_s);
-    mbedtls_ecp_keypair_init(&keypair);
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_mpi_read_binary(&keypair.d, pPrivKey, BTC_SZ_PRIVKEY);
+    mbedtls_mpi_init(&d);
+    ret = mbedtls_mpi_read_binary(&d, pPrivKey, BTC_SZ_PRIVKEY);
     if (ret) {
         LOGE("FAIL: ecdsa_sign: %d\n", ret);
         assert(0);
         goto LABEL_EXIT;
     }
 
-    ret = mbedtls_ecdsa_sign_det(&keypair.grp, p_r, p_s, &keypair.d,
+    ret = mbedtls_ecdsa_sign_det(p_grp, p_r, p_s, &d,
                     pTxHash, BTC_SZ_HASH256, MBEDTLS_MD_SHA256);
     if (ret) {
         LOGE("FAIL: ecdsa_sign: %d\n", ret);
@@ -501,10 +507,10 @@ static int sign_rs(mbedtls_mpi *p_r, mbedtls_mpi *p_s, const uint8_t *pTxHash, c
     // we use `s < (N/2)`
     mbedtls_mpi half_n;
     mbedtls_mpi_init(&half_n);
-    mbedtls_mpi_copy(&half_n, &keypair.grp.N);
+    mbedtls_mpi_copy(&half_n, &p_grp->N);
     mbedtls_mpi_shift_r(&half_n, 1);
     if (mbedtls_mpi_cmp_mpi(p_s, &half_n) == 1) {
-        ret = mbedtls_mpi_sub_mpi(p_s, &keypair.grp.N, p_s);
+        ret = mbedtls_mpi_sub_mpi(p_s, &p_grp->N, p_s);
         if (ret) {
             LOGE("FAIL: ecdsa_sign: %d\n", ret);
             assert(0);
@@ -514,7 +520,7 @@ static int sign_rs(mbedtls_mpi *p_r, mbedtls_mpi *p_s, const uint8_t *pTxHash, c
     mbedtls_mpi_free(&half_n);
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
+    mbedtls_mpi_free(&d);
 
     return ret;
 }
@@ -561,7 +567,7 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
     bool bret = false;
     int ret;
 
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
     mbedtls_mpi me;
     mbedtls_mpi r, s;
     mbedtls_mpi inv_r;
@@ -570,7 +576,6 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
     mbedtls_ecp_point MR;
     mbedtls_ecp_point pub;
 
-    mbedtls_ecp_keypair_init(&keypair);
     mbedtls_mpi_init(&me);
     mbedtls_mpi_init(&r);
     mbedtls_mpi_init(&s);
@@ -582,8 +587,6 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
     const mbedtls_ecp_point *pR[2] = { &R, &MR };
     int is_zero;
 
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-
     // 1.5
     //      e = Hash(M)
     //      me = -e
@@ -595,7 +598,7 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
     mbedtls_mpi_lset(&zero, 0);
     ret = mbedtls_mpi_sub_mpi(&me, &zero, &me);
     assert(ret == 0);
-    ret = mbedtls_mpi_mod_mpi(&me, &me, &keypair.grp.N);
+    ret = mbedtls_mpi_mod_mpi(&me, &me, &p_grp->N);
     assert(ret == 0);
     mbedtls_mpi_free(&zero);
 
@@ -605,7 +608,7 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
     assert(ret == 0);
 
     //      inv_r = r^-1
-    ret = mbedtls_mpi_inv_mod(&inv_r, &r, &keypair.grp.N);
+    ret = mbedtls_mpi_inv_mod(&inv_r, &r, &p_grp->N);
     assert(ret == 0);
 
     int start_j;
@@ -624,13 +627,13 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
         //      x = r + jn
         mbedtls_mpi tmpx;
         mbedtls_mpi_init(&tmpx);
-        ret = mbedtls_mpi_mul_int(&tmpx, &keypair.grp.N, j);
+        ret = mbedtls_mpi_mul_int(&tmpx, &p_grp->N, j);
         assert(ret == 0);
 
         ret = mbedtls_mpi_add_mpi(&x, &r, &tmpx);
         assert(ret == 0);
         mbedtls_mpi_free(&tmpx);
-        keypair.grp.modp(&x);
+        p_grp->modp(&x);
 
         // 1.2. - 1.3.
         //      R = 02 || x
@@ -645,7 +648,7 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
         //      error if nR != 0
         mbedtls_ecp_point nR;
         mbedtls_ecp_point_init(&nR);
-        ret = mbedtls_ecp_mul(&keypair.grp, &nR, &keypair.grp.N, &R, NULL, NULL);
+        ret = mbedtls_ecp_mul(p_grp, &nR, &p_grp->N, &R, NULL, NULL);
         is_zero = mbedtls_ecp_is_zero(&nR);
         mbedtls_ecp_point_free(&nR);
         if ((ret == 0) || !is_zero) {
@@ -657,7 +660,7 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
 
         // 1.6.3.
         mbedtls_ecp_copy(&MR, &R);
-        ret = mbedtls_mpi_sub_mpi(&MR.Y, &keypair.grp.P, &MR.Y);        // -R.Y = P - R.Yになる(mod P不要)
+        ret = mbedtls_mpi_sub_mpi(&MR.Y, &p_grp->P, &MR.Y);        // -R.Y = P - R.Yになる(mod P不要)
         assert(ret == 0);
 
         for (int k = start_k; k < 2; k++) {
@@ -665,15 +668,15 @@ static bool recover_pubkey(uint8_t *pPubKey, int *pRecId, const uint8_t *pRS, co
             //      Q = r^-1 * (sR - eG)
 
             //      (sR - eG)
-            ret = mbedtls_ecp_muladd(&keypair.grp, &pub, &s, pR[k], &me, &keypair.grp.G);
+            ret = mbedtls_ecp_muladd(p_grp, &pub, &s, pR[k], &me, &p_grp->G);
             assert(ret == 0);
             //      Q = r^-1 * Q
-            ret = mbedtls_ecp_mul(&keypair.grp, &pub, &inv_r, &pub, NULL, NULL);
+            ret = mbedtls_ecp_mul(p_grp, &pub, &inv_r, &pub, NULL, NULL);
             assert(ret == 0);
 
             size_t sz;
             ret = mbedtls_ecp_point_write_binary(
-                                &keypair.grp, &pub, MBEDTLS_ECP_PF_COMPRESSED,
+                                p_grp, &pub, MBEDTLS_ECP_PF_COMPRESSED,
                                 &sz, pPubKey, BTC_SZ_PUBKEY);
             assert(ret == 0);
 
@@ -717,7 +720,6 @@ SKIP_LOOP:
     mbedtls_mpi_free(&r);
     mbedtls_mpi_free(&inv_r);
     mbedtls_mpi_free(&me);
-    mbedtls_ecp_keypair_free(&keypair);
 
     return bret;
 }
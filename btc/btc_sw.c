@@ -33,6 +33,20 @@
 #include "btc_tx_buf.h"
 
 
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_SZ_SIGHASH_FIXED      (4 + 32 + 32 + 36 + 8 + 4 + 32 + 4 + 4) ///< sighash preimageのscriptCode以外のサイズ
+#define M_SZ_SIGHASH_STACK      (512)       ///< preimageをstack上で作成する最大サイズ
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool sighash_calc(const btc_sw_sighash_ctx_t *pCtx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const uint8_t *pScript, uint32_t ScriptLen, bool bAddLen);
+
 /**************************************************************************
  * public functions
  **************************************************************************/
@@ -103,20 +117,26 @@ bool btc_sw_scriptcode_p2wsh_vin(utl_buf_t *pScriptCode, const btc_vin_t *pVin)
 
 bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode)
 {
-    // [transaction version : 4]
-    // [hash_prevouts : 32]
-    // [hash_sequence : 32]
-    // [outpoint : 32 + 4]
-    // [scriptcode : xx]
-    // [amount : 8]
-    // [sequence : 4]
-    // [hash_outputs : 32]
-    // [locktime : 4]
-    // [hash_type : 4]
+    btc_sw_sighash_ctx_t ctx;
+
+    if (!btc_sw_sighash_ctx_init(&ctx, pTx)) return false;
+    return btc_sw_sighash_ctx_calc(&ctx, pTxHash, Index, Value, pScriptCode);
+}
+
+
+bool btc_sw_sighash_p2wsh_wit(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pWitScript)
+{
+    btc_sw_sighash_ctx_t ctx;
+
+    if (!btc_sw_sighash_ctx_init(&ctx, pTx)) return false;
+    return btc_sw_sighash_ctx_calc_p2wsh_wit(&ctx, pTxHash, Index, Value, pWitScript);
+}
 
+
+bool btc_sw_sighash_ctx_init(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx)
+{
     bool ret = false;
     btc_buf_w_t buf_w;
-    btc_buf_w_t buf_w_tmp;
     uint32_t lp;
 
     btc_tx_valid_t txvalid = btc_tx_is_valid(pTx);
@@ -125,90 +145,54 @@ bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint6
         return false;
     }
 
-    if (!btc_buf_w_init(&buf_w, 0)) return false;
-    if (!btc_buf_w_init(&buf_w_tmp, 0)) return false;
-
-    //version
-    if (!btc_buf_w_write_u32le(&buf_w, pTx->version)) goto LABEL_EXIT;
-
-    //vin:
-    // prev outs:
+    if (!btc_buf_w_init(&buf_w, (BTC_SZ_TXID + 4) * pTx->vin_cnt)) return false;
 
     //hash_prevouts: HASH256((txid(32) | index(4)) * n)
-    btc_buf_w_truncate(&buf_w_tmp);
     for (lp = 0; lp < pTx->vin_cnt; lp++) {
         btc_vin_t *vin = &pTx->vin[lp];
 
-        if (!btc_buf_w_write_data(&buf_w_tmp, vin->txid, BTC_SZ_TXID)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_u32le(&buf_w_tmp, vin->index)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_data(&buf_w, vin->txid, BTC_SZ_TXID)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_u32le(&buf_w, vin->index)) goto LABEL_EXIT;
     }
-    if (!btc_buf_w_write_hash256(&buf_w, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp))) goto LABEL_EXIT;
+    btc_md_hash256(pCtx->hash_prevouts, btc_tx_buf_w_get_data(&buf_w), btc_tx_buf_w_get_len(&buf_w));
 
     //hash_sequence: HASH256(sequence(4) * n)
-    btc_buf_w_truncate(&buf_w_tmp);
+    btc_buf_w_truncate(&buf_w);
     for (lp = 0; lp < pTx->vin_cnt; lp++) {
-        if (!btc_buf_w_write_u32le(&buf_w_tmp, pTx->vin[lp].sequence)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_u32le(&buf_w, pTx->vin[lp].sequence)) goto LABEL_EXIT;
     }
-    if (!btc_buf_w_write_hash256(&buf_w, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp))) goto LABEL_EXIT;
-
-    //outpoint: txid(32) | Index(4)
-    if (!btc_buf_w_write_data(&buf_w, pTx->vin[Index].txid, BTC_SZ_TXID)) goto LABEL_EXIT;
-    if (!btc_buf_w_write_u32le(&buf_w, pTx->vin[Index].index)) goto LABEL_EXIT;
-
-    //scriptcode
-    if (!btc_buf_w_write_data(&buf_w, pScriptCode->buf, pScriptCode->len)) goto LABEL_EXIT;
-
-    //amount
-    if (!btc_buf_w_write_u64le(&buf_w, Value)) goto LABEL_EXIT;
-
-    //sequence
-    if (!btc_buf_w_write_u32le(&buf_w, pTx->vin[Index].sequence)) goto LABEL_EXIT;
-
-    //vout:
-    // next vins:
+    btc_md_hash256(pCtx->hash_sequence, btc_tx_buf_w_get_data(&buf_w), btc_tx_buf_w_get_len(&buf_w));
 
     //hash_outputs: HASH256((value(8) | scriptPk) * n)
-    btc_buf_w_truncate(&buf_w_tmp);
+    btc_buf_w_truncate(&buf_w);
     for (lp = 0; lp < pTx->vout_cnt; lp++) {
         btc_vout_t *vout = &pTx->vout[lp];
-        if (!btc_buf_w_write_u64le(&buf_w_tmp, vout->value)) goto LABEL_EXIT;
-        if (!btc_tx_buf_w_write_varint_len(&buf_w_tmp, vout->script.len)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_data(&buf_w_tmp, vout->script.buf, vout->script.len)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_u64le(&buf_w, vout->value)) goto LABEL_EXIT;
+        if (!btc_tx_buf_w_write_varint_len(&buf_w, vout->script.len)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_data(&buf_w, vout->script.buf, vout->script.len)) goto LABEL_EXIT;
     }
-    if (!btc_buf_w_write_hash256(&buf_w, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp))) goto LABEL_EXIT;
-
-    //locktime
-    if (!btc_buf_w_write_u32le(&buf_w, pTx->locktime)) goto LABEL_EXIT;
-
-    //hashtype
-    if (!btc_buf_w_write_u32le(&buf_w, SIGHASH_ALL)) goto LABEL_EXIT;
-
-    btc_md_hash256(pTxHash, btc_tx_buf_w_get_data(&buf_w), btc_tx_buf_w_get_len(&buf_w));
+    btc_md_hash256(pCtx->hash_outputs, btc_tx_buf_w_get_data(&buf_w), btc_tx_buf_w_get_len(&buf_w));
 
+    pCtx->p_tx = pTx;
     ret = true;
 
 LABEL_EXIT:
     btc_tx_buf_w_free(&buf_w);
-    btc_tx_buf_w_free(&buf_w_tmp);
-
     return ret;
 }
 
 
-bool btc_sw_sighash_p2wsh_wit(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pWitScript)
+bool btc_sw_sighash_ctx_calc(const btc_sw_sighash_ctx_t *pCtx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode)
 {
-    utl_buf_t script_code = UTL_BUF_INIT;
+    return sighash_calc(pCtx, pTxHash, Index, Value, pScriptCode->buf, pScriptCode->len, false);
+}
 
-    btc_tx_valid_t txvalid = btc_tx_is_valid(pTx);
-    if (txvalid != BTC_TXVALID_OK) {
-        LOGE("fail\n");
-        return false;
-    }
 
-    if (!btc_script_p2wsh_create_scriptcode(&script_code, pWitScript)) return false;
-    if (!btc_sw_sighash(pTx, pTxHash, Index, Value, &script_code)) return false;
-    utl_buf_free(&script_code);
-    return true;
+bool btc_sw_sighash_ctx_calc_p2wsh_wit(const btc_sw_sighash_ctx_t *pCtx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pWitScript)
+{
+    //scriptCode: varint(len) | witnessScript
+    //  (#btc_script_p2wsh_create_scriptcode()と同じ値をpreimageに直接書き込む)
+    return sighash_calc(pCtx, pTxHash, Index, Value, pWitScript->buf, pWitScript->len, true);
 }
 
 
@@ -361,3 +345,114 @@ void btc_sw_wit2prog_p2wsh(uint8_t *pWitProg, const utl_buf_t *pWitScript)
     pWitProg[1] = BTC_SZ_HASH256;
     btc_md_sha256(pWitProg + 2, pWitScript->buf, pWitScript->len);
 }
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** BIP143 sighash計算
+ *
+ * preimageは通常stack上に作成し、scriptCodeが大きい場合のみheapを使用する。
+ *
+ * @param[in]       pCtx            #btc_sw_sighash_ctx_init()で計算した値
+ * @param[out]      pTxHash         sighash
+ * @param[in]       Index           署名するINPUTのindex番号
+ * @param[in]       Value           署名するINPUTのvalue[単位:satoshi]
+ * @param[in]       pScript         scriptCode(bAddLen==true: witnessScript)
+ * @param[in]       ScriptLen       pScript長
+ * @param[in]       bAddLen         true: pScriptの前にvarint(ScriptLen)を付加する
+ */
+static bool sighash_calc(const btc_sw_sighash_ctx_t *pCtx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const uint8_t *pScript, uint32_t ScriptLen, bool bAddLen)
+{
+    // [transaction version : 4]
+    // [hash_prevouts : 32]
+    // [hash_sequence : 32]
+    // [outpoint : 32 + 4]
+    // [scriptcode : xx]
+    // [amount : 8]
+    // [sequence : 4]
+    // [hash_outputs : 32]
+    // [locktime : 4]
+    // [hash_type : 4]
+
+    const btc_tx_t *p_tx = pCtx->p_tx;
+    uint8_t stack_buf[M_SZ_SIGHASH_STACK];
+    uint8_t *p_buf = stack_buf;
+    uint8_t *p;
+    uint32_t len;
+    uint32_t len_varint = 0;
+
+    if (Index >= p_tx->vin_cnt) {
+        LOGE("fail: invalid index\n");
+        return false;
+    }
+    if (bAddLen) {
+        len_varint = (ScriptLen < 0xfd) ? 1 : ((ScriptLen <= 0xffff) ? 3 : 5);
+    }
+    len = M_SZ_SIGHASH_FIXED + len_varint + ScriptLen;
+    if (len > sizeof(stack_buf)) {
+        p_buf = (uint8_t *)UTL_DBG_MALLOC(len);
+        if (!p_buf) return false;
+    }
+    p = p_buf;
+
+    //version
+    utl_int_unpack_u32le(p, p_tx->version);
+    p += 4;
+
+    //hash_prevouts, hash_sequence
+    memcpy(p, pCtx->hash_prevouts, BTC_SZ_HASH256);
+    p += BTC_SZ_HASH256;
+    memcpy(p, pCtx->hash_sequence, BTC_SZ_HASH256);
+    p += BTC_SZ_HASH256;
+
+    //outpoint: txid(32) | Index(4)
+    memcpy(p, p_tx->vin[Index].txid, BTC_SZ_TXID);
+    p += BTC_SZ_TXID;
+    utl_int_unpack_u32le(p, p_tx->vin[Index].index);
+    p += 4;
+
+    //scriptcode
+    if (len_varint == 1) {
+        *p++ = (uint8_t)ScriptLen;
+    } else if (len_varint == 3) {
+        *p++ = 0xfd;
+        utl_int_unpack_u16le(p, (uint16_t)ScriptLen);
+        p += 2;
+    } else if (len_varint == 5) {
+        *p++ = 0xfe;
+        utl_int_unpack_u32le(p, ScriptLen);
+        p += 4;
+    }
+    if (ScriptLen) {
+        memcpy(p, pScript, ScriptLen);
+        p += ScriptLen;
+    }
+
+    //amount
+    utl_int_unpack_u64le(p, Value);
+    p += 8;
+
+    //sequence
+    utl_int_unpack_u32le(p, p_tx->vin[Index].sequence);
+    p += 4;
+
+    //hash_outputs
+    memcpy(p, pCtx->hash_outputs, BTC_SZ_HASH256);
+    p += BTC_SZ_HASH256;
+
+    //locktime
+    utl_int_unpack_u32le(p, p_tx->locktime);
+    p += 4;
+
+    //hashtype
+    utl_int_unpack_u32le(p, SIGHASH_ALL);
+
+    btc_md_hash256(pTxHash, p_buf, len);
+
+    if (p_buf != stack_buf) {
+        UTL_DBG_FREE(p_buf);
+    }
+    return true;
+}
@@ -33,6 +33,7 @@
 
 #include "utl_buf.h"
 
+#include "btc_crypto.h"
 #include "btc_tx.h"
 
 
@@ -56,6 +57,20 @@ extern "C" {
  * typedefs
  **************************************************************************/
 
+/** @struct btc_sw_sighash_ctx_t
+ *  @brief  BIP143 sighash計算の事前計算値
+ *
+ * hashPrevouts, hashSequence, hashOutputsはINPUTによらず同じ値になるため、
+ * #btc_sw_sighash_ctx_init()で1回だけ計算し、INPUT毎の計算で使い回す。
+ */
+typedef struct {
+    const btc_tx_t  *p_tx;                              ///< 対象トランザクション
+    uint8_t         hash_prevouts[BTC_SZ_HASH256];      ///< hashPrevouts
+    uint8_t         hash_sequence[BTC_SZ_HASH256];      ///< hashSequence
+    uint8_t         hash_outputs[BTC_SZ_HASH256];       ///< hashOutputs
+} btc_sw_sighash_ctx_t;
+
+
 /**************************************************************************
  * prototypes
  **************************************************************************/
@@ -125,6 +140,47 @@ bool btc_sw_scriptcode_p2wsh_vin(utl_buf_t *pScriptCode, const btc_vin_t *pVin);
 bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode);
 
 
+/** segwitトランザクション署名用ハッシュ値の事前計算
+ *
+ * @param[out]      pCtx                事前計算値
+ * @param[in]       pTx                 署名対象のトランザクションデータ
+ * @retval  false   pTxがトランザクションとして不正
+ *
+ * @note
+ *      - pTxはpCtxを使い終わるまで保持し、vin/vout/version/locktimeを変更しないこと
+ *        (witnessやscriptSigは変更してよい)
+ */
+bool btc_sw_sighash_ctx_init(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx);
+
+
+/** segwitトランザクション署名用ハッシュ値計算(事前計算値使用)
+ *
+ * #btc_sw_sighash()と同じ値を計算する。
+ *
+ * @param[in]       pCtx                #btc_sw_sighash_ctx_init()で計算した値
+ * @param[out]      pTxHash             署名に使用するハッシュ値(BTC_SZ_HASH256)
+ * @param[in]       Index               署名するINPUTのindex番号
+ * @param[in]       Value               署名するINPUTのvalue[単位:satoshi]
+ * @param[in]       pScriptCode         Script Code
+ * @retval  false   Indexが範囲外
+ */
+bool btc_sw_sighash_ctx_calc(const btc_sw_sighash_ctx_t *pCtx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode);
+
+
+/** P2WSH署名用ハッシュ値計算(事前計算値使用)
+ *
+ * #btc_sw_sighash_p2wsh_wit()と同じ値を計算する。
+ *
+ * @param[in]       pCtx                #btc_sw_sighash_ctx_init()で計算した値
+ * @param[out]      pTxHash             署名に使用するハッシュ値(BTC_SZ_HASH256)
+ * @param[in]       Index               署名するINPUTのindex番号
+ * @param[in]       Value               署名するINPUTのvalue[単位:satoshi]
+ * @param[in]       pWitScript          witnessScript
+ * @retval  false   Indexが範囲外
+ */
+bool btc_sw_sighash_ctx_calc_p2wsh_wit(const btc_sw_sighash_ctx_t *pCtx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pWitScript);
+
+
 /** P2WSH署名 - Phase1: トランザクションハッシュ作成
  *
  * @param[in]       pTx
@@ -334,132 +334,16 @@ bool btc_tx_set_vin_p2sh_multisig(btc_tx_t *pTx, uint32_t Index, const utl_buf_t
 
 bool btc_tx_read(btc_tx_t *pTx, const uint8_t *pData, uint32_t Len)
 {
-    //XXX: check error
-    // segwit but non-witness is not permitted
-
-    bool ret = false;
-    uint32_t tmp_u32;
-    uint64_t tmp_u64;
-    uint32_t i;
-
-    btc_buf_r_t txbuf;
-    btc_tx_buf_r_init(&txbuf, pData, Len);
-
-    //version
-    if (!btc_tx_buf_r_read_u32le(&txbuf, &tmp_u32)) goto LABEL_EXIT;
-    pTx->version = (int32_t)tmp_u32;
+    uint32_t read_len;
 
-    //mark, flag
-    bool segwit;
-    uint8_t mark;
-    uint8_t flag;
-    if (!btc_tx_buf_r_read_byte(&txbuf, &mark)) goto LABEL_EXIT;
-    if (!btc_tx_buf_r_read_byte(&txbuf, &flag)) goto LABEL_EXIT;
-    if (mark == 0x00 && flag == 0x01) { //2017/01/04:BIP-144
-        segwit = true;
-    } else if (mark == 0x00) {
-        goto LABEL_EXIT;
-    } else {
-        segwit = false;
-        if (!btc_tx_buf_r_seek(&txbuf, -2)) goto LABEL_EXIT; //rewind
-    }
-
-    //txin count
-    if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
-    if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
-    pTx->vin_cnt = (uint32_t)tmp_u64;
-    //XXX: if (pTx->vin_cnt == 0) goto LABEL_EXIT;
-
-    //XXX:
-    pTx->vin = (btc_vin_t *)UTL_DBG_MALLOC(sizeof(btc_vin_t) * pTx->vin_cnt);
-    if (!pTx->vin) goto LABEL_EXIT;
-    memset(pTx->vin, 0x00, sizeof(btc_vin_t) * pTx->vin_cnt);
-
-    //txin
-    for (i = 0; i < pTx->vin_cnt; i++) {
-        btc_vin_t *vin = &(pTx->vin[i]);
-
-        //txid
-        if (!btc_tx_buf_r_read(&txbuf, vin->txid, BTC_SZ_TXID)) goto LABEL_EXIT;
-
-        //index
-        if (!btc_tx_buf_r_read_u32le(&txbuf, &vin->index)) goto LABEL_EXIT;
-
-        //scriptSig
-        if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
-        if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
-        if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
-        if (!utl_buf_alloccopy(&vin->script, btc_tx_buf_r_get_pos(&txbuf), (uint32_t)tmp_u64)) goto LABEL_EXIT;
-        if (!btc_tx_buf_r_seek(&txbuf, (uint32_t)tmp_u64)) goto LABEL_EXIT;
-
-        //sequence
-        if (!btc_tx_buf_r_read_u32le(&txbuf, &vin->sequence)) goto LABEL_EXIT;
-    }
-
-    //txout count
-    if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
-    if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
-    pTx->vout_cnt = (uint32_t)tmp_u64;
-    //XXX: if (pTx->vout_cnt == 0) goto LABEL_EXIT;
-
-    //XXX:
-    pTx->vout = (btc_vout_t *)UTL_DBG_MALLOC(sizeof(btc_vout_t) * pTx->vout_cnt);
-    if (!pTx->vout) goto LABEL_EXIT;
-    memset(pTx->vout, 0x00, sizeof(btc_vout_t) * pTx->vout_cnt);
-
-    //txout
-    for (i = 0; i < pTx->vout_cnt; i++) {
-        btc_vout_t *vout = &(pTx->vout[i]);
-
-        //value
-        if (!btc_tx_buf_r_read_u64le(&txbuf, &vout->value)) goto LABEL_EXIT;
-
-        //scriptPubKey
-        if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
-        if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
-        if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
-        if (!utl_buf_alloccopy(&vout->script, btc_tx_buf_r_get_pos(&txbuf), (uint32_t)tmp_u64)) goto LABEL_EXIT;
-        if (!btc_tx_buf_r_seek(&txbuf, (uint32_t)tmp_u64)) goto LABEL_EXIT;
-    }
-
-    //witness
-    if (segwit) {
-        for (i = 0; i < pTx->vin_cnt; i++) {
-            //witness item count
-            if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
-            if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
-            if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
-            pTx->vin[i].wit_item_cnt = (uint32_t)tmp_u64;
-
-            //XXX:
-            pTx->vin[i].witness = (utl_buf_t *)UTL_DBG_MALLOC(sizeof(utl_buf_t) * pTx->vin[i].wit_item_cnt);
-            if (!pTx->vin[i].witness) goto LABEL_EXIT;
-            memset(pTx->vin[i].witness, 0x00, sizeof(utl_buf_t) * pTx->vin[i].wit_item_cnt);
-
-            //witness item
-            for (uint32_t lp = 0; lp < pTx->vin[i].wit_item_cnt; lp++) {
-                if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
-                if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
-                if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
-                if (!utl_buf_alloccopy(&pTx->vin[i].witness[lp], btc_tx_buf_r_get_pos(&txbuf), (uint32_t)tmp_u64)) goto LABEL_EXIT;
-                if (!btc_tx_buf_r_seek(&txbuf, (uint32_t)tmp_u64)) goto LABEL_EXIT;
-            }
-        }
-    }
-
-    //locktime
-    if (!btc_tx_buf_r_read_u32le(&txbuf, &pTx->locktime)) goto LABEL_EXIT;
+    if (!btc_tx_read_2(pTx, pData, Len, &read_len)) return false;
 
     //check the end of the data
-    if (btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
-
-    ret = true;
-
-LABEL_EXIT:
-    if (!ret) {
+    if (read_len != Len) {
         btc_tx_free(pTx);
+        return false;
     }
-    return ret;
+    return true;
 }
 
 
@@ -920,6 +804,135 @@ LABEL_EXIT:
 }
 
 
+bool btc_tx_read_2(btc_tx_t *pTx, const uint8_t *pData, uint32_t Len, uint32_t *pReadLen)
+{
+    //XXX: check error
+    // segwit but non-witness is not permitted
+
+    bool ret = false;
+    uint32_t tmp_u32;
+    uint64_t tmp_u64;
+    uint32_t i;
+
+    btc_buf_r_t txbuf;
+    btc_tx_buf_r_init(&txbuf, pData, Len);
+
+    //version
+    if (!btc_tx_buf_r_read_u32le(&txbuf, &tmp_u32)) goto LABEL_EXIT;
+    pTx->version = (int32_t)tmp_u32;
+
+    //mark, flag
+    bool segwit;
+    uint8_t mark;
+    uint8_t flag;
+    if (!btc_tx_buf_r_read_byte(&txbuf, &mark)) goto LABEL_EXIT;
+    if (!btc_tx_buf_r_read_byte(&txbuf, &flag)) goto LABEL_EXIT;
+    if (mark == 0x00 && flag == 0x01) { //2017/01/04:BIP-144
+        segwit = true;
+    } else if (mark == 0x00) {
+        goto LABEL_EXIT;
+    } else {
+        segwit = false;
+        if (!btc_tx_buf_r_seek(&txbuf, -2)) goto LABEL_EXIT; //rewind
+    }
+
+    //txin count
+    if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
+    if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
+    pTx->vin_cnt = (uint32_t)tmp_u64;
+    //XXX: if (pTx->vin_cnt == 0) goto LABEL_EXIT;
+
+    //XXX:
+    pTx->vin = (btc_vin_t *)UTL_DBG_MALLOC(sizeof(btc_vin_t) * pTx->vin_cnt);
+    if (!pTx->vin) goto LABEL_EXIT;
+    memset(pTx->vin, 0x00, sizeof(btc_vin_t) * pTx->vin_cnt);
+
+    //txin
+    for (i = 0; i < pTx->vin_cnt; i++) {
+        btc_vin_t *vin = &(pTx->vin[i]);
+
+        //txid
+        if (!btc_tx_buf_r_read(&txbuf, vin->txid, BTC_SZ_TXID)) goto LABEL_EXIT;
+
+        //index
+        if (!btc_tx_buf_r_read_u32le(&txbuf, &vin->index)) goto LABEL_EXIT;
+
+        //scriptSig
+        if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
+        if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
+        if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
+        if (!utl_buf_alloccopy(&vin->script, btc_tx_buf_r_get_pos(&txbuf), (uint32_t)tmp_u64)) goto LABEL_EXIT;
+        if (!btc_tx_buf_r_seek(&txbuf, (uint32_t)tmp_u64)) goto LABEL_EXIT;
+
+        //sequence
+        if (!btc_tx_buf_r_read_u32le(&txbuf, &vin->sequence)) goto LABEL_EXIT;
+    }
+
+    //txout count
+    if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
+    if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
+    pTx->vout_cnt = (uint32_t)tmp_u64;
+    //XXX: if (pTx->vout_cnt == 0) goto LABEL_EXIT;
+
+    //XXX:
+    pTx->vout = (btc_vout_t *)UTL_DBG_MALLOC(sizeof(btc_vout_t) * pTx->vout_cnt);
+    if (!pTx->vout) goto LABEL_EXIT;
+    memset(pTx->vout, 0x00, sizeof(btc_vout_t) * pTx->vout_cnt);
+
+    //txout
+    for (i = 0; i < pTx->vout_cnt; i++) {
+        btc_vout_t *vout = &(pTx->vout[i]);
+
+        //value
+        if (!btc_tx_buf_r_read_u64le(&txbuf, &vout->value)) goto LABEL_EXIT;
+
+        //scriptPubKey
+        if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
+        if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
+        if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
+        if (!utl_buf_alloccopy(&vout->script, btc_tx_buf_r_get_pos(&txbuf), (uint32_t)tmp_u64)) goto LABEL_EXIT;
+        if (!btc_tx_buf_r_seek(&txbuf, (uint32_t)tmp_u64)) goto LABEL_EXIT;
+    }
+
+    //witness
+    if (segwit) {
+        for (i = 0; i < pTx->vin_cnt; i++) {
+            //witness item count
+            if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
+            if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
+            if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
+            pTx->vin[i].wit_item_cnt = (uint32_t)tmp_u64;
+
+            //XXX:
+            pTx->vin[i].witness = (utl_buf_t *)UTL_DBG_MALLOC(sizeof(utl_buf_t) * pTx->vin[i].wit_item_cnt);
+            if (!pTx->vin[i].witness) goto LABEL_EXIT;
+            memset(pTx->vin[i].witness, 0x00, sizeof(utl_buf_t) * pTx->vin[i].wit_item_cnt);
+
+            //witness item
+            for (uint32_t lp = 0; lp < pTx->vin[i].wit_item_cnt; lp++) {
+                if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) goto LABEL_EXIT;
+                if (tmp_u64 > UINT32_MAX) goto LABEL_EXIT;
+                if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) goto LABEL_EXIT;
+                if (!utl_buf_alloccopy(&pTx->vin[i].witness[lp], btc_tx_buf_r_get_pos(&txbuf), (uint32_t)tmp_u64)) goto LABEL_EXIT;
+                if (!btc_tx_buf_r_seek(&txbuf, (uint32_t)tmp_u64)) goto LABEL_EXIT;
+            }
+        }
+    }
+
+    //locktime
+    if (!btc_tx_buf_r_read_u32le(&txbuf, &pTx->locktime)) goto LABEL_EXIT;
+
+    *pReadLen = Len - btc_tx_buf_r_remains(&txbuf);
+    ret = true;
+
+LABEL_EXIT:
+    if (!ret) {
+        btc_tx_free(pTx);
+    }
+    return ret;
+}
+
+
 /**************************************************************************
  * private functions
  **************************************************************************/
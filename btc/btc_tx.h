@@ -539,6 +539,22 @@ void btc_tx_print_raw(const uint8_t *pData, uint32_t Len);
 bool HIDDEN btc_tx_write_2(utl_buf_t *pBuf, const btc_tx_t *pTx, bool enableSegWit);
 
 
+/** 先頭から1トランザクション分を読み込む
+ *
+ * #btc_tx_read()と異なり、トランザクションの後ろにデータが続いていてもよい(block内のtransaction読込み用)。
+ *
+ * @param[out]      pTx         変換後データ
+ * @param[in]       pData       トランザクションデータ
+ * @param[in]       Len         pData長
+ * @param[out]      pReadLen    読み込んだ長さ
+ * @return          変換結果
+ *
+ * @note
+ *      - 動的にメモリ確保するため、#btc_tx_free()を呼ぶこと
+ */
+bool HIDDEN btc_tx_read_2(btc_tx_t *pTx, const uint8_t *pData, uint32_t Len, uint32_t *pReadLen);
+
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
@@ -0,0 +1,275 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   btc_tx_view.c
+ *  @brief  読込み専用transaction view
+ *
+ *  #btc_tx_view_read()で範囲チェックを済ませるため、取得関数では範囲外を読まない。
+ */
+#include "mbedtls/sha256.h"
+
+#include "utl_dbg.h"
+#include "utl_int.h"
+
+#include "btc_local.h"
+#include "btc_crypto.h"
+#include "btc_tx_buf.h"
+#include "btc_tx_view.h"
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool skip_bytes(btc_buf_r_t *pBufR);
+static uint64_t read_varint(const uint8_t *pData, uint32_t *pPos);
+static void hash256_finish(mbedtls_sha256_context *pCtx, uint8_t *pHash256);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool btc_tx_view_read(btc_tx_view_t *pView, const uint8_t *pData, uint32_t Len)
+{
+    uint32_t read_len;
+
+    if (!btc_tx_view_read_2(pView, pData, Len, &read_len)) return false;
+
+    //check the end of the data
+    return read_len == Len;
+}
+
+
+bool btc_tx_view_read_2(btc_tx_view_t *pView, const uint8_t *pData, uint32_t Len, uint32_t *pReadLen)
+{
+    uint32_t tmp_u32;
+    uint64_t tmp_u64;
+
+    btc_buf_r_t txbuf;
+    btc_tx_buf_r_init(&txbuf, pData, Len);
+
+    //version
+    if (!btc_tx_buf_r_read_u32le(&txbuf, &tmp_u32)) return false;
+    pView->version = (int32_t)tmp_u32;
+
+    //mark, flag(#btc_tx_read_2()と同じ判定)
+    uint8_t mark;
+    uint8_t flag;
+    if (!btc_tx_buf_r_read_byte(&txbuf, &mark)) return false;
+    if (!btc_tx_buf_r_read_byte(&txbuf, &flag)) return false;
+    if (mark == 0x00 && flag == 0x01) { //2017/01/04:BIP-144
+        pView->segwit = true;
+    } else if (mark == 0x00) {
+        return false;
+    } else {
+        pView->segwit = false;
+        if (!btc_tx_buf_r_seek(&txbuf, -2)) return false; //rewind
+    }
+
+    //txin
+    pView->vin_cnt_pos = btc_tx_buf_r_get_pos(&txbuf) - pData;
+    if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) return false;
+    if (tmp_u64 > UINT32_MAX) return false;
+    pView->vin_cnt = (uint32_t)tmp_u64;
+    pView->vin_pos = btc_tx_buf_r_get_pos(&txbuf) - pData;
+    for (uint32_t lp = 0; lp < pView->vin_cnt; lp++) {
+        //txid, index
+        if (!btc_tx_buf_r_seek(&txbuf, BTC_SZ_TXID + sizeof(uint32_t))) return false;
+        //scriptSig
+        if (!skip_bytes(&txbuf)) return false;
+        //sequence
+        if (!btc_tx_buf_r_seek(&txbuf, sizeof(uint32_t))) return false;
+    }
+
+    //txout
+    if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) return false;
+    if (tmp_u64 > UINT32_MAX) return false;
+    pView->vout_cnt = (uint32_t)tmp_u64;
+    pView->vout_pos = btc_tx_buf_r_get_pos(&txbuf) - pData;
+    for (uint32_t lp = 0; lp < pView->vout_cnt; lp++) {
+        //value
+        if (!btc_tx_buf_r_seek(&txbuf, sizeof(uint64_t))) return false;
+        //scriptPubKey
+        if (!skip_bytes(&txbuf)) return false;
+    }
+
+    //witness
+    pView->wit_pos = btc_tx_buf_r_get_pos(&txbuf) - pData;
+    if (pView->segwit) {
+        for (uint32_t lp = 0; lp < pView->vin_cnt; lp++) {
+            if (!btc_tx_buf_r_read_varint(&txbuf, &tmp_u64)) return false;
+            if (tmp_u64 > btc_tx_buf_r_remains(&txbuf)) return false;
+            for (uint32_t lp2 = 0; lp2 < (uint32_t)tmp_u64; lp2++) {
+                if (!skip_bytes(&txbuf)) return false;
+            }
+        }
+    }
+
+    //locktime
+    if (!btc_tx_buf_r_read_u32le(&txbuf, &pView->locktime)) return false;
+
+    pView->p_data = pData;
+    pView->len = Len - btc_tx_buf_r_remains(&txbuf);
+    *pReadLen = pView->len;
+    return true;
+}
+
+
+void btc_tx_view_vin(const btc_tx_view_t *pView, btc_tx_view_vin_t *pVin, uint32_t *pPos)
+{
+    uint32_t pos = *pPos;
+
+    pVin->txid_pos = pos;
+    pos += BTC_SZ_TXID;
+    pVin->index = utl_int_pack_u32le(pView->p_data + pos);
+    pos += sizeof(uint32_t);
+    pVin->script_len = (uint32_t)read_varint(pView->p_data, &pos);
+    pVin->script_pos = pos;
+    pos += pVin->script_len;
+    pVin->sequence = utl_int_pack_u32le(pView->p_data + pos);
+    pos += sizeof(uint32_t);
+    *pPos = pos;
+}
+
+
+void btc_tx_view_vout(const btc_tx_view_t *pView, btc_tx_view_vout_t *pVout, uint32_t *pPos)
+{
+    uint32_t pos = *pPos;
+
+    pVout->value = utl_int_pack_u64le(pView->p_data + pos);
+    pos += sizeof(uint64_t);
+    pVout->script_len = (uint32_t)read_varint(pView->p_data, &pos);
+    pVout->script_pos = pos;
+    pos += pVout->script_len;
+    *pPos = pos;
+}
+
+
+void btc_tx_view_wit(const btc_tx_view_t *pView, btc_tx_view_wit_t *pWit, uint32_t *pPos)
+{
+    uint32_t pos = *pPos;
+
+    pWit->item_cnt = (uint32_t)read_varint(pView->p_data, &pos);
+    pWit->item_pos = pos;
+    for (uint32_t lp = 0; lp < pWit->item_cnt; lp++) {
+        uint32_t len = (uint32_t)read_varint(pView->p_data, &pos);
+        pos += len;
+    }
+    *pPos = pos;
+}
+
+
+void btc_tx_view_wit_item(const btc_tx_view_t *pView, uint32_t *pItemPos, uint32_t *pItemLen, uint32_t *pPos)
+{
+    uint32_t pos = *pPos;
+
+    *pItemLen = (uint32_t)read_varint(pView->p_data, &pos);
+    *pItemPos = pos;
+    *pPos = pos + *pItemLen;
+}
+
+
+void btc_tx_view_txid(const btc_tx_view_t *pView, uint8_t *pTxId)
+{
+    if (!pView->segwit) {
+        btc_tx_view_wtxid(pView, pTxId);
+        return;
+    }
+
+    //version + txin + txout + locktime
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, pView->p_data, sizeof(uint32_t));
+    mbedtls_sha256_update(&ctx, pView->p_data + pView->vin_cnt_pos, pView->wit_pos - pView->vin_cnt_pos);
+    mbedtls_sha256_update(&ctx, pView->p_data + pView->len - sizeof(uint32_t), sizeof(uint32_t));
+    hash256_finish(&ctx, pTxId);
+}
+
+
+void btc_tx_view_wtxid(const btc_tx_view_t *pView, uint8_t *pWTxId)
+{
+    //btc_md_hash256()は64KB未満までのため、ここで計算する
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, pView->p_data, pView->len);
+    hash256_finish(&ctx, pWTxId);
+}
+
+
+bool btc_tx_view_to_tx(btc_tx_t *pTx, const btc_tx_view_t *pView)
+{
+    return btc_tx_read(pTx, pView->p_data, pView->len);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** varint長 + データを読み飛ばす
+ *
+ */
+static bool skip_bytes(btc_buf_r_t *pBufR)
+{
+    uint64_t len;
+    if (!btc_tx_buf_r_read_varint(pBufR, &len)) return false;
+    if (len > btc_tx_buf_r_remains(pBufR)) return false;
+    return btc_tx_buf_r_seek(pBufR, (int32_t)len);
+}
+
+
+/** varint読込み(範囲チェック済みのデータ用)
+ *
+ */
+static uint64_t read_varint(const uint8_t *pData, uint32_t *pPos)
+{
+    const uint8_t *p = pData + *pPos;
+    uint64_t value;
+
+    if (*p < 0xfd) {
+        value = *p;
+        *pPos += 1;
+    } else if (*p == 0xfd) {
+        value = utl_int_pack_u16le(p + 1);
+        *pPos += 3;
+    } else if (*p == 0xfe) {
+        value = utl_int_pack_u32le(p + 1);
+        *pPos += 5;
+    } else {
+        value = utl_int_pack_u64le(p + 1);
+        *pPos += 9;
+    }
+    return value;
+}
+
+
+/** sha256(ctx)をもう一度sha256する
+ *
+ */
+static void hash256_finish(mbedtls_sha256_context *pCtx, uint8_t *pHash256)
+{
+    mbedtls_sha256_finish(pCtx, pHash256);
+    mbedtls_sha256_free(pCtx);
+    btc_md_sha256(pHash256, pHash256, BTC_SZ_HASH256);
+}
@@ -0,0 +1,210 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   btc_tx_view.h
+ *  @brief  読込み専用transaction view
+ *
+ *  raw transactionを#btc_tx_t に変換せず、呼び出し元のbuffer上で参照する。
+ *  #btc_tx_view_read()で全体の形式を確認し、各部の位置(buffer先頭からのoffset)を保持する。
+ *  vin/vout/witnessは位置を渡して先頭から順に取り出す。
+ *      - メモリ確保もコピーもしない。
+ *      - bufferは#btc_tx_view_t を使い終わるまで保持すること。
+ *
+ * @code
+ *  btc_tx_view_t view;
+ *  if (btc_tx_view_read(&view, p_data, len)) {
+ *      uint32_t pos = view.vout_pos;
+ *      btc_tx_view_vout_t vout;
+ *      for (uint32_t lp = 0; lp < view.vout_cnt; lp++) {
+ *          btc_tx_view_vout(&view, &vout, &pos);
+ *          //view.p_data + vout.script_pos, vout.script_len
+ *      }
+ *  }
+ * @endcode
+ */
+#ifndef BTC_TX_VIEW_H__
+#define BTC_TX_VIEW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc_tx.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct btc_tx_view_t
+ *  @brief  transaction view
+ */
+typedef struct {
+    const uint8_t   *p_data;        ///< transaction先頭(呼び出し元のbuffer)
+    uint32_t        len;            ///< transaction長
+    int32_t         version;
+    uint32_t        locktime;
+    bool            segwit;         ///< true: marker, flagあり
+    uint32_t        vin_cnt;
+    uint32_t        vout_cnt;
+    uint32_t        vin_cnt_pos;    ///< txin countのoffset
+    uint32_t        vin_pos;        ///< vin[0]のoffset
+    uint32_t        vout_pos;       ///< vout[0]のoffset
+    uint32_t        wit_pos;        ///< vin[0]のwitnessのoffset(segwitでなければlocktimeのoffset)
+} btc_tx_view_t;
+
+
+/** @struct btc_tx_view_vin_t
+ *  @brief  vin
+ */
+typedef struct {
+    uint32_t        txid_pos;       ///< outpoint txidのoffset
+    uint32_t        index;          ///< outpoint index
+    uint32_t        script_pos;     ///< scriptSigのoffset
+    uint32_t        script_len;     ///< scriptSig長
+    uint32_t        sequence;
+} btc_tx_view_vin_t;
+
+
+/** @struct btc_tx_view_vout_t
+ *  @brief  vout
+ */
+typedef struct {
+    uint64_t        value;
+    uint32_t        script_pos;     ///< scriptPubKeyのoffset
+    uint32_t        script_len;     ///< scriptPubKey長
+} btc_tx_view_vout_t;
+
+
+/** @struct btc_tx_view_wit_t
+ *  @brief  vin 1つ分のwitness
+ */
+typedef struct {
+    uint32_t        item_cnt;       ///< witness item数
+    uint32_t        item_pos;       ///< witness item[0]のoffset(長さのvarintから)
+} btc_tx_view_wit_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** raw transactionのview作成
+ *
+ * #btc_tx_read()と同じ形式チェックを行う。
+ *
+ * @param[out]      pView       view
+ * @param[in]       pData       トランザクションデータ(#btc_tx_view_t 使用中は保持すること)
+ * @param[in]       Len         pData長
+ * @retval  true    成功
+ */
+bool btc_tx_view_read(btc_tx_view_t *pView, const uint8_t *pData, uint32_t Len);
+
+
+/** 先頭から1トランザクション分のview作成
+ *
+ * #btc_tx_view_read()と異なり、トランザクションの後ろにデータが続いていてもよい(block内のtransaction読込み用)。
+ *
+ * @param[out]      pView       view
+ * @param[in]       pData       トランザクションデータ
+ * @param[in]       Len         pData長
+ * @param[out]      pReadLen    読み込んだ長さ
+ * @retval  true    成功
+ */
+bool btc_tx_view_read_2(btc_tx_view_t *pView, const uint8_t *pData, uint32_t Len, uint32_t *pReadLen);
+
+
+/** vin取得
+ *
+ * @param[in]       pView       view
+ * @param[out]      pVin        vin
+ * @param[in,out]   pPos        [in]vinのoffset(最初は#btc_tx_view_t.vin_pos)、[out]次のvinのoffset
+ */
+void btc_tx_view_vin(const btc_tx_view_t *pView, btc_tx_view_vin_t *pVin, uint32_t *pPos);
+
+
+/** vout取得
+ *
+ * @param[in]       pView       view
+ * @param[out]      pVout       vout
+ * @param[in,out]   pPos        [in]voutのoffset(最初は#btc_tx_view_t.vout_pos)、[out]次のvoutのoffset
+ */
+void btc_tx_view_vout(const btc_tx_view_t *pView, btc_tx_view_vout_t *pVout, uint32_t *pPos);
+
+
+/** witness取得(segwitのみ)
+ *
+ * @param[in]       pView       view
+ * @param[out]      pWit        vin 1つ分のwitness
+ * @param[in,out]   pPos        [in]witnessのoffset(最初は#btc_tx_view_t.wit_pos)、[out]次のvinのwitnessのoffset
+ */
+void btc_tx_view_wit(const btc_tx_view_t *pView, btc_tx_view_wit_t *pWit, uint32_t *pPos);
+
+
+/** witness item取得
+ *
+ * @param[in]       pView       view
+ * @param[out]      pItemPos    itemのoffset
+ * @param[out]      pItemLen    item長
+ * @param[in,out]   pPos        [in]itemのoffset(最初は#btc_tx_view_wit_t.item_pos)、[out]次のitemのoffset
+ */
+void btc_tx_view_wit_item(const btc_tx_view_t *pView, uint32_t *pItemPos, uint32_t *pItemLen, uint32_t *pPos);
+
+
+/** TXID計算
+ *
+ * segwitの場合はmarker, flag, witnessを除いて計算する。
+ *
+ * @param[in]       pView       view
+ * @param[out]      pTxId       TXID
+ */
+void btc_tx_view_txid(const btc_tx_view_t *pView, uint8_t *pTxId);
+
+
+/** WTXID計算
+ *
+ * segwitでなければTXIDと同じ。
+ *
+ * @param[in]       pView       view
+ * @param[out]      pWTxId      WTXID
+ */
+void btc_tx_view_wtxid(const btc_tx_view_t *pView, uint8_t *pWTxId);
+
+
+/** #btc_tx_t に変換
+ *
+ * @param[out]      pTx         変換後データ
+ * @param[in]       pView       view
+ * @retval  true    成功
+ * @note
+ *      - 動的にメモリ確保するため、#btc_tx_free()を呼ぶこと
+ */
+bool btc_tx_view_to_tx(btc_tx_t *pTx, const btc_tx_view_t *pView);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* BTC_TX_VIEW_H__ */
@@ -18,6 +18,7 @@ extern "C" {
 #include "../../utl/utl_str.c"
 #undef LOG_TAG
 #include "btc.c"
+#include "btc_block.c"
 #include "btc_buf.c"
 #include "btc_extkey.c"
 #include "btc_keys.c"
@@ -27,7 +28,9 @@ extern "C" {
 #include "btc_script_buf.c"
 #include "btc_tx.c"
 #include "btc_tx_buf.c"
+#include "btc_tx_view.c"
 #include "btc_crypto.c"
+#include "btc_chachapoly.c"
 #include "segwit_addr.c"
 #include "btc_segwit_addr.c"
 #include "btc_test_util.c"
@@ -120,4 +123,8 @@ TEST_F(btc, btc_setnet_mainnet)
 #include "testinc_segwit_addr.cpp"
 #include "testinc_script_buf.cpp"
 #include "testinc_tx_buf.cpp"
+#include "testinc_tx_view.cpp"
+#include "testinc_chachapoly.cpp"
 #include "testinc_sig.cpp"
+#include "testinc_ecc.cpp"
+#include "testinc_block.cpp"
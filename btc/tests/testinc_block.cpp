@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//FAKE_VALUE_FUNC(int, external_function, int);
+
+////////////////////////////////////////////////////////////////////////
+
+class block: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //RESET_FAKE(external_function)
+        utl_dbg_malloc_cnt_reset();
+        btc_init(BTC_BLOCK_CHAIN_BTCTEST, true);
+    }
+
+    virtual void TearDown() {
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+        btc_term();
+    }
+
+public:
+    typedef struct {
+        int         cnt;
+        int         stop;           //このindexでfalseを返す(-1:最後まで)
+        uint8_t     txids[4][BTC_SZ_TXID];
+    } read_param_t;
+
+    static bool ReadTxsCb(btc_tx_t *pTx, uint32_t Index, void *pParam)
+    {
+        read_param_t *p = (read_param_t *)pParam;
+        EXPECT_EQ(p->cnt, (int)Index);
+        btc_tx_txid(pTx, p->txids[p->cnt]);
+        p->cnt++;
+        return (int)Index != p->stop;
+    }
+
+    //raw block作成(block headerは0埋め)
+    static void CreateBlock(utl_buf_t *pBlock, utl_buf_t *pTxids, int Num)
+    {
+        btc_buf_w_t buf_w;
+        btc_buf_w_init(&buf_w, 0);
+        btc_buf_w_write_zeros(&buf_w, BTC_SZ_BLOCK_HEADER);
+        btc_tx_buf_w_write_varint_len(&buf_w, Num);
+        utl_buf_alloc(pTxids, BTC_SZ_TXID * Num);
+        for (int lp = 0; lp < Num; lp++) {
+            btc_tx_t tx = BTC_TX_INIT;
+            uint8_t txid[BTC_SZ_TXID];
+            memset(txid, lp + 1, sizeof(txid));
+            btc_vin_t *vin = btc_tx_add_vin(&tx, txid, lp);
+            if (lp & 1) {
+                //segwit
+                utl_buf_t *p_wit = btc_tx_add_wit(vin);
+                utl_buf_alloccopy(p_wit, txid, 10);
+            } else {
+                utl_buf_alloccopy(&vin->script, txid, 5);
+            }
+            btc_vout_t *vout = btc_tx_add_vout(&tx, 1000 * (lp + 1));
+            utl_buf_alloccopy(&vout->script, txid, 22);
+
+            utl_buf_t buf = UTL_BUF_INIT;
+            btc_tx_write(&tx, &buf);
+            btc_buf_w_write_data(&buf_w, buf.buf, buf.len);
+            btc_tx_txid(&tx, pTxids->buf + BTC_SZ_TXID * lp);
+            utl_buf_free(&buf);
+            btc_tx_free(&tx);
+        }
+        btc_buf_w_move(&buf_w, pBlock);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(block, read_txs)
+{
+    utl_buf_t blk = UTL_BUF_INIT;
+    utl_buf_t txids = UTL_BUF_INIT;
+    CreateBlock(&blk, &txids, 4);
+
+    read_param_t param;
+    param.cnt = 0;
+    param.stop = -1;
+    ASSERT_TRUE(btc_block_read_txs(blk.buf, blk.len, ReadTxsCb, &param));
+    ASSERT_EQ(4, param.cnt);
+    ASSERT_EQ(0, memcmp(txids.buf, param.txids, BTC_SZ_TXID * 4));
+
+    utl_buf_free(&txids);
+    utl_buf_free(&blk);
+}
+
+
+TEST_F(block, read_txs_stop)
+{
+    utl_buf_t blk = UTL_BUF_INIT;
+    utl_buf_t txids = UTL_BUF_INIT;
+    CreateBlock(&blk, &txids, 4);
+
+    read_param_t param;
+    param.cnt = 0;
+    param.stop = 1;
+    ASSERT_TRUE(btc_block_read_txs(blk.buf, blk.len, ReadTxsCb, &param));
+    ASSERT_EQ(2, param.cnt);
+
+    utl_buf_free(&txids);
+    utl_buf_free(&blk);
+}
+
+
+TEST_F(block, read_txs_take)
+{
+    //callbackでtransactionを引き取る
+    struct take_t {
+        static bool cb(btc_tx_t *pTx, uint32_t Index, void *pParam) {
+            if (Index == 2) {
+                memcpy(pParam, pTx, sizeof(btc_tx_t));
+                btc_tx_init(pTx);
+                return false;
+            }
+            return true;
+        }
+    };
+    utl_buf_t blk = UTL_BUF_INIT;
+    utl_buf_t txids = UTL_BUF_INIT;
+    CreateBlock(&blk, &txids, 4);
+
+    btc_tx_t tx = BTC_TX_INIT;
+    ASSERT_TRUE(btc_block_read_txs(blk.buf, blk.len, take_t::cb, &tx));
+    ASSERT_EQ(1, tx.vin_cnt);
+    ASSERT_EQ(2, tx.vin[0].index);
+    ASSERT_EQ(3000, tx.vout[0].value);
+    btc_tx_free(&tx);
+
+    utl_buf_free(&txids);
+    utl_buf_free(&blk);
+}
+
+
+TEST_F(block, read_txs_invalid)
+{
+    utl_buf_t blk = UTL_BUF_INIT;
+    utl_buf_t txids = UTL_BUF_INIT;
+    CreateBlock(&blk, &txids, 3);
+
+    read_param_t param;
+
+    //header only
+    param.cnt = 0;
+    param.stop = -1;
+    ASSERT_FALSE(btc_block_read_txs(blk.buf, BTC_SZ_BLOCK_HEADER - 1, ReadTxsCb, &param));
+    ASSERT_EQ(0, param.cnt);
+
+    //truncated
+    param.cnt = 0;
+    ASSERT_FALSE(btc_block_read_txs(blk.buf, blk.len - 1, ReadTxsCb, &param));
+    ASSERT_EQ(2, param.cnt);
+
+    //trailing data
+    utl_buf_t blk2 = UTL_BUF_INIT;
+    utl_buf_alloc(&blk2, blk.len + 1);
+    memcpy(blk2.buf, blk.buf, blk.len);
+    param.cnt = 0;
+    ASSERT_FALSE(btc_block_read_txs(blk2.buf, blk2.len, ReadTxsCb, &param));
+    ASSERT_EQ(3, param.cnt);
+    utl_buf_free(&blk2);
+
+    utl_buf_free(&txids);
+    utl_buf_free(&blk);
+}
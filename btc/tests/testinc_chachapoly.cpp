@@ -0,0 +1,222 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//FAKE_VALUE_FUNC(int, external_function, int);
+
+////////////////////////////////////////////////////////////////////////
+
+class chachapoly: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //RESET_FAKE(external_function)
+        utl_dbg_malloc_cnt_reset();
+        mBackendOrg = btc_chachapoly_backend();
+    }
+
+    virtual void TearDown() {
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+        btc_chachapoly_backend_set(mBackendOrg);
+    }
+
+public:
+    btc_chachapoly_backend_t mBackendOrg;
+
+    //RFC 8439 2.4.2, 2.8.2
+    static const uint8_t *Plaintext(uint32_t *pLen)
+    {
+        static const char PT[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+        *pLen = sizeof(PT) - 1;
+        return (const uint8_t *)PT;
+    }
+
+    static void RandomFill(uint8_t *pData, uint32_t Len, uint32_t *pSeed)
+    {
+        for (uint32_t lp = 0; lp < Len; lp++) {
+            *pSeed = *pSeed * 1103515245 + 12345;
+            pData[lp] = (uint8_t)(*pSeed >> 16);
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(chachapoly, portable_supported)
+{
+    ASSERT_TRUE(btc_chachapoly_backend_supported(BTC_CHACHAPOLY_PORTABLE));
+    ASSERT_TRUE(btc_chachapoly_backend_set(BTC_CHACHAPOLY_PORTABLE));
+    ASSERT_EQ(BTC_CHACHAPOLY_PORTABLE, btc_chachapoly_backend());
+    ASSERT_STREQ("portable", btc_chachapoly_backend_str(BTC_CHACHAPOLY_PORTABLE));
+    ASSERT_FALSE(btc_chachapoly_backend_set(BTC_CHACHAPOLY_BACKEND_NUM));
+}
+
+
+//RFC 8439 2.4.2
+TEST_F(chachapoly, chacha20_rfc8439)
+{
+    const uint8_t NONCE[] = {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00,
+    };
+    const uint8_t CT[] = {
+        0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+        0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+        0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+        0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+        0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+        0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+        0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+        0x87, 0x4d,
+    };
+    uint8_t key[BTC_SZ_CHACHA20_KEY];
+    uint32_t len;
+    const uint8_t *p_pt = Plaintext(&len);
+    uint8_t out[sizeof(CT)];
+
+    ASSERT_EQ(sizeof(CT), len);
+    for (int lp = 0; lp < BTC_SZ_CHACHA20_KEY; lp++) {
+        key[lp] = (uint8_t)lp;
+    }
+    for (int backend = 0; backend < BTC_CHACHAPOLY_BACKEND_NUM; backend++) {
+        if (!btc_chachapoly_backend_set((btc_chachapoly_backend_t)backend)) {
+            continue;
+        }
+        btc_chacha20_crypt(out, p_pt, len, key, NONCE, 1);
+        ASSERT_EQ(0, memcmp(CT, out, sizeof(CT)));
+
+        //in-place
+        btc_chacha20_crypt(out, out, len, key, NONCE, 1);
+        ASSERT_EQ(0, memcmp(p_pt, out, len));
+    }
+}
+
+
+//RFC 8439 2.8.2
+TEST_F(chachapoly, aead_rfc8439)
+{
+    const uint8_t NONCE[] = {
+        0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+    };
+    const uint8_t AAD[] = {
+        0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    };
+    const uint8_t CT[] = {
+        0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+        0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+        0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+        0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+        0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+        0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+        0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+        0x61, 0x16,
+    };
+    const uint8_t TAG[] = {
+        0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91,
+    };
+    uint8_t key[BTC_SZ_CHACHA20_KEY];
+    uint32_t len;
+    const uint8_t *p_pt = Plaintext(&len);
+    uint8_t out[sizeof(CT)];
+    uint8_t tag[BTC_SZ_POLY1305_TAG];
+    btc_chachapoly_t ctx;
+
+    for (int lp = 0; lp < BTC_SZ_CHACHA20_KEY; lp++) {
+        key[lp] = (uint8_t)(0x80 + lp);
+    }
+    btc_chachapoly_setkey(&ctx, key);
+    for (int backend = 0; backend < BTC_CHACHAPOLY_BACKEND_NUM; backend++) {
+        if (!btc_chachapoly_backend_set((btc_chachapoly_backend_t)backend)) {
+            continue;
+        }
+        btc_chachapoly_encrypt(&ctx, NONCE, AAD, sizeof(AAD), p_pt, len, out, tag);
+        ASSERT_EQ(0, memcmp(CT, out, sizeof(CT)));
+        ASSERT_EQ(0, memcmp(TAG, tag, sizeof(TAG)));
+
+        ASSERT_TRUE(btc_chachapoly_decrypt(&ctx, NONCE, AAD, sizeof(AAD), out, len, out, tag));
+        ASSERT_EQ(0, memcmp(p_pt, out, len));
+    }
+}
+
+
+TEST_F(chachapoly, aead_tag_mismatch)
+{
+    const uint8_t NONCE[BTC_SZ_CHACHA20_NONCE] = { 0 };
+    uint8_t key[BTC_SZ_CHACHA20_KEY];
+    uint8_t data[100];
+    uint8_t enc[sizeof(data)];
+    uint8_t dec[sizeof(data)];
+    uint8_t tag[BTC_SZ_POLY1305_TAG];
+    uint32_t seed = 1;
+    btc_chachapoly_t ctx;
+
+    RandomFill(key, sizeof(key), &seed);
+    RandomFill(data, sizeof(data), &seed);
+    btc_chachapoly_setkey(&ctx, key);
+    btc_chachapoly_encrypt(&ctx, NONCE, NULL, 0, data, sizeof(data), enc, tag);
+
+    //tag不一致なら出力しない
+    memset(dec, 0xcc, sizeof(dec));
+    tag[BTC_SZ_POLY1305_TAG - 1] ^= 0x01;
+    ASSERT_FALSE(btc_chachapoly_decrypt(&ctx, NONCE, NULL, 0, enc, sizeof(enc), dec, tag));
+    for (size_t lp = 0; lp < sizeof(dec); lp++) {
+        ASSERT_EQ(0xcc, dec[lp]);
+    }
+    tag[BTC_SZ_POLY1305_TAG - 1] ^= 0x01;
+
+    enc[50] ^= 0x80;
+    ASSERT_FALSE(btc_chachapoly_decrypt(&ctx, NONCE, NULL, 0, enc, sizeof(enc), dec, tag));
+    enc[50] ^= 0x80;
+
+    ASSERT_TRUE(btc_chachapoly_decrypt(&ctx, NONCE, NULL, 0, enc, sizeof(enc), dec, tag));
+    ASSERT_EQ(0, memcmp(data, dec, sizeof(data)));
+}
+
+
+//SIMD版の並列数や端数の境界をまたぐ長さで、portable版と一致すること
+TEST_F(chachapoly, backend_match)
+{
+    const uint32_t LENS[] = {
+        0, 1, 15, 16, 17, 63, 64, 65, 127, 128, 129, 191, 192, 255, 256, 257,
+        511, 512, 513, 1000, 1023, 1024, 1025, 1535, 1536, 1600, 2047, 2048, 4095, 4096,
+        65535, 65535 + 16,
+    };
+    const uint32_t MAXLEN = 65535 + 16;
+    uint8_t key[BTC_SZ_CHACHA20_KEY];
+    uint8_t nonce[BTC_SZ_CHACHA20_NONCE];
+    uint8_t aad[33];
+    uint8_t *p_data = (uint8_t *)malloc(MAXLEN);
+    uint8_t *p_ref = (uint8_t *)malloc(MAXLEN);
+    uint8_t *p_out = (uint8_t *)malloc(MAXLEN);
+    uint8_t tag_ref[BTC_SZ_POLY1305_TAG];
+    uint8_t tag[BTC_SZ_POLY1305_TAG];
+    uint32_t seed = 12345;
+    btc_chachapoly_t ctx;
+
+    for (size_t idx = 0; idx < ARRAY_SIZE(LENS); idx++) {
+        uint32_t len = LENS[idx];
+        uint32_t aadlen = (uint32_t)(idx % sizeof(aad));
+        RandomFill(key, sizeof(key), &seed);
+        RandomFill(nonce, sizeof(nonce), &seed);
+        RandomFill(aad, sizeof(aad), &seed);
+        RandomFill(p_data, len, &seed);
+        btc_chachapoly_setkey(&ctx, key);
+
+        ASSERT_TRUE(btc_chachapoly_backend_set(BTC_CHACHAPOLY_PORTABLE));
+        btc_chachapoly_encrypt(&ctx, nonce, aad, aadlen, p_data, len, p_ref, tag_ref);
+
+        for (int backend = BTC_CHACHAPOLY_PORTABLE + 1; backend < BTC_CHACHAPOLY_BACKEND_NUM; backend++) {
+            if (!btc_chachapoly_backend_set((btc_chachapoly_backend_t)backend)) {
+                continue;
+            }
+            btc_chachapoly_encrypt(&ctx, nonce, aad, aadlen, p_data, len, p_out, tag);
+            ASSERT_EQ(0, memcmp(p_ref, p_out, len)) << "backend=" << backend << " len=" << len;
+            ASSERT_EQ(0, memcmp(tag_ref, tag, sizeof(tag))) << "backend=" << backend << " len=" << len;
+
+            //in-place復号
+            ASSERT_TRUE(btc_chachapoly_decrypt(&ctx, nonce, aad, aadlen, p_out, len, p_out, tag));
+            ASSERT_EQ(0, memcmp(p_data, p_out, len));
+        }
+    }
+
+    free(p_data);
+    free(p_ref);
+    free(p_out);
+}
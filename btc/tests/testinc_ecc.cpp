@@ -0,0 +1,303 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//FAKE_VALUE_FUNC(int, external_function, int);
+
+////////////////////////////////////////////////////////////////////////
+
+#include <pthread.h>
+#include <time.h>
+
+
+class ecc: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //RESET_FAKE(external_function)
+        utl_dbg_malloc_cnt_reset();
+        btc_init(BTC_BLOCK_CHAIN_BTCTEST, false);
+    }
+
+    virtual void TearDown() {
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+        btc_term();
+    }
+
+public:
+    static void DumpBin(const uint8_t *pData, uint16_t Len)
+    {
+        for (uint16_t lp = 0; lp < Len; lp++) {
+            printf("%02x", pData[lp]);
+        }
+        printf("\n");
+    }
+
+    static double NowUsec(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+    }
+
+    //////////////////////////////////////////////////
+    // 共有group導入前の実装(呼び出し毎にgroupを読み込む)
+
+    static bool OldSignRs(uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPrivKey)
+    {
+        mbedtls_ecp_keypair keypair;
+        mbedtls_mpi r, s, half_n;
+        mbedtls_ecp_keypair_init(&keypair);
+        mbedtls_mpi_init(&r);
+        mbedtls_mpi_init(&s);
+        mbedtls_mpi_init(&half_n);
+        mbedtls_ecp_group_load(&keypair.grp, MBEDTLS_ECP_DP_SECP256K1);
+        mbedtls_mpi_read_binary(&keypair.d, pPrivKey, BTC_SZ_PRIVKEY);
+        int ret = mbedtls_ecdsa_sign_det(&keypair.grp, &r, &s, &keypair.d, pHash, BTC_SZ_HASH256, MBEDTLS_MD_SHA256);
+        if (ret == 0) {
+            mbedtls_mpi_copy(&half_n, &keypair.grp.N);
+            mbedtls_mpi_shift_r(&half_n, 1);
+            if (mbedtls_mpi_cmp_mpi(&s, &half_n) == 1) {
+                mbedtls_mpi_sub_mpi(&s, &keypair.grp.N, &s);
+            }
+            mbedtls_mpi_write_binary(&r, pRS, 32);
+            mbedtls_mpi_write_binary(&s, pRS + 32, 32);
+        }
+        mbedtls_mpi_free(&half_n);
+        mbedtls_mpi_free(&s);
+        mbedtls_mpi_free(&r);
+        mbedtls_ecp_keypair_free(&keypair);
+        return ret == 0;
+    }
+
+    static bool OldDecompress(mbedtls_ecp_point *pPoint, const uint8_t *pPubKey)
+    {
+        mbedtls_ecp_group grp;
+        mbedtls_mpi e, y2;
+        mbedtls_ecp_group_init(&grp);
+        mbedtls_mpi_init(&e);
+        mbedtls_mpi_init(&y2);
+        mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256K1);
+        mbedtls_mpi_read_binary(&pPoint->X, pPubKey + 1, BTC_SZ_PUBKEY - 1);
+        mbedtls_mpi_lset(&pPoint->Z, 1);
+        mbedtls_mpi_mul_mpi(&y2, &pPoint->X, &pPoint->X);
+        grp.modp(&y2);
+        mbedtls_mpi_mul_mpi(&y2, &y2, &pPoint->X);
+        mbedtls_mpi_add_mpi(&y2, &y2, &grp.B);
+        grp.modp(&y2);
+        mbedtls_mpi_add_int(&e, &grp.P, 1);
+        mbedtls_mpi_shift_r(&e, 2);
+        int ret = mbedtls_mpi_exp_mod(&pPoint->Y, &y2, &e, &grp.P, NULL);
+        if ((ret == 0) && (mbedtls_mpi_get_bit(&pPoint->Y, 0) != (pPubKey[0] & 1))) {
+            ret = mbedtls_mpi_sub_mpi(&pPoint->Y, &grp.P, &pPoint->Y);
+        }
+        mbedtls_mpi_free(&y2);
+        mbedtls_mpi_free(&e);
+        mbedtls_ecp_group_free(&grp);
+        return ret == 0;
+    }
+
+    static bool OldVerifyRs(const uint8_t *pRS, const uint8_t *pHash, const uint8_t *pPubKey)
+    {
+        mbedtls_ecp_keypair keypair;
+        mbedtls_mpi r, s;
+        mbedtls_ecp_keypair_init(&keypair);
+        mbedtls_mpi_init(&r);
+        mbedtls_mpi_init(&s);
+        mbedtls_ecp_group_load(&keypair.grp, MBEDTLS_ECP_DP_SECP256K1);
+        mbedtls_mpi_read_binary(&r, pRS, 32);
+        mbedtls_mpi_read_binary(&s, pRS + 32, 32);
+        int ret = OldDecompress(&keypair.Q, pPubKey) ? 0 : -1;
+        if (ret == 0) {
+            ret = mbedtls_ecdsa_verify(&keypair.grp, pHash, BTC_SZ_HASH256, &keypair.Q, &r, &s);
+        }
+        mbedtls_mpi_free(&s);
+        mbedtls_mpi_free(&r);
+        mbedtls_ecp_keypair_free(&keypair);
+        return ret == 0;
+    }
+
+    static bool OldMulPubkey(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pMul)
+    {
+        mbedtls_ecp_keypair keypair;
+        mbedtls_ecp_point pnt;
+        mbedtls_mpi m;
+        size_t sz;
+        mbedtls_ecp_keypair_init(&keypair);
+        mbedtls_ecp_point_init(&pnt);
+        mbedtls_mpi_init(&m);
+        mbedtls_ecp_group_load(&keypair.grp, MBEDTLS_ECP_DP_SECP256K1);
+        int ret = OldDecompress(&keypair.Q, pPubKey) ? 0 : -1;
+        if (ret == 0) {
+            mbedtls_mpi_read_binary(&m, pMul, BTC_SZ_PRIVKEY);
+            ret = mbedtls_ecp_mul(&keypair.grp, &pnt, &m, &keypair.Q, NULL, NULL);
+        }
+        if (ret == 0) {
+            ret = mbedtls_ecp_point_write_binary(&keypair.grp, &pnt, MBEDTLS_ECP_PF_COMPRESSED, &sz, pResult, BTC_SZ_PUBKEY);
+        }
+        mbedtls_mpi_free(&m);
+        mbedtls_ecp_point_free(&pnt);
+        mbedtls_ecp_keypair_free(&keypair);
+        return ret == 0;
+    }
+
+    //////////////////////////////////////////////////
+
+    static void CreateKey(uint8_t *pPrivKey, uint8_t *pPubKey)
+    {
+        do {
+            btc_rng_rand(pPrivKey, BTC_SZ_PRIVKEY);
+        } while (!btc_keys_check_priv(pPrivKey));
+        ASSERT_TRUE(btc_keys_priv2pub(pPubKey, pPrivKey));
+    }
+
+    static void *SignVerifyThread(void *pArg)
+    {
+        int *p_fail = (int *)pArg;
+        uint8_t priv[BTC_SZ_PRIVKEY];
+        uint8_t pub[BTC_SZ_PUBKEY];
+        uint8_t hash[BTC_SZ_HASH256];
+        uint8_t rs[BTC_SZ_SIGN_RS];
+
+        for (int lp = 0; lp < 50; lp++) {
+            CreateKey(priv, pub);
+            btc_rng_rand(hash, sizeof(hash));
+            if (!btc_sig_sign_rs(rs, hash, priv) || !btc_sig_verify_rs(rs, hash, pub)) {
+                (*p_fail)++;
+            }
+            hash[0] ^= 0x01;
+            if (btc_sig_verify_rs(rs, hash, pub)) {
+                (*p_fail)++;
+            }
+        }
+        return NULL;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+
+TEST_F(ecc, group)
+{
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
+    ASSERT_TRUE(p_grp != NULL);
+    ASSERT_EQ(p_grp, btc_ecc_group());
+    ASSERT_EQ(MBEDTLS_ECP_DP_SECP256K1, p_grp->id);
+
+    //G乗算用tableは作成済み
+    ASSERT_TRUE(p_grp->T != NULL);
+    ASSERT_NE(0, p_grp->T_size);
+}
+
+
+TEST_F(ecc, same_as_group_load)
+{
+    for (int lp = 0; lp < 20; lp++) {
+        uint8_t priv[BTC_SZ_PRIVKEY];
+        uint8_t pub[BTC_SZ_PUBKEY];
+        uint8_t priv2[BTC_SZ_PRIVKEY];
+        uint8_t pub2[BTC_SZ_PUBKEY];
+        uint8_t hash[BTC_SZ_HASH256];
+        CreateKey(priv, pub);
+        CreateKey(priv2, pub2);
+        btc_rng_rand(hash, sizeof(hash));
+
+        //sign
+        uint8_t rs[BTC_SZ_SIGN_RS];
+        uint8_t rs_old[BTC_SZ_SIGN_RS];
+        ASSERT_TRUE(btc_sig_sign_rs(rs, hash, priv));
+        ASSERT_TRUE(OldSignRs(rs_old, hash, priv));
+        ASSERT_EQ(0, memcmp(rs, rs_old, sizeof(rs)));
+
+        //verify
+        ASSERT_TRUE(btc_sig_verify_rs(rs, hash, pub));
+        ASSERT_TRUE(OldVerifyRs(rs, hash, pub));
+        ASSERT_FALSE(btc_sig_verify_rs(rs, hash, pub2));
+
+        //verify(DER)
+        utl_buf_t sig = UTL_BUF_INIT;
+        ASSERT_TRUE(btc_sig_sign(&sig, hash, priv));
+        ASSERT_TRUE(btc_sig_verify(&sig, hash, pub));
+        ASSERT_FALSE(btc_sig_verify(&sig, hash, pub2));
+        utl_buf_free(&sig);
+
+        //ECDH
+        uint8_t ecdh[BTC_SZ_PUBKEY];
+        uint8_t ecdh_old[BTC_SZ_PUBKEY];
+        uint8_t ecdh2[BTC_SZ_PUBKEY];
+        ASSERT_TRUE(btc_ecc_mul_pubkey(ecdh, pub2, priv, BTC_SZ_PRIVKEY));
+        ASSERT_TRUE(OldMulPubkey(ecdh_old, pub2, priv));
+        ASSERT_TRUE(btc_ecc_mul_pubkey(ecdh2, pub, priv2, BTC_SZ_PRIVKEY));
+        ASSERT_EQ(0, memcmp(ecdh, ecdh_old, sizeof(ecdh)));
+        ASSERT_EQ(0, memcmp(ecdh, ecdh2, sizeof(ecdh)));
+
+        //decompress
+        uint8_t uncomp[(BTC_SZ_PUBKEY - 1) * 2];
+        uint8_t uncomp_old[(BTC_SZ_PUBKEY - 1) * 2];
+        mbedtls_ecp_point pnt;
+        mbedtls_ecp_point_init(&pnt);
+        ASSERT_TRUE(btc_keys_uncomp_pub(uncomp, pub));
+        ASSERT_TRUE(OldDecompress(&pnt, pub));
+        mbedtls_mpi_write_binary(&pnt.X, uncomp_old, BTC_SZ_PUBKEY - 1);
+        mbedtls_mpi_write_binary(&pnt.Y, uncomp_old + BTC_SZ_PUBKEY - 1, BTC_SZ_PUBKEY - 1);
+        mbedtls_ecp_point_free(&pnt);
+        ASSERT_EQ(0, memcmp(uncomp, uncomp_old, sizeof(uncomp)));
+    }
+}
+
+
+TEST_F(ecc, threads)
+{
+    const int THREADS = 4;
+    pthread_t th[THREADS];
+    int fail[THREADS] = { 0 };
+
+    for (int lp = 0; lp < THREADS; lp++) {
+        ASSERT_EQ(0, pthread_create(&th[lp], NULL, SignVerifyThread, &fail[lp]));
+    }
+    for (int lp = 0; lp < THREADS; lp++) {
+        pthread_join(th[lp], NULL);
+        ASSERT_EQ(0, fail[lp]);
+    }
+}
+
+
+//  ./tests --gtest_also_run_disabled_tests --gtest_filter=ecc.DISABLED_bench
+TEST_F(ecc, DISABLED_bench)
+{
+    const int LOOP = 1000;
+    uint8_t priv[BTC_SZ_PRIVKEY];
+    uint8_t pub[BTC_SZ_PUBKEY];
+    uint8_t priv2[BTC_SZ_PRIVKEY];
+    uint8_t pub2[BTC_SZ_PUBKEY];
+    uint8_t hash[BTC_SZ_HASH256];
+    uint8_t rs[BTC_SZ_SIGN_RS];
+    uint8_t result[BTC_SZ_PUBKEY];
+    mbedtls_ecp_point pnt;
+    double start;
+    double t_old;
+    double t_new;
+
+    CreateKey(priv, pub);
+    CreateKey(priv2, pub2);
+    btc_rng_rand(hash, sizeof(hash));
+    btc_sig_sign_rs(rs, hash, priv);
+    mbedtls_ecp_point_init(&pnt);
+
+    printf("                ops/sec(before)   ops/sec(after)\n");
+
+#define M_BENCH(name, old_op, new_op) \
+    start = NowUsec(); \
+    for (int lp = 0; lp < LOOP; lp++) { old_op; } \
+    t_old = NowUsec() - start; \
+    start = NowUsec(); \
+    for (int lp = 0; lp < LOOP; lp++) { new_op; } \
+    t_new = NowUsec() - start; \
+    printf("  %-12s %16.0f %16.0f\n", name, LOOP * 1000000.0 / t_old, LOOP * 1000000.0 / t_new);
+
+    M_BENCH("sign", OldSignRs(rs, hash, priv), btc_sig_sign_rs(rs, hash, priv));
+    M_BENCH("verify", OldVerifyRs(rs, hash, pub), btc_sig_verify_rs(rs, hash, pub));
+    M_BENCH("ecdh", OldMulPubkey(result, pub2, priv), btc_ecc_mul_pubkey(result, pub2, priv, BTC_SZ_PRIVKEY));
+    M_BENCH("decompress", OldDecompress(&pnt, pub), btc_ecc_ecp_read_binary_pubkey(&pnt, pub));
+#undef M_BENCH
+
+    mbedtls_ecp_point_free(&pnt);
+}
@@ -26,6 +26,46 @@ public:
         }
         printf("\n");
     }
+
+    //事前計算値導入前の#btc_sw_sighash()(INPUT毎にhashPrevouts等を計算する)
+    static bool OldSighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode)
+    {
+        btc_buf_w_t buf_w;
+        btc_buf_w_t buf_w_tmp;
+        btc_buf_w_init(&buf_w, 0);
+        btc_buf_w_init(&buf_w_tmp, 0);
+
+        btc_buf_w_write_u32le(&buf_w, pTx->version);
+        for (uint32_t lp = 0; lp < pTx->vin_cnt; lp++) {
+            btc_buf_w_write_data(&buf_w_tmp, pTx->vin[lp].txid, BTC_SZ_TXID);
+            btc_buf_w_write_u32le(&buf_w_tmp, pTx->vin[lp].index);
+        }
+        btc_buf_w_write_hash256(&buf_w, btc_buf_w_get_data(&buf_w_tmp), btc_buf_w_get_len(&buf_w_tmp));
+        btc_buf_w_truncate(&buf_w_tmp);
+        for (uint32_t lp = 0; lp < pTx->vin_cnt; lp++) {
+            btc_buf_w_write_u32le(&buf_w_tmp, pTx->vin[lp].sequence);
+        }
+        btc_buf_w_write_hash256(&buf_w, btc_buf_w_get_data(&buf_w_tmp), btc_buf_w_get_len(&buf_w_tmp));
+        btc_buf_w_write_data(&buf_w, pTx->vin[Index].txid, BTC_SZ_TXID);
+        btc_buf_w_write_u32le(&buf_w, pTx->vin[Index].index);
+        btc_buf_w_write_data(&buf_w, pScriptCode->buf, pScriptCode->len);
+        btc_buf_w_write_u64le(&buf_w, Value);
+        btc_buf_w_write_u32le(&buf_w, pTx->vin[Index].sequence);
+        btc_buf_w_truncate(&buf_w_tmp);
+        for (uint32_t lp = 0; lp < pTx->vout_cnt; lp++) {
+            btc_buf_w_write_u64le(&buf_w_tmp, pTx->vout[lp].value);
+            btc_tx_buf_w_write_varint_len(&buf_w_tmp, pTx->vout[lp].script.len);
+            btc_buf_w_write_data(&buf_w_tmp, pTx->vout[lp].script.buf, pTx->vout[lp].script.len);
+        }
+        btc_buf_w_write_hash256(&buf_w, btc_buf_w_get_data(&buf_w_tmp), btc_buf_w_get_len(&buf_w_tmp));
+        btc_buf_w_write_u32le(&buf_w, pTx->locktime);
+        btc_buf_w_write_u32le(&buf_w, SIGHASH_ALL);
+        btc_md_hash256(pTxHash, btc_buf_w_get_data(&buf_w), btc_buf_w_get_len(&buf_w));
+
+        btc_buf_w_free(&buf_w);
+        btc_buf_w_free(&buf_w_tmp);
+        return true;
+    }
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -501,6 +541,74 @@ TEST_F(sw, sighash_p2wsh)
 }
 
 
+TEST_F(sw, sighash_ctx)
+{
+    const uint32_t INPUTS = 50;
+    btc_tx_t tx = BTC_TX_INIT;
+
+    tx.locktime = 500000;
+    for (uint32_t lp = 0; lp < INPUTS; lp++) {
+        uint8_t txid[BTC_SZ_TXID];
+        btc_rng_rand(txid, sizeof(txid));
+        btc_vin_t *vin = btc_tx_add_vin(&tx, txid, lp);
+        ASSERT_TRUE(vin != NULL);
+        vin->sequence = 0xfffffff0 + (lp % 16);
+    }
+    for (uint32_t lp = 0; lp < 3; lp++) {
+        uint8_t pkh[BTC_SZ_HASH160];
+        btc_rng_rand(pkh, sizeof(pkh));
+        ASSERT_TRUE(btc_sw_add_vout_p2wpkh(&tx, 10000 * (lp + 1), pkh));
+    }
+
+    //witnessScript: 短い(stack, varint 1byte)/長い(heap, varint 3byte)
+    utl_buf_t wit_short = UTL_BUF_INIT;
+    utl_buf_t wit_long = UTL_BUF_INIT;
+    utl_buf_alloc(&wit_short, 71);
+    utl_buf_alloc(&wit_long, 600);
+    btc_rng_rand(wit_short.buf, wit_short.len);
+    btc_rng_rand(wit_long.buf, wit_long.len);
+    const utl_buf_t *WIT[] = { &wit_short, &wit_long };
+
+    btc_sw_sighash_ctx_t ctx;
+    ASSERT_TRUE(btc_sw_sighash_ctx_init(&ctx, &tx));
+    for (uint32_t idx = 0; idx < INPUTS; idx++) {
+        for (size_t w = 0; w < ARRAY_SIZE(WIT); w++) {
+            uint64_t value = 100000 + idx;
+            uint8_t hash_old[BTC_SZ_HASH256];
+            uint8_t hash[BTC_SZ_HASH256];
+            utl_buf_t script_code = UTL_BUF_INIT;
+            ASSERT_TRUE(btc_script_p2wsh_create_scriptcode(&script_code, WIT[w]));
+            ASSERT_TRUE(OldSighash(&tx, hash_old, idx, value, &script_code));
+
+            ASSERT_TRUE(btc_sw_sighash_ctx_calc(&ctx, hash, idx, value, &script_code));
+            ASSERT_EQ(0, memcmp(hash_old, hash, sizeof(hash)));
+            memset(hash, 0, sizeof(hash));
+            ASSERT_TRUE(btc_sw_sighash_ctx_calc_p2wsh_wit(&ctx, hash, idx, value, WIT[w]));
+            ASSERT_EQ(0, memcmp(hash_old, hash, sizeof(hash)));
+            memset(hash, 0, sizeof(hash));
+            ASSERT_TRUE(btc_sw_sighash(&tx, hash, idx, value, &script_code));
+            ASSERT_EQ(0, memcmp(hash_old, hash, sizeof(hash)));
+            memset(hash, 0, sizeof(hash));
+            ASSERT_TRUE(btc_sw_sighash_p2wsh_wit(&tx, hash, idx, value, WIT[w]));
+            ASSERT_EQ(0, memcmp(hash_old, hash, sizeof(hash)));
+            utl_buf_free(&script_code);
+        }
+    }
+
+    //index範囲外
+    uint8_t hash[BTC_SZ_HASH256];
+    ASSERT_FALSE(btc_sw_sighash_ctx_calc_p2wsh_wit(&ctx, hash, INPUTS, 0, &wit_short));
+
+    //不正なtx
+    btc_tx_t tx_empty = BTC_TX_INIT;
+    ASSERT_FALSE(btc_sw_sighash_ctx_init(&ctx, &tx_empty));
+
+    utl_buf_free(&wit_short);
+    utl_buf_free(&wit_long);
+    btc_tx_free(&tx);
+}
+
+
 TEST_F(sw, set_vin_p2wpkh)
 {
     //空トランザクション
@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//FAKE_VALUE_FUNC(int, external_function, int);
+
+////////////////////////////////////////////////////////////////////////
+
+class tx_view: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //RESET_FAKE(external_function)
+        utl_dbg_malloc_cnt_reset();
+        btc_init(BTC_BLOCK_CHAIN_BTCTEST, true);
+    }
+
+    virtual void TearDown() {
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+        btc_term();
+    }
+
+public:
+    //BIP143: Native P2WPKH(signed transaction)
+    static const uint8_t *SegwitTx(uint32_t *pLen)
+    {
+        static const uint8_t TX[] = {
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0xff, 0xf7, 0xf7, 0x88, 0x1a, 0x80, 0x99, 0xaf, 0xa6,
+        0x94, 0x0d, 0x42, 0xd1, 0xe7, 0xf6, 0x36, 0x2b, 0xec, 0x38, 0x17, 0x1e, 0xa3, 0xed, 0xf4, 0x33,
+        0x54, 0x1d, 0xb4, 0xe4, 0xad, 0x96, 0x9f, 0x00, 0x00, 0x00, 0x00, 0x49, 0x48, 0x30, 0x45, 0x02,
+        0x21, 0x00, 0x8b, 0x9d, 0x1d, 0xc2, 0x6b, 0xa6, 0xa9, 0xcb, 0x62, 0x12, 0x7b, 0x02, 0x74, 0x2f,
+        0xa9, 0xd7, 0x54, 0xcd, 0x3b, 0xeb, 0xf3, 0x37, 0xf7, 0xa5, 0x5d, 0x11, 0x4c, 0x8e, 0x5c, 0xdd,
+        0x30, 0xbe, 0x02, 0x20, 0x40, 0x52, 0x9b, 0x19, 0x4b, 0xa3, 0xf9, 0x28, 0x1a, 0x99, 0xf2, 0xb1,
+        0xc0, 0xa1, 0x9c, 0x04, 0x89, 0xbc, 0x22, 0xed, 0xe9, 0x44, 0xcc, 0xf4, 0xec, 0xba, 0xb4, 0xcc,
+        0x61, 0x8e, 0xf3, 0xed, 0x01, 0xee, 0xff, 0xff, 0xff, 0xef, 0x51, 0xe1, 0xb8, 0x04, 0xcc, 0x89,
+        0xd1, 0x82, 0xd2, 0x79, 0x65, 0x5c, 0x3a, 0xa8, 0x9e, 0x81, 0x5b, 0x1b, 0x30, 0x9f, 0xe2, 0x87,
+        0xd9, 0xb2, 0xb5, 0x5d, 0x57, 0xb9, 0x0e, 0xc6, 0x8a, 0x01, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff,
+        0xff, 0xff, 0x02, 0x20, 0x2c, 0xb2, 0x06, 0x00, 0x00, 0x00, 0x00, 0x19, 0x76, 0xa9, 0x14, 0x82,
+        0x80, 0xb3, 0x7d, 0xf3, 0x78, 0xdb, 0x99, 0xf6, 0x6f, 0x85, 0xc9, 0x5a, 0x78, 0x3a, 0x76, 0xac,
+        0x7a, 0x6d, 0x59, 0x88, 0xac, 0x90, 0x93, 0x51, 0x0d, 0x00, 0x00, 0x00, 0x00, 0x19, 0x76, 0xa9,
+        0x14, 0x3b, 0xde, 0x42, 0xdb, 0xee, 0x7e, 0x4d, 0xbe, 0x6a, 0x21, 0xb2, 0xd5, 0x0c, 0xe2, 0xf0,
+        0x16, 0x7f, 0xaa, 0x81, 0x59, 0x88, 0xac, 0x00, 0x02, 0x47, 0x30, 0x44, 0x02, 0x20, 0x36, 0x09,
+        0xe1, 0x7b, 0x84, 0xf6, 0xa7, 0xd3, 0x0c, 0x80, 0xbf, 0xa6, 0x10, 0xb5, 0xb4, 0x54, 0x2f, 0x32,
+        0xa8, 0xa0, 0xd5, 0x44, 0x7a, 0x12, 0xfb, 0x13, 0x66, 0xd7, 0xf0, 0x1c, 0xc4, 0x4a, 0x02, 0x20,
+        0x57, 0x3a, 0x95, 0x4c, 0x45, 0x18, 0x33, 0x15, 0x61, 0x40, 0x6f, 0x90, 0x30, 0x0e, 0x8f, 0x33,
+        0x58, 0xf5, 0x19, 0x28, 0xd4, 0x3c, 0x21, 0x2a, 0x8c, 0xae, 0xd0, 0x2d, 0xe6, 0x7e, 0xeb, 0xee,
+        0x01, 0x21, 0x02, 0x54, 0x76, 0xc2, 0xe8, 0x31, 0x88, 0x36, 0x8d, 0xa1, 0xff, 0x3e, 0x29, 0x2e,
+        0x7a, 0xca, 0xfc, 0xdb, 0x35, 0x66, 0xbb, 0x0a, 0xd2, 0x53, 0xf6, 0x2f, 0xc7, 0x0f, 0x07, 0xae,
+        0xee, 0x63, 0x57, 0x11, 0x00, 0x00, 0x00
+        };
+        *pLen = sizeof(TX);
+        return TX;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(tx_view, read_segwit)
+{
+    const uint8_t TXID[] = {
+        0x09, 0x46, 0x2d, 0x60, 0x4a, 0x31, 0x02, 0xfa,
+        0xe0, 0x83, 0xad, 0xa3, 0x69, 0xc7, 0x95, 0x85,
+        0x5a, 0x28, 0xdb, 0x4b, 0xdd, 0x3d, 0x05, 0x35,
+        0x8a, 0x36, 0x1c, 0xf3, 0x2a, 0x1a, 0x15, 0xe8,
+    };
+    const uint8_t WTXID[] = {
+        0x62, 0xb7, 0x09, 0xc9, 0x12, 0x6a, 0xe7, 0x78,
+        0x2e, 0xa8, 0x65, 0x76, 0xb3, 0x38, 0xf3, 0x92,
+        0x11, 0x19, 0x9d, 0x14, 0x9d, 0xce, 0xd9, 0x24,
+        0x23, 0xdf, 0x07, 0x09, 0x37, 0x38, 0x6c, 0xc3,
+    };
+    uint32_t len;
+    const uint8_t *p_data = SegwitTx(&len);
+
+    btc_tx_view_t view;
+    ASSERT_TRUE(btc_tx_view_read(&view, p_data, len));
+    ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    ASSERT_TRUE(view.segwit);
+    ASSERT_EQ(1, view.version);
+    ASSERT_EQ(17, view.locktime);
+    ASSERT_EQ(2, view.vin_cnt);
+    ASSERT_EQ(2, view.vout_cnt);
+
+    //btc_tx_read()と同じ内容
+    btc_tx_t tx = BTC_TX_INIT;
+    ASSERT_TRUE(btc_tx_read(&tx, p_data, len));
+
+    uint32_t pos = view.vin_pos;
+    for (uint32_t lp = 0; lp < view.vin_cnt; lp++) {
+        btc_tx_view_vin_t vin;
+        btc_tx_view_vin(&view, &vin, &pos);
+        ASSERT_EQ(0, memcmp(tx.vin[lp].txid, p_data + vin.txid_pos, BTC_SZ_TXID));
+        ASSERT_EQ(tx.vin[lp].index, vin.index);
+        ASSERT_EQ(tx.vin[lp].script.len, vin.script_len);
+        ASSERT_EQ(0, memcmp(tx.vin[lp].script.buf, p_data + vin.script_pos, vin.script_len));
+        ASSERT_EQ(tx.vin[lp].sequence, vin.sequence);
+    }
+    ASSERT_EQ(view.vout_pos, pos + 1);      //txout count
+
+    pos = view.vout_pos;
+    for (uint32_t lp = 0; lp < view.vout_cnt; lp++) {
+        btc_tx_view_vout_t vout;
+        btc_tx_view_vout(&view, &vout, &pos);
+        ASSERT_EQ(tx.vout[lp].value, vout.value);
+        ASSERT_EQ(tx.vout[lp].script.len, vout.script_len);
+        ASSERT_EQ(0, memcmp(tx.vout[lp].script.buf, p_data + vout.script_pos, vout.script_len));
+    }
+    ASSERT_EQ(view.wit_pos, pos);
+
+    for (uint32_t lp = 0; lp < view.vin_cnt; lp++) {
+        btc_tx_view_wit_t wit;
+        btc_tx_view_wit(&view, &wit, &pos);
+        ASSERT_EQ(tx.vin[lp].wit_item_cnt, wit.item_cnt);
+        uint32_t item = wit.item_pos;
+        for (uint32_t lp2 = 0; lp2 < wit.item_cnt; lp2++) {
+            uint32_t item_pos;
+            uint32_t item_len;
+            btc_tx_view_wit_item(&view, &item_pos, &item_len, &item);
+            ASSERT_EQ(tx.vin[lp].witness[lp2].len, item_len);
+            ASSERT_EQ(0, memcmp(tx.vin[lp].witness[lp2].buf, p_data + item_pos, item_len));
+        }
+    }
+    ASSERT_EQ(len - sizeof(uint32_t), pos);     //locktime
+
+    uint8_t txid[BTC_SZ_TXID];
+    btc_tx_view_txid(&view, txid);
+    ASSERT_EQ(0, memcmp(TXID, txid, sizeof(txid)));
+    btc_tx_txid(&tx, txid);
+    ASSERT_EQ(0, memcmp(TXID, txid, sizeof(txid)));
+    btc_tx_view_wtxid(&view, txid);
+    ASSERT_EQ(0, memcmp(WTXID, txid, sizeof(txid)));
+
+    btc_tx_t tx2 = BTC_TX_INIT;
+    ASSERT_TRUE(btc_tx_view_to_tx(&tx2, &view));
+    ASSERT_EQ(tx.vin_cnt, tx2.vin_cnt);
+    ASSERT_EQ(tx.vout_cnt, tx2.vout_cnt);
+    btc_tx_free(&tx2);
+    btc_tx_free(&tx);
+}
+
+
+TEST_F(tx_view, read_legacy)
+{
+    btc_tx_t tx = BTC_TX_INIT;
+    uint8_t txid[BTC_SZ_TXID];
+    memset(txid, 0x11, sizeof(txid));
+    btc_vin_t *vin = btc_tx_add_vin(&tx, txid, 3);
+    utl_buf_alloccopy(&vin->script, txid, 5);
+    btc_vout_t *vout = btc_tx_add_vout(&tx, 12345);
+    utl_buf_alloccopy(&vout->script, txid, 22);
+    tx.locktime = 500;
+
+    utl_buf_t buf = UTL_BUF_INIT;
+    ASSERT_TRUE(btc_tx_write(&tx, &buf));
+
+    btc_tx_view_t view;
+    ASSERT_TRUE(btc_tx_view_read(&view, buf.buf, buf.len));
+    ASSERT_FALSE(view.segwit);
+    ASSERT_EQ(500, view.locktime);
+    ASSERT_EQ(1, view.vin_cnt);
+    ASSERT_EQ(1, view.vout_cnt);
+    ASSERT_EQ(view.wit_pos, buf.len - sizeof(uint32_t));
+
+    btc_tx_view_vin_t view_vin;
+    uint32_t pos = view.vin_pos;
+    btc_tx_view_vin(&view, &view_vin, &pos);
+    ASSERT_EQ(3, view_vin.index);
+    ASSERT_EQ(5, view_vin.script_len);
+
+    btc_tx_view_vout_t view_vout;
+    pos = view.vout_pos;
+    btc_tx_view_vout(&view, &view_vout, &pos);
+    ASSERT_EQ(12345, view_vout.value);
+    ASSERT_EQ(22, view_vout.script_len);
+
+    //segwitでなければTXID == WTXID
+    uint8_t txid_tx[BTC_SZ_TXID];
+    uint8_t txid_view[BTC_SZ_TXID];
+    uint8_t wtxid_view[BTC_SZ_TXID];
+    btc_tx_txid(&tx, txid_tx);
+    btc_tx_view_txid(&view, txid_view);
+    btc_tx_view_wtxid(&view, wtxid_view);
+    ASSERT_EQ(0, memcmp(txid_tx, txid_view, BTC_SZ_TXID));
+    ASSERT_EQ(0, memcmp(txid_tx, wtxid_view, BTC_SZ_TXID));
+
+    utl_buf_free(&buf);
+    btc_tx_free(&tx);
+}
+
+
+TEST_F(tx_view, read_invalid)
+{
+    uint32_t len;
+    const uint8_t *p_data = SegwitTx(&len);
+    btc_tx_view_t view;
+
+    //truncated
+    for (uint32_t lp = 0; lp < len; lp++) {
+        ASSERT_FALSE(btc_tx_view_read(&view, p_data, lp));
+    }
+
+    //trailing data
+    uint8_t *p_buf = (uint8_t *)malloc(len + 1);
+    memcpy(p_buf, p_data, len);
+    p_buf[len] = 0x00;
+    ASSERT_FALSE(btc_tx_view_read(&view, p_buf, len + 1));
+    uint32_t read_len;
+    ASSERT_TRUE(btc_tx_view_read_2(&view, p_buf, len + 1, &read_len));
+    ASSERT_EQ(len, read_len);
+    ASSERT_EQ(len, view.len);
+
+    //marker only
+    p_buf[5] = 0x02;
+    ASSERT_FALSE(btc_tx_view_read(&view, p_buf, len));
+    free(p_buf);
+}
@@ -64,6 +64,7 @@
 #include "ln_msg.h"
 #include "ln_htlc_tx.h"
 #include "ln_wallet.h"
+#include "ln_routing.h"
 #include "ln.h"
 
 #define M_DBG_VERBOSE
@@ -379,6 +380,7 @@ void ln_short_channel_id_set_param(ln_channel_t *pChannel, uint32_t Height, uint
     pChannel->short_channel_id = ln_short_channel_id_calc(Height, Index, ln_funding_info_txindex(&pChannel->funding_info));
     pChannel->status = LN_STATUS_NORMAL_OPE;
     M_DB_CHANNEL_SAVE(pChannel);
+    ln_routing_channel_add(pChannel->short_channel_id, pChannel->peer_node_id);
 }
 
 
@@ -564,6 +566,7 @@ void ln_shutdown_update_fee(ln_channel_t *pChannel, uint64_t Fee)
 void ln_close_change_stat(ln_channel_t *pChannel, const btc_tx_t *pCloseTx, void *pDbParam)
 {
     LOGD("BEGIN: status=%d\n", (int)pChannel->status);
+    ln_routing_channel_del(pChannel->short_channel_id);
     if (pCloseTx == NULL) {
         //funding_tx is spent but spent_tx isn't mining
         if (pChannel->status < LN_STATUS_CLOSE_WAIT) {
@@ -1427,6 +1430,7 @@ static void channel_clear(ln_channel_t *pChannel)
     pChannel->shutdown_flag = 0;
 
     ln_establish_free(pChannel);
+    ln_db_channel_save_reset(pChannel);
 }
 
 
@@ -71,6 +71,7 @@ extern "C" {
 #define LN_SZ_PREIMAGE                  (32)        ///< (size) preimage
 #define LN_SZ_ONION_ROUTE               (1366)      ///< (size) onion-routing-packet
 #define LN_SZ_NOISE_HEADER              (sizeof(uint16_t) + 16)     ///< (size) noise packet header
+#define LN_SZ_NOISE_ENC(len)            (LN_SZ_NOISE_HEADER + (len) + 16)   ///< (size) noise packet(header + body)
 #define LN_SZ_FUNDINGTX_VSIZE           (177)       ///< (size) funding_txのvsize(nested in BIP16 P2SH format)
 #define LN_SZ_ERRMSG                    (256)       ///< (size) last error string
 
@@ -420,6 +421,9 @@ struct ln_channel_t {
     int                         err;                            ///< [ERRO_01]error code(ln_err.h)
     char                        err_msg[LN_SZ_ERRMSG];          ///< [ERRO_02]]エラーメッセージ
 
+    //db
+    void                        *p_db_saved;                    ///< [DBSV_01]最後にDB保存した内容(ln_db_channel_save()の差分保存用)
+
     //for app
     ln_callback_t               p_callback;                     ///< [APPS_01]通知コールバック
     void                        *p_param;                       ///< [APPS_02]ユーザ用
@@ -604,6 +608,24 @@ void ln_idle_proc_inactive(ln_channel_t *pChannel);
 void ln_idle_proc_origin(ln_channel_t *pChannel);
 
 
+/** forward DB追加通知関数
+ *
+ * @param[in]           NextShortChannelId  転送先short_channel_id(0:origin/final node)
+ * @note
+ *      - channel threadから呼ばれるため、すぐに戻ること
+ */
+typedef void (*ln_forward_notify_t)(uint64_t NextShortChannelId);
+
+
+/** forward DB追加通知先の設定
+ *
+ * HTLCの転送/巻き戻しをforward DBに書き込んだとき、転送先を起こすために呼ばれる。
+ *
+ * @param[in]           pNotify     通知関数(NULL:通知しない)
+ */
+void ln_forward_notify_set(ln_forward_notify_t pNotify);
+
+
 /** 接続直後のfunding_locked必要性チェック
  *
  * @param[in]           pChannel        channel info
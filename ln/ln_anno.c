@@ -43,10 +43,14 @@
 #include "ln_db.h"
 #include "ln_signer.h"
 #include "ln.h"
+#include "ln_msg.h"
 #include "ln_msg_anno.h"
 #include "ln_local.h"
 #include "ln_setupctl.h"
 #include "ln_anno.h"
+#include "ln_routing.h"
+#include "ln_gossip.h"
+#include "ln_anno_verify.h"
 
 
 /**************************************************************************
@@ -66,6 +70,12 @@
 static void proc_announcement_signatures(ln_channel_t *pChannel);
 static bool create_local_channel_announcement(ln_channel_t *pChannel);
 static bool get_node_id_from_channel_announcement(ln_channel_t *pChannel, uint8_t *pNodeId, uint64_t short_channel_id, uint8_t Dir);
+static bool get_node_id_from_db(uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir);
+static bool get_node_id_from_channel(ln_channel_t *pChannel, uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir);
+static bool store_channel_announcement(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId);
+static bool store_node_announcement(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId);
+static bool store_channel_update(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId);
+static void store_verified(uint16_t Type, const uint8_t *pData, uint16_t Len, const uint8_t *pSendId);
 static bool create_channel_update(ln_channel_t *pChannel, ln_msg_channel_update_t *pUpd, utl_buf_t *pCnlUpd, uint32_t TimeStamp, uint8_t Flag);
 
 
@@ -73,6 +83,27 @@ static bool create_channel_update(ln_channel_t *pChannel, ln_msg_channel_update_
  * public functions
  **************************************************************************/
 
+bool ln_anno_init(int Workers)
+{
+    ln_anno_verify_func_t func;
+    func.p_node_id = get_node_id_from_db;
+    func.p_store = store_verified;
+    return ln_anno_verify_start(Workers, &func);
+}
+
+
+void ln_anno_term(void)
+{
+    ln_anno_verify_stop();
+}
+
+
+bool ln_anno_is_busy(void)
+{
+    return ln_anno_verify_is_busy();
+}
+
+
 bool /*HIDDEN*/ ln_announcement_signatures_send(ln_channel_t *pChannel)
 {
     uint8_t *p_sig_node;
@@ -191,17 +222,16 @@ static bool channel_announcement_recv(ln_channel_t *pChannel, const uint8_t *pDa
         return true;
     }
 
-    //XXX: check sign
-    //ln_msg_channel_announcement_verify
-
-    utl_buf_t buf = UTL_BUF_INIT;
-    buf.buf = (CONST_CAST uint8_t *)pData;
-    buf.len = Len;
-    if (!ln_db_cnlanno_save(&buf, msg.short_channel_id, ln_remote_node_id(pChannel), msg.p_node_id_1, msg.p_node_id_2)) {
-        LOGE("fail: save\n");
-        return false;
+    if (!ln_anno_verify_push(MSGTYPE_CHANNEL_ANNOUNCEMENT, pData, Len, ln_remote_node_id(pChannel), NULL)) {
+        //pipeline停止中はこのthreadで検証する
+        if (!ln_msg_channel_announcement_verify(&msg, pData, Len)) {
+            LOGE("fail: verify\n");
+            return false;
+        }
+        if (!store_channel_announcement(pData, Len, ln_remote_node_id(pChannel))) {
+            return false;
+        }
     }
-    LOGD("save channel_announcement: %016" PRIx64 "\n", msg.short_channel_id);
 
     ln_cb_param_notify_annodb_update_t db;
     db.type = LN_CB_ANNO_TYPE_CNL_ANNO;
@@ -228,23 +258,20 @@ static bool node_announcement_recv(ln_channel_t *pChannel, const uint8_t *pData,
         LOGE("fail: read message\n");
         return false;
     }
-    if (!ln_msg_node_announcement_verify(&msg, pData, Len)) {
-        LOGE("fail: verify\n");
-        return false;
-    }
 
     LOGV("node_id:");
     DUMPV(msg.p_node_id, BTC_SZ_PUBKEY);
 
-    utl_buf_t buf = UTL_BUF_INIT;
-    buf.buf = (CONST_CAST uint8_t *)pData;
-    buf.len = Len;
-    if (!ln_db_nodeanno_save(&buf, &msg, ln_remote_node_id(pChannel))) {
-        LOGE("fail: save\n");
-        return false;
+    if (!ln_anno_verify_push(MSGTYPE_NODE_ANNOUNCEMENT, pData, Len, ln_remote_node_id(pChannel), NULL)) {
+        //pipeline停止中はこのthreadで検証する
+        if (!ln_msg_node_announcement_verify(&msg, pData, Len)) {
+            LOGE("fail: verify\n");
+            return false;
+        }
+        if (!store_node_announcement(pData, Len, ln_remote_node_id(pChannel))) {
+            return false;
+        }
     }
-    LOGD("save node_announcement: ");
-    DUMPD(msg.p_node_id, BTC_SZ_PUBKEY);
 
     ln_cb_param_notify_annodb_update_t db;
     db.type = LN_CB_ANNO_TYPE_NODE_ANNO;
@@ -276,6 +303,7 @@ bool /*HIDDEN*/ ln_channel_update_send(ln_channel_t *pChannel)
         LOGE("fail: save channel_update\n");
         return false;
     }
+    ln_routing_cnlupd_update(&msg);
 
     if (pChannel->anno_flag == (M_ANNO_FLAG_SEND | M_ANNO_FLAG_RECV)) {
         //we have exchanged local announcement signatures
@@ -319,25 +347,6 @@ static bool channel_update_recv(ln_channel_t *pChannel, const uint8_t *pData, ui
 
     LOGV("recv channel_update: %016" PRIx64 ":%d\n", msg.short_channel_id, dir);
 
-    uint8_t node_id[BTC_SZ_PUBKEY];
-    if (get_node_id_from_channel_announcement(pChannel, node_id, msg.short_channel_id, dir)) {
-        //found
-        if (!btc_keys_check_pub(node_id)) {
-            LOGE("fail: invalid pubkey\n");
-            return false;
-        }
-        if (!ln_msg_channel_update_verify(node_id, pData, Len)) {
-            LOGE("fail: verify\n");
-            return false;
-        }
-    } else {
-        //not found
-        //  BOLT#11
-        //      r fieldでchannel_update相当のデータを送信したい場合に備えて保持する
-        //      https://lists.linuxfoundation.org/pipermail/lightning-dev/2018-April/001220.html
-        LOGD("through: not found channel_announcement in DB, but save\n");
-    }
-
     //BOLT07
     //  if the timestamp is unreasonably far in the future:
     //    MAY discard the channel_update.
@@ -346,14 +355,32 @@ static bool channel_update_recv(ln_channel_t *pChannel, const uint8_t *pData, ui
         return false;
     }
 
-    utl_buf_t buf = UTL_BUF_INIT;
-    buf.buf = (CONST_CAST uint8_t *)pData;
-    buf.len = Len;
-    if (!ln_db_cnlupd_save(&buf, &msg, ln_remote_node_id(pChannel))) {
-        LOGE("fail: save\n");
-        return false;
+    //pipelineでは保存済みchannel_announcementを優先し、見つからない場合だけ自channelの情報を使う
+    uint8_t node_id[BTC_SZ_PUBKEY];
+    bool own = get_node_id_from_channel(pChannel, node_id, msg.short_channel_id, dir);
+    if (!ln_anno_verify_push(MSGTYPE_CHANNEL_UPDATE, pData, Len, ln_remote_node_id(pChannel), own ? node_id : NULL)) {
+        //pipeline停止中はこのthreadで検証する
+        if (get_node_id_from_channel_announcement(pChannel, node_id, msg.short_channel_id, dir)) {
+            //found
+            if (!btc_keys_check_pub(node_id)) {
+                LOGE("fail: invalid pubkey\n");
+                return false;
+            }
+            if (!ln_msg_channel_update_verify(node_id, pData, Len)) {
+                LOGE("fail: verify\n");
+                return false;
+            }
+        } else {
+            //not found
+            //  BOLT#11
+            //      r fieldでchannel_update相当のデータを送信したい場合に備えて保持する
+            //      https://lists.linuxfoundation.org/pipermail/lightning-dev/2018-April/001220.html
+            LOGD("through: not found channel_announcement in DB, but save\n");
+        }
+        if (!store_channel_update(pData, Len, ln_remote_node_id(pChannel))) {
+            return false;
+        }
     }
-    LOGD("save channel_update: %016" PRIx64 ":%d\n", msg.short_channel_id, dir);
 
     ln_cb_param_notify_annodb_update_t db;
     db.type = LN_CB_ANNO_TYPE_CNL_UPD;
@@ -377,7 +404,9 @@ bool ln_channel_update_disable(ln_channel_t *pChannel)
     ln_msg_channel_update_t msg;
     utl_buf_t buf = UTL_BUF_INIT;
     if (!create_channel_update(pChannel, &msg, &buf, (uint32_t)utl_time_time(), LN_CNLUPD_CHFLAGS_DISABLE)) return false;
-    (void)ln_db_cnlupd_save(&buf, &msg, ln_remote_node_id(pChannel));
+    if (ln_db_cnlupd_save(&buf, &msg, ln_remote_node_id(pChannel))) {
+        ln_routing_cnlupd_update(&msg);
+    }
     utl_buf_free(&buf);
     return true;
 }
@@ -425,9 +454,8 @@ bool HIDDEN ln_query_short_channel_ids_recv(ln_channel_t *pChannel, const uint8_
     if (!ln_msg_gossip_ids_decode(&p_short_channel_ids, &ids, msg.p_encoded_short_ids, msg.len)) {
         return false;
     }
-    if (!ln_db_annoinfos_del_node_id(ln_remote_node_id(pChannel), p_short_channel_ids, ids)) {
-        return false;
-    }
+    //cursorにかかわらず送信させる
+    ln_gossip_request(ln_remote_node_id(pChannel), p_short_channel_ids, ids);
     UTL_DBG_FREE(p_short_channel_ids);
 
     return true;
@@ -677,6 +705,7 @@ static void proc_announcement_signatures(ln_channel_t *pChannel)
         }
         if (ln_db_cnlanno_save(
             &pChannel->cnl_anno, pChannel->short_channel_id, NULL, ln_remote_node_id(pChannel), ln_node_get_id())) {
+            ln_routing_cnlanno_update(pChannel->short_channel_id, ln_remote_node_id(pChannel), ln_node_get_id());
             utl_buf_free(&pChannel->cnl_anno);
         } else {
             LOGE("fail\n");
@@ -688,7 +717,9 @@ static void proc_announcement_signatures(ln_channel_t *pChannel)
         ln_msg_channel_update_t msg;
         utl_buf_t buf = UTL_BUF_INIT;
         if (create_channel_update(pChannel, &msg, &buf, (uint32_t)utl_time_time(), 0)) {
-            ln_db_cnlupd_save(&buf, &msg, NULL);
+            if (ln_db_cnlupd_save(&buf, &msg, NULL)) {
+                ln_routing_cnlupd_update(&msg);
+            }
         } else {
             LOGE("fail\n");
         }
@@ -736,6 +767,17 @@ static bool create_local_channel_announcement(ln_channel_t *pChannel)
 
 
 static bool get_node_id_from_channel_announcement(ln_channel_t *pChannel, uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir)
+{
+    if (get_node_id_from_db(pNodeId, ShortChannelId, Dir)) return true;
+    return get_node_id_from_channel(pChannel, pNodeId, ShortChannelId, Dir);
+}
+
+
+/** 保存済みchannel_announcementからchannel_updateの署名者を取得
+ *
+ * #ln_anno_verify_func_t.p_node_id
+ */
+static bool get_node_id_from_db(uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir)
 {
     bool ret = false;
 
@@ -749,27 +791,119 @@ static bool get_node_id_from_channel_announcement(ln_channel_t *pChannel, uint8_
             goto LABEL_EXIT;
         }
         memcpy(pNodeId, Dir ? msg.p_node_id_2 : msg.p_node_id_1, BTC_SZ_PUBKEY);
-    } else {
-        if (ShortChannelId != pChannel->short_channel_id) goto LABEL_EXIT;
-        btc_script_pubkey_order_t order = ln_node_id_order(pChannel, NULL);
-        if ( ((order == BTC_SCRYPT_PUBKEY_ORDER_ASC) && (Dir == 0)) ||
-             ((order == BTC_SCRYPT_PUBKEY_ORDER_OTHER) && (Dir == 1)) ) {
-            LOGD("this channel: my node\n");
-            memcpy(pNodeId, ln_node_get_id(), BTC_SZ_PUBKEY);
-        } else {
-            LOGD("this channel: peer node\n");
-            memcpy(pNodeId, pChannel->peer_node_id, BTC_SZ_PUBKEY);
-        }
+        ret = true;
     }
 
-    ret = true;
-
 LABEL_EXIT:
     utl_buf_free(&buf);
     return ret;
 }
 
 
+/** 自channelのchannel_updateの署名者を取得
+ *
+ */
+static bool get_node_id_from_channel(ln_channel_t *pChannel, uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir)
+{
+    if (ShortChannelId != pChannel->short_channel_id) return false;
+    btc_script_pubkey_order_t order = ln_node_id_order(pChannel, NULL);
+    if ( ((order == BTC_SCRYPT_PUBKEY_ORDER_ASC) && (Dir == 0)) ||
+         ((order == BTC_SCRYPT_PUBKEY_ORDER_OTHER) && (Dir == 1)) ) {
+        LOGD("this channel: my node\n");
+        memcpy(pNodeId, ln_node_get_id(), BTC_SZ_PUBKEY);
+    } else {
+        LOGD("this channel: peer node\n");
+        memcpy(pNodeId, pChannel->peer_node_id, BTC_SZ_PUBKEY);
+    }
+    return true;
+}
+
+
+static bool store_channel_announcement(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId)
+{
+    ln_msg_channel_announcement_t msg;
+    if (!ln_msg_channel_announcement_read(&msg, pData, Len)) {
+        LOGE("fail: read message\n");
+        return false;
+    }
+
+    utl_buf_t buf = UTL_BUF_INIT;
+    buf.buf = (CONST_CAST uint8_t *)pData;
+    buf.len = Len;
+    if (!ln_db_cnlanno_save(&buf, msg.short_channel_id, pSendId, msg.p_node_id_1, msg.p_node_id_2)) {
+        LOGE("fail: save\n");
+        return false;
+    }
+    LOGD("save channel_announcement: %016" PRIx64 "\n", msg.short_channel_id);
+    ln_routing_cnlanno_update(msg.short_channel_id, msg.p_node_id_1, msg.p_node_id_2);
+    return true;
+}
+
+
+static bool store_node_announcement(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId)
+{
+    ln_msg_node_announcement_t msg;
+    if (!ln_msg_node_announcement_read(&msg, pData, Len)) {
+        LOGE("fail: read message\n");
+        return false;
+    }
+
+    utl_buf_t buf = UTL_BUF_INIT;
+    buf.buf = (CONST_CAST uint8_t *)pData;
+    buf.len = Len;
+    if (!ln_db_nodeanno_save(&buf, &msg, pSendId)) {
+        LOGE("fail: save\n");
+        return false;
+    }
+    LOGD("save node_announcement: ");
+    DUMPD(msg.p_node_id, BTC_SZ_PUBKEY);
+    return true;
+}
+
+
+static bool store_channel_update(const uint8_t *pData, uint16_t Len, const uint8_t *pSendId)
+{
+    ln_msg_channel_update_t msg;
+    if (!ln_msg_channel_update_read(&msg, pData, Len)) {
+        LOGE("fail: read message\n");
+        return false;
+    }
+
+    utl_buf_t buf = UTL_BUF_INIT;
+    buf.buf = (CONST_CAST uint8_t *)pData;
+    buf.len = Len;
+    if (!ln_db_cnlupd_save(&buf, &msg, pSendId)) {
+        LOGE("fail: save\n");
+        return false;
+    }
+    LOGD("save channel_update: %016" PRIx64 ":%d\n", msg.short_channel_id, msg.channel_flags & LN_CNLUPD_CHFLAGS_DIRECTION);
+    ln_routing_cnlupd_update(&msg);
+    return true;
+}
+
+
+/** 検証済みannouncementの保存
+ *
+ * #ln_anno_verify_func_t.p_store
+ */
+static void store_verified(uint16_t Type, const uint8_t *pData, uint16_t Len, const uint8_t *pSendId)
+{
+    switch (Type) {
+    case MSGTYPE_CHANNEL_ANNOUNCEMENT:
+        /*ignore*/store_channel_announcement(pData, Len, pSendId);
+        break;
+    case MSGTYPE_NODE_ANNOUNCEMENT:
+        /*ignore*/store_node_announcement(pData, Len, pSendId);
+        break;
+    case MSGTYPE_CHANNEL_UPDATE:
+        /*ignore*/store_channel_update(pData, Len, pSendId);
+        break;
+    default:
+        break;
+    }
+}
+
+
 /** channel_update作成
  *
  * @param[in,out]       pChannel        channel情報
@@ -37,6 +37,32 @@
  * prototypes
  ********************************************************************/
 
+/** 受信したannouncementの署名検証pipeline開始
+ *
+ * 開始しない場合、受信したthreadで検証・保存する。
+ *
+ * @param[in]   Workers     署名検証thread数
+ * @retval  true    成功
+ */
+bool ln_anno_init(int Workers);
+
+
+/** 署名検証pipeline停止
+ *
+ * 検証待ちのannouncementは保存してから停止する。
+ */
+void ln_anno_term(void);
+
+
+/** 署名検証pipelineが混んでいるか
+ *
+ * trueの間、peerからの受信を止めること(#ln_anno_verify_is_busy())。
+ *
+ * @retval  true    busy
+ */
+bool ln_anno_is_busy(void);
+
+
 bool /*HIDDEN*/ ln_announcement_signatures_send(ln_channel_t *pChannel);
 bool HIDDEN ln_announcement_signatures_recv(ln_channel_t *pChannel, const uint8_t *pData, uint16_t Len);
 //XXX: no ch-anno send
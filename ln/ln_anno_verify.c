@@ -0,0 +1,462 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_anno_verify.c
+ *  @brief  announcement署名検証pipeline
+ *
+ *  worker threadはbatchの要素を先頭から1つずつ取り合って検証する(要素ごとの検証時間が異なるため)。
+ *  保存はdispatcher threadだけが行うので、保存順はqueueに積んだ順と同じになる。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "utl_dbg.h"
+
+#include "btc_keys.h"
+
+#include "ln_msg.h"
+#include "ln_msg_anno.h"
+#include "ln_local.h"
+#include "ln_anno_verify.h"
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct anno_job_t
+ *  @brief  検証待ちannouncement
+ */
+typedef struct anno_job_t {
+    struct anno_job_t   *p_next;
+    uint16_t            type;                           ///< message type
+    uint16_t            len;                            ///< data長
+    uint64_t            short_channel_id;               ///< channel_announcement/channel_update
+    uint8_t             dir;                            ///< channel_update
+    bool                b_send_id;
+    bool                b_node_id;                      ///< true: node_id有効
+    bool                valid;                          ///< 検証結果
+    uint8_t             send_id[BTC_SZ_PUBKEY];         ///< 送信元node_id
+    uint8_t             node_id[BTC_SZ_PUBKEY];         ///< channel_announcement: node_id_1, channel_update: 署名者
+    uint8_t             node_id_2[BTC_SZ_PUBKEY];       ///< channel_announcement: node_id_2
+    uint8_t             data[];
+} anno_job_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t      mMuxVerify = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       mCondQueue = PTHREAD_COND_INITIALIZER;  ///< dispatcher: queue追加
+static pthread_cond_t       mCondDone = PTHREAD_COND_INITIALIZER;   ///< flush: 保存完了
+static pthread_cond_t       mCondWork = PTHREAD_COND_INITIALIZER;   ///< worker: batch開始
+static pthread_cond_t       mCondBatch = PTHREAD_COND_INITIALIZER;  ///< dispatcher: batch検証完了
+
+static bool                 mRunning;
+static bool                 mDispatchStop;      ///< dispatcher停止要求(queueを空にしてから停止)
+static bool                 mWorkerStop;        ///< worker停止要求
+static ln_anno_verify_func_t mFunc;
+static int                  mWorkers;
+static pthread_t            mThDispatch;
+static pthread_t            mThWorker[LN_ANNO_VERIFY_WORKERS_MAX];
+
+static anno_job_t           *mpHead;
+static anno_job_t           *mpTail;
+static int                  mQueued;            ///< queue数
+static int                  mInFlight;          ///< 検証・保存中の数
+static volatile bool        mBusy;              ///< true: queue数が#LN_ANNO_VERIFY_QUEUE_MAXに達した
+
+static anno_job_t           *mpBatch[LN_ANNO_VERIFY_BATCH_MAX];
+static int                  mBatchNum;
+static int                  mBatchNext;         ///< 次に検証するmpBatch index(atomic)
+static int                  mBatchRemain;       ///< 検証中のworker数
+static uint32_t             mBatchSeq;          ///< batch番号(workerの起床判定)
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void *thread_dispatch(void *pArg);
+static void *thread_worker(void *pArg);
+static void batch_resolve_node_id(int Num);
+static void batch_verify(int Num);
+static bool job_verify(anno_job_t *pJob);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool ln_anno_verify_start(int Workers, const ln_anno_verify_func_t *pFunc)
+{
+    if ((Workers < 1) || (LN_ANNO_VERIFY_WORKERS_MAX < Workers) || (pFunc->p_store == NULL)) {
+        LOGE("fail: invalid param(workers=%d)\n", Workers);
+        return false;
+    }
+
+    pthread_mutex_lock(&mMuxVerify);
+    if (mRunning) {
+        pthread_mutex_unlock(&mMuxVerify);
+        LOGE("fail: already started\n");
+        return false;
+    }
+    mFunc = *pFunc;
+    mWorkers = Workers;
+    mDispatchStop = false;
+    mWorkerStop = false;
+    mBatchNum = 0;
+    mBatchSeq = 0;
+    mBusy = false;
+    for (int lp = 0; lp < Workers; lp++) {
+        pthread_create(&mThWorker[lp], NULL, thread_worker, NULL);
+    }
+    pthread_create(&mThDispatch, NULL, thread_dispatch, NULL);
+    mRunning = true;
+    pthread_mutex_unlock(&mMuxVerify);
+
+    LOGD("workers=%d\n", Workers);
+    return true;
+}
+
+
+void ln_anno_verify_stop(void)
+{
+    pthread_mutex_lock(&mMuxVerify);
+    if (!mRunning) {
+        pthread_mutex_unlock(&mMuxVerify);
+        return;
+    }
+    mRunning = false;
+    mDispatchStop = true;
+    pthread_cond_broadcast(&mCondQueue);
+    pthread_mutex_unlock(&mMuxVerify);
+
+    //queueに残っている分を保存してから終了する
+    pthread_join(mThDispatch, NULL);
+
+    pthread_mutex_lock(&mMuxVerify);
+    mWorkerStop = true;
+    pthread_cond_broadcast(&mCondWork);
+    pthread_mutex_unlock(&mMuxVerify);
+    for (int lp = 0; lp < mWorkers; lp++) {
+        pthread_join(mThWorker[lp], NULL);
+    }
+    mBusy = false;
+    pthread_cond_broadcast(&mCondDone);
+    LOGD("stop\n");
+}
+
+
+bool ln_anno_verify_push(uint16_t Type, const uint8_t *pData, uint16_t Len, const uint8_t *pSendId, const uint8_t *pNodeId)
+{
+    anno_job_t *p_job = (anno_job_t *)UTL_DBG_MALLOC(sizeof(anno_job_t) + Len);
+    if (p_job == NULL) {
+        return false;
+    }
+    memset(p_job, 0, sizeof(anno_job_t));
+    p_job->type = Type;
+    p_job->len = Len;
+    memcpy(p_job->data, pData, Len);
+    if (pSendId != NULL) {
+        memcpy(p_job->send_id, pSendId, BTC_SZ_PUBKEY);
+        p_job->b_send_id = true;
+    }
+
+    //同じbatchのchannel_updateが参照するため、node_idを取り出しておく
+    switch (Type) {
+    case MSGTYPE_CHANNEL_ANNOUNCEMENT:
+        {
+            ln_msg_channel_announcement_t msg;
+            if (!ln_msg_channel_announcement_read(&msg, pData, Len)) goto LABEL_ERROR;
+            p_job->short_channel_id = msg.short_channel_id;
+            memcpy(p_job->node_id, msg.p_node_id_1, BTC_SZ_PUBKEY);
+            memcpy(p_job->node_id_2, msg.p_node_id_2, BTC_SZ_PUBKEY);
+        }
+        break;
+    case MSGTYPE_CHANNEL_UPDATE:
+        {
+            ln_msg_channel_update_t msg;
+            if (!ln_msg_channel_update_read(&msg, pData, Len)) goto LABEL_ERROR;
+            p_job->short_channel_id = msg.short_channel_id;
+            p_job->dir = msg.channel_flags & LN_CNLUPD_CHFLAGS_DIRECTION;
+            if (pNodeId != NULL) {
+                memcpy(p_job->node_id, pNodeId, BTC_SZ_PUBKEY);
+                p_job->b_node_id = true;
+            }
+        }
+        break;
+    case MSGTYPE_NODE_ANNOUNCEMENT:
+        break;
+    default:
+        goto LABEL_ERROR;
+    }
+
+    pthread_mutex_lock(&mMuxVerify);
+    if (!mRunning) {
+        pthread_mutex_unlock(&mMuxVerify);
+        UTL_DBG_FREE(p_job);
+        return false;
+    }
+    if (mpTail != NULL) {
+        mpTail->p_next = p_job;
+    } else {
+        mpHead = p_job;
+    }
+    mpTail = p_job;
+    mQueued++;
+    if (!mBusy && (mQueued >= LN_ANNO_VERIFY_QUEUE_MAX)) {
+        LOGD("busy: queue=%d\n", mQueued);
+        mBusy = true;
+    }
+    pthread_cond_signal(&mCondQueue);
+    pthread_mutex_unlock(&mMuxVerify);
+    return true;
+
+LABEL_ERROR:
+    LOGE("fail: read message(type=%04x)\n", Type);
+    UTL_DBG_FREE(p_job);
+    return false;
+}
+
+
+bool ln_anno_verify_is_busy(void)
+{
+    return mBusy;
+}
+
+
+void ln_anno_verify_flush(void)
+{
+    pthread_mutex_lock(&mMuxVerify);
+    while ((mQueued > 0) || (mInFlight > 0)) {
+        pthread_cond_wait(&mCondDone, &mMuxVerify);
+    }
+    pthread_mutex_unlock(&mMuxVerify);
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** dispatcher thread
+ *
+ * queueからbatchを取り出し、workerで検証した後に保存関数に渡す。
+ */
+static void *thread_dispatch(void *pArg)
+{
+    (void)pArg;
+
+    pthread_mutex_lock(&mMuxVerify);
+    for (;;) {
+        while ((mQueued == 0) && !mDispatchStop) {
+            pthread_cond_wait(&mCondQueue, &mMuxVerify);
+        }
+        if (mQueued == 0) {
+            break;
+        }
+
+        int num = 0;
+        while ((mpHead != NULL) && (num < LN_ANNO_VERIFY_BATCH_MAX)) {
+            mpBatch[num++] = mpHead;
+            mpHead = mpHead->p_next;
+        }
+        if (mpHead == NULL) {
+            mpTail = NULL;
+        }
+        mQueued -= num;
+        mInFlight = num;
+        if (mBusy && (mQueued <= LN_ANNO_VERIFY_QUEUE_RESUME)) {
+            LOGD("resume: queue=%d\n", mQueued);
+            mBusy = false;
+        }
+        pthread_mutex_unlock(&mMuxVerify);
+
+        batch_resolve_node_id(num);
+        batch_verify(num);
+
+        int invalid = 0;
+        for (int lp = 0; lp < num; lp++) {
+            anno_job_t *p_job = mpBatch[lp];
+            if (p_job->valid) {
+                (*mFunc.p_store)(p_job->type, p_job->data, p_job->len, p_job->b_send_id ? p_job->send_id : NULL);
+            } else {
+                invalid++;
+            }
+            UTL_DBG_FREE(p_job);
+        }
+        if (invalid > 0) {
+            LOGD("batch=%d, invalid=%d\n", num, invalid);
+        }
+
+        pthread_mutex_lock(&mMuxVerify);
+        mInFlight = 0;
+        pthread_cond_broadcast(&mCondDone);
+    }
+    pthread_mutex_unlock(&mMuxVerify);
+    return NULL;
+}
+
+
+/** worker thread
+ *
+ */
+static void *thread_worker(void *pArg)
+{
+    (void)pArg;
+    uint32_t seq = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&mMuxVerify);
+        while ((seq == mBatchSeq) && !mWorkerStop) {
+            pthread_cond_wait(&mCondWork, &mMuxVerify);
+        }
+        if (mWorkerStop) {
+            pthread_mutex_unlock(&mMuxVerify);
+            break;
+        }
+        seq = mBatchSeq;
+        int num = mBatchNum;
+        pthread_mutex_unlock(&mMuxVerify);
+
+        for (;;) {
+            int idx = __atomic_fetch_add(&mBatchNext, 1, __ATOMIC_RELAXED);
+            if (idx >= num) {
+                break;
+            }
+            mpBatch[idx]->valid = job_verify(mpBatch[idx]);
+        }
+
+        pthread_mutex_lock(&mMuxVerify);
+        mBatchRemain--;
+        if (mBatchRemain == 0) {
+            pthread_cond_signal(&mCondBatch);
+        }
+        pthread_mutex_unlock(&mMuxVerify);
+    }
+    return NULL;
+}
+
+
+/** channel_updateの署名者決定
+ *
+ * 同じbatch内の先行するchannel_announcement > 保存済みchannel_announcement > push時の指定 の順。
+ */
+static void batch_resolve_node_id(int Num)
+{
+    for (int lp = 0; lp < Num; lp++) {
+        anno_job_t *p_upd = mpBatch[lp];
+        if (p_upd->type != MSGTYPE_CHANNEL_UPDATE) {
+            continue;
+        }
+
+        bool found = false;
+        for (int lp2 = lp - 1; lp2 >= 0; lp2--) {
+            const anno_job_t *p_anno = mpBatch[lp2];
+            if ( (p_anno->type == MSGTYPE_CHANNEL_ANNOUNCEMENT) &&
+                 (p_anno->short_channel_id == p_upd->short_channel_id) ) {
+                memcpy(p_upd->node_id, p_upd->dir ? p_anno->node_id_2 : p_anno->node_id, BTC_SZ_PUBKEY);
+                found = true;
+                break;
+            }
+        }
+        if (!found && (mFunc.p_node_id != NULL)) {
+            uint8_t node_id[BTC_SZ_PUBKEY];
+            if ((*mFunc.p_node_id)(node_id, p_upd->short_channel_id, p_upd->dir)) {
+                memcpy(p_upd->node_id, node_id, BTC_SZ_PUBKEY);
+                found = true;
+            }
+        }
+        if (found) {
+            p_upd->b_node_id = true;
+        }
+    }
+}
+
+
+/** batchの検証(全workerの完了待ち)
+ *
+ */
+static void batch_verify(int Num)
+{
+    pthread_mutex_lock(&mMuxVerify);
+    mBatchNum = Num;
+    mBatchNext = 0;
+    mBatchRemain = mWorkers;
+    mBatchSeq++;
+    pthread_cond_broadcast(&mCondWork);
+    while (mBatchRemain > 0) {
+        pthread_cond_wait(&mCondBatch, &mMuxVerify);
+    }
+    pthread_mutex_unlock(&mMuxVerify);
+}
+
+
+static bool job_verify(anno_job_t *pJob)
+{
+    switch (pJob->type) {
+    case MSGTYPE_CHANNEL_ANNOUNCEMENT:
+        {
+            ln_msg_channel_announcement_t msg;
+            if (!ln_msg_channel_announcement_read(&msg, pJob->data, pJob->len)) return false;
+            if (!ln_msg_channel_announcement_verify(&msg, pJob->data, pJob->len)) {
+                LOGE("fail: verify channel_announcement: %016" PRIx64 "\n", msg.short_channel_id);
+                return false;
+            }
+        }
+        break;
+    case MSGTYPE_NODE_ANNOUNCEMENT:
+        {
+            ln_msg_node_announcement_t msg;
+            if (!ln_msg_node_announcement_read(&msg, pJob->data, pJob->len)) return false;
+            if (!ln_msg_node_announcement_verify(&msg, pJob->data, pJob->len)) {
+                LOGE("fail: verify node_announcement\n");
+                return false;
+            }
+        }
+        break;
+    case MSGTYPE_CHANNEL_UPDATE:
+        if (!pJob->b_node_id) {
+            //BOLT#11のr field用に、channel_announcementがなくても保存する
+            LOGD("through: not found channel_announcement, but save\n");
+            break;
+        }
+        if (!btc_keys_check_pub(pJob->node_id)) {
+            LOGE("fail: invalid pubkey\n");
+            return false;
+        }
+        if (!ln_msg_channel_update_verify(pJob->node_id, pJob->data, pJob->len)) {
+            LOGE("fail: verify channel_update: %016" PRIx64 ":%d\n", pJob->short_channel_id, pJob->dir);
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
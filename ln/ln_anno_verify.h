@@ -0,0 +1,139 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_anno_verify.h
+ *  @brief  announcement署名検証pipeline
+ *
+ *  受信したchannel_announcement/node_announcement/channel_updateをqueueに積み、
+ *  dispatcher threadが最大#LN_ANNO_VERIFY_BATCH_MAX件ずつ取り出してworker threadで署名検証する。
+ *  検証に成功したものだけを、queueに積んだ順にdispatcher threadから保存関数に渡す。
+ *      - channel_updateの署名者は、同じbatch内の先行するchannel_announcement、
+ *        #ln_anno_verify_func_t.p_node_id、#ln_anno_verify_push()のpNodeIdの順に探す。
+ *        見つからない場合は検証せずに保存関数に渡す(従来どおり)。
+ *      - #ln_anno_verify_push()は待たない。queueが#LN_ANNO_VERIFY_QUEUE_MAX件に達すると
+ *        #ln_anno_verify_is_busy()がtrueになり、#LN_ANNO_VERIFY_QUEUE_RESUME件以下に減るとfalseに戻る。
+ *        呼び出し元はbusyの間、送信元からの受信を止めること。
+ */
+#ifndef LN_ANNO_VERIFY_H__
+#define LN_ANNO_VERIFY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define LN_ANNO_VERIFY_WORKERS_MAX      (16)        ///< worker thread数上限
+#define LN_ANNO_VERIFY_BATCH_MAX        (256)       ///< 1回に検証する最大数
+#define LN_ANNO_VERIFY_QUEUE_MAX        (4096)      ///< 検証待ちがこの数に達するとbusy
+#define LN_ANNO_VERIFY_QUEUE_RESUME     (LN_ANNO_VERIFY_QUEUE_MAX / 2)  ///< 検証待ちがこの数以下になるとbusy解除
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct     ln_anno_verify_func_t
+ *  @brief      検証結果の渡し先
+ *  @note
+ *      - どちらもdispatcher threadから呼び出される
+ */
+typedef struct {
+    /** channel_updateの署名者取得(保存済みchannel_announcementから)
+     *
+     * @param[out]  pNodeId         node_id
+     * @param[in]   ShortChannelId  short_channel_id
+     * @param[in]   Dir             channel_updateのdirection
+     * @retval  true    取得成功
+     */
+    bool (*p_node_id)(uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir);
+
+    /** 検証済みannouncementの保存
+     *
+     * @param[in]   Type            message type
+     * @param[in]   pData           message
+     * @param[in]   Len             pData長
+     * @param[in]   pSendId         送信元node_id(NULL: なし)
+     */
+    void (*p_store)(uint16_t Type, const uint8_t *pData, uint16_t Len, const uint8_t *pSendId);
+} ln_anno_verify_func_t;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** 検証pipeline開始
+ *
+ * @param[in]   Workers     worker thread数(1～#LN_ANNO_VERIFY_WORKERS_MAX)
+ * @param[in]   pFunc       検証結果の渡し先(#ln_anno_verify_stop()まで保持する)
+ * @retval  true    成功
+ */
+bool ln_anno_verify_start(int Workers, const ln_anno_verify_func_t *pFunc);
+
+
+/** 検証pipeline停止
+ *
+ * queueに残っているannouncementは検証・保存してから停止する。
+ */
+void ln_anno_verify_stop(void);
+
+
+/** announcementを検証queueに積む
+ *
+ * pData, pSendId, pNodeIdはコピーする。
+ * busy中でもqueueに積む(待たない)。
+ *
+ * @param[in]   Type        message type(channel_announcement/node_announcement/channel_update)
+ * @param[in]   pData       message(読込済みであること)
+ * @param[in]   Len         pData長
+ * @param[in]   pSendId     送信元node_id(NULL: なし)
+ * @param[in]   pNodeId     channel_updateの署名者が他で見つからない場合に使うnode_id(NULL: なし)
+ * @retval  true    queueに積んだ
+ * @retval  false   停止中(呼び出し元で検証・保存すること)またはmessage不正
+ */
+bool ln_anno_verify_push(uint16_t Type, const uint8_t *pData, uint16_t Len, const uint8_t *pSendId, const uint8_t *pNodeId);
+
+
+/** 検証queueが混んでいるか
+ *
+ * @retval  true    busy(announcementを受信するsocketの読込みを止めること)
+ */
+bool ln_anno_verify_is_busy(void);
+
+
+/** queueに積んだannouncementの保存完了待ち
+ *
+ */
+void ln_anno_verify_flush(void);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* LN_ANNO_VERIFY_H__ */
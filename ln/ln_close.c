@@ -51,6 +51,7 @@
 #include "ln_setupctl.h"
 #include "ln_anno.h"
 #include "ln_close.h"
+#include "ln_routing.h"
 
 
 /**************************************************************************
@@ -234,6 +235,7 @@ bool HIDDEN ln_closing_signed_send(ln_channel_t *pChannel, ln_msg_closing_signed
     if (pClosingSignedMsg) {
         //XXX: send the same fee now
         pChannel->status = LN_STATUS_CLOSE_WAIT;
+        ln_routing_channel_del(pChannel->short_channel_id);
     }
     M_DB_CHANNEL_SAVE(pChannel);
     return true;
@@ -314,6 +316,7 @@ bool HIDDEN ln_closing_signed_recv(ln_channel_t *pChannel, const uint8_t *pData,
 
         pChannel->status = LN_STATUS_CLOSE_WAIT;
         M_DB_CHANNEL_SAVE(pChannel);
+        ln_routing_channel_del(pChannel->short_channel_id);
     } else {
         LOGD("different fee!\n");
 
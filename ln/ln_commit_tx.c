@@ -46,20 +46,41 @@
 #include "ln_commit_tx.h"
 #include "ln_commit_tx_util.h"
 #include "ln_htlc_tx.h"
+#include "ln_crypto_pool.h"
 
 
-/**************************************************************************
+/********************************************************************
  * typedefs
- **************************************************************************/
+ ********************************************************************/
 
-/** #search_preimage()用
- *
+/** @struct htlc_verify_job_t
+ *  @brief  受信したHTLC署名の検証job(#ln_crypto_pool_run())
+ */
+typedef struct {
+    const ln_commit_info_t          *p_commit_info;
+    const uint8_t                   *p_htlc_sig;
+    const btc_tx_t                  *p_tx_commit;
+    const utl_buf_t                 *p_wit_script_to_local;
+    const ln_commit_tx_htlc_info_t  *p_htlc_info;
+    const ln_derkey_local_keys_t    *p_keys_local;
+    uint64_t                        fee;
+    uint32_t                        vout_idx;
+} htlc_verify_job_t;
+
+
+/** @struct htlc_sign_job_t
+ *  @brief  送信するHTLC署名の作成job(#ln_crypto_pool_run())
  */
 typedef struct {
-    uint8_t         *image;             ///< [out]preimage
-    const uint8_t   *hash;              ///< [in]payment_hash
-    bool            b_closing;          ///< true:一致したexpiryをUINT32_MAXに変更する
-} preimage_t;
+    const ln_commit_info_t          *p_commit_info;
+    uint8_t                         *p_htlc_sig;        ///< [out]HTLC署名
+    const btc_tx_t                  *p_tx_commit;
+    const utl_buf_t                 *p_wit_script_to_local;
+    const ln_commit_tx_htlc_info_t  *p_htlc_info;
+    const btc_keys_t                *p_htlc_key;
+    uint64_t                        fee;
+    uint32_t                        vout_idx;
+} htlc_sign_job_t;
 
 
 /********************************************************************
@@ -104,6 +125,8 @@ static bool create_local_verify_htlc(
     uint64_t Amount,
     const ln_derkey_local_keys_t *pKeysLocal);
 
+static bool create_local_verify_htlc_job(void *pJob);
+
 //local close
 static bool create_local_spend_tx(
     const ln_commit_info_t *pCommitInfo,
@@ -160,6 +183,8 @@ static bool create_remote_sign_htlc(
     uint64_t Fee,
     uint32_t VoutIdx);
 
+static bool create_remote_sign_htlc_job(void *pJob);
+
 //remote close
 static bool create_remote_spend_tx(
     const ln_commit_info_t *pCommitInfo,
@@ -182,7 +207,6 @@ static bool create_remote_spend_htlc_output_tx(
     const uint8_t *pPaymentHash);
 
 static bool search_preimage(uint8_t *pPreimage, const uint8_t *pPaymentHash, bool bClosing);
-static bool search_preimage_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *p_db_param, void *p_param);
 static bool save_vouts_remote(const ln_commit_tx_info_t *pCommitTxInfo);
 
 
@@ -792,26 +816,17 @@ static bool create_local_set_vin0_and_verify(
 {
     LOGD("local verify\n");
 
-    bool ret = false;
-
-    utl_buf_t script_code = UTL_BUF_INIT;
     uint8_t sighash[BTC_SZ_HASH256];
 
     //set vin[0]
     if (!ln_commit_tx_set_vin_p2wsh_2of2_rs(
-        pTxCommit, 0, pFundingInfo->key_order, pSigLocal, pSigRemote, &pFundingInfo->wit_script)) goto LABEL_EXIT;
+        pTxCommit, 0, pFundingInfo->key_order, pSigLocal, pSigRemote, &pFundingInfo->wit_script)) return false;
     M_DBG_PRINT_TX(pTxCommit);
 
     //verify
-    if (!btc_script_p2wsh_create_scriptcode(&script_code, &pFundingInfo->wit_script)) goto LABEL_EXIT;
-    if (!btc_sw_sighash(pTxCommit, sighash, 0, pFundingInfo->funding_satoshis, &script_code)) goto LABEL_EXIT;
-    if (!btc_sw_verify_p2wsh_2of2(pTxCommit, 0, sighash, &pFundingInfo->tx_data.vout[pFundingInfo->txindex].script)) goto LABEL_EXIT;
-
-    ret = true;
-
-LABEL_EXIT:
-    utl_buf_free(&script_code);
-    return ret;
+    if (!btc_sw_sighash_p2wsh_wit(pTxCommit, sighash, 0, pFundingInfo->funding_satoshis, &pFundingInfo->wit_script)) return false;
+    if (!btc_sw_verify_p2wsh_2of2(pTxCommit, 0, sighash, &pFundingInfo->tx_data.vout[pFundingInfo->txindex].script)) return false;
+    return true;
 }
 
 
@@ -927,8 +942,11 @@ static bool create_local_spend_tx(
  *              create HTLC tx
  *              commitment_signedで受信したhtlc_signatureのverify
  *              HTLC txのverify
- *              verify失敗ならbreak
- *              signatureの保存
+ *  全HTLCのverify成功後
+ *      signatureの保存
+ *
+ * HTLC tx作成とverifyは#ln_crypto_pool_run()でHTLCごとに並行して行う。
+ * 1つでもverifyに失敗したら、どのHTLCにも署名を保存しない。
  *
  * @param[in]       pCommitInfo
  * @param[in]       pHtlcSigs
@@ -945,6 +963,10 @@ static bool create_local_verify_htlcs(
     const ln_commit_tx_info_t *pCommitTxInfo,
     const ln_derkey_local_keys_t *pKeysLocal)
 {
+    if (pCommitTxInfo->num_htlc_outputs == 0) return true;
+    htlc_verify_job_t *p_jobs = (htlc_verify_job_t *)UTL_DBG_MALLOC(sizeof(htlc_verify_job_t) * pCommitTxInfo->num_htlc_outputs);
+    if (!p_jobs) return false;
+
     uint16_t htlc_num = 0;
     for (uint32_t vout_idx = 0; vout_idx < pTxCommit->vout_cnt; vout_idx++) {
         uint16_t htlc_idx = pTxCommit->vout[vout_idx].opt;
@@ -964,28 +986,31 @@ static bool create_local_verify_htlcs(
 
         LOGD("+++[%d]%s HTLC\n", vout_idx, (p_htlc_info->type == LN_COMMIT_TX_OUTPUT_TYPE_OFFERED) ? "offered" : "received");
         assert(pTxCommit->vout[vout_idx].value >= pCommitTxInfo->base_fee_info.dust_limit_satoshi + fee_sat);
+        assert(htlc_num < pCommitTxInfo->num_htlc_outputs);
+
+        htlc_verify_job_t *p_job = &p_jobs[htlc_num];
+        p_job->p_commit_info = pCommitInfo;
+        p_job->p_htlc_sig = pHtlcSigs[htlc_num];
+        p_job->p_tx_commit = pTxCommit;
+        p_job->p_wit_script_to_local = &pCommitTxInfo->to_local.wit_script;
+        p_job->p_htlc_info = p_htlc_info;
+        p_job->p_keys_local = pKeysLocal;
+        p_job->fee = fee_sat;
+        p_job->vout_idx = vout_idx;
+        htlc_num++;
+    }
 
-        btc_tx_t tx = BTC_TX_INIT;
-        if (!ln_htlc_tx_create(
-            &tx, (pTxCommit->vout[vout_idx].value - fee_sat), &pCommitTxInfo->to_local.wit_script,
-            p_htlc_info->type, p_htlc_info->cltv_expiry, pCommitInfo->txid, vout_idx)) {
-            btc_tx_free(&tx);
-            return false;
-        }
-        if (!create_local_verify_htlc(
-            &tx, pHtlcSigs[htlc_num], &p_htlc_info->wit_script, pTxCommit->vout[vout_idx].value,
-            pKeysLocal)) {
-            btc_tx_free(&tx);
-            return false;
-        }
+    bool ret = ln_crypto_pool_run(create_local_verify_htlc_job, p_jobs, sizeof(htlc_verify_job_t), htlc_num);
+    if (ret) {
         //XXX: save the commitment_signed message?
         //OKなら各HTLCに保持
         //  相手がunilateral closeした後に送信しなかったら、この署名を使う
-        memcpy(pUpdateInfo->htlcs[p_htlc_info->htlc_idx].remote_sig, pHtlcSigs + htlc_num * LN_SZ_SIGNATURE, LN_SZ_SIGNATURE);
-        btc_tx_free(&tx);
-        htlc_num++;
+        for (uint16_t lp = 0; lp < htlc_num; lp++) {
+            memcpy(pUpdateInfo->htlcs[p_jobs[lp].p_htlc_info->htlc_idx].remote_sig, p_jobs[lp].p_htlc_sig, LN_SZ_SIGNATURE);
+        }
     }
-    return true;
+    UTL_DBG_FREE(p_jobs);
+    return ret;
 }
 
 
@@ -1041,6 +1066,33 @@ static bool create_local_verify_htlc(
 }
 
 
+/** HTLC tx作成とHTLC署名のverify(#htlc_verify_job_t)
+ *
+ */
+static bool create_local_verify_htlc_job(void *pJob)
+{
+    const htlc_verify_job_t *p_job = (const htlc_verify_job_t *)pJob;
+    const btc_tx_t *p_tx_commit = p_job->p_tx_commit;
+    uint32_t vout_idx = p_job->vout_idx;
+
+    btc_tx_t tx = BTC_TX_INIT;
+    if (!ln_htlc_tx_create(
+        &tx, (p_tx_commit->vout[vout_idx].value - p_job->fee), p_job->p_wit_script_to_local,
+        p_job->p_htlc_info->type, p_job->p_htlc_info->cltv_expiry, p_job->p_commit_info->txid, vout_idx)) {
+        btc_tx_free(&tx);
+        return false;
+    }
+    if (!create_local_verify_htlc(
+        &tx, p_job->p_htlc_sig, &p_job->p_htlc_info->wit_script, p_tx_commit->vout[vout_idx].value,
+        p_job->p_keys_local)) {
+        btc_tx_free(&tx);
+        return false;
+    }
+    btc_tx_free(&tx);
+    return true;
+}
+
+
 static bool create_local_htlc_tx(
     btc_tx_t *pTxHtlc,
     uint64_t Amount,
@@ -1322,6 +1374,19 @@ static bool create_remote_spend_tx(
 }
 
 
+/** remote commit_txのHTLC署名作成 (commitment_signed)
+ *
+ * HTLC tx作成と署名は#ln_crypto_pool_run()でHTLCごとに並行して行う。
+ * 署名はvout順にpHtlcSigsに書き込む。
+ *
+ * @param[in]       pCommitInfo
+ * @param[out]      pHtlcSigs           HTLC署名(num_htlc_outputs個)
+ * @param[in]       pTxCommit
+ * @param[in]       pCommitTxInfo
+ * @param[in]       pKeysLocal
+ * @param[in]       pKeysRemote
+ * @retval  true    成功
+ */
 static bool create_remote_sign_htlcs(
     const ln_commit_info_t *pCommitInfo,
     uint8_t (*pHtlcSigs)[LN_SZ_SIGNATURE],
@@ -1335,6 +1400,10 @@ static bool create_remote_sign_htlcs(
     btc_keys_t htlckey;
     if (!ln_signer_htlc_remotekey(&htlckey, pKeysLocal, pKeysRemote)) return false;
 
+    if (pCommitTxInfo->num_htlc_outputs == 0) return true;
+    htlc_sign_job_t *p_jobs = (htlc_sign_job_t *)UTL_DBG_MALLOC(sizeof(htlc_sign_job_t) * pCommitTxInfo->num_htlc_outputs);
+    if (!p_jobs) return false;
+
     for (uint32_t vout_idx = 0; vout_idx < pTxCommit->vout_cnt; vout_idx++) {
         uint16_t htlc_idx = pTxCommit->vout[vout_idx].opt;
 
@@ -1346,22 +1415,28 @@ static bool create_remote_sign_htlcs(
             LOGD("---[%d]to_remote\n", vout_idx);
             continue;
         }
+        assert(htlc_num < pCommitTxInfo->num_htlc_outputs);
         const ln_commit_tx_htlc_info_t *p_htlc_info = pCommitTxInfo->pp_htlc_info[htlc_idx];
         uint64_t fee_sat =
             (p_htlc_info->type == LN_COMMIT_TX_OUTPUT_TYPE_OFFERED) ?
             pCommitTxInfo->base_fee_info.htlc_timeout_fee :
             pCommitTxInfo->base_fee_info.htlc_success_fee;
 
-        if (!create_remote_sign_htlc(
-            pCommitInfo, pHtlcSigs[htlc_num], pTxCommit,
-            &pCommitTxInfo->to_local.wit_script, p_htlc_info,
-            &htlckey, fee_sat, vout_idx)) {
-            LOGE("fail: sign vout[%d]\n", vout_idx);
-            return false;
-        }
+        htlc_sign_job_t *p_job = &p_jobs[htlc_num];
+        p_job->p_commit_info = pCommitInfo;
+        p_job->p_htlc_sig = pHtlcSigs[htlc_num];
+        p_job->p_tx_commit = pTxCommit;
+        p_job->p_wit_script_to_local = &pCommitTxInfo->to_local.wit_script;
+        p_job->p_htlc_info = p_htlc_info;
+        p_job->p_htlc_key = &htlckey;
+        p_job->fee = fee_sat;
+        p_job->vout_idx = vout_idx;
         htlc_num++;
     }
-    return true;
+
+    bool ret = ln_crypto_pool_run(create_remote_sign_htlc_job, p_jobs, sizeof(htlc_sign_job_t), htlc_num);
+    UTL_DBG_FREE(p_jobs);
+    return ret;
 }
 
 
@@ -1409,6 +1484,23 @@ LABEL_EXIT:
 }
 
 
+/** HTLC署名作成(#htlc_sign_job_t)
+ *
+ */
+static bool create_remote_sign_htlc_job(void *pJob)
+{
+    const htlc_sign_job_t *p_job = (const htlc_sign_job_t *)pJob;
+    if (!create_remote_sign_htlc(
+        p_job->p_commit_info, p_job->p_htlc_sig, p_job->p_tx_commit,
+        p_job->p_wit_script_to_local, p_job->p_htlc_info,
+        p_job->p_htlc_key, p_job->fee, p_job->vout_idx)) {
+        LOGE("fail: sign vout[%d]\n", p_job->vout_idx);
+        return false;
+    }
+    return true;
+}
+
+
 /** remote HTLCからの送金先情報作成
  *
  *  1. HTLC tx作成
@@ -1520,37 +1612,8 @@ static bool search_preimage(uint8_t *pPreimage, const uint8_t *pPaymentHash, boo
     // LOGD("pPaymentHash(%d)=", bClosing);
     // DUMPD(pPaymentHash, BTC_SZ_HASH256);
 
-    preimage_t param;
-    param.image = pPreimage;
-    param.hash = pPaymentHash;
-    param.b_closing = bClosing;
-    if (!ln_db_preimage_search(search_preimage_func, &param)) return false;
-    return true;
-}
-
-
-/** search_preimage用処理関数
- *
- * SHA256(preimage)がpayment_hashと一致した場合にtrueを返す。
- * bClosingがtrueの場合、該当するpreimageのexpiryをUINT32_MAXにする(自動削除させないため)。
- */
-static bool search_preimage_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *p_db_param, void *p_param)
-{
-    (void)Amount; (void)Expiry;
-
-    preimage_t *param = (preimage_t *)p_param;
-
-    //LOGD("compare preimage : ");
-    //DUMPD(pPreimage, LN_SZ_PREIMAGE);
-    uint8_t payment_hash[BTC_SZ_HASH256];
-    ln_payment_hash_calc(payment_hash, pPreimage);
-    if (memcmp(payment_hash, param->hash, BTC_SZ_HASH256)) return false;
-    //LOGD("preimage match!: ");
-    //DUMPD(pPreimage, LN_SZ_PREIMAGE);
-    memcpy(param->image, pPreimage, LN_SZ_PREIMAGE);
-    if (param->b_closing && Expiry != UINT32_MAX) {
-        //期限切れによる自動削除をしない
-        ln_db_preimage_set_expiry(p_db_param, UINT32_MAX); //XXX:
-    }
+    ln_db_preimage_t preimage;
+    if (!ln_db_preimage_search_hash(&preimage, pPaymentHash, bClosing)) return false;
+    memcpy(pPreimage, preimage.preimage, LN_SZ_PREIMAGE);
     return true;
 }
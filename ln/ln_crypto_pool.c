@@ -0,0 +1,257 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_crypto_pool.c
+ *  @brief  署名・検証用worker pool
+ *
+ *  #ln_crypto_pool_run()ごとにbatchをqueueに積み、worker threadと呼び出し元threadで
+ *  batchのjobを先頭から1つずつ取り合って処理する。
+ *  batchは呼び出し元のstack上にあり、全jobの完了を待ってから戻る。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "utl_dbg.h"
+
+#include "ln_local.h"
+#include "ln_crypto_pool.h"
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct pool_batch_t
+ *  @brief  #ln_crypto_pool_run() 1回分のjob
+ */
+typedef struct pool_batch_t {
+    TAILQ_ENTRY(pool_batch_t)   list;
+    ln_crypto_pool_func_t       func;
+    uint8_t                     *p_jobs;
+    size_t                      job_size;
+    int                         num;
+    int                         next;       ///< 次に処理するjob index
+    int                         done;       ///< 処理を終えたjob数
+    bool                        result;     ///< false: 失敗したjobあり
+} pool_batch_t;
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static pthread_mutex_t      mMuxPool = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       mCondWork = PTHREAD_COND_INITIALIZER;   ///< worker: batch追加
+static pthread_cond_t       mCondDone = PTHREAD_COND_INITIALIZER;   ///< run: job完了
+
+static bool                 mRunning;
+static bool                 mWorkerStop;        ///< worker停止要求(queueを空にしてから停止)
+static int                  mWorkers;
+static pthread_t            mThWorker[LN_CRYPTO_POOL_WORKERS_MAX];
+
+static TAILQ_HEAD(pool_batch_head_t, pool_batch_t)  mBatchHead = TAILQ_HEAD_INITIALIZER(mBatchHead);
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static void *thread_worker(void *pArg);
+static int batch_take(pool_batch_t *pBatch, bool *pExec);
+static void batch_exec(pool_batch_t *pBatch, int Idx, bool bExec);
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+bool ln_crypto_pool_start(int Workers)
+{
+    if ((Workers < 1) || (LN_CRYPTO_POOL_WORKERS_MAX < Workers)) {
+        LOGE("fail: invalid param(workers=%d)\n", Workers);
+        return false;
+    }
+
+    pthread_mutex_lock(&mMuxPool);
+    if (mRunning) {
+        pthread_mutex_unlock(&mMuxPool);
+        LOGE("fail: already started\n");
+        return false;
+    }
+    mWorkers = Workers;
+    mWorkerStop = false;
+    for (int lp = 0; lp < Workers; lp++) {
+        pthread_create(&mThWorker[lp], NULL, thread_worker, NULL);
+    }
+    mRunning = true;
+    pthread_mutex_unlock(&mMuxPool);
+
+    LOGD("workers=%d\n", Workers);
+    return true;
+}
+
+
+void ln_crypto_pool_stop(void)
+{
+    pthread_mutex_lock(&mMuxPool);
+    if (!mRunning) {
+        pthread_mutex_unlock(&mMuxPool);
+        return;
+    }
+    mRunning = false;
+    mWorkerStop = true;
+    pthread_cond_broadcast(&mCondWork);
+    pthread_mutex_unlock(&mMuxPool);
+
+    for (int lp = 0; lp < mWorkers; lp++) {
+        pthread_join(mThWorker[lp], NULL);
+    }
+    LOGD("stop\n");
+}
+
+
+bool ln_crypto_pool_run(ln_crypto_pool_func_t pFunc, void *pJobs, size_t JobSize, int Num)
+{
+    pool_batch_t batch;
+    batch.func = pFunc;
+    batch.p_jobs = (uint8_t *)pJobs;
+    batch.job_size = JobSize;
+    batch.num = Num;
+    batch.next = 0;
+    batch.done = 0;
+    batch.result = true;
+
+    pthread_mutex_lock(&mMuxPool);
+    if (!mRunning || (Num <= 1)) {
+        //呼び出し元threadで順に処理する
+        pthread_mutex_unlock(&mMuxPool);
+        for (int lp = 0; lp < Num; lp++) {
+            if (!(*pFunc)(batch.p_jobs + JobSize * lp)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    TAILQ_INSERT_TAIL(&mBatchHead, &batch, list);
+    pthread_cond_broadcast(&mCondWork);
+
+    //呼び出し元threadも処理する
+    while (batch.next < batch.num) {
+        bool exec;
+        int idx = batch_take(&batch, &exec);
+        pthread_mutex_unlock(&mMuxPool);
+        batch_exec(&batch, idx, exec);
+        pthread_mutex_lock(&mMuxPool);
+    }
+    while (batch.done < batch.num) {
+        pthread_cond_wait(&mCondDone, &mMuxPool);
+    }
+    pthread_mutex_unlock(&mMuxPool);
+
+    if (!batch.result) {
+        LOGE("fail: num=%d\n", Num);
+    }
+    return batch.result;
+}
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** worker thread
+ *
+ */
+static void *thread_worker(void *pArg)
+{
+    (void)pArg;
+
+    pthread_mutex_lock(&mMuxPool);
+    for (;;) {
+        while (TAILQ_EMPTY(&mBatchHead) && !mWorkerStop) {
+            pthread_cond_wait(&mCondWork, &mMuxPool);
+        }
+        if (TAILQ_EMPTY(&mBatchHead)) {
+            break;
+        }
+
+        pool_batch_t *p_batch = TAILQ_FIRST(&mBatchHead);
+        bool exec;
+        int idx = batch_take(p_batch, &exec);
+        pthread_mutex_unlock(&mMuxPool);
+        batch_exec(p_batch, idx, exec);
+        pthread_mutex_lock(&mMuxPool);
+    }
+    pthread_mutex_unlock(&mMuxPool);
+    return NULL;
+}
+
+
+/** 次に処理するjob取得(mMuxPool lock中に呼ぶ)
+ *
+ * 最後のjobを取ったbatchはqueueから外す。
+ *
+ * @param[in,out]   pBatch      batch
+ * @param[out]      pExec       false: 失敗したjobがあるので処理しない
+ * @return  job index
+ */
+static int batch_take(pool_batch_t *pBatch, bool *pExec)
+{
+    int idx = pBatch->next++;
+    if (pBatch->next == pBatch->num) {
+        TAILQ_REMOVE(&mBatchHead, pBatch, list);
+    }
+    *pExec = pBatch->result;
+    return idx;
+}
+
+
+/** job処理
+ *
+ * 全jobの処理を終えたら呼び出し元threadを起こす。
+ * pBatchは呼び出し元threadのstack上にあるため、完了を通知した後は参照しない。
+ *
+ * @param[in,out]   pBatch      batch
+ * @param[in]       Idx         job index
+ * @param[in]       bExec       false: 処理せずに完了扱いにする
+ */
+static void batch_exec(pool_batch_t *pBatch, int Idx, bool bExec)
+{
+    bool ret = true;
+    if (bExec) {
+        ret = (*pBatch->func)(pBatch->p_jobs + pBatch->job_size * Idx);
+    }
+
+    pthread_mutex_lock(&mMuxPool);
+    if (!ret) {
+        pBatch->result = false;
+    }
+    pBatch->done++;
+    if (pBatch->done == pBatch->num) {
+        pthread_cond_broadcast(&mCondDone);
+    }
+    pthread_mutex_unlock(&mMuxPool);
+}
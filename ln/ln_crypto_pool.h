@@ -0,0 +1,101 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_crypto_pool.h
+ *  @brief  署名・検証用worker pool
+ *
+ *  commitment_signedのHTLC署名・検証など、互いに独立した処理の配列をworker threadで並行に処理する。
+ *      - 複数のchannel threadから同時に呼び出してよい(worker poolは共有する)。
+ *      - 各jobは自分の要素にだけ結果を書くので、結果は処理順に依らない。
+ *      - 1つでも失敗したら全体を失敗とする。
+ *      - #ln_crypto_pool_start()していない場合は呼び出し元threadで順に処理する。
+ */
+#ifndef LN_CRYPTO_POOL_H__
+#define LN_CRYPTO_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define LN_CRYPTO_POOL_WORKERS_MAX      (16)        ///< worker thread数上限
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** job処理関数
+ *
+ * worker threadまたは呼び出し元threadから呼び出される。
+ *
+ * @param[in,out]   pJob        job(#ln_crypto_pool_run()のpJobsの1要素)
+ * @retval  true    成功
+ */
+typedef bool (*ln_crypto_pool_func_t)(void *pJob);
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** worker pool開始
+ *
+ * @param[in]   Workers     worker thread数(1～#LN_CRYPTO_POOL_WORKERS_MAX)
+ * @retval  true    成功
+ */
+bool ln_crypto_pool_start(int Workers);
+
+
+/** worker pool停止
+ *
+ * 処理中のjobは最後まで処理してから停止する。
+ */
+void ln_crypto_pool_stop(void);
+
+
+/** jobの並行処理(全job完了待ち)
+ *
+ * 呼び出し元threadもjobを処理する。
+ * 失敗したjobがあると、まだ始めていないjobは処理しない。
+ *
+ * @param[in]       pFunc       job処理関数
+ * @param[in,out]   pJobs       job配列
+ * @param[in]       JobSize     job 1要素のサイズ
+ * @param[in]       Num         job数
+ * @retval  true    全job成功
+ */
+bool ln_crypto_pool_run(ln_crypto_pool_func_t pFunc, void *pJobs, size_t JobSize, int Num);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* LN_CRYPTO_POOL_H__ */
@@ -44,6 +44,8 @@ extern "C" {
 #define LN_DB_CNLANNO_UPD0          'B'     ///< channel_announcement用KEYの末尾: channel_update dir=0
 #define LN_DB_CNLANNO_UPD1          'C'     ///< channel_announcement用KEYの末尾: channel_update dir=1
 
+#define LN_DB_ROUTE_SKIP_TEMP_SEC   (3600)  ///< 一時的なskipの有効期間[sec](#ln_db_route_skip_save())
+
 #define LN_DB_WALLET_TYPE_TO_LOCAL      ((uint8_t)1)
 #define LN_DB_WALLET_TYPE_TO_REMOTE     ((uint8_t)2)
 #define LN_DB_WALLET_TYPE_HTLC_OUTPUT   ((uint8_t)3)
@@ -160,10 +162,31 @@ typedef bool (*ln_db_func_preimage_t)(const uint8_t *pPreimage, uint64_t Amount,
 typedef bool (*ln_db_func_wallet_t)(const ln_db_wallet_t *pWallet, void *pParam);
 
 
+/** @typedef    ln_db_func_route_skip_t
+ *  @brief      読込み関数(#ln_db_route_skip_load())
+ *
+ * @param[in]       ShortChannelId  short_channel_id
+ * @param[in]       Type            LN_DB_ROUTE_SKIP_TEMP/PERM/WORK
+ * @param[in]       Expiry          有効期限(epoch time, 0:期限なし)
+ * @param[in]       pParam          #ln_db_route_skip_load()に渡したデータポインタ
+ */
+typedef void (*ln_db_func_route_skip_t)(uint64_t ShortChannelId, ln_db_route_skip_t Type, uint64_t Expiry, void *pParam);
+
+
 /********************************************************************
  * prototypes
  ********************************************************************/
 
+/** 最大channel数設定
+ *
+ * channel数に比例するDB数の上限とDBサイズ(mapsize)を決める。#ln_db_init()より前に呼び出すこと。
+ * 呼び出さない場合はMAX_CHANNELSを使用する。
+ *
+ * @param[in]   MaxChannels     最大channel数
+ */
+void ln_db_set_max_channels(uint32_t MaxChannels);
+
+
 /** DB初期化
  *
  * DBを使用できるようにする。
@@ -208,6 +231,9 @@ bool ln_db_have_db_dir(void);
 
 
 /** channel情報書き込み
+ *
+ * 前回の保存内容をpChannel->p_db_savedに保持し、変化した項目とHTLCだけを1 transactionで書き込む。
+ * 初回、または #ln_db_channel_save_reset() 後は全項目を書き込む。
  *
  * @param[in]       pChannel
  * @retval      true    成功
@@ -215,6 +241,15 @@ bool ln_db_have_db_dir(void);
 bool ln_db_channel_save(const ln_channel_t *pChannel);
 
 
+/** channel情報の差分保存用データ解放
+ *
+ * 次回の #ln_db_channel_save() は全項目を書き込む。
+ *
+ * @param[in,out]   pChannel
+ */
+void ln_db_channel_save_reset(ln_channel_t *pChannel);
+
+
 /** channel削除(channel_id指定)
  *
  * @param[in]       pChannelId      削除するpChannelのchannel_id
@@ -357,10 +392,12 @@ bool ln_db_cnlanno_load(utl_buf_t *pCnlAnno, uint64_t ShortChannelId);
 
 
 /** channel_announcement書込み
+ *
+ * 新規の場合はgossip logにも追加する。
  *
  * @param[in]       pCnlAnno
  * @param[in]       ShortChannelId  pCnlAnnoのshort_channel_id
- * @param[in]       pSendId         pCnlAnnoの送信元/先node_id
+ * @param[in]       pSendId         pCnlAnnoの送信元node_id(NULL: 自channel)
  * @param[in]       pNodeId1        channel_announcementのnode_id1
  * @param[in]       pNodeId2        channel_announcementのnode_id2
  * @retval      true    成功
@@ -382,10 +419,12 @@ bool ln_db_cnlupd_load(utl_buf_t *pCnlUpd, uint32_t *pTimeStamp, uint64_t ShortC
 
 
 /** channel_update書込み
+ *
+ * 新規または更新した場合はgossip logにも追加する。
  *
  * @param[in]       pCnlUpd             channel_updateパケット
  * @param[in]       pUpd                channel_update構造体
- * @param[in]       pSendId             channel_updateの送信元/先ノード
+ * @param[in]       pSendId             channel_updateの送信元ノード(NULL: 自channel)
  * @retval      true    成功
  */
 bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *pUpd, const uint8_t *pSendId);
@@ -400,16 +439,27 @@ bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *
 bool ln_db_cnlupd_need_to_prune(uint64_t Now, uint32_t TimesStamp);
 
 
-/** channel_announcement系の送受信情報削除
+/** channel_announcement/channel_update削除
  *
- * channel_announcement/channel_updateの送信先・受信元ノードIDを削除する。
+ * routing graph, gossip logからも削除する。
  *
- * @param[in]       short_channel_id(0の場合、全削除)
+ * @param[in]       ShortChannelId
  * @retval      true    成功
  */
 bool ln_db_cnlanno_del(uint64_t ShortChannelId);
 
 
+/** channel_update削除
+ *
+ * routing graph, gossip logからも削除する。
+ *
+ * @param[in]       ShortChannelId
+ * @param[in]       Dir                 0:node1, 1:node2
+ * @retval      true    成功
+ */
+bool ln_db_cnlupd_del(uint64_t ShortChannelId, uint8_t Dir);
+
+
 /********************************************************************
  * node_announcement
  ********************************************************************/
@@ -425,10 +475,12 @@ bool ln_db_nodeanno_load(utl_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8
 
 
 /** node_announcement書込み
+ *
+ * 新規または更新した場合はgossip logにも追加する。
  *
  * @param[in]       pNodeAnno       node_announcementパケット
  * @param[in]       pAnno           node_announcement構造体
- * @param[in]       pSendId         (非NULL)node_announcementの送信元/先ノード
+ * @param[in]       pSendId         node_announcementの送信元ノード(NULL: 自node)
  * @retval      true    成功
  * @note
  *      - タイムスタンプはAPI呼び出し時の値が保存される
@@ -456,30 +508,6 @@ bool ln_db_anno_cur_open(void **ppCur, ln_db_cur_t Type);
 void ln_db_anno_cur_close(void *pCur);
 
 
-/** channel_announcement系の送受信情報追加
- *
- * channel_announcement/channel_updateの送信先・受信元ノードIDを追加する。
- *
- * @param[in,out]   pCur
- * @param[in]       ShortChannelId
- * @param[in]       Type
- * @param[in]       bClear                true:保存したノードを削除してから追加する
- * @param[in]       pNodeId             追加するnode_id
- */
-bool ln_db_cnlanno_info_add_node_id(void *pCur, uint64_t ShortChannelId, char Type, bool bClear, const uint8_t *pNodeId);
-
-
-/** channel_announcement関連情報送信済み検索
- *
- * @param[in]       pCur
- * @param[in]       ShortChannelId      検索するshort_channel_id
- * @param[in]       Type                検索するchannel_announcement/channel_update[1/2]
- * @param[in]       pNodeId             対象node_id
- * @retval  true    pNodeIdへ送信済み
- */
-bool ln_db_cnlanno_info_search_node_id(void *pCur, uint64_t ShortChannelId, char Type, const uint8_t *pNodeId);
-
-
 /** channel_announcement関連情報の順次取得
  *
  * @param[in]       pCur
@@ -512,23 +540,6 @@ bool ln_db_cnlanno_cur_del(void *pCur);
 bool ln_db_nodeanno_cur_load(void *pCur, utl_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8_t *pNodeId);
 
 
-/** node_announcement送信済み検索
- *
- * @retval  true        送信済み
- */
-bool ln_db_nodeanno_info_search_node_id(void *pCur, const uint8_t *pNodeId, const uint8_t *pSendId);
-
-
-/** node_announcement送信元/先ノード追加
- *
- * @param[in,out]   pCur
- * @param[in]       pNodeId
- * @param[in]       bClear                true:保存したノードを削除してから追加する
- * @param[in]       pSendId             送信元/先ノード(NULLでbClear=true時はクリアのみ行う)
- */
-bool ln_db_nodeanno_info_add_node_id(void *pCur, const uint8_t *pNodeId, bool bClear, const uint8_t *pSendId);
-
-
 /** node_announcement順次取得
  *
  * @param[in,out]   pCur            #ln_db_nodeanno_cur_open()でオープンしたDB cursor
@@ -565,39 +576,20 @@ bool ln_db_channel_owned_check(uint64_t ShortChannelId);
 bool ln_db_channel_owned_del(uint64_t ShortChannelId);
 
 
-/********************************************************************
- * cnlanno, nodeanno共通
- ********************************************************************/
-
-/** channel_announcement/channel_update/node_announcement送受信ノード情報削除
- * announcement送信済みnode_idから削除する。
- *
- * @param[in]       pNodeId     削除対象のnode_id(NULL時は全削除)
- * @param[in]       pShortChannelId     (pNodeId非NULL時)削除対象のshort_channel_id(NULL時は全削除)
- * @param[in]       Num                 pShortChannelId数
- */
-bool ln_db_annoinfos_del_node_id(const uint8_t *pNodeId, const uint64_t *pShortChannelId, size_t Num);
-
-
-/** channel_announcement/channel_update/node_announcement送受信ノード情報追加
- * announcement送信済みnode_idに追加する。
- *
- * @param[in]       pNodeId     削除対象のnode_id(NULL時は全削除)
- */
-bool ln_db_annoinfos_add_node_id(const uint8_t *pNodeId);
-
-
 /********************************************************************
  * skip routing list
  ********************************************************************/
 
 /** "route_skip" short_channel_id登録
+ *
+ * Expiryを過ぎたentryは登録されていないものとして扱う(DBからは#ln_db_route_skip_drop()で削除する)。
  *
  * @param[in]   ShortChannelId      登録するshort_channel_id
  * @param[in]   bTemp               true:一時的なskip
+ * @param[in]   Expiry              有効期限(epoch time, 0:期限なし)
  * @retval  true    成功
  */
-bool ln_db_route_skip_save(uint64_t ShortChannelId, bool bTemp);
+bool ln_db_route_skip_save(uint64_t ShortChannelId, bool bTemp, uint64_t Expiry);
 
 
 /** "route_skip" temporary skip <--> temporary work
@@ -615,6 +607,17 @@ bool ln_db_route_skip_work(bool bWork);
 ln_db_route_skip_t ln_db_route_skip_search(uint64_t ShortChannelId);
 
 
+/** "route_skip" 全entry読込み
+ *
+ * 1つのtransactionで読み込む。有効期限を過ぎたentryはcallbackしない。
+ *
+ * @param[in]   pFunc               entryごとに呼び出す関数
+ * @param[in]   pParam              pFuncに渡すデータポインタ
+ * @retval  true    成功(DBが無い場合も含む)
+ */
+bool ln_db_route_skip_load(ln_db_func_route_skip_t pFunc, void *pParam);
+
+
 /** "route_skip" DB削除
  *
  * @param[in]   bTemp               true:一時的なskipのみ削除 / false:全削除
@@ -692,6 +695,19 @@ bool ln_db_preimage_del(const uint8_t *pPreimage);
 bool ln_db_preimage_search(ln_db_func_preimage_t pFunc, void *pFuncParam);
 
 
+/** preimage検索(payment_hash)
+ *
+ * payment_hash indexから検索する(preimageごとのSHA256計算は行わない)。
+ * 期限切れのpreimageは検出しない。
+ *
+ * @param[out]      pPreimage       一致したpreimage
+ * @param[in]       pPaymentHash    payment_hash
+ * @param[in]       bNoExpire       true:一致したpreimageのexpiryをUINT32_MAXに変更する(期限切れで削除させない)
+ * @retval  true    検出
+ */
+bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash, bool bNoExpire);
+
+
 /** preimage削除(payment_hash検索)
  *
  * @param[in]       pPaymentHash
@@ -896,6 +912,15 @@ bool ln_db_payment_info_save(uint64_t PaymentId, const ln_payment_info_t *pInfo)
 bool ln_db_payment_info_load(ln_payment_info_t *pInfo, uint64_t PaymentId);
 bool ln_db_payment_info_del(uint64_t PaymentId);
 
+/** multi-path paymentのpart保存
+ *
+ * PaymentIdはpartのpayment_id(親のpayment_idはpPart->payment_id)。
+ */
+bool ln_db_payment_part_save(uint64_t PaymentId, const ln_payment_part_t *pPart);
+bool ln_db_payment_part_load(ln_payment_part_t *pPart, uint64_t PaymentId);
+bool ln_db_payment_part_del(uint64_t PaymentId);
+
+//親のpayment_idを指定した場合は、partも削除する
 bool ln_db_payment_del_all(uint64_t PaymentId);
 
 
@@ -909,6 +934,12 @@ void ln_db_payment_info_cur_close(void *pCur, bool bCommit);
 bool ln_db_payment_info_cur_get(void *pCur, uint64_t *pPaymentId, ln_payment_info_t *pInfo);
 bool ln_db_payment_info_cur_del(void *pCur);
 
+//XXX: comment
+bool ln_db_payment_part_cur_open(void **ppCur);
+void ln_db_payment_part_cur_close(void *pCur, bool bCommit);
+bool ln_db_payment_part_cur_get(void *pCur, uint64_t *pPaymentId, ln_payment_part_t *pPart);
+bool ln_db_payment_part_cur_del(void *pCur);
+
 
 /********************************************************************
  * others
@@ -54,6 +54,8 @@
 #include "ln_db.h"
 #include "ln_db_lmdb.h"
 #include "ln_version.h"
+#include "ln_routing.h"
+#include "ln_gossip.h"
 
 
 //#define M_DB_DEBUG
@@ -68,22 +70,26 @@
 #define M_MAPSIZE_REMAIN_LIMIT  (2)                         ///< DB compactionを実施する残りpage
 
 #define M_DEFAULT_MAPSIZE       ((size_t)10485760)          // DB最大長[byte](LMDBのデフォルト値)
-#define M_CHANNEL_MAXDBS        (12 * 2 * MAX_CHANNELS)     ///< 同時オープンできるDB数
-#define M_CHANNEL_MAPSIZE       M_DEFAULT_MAPSIZE           // DB最大長[byte]
+#define M_SCALED_MAPSIZE_MAX    ((uint64_t)1073741824)      // channel数で増やすDB最大長の上限[byte](M_ANNO_MAPSIZEと同じく32bitの範囲内)
+#define M_CHANNEL_MAXDBS        (12 * 2)                    ///< 同時オープンできるDB数(channelあたり)
+#define M_CHANNEL_MAPSIZE       M_DEFAULT_MAPSIZE           // DB最大長[byte](最小値)
+#define M_CHANNEL_MAPSIZE_CH    ((size_t)1048576)           // channelあたりのDB長[byte](旧MAX_CHANNELS=10で10MB)
 
 #define M_NODE_MAXDBS           (50)                        ///< 同時オープンできるDB数
-#define M_NODE_MAPSIZE          M_DEFAULT_MAPSIZE           // DB最大長[byte]
+#define M_NODE_MAPSIZE          ((size_t)268435456)         // DB最大長[byte] preimageとpayment_hash indexで1M invoice程度
 
 #define M_ANNO_MAXDBS           (50)                        ///< 同時オープンできるDB数
 //#define M_ANNO_MAPSIZE        ((size_t)4294963200)        // DB最大長[byte] Ubuntu 18.04(64bit)で使用できたサイズ
 #define M_ANNO_MAPSIZE          ((size_t)1073741824)        // DB最大長[byte] Raspberry Piで使用できたサイズ
                                                             // 32bit環境ではsize_tが4byteになるため、32bitの範囲内にすること
 
-#define M_WALLET_MAXDBS         (MAX_CHANNELS)              ///< 同時オープンできるDB数
-#define M_WALLET_MAPSIZE        M_DEFAULT_MAPSIZE           // DB最大長[byte]
+#define M_WALLET_MAXDBS         (1)                         ///< 同時オープンできるDB数(channelあたり)
+#define M_WALLET_MAPSIZE        M_DEFAULT_MAPSIZE           // DB最大長[byte](最小値)
+#define M_WALLET_MAPSIZE_CH     ((size_t)65536)             // channelあたりのDB長[byte]
 
-#define M_FORWARD_MAXDBS        (MAX_CHANNELS * 3)          ///< 同時オープンできるDB数
-#define M_FORWARD_MAPSIZE       M_DEFAULT_MAPSIZE           // DB最大長[byte]
+#define M_FORWARD_MAXDBS        (3)                         ///< 同時オープンできるDB数(channelあたり)
+#define M_FORWARD_MAPSIZE       M_DEFAULT_MAPSIZE           // DB最大長[byte](最小値)
+#define M_FORWARD_MAPSIZE_CH    ((size_t)262144)            // channelあたりのDB長[byte]
 
 #define M_PAYMENT_MAXDBS        (10)                        ///< 同時オープンできるDB数
 #define M_PAYMENT_MAPSIZE       M_DEFAULT_MAPSIZE           // DB最大長[byte]
@@ -106,6 +112,10 @@
                                                             //      funding
                                                             //      local shutdown scriptPubKeyHash
                                                             //      remote shutdown scriptPubKeyHash
+#define M_NUM_HTLC_BUFS         (3)                         ///< HTLCごとにDB保存するvariable長データ数
+                                                            //      preimage
+                                                            //      onion_route
+                                                            //      shared_secret
 
 #define M_SZ_PREF_STR           (2)
 #define M_PREF_CHANNEL          "CN"                        ///< channel
@@ -124,6 +134,7 @@
 #define M_DBI_ROUTE_SKIP        LN_DB_DBI_ROUTE_SKIP        ///< 送金失敗short_channel_id
 #define M_DBI_INVOICE           "invoice"                   ///< 送金中invoice一時保存
 #define M_DBI_PREIMAGE          "preimage"                  ///< preimage
+#define M_DBI_PREIMAGE_HASH     "preimage_hash"             ///< payment_hash --> preimage(preimage検索用index)
 #define M_DBI_PAYMENT_HASH      "payment_hash"              ///< revoked transaction close用
 #define M_DBI_WALLET            "wallet"                    ///< wallet
 #define M_DBI_VERSION           "version"                   ///< verion
@@ -132,6 +143,7 @@
 #define M_DBI_ROUTE             "route"                     ///< route
 #define M_DBI_PAYMENT_INVOICE   "invoice"                   ///< payment invoice
 #define M_DBI_PAYMENT_INFO      "payment_info"              ///< payment info
+#define M_DBI_PAYMENT_PART      "payment_part"              ///< multi-path paymentのpart
 
 #define M_SZ_CHANNEL_DB_NAME_STR    (M_SZ_PREF_STR + LN_SZ_CHANNEL_ID * 2)
 #define M_SZ_FORWARD_DB_NAME_STR    (M_SZ_PREF_STR + LN_SZ_SHORT_CHANNEL_ID * 2)
@@ -224,6 +236,21 @@ typedef struct variable_item_t {
 } variable_item_t;
 
 
+/**
+ * @typedef channel_saved_t
+ * @brief   最後にDB保存したchannel情報(ln_db_channel_save()の差分保存用)
+ * @note
+ *      - ln_channel_t.p_db_savedで保持する
+ *      - gen != mChannelSavedGenの場合は無効(次回は全項目保存)
+ */
+typedef struct {
+    uint32_t    gen;                                        ///< 保存時のmChannelSavedGen
+    uint8_t     *p_values;                                  ///< DBCHANNEL_VALUES, DBHTLC_VALUES * LN_HTLC_MAX(詰めて保持)
+    utl_buf_t   bufs[M_NUM_CHANNEL_BUFS];                   ///< buf_fund_tx, shutdown_scriptpk_local, shutdown_scriptpk_remote
+    utl_buf_t   htlc_bufs[LN_HTLC_MAX][M_NUM_HTLC_BUFS];    ///< preimage, onion_route, shared_secret
+} channel_saved_t;
+
+
 /**
  * @typedef init_param_t
  * @brief   DB初期化パラメータ
@@ -232,7 +259,9 @@ typedef struct {
     MDB_env         **pp_env;
     const char      *p_path;
     MDB_dbi         maxdbs;         //mdb_env_set_maxdbs()
+    MDB_dbi         maxdbs_channel; //mdb_env_set_maxdbs()に加えるchannelあたりのDB数
     size_t          mapsize;        //mdb_env_set_mapsize()
+    size_t          mapsize_channel;//mdb_env_set_mapsize()をchannel数で増やす場合のchannelあたりのサイズ
     unsigned int    open_flag;      //mdb_env_open()
 } init_param_t;
 
@@ -261,14 +290,6 @@ typedef struct {
 } preimage_info_t;
 
 
-/** #ln_db_channel_del_param()用(ln_db_preimage_search)
- *
- */
-typedef struct {
-    const ln_htlc_t  *p_htlcs;
-} preimage_close_t;
-
-
 /********************************************************************
  * static variables
  ********************************************************************/
@@ -293,6 +314,12 @@ static char         mPathPayment[M_DB_PATH_STR_MAX + 1];
 static pthread_mutex_t  mMuxAnno;
 static MDB_txn          *mpTxnAnno;
 
+//ln_db_channel_save()以外でchannel DBを書き換えるとインクリメントし、保存済み情報を無効にする
+//  (channel DBのwrite txn内でのみ更新・参照する)
+static uint32_t         mChannelSavedGen;
+
+static uint32_t         mMaxChannels = MAX_CHANNELS;    ///< #ln_db_set_max_channels()
+
 
 /**
  *  @var    DBCHANNEL_SECRET
@@ -455,12 +482,12 @@ static const fixed_item_t DBHTLC_VALUES[] = {
 
 // LMDB initialize parameter
 static const init_param_t INIT_PARAM[] = {
-    { &mpEnvChannel, mPathChannel, M_CHANNEL_MAXDBS, M_CHANNEL_MAPSIZE, 0 },
-    { &mpEnvNode, mPathNode, M_NODE_MAXDBS, M_NODE_MAPSIZE, 0 },
-    { &mpEnvAnno, mPathAnno, M_ANNO_MAXDBS, M_ANNO_MAPSIZE, MDB_NOSYNC },
-    { &mpEnvWallet, mPathWallet, M_WALLET_MAXDBS, M_WALLET_MAPSIZE, 0 },
-    { &mpEnvForward, mPathForward, M_FORWARD_MAXDBS, M_FORWARD_MAPSIZE, 0 },
-    { &mpEnvPayment, mPathPayment, M_PAYMENT_MAXDBS, M_PAYMENT_MAPSIZE, 0 },
+    { &mpEnvChannel, mPathChannel, 0, M_CHANNEL_MAXDBS, M_CHANNEL_MAPSIZE, M_CHANNEL_MAPSIZE_CH, 0 },
+    { &mpEnvNode, mPathNode, M_NODE_MAXDBS, 0, M_NODE_MAPSIZE, 0, 0 },
+    { &mpEnvAnno, mPathAnno, M_ANNO_MAXDBS, 0, M_ANNO_MAPSIZE, 0, MDB_NOSYNC },
+    { &mpEnvWallet, mPathWallet, 0, M_WALLET_MAXDBS, M_WALLET_MAPSIZE, M_WALLET_MAPSIZE_CH, 0 },
+    { &mpEnvForward, mPathForward, 0, M_FORWARD_MAXDBS, M_FORWARD_MAPSIZE, M_FORWARD_MAPSIZE_CH, 0 },
+    { &mpEnvPayment, mPathPayment, M_PAYMENT_MAXDBS, 0, M_PAYMENT_MAPSIZE, 0, 0 },
 };
 
 
@@ -475,8 +502,11 @@ static int db_open_2(ln_lmdb_db_t *pDb, MDB_txn *pTxn, const char *pDbName, int
 
 static int channel_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, int OptDb);
 static int channel_htlc_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
-static int channel_htlc_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
-static int channel_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
+static int channel_htlc_save(const ln_channel_t *pChannel, const channel_saved_t *pSaved, ln_lmdb_db_t *pDb);
+static int channel_save(const ln_channel_t *pChannel, const utl_buf_t *pBufFundTx, const channel_saved_t *pSaved, ln_lmdb_db_t *pDb);
+static int channel_buf_save(ln_lmdb_db_t *pDb, const char *pKey, const utl_buf_t *pBuf, const utl_buf_t *pSaved);
+static void channel_saved_update(const ln_channel_t *pChannel, const utl_buf_t *pBufFundTx, uint32_t Gen);
+static void channel_saved_free(const ln_channel_t *pChannel);
 static int channel_item_load(ln_channel_t *pChannel, const fixed_item_t *pItems, ln_lmdb_db_t *pDb);
 static int channel_item_save(const ln_channel_t *pChannel, const fixed_item_t *pItems, ln_lmdb_db_t *pDb);
 static int channel_secret_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
@@ -498,12 +528,6 @@ static int cnlanno_cur_load(MDB_cursor *pCur, uint64_t *pShortChannelId, char *p
 static int nodeanno_load(ln_lmdb_db_t *pDb, utl_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8_t *pNodeId);
 static int nodeanno_save(ln_lmdb_db_t *pDb, const utl_buf_t *pNodeAnno, const uint8_t *pNodeId, uint32_t Timestamp);
 
-static bool annoinfos_trim_node_id(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo);
-static bool annoinfos_trim_node_id_selected(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo, const uint64_t *pShortChannelIds, size_t Num);
-static bool annoinfos_trim_node_id_nodeanno(
-    const uint8_t *pNodeId, uint64_t ShortChannelId, MDB_dbi DbiNodeannoInfo, ln_lmdb_db_t *pDb);
 static bool annoinfos_del_all(MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo);
 
 static void cnlanno_info_set_key(uint8_t *pKeyData, MDB_val *pKey, uint64_t ShortChannelId, char Type);
@@ -511,18 +535,19 @@ static bool cnlanno_info_parse_key(MDB_val *pKey, uint64_t *pShortChannelId, cha
 static void nodeanno_info_set_key(uint8_t *pKeyData, MDB_val *pKey, const uint8_t *pNodeId);
 //static bool nodeanno_info_parse_key(MDB_val *pKey, uint8_t *pNodeId);
 
-static bool annoinfo_add(ln_lmdb_db_t *pDb, MDB_val *pMdbKey, MDB_val *pMdbData, const uint8_t *pNodeId);
-static bool annoinfo_search_node_id(MDB_val *pMdbData, const uint8_t *pNodeId);
-static bool annoinfo_cur_trim_node_id(MDB_cursor *pCursor, const uint8_t *pNodeId);
-static bool annoinfo_trim_node_id(MDB_val *pData, const uint8_t *pNodeId);
-static void annoinfo_cur_add(MDB_cursor *pCursor, const uint8_t *pNodeId);
 static void anno_del_prune(void);
 
+static bool route_skip_parse(const MDB_val *pData, uint8_t *pType, uint64_t *pExpiry);
+static bool route_skip_expired(uint64_t Expiry, uint64_t Now);
+
 static bool preimage_open(ln_lmdb_db_t *pDb, MDB_txn *pTxn);
 static void preimage_close(ln_lmdb_db_t *pDb, MDB_txn *pTxn, bool bCommit);
-static bool preimage_cmp_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam);
-static bool preimage_cmp_all_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam);
 static bool preimage_search(ln_db_func_preimage_t pFunc, bool bCommit, void *pFuncParam);
+static int preimage_hash_open(MDB_txn *pTxn, MDB_dbi *pDbi);
+static int preimage_hash_put(MDB_txn *pTxn, const uint8_t *pPreimage);
+static int preimage_hash_del(MDB_txn *pTxn, const uint8_t *pPreimage);
+static int preimage_del_hash(ln_lmdb_db_t *pDb, const uint8_t *pPaymentHash);
+static void preimage_hash_migrate(void);
 
 static int wallet_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, int OptDb);
 
@@ -568,11 +593,16 @@ static bool payment_cur_del(void *pCur);
 
 static int fixed_items_load(void *pData, ln_lmdb_db_t *pDb, const fixed_item_t *pItems, size_t Num);
 static int fixed_items_save(const void *pData, ln_lmdb_db_t *pDb, const fixed_item_t *pItems, size_t Num);
+static int fixed_items_save_diff(const void *pData, const uint8_t *pSaved, ln_lmdb_db_t *pDb, const fixed_item_t *pItems, size_t Num);
+static bool fixed_items_equal(const void *pData, const uint8_t *pSaved, const fixed_item_t *pItems, size_t Num);
+static size_t fixed_items_size(const fixed_item_t *pItems, size_t Num);
+static uint8_t *fixed_items_copy(uint8_t *pSaved, const void *pData, const fixed_item_t *pItems, size_t Num);
 
 static int init_db_env(const init_param_t  *p_param);
 static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb);
 static bool rmdir_recursively(const char *pPath);
 static int lmdb_init(const init_param_t  *p_param);
+static size_t lmdb_mapsize(const init_param_t  *p_param);
 static int lmdb_compaction(const init_param_t  *p_param);
 
 
@@ -724,6 +754,12 @@ static inline uint8_t *my_mdb_val_alloccopy(MDB_val *pDst, const MDB_val *pSrc)
  * public functions
  ********************************************************************/
 
+void ln_db_set_max_channels(uint32_t MaxChannels)
+{
+    mMaxChannels = MaxChannels;
+}
+
+
 bool ln_lmdb_set_home_dir(const char *pPath)
 {
     char path[M_DB_PATH_STR_MAX + 1];
@@ -902,6 +938,7 @@ bool ln_db_init(char *pWif, char *pNodeName, uint16_t *pPort, bool bStdErr)
 
     //ln_db_invoice_drop();     //送金を再開する場合があるが、その場合は再入力させるか？
     anno_del_prune();           //channel_updateだけの場合でも保持しておく
+    preimage_hash_migrate();
 
 LABEL_EXIT:
     if (retval == 0) {
@@ -1023,6 +1060,9 @@ bool ln_db_channel_save(const ln_channel_t *pChannel)
     int             retval;
     ln_lmdb_db_t    db;
     char            db_name[M_SZ_CHANNEL_DB_NAME_STR + 1];
+    utl_buf_t       buf_fund_tx = UTL_BUF_INIT;
+    uint32_t        gen;
+    const channel_saved_t *p_saved;
 
     db.p_txn = NULL;
 
@@ -1038,12 +1078,23 @@ bool ln_db_channel_save(const ln_channel_t *pChannel)
         LOGE("ERR: %s\n", mdb_strerror(retval));
         goto LABEL_EXIT;
     }
-    retval = channel_save(pChannel, &db);
+
+    //前回保存した内容と異なる項目だけを書き込む
+    gen = mChannelSavedGen;
+    p_saved = (const channel_saved_t *)pChannel->p_db_saved;
+    if (p_saved && (p_saved->gen != gen)) {
+        //他の処理でDBが書き換えられている
+        channel_saved_free(pChannel);
+        p_saved = NULL;
+    }
+
+    btc_tx_write(&pChannel->funding_info.tx_data, &buf_fund_tx);
+    retval = channel_save(pChannel, &buf_fund_tx, p_saved, &db);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         goto LABEL_EXIT;
     }
-    retval = channel_htlc_save(pChannel, &db);
+    retval = channel_htlc_save(pChannel, p_saved, &db);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         goto LABEL_EXIT;
@@ -1052,6 +1103,8 @@ bool ln_db_channel_save(const ln_channel_t *pChannel)
     MDB_TXN_COMMIT(db.p_txn);
     db.p_txn = NULL;
 
+    channel_saved_update(pChannel, &buf_fund_tx, gen);
+
 LABEL_EXIT:
     if (retval) {
         LOGE("fail: save\n");
@@ -1059,10 +1112,17 @@ LABEL_EXIT:
     if (db.p_txn) {
         MDB_TXN_ABORT(db.p_txn);
     }
+    utl_buf_free(&buf_fund_tx);
     return retval == 0;
 }
 
 
+void ln_db_channel_save_reset(ln_channel_t *pChannel)
+{
+    channel_saved_free(pChannel);
+}
+
+
 bool ln_db_channel_del(const uint8_t *pChannelId)
 {
     bool ret = ln_db_channel_search(channel_cmp_func_channel_del, (CONST_CAST void *)pChannelId);
@@ -1085,13 +1145,20 @@ bool ln_db_channel_del_param(const ln_channel_t *pChannel, void *pDbParam)
 
     MDB_TXN_CHECK_CHANNEL(p_cur->p_txn);
 
+    mChannelSavedGen++;
+    ln_routing_channel_del(pChannel->short_channel_id);
+
     //copy to closed env
     channel_copy_closed(p_cur->p_txn, chanid_str);
 
     //remove preimages
-    preimage_close_t param;
-    param.p_htlcs = pChannel->update_info.htlcs;
-    ln_db_preimage_search(preimage_cmp_all_func, &param);
+    ln_lmdb_db_t db_preimage;
+    if (preimage_open(&db_preimage, NULL)) {
+        for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+            (void)preimage_del_hash(&db_preimage, pChannel->update_info.htlcs[lp].payment_hash);
+        }
+        preimage_close(&db_preimage, NULL, true);
+    }
 
     //db_name base
     memcpy(db_name + M_SZ_PREF_STR, chanid_str, LN_SZ_CHANNEL_ID * 2);
@@ -1441,20 +1508,20 @@ LABEL_EXIT:
 
 
 /* [channel_announcement]save
- *  パケット保存と、その送信元node_idの保存を行う。
+ *  パケット保存を行い、新規であればgossip logに追加する。
  *  また、channel_announcementの両端node_idを保存する(node_announcement送信判定用)。
  *
  *  dbi: "channel_anno"
- *  dbi: "channel_anno_info"
  *  dbi: "channal_anno_recv"
  */
 bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, const uint8_t *pSendId,
                         const uint8_t *pNodeId1, const uint8_t *pNodeId2)
 {
     int             retval;
-    ln_lmdb_db_t    db, db_info, db_recv;
+    ln_lmdb_db_t    db, db_recv;
     MDB_val         key, data;
     utl_buf_t       buf_anno = UTL_BUF_INIT;
+    bool            update = false;
 
     if (!ln_db_anno_transaction()) {
         LOGE("ERR: anno transaction\n");
@@ -1468,13 +1535,6 @@ bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, cons
         goto LABEL_EXIT;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, MDB_CREATE, &db_info.dbi);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        goto LABEL_EXIT;
-    }
-
     retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_RECV, MDB_CREATE, &db_recv.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -1514,6 +1574,7 @@ bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, cons
             LOGE("ERR: save\n");
             goto LABEL_EXIT;
         }
+        update = true;
     } else if (utl_buf_equal(&buf_anno, pCnlAnno)) {
         LOGV("same channel_announcement: %016" PRIx64 "\n", ShortChannelId);
     } else {
@@ -1523,17 +1584,11 @@ bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, cons
         goto LABEL_EXIT;
     }
 
-    //info
-    if (pSendId) {
-        if (!ln_db_cnlanno_info_add_node_id(
-            &db_info, ShortChannelId, LN_DB_CNLANNO_ANNO, false, pSendId)) {
-            retval = -1;
-            goto LABEL_EXIT;
-        }
-    }
-
 LABEL_EXIT:
     if (retval == 0) {
+        if (update) {
+            ln_gossip_cnlanno_add(ShortChannelId, pNodeId1, pNodeId2, pSendId);
+        }
         ln_db_anno_commit(true);
     } else {
         //failed
@@ -1586,15 +1641,14 @@ bool ln_db_cnlupd_load(utl_buf_t *pCnlUpd, uint32_t *pTimeStamp, uint64_t ShortC
 
 
 /* [channel_update]save
- *  パケット保存と、その送信元node_idの保存を行う。
+ *  パケット保存を行い、更新した場合はgossip logに追加する。
  *
  *  dbi: "channel_anno"
- *  dbi: "channel_anno_info"
  */
 bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *pUpd, const uint8_t *pSendId)
 {
     int             retval;
-    ln_lmdb_db_t    db, db_info;
+    ln_lmdb_db_t    db;
 
     if (!ln_db_anno_transaction()) {
         LOGE("ERR: anno transaction\n");
@@ -1608,17 +1662,9 @@ bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, MDB_CREATE, &db_info.dbi);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
-    }
-
     utl_buf_t   buf_upd = UTL_BUF_INIT;
     uint32_t    timestamp;
     bool        update = false;
-    bool        clear_node_ids = false;
 
     retval = cnlupd_load(&db, &buf_upd, &timestamp, pUpd->short_channel_id, ln_cnlupd_direction(pUpd));
     if (retval) {
@@ -1636,8 +1682,6 @@ bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *
             //自分の方が古いので、更新
             LOGD("update: short_channel_id=%016" PRIx64 "(dir=%d)\n", pUpd->short_channel_id, ln_cnlupd_direction(pUpd));
             update = true;
-            //announceし直す必要があるため、クリアする
-            clear_node_ids = true;
         } else if (utl_buf_equal(&buf_upd, pCnlUpd)) {
             //LOGV("same channel_update\n");
         } else {
@@ -1661,15 +1705,8 @@ bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *
             ln_db_anno_commit(false);
             return false;
         }
-    }
-    if (pSendId) {
-        char type = ln_cnlupd_direction(pUpd) ?  LN_DB_CNLANNO_UPD1 : LN_DB_CNLANNO_UPD0;
-        if (!ln_db_cnlanno_info_add_node_id(
-            &db_info, pUpd->short_channel_id, type, clear_node_ids, pSendId)) {
-            LOGE("fail: ???\n");
-            ln_db_anno_commit(false);
-            return false;
-        }
+        //announceし直す必要があるため、gossip logの末尾に付け直す
+        ln_gossip_cnlupd_add(pUpd->short_channel_id, ln_cnlupd_direction(pUpd), pSendId);
     }
 
     ln_db_anno_commit(true);
@@ -1691,12 +1728,11 @@ bool ln_db_cnlupd_need_to_prune(uint64_t Now, uint32_t TimesStamp)
  *
  *
  *  dbi: "channel_anno"
- *  dbi: "channel_anno_info"
  */
 bool ln_db_cnlanno_del(uint64_t ShortChannelId)
 {
     int         retval;
-    MDB_dbi     dbi, dbi_info;
+    MDB_dbi     dbi;
     MDB_val     key;
     uint8_t     key_data[M_SZ_CNLANNO_INFO_KEY];
 
@@ -1712,13 +1748,6 @@ bool ln_db_cnlanno_del(uint64_t ShortChannelId)
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, MDB_CREATE, &dbi_info);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
-    }
-
     char SUFFIX[] = { LN_DB_CNLANNO_ANNO, LN_DB_CNLANNO_UPD0, LN_DB_CNLANNO_UPD1 };
     for (size_t lp = 0; lp < ARRAY_SIZE(SUFFIX); lp++) {
         cnlanno_info_set_key(key_data, &key, ShortChannelId, SUFFIX[lp]);
@@ -1726,13 +1755,49 @@ bool ln_db_cnlanno_del(uint64_t ShortChannelId)
         if (retval && (retval != MDB_NOTFOUND)) {
             LOGE("ERR[%c]: %s\n", SUFFIX[lp], mdb_strerror(retval));
         }
-        retval = mdb_del(mpTxnAnno, dbi_info, &key, NULL);
-        if (retval && (retval != MDB_NOTFOUND)) {
-            LOGE("ERR[%c]: %s\n", SUFFIX[lp], mdb_strerror(retval));
-        }
     }
     ln_db_anno_commit(true);
     LOGD("remove channel_announcement: %016" PRIx64 "\n", ShortChannelId);
+    ln_routing_cnlanno_del(ShortChannelId);
+    ln_gossip_cnlanno_del(ShortChannelId);
+    return true;
+}
+
+
+/* [channel_update]delete
+ *
+ *  dbi: "channel_anno"
+ */
+bool ln_db_cnlupd_del(uint64_t ShortChannelId, uint8_t Dir)
+{
+    int         retval;
+    MDB_dbi     dbi;
+    MDB_val     key;
+    uint8_t     key_data[M_SZ_CNLANNO_INFO_KEY];
+
+    if (!ln_db_anno_transaction()) {
+        LOGE("ERR: anno transaction\n");
+        return false;
+    }
+
+    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, 0, &dbi);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        ln_db_anno_commit(false);
+        return false;
+    }
+
+    cnlanno_info_set_key(key_data, &key, ShortChannelId, (Dir) ? LN_DB_CNLANNO_UPD1 : LN_DB_CNLANNO_UPD0);
+    retval = mdb_del(mpTxnAnno, dbi, &key, NULL);
+    if (retval && (retval != MDB_NOTFOUND)) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        ln_db_anno_commit(false);
+        return false;
+    }
+    ln_db_anno_commit(true);
+    LOGD("remove channel_update: %016" PRIx64 "(dir=%d)\n", ShortChannelId, Dir);
+    ln_routing_cnlupd_del(ShortChannelId, Dir);
+    ln_gossip_cnlupd_del(ShortChannelId, Dir);
     return true;
 }
 
@@ -1771,15 +1836,13 @@ bool ln_db_nodeanno_load(utl_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8
 
 
 // dbi: "node_anno"
-// dbi: "node_anno_info"
 bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcement_t *pAnno, const uint8_t *pSendId)
 {
     int             retval;
-    ln_lmdb_db_t    db, db_info, db_recv;
+    ln_lmdb_db_t    db, db_recv;
     utl_buf_t       buf_node = UTL_BUF_INIT;
     uint32_t        timestamp;
     bool            update = false;
-    bool            clear_node_ids = false;
     MDB_val         key, data;
 
     if (!ln_db_anno_transaction()) {
@@ -1794,13 +1857,6 @@ bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcem
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, MDB_CREATE, &db_info.dbi);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
-    }
-
     if (memcmp(pAnno->p_node_id, ln_node_get_id(), BTC_SZ_PUBKEY)) {
         //BOLT#07
         //  * if node_id is NOT previously known from a channel_announcement message, OR if timestamp is NOT greater than the last-received node_announcement from this node_id:
@@ -1836,9 +1892,6 @@ bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcem
             //自分の方が古いので、更新
             LOGV("gotten node_announcement is newer\n");
             update = true;
-
-            //announceし直す必要があるため、クリアする
-            clear_node_ids = true;
         } else if (utl_buf_equal(&buf_node, pNodeAnno)) {
             LOGV("same node_announcement\n");
         } else {
@@ -1857,18 +1910,8 @@ bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcem
             ln_db_anno_commit(false);
             return false;
         }
-        if (pSendId || clear_node_ids) {
-            // if (pSendId != NULL) {
-            //     LOGD("  node_info: ");
-            //     DUMPD(pAnno->p_node_id, BTC_SZ_PUBKEY);
-            //     LOGD("  sender: ");
-            //     DUMPD(pSendId, BTC_SZ_PUBKEY);
-            // }
-            if (!ln_db_nodeanno_info_add_node_id(&db_info, pAnno->p_node_id, clear_node_ids, pSendId)) {
-                ln_db_anno_commit(false);
-                return false;
-            }
-        }
+        //announceし直す必要があるため、gossip logの末尾に付け直す
+        ln_gossip_nodeanno_add(pAnno->p_node_id, pSendId);
         ln_db_anno_commit(true);
     } else {
         ln_db_anno_commit(false);
@@ -1945,69 +1988,6 @@ void ln_db_anno_cur_close(void *pCur)
 }
 
 
-/* channel_announcement/channel_updateの送信元/送信先登録
- *
- * 既にchannel_announcement/channel_updateを送信したノードや、
- * その情報をもらったノードへはannoundementを送信したくないため、登録しておく。
- *
- * #ln_db_cnlanno_info_search_node_id()で、送信不要かどうかをチェックする。
-
- *  dbi: "channel_anno_info"
- */
-bool ln_db_cnlanno_info_add_node_id(void *pCur, uint64_t ShortChannelId, char Type, bool bClear, const uint8_t *pNodeId)
-{
-    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
-    MDB_val key, data;
-    uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
-    bool detect = false;
-
-    cnlanno_info_set_key(key_data, &key, ShortChannelId, Type);
-    if (bClear) {
-        data.mv_size = 0;
-    } else {
-        int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
-        if (retval == 0) {
-            detect = annoinfo_search_node_id(&data, pNodeId);
-        } else {
-            LOGV("new reg[%016" PRIx64 ":%c] ", ShortChannelId, Type);
-            DUMPV(pNodeId, BTC_SZ_PUBKEY);
-            data.mv_size = 0;
-        }
-    }
-    if (!detect) {
-        if (!annoinfo_add((ln_lmdb_db_t *)p_cur, &key, &data, pNodeId)) {
-            return false;
-        }
-    }
-    return true;
-}
-
-
-/* [channel_announcement / channel_update]search received/sent DB
- *
- *  dbi: "channel_anno_info"
- */
-bool ln_db_cnlanno_info_search_node_id(void *pCur, uint64_t ShortChannelId, char Type, const uint8_t *pNodeId)
-{
-    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
-
-    MDB_val key, data;
-    uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
-
-    cnlanno_info_set_key(key_data, &key, ShortChannelId, Type);
-    int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
-    if (retval) {
-        //LOGE("ERR: %s\n", mdb_strerror(retval));
-        return false;
-    }
-
-    // LOGD("short_channel_id[%c]= %016" PRIx64 "\n", Type, ShortChannelId);
-    // LOGD("send_id= ");
-    // DUMPD(pSendId, BTC_SZ_PUBKEY);
-    return annoinfo_search_node_id(&data, pNodeId);
-}
-
-
 /* [channel_announcement / channel_update]cursor
  *
  *  dbi: "channel_anno"
@@ -2043,6 +2023,14 @@ bool ln_db_cnlanno_cur_back(void *pCur)
 bool ln_db_cnlanno_cur_del(void *pCur)
 {
     lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
+    MDB_val key, data;
+    uint64_t short_channel_id;
+    char type;
+
+    //routing graph/gossip logから削除するため、削除前にkeyを取得しておく
+    bool routing = (mdb_cursor_get(p_cur->p_cursor, &key, &data, MDB_GET_CURRENT) == 0) &&
+                    cnlanno_info_parse_key(&key, &short_channel_id, &type);
+
     int retval = mdb_cursor_del(p_cur->p_cursor, 0);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
@@ -2050,6 +2038,15 @@ bool ln_db_cnlanno_cur_del(void *pCur)
         }
         return false;
     }
+    if (routing) {
+        if (type == LN_DB_CNLANNO_ANNO) {
+            ln_routing_cnlanno_del(short_channel_id);
+            ln_gossip_cnlanno_del(short_channel_id);
+        } else if ((type == LN_DB_CNLANNO_UPD0) || (type == LN_DB_CNLANNO_UPD1)) {
+            ln_routing_cnlupd_del(short_channel_id, type - LN_DB_CNLANNO_UPD0);
+            ln_gossip_cnlupd_del(short_channel_id, type - LN_DB_CNLANNO_UPD0);
+        }
+    }
     return true;
 }
 
@@ -2077,80 +2074,6 @@ bool ln_db_nodeanno_cur_load(void *pCur, utl_buf_t *pNodeAnno, uint32_t *pTimeSt
 }
 
 
-/* [node_announcement]
- *
- *  dbi: "node_anno_info"
- */
-bool ln_db_nodeanno_info_search_node_id(void *pCur, const uint8_t *pNodeId, const uint8_t *pSendId)
-{
-    //LOGD("node_id= ");
-    //DUMPD(pNodeId, BTC_SZ_PUBKEY);
-    //LOGD("send_id= ");
-    //DUMPD(pSendId, BTC_SZ_PUBKEY);
-
-    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
-
-    MDB_val key, data;
-    uint8_t key_data[M_SZ_NODEANNO_INFO_KEY];
-
-    nodeanno_info_set_key(key_data, &key, pNodeId);
-    int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
-    if (retval) {
-        if (retval != MDB_NOTFOUND) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
-        return false;
-    }
-
-    //LOGD("search...\n");
-    return annoinfo_search_node_id(&data, pSendId);
-}
-
-
-/* [node_announcement]
- *
- *  dbi: "node_anno_info"
- */
-bool ln_db_nodeanno_info_add_node_id(void *pCur, const uint8_t *pNodeId, bool bClear, const uint8_t *pSendId)
-{
-    if (!pSendId && !bClear) {
-        LOGD("do nothing\n");
-        return true;
-    }
-
-    lmdb_cursor_t   *p_cur = (lmdb_cursor_t *)pCur;
-    MDB_val         key, data;
-    uint8_t         key_data[M_SZ_NODEANNO_INFO_KEY];
-    bool            detect = false;
-
-    nodeanno_info_set_key(key_data, &key, pNodeId);
-    if (bClear) {
-        data.mv_size = 0;
-    } else {
-        int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
-        if (retval == 0) {
-            detect = annoinfo_search_node_id(&data, pSendId);
-        } else {
-            data.mv_size = 0;
-        }
-    }
-
-    if (!detect) {
-        LOGV("new from ");
-        if (pSendId) {
-            DUMPV(pSendId, BTC_SZ_PUBKEY);
-        } else {
-            LOGV(": only clear\n");
-        }
-        if (!annoinfo_add((ln_lmdb_db_t *)p_cur, &key, &data, pSendId)) {
-            LOGE("fail: ???\n");
-            return false;
-        }
-    }
-    return true;
-}
-
-
 /* [node_announcement]
  *
  *  dbi: "node_anno"
@@ -2311,214 +2234,112 @@ bool ln_db_channel_owned_del(uint64_t ShortChannelId)
 
 
 /********************************************************************
- * [anno]cnlanno, nodeanno共通
+ * [node]skip routing list
  ********************************************************************/
 
-bool ln_db_annoinfos_del_node_id(const uint8_t *pNodeId, const uint64_t *pShortChannelIds, size_t Num)
+bool ln_db_route_skip_save(uint64_t ShortChannelId, bool bTemp, uint64_t Expiry)
 {
-    int         retval;
-    MDB_dbi     dbi_cnlanno_info;
-    MDB_dbi     dbi_nodeanno_info;
+    LOGD("short_channel_id=%016" PRIx64 ", bTemp=%d, expiry=%" PRIu64 "\n", ShortChannelId, bTemp, Expiry);
 
-    if (!ln_db_anno_transaction()) {
-        LOGE("ERR: anno transaction\n");
-        return false;
-    }
+    int             retval;
+    MDB_val         key, data;
+    ln_lmdb_db_t    db;
+    uint8_t         tmp_data[LN_DB_ROUTE_SKIP_SZ_EXPIRY];
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, 0, &dbi_cnlanno_info);
+    retval = node_db_open(&db, M_DBI_ROUTE_SKIP, 0, MDB_CREATE);
     if (retval) {
-        if (retval != MDB_NOTFOUND) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
-        ln_db_anno_commit(false);
+        LOGE("ERR: %s\n", mdb_strerror(retval));
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, 0, &dbi_nodeanno_info);
+    key.mv_size = sizeof(ShortChannelId);
+    key.mv_data = &ShortChannelId;
+    tmp_data[0] = (bTemp) ? LN_DB_ROUTE_SKIP_TEMP : LN_DB_ROUTE_SKIP_PERM;
+    data.mv_data = tmp_data;
+    if (Expiry != 0) {
+        memcpy(tmp_data + sizeof(uint8_t), &Expiry, sizeof(Expiry));
+        data.mv_size = LN_DB_ROUTE_SKIP_SZ_EXPIRY;
+    } else {
+        data.mv_size = sizeof(uint8_t);
+    }
+    retval = mdb_put(db.p_txn, db.dbi, &key, &data, 0);
     if (retval) {
-        if (retval != MDB_NOTFOUND) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
-        ln_db_anno_commit(false);
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(db.p_txn);
         return false;
     }
+    LOGD("add skip[%d]: %016" PRIx64 "\n", bTemp, ShortChannelId);
 
-    if (pNodeId) {
-        if ((pShortChannelIds == NULL) && (Num == 0)) {
-            //all trim
-            (void)annoinfos_trim_node_id(pNodeId, dbi_cnlanno_info, dbi_nodeanno_info);
-        } else {
-            //selected trim
-            (void)annoinfos_trim_node_id_selected(pNodeId, dbi_cnlanno_info, dbi_nodeanno_info, pShortChannelIds, Num);
-        }
-    } else {
-        //drop
-        (void)annoinfos_del_all(dbi_cnlanno_info, dbi_nodeanno_info);
-    }
+    MDB_TXN_COMMIT(db.p_txn);
 
-    if (pNodeId) {
-        LOGD("remove annoinfo: ");
-        DUMPD(pNodeId, BTC_SZ_PUBKEY);
-    } else {
-        LOGD("remove annoinfo: ALL\n");
-    }
-    ln_db_anno_commit(true);
+    ln_routing_skip_add(ShortChannelId, bTemp, Expiry);
     return true;
 }
 
 
-bool ln_db_annoinfos_add_node_id(const uint8_t *pNodeId)
+bool ln_db_route_skip_work(bool bWork)
 {
-    int         retval;
-    MDB_dbi     dbi_cnl;
-    MDB_dbi     dbi_node;
-    MDB_cursor  *p_cursor;
+    LOGD("bWork=%d\n", bWork);
 
-    if (!ln_db_anno_transaction()) {
-        LOGE("ERR: anno transaction\n");
-        return false;
-    }
+    int             retval;
+    MDB_val         key, data;
+    MDB_cursor      *p_cursor = NULL;
+    ln_lmdb_db_t    db;
+
+    db.p_txn = NULL;
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, 0, &dbi_cnl);
+    retval = node_db_open(&db, M_DBI_ROUTE_SKIP, 0, MDB_CREATE);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
+        goto LABEL_ERROR;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, 0, &dbi_node);
+    retval = mdb_cursor_open(db.p_txn, db.dbi, &p_cursor);
     if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
-    }
-
-    LOGD("add annoinfo: ");
-    DUMPD(pNodeId, BTC_SZ_PUBKEY);
-
-    //cnlanno_info
-    retval = mdb_cursor_open(mpTxnAnno, dbi_cnl, &p_cursor);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
-    }
-    annoinfo_cur_add(p_cursor, pNodeId);
-    MDB_CURSOR_CLOSE(p_cursor);
-
-    //nodeanno_info
-    retval = mdb_cursor_open(mpTxnAnno, dbi_node, &p_cursor);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
-    }
-    annoinfo_cur_add(p_cursor, pNodeId);
-    MDB_CURSOR_CLOSE(p_cursor);
-
-    ln_db_anno_commit(true);
-    return true;
-}
-
-
-/********************************************************************
- * [node]skip routing list
- ********************************************************************/
-
-bool ln_db_route_skip_save(uint64_t ShortChannelId, bool bTemp)
-{
-    LOGD("short_channel_id=%016" PRIx64 ", bTemp=%d\n", ShortChannelId, bTemp);
-
-    int             retval;
-    MDB_val         key, data;
-    ln_lmdb_db_t    db;
-
-    retval = node_db_open(&db, M_DBI_ROUTE_SKIP, 0, MDB_CREATE);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        return false;
-    }
-
-    key.mv_size = sizeof(ShortChannelId);
-    key.mv_data = &ShortChannelId;
-    uint8_t tmp_data;
-    if (bTemp) {
-        tmp_data = LN_DB_ROUTE_SKIP_TEMP;
-        data.mv_size = sizeof(tmp_data);
-        data.mv_data = &tmp_data;
-    } else {
-        tmp_data = LN_DB_ROUTE_SKIP_PERM;
-        data.mv_size = sizeof(tmp_data);
-        data.mv_data = &tmp_data;
-    }
-    retval = mdb_put(db.p_txn, db.dbi, &key, &data, 0);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        MDB_TXN_ABORT(db.p_txn);
-        return false;
-    }
-    LOGD("add skip[%d]: %016" PRIx64 "\n", bTemp, ShortChannelId);
-
-    MDB_TXN_COMMIT(db.p_txn);
-    return true;
-}
-
-
-bool ln_db_route_skip_work(bool bWork)
-{
-    LOGD("bWork=%d\n", bWork);
-
-    int             retval;
-    MDB_val         key, data;
-    MDB_cursor      *p_cursor = NULL;
-    ln_lmdb_db_t    db;
-
-    db.p_txn = NULL;
-
-    retval = node_db_open(&db, M_DBI_ROUTE_SKIP, 0, MDB_CREATE);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        goto LABEL_ERROR;
-    }
-
-    retval = mdb_cursor_open(db.p_txn, db.dbi, &p_cursor);
-    if (retval) {
-        p_cursor = NULL;
+        p_cursor = NULL;
         LOGE("ERR: %s\n", mdb_strerror(retval));
         goto LABEL_ERROR;
     }
 
     while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT) == 0) {
-        const uint8_t *p_data = (const uint8_t *)data.mv_data;
-        if (data.mv_size != sizeof(uint8_t)) continue;
+        uint8_t type;
+        uint64_t expiry;
+        if (!route_skip_parse(&data, &type, &expiry)) continue;
 
-        if (!my_mdb_val_alloccopy(&key, &key)) {
-            LOGE("fail: ???\n");
-            goto LABEL_ERROR;
-        }
-
-        uint64_t short_channel_id = *(uint64_t *)key.mv_data;
         uint8_t wk = LN_DB_ROUTE_SKIP_NONE;
-        if (bWork && (p_data[0] == LN_DB_ROUTE_SKIP_TEMP)) {
-            LOGD("TEMP-->WORK: %016" PRIx64 "\n", short_channel_id);
+        if (bWork && (type == LN_DB_ROUTE_SKIP_TEMP)) {
             wk = LN_DB_ROUTE_SKIP_WORK;
-        } else if (!bWork && (p_data[0] == LN_DB_ROUTE_SKIP_WORK)) {
-            LOGD("WORK-->TEMP: %016" PRIx64 "\n", short_channel_id);
+        } else if (!bWork && (type == LN_DB_ROUTE_SKIP_WORK)) {
             wk = LN_DB_ROUTE_SKIP_TEMP;
         }
-        if (wk != LN_DB_ROUTE_SKIP_NONE) {
-            data.mv_data = &wk;
-            int retval = mdb_cursor_put(p_cursor, &key, &data, MDB_CURRENT);
-            UTL_DBG_FREE(key.mv_data);
-            if (retval) {
-                LOGD("through: put(%s)\n", mdb_strerror(retval));
-                //XXX: ignore error
-            }
+        if (wk == LN_DB_ROUTE_SKIP_NONE) continue;
+
+        if (!my_mdb_val_alloccopy(&key, &key)) {
+            LOGE("fail: ???\n");
+            goto LABEL_ERROR;
+        }
+        uint64_t short_channel_id;
+        memcpy(&short_channel_id, key.mv_data, sizeof(uint64_t));
+        LOGD("%s: %016" PRIx64 "\n", (bWork) ? "TEMP-->WORK" : "WORK-->TEMP", short_channel_id);
+
+        //有効期限は引き継ぐ
+        uint8_t tmp_data[LN_DB_ROUTE_SKIP_SZ_EXPIRY];
+        tmp_data[0] = wk;
+        memcpy(tmp_data + sizeof(uint8_t), &expiry, sizeof(expiry));
+        data.mv_size = (expiry != 0) ? LN_DB_ROUTE_SKIP_SZ_EXPIRY : sizeof(uint8_t);
+        data.mv_data = tmp_data;
+        int retval = mdb_cursor_put(p_cursor, &key, &data, MDB_CURRENT);
+        UTL_DBG_FREE(key.mv_data);
+        if (retval) {
+            LOGD("through: put(%s)\n", mdb_strerror(retval));
+            //XXX: ignore error
         }
     }
 
     MDB_CURSOR_CLOSE(p_cursor);
     MDB_TXN_COMMIT(db.p_txn);
+
+    ln_routing_skip_work(bWork);
     return true;
 
 LABEL_ERROR:
@@ -2539,10 +2360,11 @@ LABEL_ERROR:
  */
 ln_db_route_skip_t ln_db_route_skip_search(uint64_t ShortChannelId)
 {
-    ln_db_route_skip_t  result = LN_DB_ROUTE_SKIP_NONE;
     int                 retval;
     MDB_val             key, data;
     ln_lmdb_db_t        db;
+    uint8_t             type;
+    uint64_t            expiry;
 
     db.p_txn = NULL;
 
@@ -2563,16 +2385,62 @@ ln_db_route_skip_t ln_db_route_skip_search(uint64_t ShortChannelId)
         return LN_DB_ROUTE_SKIP_NONE;
     }
 
-    const uint8_t *p_data = (const uint8_t *)data.mv_data;
-    if (data.mv_size != sizeof(uint8_t)) {
+    if (!route_skip_parse(&data, &type, &expiry)) {
         LOGE("fail\n");
         MDB_TXN_ABORT(db.p_txn);
         return LN_DB_ROUTE_SKIP_NONE;
     }
-    result = p_data[0];
+    MDB_TXN_ABORT(db.p_txn);
+
+    if (route_skip_expired(expiry, (uint64_t)utl_time_time())) {
+        return LN_DB_ROUTE_SKIP_NONE;
+    }
+    return (ln_db_route_skip_t)type;
+}
+
+
+bool ln_db_route_skip_load(ln_db_func_route_skip_t pFunc, void *pParam)
+{
+    int             retval;
+    ln_lmdb_db_t    db;
+    MDB_cursor      *p_cursor = NULL;
+    MDB_val         key, data;
+    uint64_t        now = (uint64_t)utl_time_time();
+
+    db.p_txn = NULL;
+
+    retval = node_db_open(&db, M_DBI_ROUTE_SKIP, MDB_RDONLY, 0);
+    if (retval) {
+        if (retval == MDB_NOTFOUND) {
+            LOGD("no db\n");
+            return true;
+        }
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return false;
+    }
+
+    retval = mdb_cursor_open(db.p_txn, db.dbi, &p_cursor);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(db.p_txn);
+        return false;
+    }
+
+    while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT) == 0) {
+        uint64_t short_channel_id;
+        uint8_t type;
+        uint64_t expiry;
+
+        if (key.mv_size != sizeof(uint64_t)) continue;
+        if (!route_skip_parse(&data, &type, &expiry)) continue;
+        if (route_skip_expired(expiry, now)) continue;
+        memcpy(&short_channel_id, key.mv_data, sizeof(uint64_t));
+        (*pFunc)(short_channel_id, (ln_db_route_skip_t)type, expiry, pParam);
+    }
 
+    MDB_CURSOR_CLOSE(p_cursor);
     MDB_TXN_ABORT(db.p_txn);
-    return result;
+    return true;
 }
 
 
@@ -2596,7 +2464,9 @@ bool ln_db_route_skip_drop(bool bTemp)
     }
 
     if (bTemp) {
+        //一時的なskipと、有効期限を過ぎたentryを削除
         LOGD("remove temporary only\n");
+        uint64_t now = (uint64_t)utl_time_time();
         retval = mdb_cursor_open(db.p_txn, db.dbi, &p_cursor);
         if (retval) {
             p_cursor = NULL;
@@ -2605,18 +2475,18 @@ bool ln_db_route_skip_drop(bool bTemp)
         }
 
         while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT) == 0) {
-            const uint8_t *p_data = (const uint8_t *)data.mv_data;
-            if (data.mv_size != sizeof(uint8_t)) continue;
-            if (p_data[0] != LN_DB_ROUTE_SKIP_TEMP) continue;
+            uint8_t type;
+            uint64_t expiry;
+            if (!route_skip_parse(&data, &type, &expiry)) continue;
+            if ((type != LN_DB_ROUTE_SKIP_TEMP) && !route_skip_expired(expiry, now)) continue;
 
+            uint64_t val;
+            memcpy(&val, key.mv_data, sizeof(uint64_t));
             retval = mdb_cursor_del(p_cursor, 0);
             if (retval) {
                 LOGE("ERR: %s\n", mdb_strerror(retval));
                 goto LABEL_ERROR;
             }
-
-            uint64_t val;
-            memcpy(&val, key.mv_data, sizeof(uint64_t));
             LOGD("del skip: %016" PRIx64 "\n", val);
         }
 
@@ -2631,6 +2501,8 @@ bool ln_db_route_skip_drop(bool bTemp)
     }
 
     MDB_TXN_COMMIT(db.p_txn);
+
+    ln_routing_skip_drop(bTemp);
     return true;
 
 LABEL_ERROR:
@@ -2857,6 +2729,9 @@ bool ln_db_preimage_save(ln_db_preimage_t *pPreimage, void *pDb)
     info.expiry = pPreimage->expiry;
     data.mv_data = &info;
     int retval = mdb_put(db.p_txn, db.dbi, &key, &data, 0);
+    if (retval == 0) {
+        retval = preimage_hash_put(db.p_txn, pPreimage->preimage);
+    }
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         preimage_close(&db, p_txn, false);
@@ -2887,6 +2762,9 @@ bool ln_db_preimage_del(const uint8_t *pPreimage)
         key.mv_size = LN_SZ_PREIMAGE;
         key.mv_data = (CONST_CAST uint8_t *)pPreimage;
         retval = mdb_del(db.p_txn, db.dbi, &key, NULL);
+        if (retval == 0) {
+            retval = preimage_hash_del(db.p_txn, pPreimage);
+        }
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             preimage_close(&db, NULL, false);
@@ -2894,7 +2772,14 @@ bool ln_db_preimage_del(const uint8_t *pPreimage)
         }
     } else {
         LOGD("remove all\n");
+        MDB_dbi dbi_hash;
         retval = mdb_drop(db.p_txn, db.dbi, 1);
+        if (retval == 0) {
+            retval = preimage_hash_open(db.p_txn, &dbi_hash);
+        }
+        if (retval == 0) {
+            retval = mdb_drop(db.p_txn, dbi_hash, 1);
+        }
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             preimage_close(&db, NULL, false);
@@ -2914,9 +2799,90 @@ bool ln_db_preimage_search(ln_db_func_preimage_t pFunc, void *pFuncParam)
 }
 
 
+bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash, bool bNoExpire)
+{
+    int             retval;
+    ln_lmdb_db_t    db;
+    MDB_dbi         dbi_hash;
+    MDB_val         key, data;
+    preimage_info_t info;
+    bool            found = false;
+    bool            commit = false;
+
+    if (!preimage_open(&db, NULL)) {
+        LOGE("fail: open\n");
+        return false;
+    }
+
+    retval = preimage_hash_open(db.p_txn, &dbi_hash);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = (CONST_CAST uint8_t *)pPaymentHash;
+    retval = mdb_get(db.p_txn, dbi_hash, &key, &data);
+    if (retval) {
+        if (retval != MDB_NOTFOUND) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+        }
+        goto LABEL_EXIT;
+    }
+    if (data.mv_size != LN_SZ_PREIMAGE) {
+        LOGE("fail: invalid index\n");
+        goto LABEL_EXIT;
+    }
+    memcpy(pPreimage->preimage, data.mv_data, LN_SZ_PREIMAGE);
+
+    key.mv_size = LN_SZ_PREIMAGE;
+    key.mv_data = pPreimage->preimage;
+    retval = mdb_get(db.p_txn, db.dbi, &key, &data);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    memcpy(&info, data.mv_data, sizeof(info));
+    if ((info.expiry != UINT32_MAX) && ((uint64_t)utl_time_time() > info.creation + info.expiry)) {
+        //期限切れの削除は#ln_db_preimage_cur_get()で行う
+        LOGD("invoice expired\n");
+        goto LABEL_EXIT;
+    }
+    pPreimage->amount_msat = info.amount;
+    pPreimage->creation_time = info.creation;
+    pPreimage->expiry = info.expiry;
+    found = true;
+
+    if (bNoExpire && (info.expiry != UINT32_MAX)) {
+        //期限切れによる自動削除をしない
+        info.expiry = UINT32_MAX;
+        data.mv_size = sizeof(info);
+        data.mv_data = &info;
+        retval = mdb_put(db.p_txn, db.dbi, &key, &data, 0);
+        if (retval == 0) {
+            LOGD("  change expiry: %" PRIu32 "\n", info.expiry);
+            commit = true;
+        } else {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+        }
+    }
+
+LABEL_EXIT:
+    preimage_close(&db, NULL, commit);
+    return found;
+}
+
+
 bool ln_db_preimage_del_hash(const uint8_t *pPaymentHash)
 {
-    return preimage_search(preimage_cmp_func, true, (CONST_CAST uint8_t *)pPaymentHash);
+    ln_lmdb_db_t db;
+
+    if (!preimage_open(&db, NULL)) {
+        LOGE("fail: open\n");
+        return false;
+    }
+    int retval = preimage_del_hash(&db, pPaymentHash);
+    preimage_close(&db, NULL, retval == 0);
+    return retval == 0;
 }
 
 
@@ -2999,9 +2965,13 @@ bool ln_db_preimage_cur_get(void *pCur, bool *pDetect, ln_db_preimage_t *pPreima
         LOGD("invoice hash: ");
         DUMPD(hash, BTC_SZ_HASH256);
     } else {
+        uint8_t preimage[LN_SZ_PREIMAGE];
+        memcpy(preimage, key.mv_data, LN_SZ_PREIMAGE);
         LOGD("invoice expired del: ");
-        DUMPD(key.mv_data, key.mv_size);
-        mdb_cursor_del(p_cur->p_cursor, 0);
+        DUMPD(preimage, LN_SZ_PREIMAGE);
+        if (mdb_cursor_del(p_cur->p_cursor, 0) == 0) {
+            (void)preimage_hash_del(p_cur->p_txn, preimage);
+        }
     }
     return true;
 }
@@ -3345,11 +3315,15 @@ bool ln_db_revoked_tx_save(const ln_channel_t *pChannel, bool bUpdate, void *pDb
             LOGE("ERR: %s\n", mdb_strerror(retval));
             return false;
         }
-        retval = channel_save(pChannel, &db);
+        utl_buf_t buf_fund_tx = UTL_BUF_INIT;
+        btc_tx_write(&pChannel->funding_info.tx_data, &buf_fund_tx);
+        retval = channel_save(pChannel, &buf_fund_tx, NULL, &db);
+        utl_buf_free(&buf_fund_tx);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             return false;
         }
+        mChannelSavedGen++;
     }
     return true;
 }
@@ -3726,6 +3700,7 @@ ln_lmdb_db_type_t ln_lmdb_get_db_type(const MDB_env *pEnv, const char *pDbName)
         if (strcmp(pDbName, M_DBI_ROUTE_SKIP) == 0) return LN_LMDB_DB_TYPE_ROUTE_SKIP;
         if (strcmp(pDbName, M_DBI_INVOICE) == 0) return LN_LMDB_DB_TYPE_INVOICE;
         if (strcmp(pDbName, M_DBI_PREIMAGE) == 0) return LN_LMDB_DB_TYPE_PREIMAGE;
+        if (strcmp(pDbName, M_DBI_PREIMAGE_HASH) == 0) return LN_LMDB_DB_TYPE_PREIMAGE_HASH;
         if (strcmp(pDbName, M_DBI_PAYMENT_HASH) == 0) return LN_LMDB_DB_TYPE_PAYMENT_HASH;
     }
 
@@ -3740,6 +3715,7 @@ ln_lmdb_db_type_t ln_lmdb_get_db_type(const MDB_env *pEnv, const char *pDbName)
         if (strcmp(pDbName, M_DBI_ROUTE) == 0) return LN_LMDB_DB_TYPE_ROUTE;
         if (strcmp(pDbName, M_DBI_PAYMENT_INVOICE) == 0) return LN_LMDB_DB_TYPE_PAYMENT_INVOICE;
         if (strcmp(pDbName, M_DBI_PAYMENT_INFO) == 0) return LN_LMDB_DB_TYPE_PAYMENT_INFO;
+        if (strcmp(pDbName, M_DBI_PAYMENT_PART) == 0) return LN_LMDB_DB_TYPE_PAYMENT_PART;
     }
 
     return LN_LMDB_DB_TYPE_UNKNOWN;
@@ -3846,6 +3822,10 @@ void ln_db_copy_channel(ln_channel_t *pOutChannel, const ln_channel_t *pInChanne
     //XXX: check return code
 
     LOGD("recover\n");
+
+    //DBから読み込んだ内容で上書きするため、差分保存情報は使えない
+    channel_saved_free(pOutChannel);
+
     //fixed size data
 
     for (size_t lp = 0; lp < ARRAY_SIZE(DBCHANNEL_VALUES); lp++) {
@@ -4165,8 +4145,75 @@ bool ln_db_payment_info_del(uint64_t PaymentId)
 }
 
 
+bool ln_db_payment_part_save(uint64_t PaymentId, const ln_payment_part_t *pPart)
+{
+    return payment_save(
+        M_DBI_PAYMENT_PART, PaymentId, (const uint8_t *)pPart, sizeof(ln_payment_part_t));
+}
+
+
+bool ln_db_payment_part_load(ln_payment_part_t *pPart, uint64_t PaymentId)
+{
+    //partかどうかの判定にも使うため、見つからない場合はログを出さない
+    int             retval;
+    ln_lmdb_db_t    db;
+    MDB_val         key, data;
+    uint8_t         key_data[M_SZ_PAYMENT_ID_KEY];
+
+    retval = payment_db_open(&db, M_DBI_PAYMENT_PART, MDB_RDONLY, 0);
+    if (retval) {
+        return false;
+    }
+
+    payment_id_set_key(key_data, &key, PaymentId);
+    retval = mdb_get(db.p_txn, db.dbi, &key, &data);
+    if (retval) {
+        if (retval != MDB_NOTFOUND) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+        }
+        MDB_TXN_ABORT(db.p_txn);
+        return false;
+    }
+    if (data.mv_size != sizeof(ln_payment_part_t)) {
+        LOGE("fail: ???\n");
+        MDB_TXN_ABORT(db.p_txn);
+        return false;
+    }
+    memcpy(pPart, data.mv_data, data.mv_size);
+    MDB_TXN_ABORT(db.p_txn);
+    return true;
+}
+
+
+bool ln_db_payment_part_del(uint64_t PaymentId)
+{
+    return payment_del(M_DBI_PAYMENT_PART, PaymentId);
+}
+
+
 bool ln_db_payment_del_all(uint64_t PaymentId)
 {
+    //multi-path paymentのpart
+    //  (cursorはwrite transactionのため、閉じてから削除する)
+    uint64_t parts[LN_PAYMENT_PARTS_MAX];
+    int num = 0;
+    void *p_cur;
+    if (ln_db_payment_part_cur_open(&p_cur)) {
+        uint64_t part_id;
+        ln_payment_part_t part;
+        while ((num < LN_PAYMENT_PARTS_MAX) && ln_db_payment_part_cur_get(p_cur, &part_id, &part)) {
+            if (part.payment_id == PaymentId) {
+                parts[num++] = part_id;
+            }
+        }
+        ln_db_payment_part_cur_close(p_cur, false);
+    }
+    for (int lp = 0; lp < num; lp++) {
+        /*ignore*/ln_db_payment_shared_secrets_del(parts[lp]);
+        /*ignore*/ln_db_payment_route_del(parts[lp]);
+        /*ignore*/ln_db_payment_part_del(parts[lp]);
+    }
+
     /*ignore*/ln_db_payment_shared_secrets_del(PaymentId);
     /*ignore*/ln_db_payment_route_del(PaymentId);
     /*ignore*/ln_db_payment_invoice_del(PaymentId);
@@ -4213,15 +4260,51 @@ bool ln_db_payment_info_cur_del(void *pCur)
 }
 
 
-/********************************************************************
- * private functions
- ********************************************************************/
-
-static int db_open(ln_lmdb_db_t *pDb, MDB_env *env, const char *pDbName, int OptTxn, int OptDb)
+bool ln_db_payment_part_cur_open(void **ppCur)
 {
-    int retval;
+    return payment_cur_open(ppCur, M_DBI_PAYMENT_PART);
+}
 
-    retval = MDB_TXN_BEGIN(env, NULL, OptTxn, &pDb->p_txn);
+
+void ln_db_payment_part_cur_close(void *pCur, bool bCommit)
+{
+    payment_cur_close(pCur, bCommit);
+}
+
+
+bool ln_db_payment_part_cur_get(void *pCur, uint64_t *pPaymentId, ln_payment_part_t *pPart)
+{
+    utl_buf_t buf = UTL_BUF_INIT;
+    if (!payment_cur_get(pCur, pPaymentId, &buf)) {
+        utl_buf_free(&buf);
+        return false;
+    }
+    if (buf.len != sizeof(ln_payment_part_t)) {
+        LOGE("fail: ???\n");
+        utl_buf_free(&buf);
+        return false;
+    }
+    memcpy(pPart, buf.buf, buf.len);
+    utl_buf_free(&buf);
+    return true;
+}
+
+
+bool ln_db_payment_part_cur_del(void *pCur)
+{
+    return payment_cur_del(pCur);
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+static int db_open(ln_lmdb_db_t *pDb, MDB_env *env, const char *pDbName, int OptTxn, int OptDb)
+{
+    int retval;
+
+    retval = MDB_TXN_BEGIN(env, NULL, OptTxn, &pDb->p_txn);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         pDb->p_txn = NULL;
@@ -4380,17 +4463,21 @@ static int channel_htlc_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
 
 
 /** channel: htlc書込み
+ *
+ * pSavedがある場合、前回保存から変化したHTLCだけを書き込む。
  *
  * @param[in]       pChannel
+ * @param[in]       pSaved          前回保存した内容(NULL:全HTLC保存)
  * @param[in]       pDb
  * @retval      true    成功
  */
-static int channel_htlc_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
+static int channel_htlc_save(const ln_channel_t *pChannel, const channel_saved_t *pSaved, ln_lmdb_db_t *pDb)
 {
-    int         retval;
+    int         retval = 0;
     MDB_dbi     dbi;
-    MDB_val     key, data;
     char        db_name[M_SZ_CHANNEL_DB_NAME_STR + M_SZ_HTLC_IDX_STR + 1];
+    const uint8_t *p_saved_values = NULL;
+    size_t      htlc_values_size = fixed_items_size(DBHTLC_VALUES, ARRAY_SIZE(DBHTLC_VALUES));
 
     uint8_t *OFFSET =
         ((uint8_t *)pChannel) + offsetof(ln_channel_t, update_info) + offsetof(ln_update_info_t, htlcs);
@@ -4398,7 +4485,27 @@ static int channel_htlc_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
     memcpy(db_name, M_PREF_HTLC, M_SZ_PREF_STR);
     utl_str_bin2str(db_name + M_SZ_PREF_STR, pChannel->channel_id, LN_SZ_CHANNEL_ID);
 
+    if (pSaved) {
+        p_saved_values = pSaved->p_values + fixed_items_size(DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES));
+    }
     for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+        const ln_htlc_t *p_htlc = &pChannel->update_info.htlcs[lp];
+        const uint8_t *p_saved = NULL;
+        const utl_buf_t *p_saved_bufs = NULL;
+
+        if (pSaved) {
+            p_saved = p_saved_values + htlc_values_size * lp;
+            p_saved_bufs = pSaved->htlc_bufs[lp];
+
+            //変化がなければDBを開かない
+            if (fixed_items_equal(p_htlc, p_saved, DBHTLC_VALUES, ARRAY_SIZE(DBHTLC_VALUES)) &&
+                ((p_htlc->buf_preimage.len == 0) || utl_buf_equal(&p_htlc->buf_preimage, &p_saved_bufs[0])) &&
+                utl_buf_equal(&p_htlc->buf_onion_reason, &p_saved_bufs[1]) &&
+                utl_buf_equal(&p_htlc->buf_shared_secret, &p_saved_bufs[2])) {
+                continue;
+            }
+        }
+
         channel_htlc_db_name(db_name, lp);
         //LOGD("[%d]db_name: %s\n", lp, db_name);
         retval = MDB_DBI_OPEN(pDb->p_txn, db_name, MDB_CREATE, &dbi);
@@ -4411,7 +4518,7 @@ static int channel_htlc_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
         ln_lmdb_db_t db;
         db.p_txn = pDb->p_txn;
         db.dbi = dbi;
-        retval = fixed_items_save(OFFSET + sizeof(ln_htlc_t) * lp,
+        retval = fixed_items_save_diff(OFFSET + sizeof(ln_htlc_t) * lp, p_saved,
                         &db, DBHTLC_VALUES, ARRAY_SIZE(DBHTLC_VALUES));
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -4419,33 +4526,24 @@ static int channel_htlc_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
         }
 
         //variable
-        if (pChannel->update_info.htlcs[lp].buf_preimage.len) {
-            key.mv_size = M_SZ_PREIMAGE;
-            key.mv_data = M_KEY_PREIMAGE;
-            data.mv_size = pChannel->update_info.htlcs[lp].buf_preimage.len;
-            data.mv_data = pChannel->update_info.htlcs[lp].buf_preimage.buf;
-            retval = mdb_put(pDb->p_txn, dbi, &key, &data, 0);
+        if (p_htlc->buf_preimage.len) {
+            retval = channel_buf_save(&db, M_KEY_PREIMAGE, &p_htlc->buf_preimage,
+                        (p_saved_bufs) ? &p_saved_bufs[0] : NULL);
             if (retval) {
                 LOGE("ERR: %s(preimage)\n", mdb_strerror(retval));
                 goto LABEL_EXIT;
             }
         }
 
-        key.mv_size = M_SZ_ONION_ROUTE;
-        key.mv_data = M_KEY_ONION_ROUTE;
-        data.mv_size = pChannel->update_info.htlcs[lp].buf_onion_reason.len;
-        data.mv_data = pChannel->update_info.htlcs[lp].buf_onion_reason.buf;
-        retval = mdb_put(pDb->p_txn, dbi, &key, &data, 0);
+        retval = channel_buf_save(&db, M_KEY_ONION_ROUTE, &p_htlc->buf_onion_reason,
+                        (p_saved_bufs) ? &p_saved_bufs[1] : NULL);
         if (retval) {
             LOGE("ERR: %s(onion_route)\n", mdb_strerror(retval));
             goto LABEL_EXIT;
         }
 
-        key.mv_size = M_SZ_SHARED_SECRET;
-        key.mv_data = M_KEY_SHARED_SECRET;
-        data.mv_size = pChannel->update_info.htlcs[lp].buf_shared_secret.len;
-        data.mv_data = pChannel->update_info.htlcs[lp].buf_shared_secret.buf;
-        retval = mdb_put(pDb->p_txn, dbi, &key, &data, 0);
+        retval = channel_buf_save(&db, M_KEY_SHARED_SECRET, &p_htlc->buf_shared_secret,
+                        (p_saved_bufs) ? &p_saved_bufs[2] : NULL);
         if (retval) {
             LOGE("ERR: %s(shared_secret)\n", mdb_strerror(retval));
             goto LABEL_EXIT;
@@ -4458,33 +4556,31 @@ LABEL_EXIT:
 
 
 /** channel情報書き込み
+ *
+ * pSavedがある場合、前回保存から変化した項目だけを書き込む。
  *
  * @param[in]       pChannel
+ * @param[in]       pBufFundTx      funding_info.tx_dataの展開データ
+ * @param[in]       pSaved          前回保存した内容(NULL:全項目保存)
  * @param[in,out]   pDb
  * @retval      true    成功
  */
-static int channel_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
+static int channel_save(const ln_channel_t *pChannel, const utl_buf_t *pBufFundTx, const channel_saved_t *pSaved, ln_lmdb_db_t *pDb)
 {
-    MDB_val key, data;
     int     retval;
 
     //fixed size data
-    retval = fixed_items_save(pChannel, pDb, DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES));
+    retval = fixed_items_save_diff(pChannel, (pSaved) ? pSaved->p_values : NULL,
+                        pDb, DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES));
     if (retval) {
         return retval;
     }
 
     //variable size data
-    utl_buf_t buf_fund_tx = UTL_BUF_INIT;
-    btc_tx_write(&pChannel->funding_info.tx_data, &buf_fund_tx);
-    variable_item_t *p_variable_items = (variable_item_t *)UTL_DBG_MALLOC(sizeof(variable_item_t) * M_NUM_CHANNEL_BUFS);
-    if (!p_variable_items) {
-        LOGE("fail: ???");
-        goto LABEL_EXIT;
-    }
+    variable_item_t p_variable_items[M_NUM_CHANNEL_BUFS];
     int index = 0;
     p_variable_items[index].p_name = "buf_fund_tx";
-    p_variable_items[index].p_buf = &buf_fund_tx;
+    p_variable_items[index].p_buf = (CONST_CAST utl_buf_t *)pBufFundTx;
     index++;
     M_BUF_ITEM(index, shutdown_scriptpk_local);
     index++;
@@ -4492,24 +4588,128 @@ static int channel_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
     //index++;
 
     for (size_t lp = 0; lp < M_NUM_CHANNEL_BUFS; lp++) {
-        key.mv_size = strlen(p_variable_items[lp].p_name);
-        key.mv_data = (CONST_CAST char*)p_variable_items[lp].p_name;
-        data.mv_size = p_variable_items[lp].p_buf->len;
-        data.mv_data = p_variable_items[lp].p_buf->buf;
-        retval = mdb_put(pDb->p_txn, pDb->dbi, &key, &data, 0);
+        retval = channel_buf_save(pDb, p_variable_items[lp].p_name, p_variable_items[lp].p_buf,
+                        (pSaved) ? &pSaved->bufs[lp] : NULL);
         if (retval) {
             LOGE("fail: %s\n", p_variable_items[lp].p_name);
-            goto LABEL_EXIT;
+            break;
         }
     }
 
-LABEL_EXIT:
-    utl_buf_free(&buf_fund_tx);
-    UTL_DBG_FREE(p_variable_items);
     return retval;
 }
 
 
+/** variable長データ書き込み
+ *
+ * @param[in]       pDb
+ * @param[in]       pKey
+ * @param[in]       pBuf
+ * @param[in]       pSaved          前回保存した内容(NULL:必ず書き込む)
+ * @retval      0   成功(pSavedと同じ場合は書き込まない)
+ */
+static int channel_buf_save(ln_lmdb_db_t *pDb, const char *pKey, const utl_buf_t *pBuf, const utl_buf_t *pSaved)
+{
+    MDB_val key, data;
+
+    if (pSaved && utl_buf_equal(pBuf, pSaved)) {
+        return 0;
+    }
+    key.mv_size = strlen(pKey);
+    key.mv_data = (CONST_CAST char *)pKey;
+    data.mv_size = pBuf->len;
+    data.mv_data = pBuf->buf;
+    return mdb_put(pDb->p_txn, pDb->dbi, &key, &data, 0);
+}
+
+
+/** 保存済み情報の更新
+ *
+ * ln_db_channel_save()のcommit後に呼び出す。
+ *
+ * @param[in]       pChannel
+ * @param[in]       pBufFundTx      保存したfunding_info.tx_dataの展開データ
+ * @param[in]       Gen             保存時のmChannelSavedGen
+ */
+static void channel_saved_update(const ln_channel_t *pChannel, const utl_buf_t *pBufFundTx, uint32_t Gen)
+{
+    channel_saved_t *p_saved = (channel_saved_t *)pChannel->p_db_saved;
+    if (!p_saved) {
+        p_saved = (channel_saved_t *)UTL_DBG_MALLOC(sizeof(channel_saved_t));
+        if (!p_saved) {
+            LOGE("fail: ???\n");
+            return;
+        }
+        memset(p_saved, 0, sizeof(channel_saved_t));
+        p_saved->p_values = (uint8_t *)UTL_DBG_MALLOC(
+            fixed_items_size(DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES)) +
+            fixed_items_size(DBHTLC_VALUES, ARRAY_SIZE(DBHTLC_VALUES)) * LN_HTLC_MAX);
+        if (!p_saved->p_values) {
+            LOGE("fail: ???\n");
+            UTL_DBG_FREE(p_saved);
+            return;
+        }
+        //pChannelはconstだが、保存済み情報はDB処理で管理している
+        ((ln_channel_t *)pChannel)->p_db_saved = p_saved;
+    }
+    p_saved->gen = Gen;
+
+    uint8_t *p_values = fixed_items_copy(p_saved->p_values, pChannel, DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES));
+    const utl_buf_t *p_bufs[M_NUM_CHANNEL_BUFS] = {
+        pBufFundTx, &pChannel->shutdown_scriptpk_local, &pChannel->shutdown_scriptpk_remote
+    };
+    for (size_t lp = 0; lp < M_NUM_CHANNEL_BUFS; lp++) {
+        if (!utl_buf_equal(&p_saved->bufs[lp], p_bufs[lp])) {
+            utl_buf_free(&p_saved->bufs[lp]);
+            utl_buf_alloccopy(&p_saved->bufs[lp], p_bufs[lp]->buf, p_bufs[lp]->len);
+        }
+    }
+
+    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+        const ln_htlc_t *p_htlc = &pChannel->update_info.htlcs[lp];
+        p_values = fixed_items_copy(p_values, p_htlc, DBHTLC_VALUES, ARRAY_SIZE(DBHTLC_VALUES));
+
+        const utl_buf_t *p_htlc_bufs[M_NUM_HTLC_BUFS] = {
+            &p_htlc->buf_preimage, &p_htlc->buf_onion_reason, &p_htlc->buf_shared_secret
+        };
+        for (size_t lp2 = 0; lp2 < M_NUM_HTLC_BUFS; lp2++) {
+            if ((lp2 == 0) && (p_htlc->buf_preimage.len == 0)) {
+                //preimageは長さ0の場合は書き込んでいないため、DBに残っている値のまま
+                continue;
+            }
+            if (!utl_buf_equal(&p_saved->htlc_bufs[lp][lp2], p_htlc_bufs[lp2])) {
+                utl_buf_free(&p_saved->htlc_bufs[lp][lp2]);
+                utl_buf_alloccopy(&p_saved->htlc_bufs[lp][lp2], p_htlc_bufs[lp2]->buf, p_htlc_bufs[lp2]->len);
+            }
+        }
+    }
+}
+
+
+/** 保存済み情報の解放
+ *
+ * @param[in,out]   pChannel
+ */
+static void channel_saved_free(const ln_channel_t *pChannel)
+{
+    channel_saved_t *p_saved = (channel_saved_t *)pChannel->p_db_saved;
+    if (!p_saved) {
+        return;
+    }
+    for (size_t lp = 0; lp < M_NUM_CHANNEL_BUFS; lp++) {
+        utl_buf_free(&p_saved->bufs[lp]);
+    }
+    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+        for (size_t lp2 = 0; lp2 < M_NUM_HTLC_BUFS; lp2++) {
+            utl_buf_free(&p_saved->htlc_bufs[lp][lp2]);
+        }
+    }
+    UTL_DBG_FREE(p_saved->p_values);
+    UTL_DBG_FREE(p_saved);
+    ((ln_channel_t *)pChannel)->p_db_saved = NULL;
+}
+
+
 static int channel_item_load(ln_channel_t *pChannel, const fixed_item_t *pItems, ln_lmdb_db_t *pDb)
 {
     int     retval;
@@ -4564,6 +4764,7 @@ static int channel_item_save(const ln_channel_t *pChannel, const fixed_item_t *p
         LOGE("fail: %s(%s)\n", mdb_strerror(retval), pItems->p_name);
         goto LABEL_EXIT;
     }
+    mChannelSavedGen++;
 
 LABEL_EXIT:
     if (p_bak_db_param == NULL) {
@@ -4757,7 +4958,9 @@ static bool channel_search(ln_db_func_cmp_t pFunc, void *pFuncParam, bool bWrita
             continue;
         }
 
-        if (!(*pFunc)(p_channel, (void *)&cur, pFuncParam)) {
+        bool ret = (*pFunc)(p_channel, (void *)&cur, pFuncParam);
+        channel_saved_free(p_channel);
+        if (!ret) {
             ln_term(p_channel);     //falseのみ解放
             continue;
         }
@@ -4798,7 +5001,9 @@ static void channel_copy_closed(MDB_txn *pTxn, const char *pChannelStr)
     init_param.pp_env = &p_env_closed;
     init_param.p_path = path_env;
     init_param.maxdbs = M_CLOSED_MAXDBS;
+    init_param.maxdbs_channel = 0;
     init_param.mapsize = M_CLOSED_MAPSIZE;
+    init_param.mapsize_channel = 0;
     init_param.open_flag = 0;
     retval = init_db_env(&init_param);
     if (retval) {
@@ -4902,6 +5107,40 @@ static int node_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, int
 }
 
 
+/** "route_skip" value解析
+ *
+ * 古いDBのvalue(長さ0:PERM, 長さ1:期限なし)も受け付ける。
+ *
+ * @param[in]   pData       value
+ * @param[out]  pType       LN_DB_ROUTE_SKIP_TEMP/PERM/WORK
+ * @param[out]  pExpiry     有効期限(0:期限なし)
+ * @retval  false   不正なvalue
+ */
+static bool route_skip_parse(const MDB_val *pData, uint8_t *pType, uint64_t *pExpiry)
+{
+    const uint8_t *p_data = (const uint8_t *)pData->mv_data;
+
+    *pExpiry = 0;
+    if (pData->mv_size == 0) {
+        *pType = LN_DB_ROUTE_SKIP_PERM;
+    } else if (pData->mv_size == sizeof(uint8_t)) {
+        *pType = p_data[0];
+    } else if (pData->mv_size == LN_DB_ROUTE_SKIP_SZ_EXPIRY) {
+        *pType = p_data[0];
+        memcpy(pExpiry, p_data + sizeof(uint8_t), sizeof(uint64_t));
+    } else {
+        return false;
+    }
+    return (*pType == LN_DB_ROUTE_SKIP_TEMP) || (*pType == LN_DB_ROUTE_SKIP_PERM) || (*pType == LN_DB_ROUTE_SKIP_WORK);
+}
+
+
+static bool route_skip_expired(uint64_t Expiry, uint64_t Now)
+{
+    return (Expiry != 0) && (Expiry <= Now);
+}
+
+
 /********************************************************************
  * private functions: announce
  ********************************************************************/
@@ -5163,159 +5402,6 @@ static int nodeanno_save(ln_lmdb_db_t *pDb, const utl_buf_t *pNodeAnno, const ui
 }
 
 
-static bool annoinfos_trim_node_id(const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo)
-{
-    LOGD("del annoinfo: ");
-    DUMPD(pNodeId, BTC_SZ_PUBKEY);
-    MDB_cursor  *p_cursor;
-
-    //cnlanno_info
-    int retval1 = mdb_cursor_open(mpTxnAnno, DbiCnlannoInfo, &p_cursor);
-    if (retval1 == 0) {
-        if (!annoinfo_cur_trim_node_id(p_cursor, pNodeId)) {
-            retval1 = -1;
-        }
-        MDB_CURSOR_CLOSE(p_cursor);
-    } else {
-        LOGE("ERR: %s\n", mdb_strerror(retval1));
-    }
-
-    //nodeanno_info
-    int retval2 = mdb_cursor_open(mpTxnAnno, DbiNodeannoInfo, &p_cursor);
-    if (retval2 == 0) {
-        if (!annoinfo_cur_trim_node_id(p_cursor, pNodeId)) {
-            retval2 = -1;
-        }
-        MDB_CURSOR_CLOSE(p_cursor);
-    } else {
-        LOGE("ERR: %s\n", mdb_strerror(retval2));
-    }
-
-    return (retval1 == 0) && (retval2 == 0);
-}
-
-
-/** annoinfo(送信済み情報)のchannelとnodeから、指定されたshort_channel_id[]についてだけ未送信状態にする。
- *  (未送信状態＝node_idを mv_dataから削除する)
- *
- * 未送信のannouncementは、自動的に送信が行われる。
- * channel_announcementから両端のnode_idもわかるため、それを未送信にする。
- */
-static bool annoinfos_trim_node_id_selected(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
-    const uint64_t *pShortChannelIds, size_t Num)
-{
-    int retval;
-    LOGD("del selected annoinfo: ");
-    DUMPD(pNodeId, BTC_SZ_PUBKEY);
-
-    //channel_announcement取得用
-    ln_lmdb_db_t db;
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, 0, &db.dbi);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        return false;
-    }
-    db.p_txn = mpTxnAnno;
-
-    for(size_t lp = 0; lp < Num; lp++) {
-        LOGD(" %d: %016" PRIx64 "\n", lp, pShortChannelIds[lp]);
-
-        MDB_val key, data;
-        uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
-
-        const char TYPES[] = { LN_DB_CNLANNO_ANNO, LN_DB_CNLANNO_UPD0, LN_DB_CNLANNO_UPD1 };
-        for (size_t type = 0; type < ARRAY_SIZE(TYPES); type++) {
-            cnlanno_info_set_key(key_data, &key, pShortChannelIds[lp], TYPES[type]);
-            int retval = mdb_get(mpTxnAnno, DbiCnlannoInfo, &key, &data);
-            if (retval) {
-                LOGD("nof found: %016" PRIx64 " %c\n", pShortChannelIds[lp], TYPES[type]);
-                continue;
-            }
-
-            LOGD("found: %016" PRIx64 " %c\n", pShortChannelIds[lp], TYPES[type]);
-
-            if (TYPES[type] == LN_DB_CNLANNO_ANNO) {
-                //trim node_id in  node_announcement
-                annoinfos_trim_node_id_nodeanno(pNodeId, pShortChannelIds[lp], DbiNodeannoInfo, &db);
-            }
-
-            if (!annoinfo_trim_node_id(&data, pNodeId)) {
-                continue;
-            }
-            if (!my_mdb_val_alloccopy(&key, &key)) {
-                LOGE("fail: ???\n");
-                UTL_DBG_FREE(data.mv_data);
-                return false;
-            }
-            retval = mdb_put(mpTxnAnno, DbiCnlannoInfo, &key, &data, 0);
-            if (retval) {
-                LOGE("ERR: %s\n", mdb_strerror(retval));
-                //XXX: ???
-            }
-            UTL_DBG_FREE(data.mv_data);
-            UTL_DBG_FREE(key.mv_data);
-        }
-    }
-    //XXX: return true;
-    //  not tested, always return false
-    return false;
-}
-
-
-static bool annoinfos_trim_node_id_nodeanno(
-    const uint8_t *pNodeId, uint64_t ShortChannelId, MDB_dbi DbiNodeannoInfo,
-    ln_lmdb_db_t *pDb)
-{
-    ln_msg_channel_announcement_t msg;
-    utl_buf_t buf_cnlanno = UTL_BUF_INIT;
-    int retval = cnlanno_load(pDb, &buf_cnlanno, ShortChannelId);
-    if (retval) {
-        //XXX: ???
-        return true;
-    }
-    if (!ln_msg_channel_announcement_read(&msg, buf_cnlanno.buf, buf_cnlanno.len)) {
-        //XXX: ???
-        utl_buf_free(&buf_cnlanno);
-        return true;
-    }
-    MDB_val key, data;
-    uint8_t key_data[M_SZ_NODEANNO_INFO_KEY];
-
-    const uint8_t *p_node_id[2];
-    p_node_id[0] = msg.p_node_id_1;
-    p_node_id[1] = msg.p_node_id_2;
-    for (int lp = 0; lp < 2; lp++) {
-        nodeanno_info_set_key(key_data, &key, p_node_id[lp]);
-        int retval = mdb_get(mpTxnAnno, DbiNodeannoInfo, &key, &data);
-        if (retval) {
-            //XXX: ???
-            continue;
-        }
-        LOGD("found: ");
-        DUMPD(p_node_id[lp], BTC_SZ_PUBKEY);
-
-        if (!annoinfo_trim_node_id(&data, pNodeId)) {
-            //XXX: ???
-            continue;
-        }
-        if (!my_mdb_val_alloccopy(&key, &key)) {
-            //XXX: ???
-            UTL_DBG_FREE(data.mv_data);
-            continue;
-        }
-        retval = mdb_put(mpTxnAnno, DbiNodeannoInfo, &key, &data, 0);
-        if (retval) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
-        UTL_DBG_FREE(data.mv_data);
-        UTL_DBG_FREE(key.mv_data);
-    }
-    utl_buf_free(&buf_cnlanno);
-    return true;
-}
-
-
 static bool annoinfos_del_all(MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo)
 {
     LOGD("del annoinfo: ALL\n");
@@ -5376,177 +5462,6 @@ static void nodeanno_info_set_key(uint8_t *pKeyData, MDB_val *pKey, const uint8_
 // }
 
 
-/** annoinfoにnode_idを追加(channel, node共通)
- *
- * @param[in,out]   pDb         annoinfo
- * @param[in]       pMdbKey     loadしたchannel_announcement infoのkey
- * @param[in]       pMdbData    loadしたchannel_announcement infoのdata
- * @param[in]       pNodeId     追加するnode_id(NULL時はクリア)
- */
-static bool annoinfo_add(ln_lmdb_db_t *pDb, MDB_val *pMdbKey, MDB_val *pMdbData, const uint8_t *pNodeId)
-{
-    uint8_t *p_ids;
-
-    if (pNodeId) {
-        int nums = pMdbData->mv_size / BTC_SZ_PUBKEY;
-        p_ids = (uint8_t *)UTL_DBG_MALLOC((nums + 1) * BTC_SZ_PUBKEY);
-        if (!p_ids) {
-            LOGE("fail: ???");
-            return false;
-        }
-        //append
-        memcpy(p_ids, pMdbData->mv_data, pMdbData->mv_size);
-        memcpy(p_ids + pMdbData->mv_size, pNodeId, BTC_SZ_PUBKEY);
-        pMdbData->mv_size += BTC_SZ_PUBKEY;
-    } else {
-        pMdbData->mv_size = 0;
-        p_ids = NULL;
-    }
-
-    pMdbData->mv_data = p_ids;
-    int retval = mdb_put(mpTxnAnno, pDb->dbi, pMdbKey, pMdbData, 0);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-    }
-    UTL_DBG_FREE(p_ids);
-    return retval == 0;
-}
-
-
-/** annoinfoからnode_idの有無を検索(channel, node共通)
- *
- * @param[in]   pMdbData
- * @param[in]   pNodeId
- * @retval  true    検出
- */
-static bool annoinfo_search_node_id(MDB_val *pMdbData, const uint8_t *pNodeId)
-{
-    int nums = pMdbData->mv_size / BTC_SZ_PUBKEY;
-    //LOGD("nums=%d\n", nums);
-    //LOGD("search id: ");
-    //DUMPD(pNodeId, BTC_SZ_PUBKEY);
-    for (int lp = 0; lp < nums; lp++) {
-        //LOGD("  node_id[%d]= ", lp);
-        //DUMPD(pMdbData->mv_data + BTC_SZ_PUBKEY * lp, BTC_SZ_PUBKEY);
-        if (memcmp((uint8_t *)pMdbData->mv_data + BTC_SZ_PUBKEY * lp, pNodeId, BTC_SZ_PUBKEY)) continue;
-        return true;
-    }
-    return false;
-}
-
-
-/** annoinfoからnode_idを削除(channel, node共通)
- *
- * @param[in]   pCursor
- * @param[in]   pNodeId
- */
-static bool annoinfo_cur_trim_node_id(MDB_cursor *pCursor, const uint8_t *pNodeId)
-{
-    //XXX: check error code
-    MDB_val key, data;
-
-    while (mdb_cursor_get(pCursor, &key, &data, MDB_NEXT) == 0) {
-        if (!annoinfo_trim_node_id(&data, pNodeId)) continue;
-        if (!my_mdb_val_alloccopy(&key, &key)) {
-            UTL_DBG_FREE(data.mv_data);
-            LOGE("fail: ???\n");
-            return false;
-        }
-        int retval = mdb_cursor_put(pCursor, &key, &data, MDB_CURRENT);
-        if (retval) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
-        UTL_DBG_FREE(data.mv_data);
-        UTL_DBG_FREE(key.mv_data);
-    }
-    return true; //XXX: ???
-}
-
-
-//need free() pData->mv_data
-static bool annoinfo_trim_node_id(MDB_val *pData, const uint8_t *pNodeId)
-{
-    int nums = pData->mv_size / BTC_SZ_PUBKEY;
-
-    if (!nums) {
-        return false;
-    }
-
-    int lp;
-    for (lp = 0; lp < nums; lp++) {
-        if (memcmp((uint8_t *)pData->mv_data + BTC_SZ_PUBKEY * lp, pNodeId, BTC_SZ_PUBKEY)) continue;
-        break;
-    }
-
-    if (lp == nums) {
-        return false;
-    }
-
-    nums--;
-    if (nums) {
-        uint8_t *p_data = (uint8_t *)UTL_DBG_MALLOC(BTC_SZ_PUBKEY * nums);
-        if (!p_data) {
-            LOGE("fail: ???\n");
-            return false;
-        }
-        memcpy(p_data, (uint8_t *)pData->mv_data, BTC_SZ_PUBKEY * lp);
-        memcpy(p_data + BTC_SZ_PUBKEY * lp,
-            (uint8_t *)pData->mv_data + BTC_SZ_PUBKEY * (lp + 1), BTC_SZ_PUBKEY * (nums - lp));
-
-        pData->mv_size = BTC_SZ_PUBKEY * nums;
-        pData->mv_data = p_data;
-    } else {
-        pData->mv_size = 0;
-        pData->mv_data = NULL;
-    }
-    return true;
-}
-
-
-/** annoinfoにnode_idを追加(channel, node共通)
- *
- * @param[in]   pCursor
- * @param[in]   pNodeId
- */
-static void annoinfo_cur_add(MDB_cursor *pCursor, const uint8_t *pNodeId)
-{
-    //XXX: check error code
-    MDB_val     key, data;
-
-    while (mdb_cursor_get(pCursor, &key, &data, MDB_NEXT) == 0) {
-        int nums = data.mv_size / BTC_SZ_PUBKEY;
-        int lp;
-        for (lp = 0; lp < nums; lp++) {
-            if (memcmp((uint8_t *)data.mv_data + BTC_SZ_PUBKEY * lp, pNodeId, BTC_SZ_PUBKEY)) continue;
-            break;
-        }
-        if (lp == nums) continue;
-
-        if (!my_mdb_val_alloccopy(&key, &key)) {
-            LOGE("fail: ???");
-            break;
-        }
-        nums++;
-        uint8_t *p_data = (uint8_t *)UTL_DBG_MALLOC(BTC_SZ_PUBKEY * nums);
-        if (!p_data) {
-            UTL_DBG_FREE(key.mv_data);
-            LOGE("fail: ???");
-            break;
-        }
-        memcpy(p_data, data.mv_data, data.mv_size);
-        memcpy(p_data + data.mv_size, pNodeId, BTC_SZ_PUBKEY);
-        data.mv_size = BTC_SZ_PUBKEY * nums;
-        data.mv_data = p_data;
-        int retval = mdb_cursor_put(pCursor, &key, &data, MDB_CURRENT);
-        if (retval) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
-        UTL_DBG_FREE(data.mv_data);
-        UTL_DBG_FREE(key.mv_data);
-    }
-}
-
-
 /** channel_updateの枝刈り
  *      - channel_announcementがない(自channel以外)
  *      - 期限切れ
@@ -5576,7 +5491,7 @@ static void anno_del_prune(void)
     while (ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, &timestamp, &buf_cnlanno)) {
         fprintf(stderr, ".");
         utl_buf_free(&buf_cnlanno);
-        if (type != LN_DB_CNLANNO_UPD0 || type != LN_DB_CNLANNO_UPD1) continue;
+        if ((type != LN_DB_CNLANNO_UPD0) && (type != LN_DB_CNLANNO_UPD1)) continue;
         if (!ln_db_cnlupd_need_to_prune(now, timestamp)) continue;
 
         MDB_cursor *p_cursor = ((lmdb_cursor_t *)p_cur)->p_cursor;
@@ -5589,6 +5504,15 @@ static void anno_del_prune(void)
     }
 
     ln_db_anno_cur_close(p_cur);
+
+    //送信済みnode_idはgossip logのcursorで管理するため、以前のDBは削除する
+    MDB_dbi dbi_cnlanno_info;
+    MDB_dbi dbi_nodeanno_info;
+    if ((MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, 0, &dbi_cnlanno_info) == 0) &&
+        (MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, 0, &dbi_nodeanno_info) == 0)) {
+        (void)annoinfos_del_all(dbi_cnlanno_info, dbi_nodeanno_info);
+    }
+
     ln_db_anno_commit(true);
     fprintf(stderr, "done!\n");
 }
@@ -5635,78 +5559,190 @@ static void preimage_close(ln_lmdb_db_t *pDb, MDB_txn *pTxn, bool bCommit)
 }
 
 
-/** #ln_db_preimage_del_hash()用処理関数
+/** preimage検索(自分で作成)
+ *  @param[in]bCommit       true    cursor close時にcommitを行う
+ */
+static bool preimage_search(ln_db_func_preimage_t pFunc, bool bCommit, void *pFuncParam)
+{
+    bool found = false;
+    void *p_cur;
+    ln_db_preimage_t preimage;
+    bool detect;
+
+    if (!ln_db_preimage_cur_open(&p_cur)) return false;
+    while (ln_db_preimage_cur_get(p_cur, &detect, &preimage)) {
+        if (!detect) continue;
+        if (!(*pFunc)(preimage.preimage, preimage.amount_msat, preimage.expiry, p_cur, pFuncParam)) continue;
+        found = true;
+        break;
+    }
+    ln_db_preimage_cur_close(p_cur, bCommit);
+    return found;
+}
+
+
+/** payment_hash index DBオープン
  *
- * SHA256(preimage)がpayment_hashと一致した場合にDBから削除する。
+ * @param[in]       pTxn        preimage DBのtransaction
+ * @param[out]      pDbi
+ * @retval  0       成功
  */
-static bool preimage_cmp_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam)
+static int preimage_hash_open(MDB_txn *pTxn, MDB_dbi *pDbi)
 {
-    (void)Amount; (void)Expiry;
+    return MDB_DBI_OPEN(pTxn, M_DBI_PREIMAGE_HASH, MDB_CREATE, pDbi);
+}
 
-    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pDbParam;
-    const uint8_t *hash = (const uint8_t *)pParam;
-    uint8_t preimage_hash[BTC_SZ_HASH256];
 
-    LOGD("compare preimage : ");
-    DUMPD(pPreimage, LN_SZ_PREIMAGE);
-    ln_payment_hash_calc(preimage_hash, pPreimage);
+/** payment_hash index追加
+ *
+ * @param[in]       pTxn        preimage DBのtransaction
+ * @param[in]       pPreimage   preimage
+ * @retval  0       成功
+ */
+static int preimage_hash_put(MDB_txn *pTxn, const uint8_t *pPreimage)
+{
+    MDB_dbi dbi;
+    MDB_val key, data;
+    uint8_t payment_hash[BTC_SZ_HASH256];
 
-    if (memcmp(preimage_hash, hash, BTC_SZ_HASH256)) {
-        LOGD("  not found");
-        return false;
+    int retval = preimage_hash_open(pTxn, &dbi);
+    if (retval) {
+        return retval;
     }
-
-    int retval = mdb_cursor_del(p_cur->p_cursor, 0);
-    LOGD("  remove from DB: %s\n", mdb_strerror(retval));
-    return retval == 0;
+    ln_payment_hash_calc(payment_hash, pPreimage);
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = payment_hash;
+    data.mv_size = LN_SZ_PREIMAGE;
+    data.mv_data = (CONST_CAST uint8_t *)pPreimage;
+    return mdb_put(pTxn, dbi, &key, &data, 0);
 }
 
 
-/** ln_db_channel_del_param用処理関数
+/** payment_hash index削除
  *
- * SHA256(preimage)がpayment_hashと一致した場合、DBから削除する。
+ * @param[in]       pTxn        preimage DBのtransaction
+ * @param[in]       pPreimage   preimage
+ * @retval  0       成功(indexが無い場合も含む)
  */
-static bool preimage_cmp_all_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam)
+static int preimage_hash_del(MDB_txn *pTxn, const uint8_t *pPreimage)
 {
-    (void)Amount; (void)Expiry;
+    MDB_dbi dbi;
+    MDB_val key;
+    uint8_t payment_hash[BTC_SZ_HASH256];
+
+    int retval = preimage_hash_open(pTxn, &dbi);
+    if (retval) {
+        return retval;
+    }
+    ln_payment_hash_calc(payment_hash, pPreimage);
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = payment_hash;
+    retval = mdb_del(pTxn, dbi, &key, NULL);
+    if (retval == MDB_NOTFOUND) {
+        retval = 0;
+    }
+    return retval;
+}
 
-    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pDbParam;
-    preimage_close_t *param = (preimage_close_t *)pParam;
-    uint8_t preimage_hash[BTC_SZ_HASH256];
 
-    LOGD("compare preimage : ");
-    DUMPD(pPreimage, LN_SZ_PREIMAGE);
-    ln_payment_hash_calc(preimage_hash, pPreimage);
+/** payment_hashが一致するpreimage削除
+ *
+ * @param[in]       pDb             preimage DB
+ * @param[in]       pPaymentHash    payment_hash
+ * @retval  0       成功
+ */
+static int preimage_del_hash(ln_lmdb_db_t *pDb, const uint8_t *pPaymentHash)
+{
+    MDB_dbi dbi_hash;
+    MDB_val key, data;
+    uint8_t preimage[LN_SZ_PREIMAGE];
 
-    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
-        if (memcmp(preimage_hash, param->p_htlcs[lp].payment_hash, BTC_SZ_HASH256)) continue;
-        //match
-        int retval = mdb_cursor_del(p_cur->p_cursor, 0);
-        LOGD("  remove from DB: %s\n", mdb_strerror(retval));
+    int retval = preimage_hash_open(pDb->p_txn, &dbi_hash);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
     }
-    return false; //continue
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = (CONST_CAST uint8_t *)pPaymentHash;
+    retval = mdb_get(pDb->p_txn, dbi_hash, &key, &data);
+    if (retval) {
+        return retval;
+    }
+    memcpy(preimage, data.mv_data, LN_SZ_PREIMAGE);
+    retval = mdb_del(pDb->p_txn, dbi_hash, &key, NULL);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
+    }
+
+    key.mv_size = LN_SZ_PREIMAGE;
+    key.mv_data = preimage;
+    retval = mdb_del(pDb->p_txn, pDb->dbi, &key, NULL);
+    LOGD("  remove from DB: %s\n", mdb_strerror(retval));
+    if (retval == MDB_NOTFOUND) {
+        retval = 0;
+    }
+    return retval;
 }
 
 
-/** preimage検索(自分で作成)
- *  @param[in]bCommit       true    cursor close時にcommitを行う
+/** payment_hash index作成
+ *
+ * payment_hash indexが無いDB(index追加前に作成したDB)の場合、preimage DBから作成する。
  */
-static bool preimage_search(ln_db_func_preimage_t pFunc, bool bCommit, void *pFuncParam)
+static void preimage_hash_migrate(void)
 {
-    bool found = false;
-    void *p_cur;
-    ln_db_preimage_t preimage;
-    bool detect;
+    int             retval;
+    MDB_txn         *p_txn;
+    MDB_dbi         dbi;
+    MDB_dbi         dbi_hash;
+    MDB_cursor      *p_cursor;
+    MDB_val         key, data;
+    int             cnt = 0;
 
-    if (!ln_db_preimage_cur_open(&p_cur)) return false;
-    while (ln_db_preimage_cur_get(p_cur, &detect, &preimage)) {
-        if (!detect) continue;
-        if (!(*pFunc)(preimage.preimage, preimage.amount_msat, preimage.expiry, p_cur, pFuncParam)) continue;
-        found = true;
-        break;
+    retval = MDB_TXN_BEGIN(mpEnvNode, NULL, 0, &p_txn);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return;
     }
-    ln_db_preimage_cur_close(p_cur, bCommit);
-    return found;
+    retval = MDB_DBI_OPEN(p_txn, M_DBI_PREIMAGE_HASH, 0, &dbi_hash);
+    if (retval != MDB_NOTFOUND) {
+        //作成済み
+        MDB_TXN_ABORT(p_txn);
+        return;
+    }
+    retval = MDB_DBI_OPEN(p_txn, M_DBI_PREIMAGE, 0, &dbi);
+    if (retval) {
+        //preimage無し: #ln_db_preimage_save()で作成する
+        MDB_TXN_ABORT(p_txn);
+        return;
+    }
+
+    fprintf(stderr, "DB checking: preimage index...");
+    retval = mdb_cursor_open(p_txn, dbi, &p_cursor);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(p_txn);
+        return;
+    }
+    while ((retval = mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT_NODUP)) == 0) {
+        if (key.mv_size != LN_SZ_PREIMAGE) continue;
+        retval = preimage_hash_put(p_txn, key.mv_data);
+        if (retval) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+            break;
+        }
+        cnt++;
+    }
+    MDB_CURSOR_CLOSE(p_cursor);
+    if (retval != MDB_NOTFOUND) {
+        MDB_TXN_ABORT(p_txn);
+        fprintf(stderr, "fail\n");
+        return;
+    }
+    MDB_TXN_COMMIT(p_txn);
+    LOGD("preimage index: %d\n", cnt);
+    fprintf(stderr, "done!\n");
 }
 
 
@@ -6501,6 +6537,98 @@ static int fixed_items_save(const void *pData, ln_lmdb_db_t *pDb, const fixed_it
 }
 
 
+/** fixed_item_tデータ差分保存
+ *
+ * @param[in]       pData
+ * @param[in]       pSaved          前回保存したデータ(#fixed_items_copy()で詰めたもの, NULL:全項目保存)
+ * @param[in]       pDb
+ * @param[in]       pItems
+ * @param[in]       Num             pItems数
+ */
+static int fixed_items_save_diff(const void *pData, const uint8_t *pSaved, ln_lmdb_db_t *pDb, const fixed_item_t *pItems, size_t Num)
+{
+    int     retval;
+    MDB_val key, data;
+
+    if (!pSaved) {
+        return fixed_items_save(pData, pDb, pItems, Num);
+    }
+
+    for (size_t lp = 0; lp < Num; lp++) {
+        const uint8_t *p_data = (const uint8_t *)pData + pItems[lp].offset;
+        if (memcmp(p_data, pSaved, pItems[lp].data_len) != 0) {
+            key.mv_size = strlen(pItems[lp].p_name);
+            key.mv_data = (CONST_CAST char *)pItems[lp].p_name;
+            data.mv_size = pItems[lp].data_len;
+            data.mv_data = (CONST_CAST uint8_t *)p_data;
+            retval = mdb_put(pDb->p_txn, pDb->dbi, &key, &data, 0);
+            if (retval) {
+                LOGE("fail: %s\n", mdb_strerror(retval));
+                LOGE("fail: %s\n", pItems[lp].p_name);
+                return retval;
+            }
+        }
+        pSaved += pItems[lp].data_len;
+    }
+
+    return 0;
+}
+
+
+/** fixed_item_tデータ比較
+ *
+ * @param[in]       pData
+ * @param[in]       pSaved          #fixed_items_copy()で詰めたデータ
+ * @param[in]       pItems
+ * @param[in]       Num             pItems数
+ * @retval      true    全項目一致
+ */
+static bool fixed_items_equal(const void *pData, const uint8_t *pSaved, const fixed_item_t *pItems, size_t Num)
+{
+    for (size_t lp = 0; lp < Num; lp++) {
+        if (memcmp((const uint8_t *)pData + pItems[lp].offset, pSaved, pItems[lp].data_len) != 0) {
+            return false;
+        }
+        pSaved += pItems[lp].data_len;
+    }
+    return true;
+}
+
+
+/** fixed_item_tデータ長合計
+ *
+ * @param[in]       pItems
+ * @param[in]       Num             pItems数
+ * @return      data_lenの合計
+ */
+static size_t fixed_items_size(const fixed_item_t *pItems, size_t Num)
+{
+    size_t sz = 0;
+    for (size_t lp = 0; lp < Num; lp++) {
+        sz += pItems[lp].data_len;
+    }
+    return sz;
+}
+
+
+/** fixed_item_tデータを詰めてコピー
+ *
+ * @param[out]      pSaved          コピー先
+ * @param[in]       pData
+ * @param[in]       pItems
+ * @param[in]       Num             pItems数
+ * @return      コピーしたデータの次のアドレス
+ */
+static uint8_t *fixed_items_copy(uint8_t *pSaved, const void *pData, const fixed_item_t *pItems, size_t Num)
+{
+    for (size_t lp = 0; lp < Num; lp++) {
+        memcpy(pSaved, (const uint8_t *)pData + pItems[lp].offset, pItems[lp].data_len);
+        pSaved += pItems[lp].data_len;
+    }
+    return pSaved;
+}
+
+
 /********************************************************************
  * private functions: initialize
  ********************************************************************/
@@ -6539,12 +6667,12 @@ static int lmdb_init(const init_param_t  *p_param)
         LOGE("ERR: %s\n", mdb_strerror(retval));
         return retval;
     }
-    retval = mdb_env_set_maxdbs(*p_param->pp_env, p_param->maxdbs);
+    retval = mdb_env_set_maxdbs(*p_param->pp_env, p_param->maxdbs + p_param->maxdbs_channel * mMaxChannels);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         return retval;
     }
-    retval = mdb_env_set_mapsize(*p_param->pp_env, p_param->mapsize);
+    retval = mdb_env_set_mapsize(*p_param->pp_env, lmdb_mapsize(p_param));
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         return retval;
@@ -6560,6 +6688,24 @@ static int lmdb_init(const init_param_t  *p_param)
 }
 
 
+/** mdb_env_set_mapsize()に指定するサイズ
+ *
+ * channelごとにDBを持つenvは、#ln_db_set_max_channels()の数に比例させる。
+ * 32bit環境でもsize_tに収まるよう、#M_SCALED_MAPSIZE_MAXを上限にする。
+ */
+static size_t lmdb_mapsize(const init_param_t  *p_param)
+{
+    uint64_t mapsize = (uint64_t)p_param->mapsize_channel * mMaxChannels;
+    if (mapsize < p_param->mapsize) {
+        mapsize = p_param->mapsize;
+    }
+    if (mapsize > M_SCALED_MAPSIZE_MAX) {
+        mapsize = M_SCALED_MAPSIZE_MAX;
+    }
+    return (size_t)mapsize;
+}
+
+
 static int lmdb_compaction(const init_param_t  *p_param)
 {
     int                 retval;
@@ -144,8 +144,9 @@ extern "C" {
 #define LN_DB_KEY_RLEN              (3)                 ///< [revoked]key長
 
 #define LN_DB_DBI_ROUTE_SKIP        "route_skip"
-#define LN_DB_ROUTE_SKIP_TEMP       ((uint8_t)1)    // 一時的にskip
-#define LN_DB_ROUTE_SKIP_WORK       ((uint8_t)2)    // 一時的にrouteに含める
+//  value: [1:ln_db_route_skip_t]([8:有効期限(epoch time)])
+//      TEMP=1, PERM=2, WORK=3(一時的にrouteに含める)
+#define LN_DB_ROUTE_SKIP_SZ_EXPIRY  (sizeof(uint8_t) + sizeof(uint64_t))
 
 
 /**************************************************************************
@@ -166,6 +167,7 @@ typedef enum {
     LN_LMDB_DB_TYPE_ROUTE_SKIP,
     LN_LMDB_DB_TYPE_INVOICE,
     LN_LMDB_DB_TYPE_PREIMAGE,
+    LN_LMDB_DB_TYPE_PREIMAGE_HASH,
     LN_LMDB_DB_TYPE_PAYMENT_HASH,
     LN_LMDB_DB_TYPE_VERSION,
     LN_LMDB_DB_TYPE_FORWARD_ADD,
@@ -179,6 +181,7 @@ typedef enum {
     LN_LMDB_DB_TYPE_ROUTE,
     LN_LMDB_DB_TYPE_PAYMENT_INVOICE,
     LN_LMDB_DB_TYPE_PAYMENT_INFO,
+    LN_LMDB_DB_TYPE_PAYMENT_PART,
 } ln_lmdb_db_type_t;
 
 
@@ -104,14 +104,12 @@ bool HIDDEN ln_derkey_privkey(uint8_t *pPrivKey,
     mbedtls_mpi b;
     mbedtls_mpi_init(&a);
     mbedtls_mpi_init(&b);
-    mbedtls_ecp_keypair keypair;
-    mbedtls_ecp_keypair_init(&keypair);
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
     mbedtls_mpi_read_binary(&a, pPrivKey, BTC_SZ_PRIVKEY);
     mbedtls_mpi_read_binary(&b, pBaseSecret, BTC_SZ_PRIVKEY);
     ret = mbedtls_mpi_add_mpi(&a, &a, &b);
     if (ret) goto LABEL_EXIT;
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_mpi_mod_mpi(&a, &a, &keypair.grp.N);
+    ret = mbedtls_mpi_mod_mpi(&a, &a, &p_grp->N);
     if (ret) goto LABEL_EXIT;
     ret = mbedtls_mpi_write_binary(&a, pPrivKey, BTC_SZ_PRIVKEY);
     if (ret) goto LABEL_EXIT;
@@ -126,7 +124,6 @@ bool HIDDEN ln_derkey_privkey(uint8_t *pPrivKey,
 #endif
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_mpi_free(&b);
     mbedtls_mpi_free(&a);
 
@@ -144,7 +141,7 @@ bool HIDDEN ln_derkey_revocation_pubkey(uint8_t *PubKey,
     uint8_t hash1[BTC_SZ_HASH256];
     uint8_t hash2[BTC_SZ_HASH256];
     mbedtls_sha256_context ctx;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
 
     //sha256(revocation-basepoint || per-commitment-point)
     mbedtls_sha256_init(&ctx);
@@ -174,7 +171,6 @@ bool HIDDEN ln_derkey_revocation_pubkey(uint8_t *PubKey,
     mbedtls_ecp_point_init(&S1);
     mbedtls_ecp_point_init(&S2);
     mbedtls_ecp_point_init(&S);
-    mbedtls_ecp_keypair_init(&keypair);
 
     mbedtls_mpi_read_binary(&h1, hash1, sizeof(hash1));
     ret = btc_ecc_ecp_read_binary_pubkey(&S1, pBasePoint);
@@ -182,10 +178,9 @@ bool HIDDEN ln_derkey_revocation_pubkey(uint8_t *PubKey,
     mbedtls_mpi_read_binary(&h2, hash2, sizeof(hash2));
     ret = btc_ecc_ecp_read_binary_pubkey(&S2, pPerCommitPoint);
     if (ret) goto LABEL_EXIT;
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_ecp_muladd(&keypair.grp, &S, &h1, &S1, &h2, &S2);
+    ret = mbedtls_ecp_muladd(p_grp, &S, &h1, &S1, &h2, &S2);
     if (ret) goto LABEL_EXIT;
-    ret = mbedtls_ecp_point_write_binary(&keypair.grp, &S, MBEDTLS_ECP_PF_COMPRESSED, &sz, PubKey, BTC_SZ_PUBKEY);
+    ret = mbedtls_ecp_point_write_binary(p_grp, &S, MBEDTLS_ECP_PF_COMPRESSED, &sz, PubKey, BTC_SZ_PUBKEY);
 
 #ifdef M_DBG_PRINT
     LOGD("SHA256(revocation_basepoint |x per_commitment_point)\n=> SHA256(");
@@ -197,7 +192,6 @@ bool HIDDEN ln_derkey_revocation_pubkey(uint8_t *PubKey,
 #endif
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_ecp_point_free(&S);
     mbedtls_mpi_free(&h1);
     mbedtls_mpi_free(&h2);
@@ -219,7 +213,7 @@ bool HIDDEN ln_derkey_revocation_privkey(uint8_t *pPrivKey,
     uint8_t hash1[BTC_SZ_HASH256];
     uint8_t hash2[BTC_SZ_HASH256];
     mbedtls_sha256_context ctx;
-    mbedtls_ecp_keypair keypair;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
 
     //sha256(revocation-basepoint || per-commitment-point)
     mbedtls_sha256_init(&ctx);
@@ -235,7 +229,6 @@ bool HIDDEN ln_derkey_revocation_privkey(uint8_t *pPrivKey,
     mbedtls_mpi_init(&a);
     mbedtls_mpi_init(&b);
     mbedtls_mpi_init(&c);
-    mbedtls_ecp_keypair_init(&keypair);
 
     mbedtls_mpi_read_binary(&a, hash1, BTC_SZ_PRIVKEY);
     mbedtls_mpi_read_binary(&b, pBaseSecret, BTC_SZ_PRIVKEY);
@@ -257,8 +250,7 @@ bool HIDDEN ln_derkey_revocation_privkey(uint8_t *pPrivKey,
 
     ret = mbedtls_mpi_add_mpi(&a, &a, &b);
     if (ret) goto LABEL_EXIT;
-    mbedtls_ecp_group_load(&(keypair.grp), MBEDTLS_ECP_DP_SECP256K1);
-    ret = mbedtls_mpi_mod_mpi(&a, &a, &keypair.grp.N);
+    ret = mbedtls_mpi_mod_mpi(&a, &a, &p_grp->N);
     if (ret) goto LABEL_EXIT;
     ret = mbedtls_mpi_write_binary(&a, pPrivKey, BTC_SZ_PRIVKEY);
     if (ret) goto LABEL_EXIT;
@@ -275,7 +267,6 @@ bool HIDDEN ln_derkey_revocation_privkey(uint8_t *pPrivKey,
 #endif
 
 LABEL_EXIT:
-    mbedtls_ecp_keypair_free(&keypair);
     mbedtls_mpi_free(&c);
     mbedtls_mpi_free(&b);
     mbedtls_mpi_free(&a);
@@ -273,6 +273,12 @@ typedef enum {
      * The CLTV expiry in the HTLC is too far in the future.
      */
     LNONION_EXPIRY_TOO_FAR          = ((uint16_t)(21)),
+
+    /** mpp_timeout
+     *
+     * The complete amount of the multi-part payment was not received within a reasonable time.
+     */
+    LNONION_MPP_TIMEOUT             = ((uint16_t)(23)),
 } lnerr_onion_t;
 
 #endif /* LN_ERR_H__ */
@@ -0,0 +1,634 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_gossip.cpp
+ *  @brief  gossip broadcast
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "ln_local.h"
+#include "ln_db.h"
+#include "utl_dbg.h"
+
+#include <deque>
+#include <map>
+#include <array>
+
+#include "ln_gossip.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_SEQ_BEGIN                         (1)     ///< 最初のentryのseq(LN_GOSSIP_CURSOR_INITより大きい値)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+extern "C" {
+    bool ln_get_ids_cnl_anno(uint64_t *p_short_channel_id, uint8_t *pNodeId1, uint8_t *pNodeId2, const uint8_t *pData, uint16_t Len);
+}
+
+typedef std::array<uint8_t, BTC_SZ_PUBKEY> node_key_t;
+
+
+/** @struct gossip_key_t
+ *  @brief  entryの対象(channel: short_channel_id+種別, node: node_id)
+ */
+struct gossip_key_t {
+    ln_gossip_type_t    type;
+    uint64_t            short_channel_id;   ///< channel_announcement/channel_update
+    node_key_t          node_id;            ///< node_announcement
+
+    bool operator<(const gossip_key_t &Key) const {
+        if (type != Key.type) {
+            return type < Key.type;
+        }
+        if (short_channel_id != Key.short_channel_id) {
+            return short_channel_id < Key.short_channel_id;
+        }
+        return node_id < Key.node_id;
+    }
+};
+
+
+/** @struct gossip_entry_t
+ *  @brief  log entry
+ *
+ *  packetは持たず、送信時にannouncement DBから読み込む。
+ */
+struct gossip_entry_t {
+    gossip_key_t            key;
+    bool                    has_src;        ///< true: srcへは送信しない
+    node_key_t              src;            ///< 送信元node_id
+};
+
+
+typedef std::array<node_key_t, 2> cnl_nodes_t;      ///< channel_announcementの両端
+
+
+/** @struct gossip_log_t
+ *  @brief  常駐gossip log
+ */
+struct gossip_log_t {
+    uint64_t                                        next_seq;       ///< 次に追加するentryのseq
+    std::map<uint64_t, gossip_entry_t>              entries;        ///< seq --> entry(seq順)
+    std::map<gossip_key_t, uint64_t>                index;          ///< key --> 最新entryのseq
+    std::map<uint64_t, cnl_nodes_t>                 cnl_nodes;      ///< short_channel_id --> channel_announcementの両端
+    std::map<node_key_t, int>                       node_channels;  ///< node_id --> channel_announcement数
+    std::map<node_key_t, std::deque<gossip_key_t> > requests;       ///< peer node_id --> 送信要求
+
+    gossip_log_t() : next_seq(M_SEQ_BEGIN) {}
+};
+
+
+/********************************************************************
+ * static variables
+ ********************************************************************/
+
+//mMuxGossipはleaf lockとして扱い、保持したままDBのtransactionは開始しない
+//  (announcement DBのtransaction中に追加/削除関数が呼ばれるため)
+static pthread_mutex_t      mMuxGossip = PTHREAD_MUTEX_INITIALIZER;
+static gossip_log_t         *mpLog;
+
+
+/********************************************************************
+ * functions
+ ********************************************************************/
+
+static node_key_t node_key(const uint8_t *pNodeId)
+{
+    node_key_t key;
+    memcpy(key.data(), pNodeId, BTC_SZ_PUBKEY);
+    return key;
+}
+
+
+static gossip_key_t cnl_key(ln_gossip_type_t Type, uint64_t ShortChannelId)
+{
+    gossip_key_t key;
+    key.type = Type;
+    key.short_channel_id = ShortChannelId;
+    key.node_id.fill(0);
+    return key;
+}
+
+
+static gossip_key_t node_anno_key(const node_key_t &NodeId)
+{
+    gossip_key_t key;
+    key.type = LN_GOSSIP_TYPE_NODEANNO;
+    key.short_channel_id = 0;
+    key.node_id = NodeId;
+    return key;
+}
+
+
+static void entry_init(gossip_entry_t *pEntry, const gossip_key_t &Key, const uint8_t *pSendId)
+{
+    pEntry->key = Key;
+    pEntry->has_src = (pSendId != NULL);
+    if (pSendId != NULL) {
+        pEntry->src = node_key(pSendId);
+    } else {
+        pEntry->src.fill(0);
+    }
+}
+
+
+/********************************************************************
+ * log operation
+ ********************************************************************/
+
+static void log_node_channels_dec(gossip_log_t &Log, const node_key_t &NodeId)
+{
+    std::map<node_key_t, int>::iterator it = Log.node_channels.find(NodeId);
+    if (it != Log.node_channels.end()) {
+        if (--it->second <= 0) {
+            Log.node_channels.erase(it);
+        }
+    }
+}
+
+
+/** entry削除
+ *
+ * @retval  true    削除した
+ */
+static bool log_erase(gossip_log_t &Log, const gossip_key_t &Key)
+{
+    std::map<gossip_key_t, uint64_t>::iterator it_idx = Log.index.find(Key);
+    if (it_idx == Log.index.end()) {
+        return false;
+    }
+    Log.entries.erase(it_idx->second);
+    Log.index.erase(it_idx);
+    if (Key.type == LN_GOSSIP_TYPE_CNLANNO) {
+        std::map<uint64_t, cnl_nodes_t>::iterator it_nodes = Log.cnl_nodes.find(Key.short_channel_id);
+        if (it_nodes != Log.cnl_nodes.end()) {
+            log_node_channels_dec(Log, it_nodes->second[0]);
+            log_node_channels_dec(Log, it_nodes->second[1]);
+            Log.cnl_nodes.erase(it_nodes);
+        }
+    }
+    return true;
+}
+
+
+/** entry追加
+ *
+ * 同じkeyのentryがあれば削除し、末尾に追加する。
+ */
+static void log_append(gossip_log_t &Log, const gossip_entry_t &Entry)
+{
+    log_erase(Log, Entry.key);
+
+    uint64_t seq = Log.next_seq++;
+    Log.entries[seq] = Entry;
+    Log.index[Entry.key] = seq;
+}
+
+
+/** entryを末尾に付け直す
+ *
+ * 付け直したentryは、cursorが通過済みのpeerにも再度送信される。
+ */
+static void log_move_tail(gossip_log_t &Log, const gossip_key_t &Key)
+{
+    std::map<gossip_key_t, uint64_t>::iterator it_idx = Log.index.find(Key);
+    if (it_idx == Log.index.end()) {
+        return;
+    }
+    std::map<uint64_t, gossip_entry_t>::iterator it = Log.entries.find(it_idx->second);
+    if (it == Log.entries.end()) {
+        return;
+    }
+    uint64_t seq = Log.next_seq++;
+    std::swap(Log.entries[seq], it->second);
+    Log.entries.erase(it);
+    it_idx->second = seq;
+}
+
+
+static void log_cnlanno(gossip_log_t &Log, const gossip_entry_t &Entry, const cnl_nodes_t &NodeIds)
+{
+    bool known[2];
+    for (int lp = 0; lp < 2; lp++) {
+        known[lp] = (Log.node_channels.find(NodeIds[lp]) != Log.node_channels.end());
+    }
+
+    log_append(Log, Entry);
+    Log.cnl_nodes[Entry.key.short_channel_id] = NodeIds;
+    Log.node_channels[NodeIds[0]]++;
+    Log.node_channels[NodeIds[1]]++;
+
+    //BOLT#7: channel_updateとnode_announcementは、channel_announcementより後に送信する
+    //  channel_announcementより先に受け入れていたものは、後ろに付け直す
+    log_move_tail(Log, cnl_key(LN_GOSSIP_TYPE_CNLUPD0, Entry.key.short_channel_id));
+    log_move_tail(Log, cnl_key(LN_GOSSIP_TYPE_CNLUPD1, Entry.key.short_channel_id));
+    for (int lp = 0; lp < 2; lp++) {
+        if (!known[lp]) {
+            log_move_tail(Log, node_anno_key(NodeIds[lp]));
+        }
+    }
+}
+
+
+/** 送信可能なentryかどうか
+ *
+ * @param[in]   Log
+ * @param[in]   Entry
+ * @param[in]   PeerId      送信先node_id
+ * @retval  true    送信してよい
+ */
+static bool log_sendable(const gossip_log_t &Log, const gossip_entry_t &Entry, const node_key_t &PeerId)
+{
+    if (Entry.has_src && (Entry.src == PeerId)) {
+        //送信元へは送り返さない
+        return false;
+    }
+    switch (Entry.key.type) {
+    case LN_GOSSIP_TYPE_CNLUPD0:
+    case LN_GOSSIP_TYPE_CNLUPD1:
+        return Log.index.find(cnl_key(LN_GOSSIP_TYPE_CNLANNO, Entry.key.short_channel_id)) != Log.index.end();
+    case LN_GOSSIP_TYPE_NODEANNO:
+        return Log.node_channels.find(Entry.key.node_id) != Log.node_channels.end();
+    default:
+        break;
+    }
+    return true;
+}
+
+
+/** 送信要求があれば取得
+ *
+ * @param[out]  pKey        取得したentryのkey
+ * @retval  true    取得した
+ */
+static bool log_request_next(gossip_log_t &Log, gossip_key_t *pKey, const node_key_t &PeerId)
+{
+    std::map<node_key_t, std::deque<gossip_key_t> >::iterator it_req = Log.requests.find(PeerId);
+    if (it_req == Log.requests.end()) {
+        return false;
+    }
+
+    bool ret = false;
+    std::deque<gossip_key_t> &keys = it_req->second;
+    while (!keys.empty()) {
+        gossip_key_t key = keys.front();
+        keys.pop_front();
+
+        if (Log.index.find(key) != Log.index.end()) {
+            *pKey = key;
+            ret = true;
+            break;
+        }
+    }
+    if (keys.empty()) {
+        Log.requests.erase(it_req);
+    }
+    return ret;
+}
+
+
+/********************************************************************
+ * load DB
+ ********************************************************************/
+
+/** announcement DBからpacket読込み
+ *
+ * @param[out]  pEntry      読み込んだentry(pEntry->bufは呼び出し元で解放する)
+ * @param[in]   Key         読み込むentryのkey
+ * @retval  true    読み込んだ
+ * @retval  false   DBにない(logから取得した後に削除された)
+ * @note
+ *      - mMuxGossipを保持したまま呼び出さないこと
+ */
+static bool entry_load(ln_gossip_entry_t *pEntry, const gossip_key_t &Key)
+{
+    bool ret = false;
+
+    pEntry->type = Key.type;
+    pEntry->short_channel_id = Key.short_channel_id;
+    pEntry->timestamp = 0;
+    switch (Key.type) {
+    case LN_GOSSIP_TYPE_CNLANNO:
+        ret = ln_db_cnlanno_load(&pEntry->buf, Key.short_channel_id);
+        break;
+    case LN_GOSSIP_TYPE_CNLUPD0:
+    case LN_GOSSIP_TYPE_CNLUPD1:
+        ret = ln_db_cnlupd_load(&pEntry->buf, &pEntry->timestamp, Key.short_channel_id,
+                    (uint8_t)(Key.type - LN_GOSSIP_TYPE_CNLUPD0), NULL);
+        break;
+    case LN_GOSSIP_TYPE_NODEANNO:
+        ret = ln_db_nodeanno_load(&pEntry->buf, &pEntry->timestamp, Key.node_id.data());
+        break;
+    default:
+        break;
+    }
+    if (!ret) {
+        LOGD("not found: type=%d, %016" PRIx64 "\n", Key.type, Key.short_channel_id);
+        utl_buf_free(&pEntry->buf);
+    }
+    return ret;
+}
+
+
+static void load_cnlanno(gossip_log_t &Log, uint64_t ShortChannelId, char Type, const utl_buf_t *pBuf)
+{
+    gossip_entry_t entry;
+
+    switch (Type) {
+    case LN_DB_CNLANNO_ANNO:
+        {
+            uint64_t short_channel_id;
+            uint8_t node_id[2][BTC_SZ_PUBKEY];
+            if (!ln_get_ids_cnl_anno(&short_channel_id, node_id[0], node_id[1], pBuf->buf, pBuf->len)) {
+                LOGE("fail: channel_announcement %016" PRIx64 "\n", ShortChannelId);
+                break;
+            }
+            entry_init(&entry, cnl_key(LN_GOSSIP_TYPE_CNLANNO, ShortChannelId), NULL);
+            cnl_nodes_t node_ids = {{ node_key(node_id[0]), node_key(node_id[1]) }};
+            log_cnlanno(Log, entry, node_ids);
+        }
+        break;
+    case LN_DB_CNLANNO_UPD0:
+    case LN_DB_CNLANNO_UPD1:
+        {
+            ln_gossip_type_t type = (Type == LN_DB_CNLANNO_UPD0) ? LN_GOSSIP_TYPE_CNLUPD0 : LN_GOSSIP_TYPE_CNLUPD1;
+            entry_init(&entry, cnl_key(type, ShortChannelId), NULL);
+            log_append(Log, entry);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+
+/** DBからlog構築
+ *
+ * @param[out]      pLog        構築したlog
+ * @attention
+ *      - #ln_db_anno_transaction()で取得済みであること
+ */
+static void load_db(gossip_log_t *pLog)
+{
+    void *p_cur;
+
+    //channel_anno
+    if (ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO)) {
+        uint64_t short_channel_id;
+        char type;
+        uint32_t timestamp;
+        utl_buf_t buf = UTL_BUF_INIT;
+
+        while (ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, &timestamp, &buf)) {
+            load_cnlanno(*pLog, short_channel_id, type, &buf);
+            utl_buf_free(&buf);
+        }
+        ln_db_anno_cur_close(p_cur);
+    } else {
+        LOGD("no channel_announcement DB\n");
+    }
+
+    //node_anno
+    if (ln_db_anno_cur_open(&p_cur, LN_DB_CUR_NODEANNO)) {
+        uint8_t node_id[BTC_SZ_PUBKEY];
+        uint32_t timestamp;
+        utl_buf_t buf = UTL_BUF_INIT;
+
+        while (ln_db_nodeanno_cur_get(p_cur, &buf, &timestamp, node_id)) {
+            gossip_entry_t entry;
+            entry_init(&entry, node_anno_key(node_key(node_id)), NULL);
+            log_append(*pLog, entry);
+            utl_buf_free(&buf);
+        }
+        ln_db_anno_cur_close(p_cur);
+    } else {
+        LOGD("no node_announcement DB\n");
+    }
+}
+
+
+/** log取得
+ *
+ * 未初期化であれば、ここで作成する(#ln_gossip_init()前に追加された場合)。
+ */
+static gossip_log_t &get_log(void)
+{
+    if (mpLog == NULL) {
+        mpLog = new gossip_log_t;
+    }
+    return *mpLog;
+}
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool ln_gossip_init(void)
+{
+    gossip_log_t *p_log = new gossip_log_t;
+
+    //DB読込み中はannouncement DBの追加/削除が行われない
+    if (ln_db_anno_transaction()) {
+        load_db(p_log);
+
+        pthread_mutex_lock(&mMuxGossip);
+        std::swap(mpLog, p_log);
+        LOGD("gossip log: entries=%" PRIu32 ", next seq=%" PRIu64 "\n",
+                    (uint32_t)mpLog->entries.size(), mpLog->next_seq);
+        pthread_mutex_unlock(&mMuxGossip);
+
+        ln_db_anno_commit(false);
+    } else {
+        //channel_announcementを1回も受信せずにDBが存在しない場合もあるため、空のlogで開始する
+        LOGD("no announce DB\n");
+        pthread_mutex_lock(&mMuxGossip);
+        std::swap(mpLog, p_log);
+        pthread_mutex_unlock(&mMuxGossip);
+    }
+
+    delete p_log;
+    return true;
+}
+
+
+void ln_gossip_term(void)
+{
+    pthread_mutex_lock(&mMuxGossip);
+    delete mpLog;
+    mpLog = NULL;
+    pthread_mutex_unlock(&mMuxGossip);
+}
+
+
+void ln_gossip_cnlanno_add(uint64_t ShortChannelId,
+            const uint8_t *pNodeId1, const uint8_t *pNodeId2, const uint8_t *pSendId)
+{
+    gossip_entry_t entry;
+    entry_init(&entry, cnl_key(LN_GOSSIP_TYPE_CNLANNO, ShortChannelId), pSendId);
+    cnl_nodes_t node_ids = {{ node_key(pNodeId1), node_key(pNodeId2) }};
+
+    pthread_mutex_lock(&mMuxGossip);
+    log_cnlanno(get_log(), entry, node_ids);
+    pthread_mutex_unlock(&mMuxGossip);
+}
+
+
+void ln_gossip_cnlupd_add(uint64_t ShortChannelId, uint8_t Dir, const uint8_t *pSendId)
+{
+    ln_gossip_type_t type = (Dir & LN_CNLUPD_CHFLAGS_DIRECTION) ? LN_GOSSIP_TYPE_CNLUPD1 : LN_GOSSIP_TYPE_CNLUPD0;
+    gossip_entry_t entry;
+    entry_init(&entry, cnl_key(type, ShortChannelId), pSendId);
+
+    pthread_mutex_lock(&mMuxGossip);
+    log_append(get_log(), entry);
+    pthread_mutex_unlock(&mMuxGossip);
+}
+
+
+void ln_gossip_nodeanno_add(const uint8_t *pNodeId, const uint8_t *pSendId)
+{
+    gossip_entry_t entry;
+    entry_init(&entry, node_anno_key(node_key(pNodeId)), pSendId);
+
+    pthread_mutex_lock(&mMuxGossip);
+    log_append(get_log(), entry);
+    pthread_mutex_unlock(&mMuxGossip);
+}
+
+
+void ln_gossip_cnlanno_del(uint64_t ShortChannelId)
+{
+    pthread_mutex_lock(&mMuxGossip);
+    gossip_log_t &log = get_log();
+    log_erase(log, cnl_key(LN_GOSSIP_TYPE_CNLANNO, ShortChannelId));
+    log_erase(log, cnl_key(LN_GOSSIP_TYPE_CNLUPD0, ShortChannelId));
+    log_erase(log, cnl_key(LN_GOSSIP_TYPE_CNLUPD1, ShortChannelId));
+    pthread_mutex_unlock(&mMuxGossip);
+}
+
+
+void ln_gossip_cnlupd_del(uint64_t ShortChannelId, uint8_t Dir)
+{
+    ln_gossip_type_t type = (Dir & LN_CNLUPD_CHFLAGS_DIRECTION) ? LN_GOSSIP_TYPE_CNLUPD1 : LN_GOSSIP_TYPE_CNLUPD0;
+
+    pthread_mutex_lock(&mMuxGossip);
+    log_erase(get_log(), cnl_key(type, ShortChannelId));
+    pthread_mutex_unlock(&mMuxGossip);
+}
+
+
+uint64_t ln_gossip_tail(void)
+{
+    pthread_mutex_lock(&mMuxGossip);
+    uint64_t seq = get_log().next_seq;
+    pthread_mutex_unlock(&mMuxGossip);
+    return seq;
+}
+
+
+bool ln_gossip_next(ln_gossip_entry_t *pEntry, uint64_t *pCursor, const uint8_t *pPeerId)
+{
+    node_key_t peer_id = node_key(pPeerId);
+
+    utl_buf_init(&pEntry->buf);
+
+    for (;;) {
+        bool found = false;
+        gossip_key_t key;
+
+        pthread_mutex_lock(&mMuxGossip);
+        gossip_log_t &log = get_log();
+        if (log_request_next(log, &key, peer_id)) {
+            found = true;
+        } else {
+            std::map<uint64_t, gossip_entry_t>::const_iterator it = log.entries.lower_bound(*pCursor);
+            for (; it != log.entries.end(); ++it) {
+                if (log_sendable(log, it->second, peer_id)) {
+                    key = it->second.key;
+                    *pCursor = it->first + 1;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                *pCursor = log.next_seq;
+            }
+        }
+        pthread_mutex_unlock(&mMuxGossip);
+
+        if (!found) {
+            return false;
+        }
+        //DBのtransactionはmMuxGossipを解放してから開始する
+        if (entry_load(pEntry, key)) {
+            return true;
+        }
+        //取得後に削除されていれば次を探す
+    }
+}
+
+
+void ln_gossip_request(const uint8_t *pPeerId, const uint64_t *pShortChannelIds, size_t Num)
+{
+    pthread_mutex_lock(&mMuxGossip);
+    gossip_log_t &log = get_log();
+    std::deque<gossip_key_t> &keys = log.requests[node_key(pPeerId)];
+    for (size_t lp = 0; lp < Num; lp++) {
+        gossip_key_t key = cnl_key(LN_GOSSIP_TYPE_CNLANNO, pShortChannelIds[lp]);
+        std::map<gossip_key_t, uint64_t>::iterator it_idx = log.index.find(key);
+        if (it_idx == log.index.end()) {
+            LOGD("not found: %016" PRIx64 "\n", pShortChannelIds[lp]);
+            continue;
+        }
+        const cnl_nodes_t &nodes = log.cnl_nodes[pShortChannelIds[lp]];
+        keys.push_back(key);
+        keys.push_back(cnl_key(LN_GOSSIP_TYPE_CNLUPD0, pShortChannelIds[lp]));
+        keys.push_back(cnl_key(LN_GOSSIP_TYPE_CNLUPD1, pShortChannelIds[lp]));
+        keys.push_back(node_anno_key(nodes[0]));
+        keys.push_back(node_anno_key(nodes[1]));
+    }
+    if (keys.empty()) {
+        log.requests.erase(node_key(pPeerId));
+    }
+    pthread_mutex_unlock(&mMuxGossip);
+}
+
+
+void ln_gossip_request_clear(const uint8_t *pPeerId)
+{
+    pthread_mutex_lock(&mMuxGossip);
+    get_log().requests.erase(node_key(pPeerId));
+    pthread_mutex_unlock(&mMuxGossip);
+}
@@ -0,0 +1,193 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_gossip.h
+ *  @brief  gossip broadcast
+ *
+ *  受け入れたchannel_announcement/channel_update/node_announcementを、
+ *  受け入れ順に連番(seq)を付けたlogとして常駐させる。
+ *  logが持つのは対象と送信元だけで、packetは#ln_gossip_next()でannouncement DBから読み込む。
+ *  各peerはlogへのcursor(次に読むseq)だけを持ち、#ln_gossip_next()で順に取得して送信する。
+ *  同じ対象(short_channel_id+種別, node_id)のannouncementを更新した場合、古いentryはlogから削除する。
+ */
+#ifndef LN_GOSSIP_H__
+#define LN_GOSSIP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "utl_buf.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define LN_GOSSIP_CURSOR_INIT       ((uint64_t)0)       ///< cursor初期値(logの先頭から送信する)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @enum   ln_gossip_type_t
+ *  @brief  log entryの種別
+ */
+typedef enum {
+    LN_GOSSIP_TYPE_CNLANNO,             ///< channel_announcement
+    LN_GOSSIP_TYPE_CNLUPD0,             ///< channel_update(dir=0)
+    LN_GOSSIP_TYPE_CNLUPD1,             ///< channel_update(dir=1)
+    LN_GOSSIP_TYPE_NODEANNO,            ///< node_announcement
+} ln_gossip_type_t;
+
+
+/** @struct     ln_gossip_entry_t
+ *  @brief      #ln_gossip_next()で取得したentry
+ */
+typedef struct {
+    ln_gossip_type_t    type;
+    uint64_t            short_channel_id;       ///< channel_announcement/channel_update
+    uint32_t            timestamp;              ///< channel_update/node_announcement
+    utl_buf_t           buf;                    ///< packet
+} ln_gossip_entry_t;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** gossip log初期化
+ *
+ * announcement DBからlogを構築する(channel_announcement, channel_update, node_announcementの順)。
+ * DBから構築したentryは送信元を持たない。
+ *
+ * @retval  true    成功
+ */
+bool ln_gossip_init(void);
+
+
+/** gossip log解放
+ *
+ */
+void ln_gossip_term(void);
+
+
+/** channel_announcement追加
+ *
+ * 既に保持しているchannel_updateは、channel_announcementの後ろに付け直す。
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   pNodeId1        node_id_1
+ * @param[in]   pNodeId2        node_id_2
+ * @param[in]   pSendId         送信元node_id(NULL: 自channel)
+ */
+void ln_gossip_cnlanno_add(uint64_t ShortChannelId,
+                const uint8_t *pNodeId1, const uint8_t *pNodeId2, const uint8_t *pSendId);
+
+
+/** channel_update追加
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   Dir             channel_updateのdirection
+ * @param[in]   pSendId         送信元node_id(NULL: 自channel)
+ */
+void ln_gossip_cnlupd_add(uint64_t ShortChannelId, uint8_t Dir, const uint8_t *pSendId);
+
+
+/** node_announcement追加
+ *
+ * @param[in]   pNodeId
+ * @param[in]   pSendId         送信元node_id(NULL: 自node)
+ */
+void ln_gossip_nodeanno_add(const uint8_t *pNodeId, const uint8_t *pSendId);
+
+
+/** channel_announcement/channel_update削除
+ *
+ * @param[in]   ShortChannelId
+ */
+void ln_gossip_cnlanno_del(uint64_t ShortChannelId);
+
+
+/** channel_update削除
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   Dir             channel_updateのdirection
+ */
+void ln_gossip_cnlupd_del(uint64_t ShortChannelId, uint8_t Dir);
+
+
+/** logの末尾cursor
+ *
+ * 今までのentryは送信せず、以降に追加されたentryだけを送信する場合のcursor。
+ *
+ * @return  次に追加されるentryのseq
+ */
+uint64_t ln_gossip_tail(void);
+
+
+/** cursor以降のentry取得
+ *
+ * #ln_gossip_request()で要求されたentryがあれば、cursorより先に取得する。
+ * packetはannouncement DBから読み込むため、DBのtransaction中に呼び出さないこと。
+ * logから取得した後にDBから削除されていたentryは飛ばす。
+ * 下記は送信しないため、取得せずにcursorを進める。
+ *      - 送信元がpPeerIdのentry
+ *      - channel_announcementがないchannel_update
+ *      - channel_announcementがないnodeのnode_announcement
+ *
+ * @param[out]      pEntry      取得したentry(pEntry->bufは呼び出し元で解放する)
+ * @param[in,out]   pCursor     peerのcursor(取得したentryの次に更新する)
+ * @param[in]       pPeerId     送信先node_id
+ * @retval  true    取得した
+ * @retval  false   logの末尾まで取得済み
+ */
+bool ln_gossip_next(ln_gossip_entry_t *pEntry, uint64_t *pCursor, const uint8_t *pPeerId);
+
+
+/** short_channel_id指定の送信要求(query_short_channel_ids)
+ *
+ * channel_announcement, channel_update, 両端のnode_announcementを
+ * 次回以降の#ln_gossip_next()でcursorにかかわらず取得させる。
+ *
+ * @param[in]   pPeerId             要求元node_id
+ * @param[in]   pShortChannelIds
+ * @param[in]   Num                 pShortChannelIds数
+ */
+void ln_gossip_request(const uint8_t *pPeerId, const uint64_t *pShortChannelIds, size_t Num);
+
+
+/** 送信要求削除
+ *
+ * @param[in]   pPeerId             要求元node_id
+ */
+void ln_gossip_request_clear(const uint8_t *pPeerId);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* LN_GOSSIP_H__ */
@@ -80,6 +80,9 @@ bool HIDDEN ln_msg_x_update_add_htlc_write(utl_buf_t *pBuf, const ln_msg_x_updat
     if (!btc_buf_w_write_u64be(&buf_w, pMsg->amt_to_forward)) goto LABEL_ERROR;
     if (!btc_buf_w_write_u32be(&buf_w, pMsg->outgoing_cltv_value)) goto LABEL_ERROR;
     if (!btc_buf_w_write_data(&buf_w, pMsg->p_onion_routing_packet, LN_SZ_ONION_ROUTE)) goto LABEL_ERROR;
+    if (pMsg->total_msat != 0) {
+        if (!btc_buf_w_write_u64be(&buf_w, pMsg->total_msat)) goto LABEL_ERROR;
+    }
     btc_buf_w_move(&buf_w, pBuf);
     return true;
 
@@ -105,6 +108,11 @@ bool HIDDEN ln_msg_x_update_add_htlc_read(ln_msg_x_update_add_htlc_t *pMsg, cons
     if (!btc_buf_r_read_u64be(&buf_r, &pMsg->amt_to_forward)) goto LABEL_ERROR_SYNTAX;
     if (!btc_buf_r_read_u32be(&buf_r, &pMsg->outgoing_cltv_value)) goto LABEL_ERROR_SYNTAX;
     if (!btc_buf_r_get_pos_and_seek(&buf_r, &pMsg->p_onion_routing_packet, LN_SZ_ONION_ROUTE)) goto LABEL_ERROR_SYNTAX;
+    pMsg->total_msat = 0;
+    if (btc_buf_r_remains(&buf_r) != 0) {
+        //optional
+        if (!btc_buf_r_read_u64be(&buf_r, &pMsg->total_msat)) goto LABEL_ERROR_SYNTAX;
+    }
 
 #ifdef DBG_PRINT_READ
     LOGD("@@@@@ %s @@@@@\n", __func__);
@@ -131,6 +139,7 @@ static void x_update_add_htlc_print(const ln_msg_x_update_add_htlc_t *pMsg)
     LOGD("outgoing_cltv_value: %u\n", pMsg->outgoing_cltv_value);
     LOGD("onion_routing_packet(top 34bytes only): ");
     DUMPD(pMsg->p_onion_routing_packet, 34);
+    LOGD("total_msat: %" PRIu64 "\n", pMsg->total_msat);
     LOGD("--------------------------------\n");
 #endif  //PTARM_DEBUG
 }
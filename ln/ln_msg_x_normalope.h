@@ -46,6 +46,7 @@ typedef struct {
     //  [8:amt_to_forward]
     //  [4:outgoing_cltv_value]
     //  [1366:onion_routing_packet]
+    //  [8:total_msat] (total_msat != 0のみ)
 
     uint64_t        amount_msat;
     const uint8_t   *p_payment_hash;
@@ -53,6 +54,7 @@ typedef struct {
     uint64_t        amt_to_forward;
     uint32_t        outgoing_cltv_value;
     const uint8_t   *p_onion_routing_packet;
+    uint64_t        total_msat;             ///< multi-path paymentの合計額(0:multi-path paymentではない)
 } ln_msg_x_update_add_htlc_t;
 
 
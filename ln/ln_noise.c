@@ -39,6 +39,7 @@
 #include "utl_dbg.h"
 
 #include "btc_crypto.h"
+#include "btc_chachapoly.h"
 
 #include "ln_noise.h"
 #include "ln_node.h"
@@ -97,6 +98,9 @@ struct bolt8_t {
  * prototypes
  **************************************************************************/
 
+static bool noise_enc(ln_noise_t *pCtx, uint8_t *pEnc, const uint8_t *pData, uint16_t Len);
+static void noise_cipher_init(ln_noise_ctx_t *pCtx);
+static void noise_rotate(ln_noise_ctx_t *pCtx);
 static bool noise_hkdf(uint8_t *ck, uint8_t *k, const uint8_t *pSalt, const uint8_t *pIkm);
 static bool actone_sender(ln_noise_t *pCtx, utl_buf_t *pBuf, const uint8_t *pRS);
 static bool actone_receiver(ln_noise_t *pCtx, utl_buf_t *pBuf);
@@ -192,6 +196,9 @@ bool ln_noise_handshake_recv(ln_noise_t *pCtx, utl_buf_t *pBuf)
         UTL_DBG_FREE(pCtx->p_handshake);
         pCtx->send_ctx.nonce = 0;
         pCtx->recv_ctx.nonce = 0;
+        if (ret) {
+            ln_noise_cipher_init(pCtx);
+        }
         break;
 
     //responder
@@ -208,6 +215,9 @@ bool ln_noise_handshake_recv(ln_noise_t *pCtx, utl_buf_t *pBuf)
         UTL_DBG_FREE(pCtx->p_handshake);
         pCtx->send_ctx.nonce = 0;
         pCtx->recv_ctx.nonce = 0;
+        if (ret) {
+            ln_noise_cipher_init(pCtx);
+        }
         break;
     default:
         ret = false;
@@ -234,125 +244,51 @@ void ln_noise_handshake_free(ln_noise_t *pCtx)
 }
 
 
-bool ln_noise_enc(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn)
+void ln_noise_cipher_init(ln_noise_t *pCtx)
 {
-    bool ret = false;
-    uint8_t nonce[12];
-    uint16_t l = (pBufIn->len >> 8) | (pBufIn->len << 8);
-    uint8_t *cl = (uint8_t *)UTL_DBG_MALLOC(sizeof(l) + M_CHACHAPOLY_MAC);
-    uint8_t *cm = (uint8_t *)UTL_DBG_MALLOC(pBufIn->len + M_CHACHAPOLY_MAC);
-    int rc;
+    noise_cipher_init(&pCtx->send_ctx);
+    noise_cipher_init(&pCtx->recv_ctx);
+}
 
-    memset(nonce, 0, 4);
-    memcpy(nonce + 4, &pCtx->send_ctx.nonce, sizeof(uint64_t));
-#ifdef M_USE_SODIUM
-    unsigned long long cllen;
-    unsigned long long cmlen;
 
-    rc = crypto_aead_chacha20poly1305_ietf_encrypt(
-                    cl, &cllen,
-                    (uint8_t *)&l, sizeof(l),   //message length
-                    NULL, 0,                    //additional data
-                    NULL,                       //combined modeではNULL
-                    nonce, pCtx->send_ctx.key);     //nonce, key
-    if ((rc != 0) || (cllen != sizeof(l) + crypto_aead_chacha20poly1305_IETF_ABYTES)) {
-        LOGE("fail: crypto_aead_chacha20poly1305_ietf_encrypt rc=%d\n", rc);
-        goto LABEL_EXIT;
-    }
-#else
-    mbedtls_chachapoly_context ctx;
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->send_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
-    }
-    rc = mbedtls_chachapoly_encrypt_and_tag(&ctx,
-                    sizeof(l),          //in length
-                    nonce,              //12byte
-                    NULL, 0,            //AAD
-                    (const uint8_t *)&l,    //input
-                    cl,                 //output
-                    cl + sizeof(l));    //MAC
-    mbedtls_chachapoly_free(&ctx);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_encrypt_and_tag rc=-%04x\n", -rc);
-        assert(0);
-        goto LABEL_EXIT;
-    }
-#endif
-
-    if (pCtx->send_ctx.nonce == 0) {
-        dump_key(pCtx->send_ctx.key, cl + sizeof(l));
+bool ln_noise_enc(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn)
+{
+    utl_buf_t buf = UTL_BUF_INIT;
+    if (!utl_buf_alloc(&buf, LN_SZ_NOISE_ENC(pBufIn->len))) {
+        return false;
     }
-
-    pCtx->send_ctx.nonce++;
-    if (pCtx->send_ctx.nonce == 1000) {
-        LOGE("???: This root shall not in.\n");
-        goto LABEL_EXIT;
+    if (!noise_enc(pCtx, buf.buf, pBufIn->buf, pBufIn->len)) {
+        utl_buf_free(&buf);
+        return false;
     }
-    memcpy(nonce + 4, &pCtx->send_ctx.nonce, sizeof(uint64_t));
+    *pBufEnc = buf;
+    return true;
+}
 
-#ifdef M_USE_SODIUM
-    rc = crypto_aead_chacha20poly1305_ietf_encrypt(
-                    cm, &cmlen,
-                    pBufIn->buf, pBufIn->len,       //message length
-                    NULL, 0,                    //additional data
-                    NULL,                       //combined modeではNULL
-                    nonce, pCtx->send_ctx.key);     //nonce, key
-    if ((rc != 0) || (cmlen != pBufIn->len + crypto_aead_chacha20poly1305_IETF_ABYTES)) {
-        LOGE("fail: crypto_aead_chacha20poly1305_ietf_encrypt rc=%d\n", rc);
-        goto LABEL_EXIT;
-    }
-#else
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->send_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
-    }
-    rc = mbedtls_chachapoly_encrypt_and_tag(&ctx,
-                    pBufIn->len,        //in length
-                    nonce,              //12byte
-                    NULL, 0,            //AAD
-                    pBufIn->buf,        //input
-                    cm,                 //output
-                    cm + pBufIn->len);  //MAC
-    mbedtls_chachapoly_free(&ctx);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_encrypt_and_tag rc=-%04x\n", -rc);
-        assert(0);
-        goto LABEL_EXIT;
-    }
-#endif
 
-    pCtx->send_ctx.nonce++;
-    if (pCtx->send_ctx.nonce == 1000) {
-        //key rotation
-        //ck', k' = HKDF(ck, k)
-        noise_hkdf(pCtx->send_ctx.ck, pCtx->send_ctx.key, pCtx->send_ctx.ck, pCtx->send_ctx.key);
-        pCtx->send_ctx.nonce = 0;
+bool ln_noise_enc_arena(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn, utl_arena_t *pArena)
+{
+    if (!utl_arena_buf_alloc(pArena, pBufEnc, LN_SZ_NOISE_ENC(pBufIn->len))) {
+        return false;
     }
+    return noise_enc(pCtx, pBufEnc->buf, pBufIn->buf, pBufIn->len);
+}
 
-    utl_buf_alloc(pBufEnc, sizeof(l) + pBufIn->len + 2 * M_CHACHAPOLY_MAC);
-    memcpy(pBufEnc->buf, cl, sizeof(l) + M_CHACHAPOLY_MAC);
-    memcpy(pBufEnc->buf + sizeof(l) + M_CHACHAPOLY_MAC, cm, pBufIn->len + M_CHACHAPOLY_MAC);
-    ret = true;
-
-LABEL_EXIT:
-    UTL_DBG_FREE(cl);
-    UTL_DBG_FREE(cm);
 
-    return ret;
+bool ln_noise_enc_inplace(ln_noise_t *pCtx, uint8_t *pBuf, uint16_t Len)
+{
+    return noise_enc(pCtx, pBuf, pBuf + LN_SZ_NOISE_HEADER, Len);
 }
 
 
-uint16_t /*HIDDEN*/ ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uint16_t Len)
+uint32_t /*HIDDEN*/ ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uint16_t Len)
 {
     uint8_t nonce[12];
     uint8_t pl[sizeof(uint16_t)];
-    uint16_t l = 0;
+    uint32_t l = 0;
+#ifdef M_USE_SODIUM
     int rc;
+#endif
 
     if (Len != LN_SZ_NOISE_HEADER) {
         return 0;
@@ -374,23 +310,13 @@ uint16_t /*HIDDEN*/ ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uin
         goto LABEL_EXIT;
     }
 #else
-    mbedtls_chachapoly_context ctx;
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->recv_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
-    }
-    rc = mbedtls_chachapoly_auth_decrypt(&ctx,
-                    sizeof(pl),             //in length
+    if (!btc_chachapoly_decrypt(&pCtx->recv_ctx.cipher,
                     nonce,                  //12byte
                     NULL, 0,                //AAD
-                    pData + sizeof(pl),     //MAC
-                    pData,                  //input
-                    pl);                    //output
-    mbedtls_chachapoly_free(&ctx);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_auth_decrypt rc=-%04x\n", -rc);
+                    pData, sizeof(pl),      //input
+                    pl,                     //output
+                    pData + sizeof(pl))) {  //MAC
+        LOGE("fail: btc_chachapoly_decrypt\n");
         goto LABEL_EXIT;
     }
 #endif
@@ -420,8 +346,15 @@ bool /*HIDDEN*/ ln_noise_dec_msg(ln_noise_t *pCtx, utl_buf_t *pBuf)
     bool ret = false;
     uint16_t l = pBuf->len - M_CHACHAPOLY_MAC;
     uint8_t nonce[12];
-    uint8_t *pm = (uint8_t *)UTL_DBG_MALLOC(l);
+    uint8_t *pm = pBuf->buf;        //in-place
+#ifdef M_USE_SODIUM
     int rc;
+#endif
+
+    if ((pBuf->len < M_CHACHAPOLY_MAC) || (pBuf->len > UINT16_MAX + M_CHACHAPOLY_MAC)) {
+        LOGE("fail: invalid length\n");
+        goto LABEL_EXIT;
+    }
 
     memset(nonce, 0, 4);
     memcpy(nonce + 4, &pCtx->recv_ctx.nonce, sizeof(uint64_t));
@@ -438,43 +371,27 @@ bool /*HIDDEN*/ ln_noise_dec_msg(ln_noise_t *pCtx, utl_buf_t *pBuf)
         goto LABEL_EXIT;
     }
 #else
-    mbedtls_chachapoly_context ctx;
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->recv_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
-    }
-    rc = mbedtls_chachapoly_auth_decrypt(&ctx,
-                    l,                  //in length
+    if (!btc_chachapoly_decrypt(&pCtx->recv_ctx.cipher,
                     nonce,              //12byte
                     NULL, 0,            //AAD
-                    pBuf->buf + l,      //MAC
-                    pBuf->buf,          //input
-                    pm);                //output
-    mbedtls_chachapoly_free(&ctx);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_auth_decrypt rc=-%04x\n", -rc);
+                    pBuf->buf, l,       //input
+                    pm,                 //output
+                    pBuf->buf + l)) {   //MAC
+        LOGE("fail: btc_chachapoly_decrypt\n");
         goto LABEL_EXIT;
     }
 #endif
 
     pCtx->recv_ctx.nonce++;
     if (pCtx->recv_ctx.nonce == 1000) {
-        //key rotation
-        //ck', k' = HKDF(ck, k)
-        noise_hkdf(pCtx->recv_ctx.ck, pCtx->recv_ctx.key, pCtx->recv_ctx.ck, pCtx->recv_ctx.key);
-        pCtx->recv_ctx.nonce = 0;
+        noise_rotate(&pCtx->recv_ctx);
     }
 
-    utl_buf_free(pBuf);
-    utl_buf_alloc(pBuf, l);
-    memcpy(pBuf->buf, pm, l);
+    //MACは残したままlenだけ詰める(pBuf->bufはそのまま)
+    pBuf->len = l;
     ret = true;
 
 LABEL_EXIT:
-    UTL_DBG_FREE(pm);
-
     return ret;
 }
 
@@ -483,6 +400,127 @@ LABEL_EXIT:
  * private functions
  ********************************************************************/
 
+/** noise message暗号化
+ *
+ * 暗号化したlength(+MAC)とmessage(+MAC)をpEncに続けて書き込む。
+ * pDataはpEnc + #LN_SZ_NOISE_HEADER と同じ領域でもよい(in-place)。
+ *
+ * @param[in,out]   pCtx        noise情報
+ * @param[out]      pEnc        暗号化データ(#LN_SZ_NOISE_ENC(Len))
+ * @param[in]       pData       平文message
+ * @param[in]       Len         平文messageの長さ
+ * @retval  true    成功
+ */
+static bool noise_enc(ln_noise_t *pCtx, uint8_t *pEnc, const uint8_t *pData, uint16_t Len)
+{
+    bool ret = false;
+    uint8_t nonce[12];
+    uint16_t l = (Len >> 8) | (Len << 8);
+    uint8_t *cl = pEnc;
+    uint8_t *cm = pEnc + sizeof(l) + M_CHACHAPOLY_MAC;
+#ifdef M_USE_SODIUM
+    int rc;
+#endif
+
+    memset(nonce, 0, 4);
+    memcpy(nonce + 4, &pCtx->send_ctx.nonce, sizeof(uint64_t));
+#ifdef M_USE_SODIUM
+    unsigned long long cllen;
+    unsigned long long cmlen;
+
+    rc = crypto_aead_chacha20poly1305_ietf_encrypt(
+                    cl, &cllen,
+                    (uint8_t *)&l, sizeof(l),   //message length
+                    NULL, 0,                    //additional data
+                    NULL,                       //combined modeではNULL
+                    nonce, pCtx->send_ctx.key);     //nonce, key
+    if ((rc != 0) || (cllen != sizeof(l) + crypto_aead_chacha20poly1305_IETF_ABYTES)) {
+        LOGE("fail: crypto_aead_chacha20poly1305_ietf_encrypt rc=%d\n", rc);
+        goto LABEL_EXIT;
+    }
+#else
+    btc_chachapoly_encrypt(&pCtx->send_ctx.cipher,
+                    nonce,              //12byte
+                    NULL, 0,            //AAD
+                    (const uint8_t *)&l, sizeof(l), //input
+                    cl,                 //output
+                    cl + sizeof(l));    //MAC
+#endif
+
+    if (pCtx->send_ctx.nonce == 0) {
+        dump_key(pCtx->send_ctx.key, cl + sizeof(l));
+    }
+
+    pCtx->send_ctx.nonce++;
+    if (pCtx->send_ctx.nonce == 1000) {
+        LOGE("???: This root shall not in.\n");
+        goto LABEL_EXIT;
+    }
+    memcpy(nonce + 4, &pCtx->send_ctx.nonce, sizeof(uint64_t));
+
+#ifdef M_USE_SODIUM
+    rc = crypto_aead_chacha20poly1305_ietf_encrypt(
+                    cm, &cmlen,
+                    pData, Len,                 //message length
+                    NULL, 0,                    //additional data
+                    NULL,                       //combined modeではNULL
+                    nonce, pCtx->send_ctx.key);     //nonce, key
+    if ((rc != 0) || (cmlen != Len + crypto_aead_chacha20poly1305_IETF_ABYTES)) {
+        LOGE("fail: crypto_aead_chacha20poly1305_ietf_encrypt rc=%d\n", rc);
+        goto LABEL_EXIT;
+    }
+#else
+    btc_chachapoly_encrypt(&pCtx->send_ctx.cipher,
+                    nonce,              //12byte
+                    NULL, 0,            //AAD
+                    pData, Len,         //input
+                    cm,                 //output
+                    cm + Len);          //MAC
+#endif
+
+    pCtx->send_ctx.nonce++;
+    if (pCtx->send_ctx.nonce == 1000) {
+        noise_rotate(&pCtx->send_ctx);
+    }
+
+    ret = true;
+
+LABEL_EXIT:
+    return ret;
+}
+
+
+/** 暗号context初期化
+ *
+ * @param[in,out]   pCtx        noise情報(keyは設定済み)
+ */
+static void noise_cipher_init(ln_noise_ctx_t *pCtx)
+{
+#ifndef M_USE_SODIUM
+    btc_chachapoly_setkey(&pCtx->cipher, pCtx->key);
+#else
+    (void)pCtx;
+#endif
+}
+
+
+/** key rotation
+ *
+ * 暗号contextはkeyだけ差し替えて使い続ける。
+ *
+ * @param[in,out]   pCtx        noise情報
+ */
+static void noise_rotate(ln_noise_ctx_t *pCtx)
+{
+    //ck', k' = HKDF(ck, k)
+    noise_hkdf(pCtx->ck, pCtx->key, pCtx->ck, pCtx->key);
+    pCtx->nonce = 0;
+#ifndef M_USE_SODIUM
+    btc_chachapoly_setkey(&pCtx->cipher, pCtx->key);
+#endif
+}
+
+
 //BOLT#8
 //  HKDF(salt,ikm): a function defined in RFC 58693, evaluated with a zero-length info field
 //      All invocations of HKDF implicitly return 64 bytes of cryptographic randomness
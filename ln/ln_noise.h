@@ -25,7 +25,11 @@
 #ifndef LN_NOISE_H__
 #define LN_NOISE_H__
 
+#include "utl_buf.h"
+#include "utl_arena.h"
+
 #include "btc_keys.h"
+#include "btc_chachapoly.h"
 
 
 /** @struct ln_noise_ctx_t
@@ -35,6 +39,7 @@ typedef struct {
     uint8_t         key[BTC_SZ_PRIVKEY];            ///< key
     uint64_t        nonce;                          ///< nonce
     uint8_t         ck[BTC_SZ_HASH256];             ///< chainkey
+    btc_chachapoly_t cipher;                        ///< keyを設定済みのcontext(key rotationまで使い回す)
 } ln_noise_ctx_t;
 
 
@@ -100,20 +105,69 @@ bool ln_noise_handshake_state(ln_noise_t *pCtx);
 void ln_noise_handshake_free(ln_noise_t *pCtx);
 
 
-/**
+/** noise暗号context初期化
+ *
+ * send_ctx.key, recv_ctx.keyを暗号contextに設定する。
+ *
+ * @param[in,out]       pCtx        channel情報
+ * @note
+ *      - handshake完了時とkey rotation時は内部で設定するため、keyを直接設定した場合のみ呼び出す
+ */
+void ln_noise_cipher_init(ln_noise_t *pCtx);
+
+
+/** noise message暗号化
  *
+ * @param[in,out]       pCtx        channel情報
+ * @param[out]          pBufEnc     暗号化データ(#LN_SZ_NOISE_ENC(pBufIn->len))
+ * @param[in]           pBufIn      平文message
+ * @retval      true    成功
  */
 bool ln_noise_enc(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn);
 
 
-/**
+/** noise message暗号化(arena)
+ *
+ * #ln_noise_enc()と同じだが、pBufEncはpArenaから確保する。
+ *
+ * @param[in,out]       pCtx        channel情報
+ * @param[out]          pBufEnc     暗号化データ(#utl_buf_free()しないこと)
+ * @param[in]           pBufIn      平文message
+ * @param[in,out]       pArena      pBufEncの確保元
+ * @retval      true    成功
+ */
+bool ln_noise_enc_arena(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn, utl_arena_t *pArena);
+
+
+/** noise message暗号化(in-place)
+ *
+ * pBuf[#LN_SZ_NOISE_HEADER]から置いたLen byteの平文を、pBufの領域で暗号化する。
+ *
+ * @param[in,out]       pCtx        channel情報
+ * @param[in,out]       pBuf        [in]平文message(先頭#LN_SZ_NOISE_HEADERは空き), [out]暗号化データ(#LN_SZ_NOISE_ENC(Len))
+ * @param[in]           Len         平文messageの長さ
+ * @retval      true    成功
+ */
+bool ln_noise_enc_inplace(ln_noise_t *pCtx, uint8_t *pBuf, uint16_t Len);
+
+
+/** noise message長復号
  *
+ * @param[in,out]       pCtx        channel情報
+ * @param[in]           pData       暗号化length(+MAC)
+ * @param[in]           Len         pDataの長さ(#LN_SZ_NOISE_HEADER)
+ * @return      続けて受信するbody長(message長 + MAC。最大65535 + 16のためuint16_tに収まらない)。失敗時は0
  */
-uint16_t ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uint16_t Len);
+uint32_t ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uint16_t Len);
 
 
-/**
+/** noise message復号
  *
+ * pBuf->bufの領域で復号し、pBuf->lenを平文の長さにする。
+ *
+ * @param[in,out]       pCtx        channel情報
+ * @param[in,out]       pBuf        [in]暗号化body(#ln_noise_dec_len()の長さ), [out]平文message
+ * @retval      true    成功
  */
 bool ln_noise_dec_msg(ln_noise_t *pCtx, utl_buf_t *pBuf);
 
@@ -74,6 +74,10 @@
 
 #define M_ERRSTR_REASON                 "fail: %s (hop=%d)(suggest:%s)"
 
+#define M_MPP_SET_MAX                   (16)            ///< 同時に受信を待つmulti-path paymentの数
+#define M_MPP_PART_MAX                  (8)             ///< multi-path paymentあたりのpart数
+#define M_MPP_TIMEOUT_SEC               (60)            ///< multi-path paymentの全partが揃うまでの待ち時間[sec]
+
 
 /**************************************************************************
  * prototypes
@@ -84,7 +88,8 @@ static bool check_recv_add_htlc_bolt4(ln_channel_t *pChannel, uint16_t update_id
 static bool check_recv_add_htlc_bolt4_after_forward(
     ln_channel_t *pChannel, utl_buf_t *pReason, ln_msg_x_update_add_htlc_t *pForwardParam);
 static bool check_recv_add_htlc_bolt4_final(
-    ln_channel_t *pChannel, uint8_t *pPreimage, utl_buf_t *pReason, ln_msg_x_update_add_htlc_t *pForwardParam);
+    ln_channel_t *pChannel, uint8_t *pPreimage, uint64_t *pAmountMsat,
+    utl_buf_t *pReason, ln_msg_x_update_add_htlc_t *pForwardParam);
 static uint64_t forward_fee(uint64_t AmountMsat, ln_msg_channel_update_t* pMsg);
 static bool load_channel_update_local(
     ln_channel_t *pChannel, utl_buf_t *pBuf, ln_msg_channel_update_t* pMsg, uint64_t ShortChannelId);
@@ -107,17 +112,46 @@ static bool poll_update_del_htlc_forward(ln_channel_t *pChannel);
 static bool poll_update_add_htlc_forward_inactive(ln_channel_t *pChannel);
 static bool poll_update_add_htlc_forward_closing(ln_channel_t *pChannel);
 static bool poll_update_add_htlc_forward_origin(ln_channel_t *pChannel);
+static void forward_origin_del_htlc(
+    void *pCur, uint64_t PrevShortChannelId, uint64_t PrevHtlcId,
+    const uint8_t *pPreimage, const utl_buf_t *pReason);
+static bool forward_origin_mpp_expired(const uint8_t *pPaymentHash, uint64_t Now);
+static void forward_origin_mpp_clean(const uint8_t (*pPaymentHashes)[BTC_SZ_HASH256], int Num);
 static bool update_fail_htlc_forward_origin(
     ln_channel_t *pChannel, uint64_t PrevShortChannelId, uint64_t PrevHtlcId,
     const ln_msg_x_update_fail_htlc_t* pForwardMsg);
 static bool poll_update_del_htlc_forward_origin(ln_channel_t *pChannel);
 static bool update_fee_send_needs(ln_channel_t *pChannel, uint32_t FeeratePerKw);
+static void forward_notify(uint64_t NextShortChannelId);
+
+
+/**************************************************************************
+ * static variables
+ **************************************************************************/
+
+static ln_forward_notify_t  mForwardNotify;     ///< forward DB追加通知先
+
+/** 受信待ちのmulti-path payment
+ *
+ * forward DB(final node宛)のtransaction中だけ参照する。
+ */
+static struct {
+    bool        used;
+    uint8_t     payment_hash[BTC_SZ_HASH256];
+    uint64_t    first;                          ///< 最初のpartを受信した時刻(epoch time)
+} mMppWait[M_MPP_SET_MAX];
 
 
 /**************************************************************************
  * public functions
  **************************************************************************/
 
+void ln_forward_notify_set(ln_forward_notify_t pNotify)
+{
+    mForwardNotify = pNotify;
+}
+
+
 bool HIDDEN ln_update_add_htlc_recv(ln_channel_t *pChannel, const uint8_t *pData, uint16_t Len)
 {
     LOGD("BEGIN\n");
@@ -250,6 +284,7 @@ bool HIDDEN ln_update_fulfill_htlc_recv(ln_channel_t *pChannel, const uint8_t *p
         return false;
     }
     utl_buf_free(&buf);
+    forward_notify(param.next_short_channel_id);
 
     LOGD("END\n");
     return true;
@@ -481,6 +516,7 @@ bool HIDDEN ln_revoke_and_ack_recv(ln_channel_t *pChannel, const uint8_t *pData,
             param.p_msg = &buf;
             if (ln_db_forward_del_htlc_save(&param)) {
                 LOGD("\n");
+                forward_notify(param.next_short_channel_id);
             } else {
                 LOGE("fail: ???\n");
             }
@@ -598,6 +634,7 @@ bool ln_set_add_htlc_send_origin(
     msg.amt_to_forward = AmountMsat,
     msg.outgoing_cltv_value = CltvExpiry;
     msg.p_onion_routing_packet = pOnionRoutingPacket;
+    msg.total_msat = 0;
     utl_buf_t buf = UTL_BUF_INIT;
     /*ignore(XXX: need to check)*/ln_msg_x_update_add_htlc_write(&buf, &msg);
 
@@ -612,6 +649,7 @@ bool ln_set_add_htlc_send_origin(
         return false;
     }
     utl_buf_free(&buf);
+    forward_notify(NextShortChannelId);
     return true;
 }
 
@@ -748,7 +786,9 @@ static bool poll_update_add_htlc_forward(ln_channel_t *pChannel)
                 param.prev_short_channel_id = prev_short_channel_id;
                 param.prev_htlc_id = prev_htlc_id;
                 param.p_msg = &buf;
-                if (!ln_db_forward_del_htlc_save_2(&param, p_cur)) {
+                if (ln_db_forward_del_htlc_save_2(&param, p_cur)) {
+                    forward_notify(param.next_short_channel_id);
+                } else {
                     LOGE("fail: ???\n");
                 }
             } else {
@@ -873,7 +913,9 @@ static bool poll_update_add_htlc_forward_inactive(ln_channel_t *pChannel)
             param.prev_short_channel_id = prev_short_channel_id;
             param.prev_htlc_id = prev_htlc_id;
             param.p_msg = &buf;
-            if (!ln_db_forward_del_htlc_save_2(&param, p_cur)) {
+            if (ln_db_forward_del_htlc_save_2(&param, p_cur)) {
+                forward_notify(param.next_short_channel_id);
+            } else {
                 LOGE("fail: ???\n");
             }
         } else {
@@ -932,7 +974,9 @@ static bool poll_update_add_htlc_forward_closing(ln_channel_t *pChannel)
             param.prev_short_channel_id = prev_short_channel_id;
             param.prev_htlc_id = prev_htlc_id;
             param.p_msg = &buf;
-            if (!ln_db_forward_del_htlc_save_2(&param, p_cur)) {
+            if (ln_db_forward_del_htlc_save_2(&param, p_cur)) {
+                forward_notify(param.next_short_channel_id);
+            } else {
                 LOGE("fail: ???\n");
             }
         } else {
@@ -950,6 +994,13 @@ static bool poll_update_add_htlc_forward_closing(ln_channel_t *pChannel)
 }
 
 
+/** final node宛のHTLC
+ *
+ * invoiceの額に満たないHTLCのうち、payerがonionでmulti-path paymentのtotal_msatを指定したものは、
+ * partとして同じpayment_hashのHTLCが揃うまで保持する。
+ * 合計がinvoiceの額に達したらまとめてfulfillし、#M_MPP_TIMEOUT_SEC経過したらmpp_timeoutで返す。
+ * total_msatがないHTLCは、従来どおりincorrect_payment_amountで返す。
+ */
 static bool poll_update_add_htlc_forward_origin(ln_channel_t *pChannel)
 {
     void* p_cur = NULL;
@@ -957,6 +1008,19 @@ static bool poll_update_add_htlc_forward_origin(ln_channel_t *pChannel)
         return true;
     }
 
+    struct {
+        uint8_t     payment_hash[BTC_SZ_HASH256];
+        uint8_t     preimage[LN_SZ_PREIMAGE];
+        uint64_t    expected_msat;
+        uint64_t    total_msat;
+        int         num;
+        uint64_t    prev_short_channel_id[M_MPP_PART_MAX];
+        uint64_t    prev_htlc_id[M_MPP_PART_MAX];
+        bool        fulfill;
+        bool        timeout;
+    } mpp[M_MPP_SET_MAX];
+    int mpp_num = 0;
+
     uint64_t    prev_short_channel_id;
     uint64_t    prev_htlc_id;
     bool        b_commit = false;
@@ -967,8 +1031,9 @@ static bool poll_update_add_htlc_forward_origin(ln_channel_t *pChannel)
 
         ln_msg_x_update_add_htlc_t msg;
         uint8_t preimage[LN_SZ_PREIMAGE];
+        uint64_t expected_msat = 0;
         if (ln_msg_x_update_add_htlc_read(&msg, buf.buf, buf.len)) {
-            if (check_recv_add_htlc_bolt4_final(pChannel, preimage, &reason, &msg)) {
+            if (check_recv_add_htlc_bolt4_final(pChannel, preimage, &expected_msat, &reason, &msg)) {
                 succeeded = true;
             }
         } else {
@@ -978,55 +1043,220 @@ static bool poll_update_add_htlc_forward_origin(ln_channel_t *pChannel)
             utl_push_u16be(&push_reason, LNONION_TMP_NODE_FAIL);
         }
 
+        //C2. if the amount paid is less than the amount expected:
+        //      incorrect_payment_amount
+        //  total_msatがinvoiceの額以上であればmulti-path paymentのpartとみなし、同じpayment_hashの合計で判定する
+        if (succeeded && (msg.amount_msat < expected_msat)) {
+            bool b_part = (msg.total_msat >= expected_msat);
+            if (!b_part && (msg.total_msat != 0)) {
+                LOGE("fail: total_msat too small: %" PRIu64 " < %" PRIu64 "\n", msg.total_msat, expected_msat);
+            }
+            int idx = mpp_num;
+            if (b_part) {
+                for (idx = 0; idx < mpp_num; idx++) {
+                    if (memcmp(mpp[idx].payment_hash, msg.p_payment_hash, BTC_SZ_HASH256) == 0) {
+                        break;
+                    }
+                }
+            }
+            if (b_part && (idx == mpp_num) && (mpp_num < M_MPP_SET_MAX)) {
+                memcpy(mpp[idx].payment_hash, msg.p_payment_hash, BTC_SZ_HASH256);
+                memcpy(mpp[idx].preimage, preimage, LN_SZ_PREIMAGE);
+                mpp[idx].expected_msat = expected_msat;
+                mpp[idx].total_msat = 0;
+                mpp[idx].num = 0;
+                mpp[idx].fulfill = false;
+                mpp[idx].timeout = false;
+                mpp_num++;
+            }
+            if ((idx < mpp_num) && (mpp[idx].num < M_MPP_PART_MAX)) {
+                LOGD("hold part: amount_msat=%" PRIu64 "\n", msg.amount_msat);
+                mpp[idx].prev_short_channel_id[mpp[idx].num] = prev_short_channel_id;
+                mpp[idx].prev_htlc_id[mpp[idx].num] = prev_htlc_id;
+                mpp[idx].num++;
+                mpp[idx].total_msat += msg.amount_msat;
+                utl_buf_free(&buf);
+                utl_buf_free(&reason);
+                continue;
+            }
+            M_SET_ERR(pChannel, LNERR_INV_VALUE, "incorrect_payment_amount(final) : %" PRIu64 " < %" PRIu64,
+                msg.amount_msat, expected_msat);
+            utl_push_t push_reason;
+            utl_push_init(&push_reason, &reason, 0);
+            utl_push_u16be(&push_reason, LNONION_INCRR_OR_UNKNOWN_PAY);
+            utl_push_u64be(&push_reason, msg.amount_msat); //[8:htlc_msat]
+            succeeded = false;
+        }
+
         if (!ln_db_forward_add_htlc_cur_del(p_cur)) {
             LOGE("fail: ???\n");
         }
+        forward_origin_del_htlc(
+            p_cur, prev_short_channel_id, prev_htlc_id, (succeeded) ? preimage : NULL, &reason);
 
-        if (succeeded) {
-            ln_msg_x_update_fulfill_htlc_t forward_msg;
-            forward_msg.p_payment_preimage = preimage;
-            utl_buf_free(&buf);
-            if (ln_msg_x_update_fulfill_htlc_write(&buf, &forward_msg)) {
-                ln_db_forward_t param;
-                param.next_short_channel_id = prev_short_channel_id;
-                param.prev_short_channel_id = prev_short_channel_id;
-                param.prev_htlc_id = prev_htlc_id;
-                param.p_msg = &buf;
-                if (!ln_db_forward_del_htlc_save_2(&param, p_cur)) {
-                    LOGE("fail: ???\n");
-                }
-            } else {
-                LOGE("fail: ???\n");
-            }
+        b_commit = true;
+        utl_buf_free(&buf);
+        utl_buf_free(&reason);
+    }
+
+    //multi-path payment
+    uint64_t now = (uint64_t)utl_time_time();
+    uint8_t held[M_MPP_SET_MAX][BTC_SZ_HASH256];
+    int held_num = 0;
+    bool resolved = false;
+    for (int idx = 0; idx < mpp_num; idx++) {
+        if (mpp[idx].total_msat >= mpp[idx].expected_msat) {
+            LOGD("mpp complete: %" PRIu64 " >= %" PRIu64 "\n", mpp[idx].total_msat, mpp[idx].expected_msat);
+            mpp[idx].fulfill = true;
+            resolved = true;
+        } else if (forward_origin_mpp_expired(mpp[idx].payment_hash, now)) {
+            LOGE("mpp timeout: %" PRIu64 " < %" PRIu64 "\n", mpp[idx].total_msat, mpp[idx].expected_msat);
+            mpp[idx].timeout = true;
+            resolved = true;
         } else {
-            ln_msg_x_update_fail_htlc_t forward_msg;
-            forward_msg.len = reason.len;
-            forward_msg.p_reason = reason.buf;
+            memcpy(held[held_num++], mpp[idx].payment_hash, BTC_SZ_HASH256);
+        }
+    }
+    if (resolved) {
+        //保持していたHTLCは見つけた位置でまとめて削除する
+        ln_db_forward_add_htlc_cur_close(p_cur, b_commit);
+        b_commit = false;
+        if (!ln_db_forward_add_htlc_cur_open(&p_cur, 0)) {
+            return true;
+        }
+        while (ln_db_forward_add_htlc_cur_get(p_cur, &prev_short_channel_id, &prev_htlc_id, &buf)) {
             utl_buf_free(&buf);
-            if (ln_msg_x_update_fail_htlc_write(&buf, &forward_msg)) {
-                ln_db_forward_t param;
-                param.next_short_channel_id = prev_short_channel_id;
-                param.prev_short_channel_id = prev_short_channel_id;
-                param.prev_htlc_id = prev_htlc_id;
-                param.p_msg = &buf;
-                if (!ln_db_forward_del_htlc_save_2(&param, p_cur)) {
+            for (int idx = 0; idx < mpp_num; idx++) {
+                if (!mpp[idx].fulfill && !mpp[idx].timeout) {
+                    continue;
+                }
+                int lp;
+                for (lp = 0; lp < mpp[idx].num; lp++) {
+                    if ((mpp[idx].prev_short_channel_id[lp] == prev_short_channel_id) &&
+                        (mpp[idx].prev_htlc_id[lp] == prev_htlc_id)) {
+                        break;
+                    }
+                }
+                if (lp == mpp[idx].num) {
+                    continue;
+                }
+
+                utl_buf_t reason = UTL_BUF_INIT;
+                if (mpp[idx].timeout) {
+                    utl_push_t push_reason;
+                    utl_push_init(&push_reason, &reason, 0);
+                    utl_push_u16be(&push_reason, LNONION_MPP_TIMEOUT);
+                }
+                if (!ln_db_forward_add_htlc_cur_del(p_cur)) {
                     LOGE("fail: ???\n");
                 }
-            } else {
-                LOGE("fail: ???\n");
+                forward_origin_del_htlc(
+                    p_cur, prev_short_channel_id, prev_htlc_id,
+                    (mpp[idx].fulfill) ? mpp[idx].preimage : NULL, &reason);
+                utl_buf_free(&reason);
+                b_commit = true;
+                break;
             }
         }
-
-        b_commit = true;
-        utl_buf_free(&buf);
-        utl_buf_free(&reason);
     }
+    //解決したpayment_hashと、保持しているHTLCがなくなったpayment_hashは待ち合わせから外す
+    forward_origin_mpp_clean((const uint8_t (*)[BTC_SZ_HASH256])held, held_num);
 
     ln_db_forward_add_htlc_cur_close(p_cur, b_commit);
     return true;
 }
 
 
+/** final node宛HTLCの結果をforward DBに保存する
+ *
+ * @param[in]   pPreimage       NULL以外: fulfill / NULL: fail(pReason)
+ */
+static void forward_origin_del_htlc(
+    void *pCur, uint64_t PrevShortChannelId, uint64_t PrevHtlcId,
+    const uint8_t *pPreimage, const utl_buf_t *pReason)
+{
+    utl_buf_t buf = UTL_BUF_INIT;
+    bool ret;
+    if (pPreimage) {
+        ln_msg_x_update_fulfill_htlc_t forward_msg;
+        forward_msg.p_payment_preimage = pPreimage;
+        ret = ln_msg_x_update_fulfill_htlc_write(&buf, &forward_msg);
+    } else {
+        ln_msg_x_update_fail_htlc_t forward_msg;
+        forward_msg.len = pReason->len;
+        forward_msg.p_reason = pReason->buf;
+        ret = ln_msg_x_update_fail_htlc_write(&buf, &forward_msg);
+    }
+    if (ret) {
+        ln_db_forward_t param;
+        param.next_short_channel_id = PrevShortChannelId;
+        param.prev_short_channel_id = PrevShortChannelId;
+        param.prev_htlc_id = PrevHtlcId;
+        param.p_msg = &buf;
+        if (ln_db_forward_del_htlc_save_2(&param, pCur)) {
+            forward_notify(param.next_short_channel_id);
+        } else {
+            LOGE("fail: ???\n");
+        }
+    } else {
+        LOGE("fail: ???\n");
+    }
+    utl_buf_free(&buf);
+}
+
+
+/** multi-path paymentの待ち時間を過ぎたか
+ *
+ * 初めて見たpayment_hashは待ち合わせを開始する。
+ */
+static bool forward_origin_mpp_expired(const uint8_t *pPaymentHash, uint64_t Now)
+{
+    int empty = -1;
+    for (int lp = 0; lp < M_MPP_SET_MAX; lp++) {
+        if (!mMppWait[lp].used) {
+            if (empty < 0) {
+                empty = lp;
+            }
+            continue;
+        }
+        if (memcmp(mMppWait[lp].payment_hash, pPaymentHash, BTC_SZ_HASH256) == 0) {
+            return mMppWait[lp].first + M_MPP_TIMEOUT_SEC <= Now;
+        }
+    }
+    if (empty < 0) {
+        //待ち合わせできないものは待たせない
+        return true;
+    }
+    mMppWait[empty].used = true;
+    memcpy(mMppWait[empty].payment_hash, pPaymentHash, BTC_SZ_HASH256);
+    mMppWait[empty].first = Now;
+    return false;
+}
+
+
+/** 保持しているHTLCがなくなったpayment_hashを待ち合わせから外す
+ *
+ * @param[in]   pPaymentHashes      保持を続けるpayment_hash
+ */
+static void forward_origin_mpp_clean(const uint8_t (*pPaymentHashes)[BTC_SZ_HASH256], int Num)
+{
+    for (int lp = 0; lp < M_MPP_SET_MAX; lp++) {
+        if (!mMppWait[lp].used) {
+            continue;
+        }
+        int idx;
+        for (idx = 0; idx < Num; idx++) {
+            if (memcmp(mMppWait[lp].payment_hash, pPaymentHashes[idx], BTC_SZ_HASH256) == 0) {
+                break;
+            }
+        }
+        if (idx == Num) {
+            mMppWait[lp].used = false;
+        }
+    }
+}
+
+
 static bool update_fail_htlc_forward_origin(
     ln_channel_t *pChannel, uint64_t PrevShortChannelId, uint64_t PrevHtlcId,
     const ln_msg_x_update_fail_htlc_t* pForwardMsg)
@@ -1084,6 +1314,7 @@ static bool update_fail_htlc_forward_origin(
 
     if (short_channel_id) {
         bool b_temp = true;
+        bool b_skip = true;
         if (ln_onion_read_err(&onion_err, &reason)) {
             switch (onion_err.reason) {
             case LNONION_PERM_NODE_FAIL:
@@ -1092,12 +1323,20 @@ static bool update_fail_htlc_forward_origin(
                 //LOGD("add skip route: permanently: short_chanel_id=%" PRIu64 "\n", short_channel_id);
                 b_temp = false;
                 break;
+            case LNONION_MPP_TIMEOUT:
+                //他のpartが届かなかっただけで、経路の問題ではない
+                b_skip = false;
+                break;
             default:
                 //LOGD("add skip route: temporary: short_chanel_id=%" PRIu64 "\n", short_channel_id);
                 break;
             }
         }
-        ln_db_route_skip_save(short_channel_id, b_temp);
+        if (b_skip) {
+            ln_db_route_skip_save(short_channel_id, b_temp,
+                (b_temp) ? (uint64_t)utl_time_time() + LN_DB_ROUTE_SKIP_TEMP_SEC : 0);
+            ln_payment_exclude(PrevHtlcId, short_channel_id);
+        }
         ln_short_channel_id_string(suggest, short_channel_id);
     }
 
@@ -1450,6 +1689,7 @@ static bool check_recv_add_htlc_bolt4(ln_channel_t *pChannel, uint16_t UpdateIdx
     msg.amt_to_forward = hop_dataout.amt_to_forward;
     msg.outgoing_cltv_value = hop_dataout.outgoing_cltv_value;
     msg.p_onion_routing_packet = p_htlc->buf_onion_reason.buf;
+    msg.total_msat = (hop_dataout.b_exit) ? hop_dataout.total_msat : 0;
     /*ignore(XXX: need to check)*/ln_msg_x_update_add_htlc_write(&buf_forward_msg, &msg);
 
     ln_db_forward_t param;
@@ -1459,6 +1699,7 @@ static bool check_recv_add_htlc_bolt4(ln_channel_t *pChannel, uint16_t UpdateIdx
     param.p_msg = &buf_forward_msg;
     if (ln_db_forward_add_htlc_save(&param)) {
         LOGD("\n");
+        forward_notify(param.next_short_channel_id);
     } else {
         LOGE("fail: ???\n");
         if (p_htlc->neighbor_short_channel_id) {
@@ -1589,14 +1830,20 @@ LABEL_ERROR:
 }
 
 
+/** final nodeのBOLT4 check
+ *
+ * C2(amountの不足)はmulti-path paymentのpartがありうるため、呼び元でtotal_msatとpayment_hashごとの合計から判定する。
+ *
+ * @param[out]  pAmountMsat     invoiceの額
+ */
 static bool check_recv_add_htlc_bolt4_final(
-    ln_channel_t *pChannel, uint8_t *pPreimage, utl_buf_t *pReason, ln_msg_x_update_add_htlc_t *pForwardParam)
+    ln_channel_t *pChannel, uint8_t *pPreimage, uint64_t *pAmountMsat,
+    utl_buf_t *pReason, ln_msg_x_update_add_htlc_t *pForwardParam)
 {
     utl_push_t push_reason;
     int32_t height = 0;
 
     ln_db_preimage_t preimage;
-    uint8_t preimage_hash[BTC_SZ_HASH256];
 
     utl_push_init(&push_reason, pReason, 0);
 
@@ -1609,25 +1856,7 @@ static bool check_recv_add_htlc_bolt4_final(
 
     preimage.amount_msat = (uint64_t)-1;
     preimage.expiry = 0;
-    void *p_cur;
-    if (!ln_db_preimage_cur_open(&p_cur)) { //XXX: internal error?
-        M_SET_ERR(pChannel, LNERR_INV_VALUE, "preimage mismatch");
-        utl_push_u16be(&push_reason, LNONION_INCRR_OR_UNKNOWN_PAY);
-        utl_push_u64be(&push_reason, pForwardParam->amount_msat); //[8:htlc_msat]
-        return false;
-    }
-    bool detect = false;
-    for (;;) {
-        detect = false;
-        if (!ln_db_preimage_cur_get(p_cur, &detect, &preimage)) break;     //from invoice
-        if (!detect) continue;
-        memcpy(pPreimage, preimage.preimage, LN_SZ_PREIMAGE);
-        ln_payment_hash_calc(preimage_hash, pPreimage);
-        if (memcmp(preimage_hash, pForwardParam->p_payment_hash, BTC_SZ_HASH256)) continue;
-        break;
-    }
-    ln_db_preimage_cur_close(p_cur, false);
-    if (!detect) {
+    if (!ln_db_preimage_search_hash(&preimage, pForwardParam->p_payment_hash, false)) {     //from invoice
         //C1. if the payment hash has already been paid:
         //      ★(採用)MAY treat the payment hash as unknown.★
         //      MAY succeed in accepting the HTLC.
@@ -1638,18 +1867,12 @@ static bool check_recv_add_htlc_bolt4_final(
         utl_push_u64be(&push_reason, pForwardParam->amount_msat); //[8:htlc_msat]
         return false;
     }
+    memcpy(pPreimage, preimage.preimage, LN_SZ_PREIMAGE);
+    *pAmountMsat = preimage.amount_msat;
     LOGD("match preimage: ");
     DUMPD(pPreimage, LN_SZ_PREIMAGE);
 
-    //C2. if the amount paid is less than the amount expected:
-    //      incorrect_payment_amount
-    if (pForwardParam->amount_msat < preimage.amount_msat) {
-        M_SET_ERR(pChannel, LNERR_INV_VALUE, "incorrect_payment_amount(final) : %" PRIu64 " < %" PRIu64,
-            pForwardParam->amount_msat, preimage.amount_msat);
-        utl_push_u16be(&push_reason, LNONION_INCRR_OR_UNKNOWN_PAY);
-        utl_push_u64be(&push_reason, pForwardParam->amount_msat); //[8:htlc_msat]
-        return false;
-    }
+    //C2. (see poll_update_add_htlc_forward_origin())
 
     //C4. if the amount paid is more than twice the amount expected:
     //      incorrect_payment_amount
@@ -2232,3 +2455,19 @@ static bool update_fee_send_needs(ln_channel_t *pChannel, uint32_t FeeratePerKw)
 
     return true;
 }
+
+
+/** forward DB追加通知
+ *
+ * 転送先channelの処理を待たずに起こすため、上位層に通知する。
+ * forward DBは引き続きcrash recovery用のjournalとして使う。
+ * cursorのtxn commit前に通知しても、転送先はwrite txn開始で待たされるため問題ない。
+ *
+ * @param[in]   NextShortChannelId      転送先short_channel_id(0:origin/final node)
+ */
+static void forward_notify(uint64_t NextShortChannelId)
+{
+    if (mForwardNotify) {
+        (*mForwardNotify)(NextShortChannelId);
+    }
+}
@@ -27,15 +27,15 @@
 #ifdef M_USE_SODIUM
 #include <sodium/crypto_stream_chacha20.h>
 #include <sodium/randombytes.h>
-#else
-#include "mbedtls/chacha20.h"
 #endif
 #include "mbedtls/md.h"
+#include "mbedtls/ecp.h"
 
 #include "utl_dbg.h"
 #include "utl_int.h"
 
 #include "btc_crypto.h"
+#include "btc_chachapoly.h"
 
 #include "ln_onion.h"
 #include "ln_node.h"
@@ -83,8 +83,8 @@ static const uint8_t AMMAG[] = { 'a', 'm', 'm', 'a', 'g' };
  * prototypes
  **************************************************************************/
 
-static void multi_scalar_mul(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactors, int NumHops);
 static bool blind_group_element(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactor);
+static bool blind_scalar(uint8_t *pResult, const uint8_t *pScalar, const uint8_t *pBlindingFactor);
 static void compute_blinding_factor(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pSharedSecret);
 static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int StrLen, int NumHops, const uint8_t *pSharedSecrets);
 static bool generate_key(uint8_t *pResult, const uint8_t *pKeyStr, int StrLen, const uint8_t *pSharedSecret);
@@ -102,6 +102,7 @@ bool ln_onion_create_packet(uint8_t *pPacket,
             utl_buf_t *pSecrets,
             const ln_hop_datain_t *pHopData,
             int NumHops,
+            uint64_t TotalMsat,
             const uint8_t *pSessionKey,
             const uint8_t *pAssocData, int AssocLen)
 {
@@ -114,47 +115,42 @@ bool ln_onion_create_packet(uint8_t *pPacket,
     uint8_t next_hmac[M_SZ_HMAC];
     uint8_t rho_key[M_SZ_KEYLEN];
     uint8_t mu_key[M_SZ_KEYLEN];
-
-    //メモリ確保
-    uint8_t *eph_pubkeys = (uint8_t *)UTL_DBG_MALLOC(BTC_SZ_PUBKEY * NumHops);
-    uint8_t *shd_secrets = (uint8_t *)UTL_DBG_MALLOC(M_SZ_SHARED_SECRET * NumHops);
-    uint8_t *blind_factors = (uint8_t *)UTL_DBG_MALLOC(M_SZ_BLINDING_FACT * NumHops);
-    uint8_t *filler = (uint8_t *)UTL_DBG_MALLOC(M_SZ_HOP_DATA * (LN_HOP_MAX - 1));
-    //メモリ確保(初期値0)
-    uint8_t *mix_header = (uint8_t *)UTL_DBG_CALLOC(1, M_SZ_ROUTING_INFO);
-    uint8_t *stream_bytes = (uint8_t *)UTL_DBG_CALLOC(1, M_SZ_STREAM_BYTES);
-
-    //[0]は最初に作る
-
-    //セッション鍵のpubkey --> eph_pubkeys[0]
-    btc_keys_priv2pub(eph_pubkeys, pSessionKey);
-
-    //セッション鍵とpaymentPathの先頭から作った共有鍵のSHA256 --> shd_secrets[0]
-    btc_ecc_shared_secret_sha256(shd_secrets, pHopData[0].pubkey, pSessionKey);
-
-    //eph_pubkeys[0]とshd_secrets[0]から計算 --> blind_factors[0]
-    compute_blinding_factor(blind_factors, eph_pubkeys, shd_secrets);
-
-    for (int lp = 1; lp < NumHops; lp++) {
-        //eph_pubkeys[lp-1] * blind_factors[lp - 1] --> eph_pubkeys[lp]
-        blind_group_element(eph_pubkeys + BTC_SZ_PUBKEY * lp,
-                            eph_pubkeys + BTC_SZ_PUBKEY * (lp - 1),
-                            blind_factors + M_SZ_BLINDING_FACT * (lp - 1));
-
-        //paymentPath[lp] * セッション鍵 --> yToX(公開鍵)
-        //yToXにblind_factors[0～lp]までを掛けていった結果をSHA256 --> shd_secrets[lp]
-        uint8_t yToX[BTC_SZ_PUBKEY];
-        uint8_t buf[BTC_SZ_PUBKEY];
-
-        blind_group_element(yToX, pHopData[lp].pubkey, pSessionKey);
-        multi_scalar_mul(buf, yToX, blind_factors, lp);
-        btc_md_sha256(shd_secrets + M_SZ_SHARED_SECRET * lp, buf, sizeof(buf));
+    uint8_t eph_privkey[BTC_SZ_PRIVKEY];
+
+    uint8_t eph_pubkeys[BTC_SZ_PUBKEY * LN_HOP_MAX];
+    uint8_t shd_secrets[M_SZ_SHARED_SECRET * LN_HOP_MAX];
+    uint8_t blind_factors[M_SZ_BLINDING_FACT * LN_HOP_MAX];
+    uint8_t filler[M_SZ_HOP_DATA * (LN_HOP_MAX - 1)];
+    uint8_t mix_header[M_SZ_ROUTING_INFO];
+    uint8_t stream_bytes[M_SZ_STREAM_BYTES];
+
+    //ephemeral keyはblinding factorを掛けた秘密鍵を持ち回って計算する(1hopあたりEC演算2回)
+    //  eph_privkey[0]  = セッション鍵
+    //  eph_privkey[lp] = eph_privkey[lp-1] * blind_factors[lp-1] (mod N)
+    //  eph_pubkeys[lp] = eph_privkey[lp] * G
+    //  shd_secrets[lp] = SHA256(paymentPath[lp] * eph_privkey[lp])
+    memcpy(eph_privkey, pSessionKey, BTC_SZ_PRIVKEY);
+    for (int lp = 0; lp < NumHops; lp++) {
+        if (lp > 0) {
+            if (!blind_scalar(eph_privkey, eph_privkey, blind_factors + M_SZ_BLINDING_FACT * (lp - 1))) {
+                LOGE("fail: blind ephemeral key\n");
+                memset(eph_privkey, 0, sizeof(eph_privkey));
+                return false;
+            }
+        }
+        if (!btc_keys_priv2pub(eph_pubkeys + BTC_SZ_PUBKEY * lp, eph_privkey) ||
+            !btc_ecc_shared_secret_sha256(shd_secrets + M_SZ_SHARED_SECRET * lp, pHopData[lp].pubkey, eph_privkey)) {
+            LOGE("fail: ephemeral key\n");
+            memset(eph_privkey, 0, sizeof(eph_privkey));
+            return false;
+        }
 
         //SHA256(eph_pubkeys[lp] || shd_secrets[lp]) --> blind_factors[lp]
         compute_blinding_factor(blind_factors + M_SZ_BLINDING_FACT * lp,
                             eph_pubkeys + BTC_SZ_PUBKEY * lp,
                             shd_secrets + M_SZ_SHARED_SECRET * lp);
     }
+    memset(eph_privkey, 0, sizeof(eph_privkey));
 
     filler_len = generate_header_padding(filler, RHO, sizeof(RHO), NumHops, shd_secrets);
 #ifdef UNITTEST
@@ -173,6 +169,7 @@ bool ln_onion_create_packet(uint8_t *pPacket,
 #endif  //UNITTEST
 
     memset(next_hmac, 0, sizeof(next_hmac));
+    memset(mix_header, 0, sizeof(mix_header));
 
     //For each hop in the route in reverse order the sender applies the following operations:
     for (int lp = NumHops - 1; lp >= 0; lp--) {
@@ -186,7 +183,7 @@ bool ln_onion_create_packet(uint8_t *pPacket,
         //[ 1] short_channel_id
         //[ 9] amt_to_forward
         //[17] outgoing_cltv_value
-        //[21] padding
+        //[21] padding([8:total_msat]: 最終hopでmulti-path paymentの場合のみ)
         //[33] hmac
         uint8_t *p = mix_header;
         if (LN_DBG_ONION_CREATE_NORMAL_REALM()) {
@@ -202,6 +199,9 @@ bool ln_onion_create_packet(uint8_t *pPacket,
         utl_int_unpack_u32be(p, pHopData[lp].outgoing_cltv_value);
         p += M_SZ_OUTGOING_CLTV_VAL;
         memset(p, 0, M_SZ_PAD);
+        if ((lp == NumHops - 1) && (TotalMsat != 0)) {
+            utl_int_unpack_u64be(p, TotalMsat);
+        }
         p += M_SZ_PAD;
         memcpy(p, next_hmac, M_SZ_HMAC);
         p += M_SZ_HMAC;
@@ -232,14 +232,6 @@ bool ln_onion_create_packet(uint8_t *pPacket,
         utl_buf_alloccopy(pSecrets, shd_secrets, M_SZ_SHARED_SECRET * NumHops);
     }
 
-    //メモリ解放
-    UTL_DBG_FREE(stream_bytes);
-    UTL_DBG_FREE(mix_header);
-    UTL_DBG_FREE(filler);
-    UTL_DBG_FREE(blind_factors);
-    UTL_DBG_FREE(shd_secrets);
-    UTL_DBG_FREE(eph_pubkeys);
-
     return true;
 }
 
@@ -325,6 +317,7 @@ bool HIDDEN ln_onion_read_packet(
     pNextData->short_channel_id = utl_int_pack_u64be(stream_bytes + M_SZ_REALM);
     pNextData->amt_to_forward = utl_int_pack_u64be(stream_bytes + M_SZ_REALM + M_SZ_CHANNEL_ID);
     pNextData->outgoing_cltv_value = utl_int_pack_u32be(stream_bytes + M_SZ_REALM + M_SZ_CHANNEL_ID + M_SZ_AMT_TO_FORWARD);
+    pNextData->total_msat = utl_int_pack_u64be(stream_bytes + M_SZ_REALM + M_SZ_CHANNEL_ID + M_SZ_AMT_TO_FORWARD + M_SZ_OUTGOING_CLTV_VAL);
 
     uint8_t blind_factor[M_SZ_BLINDING_FACT];
     compute_blinding_factor(blind_factor, p_dhkey, shared_secret);
@@ -592,6 +585,7 @@ char *ln_onion_get_errstr(const ln_onion_err_t *pOnionErr)
         { LNONION_FINAL_INCORR_HTLC_AMT, "final_incorrect_htlc_amount" },
         { LNONION_CHAN_DISABLE, "channel_disabled" },
         { LNONION_EXPIRY_TOO_FAR, "expiry_too_far" },
+        { LNONION_MPP_TIMEOUT, "mpp_timeout" },
     };
 
     const char *p_str = NULL;
@@ -614,28 +608,50 @@ char *ln_onion_get_errstr(const ln_onion_err_t *pOnionErr)
  * private functions
  **************************************************************************/
 
-/** loop{ PubKey * BlindingFactor[lp] } --> pOutput
+/** PubKey * BlindingFactor --> pResult
  *
  * @param[out]      pResult         BTC_SZ_PUBKEY
  */
-static void multi_scalar_mul(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactors, int NumHops)
+static bool blind_group_element(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactor)
 {
-    memcpy(pResult, pPubKey, BTC_SZ_PUBKEY);
-    for (int lp = 0; lp < NumHops; lp++) {
-        //前の結果公開鍵 * pBlindingFactors[lp] --> 結果公開鍵
-        blind_group_element(pResult, pResult, pBlindingFactors + M_SZ_BLINDING_FACT * lp);
-    }
+    bool ret = btc_ecc_mul_pubkey(pResult, pPubKey, pBlindingFactor, M_SZ_BLINDING_FACT);
+    return ret;
 }
 
 
-/** PubKey * BlindingFactor --> pResult
+/** Scalar * BlindingFactor (mod N) --> pResult
  *
- * @param[out]      pResult         BTC_SZ_PUBKEY
+ * @param[out]      pResult         BTC_SZ_PRIVKEY(pScalarと同じでもよい)
  */
-static bool blind_group_element(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactor)
+static bool blind_scalar(uint8_t *pResult, const uint8_t *pScalar, const uint8_t *pBlindingFactor) //XXX: mbed
 {
-    bool ret = btc_ecc_mul_pubkey(pResult, pPubKey, pBlindingFactor, M_SZ_BLINDING_FACT);
-    return ret;
+    int ret;
+    mbedtls_mpi a;
+    mbedtls_mpi b;
+    mbedtls_ecp_group *p_grp = (mbedtls_ecp_group *)btc_ecc_group();
+
+    mbedtls_mpi_init(&a);
+    mbedtls_mpi_init(&b);
+    ret = mbedtls_mpi_read_binary(&a, pScalar, BTC_SZ_PRIVKEY);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_read_binary(&b, pBlindingFactor, M_SZ_BLINDING_FACT);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_mul_mpi(&a, &a, &b);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_mod_mpi(&a, &a, &p_grp->N);
+    if (ret) goto LABEL_EXIT;
+    if (mbedtls_mpi_cmp_int(&a, 0) == 0) {
+        ret = -1;
+        goto LABEL_EXIT;
+    }
+    ret = mbedtls_mpi_write_binary(&a, pResult, BTC_SZ_PRIVKEY);
+
+LABEL_EXIT:
+    mbedtls_mpi_lset(&a, 0);            //clear for security
+    mbedtls_mpi_free(&b);
+    mbedtls_mpi_free(&a);
+
+    return ret == 0;
 }
 
 
@@ -660,7 +676,7 @@ static void compute_blinding_factor(uint8_t *pResult, const uint8_t *pPubKey, co
  */
 static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int StrLen, int NumHops, const uint8_t *pSharedSecrets)
 {
-    uint8_t *streamBytes = (uint8_t *)UTL_DBG_MALLOC(M_SZ_STREAM_BYTES);
+    uint8_t streamBytes[M_SZ_STREAM_BYTES];
     uint8_t streamKey[M_SZ_KEYLEN];
     int len = 0;
 
@@ -678,8 +694,6 @@ static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int
         xor_bytes(pResult, pResult, streamBytes + sz, len);
     }
 
-    UTL_DBG_FREE(streamBytes);
-
     return len;
 }
 
@@ -707,13 +721,9 @@ static void generate_cipher_stream(uint8_t *pResult, const uint8_t *pKey, int Le
     crypto_stream_chacha20(pResult, Len, nonce, pKey);
 #else
     uint8_t nonce[12] = {0};
-    uint8_t *dummy = (uint8_t *)UTL_DBG_CALLOC(1, Len);
-    int ret = mbedtls_chacha20_crypt(pKey, nonce, 0, Len, dummy, pResult);
-    if (ret != 0) {
-        LOGE("FATAL: mbedtls_chacha20_crypt\n");
-        abort();
-    }
-    UTL_DBG_FREE(dummy);
+    //0をin-placeで暗号化 --> key stream
+    memset(pResult, 0, Len);
+    btc_chacha20_crypt(pResult, pResult, Len, pKey, nonce, 0);
 #endif
 }
 
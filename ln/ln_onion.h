@@ -60,6 +60,7 @@ typedef struct {
     uint64_t            short_channel_id;               ///< short_channel_id
     uint64_t            amt_to_forward;                 ///< update_add_htlcのamount-msat
     uint32_t            outgoing_cltv_value;            ///< update_add_htlcのcltv-expiry
+    uint64_t            total_msat;                     ///< multi-path paymentの合計額(0:multi-path paymentではない)
 } ln_hop_dataout_t;
 
 
@@ -104,15 +105,20 @@ bool HIDDEN ln_onion_read_packet(uint8_t *pNextPacket, ln_hop_dataout_t *pNextDa
  * @param[out]      pSecrets            全shared secret(#ln_onion_failure_read()用)
  * @param[in]       pHopData            HOPデータ
  * @param[in]       NumHops             pHopData数
+ * @param[in]       TotalMsat           multi-path paymentの合計額(0:multi-path paymentではない)
  * @param[in]       pSessionKey         セッション鍵[BTC_SZ_PRIVKEY]
  * @param[in]       pAssocData          Associated Data
  * @param[in]       AssocLen            pAssocData長
  * @retval      true    成功
+ *
+ * @note
+ *      - TotalMsatは最終hopのpadding先頭8byteに入れる(ptarmigan同士のmulti-path payment用)
  */
 bool ln_onion_create_packet(uint8_t *pPacket,
             utl_buf_t *pSecrets,
             const ln_hop_datain_t *pHopData,
             int NumHops,
+            uint64_t TotalMsat,
             const uint8_t *pSessionKey,
             const uint8_t *pAssocData, int AssocLen);
 
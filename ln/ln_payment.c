@@ -29,6 +29,8 @@
 #include <time.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/queue.h>
 
 #include "utl_str.h"
 #include "utl_buf.h"
@@ -55,23 +57,86 @@
 #include "ln_payment.h"
 
 
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_RETRY_CTX_MAX         (32)        ///< 保持するretry contextの最大数
+#define M_ROUTE_CANDIDATES      (4)         ///< 1回の検索で作る経路候補の数
+#define M_EXCLUDE_MAX           (20)        ///< retry contextで除外するchannelの最大数
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct retry_ctx_t
+ *  @brief  retry context
+ *
+ *  payment_id(partの場合はpartのid)ごとに、decode済みinvoice、経路候補、失敗したchannelを保持する。
+ *  retryでは残っている候補を#ln_routing_reprice()で計算し直すだけで済ませ、
+ *  候補を使い切った場合だけ失敗したchannelを除外して検索し直す。
+ *  再起動などでcontextがない場合は、DBのinvoiceから作り直す。
+ */
+typedef struct retry_ctx_t {
+    LIST_ENTRY(retry_ctx_t) list;
+    uint64_t                payment_id;
+    ln_invoice_t            *p_invoice;                 ///< decode済みinvoice
+    uint64_t                amount_msat;                ///< payeeへの送金額
+    ln_routing_profile_t    profile;
+    uint8_t                 cand_num;                   ///< 未使用の経路候補数
+    ln_routing_result_t     cand[M_ROUTE_CANDIDATES];   ///< 経路候補(先頭から使用する)
+    uint8_t                 exclude_num;
+    uint64_t                exclude[M_EXCLUDE_MAX];     ///< 失敗したshort_channel_id
+} retry_ctx_t;
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+//保持中のcontext(先頭ほど新しい)
+//  mMuxRetryを保持したままDBやroutingを呼ばない
+//  使用中のcontextは#ctx_checkout()でlistから外し、他threadから解放されないようにする
+static pthread_mutex_t              mMuxRetry = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(retry_ctx_head_t, retry_ctx_t) mRetryCtxHead = LIST_HEAD_INITIALIZER(mRetryCtxHead);
+static int                          mRetryCtxNum;
+
+
 /**************************************************************************
  * prototypes
  **************************************************************************/
 
-static ln_payment_error_t route_invoice(
-    ln_payment_route_t *pRoute, uint8_t *pPaymentHash,
-    const char *pInvoice, uint32_t InvoiceLen,
-    uint64_t AdditionalAmountMsat, uint32_t BlockCount);
+static retry_ctx_t *ctx_create(
+    ln_payment_error_t *pError, uint64_t PaymentId, const char *pInvoice, uint32_t InvoiceLen,
+    uint64_t AdditionalAmountMsat, uint64_t AmountMsat, ln_routing_profile_t Profile);
+static retry_ctx_t *ctx_dup(const retry_ctx_t *pCtx, uint64_t PaymentId, uint64_t AmountMsat);
+static void ctx_free(retry_ctx_t *pCtx);
+static void ctx_checkin(retry_ctx_t *pCtx);
+static retry_ctx_t *ctx_checkout(uint64_t PaymentId);
+static void ctx_exclude(retry_ctx_t *pCtx, uint64_t ShortChannelId);
+static ln_payment_error_t route_ctx(
+    ln_payment_route_t *pRoutes, uint8_t *pNum, uint8_t MaxParts, retry_ctx_t *pCtx, uint32_t BlockCount);
+static uint8_t max_parts(uint8_t MaxParts);
+static ln_payment_error_t route_error(lnerr_route_t Err);
+static bool comp_func_payable(ln_channel_t *pChannel, void *p_db_param, void *p_param);
 static ln_payment_error_t payment_start(
-    uint64_t *pPaymentId, const ln_payment_route_t *pRoute, const uint8_t *pPaymentHash,
+    uint64_t *pPaymentId, const ln_payment_route_t *pRoutes, uint8_t Num, const uint8_t *pPaymentHash,
     uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount,
-    const char *pInvoice);
+    const char *pInvoice, ln_routing_profile_t Profile, uint8_t MaxParts, retry_ctx_t *pCtx);
+static ln_payment_error_t payment_parts(
+    uint64_t PaymentId, const uint8_t *pPaymentHash,
+    const ln_payment_route_t *pRoutes, uint8_t Num, uint32_t BlockCount, const retry_ctx_t *pCtx);
+static ln_payment_error_t part_retry(uint64_t PartId, const ln_payment_part_t *pPart, uint32_t BlockCount);
+static bool part_end(uint64_t PartId, ln_payment_part_t *pPart, ln_payment_state_t State, const uint8_t *pPreimage);
+static bool payment_end(uint64_t PaymentId, ln_payment_state_t State, const uint8_t *pPreimage);
 static ln_payment_error_t check_route(const ln_payment_route_t *pRoute);
 static void payment_info_init(
     ln_payment_info_t *pInfo, const uint8_t *pPaymentHash, uint64_t AdditionalAmountMsat,
-    uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount, ln_payment_state_t state);
-static ln_payment_error_t payment(uint64_t PaymentId, const uint8_t *pPaymentHash, const ln_payment_route_t *pRoute);
+    uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount, ln_payment_state_t state,
+    ln_routing_profile_t Profile, uint8_t MaxParts);
+static ln_payment_error_t payment(
+    uint64_t PaymentId, const uint8_t *pPaymentHash, const ln_payment_route_t *pRoute, uint64_t TotalMsat);
 
 
 /********************************************************************
@@ -80,23 +145,36 @@ static ln_payment_error_t payment(uint64_t PaymentId, const uint8_t *pPaymentHas
 
 ln_payment_error_t ln_payment_start_invoice(
     uint64_t *pPaymentId, ln_payment_route_t *pRoute, const char *pInvoice,
-    uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount)
+    uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount,
+    ln_routing_profile_t Profile, uint8_t MaxParts)
 {
     *pPaymentId = LN_PAYMENT_ID_INVALID;
 
     ln_payment_error_t  retval = LN_PAYMENT_ERROR;
     uint8_t             payment_hash[BTC_SZ_HASH256];
+    ln_payment_route_t  routes[LN_PAYMENT_PARTS_MAX];
+    uint8_t             num = 0;
 
-    retval = route_invoice(
-        pRoute, payment_hash, pInvoice, strlen(pInvoice), AdditionalAmountMsat, BlockCount);
+    retry_ctx_t *p_ctx = ctx_create(
+        &retval, LN_PAYMENT_ID_INVALID, pInvoice, strlen(pInvoice), AdditionalAmountMsat, 0, Profile);
+    if (!p_ctx) {
+        LOGE("fail: ???\n");
+        return retval;
+    }
+    MaxParts = max_parts(MaxParts);
+    retval = route_ctx(routes, &num, MaxParts, p_ctx, BlockCount);
     if (retval != LN_PAYMENT_OK) {
         LOGE("fail: ???\n");
+        ctx_free(p_ctx);
         return retval;
     }
+    memcpy(payment_hash, p_ctx->p_invoice->payment_hash, BTC_SZ_HASH256);
 
+    //multi-pathの場合は先頭partのroute
+    memcpy(pRoute, &routes[0], sizeof(ln_payment_route_t));
     return payment_start(
-        pPaymentId, pRoute, payment_hash, AdditionalAmountMsat,
-        RetryCount, AutoRemove, BlockCount, pInvoice);
+        pPaymentId, routes, num, payment_hash, AdditionalAmountMsat,
+        RetryCount, AutoRemove, BlockCount, pInvoice, Profile, MaxParts, p_ctx);
 }
 
 
@@ -107,17 +185,24 @@ ln_payment_error_t ln_payment_start_test(
     *pPaymentId = LN_PAYMENT_ID_INVALID;
 
     return payment_start(
-        pPaymentId, pRoute, pPaymentHash, 0, 0, true, BlockCount, NULL);
+        pPaymentId, pRoute, 1, pPaymentHash, 0, 0, true, BlockCount, NULL, LN_ROUTING_PROFILE_FEE, 1, NULL);
 }
 
 
 ln_payment_error_t ln_payment_retry(uint64_t PaymentId, uint32_t BlockCount)
 {
     ln_payment_error_t  retval = LN_PAYMENT_ERROR;
-    utl_buf_t           buf_invoice = UTL_BUF_INIT;
-    ln_payment_route_t  route;
+    ln_payment_route_t  routes[LN_PAYMENT_PARTS_MAX];
+    uint8_t             num = 0;
     uint8_t             payment_hash[BTC_SZ_HASH256];
     ln_payment_info_t   info;
+    ln_payment_part_t   part;
+    retry_ctx_t         *p_ctx = NULL;
+
+    //multi-path payment's part
+    if (ln_db_payment_part_load(&part, PaymentId)) {
+        return part_retry(PaymentId, &part, BlockCount);
+    }
 
     //local payment data
     LOGD("payment_id: %" PRIu64 "\n", PaymentId);
@@ -131,79 +216,108 @@ ln_payment_error_t ln_payment_retry(uint64_t PaymentId, uint32_t BlockCount)
         retval = LN_PAYMENT_ERROR;
         goto LABEL_ERROR;
     }
-    if (!ln_db_payment_invoice_load(&buf_invoice, PaymentId)) {
-        LOGE("fail: ???\n");
-        retval = LN_PAYMENT_ERROR;
-        goto LABEL_ERROR;
+    p_ctx = ctx_checkout(PaymentId);
+    if (!p_ctx) {
+        //no context (e.g. restarted): decode the invoice again
+        //  (routing_profile is 0(LN_ROUTING_PROFILE_FEE) in the data saved by the older version)
+        utl_buf_t buf_invoice = UTL_BUF_INIT;
+        if (!ln_db_payment_invoice_load(&buf_invoice, PaymentId)) {
+            LOGE("fail: ???\n");
+            retval = LN_PAYMENT_ERROR;
+            goto LABEL_ERROR;
+        }
+        p_ctx = ctx_create(
+            &retval, PaymentId, (const char *)buf_invoice.buf, buf_invoice.len, info.additional_amount_msat, 0,
+            (info.routing_profile < LN_ROUTING_PROFILE_MAX) ?
+                (ln_routing_profile_t)info.routing_profile : LN_ROUTING_PROFILE_FEE);
+        utl_buf_free(&buf_invoice);
+        if (!p_ctx) {
+            LOGE("fail: ???\n");
+            goto LABEL_ERROR;
+        }
     }
     info.retry_count++;
 
-    //routing with invoice
-    retval = route_invoice(
-        &route, payment_hash, (const char *)buf_invoice.buf, buf_invoice.len,
-        info.additional_amount_msat, BlockCount);
+    //routing with the retry context
+    //  (max_parts is 0 in the data saved by the older version: single path)
+    retval = route_ctx(routes, &num, max_parts(info.max_parts), p_ctx, BlockCount);
     if (retval != LN_PAYMENT_OK) {
         LOGE("fail: ???\n");
         goto LABEL_ERROR;
     }
+    memcpy(payment_hash, p_ctx->p_invoice->payment_hash, BTC_SZ_HASH256);
 
     //update payment data
     if (!ln_db_payment_info_save(PaymentId, &info)) {
         retval = LN_PAYMENT_ERROR;
         goto LABEL_ERROR;
     }
-    if (!ln_payment_route_save(PaymentId, &route)) {
+    if (num > 1) {
+        //split into parts
+        /*ignore*/ln_db_payment_shared_secrets_del(PaymentId);
+        /*ignore*/ln_db_payment_route_del(PaymentId);
+        retval = payment_parts(PaymentId, payment_hash, routes, num, BlockCount, p_ctx);
+        ctx_free(p_ctx);
+        p_ctx = NULL;
+        if (retval != LN_PAYMENT_OK) {
+            LOGE("fail: ???\n");
+            goto LABEL_ERROR;
+        }
+        return LN_PAYMENT_OK;
+    }
+    if (!ln_payment_route_save(PaymentId, &routes[0])) {
         LOGE("fail: ???\n");
         retval = LN_PAYMENT_ERROR;
         goto LABEL_ERROR;
     }
 
     //payment
-    retval = payment(PaymentId, payment_hash, &route);
+    //  return the context first (the failed channel is added by `ln_payment_exclude`)
+    ctx_checkin(p_ctx);
+    p_ctx = NULL;
+    retval = payment(PaymentId, payment_hash, &routes[0], 0);
     if (retval != LN_PAYMENT_OK) {
         LOGE("fail: ???\n");
         goto LABEL_ERROR;
     }
 
-    utl_buf_free(&buf_invoice);
     return LN_PAYMENT_OK;
 
 LABEL_ERROR:
+    if (p_ctx) {
+        //keep it until `ln_payment_end`
+        ctx_checkin(p_ctx);
+    }
     if (retval == LN_PAYMENT_ERROR_RETRY) {
         retval = ln_payment_retry(PaymentId, BlockCount);
     }
 
-    utl_buf_free(&buf_invoice);
     return retval;
 }
 
 
 bool ln_payment_end(uint64_t PaymentId, ln_payment_state_t State, const uint8_t *pPreimage)
 {
-    ln_payment_info_t info;
-    if (!ln_db_payment_info_load(&info, PaymentId)) {
-        LOGE("fail: ???\n");
-        return false;
+    ln_payment_part_t part;
+    if (ln_db_payment_part_load(&part, PaymentId)) {
+        return part_end(PaymentId, &part, State, pPreimage);
     }
-    if (info.auto_remove) {
-        /*ignore*/ln_db_payment_del_all(PaymentId);
-    } else {
-        /*ignore*/ln_db_payment_shared_secrets_del(PaymentId);
-        /*ignore*/ln_db_payment_route_del(PaymentId);
-        info.state = State;
-        if (State == LN_PAYMENT_STATE_SUCCEEDED) {
-            if (pPreimage) {
-                memcpy(info.preimage, pPreimage, LN_SZ_PREIMAGE);
-            } else {
-                LOGE("fail: ???\n");
-            }
-        }
-        if (!ln_db_payment_info_save(PaymentId, &info)) {
-            LOGE("fail: ???\n");
-            return false;
+    return payment_end(PaymentId, State, pPreimage);
+}
+
+
+void ln_payment_exclude(uint64_t PaymentId, uint64_t ShortChannelId)
+{
+    retry_ctx_t *p_ctx;
+
+    pthread_mutex_lock(&mMuxRetry);
+    LIST_FOREACH(p_ctx, &mRetryCtxHead, list) {
+        if (p_ctx->payment_id == PaymentId) {
+            ctx_exclude(p_ctx, ShortChannelId);
+            break;
         }
     }
-    return true;
+    pthread_mutex_unlock(&mMuxRetry);
 }
 
 
@@ -244,7 +358,8 @@ bool ln_payment_route_del(uint64_t PaymentId)
 
 static void payment_info_init(
     ln_payment_info_t *pInfo, const uint8_t *pPaymentHash, uint64_t AdditionalAmountMsat,
-    uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount, ln_payment_state_t state)
+    uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount, ln_payment_state_t state,
+    ln_routing_profile_t Profile, uint8_t MaxParts)
 {
     memset(pInfo, 0x00, sizeof(ln_payment_info_t));
     memcpy(pInfo->payment_hash, pPaymentHash, BTC_SZ_HASH256);
@@ -252,22 +367,29 @@ static void payment_info_init(
     pInfo->retry_count = 0;
     pInfo->max_retry_count = RetryCount;
     pInfo->auto_remove = AutoRemove;
+    pInfo->routing_profile = (uint8_t)Profile;
+    pInfo->max_parts = MaxParts;
     pInfo->block_count = BlockCount;
     pInfo->state = state;
 }
 
 
-static ln_payment_error_t route_invoice(
-    ln_payment_route_t *pRoute, uint8_t *pPaymentHash,
-    const char *pInvoice, uint32_t InvoiceLen,
-    uint64_t AdditionalAmountMsat, uint32_t BlockCount)
+/** retry context作成
+ *
+ * invoiceをdecodeして保持する。
+ *
+ * @param[out]  pError          NULLを返した場合のエラー
+ * @param[in]   AmountMsat      0: invoiceの額 + AdditionalAmountMsat / 0以外: partの額
+ * @return  context(#ctx_free()で解放する), NULL: エラー
+ */
+static retry_ctx_t *ctx_create(
+    ln_payment_error_t *pError, uint64_t PaymentId, const char *pInvoice, uint32_t InvoiceLen,
+    uint64_t AdditionalAmountMsat, uint64_t AmountMsat, ln_routing_profile_t Profile)
 {
-    ln_payment_error_t retval = LN_PAYMENT_ERROR;
-
     ln_invoice_t *p_invoice_data = NULL;
     if (!ln_invoice_decode_2(&p_invoice_data, pInvoice, InvoiceLen)) {
-        retval =  LN_PAYMENT_ERROR_INVOICE_INVALID;
-        goto LABEL_ERROR;
+        *pError = LN_PAYMENT_ERROR_INVOICE_INVALID;
+        return NULL;
     }
 
     switch (p_invoice_data->hrp_type) {
@@ -277,62 +399,280 @@ static ln_payment_error_t route_invoice(
         break;
     default:
         LOGE("fail: mismatch blockchain\n");
-        retval = LN_PAYMENT_ERROR_INVOICE_INVALID_TYPE;
-        goto LABEL_ERROR;
+        ln_invoice_decode_free(p_invoice_data);
+        *pError = LN_PAYMENT_ERROR_INVOICE_INVALID_TYPE;
+        return NULL;
     }
 
+    retry_ctx_t *p_ctx = (retry_ctx_t *)UTL_DBG_MALLOC(sizeof(retry_ctx_t));
+    if (!p_ctx) {
+        ln_invoice_decode_free(p_invoice_data);
+        *pError = LN_PAYMENT_ERROR;
+        return NULL;
+    }
+    p_ctx->payment_id = PaymentId;
+    p_ctx->p_invoice = p_invoice_data;
+    p_ctx->amount_msat = (AmountMsat != 0) ? AmountMsat : p_invoice_data->amount_msat + AdditionalAmountMsat;
+    p_ctx->profile = Profile;
+    p_ctx->cand_num = 0;
+    p_ctx->exclude_num = 0;
+    return p_ctx;
+}
+
+
+/** retry context複製(multi-path paymentのpart用)
+ *
+ * 経路候補は引き継がず、失敗したchannelは引き継ぐ。
+ */
+static retry_ctx_t *ctx_dup(const retry_ctx_t *pCtx, uint64_t PaymentId, uint64_t AmountMsat)
+{
+    size_t sz = sizeof(ln_invoice_t) + sizeof(ln_r_field_t) * pCtx->p_invoice->r_field_num;
+    retry_ctx_t *p_ctx = (retry_ctx_t *)UTL_DBG_MALLOC(sizeof(retry_ctx_t));
+    ln_invoice_t *p_invoice_data = (ln_invoice_t *)UTL_DBG_MALLOC(sz);
+    if (!p_ctx || !p_invoice_data) {
+        UTL_DBG_FREE(p_ctx);
+        UTL_DBG_FREE(p_invoice_data);
+        return NULL;
+    }
+    memcpy(p_invoice_data, pCtx->p_invoice, sz);
+    //descriptionは経路計算に使わない
+    p_invoice_data->description.type = LN_INVOICE_DESC_NONE;
+    utl_buf_init(&p_invoice_data->description.data);
+
+    memcpy(p_ctx, pCtx, sizeof(retry_ctx_t));
+    p_ctx->payment_id = PaymentId;
+    p_ctx->p_invoice = p_invoice_data;
+    p_ctx->amount_msat = AmountMsat;
+    p_ctx->cand_num = 0;
+    return p_ctx;
+}
+
+
+static void ctx_free(retry_ctx_t *pCtx)
+{
+    if (pCtx) {
+        ln_invoice_decode_free(pCtx->p_invoice);
+        UTL_DBG_FREE(pCtx);
+    }
+}
+
+
+/** retry contextを保持する
+ *
+ * 同じpayment_idのcontextがあれば置き換える。
+ * 保持数を超える場合は最も古いcontextを解放する(次のretryでDBから作り直す)。
+ */
+static void ctx_checkin(retry_ctx_t *pCtx)
+{
+    retry_ctx_t *p_old = NULL;
+    retry_ctx_t *p_last = NULL;
+    retry_ctx_t *p_ctx;
+
+    pthread_mutex_lock(&mMuxRetry);
+    LIST_FOREACH(p_ctx, &mRetryCtxHead, list) {
+        if (p_ctx->payment_id == pCtx->payment_id) {
+            p_old = p_ctx;
+        }
+        p_last = p_ctx;
+    }
+    if (!p_old && (mRetryCtxNum >= M_RETRY_CTX_MAX)) {
+        p_old = p_last;
+    }
+    if (p_old) {
+        LIST_REMOVE(p_old, list);
+        mRetryCtxNum--;
+    }
+    LIST_INSERT_HEAD(&mRetryCtxHead, pCtx, list);
+    mRetryCtxNum++;
+    pthread_mutex_unlock(&mMuxRetry);
+
+    ctx_free(p_old);
+}
+
+
+/** retry contextを取り出す
+ *
+ * 取り出したcontextは#ctx_checkin()で戻すか#ctx_free()で解放する。
+ *
+ * @return  context, NULL: 保持していない
+ */
+static retry_ctx_t *ctx_checkout(uint64_t PaymentId)
+{
+    retry_ctx_t *p_ctx;
+
+    pthread_mutex_lock(&mMuxRetry);
+    LIST_FOREACH(p_ctx, &mRetryCtxHead, list) {
+        if (p_ctx->payment_id == PaymentId) {
+            LIST_REMOVE(p_ctx, list);
+            mRetryCtxNum--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mMuxRetry);
+    return p_ctx;
+}
+
+
+/** 失敗したchannelを除外し、そのchannelを通る経路候補を捨てる
+ *
+ */
+static void ctx_exclude(retry_ctx_t *pCtx, uint64_t ShortChannelId)
+{
+    bool found = false;
+    for (uint8_t lp = 0; lp < pCtx->exclude_num; lp++) {
+        if (pCtx->exclude[lp] == ShortChannelId) {
+            found = true;
+            break;
+        }
+    }
+    if (!found && (pCtx->exclude_num < M_EXCLUDE_MAX)) {
+        pCtx->exclude[pCtx->exclude_num++] = ShortChannelId;
+    }
+
+    uint8_t num = 0;
+    for (uint8_t lp = 0; lp < pCtx->cand_num; lp++) {
+        bool use = true;
+        for (int hop = 0; hop < pCtx->cand[lp].num_hops - 1; hop++) {
+            if (pCtx->cand[lp].hop_datain[hop].short_channel_id == ShortChannelId) {
+                use = false;
+                break;
+            }
+        }
+        if (use) {
+            if (num != lp) {
+                memcpy(&pCtx->cand[num], &pCtx->cand[lp], sizeof(ln_routing_result_t));
+            }
+            num++;
+        }
+    }
+    pCtx->cand_num = num;
+}
+
+
+/** retry contextの支払いルート作成
+ *
+ * 経路候補が残っていれば、先頭から#ln_routing_reprice()で現在のgraphに合わせて使う。
+ * 候補がなければ除外channelを避けて候補を作り直し、1経路で支払えない場合は最大MaxPartsに分割する。
+ *
+ * @param[out]  pRoutes         MaxParts個の配列
+ * @param[out]  pNum            pRoutesの有効数
+ */
+static ln_payment_error_t route_ctx(
+    ln_payment_route_t *pRoutes, uint8_t *pNum, uint8_t MaxParts, retry_ctx_t *pCtx, uint32_t BlockCount)
+{
+    const ln_invoice_t *p_invoice_data = pCtx->p_invoice;
+    uint32_t cltv_expiry = BlockCount + p_invoice_data->min_final_cltv_expiry;
+
     if (p_invoice_data->timestamp + p_invoice_data->expiry < (uint64_t)utl_time_time()) {
         LOGE("fail: invoice outdated\n");
-        retval = LN_PAYMENT_ERROR_INVOICE_OUTDATE;
-        goto LABEL_ERROR;
+        return LN_PAYMENT_ERROR_INVOICE_OUTDATE;
     }
 
-    p_invoice_data->amount_msat += AdditionalAmountMsat;
+    //候補の再利用
+    while (pCtx->cand_num > 0) {
+        ln_routing_result_t result;
+        memcpy(&result, &pCtx->cand[0], sizeof(ln_routing_result_t));
+        pCtx->cand_num--;
+        memmove(&pCtx->cand[0], &pCtx->cand[1], sizeof(ln_routing_result_t) * pCtx->cand_num);
+        if (ln_routing_reprice(
+            &result, cltv_expiry, pCtx->amount_msat,
+            p_invoice_data->r_field_num, p_invoice_data->r_field) == LNROUTE_OK) {
+            LOGD("reuse candidate(rest=%d)\n", pCtx->cand_num);
+            pRoutes[0].num_hops = result.num_hops;
+            memcpy(pRoutes[0].hop_datain, result.hop_datain, sizeof(pRoutes[0].hop_datain));
+            *pNum = 1;
+            return LN_PAYMENT_OK;
+        }
+    }
 
-    ln_routing_result_t route_result;
-    lnerr_route_t err = ln_routing_calculate(
-        &route_result, ln_node_get_id(), p_invoice_data->pubkey,
-        BlockCount + p_invoice_data->min_final_cltv_expiry,
-        p_invoice_data->amount_msat, p_invoice_data->r_field_num,
-        p_invoice_data->r_field);
+    //送金可能額を自channelのhtlc_maximum_msatとして反映してから検索する
+    ln_db_channel_search_readonly_nokey(comp_func_payable, NULL);
+
+    uint8_t num = 0;
+    lnerr_route_t err = ln_routing_calculate_k(
+        pCtx->cand, &num, M_ROUTE_CANDIDATES, ln_node_get_id(), p_invoice_data->pubkey,
+        cltv_expiry, pCtx->amount_msat, p_invoice_data->r_field_num, p_invoice_data->r_field,
+        pCtx->exclude, pCtx->exclude_num, pCtx->profile);
+    if (err == LNROUTE_OK) {
+        pRoutes[0].num_hops = pCtx->cand[0].num_hops;
+        memcpy(pRoutes[0].hop_datain, pCtx->cand[0].hop_datain, sizeof(pRoutes[0].hop_datain));
+        *pNum = 1;
+        pCtx->cand_num = num - 1;
+        memmove(&pCtx->cand[0], &pCtx->cand[1], sizeof(ln_routing_result_t) * pCtx->cand_num);
+        return LN_PAYMENT_OK;
+    }
+    if ((err != LNROUTE_NOTFOUND) || (MaxParts <= 1)) {
+        LOGE("fail: routing\n");
+        return route_error(err);
+    }
+
+    //multi-path
+    assert(MaxParts <= LN_PAYMENT_PARTS_MAX);
+    ln_routing_result_t route_result[LN_PAYMENT_PARTS_MAX];
+    err = ln_routing_calculate_mpp(
+        route_result, pNum, MaxParts, ln_node_get_id(), p_invoice_data->pubkey,
+        cltv_expiry, pCtx->amount_msat, p_invoice_data->r_field_num,
+        p_invoice_data->r_field, pCtx->profile);
     if (err != LNROUTE_OK) {
         LOGE("fail: routing\n");
-        switch (err) {
-        case LNROUTE_NOSTART:
-            retval = LN_PAYMENT_ERROR_ROUTE_NO_START;
-            goto LABEL_ERROR;
-        case LNROUTE_NOGOAL:
-            retval = LN_PAYMENT_ERROR_ROUTE_NO_GOAL;
-            goto LABEL_ERROR;
-        case LNROUTE_NOTFOUND:
-            retval = LN_PAYMENT_ERROR_ROUTE_NO_ROUTE;
-            goto LABEL_ERROR;
-        case LNROUTE_TOOMANYHOP:
-            retval = LN_PAYMENT_ERROR_ROUTE_TOO_MANY_HOPS;
-            goto LABEL_ERROR;
-        default:
-            retval = LN_PAYMENT_ERROR_ROUTE;
-            goto LABEL_ERROR;
-        }
+        return route_error(err);
+    }
+    for (uint8_t lp = 0; lp < *pNum; lp++) {
+        pRoutes[lp].num_hops = route_result[lp].num_hops;
+        memcpy(pRoutes[lp].hop_datain, route_result[lp].hop_datain, sizeof(pRoutes[lp].hop_datain));
     }
+    return LN_PAYMENT_OK;
+}
 
-    memcpy(pPaymentHash, p_invoice_data->payment_hash, BTC_SZ_HASH256);
-    pRoute->num_hops = route_result.num_hops;
-    memcpy(pRoute->hop_datain, route_result.hop_datain, sizeof(pRoute->hop_datain));
 
-    ln_invoice_decode_free(p_invoice_data);
-    return LN_PAYMENT_OK;
+/** 最大分割数
+ *
+ * 分割するとpayeeに合計額を独自領域で伝えるため、指定がなければ分割しない。
+ */
+static uint8_t max_parts(uint8_t MaxParts)
+{
+    if (MaxParts == 0) {
+        return 1;
+    }
+    if (MaxParts > LN_PAYMENT_PARTS_MAX) {
+        return LN_PAYMENT_PARTS_MAX;
+    }
+    return MaxParts;
+}
 
-LABEL_ERROR:
-    ln_invoice_decode_free(p_invoice_data);
-    return retval;
+
+static ln_payment_error_t route_error(lnerr_route_t Err)
+{
+    switch (Err) {
+    case LNROUTE_NOSTART:
+        return LN_PAYMENT_ERROR_ROUTE_NO_START;
+    case LNROUTE_NOGOAL:
+        return LN_PAYMENT_ERROR_ROUTE_NO_GOAL;
+    case LNROUTE_NOTFOUND:
+        return LN_PAYMENT_ERROR_ROUTE_NO_ROUTE;
+    case LNROUTE_TOOMANYHOP:
+        return LN_PAYMENT_ERROR_ROUTE_TOO_MANY_HOPS;
+    default:
+        return LN_PAYMENT_ERROR_ROUTE;
+    }
+}
+
+
+static bool comp_func_payable(ln_channel_t *pChannel, void *p_db_param, void *p_param)
+{
+    (void)p_db_param; (void)p_param;
+
+    if ((pChannel->short_channel_id != 0) && (ln_status_get(pChannel) == LN_STATUS_NORMAL_OPE)) {
+        ln_routing_channel_payable(pChannel->short_channel_id, ln_local_payable_msat(pChannel));
+    }
+    return false;   //false=検索継続
 }
 
 
 static ln_payment_error_t payment_start(
-    uint64_t *pPaymentId, const ln_payment_route_t *pRoute, const uint8_t *pPaymentHash,
+    uint64_t *pPaymentId, const ln_payment_route_t *pRoutes, uint8_t Num, const uint8_t *pPaymentHash,
     uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount,
-    const char *pInvoice)
+    const char *pInvoice, ln_routing_profile_t Profile, uint8_t MaxParts, retry_ctx_t *pCtx)
 {
     ln_payment_error_t  retval = LN_PAYMENT_ERROR;
     ln_payment_info_t   info;
@@ -346,13 +686,13 @@ static ln_payment_error_t payment_start(
     LOGD("payment_id: %" PRIu64 "\n", *pPaymentId);
     payment_info_init(
         &info, pPaymentHash, AdditionalAmountMsat, RetryCount, AutoRemove,
-        BlockCount, LN_PAYMENT_STATE_PROCESSING);
+        BlockCount, LN_PAYMENT_STATE_PROCESSING, Profile, MaxParts);
     if (!ln_db_payment_info_save(*pPaymentId, &info)) {
         LOGE("fail: ???\n");
         retval = LN_PAYMENT_ERROR;
         goto LABEL_ERROR;
     }
-    if (!ln_payment_route_save(*pPaymentId, pRoute)) {
+    if ((Num == 1) && !ln_payment_route_save(*pPaymentId, &pRoutes[0])) {
         LOGE("fail: ???\n");
         retval = LN_PAYMENT_ERROR;
         goto LABEL_ERROR;
@@ -367,7 +707,19 @@ static ln_payment_error_t payment_start(
     }
 
     //payment
-    retval = payment(*pPaymentId, pPaymentHash, pRoute);
+    if (Num == 1) {
+        if (pCtx) {
+            //hand over the retry context (the failed channel is added by `ln_payment_exclude`)
+            pCtx->payment_id = *pPaymentId;
+            ctx_checkin(pCtx);
+            pCtx = NULL;
+        }
+        retval = payment(*pPaymentId, pPaymentHash, &pRoutes[0], 0);
+    } else {
+        retval = payment_parts(*pPaymentId, pPaymentHash, pRoutes, Num, BlockCount, pCtx);
+        ctx_free(pCtx);
+        pCtx = NULL;
+    }
     if (retval != LN_PAYMENT_OK) {
         LOGE("fail: ???\n");
         goto LABEL_ERROR;
@@ -376,20 +728,280 @@ static ln_payment_error_t payment_start(
     return LN_PAYMENT_OK;
 
 LABEL_ERROR:
+    ctx_free(pCtx);
     if (retval == LN_PAYMENT_ERROR_RETRY && !RetryCount) {
         retval = LN_PAYMENT_ERROR;
     }
     if (retval == LN_PAYMENT_ERROR_RETRY) {
         retval = ln_payment_retry(*pPaymentId, BlockCount);
     } else {
+        ctx_free(ctx_checkout(*pPaymentId));
         ln_db_payment_del_all(*pPaymentId);
     }
     return retval;
 }
 
 
+/** multi-path payment
+ *
+ * partごとにpayment_idを採番してrouteを保存し、update_add_htlcを並行して送信する。
+ * 送信できなかったpartは単独でretryし、それでも失敗したpartは終了させる。
+ * pCtxがあれば、partごとにinvoiceと除外channelを引き継いだretry contextを作る。
+ *
+ * @retval  LN_PAYMENT_OK   1つ以上のpartを送信した
+ */
+static ln_payment_error_t payment_parts(
+    uint64_t PaymentId, const uint8_t *pPaymentHash,
+    const ln_payment_route_t *pRoutes, uint8_t Num, uint32_t BlockCount, const retry_ctx_t *pCtx)
+{
+    uint64_t            part_ids[LN_PAYMENT_PARTS_MAX];
+    ln_payment_part_t   part;
+
+    //先に全partを登録する(送信中に他のpartが終了しても、親を終了させないため)
+    for (uint8_t lp = 0; lp < Num; lp++) {
+        if (!ln_db_payment_get_new_payment_id(&part_ids[lp])) {
+            LOGE("fail: ???\n");
+            return LN_PAYMENT_ERROR;
+        }
+        part.payment_id = PaymentId;
+        part.amount_msat = pRoutes[lp].hop_datain[pRoutes[lp].num_hops - 1].amt_to_forward;
+        part.state = LN_PAYMENT_STATE_PROCESSING;
+        if (!ln_db_payment_part_save(part_ids[lp], &part)) {
+            LOGE("fail: ???\n");
+            return LN_PAYMENT_ERROR;
+        }
+        if (!ln_payment_route_save(part_ids[lp], &pRoutes[lp])) {
+            LOGE("fail: ???\n");
+            return LN_PAYMENT_ERROR;
+        }
+        LOGD("payment_id: %" PRIu64 "(part of %" PRIu64 "), amount_msat=%" PRIu64 "\n",
+            part_ids[lp], PaymentId, part.amount_msat);
+        if (pCtx) {
+            retry_ctx_t *p_ctx = ctx_dup(pCtx, part_ids[lp], part.amount_msat);
+            if (p_ctx) {
+                ctx_checkin(p_ctx);
+            }
+        }
+    }
+
+    //payeeには全partの合計額を伝える
+    uint64_t total_msat = 0;
+    for (uint8_t lp = 0; lp < Num; lp++) {
+        total_msat += pRoutes[lp].hop_datain[pRoutes[lp].num_hops - 1].amt_to_forward;
+    }
+
+    bool sent = false;
+    for (uint8_t lp = 0; lp < Num; lp++) {
+        ln_payment_error_t retval = payment(part_ids[lp], pPaymentHash, &pRoutes[lp], total_msat);
+        if (retval == LN_PAYMENT_ERROR_RETRY) {
+            retval = ln_payment_retry(part_ids[lp], BlockCount);
+        }
+        if (retval == LN_PAYMENT_OK) {
+            sent = true;
+        } else {
+            LOGE("fail: part payment_id=%" PRIu64 "\n", part_ids[lp]);
+            /*ignore*/ln_payment_end(part_ids[lp], LN_PAYMENT_STATE_FAILED, NULL);
+        }
+    }
+    return (sent) ? LN_PAYMENT_OK : LN_PAYMENT_ERROR;
+}
+
+
+/** multi-path paymentのpartだけをretryする
+ *
+ * retry回数は親のpayment_infoで全partを合わせて数える。
+ * 他のpartでpreimageを受信済みであればretryしない。
+ */
+static ln_payment_error_t part_retry(uint64_t PartId, const ln_payment_part_t *pPart, uint32_t BlockCount)
+{
+    ln_payment_error_t  retval = LN_PAYMENT_ERROR;
+    ln_payment_route_t  route;
+    uint8_t             num = 0;
+    uint8_t             payment_hash[BTC_SZ_HASH256];
+    uint64_t            total_msat;
+    ln_payment_info_t   info;
+    const uint8_t       zero[LN_SZ_PREIMAGE] = {0};
+    retry_ctx_t         *p_ctx = NULL;
+
+    LOGD("payment_id: %" PRIu64 "(part of %" PRIu64 ")\n", PartId, pPart->payment_id);
+    if (!ln_db_payment_info_load(&info, pPart->payment_id)) {
+        LOGE("fail: ???\n");
+        retval = LN_PAYMENT_ERROR;
+        goto LABEL_ERROR;
+    }
+    if (memcmp(info.preimage, zero, LN_SZ_PREIMAGE) != 0) {
+        LOGD("already fulfilled by another part\n");
+        retval = LN_PAYMENT_ERROR;
+        goto LABEL_ERROR;
+    }
+    if (info.retry_count >= info.max_retry_count) {
+        LOGE("fail: ???\n");
+        retval = LN_PAYMENT_ERROR;
+        goto LABEL_ERROR;
+    }
+    p_ctx = ctx_checkout(PartId);
+    if (!p_ctx) {
+        utl_buf_t buf_invoice = UTL_BUF_INIT;
+        if (!ln_db_payment_invoice_load(&buf_invoice, pPart->payment_id)) {
+            LOGE("fail: ???\n");
+            retval = LN_PAYMENT_ERROR;
+            goto LABEL_ERROR;
+        }
+        p_ctx = ctx_create(
+            &retval, PartId, (const char *)buf_invoice.buf, buf_invoice.len,
+            info.additional_amount_msat, pPart->amount_msat,
+            (info.routing_profile < LN_ROUTING_PROFILE_MAX) ?
+                (ln_routing_profile_t)info.routing_profile : LN_ROUTING_PROFILE_FEE);
+        utl_buf_free(&buf_invoice);
+        if (!p_ctx) {
+            LOGE("fail: ???\n");
+            goto LABEL_ERROR;
+        }
+    }
+    info.retry_count++;
+
+    retval = route_ctx(&route, &num, 1, p_ctx, BlockCount);
+    if (retval != LN_PAYMENT_OK) {
+        LOGE("fail: ???\n");
+        goto LABEL_ERROR;
+    }
+    memcpy(payment_hash, p_ctx->p_invoice->payment_hash, BTC_SZ_HASH256);
+    total_msat = p_ctx->p_invoice->amount_msat + info.additional_amount_msat;
+
+    //update payment data
+    if (!ln_db_payment_info_save(pPart->payment_id, &info)) {
+        retval = LN_PAYMENT_ERROR;
+        goto LABEL_ERROR;
+    }
+    if (!ln_payment_route_save(PartId, &route)) {
+        LOGE("fail: ???\n");
+        retval = LN_PAYMENT_ERROR;
+        goto LABEL_ERROR;
+    }
+
+    //payment
+    ctx_checkin(p_ctx);
+    p_ctx = NULL;
+    retval = payment(PartId, payment_hash, &route, total_msat);
+    if (retval != LN_PAYMENT_OK) {
+        LOGE("fail: ???\n");
+        goto LABEL_ERROR;
+    }
+
+    return LN_PAYMENT_OK;
+
+LABEL_ERROR:
+    if (p_ctx) {
+        ctx_checkin(p_ctx);
+    }
+    if (retval == LN_PAYMENT_ERROR_RETRY) {
+        retval = part_retry(PartId, pPart, BlockCount);
+    }
+
+    return retval;
+}
+
+
+/** multi-path paymentのpart終了
+ *
+ * 全partが終了した時点で親を終了させる(1つでも成功していればSUCCEEDED)。
+ */
+static bool part_end(uint64_t PartId, ln_payment_part_t *pPart, ln_payment_state_t State, const uint8_t *pPreimage)
+{
+    LOGD("payment_id: %" PRIu64 "(part of %" PRIu64 ")\n", PartId, pPart->payment_id);
+    if (pPart->state != LN_PAYMENT_STATE_PROCESSING) {
+        LOGD("already ended\n");
+        return true;
+    }
+
+    ctx_free(ctx_checkout(PartId));
+    /*ignore*/ln_db_payment_shared_secrets_del(PartId);
+    /*ignore*/ln_db_payment_route_del(PartId);
+    pPart->state = State;
+    if (!ln_db_payment_part_save(PartId, pPart)) {
+        LOGE("fail: ???\n");
+        return false;
+    }
+
+    ln_payment_info_t info;
+    if (!ln_db_payment_info_load(&info, pPart->payment_id)) {
+        LOGE("fail: ???\n");
+        return false;
+    }
+    if ((State == LN_PAYMENT_STATE_SUCCEEDED) && pPreimage) {
+        //残りのpartをretryさせないため、先に保存する
+        memcpy(info.preimage, pPreimage, LN_SZ_PREIMAGE);
+        if (!ln_db_payment_info_save(pPart->payment_id, &info)) {
+            LOGE("fail: ???\n");
+            return false;
+        }
+    }
+
+    bool processing = false;
+    bool succeeded = false;
+    void *p_cur;
+    if (ln_db_payment_part_cur_open(&p_cur)) {
+        uint64_t            part_id;
+        ln_payment_part_t   part;
+        while (ln_db_payment_part_cur_get(p_cur, &part_id, &part)) {
+            if (part.payment_id != pPart->payment_id) {
+                continue;
+            }
+            if (part.state == LN_PAYMENT_STATE_PROCESSING) {
+                processing = true;
+            } else if (part.state == LN_PAYMENT_STATE_SUCCEEDED) {
+                succeeded = true;
+            }
+        }
+        ln_db_payment_part_cur_close(p_cur, false);
+    }
+    if (processing) {
+        return true;
+    }
+
+    LOGD("all parts ended: payment_id=%" PRIu64 "\n", pPart->payment_id);
+    return payment_end(pPart->payment_id,
+        (succeeded) ? LN_PAYMENT_STATE_SUCCEEDED : LN_PAYMENT_STATE_FAILED, info.preimage);
+}
+
+
+static bool payment_end(uint64_t PaymentId, ln_payment_state_t State, const uint8_t *pPreimage)
+{
+    ln_payment_info_t info;
+
+    ctx_free(ctx_checkout(PaymentId));
+    if (!ln_db_payment_info_load(&info, PaymentId)) {
+        LOGE("fail: ???\n");
+        return false;
+    }
+    if (info.auto_remove) {
+        /*ignore*/ln_db_payment_del_all(PaymentId);
+    } else {
+        /*ignore*/ln_db_payment_shared_secrets_del(PaymentId);
+        /*ignore*/ln_db_payment_route_del(PaymentId);
+        info.state = State;
+        if (State == LN_PAYMENT_STATE_SUCCEEDED) {
+            if (pPreimage) {
+                memcpy(info.preimage, pPreimage, LN_SZ_PREIMAGE);
+            } else {
+                LOGE("fail: ???\n");
+            }
+        }
+        if (!ln_db_payment_info_save(PaymentId, &info)) {
+            LOGE("fail: ???\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** update_add_htlc送信
+ *
+ * @param[in]   TotalMsat   multi-path paymentの合計額(0:multi-path paymentではない)
+ */
 static ln_payment_error_t payment(
-    uint64_t PaymentId, const uint8_t *pPaymentHash, const ln_payment_route_t *pRoute)
+    uint64_t PaymentId, const uint8_t *pPaymentHash, const ln_payment_route_t *pRoute, uint64_t TotalMsat)
 {
     uint8_t             session_key[BTC_SZ_PRIVKEY];
     uint8_t             onion[LN_SZ_ONION_ROUTE];
@@ -403,7 +1015,7 @@ static ln_payment_error_t payment(
 
     btc_rng_rand(session_key, sizeof(session_key));
     if (!ln_onion_create_packet(
-        onion, &secrets, &pRoute->hop_datain[1], pRoute->num_hops - 1,
+        onion, &secrets, &pRoute->hop_datain[1], pRoute->num_hops - 1, TotalMsat,
         session_key, pPaymentHash, BTC_SZ_HASH256)) {
         retval = LN_PAYMENT_ERROR;
         goto LABEL_ERROR;
@@ -419,7 +1031,8 @@ static ln_payment_error_t payment(
         pRoute->hop_datain[0].short_channel_id, 0, PaymentId,
         pRoute->hop_datain[0].amt_to_forward, pPaymentHash,
         pRoute->hop_datain[0].outgoing_cltv_value, onion)) {
-        ln_db_route_skip_save(pRoute->hop_datain[0].short_channel_id, false);
+        ln_db_route_skip_save(pRoute->hop_datain[0].short_channel_id, false, 0);
+        ln_payment_exclude(PaymentId, pRoute->hop_datain[0].short_channel_id);
         retval = LN_PAYMENT_ERROR_RETRY;
         goto LABEL_ERROR;
     }
@@ -29,6 +29,7 @@
 #include <stdbool.h>
 
 #include "ln.h"
+#include "ln_routing.h"
 
 //XXX: unit test
 
@@ -38,6 +39,7 @@
  ********************************************************************/
 
 #define LN_PAYMENT_ID_INVALID   UINT64_C(0xffffffffffffffff)
+#define LN_PAYMENT_PARTS_MAX    (4)         ///< multi-path paymentの最大分割数
 
 
 /********************************************************************
@@ -76,10 +78,24 @@ typedef struct {
     uint8_t             retry_count;
     uint8_t             max_retry_count;
     bool                auto_remove;
+    uint8_t             routing_profile;    //ln_routing_profile_t (retry uses the same profile)
     ln_payment_state_t  state;
+    uint8_t             max_parts;          //max number of multi-path parts (0,1: single path)
 } ln_payment_info_t;
 
 
+/** multi-path paymentのpart
+ *
+ * partは個別のpayment_idでshared_secretsとrouteを保存し、
+ * payment_info/invoiceは親のpayment_idで保持する。
+ */
+typedef struct {
+    uint64_t            payment_id;         //parent's payment_id
+    uint64_t            amount_msat;        //amount to the payee
+    ln_payment_state_t  state;
+} ln_payment_part_t;
+
+
 typedef struct {
     uint8_t             num_hops;
     ln_hop_datain_t     hop_datain[1 + LN_HOP_MAX];     //[0] is a payer's data
@@ -90,15 +106,31 @@ typedef struct {
  * prototypes
  ********************************************************************/
 
+/** invoiceで送金開始
+ *
+ * MaxPartsが2以上で1経路では送れない場合、multi-path paymentとして分割する。
+ * 各partの合計額はonionの独自領域(最終hopのpadding)で伝えるため、ptarmiganのpayee以外は受け付けない。
+ * 分割はpayeeがptarmiganであると分かっている場合だけ指定すること。
+ *
+ * @param[in]   MaxParts        最大分割数(0,1: 分割しない, 最大#LN_PAYMENT_PARTS_MAX)
+ */
 ln_payment_error_t ln_payment_start_invoice(
     uint64_t *pPaymentId, ln_payment_route_t *pRoute, const char *pInvoice,
-    uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount);
+    uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount,
+    ln_routing_profile_t Profile, uint8_t MaxParts);
 ln_payment_error_t ln_payment_start_test(
     uint64_t *pPaymentId, const uint8_t *pPaymentHash, const ln_payment_route_t *pRoute,
     uint32_t BlockCount);
 ln_payment_error_t ln_payment_retry(uint64_t PaymentId, uint32_t BlockCount);
 bool ln_payment_end(uint64_t PaymentId, ln_payment_state_t State, const uint8_t *pPreimage);
 
+/** 失敗したchannelをpaymentのretry対象から除外する
+ *
+ * 以降のretryでは、そのchannelを通る経路候補を使わず、検索からも除外する。
+ * lockはretry contextだけなので、DBのtransaction中に呼んでもよい。
+ */
+void ln_payment_exclude(uint64_t PaymentId, uint64_t ShortChannelId);
+
 bool ln_payment_route_save(uint64_t PaymentId, const ln_payment_route_t *pRoute);
 bool ln_payment_route_load(ln_payment_route_t *pRoute, uint64_t PaymentId);
 bool ln_payment_route_del(uint64_t PaymentId);
@@ -29,21 +29,30 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "ln_local.h"
 #include "ln_db.h"
 #include "ln_db_lmdb.h"
 #include "ln_invoice.h"
 #include "utl_dbg.h"
+#include "utl_time.h"
 
 #include <iostream>
 #include <fstream>
 #include <deque>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <array>
+#include <algorithm>
+#include <cmath>
 
 #include <boost/config.hpp>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/dijkstra_shortest_paths.hpp>
+#include <boost/graph/filtered_graph.hpp>
+#include <boost/graph/reverse_graph.hpp>
 #include <boost/graph/graph_traits.hpp>
 #include <boost/property_map/property_map.hpp>
 #ifdef M_GRAPHVIZ
@@ -59,8 +68,6 @@ using namespace boost;
  * macros
  **************************************************************************/
 
-#define M_CLTV_INIT                         ((uint16_t)0xffff)
-
 #define M_SHADOW_ROUTE                      (10)    // shadow route extension
                                                     //  攪乱するためにオフセットとして加算するCLTV
                                                     //  https://github.com/lightningnetwork/lightning-rfc/blob/master/07-routing-gossip.md#recommendations-for-routing
@@ -82,6 +89,8 @@ using namespace boost;
 #endif
 
 
+
+
 /**************************************************************************
  * typedefs
  **************************************************************************/
@@ -92,18 +101,18 @@ extern "C" {
 }
 
 struct Node {
-    //std::string name;
-    const uint8_t*  p_node;
+    uint8_t     node_id[BTC_SZ_PUBKEY];
 };
 
 struct Fee {
-    //std::string name;
     uint64_t    short_channel_id;
     uint32_t    fee_base_msat;
     uint32_t    fee_prop_millionths;
     uint16_t    cltv_expiry_delta;
+    uint64_t    htlc_minimum_msat;
+    uint64_t    htlc_maximum_msat;      ///< 0: 不明
     uint64_t    weight;
-    const uint8_t   *node_id;
+    bool        skip;                   ///< true: route skip DB(TEMP/PERM)により除外
 };
 
 typedef adjacency_list <
@@ -115,27 +124,136 @@ typedef adjacency_list <
         > graph_t;
 typedef graph_traits < graph_t >::vertex_descriptor vertex_descriptor;
 typedef graph_traits < graph_t >::vertex_iterator vertex_iterator;
+typedef graph_traits < graph_t >::edge_descriptor edge_descriptor;
+typedef graph_traits < graph_t >::out_edge_iterator out_edge_iterator;
 
-struct nodes_t {
-    uint64_t    short_channel_id;
-    struct {
-        uint8_t     node_id[BTC_SZ_PUBKEY];
-        uint16_t    cltv_expiry_delta;
-        uint64_t    htlc_minimum_msat;
-        uint32_t    fee_base_msat;
-        uint32_t    fee_prop_millionths;
-        ln_db_route_skip_t   route_skip;              //ln_db_route_skip_search()
-    } ninfo[2];         //[0]channel_updateのdir0, [1]channel_updateのdir1
+typedef std::array<uint8_t, BTC_SZ_PUBKEY> node_key_t;
+
+
+/** @struct chan_dir_t
+ *  @brief  channel_updateの片方向分
+ */
+struct chan_dir_t {
+    bool            valid;              ///< true: channel_update受信済み
+    bool            disabled;           ///< true: channel_flagsでdisable
+    uint32_t        timestamp;
+    uint16_t        cltv_expiry_delta;
+    uint64_t        htlc_minimum_msat;
+    uint64_t        htlc_maximum_msat;  ///< 0: option_channel_htlc_maxなし
+    uint32_t        fee_base_msat;
+    uint32_t        fee_prop_millionths;
+    bool            has_edge;           ///< true: edgeがgraphに存在する
+    edge_descriptor edge;
+};
+
+
+/** @struct chan_t
+ *  @brief  channel_announcement + channel_update
+ */
+struct chan_t {
+    bool            announced;          ///< true: channel_announcement受信済み
+    node_key_t      node_id[2];         ///< [0]node_id_1, [1]node_id_2
+    chan_dir_t      dir[2];             ///< [0]channel_updateのdir0, [1]channel_updateのdir1
+};
+
+
+/** @struct skip_t
+ *  @brief  route skip DBの1entry
+ */
+struct skip_t {
+    ln_db_route_skip_t  type;               ///< LN_DB_ROUTE_SKIP_TEMP/PERM/WORK
+    uint64_t            expiry;             ///< 有効期限(epoch time, 0:期限なし)
+};
+
+
+/** @struct fail_t
+ *  @brief  channelの失敗履歴
+ */
+struct fail_t {
+    double              count;              ///< last時点の失敗回数(半減期で減衰させる)
+    uint64_t            last;               ///< 最後に失敗した時刻(epoch time)
+};
+
+
+/** @struct routing_graph_t
+ *  @brief  常駐routing graph
+ */
+struct routing_graph_t {
+    graph_t                                 graph;
+    std::map<node_key_t, vertex_descriptor> nodes;      ///< node_id --> vertex
+    std::map<uint64_t, chan_t>              channels;   ///< short_channel_id --> channel
+    std::map<uint64_t, node_key_t>          local;      ///< 自channel(NORMAL_OPE): short_channel_id --> peer node_id
+    std::unordered_map<uint64_t, skip_t>    skip;       ///< route skip DB: short_channel_id --> skip
+    std::unordered_map<uint64_t, fail_t>    fails;      ///< 失敗履歴: short_channel_id --> fail
+    std::unordered_map<uint64_t, uint64_t>  payable;    ///< 自channelの送金可能額: short_channel_id --> msat
+};
+
+
+/** @struct routing_op_t
+ *  @brief  graph更新要求
+ */
+struct routing_op_t {
+    enum {
+        OP_CNLANNO,
+        OP_CNLUPD,
+        OP_CNLANNO_DEL,
+        OP_CNLUPD_DEL,
+        OP_LOCAL_ADD,
+        OP_LOCAL_DEL,
+        OP_SKIP_ADD,
+        OP_SKIP_WORK,
+        OP_SKIP_DROP,
+        OP_LOCAL_PAYABLE,
+    }               type;
+    uint64_t        short_channel_id;
+    node_key_t      node_id[2];
+    int             dir;
+    chan_dir_t      upd;
+    skip_t          skip;               ///< OP_SKIP_ADD
+    bool            flag;               ///< OP_SKIP_WORK: bWork, OP_SKIP_DROP: bTemp
+    uint64_t        msat;               ///< OP_LOCAL_PAYABLE
+};
+
+
+/** @struct edge_enabled_t
+ *  @brief  route skip DBで除外されていないedgeだけを通すfilter
+ */
+struct edge_enabled_t {
+    const graph_t   *p_graph;
+
+    edge_enabled_t() : p_graph(NULL) {}
+    edge_enabled_t(const graph_t *pGraph) : p_graph(pGraph) {}
+
+    bool operator()(const edge_descriptor &e) const {
+        return !(*p_graph)[e].skip;
+    }
 };
 
-struct nodes_result_t {
-    uint32_t    node_num;
-    nodes_t     *p_nodes;
+typedef filtered_graph<graph_t, edge_enabled_t> fgraph_t;
+
+
+/********************************************************************
+ * static variables
+ ********************************************************************/
+
+//mMuxRoutingはleaf lockとして扱い、保持したままDBのtransactionは開始しない
+//  (announcement DBのtransaction中に更新関数が呼ばれることがあるため)
+static pthread_mutex_t              mMuxRouting = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t              mMuxInit = PTHREAD_MUTEX_INITIALIZER;
+static routing_graph_t              *mpRouting;         ///< NULL: 未初期化
+static bool                         mBuilding;          ///< true: DBからgraph構築中
+static std::vector<routing_op_t>    mPendingOps;        ///< graph構築中に受けた更新
+
+//mMuxRoutingで保護する
+static ln_routing_cost_t            mCost[LN_ROUTING_PROFILE_MAX] = {
+    //cltv_ppb, fail_base_msat, fail_ppm, fail_halflife, use_capacity
+    { 0, 0, 0, 3600, false },               //LN_ROUTING_PROFILE_FEE
+    { 15, 100000, 1000, 3600, true },       //LN_ROUTING_PROFILE_BALANCED
+    { 15, 1000000, 10000, 6 * 3600, true }, //LN_ROUTING_PROFILE_RELIABLE
 };
 
-struct param_channel_t {
-    nodes_result_t  *p_result;
-    const uint8_t   *p_payer;
+static const char                   *M_PROFILE_NAME[LN_ROUTING_PROFILE_MAX] = {
+    "fee", "balanced", "reliable",
 };
 
 
@@ -169,76 +287,267 @@ static uint64_t edgefee(uint64_t amtmsat, uint32_t fee_base_msat, uint32_t fee_p
 }
 
 
-static void dumpit_chan(nodes_result_t *p_result, char type, const utl_buf_t *p_buf, ln_db_route_skip_t rskip)
+static node_key_t node_key(const uint8_t *pNodeId)
 {
-    nodes_t *p_nodes;
+    node_key_t key;
+    memcpy(key.data(), pNodeId, BTC_SZ_PUBKEY);
+    return key;
+}
 
-    /*
-     * channel_announcementとchannel_updateの存在パターンとして、以下がある。
-     *      a) channel_announcementのみ
-     *      b) channel_updateのみ
-     *      c) 両方
-     *
-     * 通常、channel_announcementとchannel_updateは両方存在するが、announcement前は相手からchannel_updateだけ送信することがある。
-     *      https://lists.linuxfoundation.org/pipermail/lightning-dev/2018-April/001220.html
-     * ただし、channelのnode_idはchannel_announcementが保持しているため、自分が持つshort_chennl_idと一致する場合のみroutingに加える。
-     */
 
-    switch (type) {
-    case LN_DB_CNLANNO_ANNO:
-        p_result->node_num++;
-        p_result->p_nodes = (nodes_t *)UTL_DBG_REALLOC(p_result->p_nodes, sizeof(nodes_t) * p_result->node_num);
-        p_nodes = &p_result->p_nodes[p_result->node_num - 1];
-
-        ln_get_ids_cnl_anno(
-                            &p_nodes->short_channel_id,
-                            p_nodes->ninfo[0].node_id,
-                            p_nodes->ninfo[1].node_id,
-                            p_buf->buf, p_buf->len);
-        p_nodes->ninfo[0].route_skip = rskip;
-        p_nodes->ninfo[1].route_skip = rskip;
-        p_nodes->ninfo[0].cltv_expiry_delta = M_CLTV_INIT;     //未設定判定用
-        p_nodes->ninfo[1].cltv_expiry_delta = M_CLTV_INIT;     //未設定判定用
-
-        M_DBGLOGV("[cnl]nodenum=%d\n", p_result->node_num);
-        M_DBGLOGV("[cnl]short_channel_id: %016" PRIx64 "\n", p_nodes->short_channel_id);
-        M_DBGLOGV("[cnl]node1= ");
-        M_DBGDUMPV(p_nodes->ninfo[0].node_id, BTC_SZ_PUBKEY);
-        M_DBGLOGV("[cnl]node2= ");
-        M_DBGDUMPV(p_nodes->ninfo[1].node_id, BTC_SZ_PUBKEY);
-        break;
-    case LN_DB_CNLANNO_UPD0:
-    case LN_DB_CNLANNO_UPD1:
-        if (p_result->node_num > 0) {
-            p_nodes = &p_result->p_nodes[p_result->node_num - 1];
+/********************************************************************
+ * graph operation
+ ********************************************************************/
 
-            ln_msg_channel_update_t upd;
-            int idx = type - LN_DB_CNLANNO_UPD0;
-            bool bret = ln_channel_update_get_params(&upd, p_buf->buf, p_buf->len);
-            if (bret && ((upd.channel_flags & LN_CNLUPD_CHFLAGS_DISABLE) == 0)) {
-                if (p_nodes->short_channel_id == upd.short_channel_id) {
-                    //disable状態ではない && channel_announcement.short_channel_idと一致
-                    p_nodes->ninfo[idx].cltv_expiry_delta = upd.cltv_expiry_delta;
-                    p_nodes->ninfo[idx].htlc_minimum_msat = upd.htlc_minimum_msat;
-                    p_nodes->ninfo[idx].fee_base_msat = upd.fee_base_msat;
-                    p_nodes->ninfo[idx].fee_prop_millionths = upd.fee_proportional_millionths;
-
-                    M_DBGLOGV("[upd]nodenum=%d\n", p_result->node_num);
-                    M_DBGLOGV("[upd]short_channel_id: %016" PRIx64 "\n", p_nodes->short_channel_id);
-                    M_DBGLOGV("[upd]node1= ");
-                    M_DBGDUMPV(p_nodes->ninfo[0].node_id, BTC_SZ_PUBKEY);
-                    M_DBGLOGV("[upd]node2= ");
-                    M_DBGDUMPV(p_nodes->ninfo[1].node_id, BTC_SZ_PUBKEY);
-                } else {
-                    M_DBGLOG("short_channel_id not match(%016" PRIx64 " !=%016" PRIx64 ")\n", p_nodes->short_channel_id, upd.short_channel_id);
-                }
-            } else {
-                //disableの場合は、対象外にされるよう初期値にしておく
-                M_DBGLOGV("[upd]short_channel_id: %016" PRIx64 "\n", p_nodes->short_channel_id);
-                M_DBGLOGV("[upd]skip[%c]\n", type);
-                p_nodes->ninfo[idx].cltv_expiry_delta = M_CLTV_INIT;
-            }
+static vertex_descriptor graph_vertex(routing_graph_t &Rt, const node_key_t &NodeId)
+{
+    std::map<node_key_t, vertex_descriptor>::iterator it = Rt.nodes.find(NodeId);
+    if (it != Rt.nodes.end()) {
+        return it->second;
+    }
+
+    //vertexは削除しない(listSなのでedge削除で他のdescriptorは無効にならない)
+    vertex_descriptor vtx = add_vertex(Rt.graph);
+    memcpy(Rt.graph[vtx].node_id, NodeId.data(), BTC_SZ_PUBKEY);
+    Rt.nodes[NodeId] = vtx;
+    return vtx;
+}
+
+
+static bool graph_find_vertex(const routing_graph_t &Rt, const uint8_t *pNodeId, vertex_descriptor *pVtx)
+{
+    std::map<node_key_t, vertex_descriptor>::const_iterator it = Rt.nodes.find(node_key(pNodeId));
+    if (it == Rt.nodes.end()) {
+        return false;
+    }
+    *pVtx = it->second;
+    return true;
+}
+
+
+static void graph_edge_remove(routing_graph_t &Rt, chan_dir_t &Dir)
+{
+    if (Dir.has_edge) {
+        remove_edge(Dir.edge, Rt.graph);
+        Dir.has_edge = false;
+    }
+}
+
+
+/** channel_announcementとchannel_update(disableではない)が揃っている方向だけedgeを張る
+ *
+ * 通常、channel_announcementとchannel_updateは両方存在するが、announcement前は相手からchannel_updateだけ送信することがある。
+ *      https://lists.linuxfoundation.org/pipermail/lightning-dev/2018-April/001220.html
+ * channelのnode_idはchannel_announcementが保持しているため、channel_announcementを受信するまでedgeにはしない。
+ */
+static void graph_edge_refresh(routing_graph_t &Rt, uint64_t ShortChannelId, chan_t &Chan, int Dir)
+{
+    chan_dir_t &dir = Chan.dir[Dir];
+
+    bool need = Chan.announced && dir.valid && !dir.disabled && (Chan.node_id[0] != Chan.node_id[1]);
+    if (!need) {
+        graph_edge_remove(Rt, dir);
+        return;
+    }
+
+    if (!dir.has_edge) {
+        vertex_descriptor from = graph_vertex(Rt, Chan.node_id[Dir]);
+        vertex_descriptor to = graph_vertex(Rt, Chan.node_id[Dir ^ 1]);
+        bool inserted = false;
+        boost::tie(dir.edge, inserted) = add_edge(from, to, Rt.graph);
+        dir.has_edge = true;
+    }
+
+    Fee &fee = Rt.graph[dir.edge];
+    fee.short_channel_id = ShortChannelId;
+    fee.fee_base_msat = dir.fee_base_msat;
+    fee.fee_prop_millionths = dir.fee_prop_millionths;
+    fee.cltv_expiry_delta = dir.cltv_expiry_delta;
+    fee.htlc_minimum_msat = dir.htlc_minimum_msat;
+    fee.htlc_maximum_msat = dir.htlc_maximum_msat;
+    fee.weight = 0;
+    fee.skip = false;
+}
+
+
+static void graph_cnlanno(routing_graph_t &Rt, uint64_t ShortChannelId, const node_key_t &NodeId1, const node_key_t &NodeId2)
+{
+    chan_t &chan = Rt.channels[ShortChannelId];
+    if (chan.announced) {
+        if ((chan.node_id[0] == NodeId1) && (chan.node_id[1] == NodeId2)) {
+            return;
+        }
+        //node_idが変わった場合は張り直す
+        graph_edge_remove(Rt, chan.dir[0]);
+        graph_edge_remove(Rt, chan.dir[1]);
+    }
+    chan.announced = true;
+    chan.node_id[0] = NodeId1;
+    chan.node_id[1] = NodeId2;
+    graph_edge_refresh(Rt, ShortChannelId, chan, 0);
+    graph_edge_refresh(Rt, ShortChannelId, chan, 1);
+
+    M_DBGLOGV("[cnl]short_channel_id: %016" PRIx64 "\n", ShortChannelId);
+}
+
+
+static void graph_cnlupd(routing_graph_t &Rt, uint64_t ShortChannelId, int Dir, const chan_dir_t &Upd)
+{
+    chan_t &chan = Rt.channels[ShortChannelId];
+    chan_dir_t &dir = chan.dir[Dir];
+    if (dir.valid && (Upd.timestamp < dir.timestamp)) {
+        M_DBGLOG("older channel_update: %016" PRIx64 ":%d\n", ShortChannelId, Dir);
+        return;
+    }
+    dir.valid = true;
+    dir.disabled = Upd.disabled;
+    dir.timestamp = Upd.timestamp;
+    dir.cltv_expiry_delta = Upd.cltv_expiry_delta;
+    dir.htlc_minimum_msat = Upd.htlc_minimum_msat;
+    dir.htlc_maximum_msat = Upd.htlc_maximum_msat;
+    dir.fee_base_msat = Upd.fee_base_msat;
+    dir.fee_prop_millionths = Upd.fee_prop_millionths;
+    graph_edge_refresh(Rt, ShortChannelId, chan, Dir);
+
+    M_DBGLOGV("[upd]short_channel_id: %016" PRIx64 ":%d\n", ShortChannelId, Dir);
+}
+
+
+static void graph_cnlanno_del(routing_graph_t &Rt, uint64_t ShortChannelId)
+{
+    std::map<uint64_t, chan_t>::iterator it = Rt.channels.find(ShortChannelId);
+    if (it == Rt.channels.end()) {
+        return;
+    }
+    graph_edge_remove(Rt, it->second.dir[0]);
+    graph_edge_remove(Rt, it->second.dir[1]);
+    Rt.channels.erase(it);
+}
+
+
+static void graph_cnlupd_del(routing_graph_t &Rt, uint64_t ShortChannelId, int Dir)
+{
+    std::map<uint64_t, chan_t>::iterator it = Rt.channels.find(ShortChannelId);
+    if (it == Rt.channels.end()) {
+        return;
+    }
+    graph_edge_remove(Rt, it->second.dir[Dir]);
+    it->second.dir[Dir].valid = false;
+}
+
+
+static bool skip_expired(const skip_t &Skip, uint64_t Now)
+{
+    return (Skip.expiry != 0) && (Skip.expiry <= Now);
+}
+
+
+/** 失敗履歴の減衰後の回数
+ */
+static double fail_count(const fail_t &Fail, uint64_t Now, uint32_t HalfLife)
+{
+    if ((Now <= Fail.last) || (HalfLife == 0)) {
+        return Fail.count;
+    }
+    return Fail.count * std::exp2(-(double)(Now - Fail.last) / (double)HalfLife);
+}
+
+
+/** 失敗履歴追加
+ *
+ * 減衰は最も長い半減期で計算しておき、参照時にprofileの半減期で減衰させる。
+ */
+static void graph_fail_add(routing_graph_t &Rt, uint64_t ShortChannelId)
+{
+    uint64_t now = (uint64_t)utl_time_time();
+    uint32_t halflife = 0;
+    for (int lp = 0; lp < LN_ROUTING_PROFILE_MAX; lp++) {
+        if (mCost[lp].fail_halflife > halflife) {
+            halflife = mCost[lp].fail_halflife;
+        }
+    }
+
+    std::unordered_map<uint64_t, fail_t>::iterator it = Rt.fails.find(ShortChannelId);
+    if (it == Rt.fails.end()) {
+        fail_t &fail = Rt.fails[ShortChannelId];
+        fail.count = 1.0;
+        fail.last = now;
+    } else {
+        it->second.count = fail_count(it->second, now, halflife) + 1.0;
+        it->second.last = now;
+    }
+}
+
+
+/** route skip TEMP <--> WORK(#ln_db_route_skip_work()と同じ変換)
+ */
+static void graph_skip_work(routing_graph_t &Rt, bool bWork)
+{
+    ln_db_route_skip_t from = (bWork) ? LN_DB_ROUTE_SKIP_TEMP : LN_DB_ROUTE_SKIP_WORK;
+    ln_db_route_skip_t to = (bWork) ? LN_DB_ROUTE_SKIP_WORK : LN_DB_ROUTE_SKIP_TEMP;
+    for (std::unordered_map<uint64_t, skip_t>::iterator it = Rt.skip.begin(); it != Rt.skip.end(); ++it) {
+        if (it->second.type == from) {
+            it->second.type = to;
+        }
+    }
+}
+
+
+/** route skip削除(#ln_db_route_skip_drop()と同じ条件)
+ */
+static void graph_skip_drop(routing_graph_t &Rt, bool bTemp)
+{
+    if (!bTemp) {
+        Rt.skip.clear();
+        return;
+    }
+
+    uint64_t now = (uint64_t)utl_time_time();
+    std::unordered_map<uint64_t, skip_t>::iterator it = Rt.skip.begin();
+    while (it != Rt.skip.end()) {
+        if ((it->second.type == LN_DB_ROUTE_SKIP_TEMP) || skip_expired(it->second, now)) {
+            it = Rt.skip.erase(it);
+        } else {
+            ++it;
         }
+    }
+}
+
+
+static void graph_apply(routing_graph_t &Rt, const routing_op_t &Op)
+{
+    switch (Op.type) {
+    case routing_op_t::OP_CNLANNO:
+        graph_cnlanno(Rt, Op.short_channel_id, Op.node_id[0], Op.node_id[1]);
+        break;
+    case routing_op_t::OP_CNLUPD:
+        graph_cnlupd(Rt, Op.short_channel_id, Op.dir, Op.upd);
+        break;
+    case routing_op_t::OP_CNLANNO_DEL:
+        graph_cnlanno_del(Rt, Op.short_channel_id);
+        break;
+    case routing_op_t::OP_CNLUPD_DEL:
+        graph_cnlupd_del(Rt, Op.short_channel_id, Op.dir);
+        break;
+    case routing_op_t::OP_LOCAL_ADD:
+        Rt.local[Op.short_channel_id] = Op.node_id[0];
+        break;
+    case routing_op_t::OP_LOCAL_DEL:
+        Rt.local.erase(Op.short_channel_id);
+        Rt.payable.erase(Op.short_channel_id);
+        break;
+    case routing_op_t::OP_SKIP_ADD:
+        Rt.skip[Op.short_channel_id] = Op.skip;
+        graph_fail_add(Rt, Op.short_channel_id);
+        break;
+    case routing_op_t::OP_SKIP_WORK:
+        graph_skip_work(Rt, Op.flag);
+        break;
+    case routing_op_t::OP_SKIP_DROP:
+        graph_skip_drop(Rt, Op.flag);
+        break;
+    case routing_op_t::OP_LOCAL_PAYABLE:
+        Rt.payable[Op.short_channel_id] = Op.msat;
         break;
     default:
         break;
@@ -246,49 +555,57 @@ static void dumpit_chan(nodes_result_t *p_result, char type, const utl_buf_t *p_
 }
 
 
+/** graph更新要求
+ *
+ * 未初期化であれば何もしない(#ln_routing_init()でDBから読み込む)。
+ * 構築中の場合は、構築完了後に適用するため保持しておく。
+ */
+static void routing_apply(const routing_op_t &Op)
+{
+    pthread_mutex_lock(&mMuxRouting);
+    if (mpRouting != NULL) {
+        graph_apply(*mpRouting, Op);
+    }
+    if (mBuilding) {
+        mPendingOps.push_back(Op);
+    }
+    pthread_mutex_unlock(&mMuxRouting);
+}
+
+
+static void set_upd_param(chan_dir_t *pDir, const ln_msg_channel_update_t *pUpd)
+{
+    pDir->valid = true;
+    pDir->disabled = (pUpd->channel_flags & LN_CNLUPD_CHFLAGS_DISABLE) != 0;
+    pDir->timestamp = pUpd->timestamp;
+    pDir->cltv_expiry_delta = pUpd->cltv_expiry_delta;
+    pDir->htlc_minimum_msat = pUpd->htlc_minimum_msat;
+    pDir->htlc_maximum_msat = pUpd->htlc_maximum_msat;
+    pDir->fee_base_msat = pUpd->fee_base_msat;
+    pDir->fee_prop_millionths = pUpd->fee_proportional_millionths;
+    pDir->has_edge = false;
+    pDir->edge = edge_descriptor();
+}
+
+
+/********************************************************************
+ * load DB
+ ********************************************************************/
+
 //開設済みで生きている送金元channelは、announcementの有無にかかわらず検索候補に追加する
 static bool comp_func_channel(ln_channel_t *pChannel, void *p_db_param, void *p_param)
 {
     (void)p_db_param;
 
-    param_channel_t *p_param_channel = (param_channel_t *)p_param;
+    routing_graph_t *p_rt = (routing_graph_t *)p_param;
 
     M_DBGLOG("channel: short_channel_id=%016" PRIx64 "\n", pChannel->short_channel_id);
     M_DBGLOG("      status=%d\n", ln_status_get(pChannel));
     if ((pChannel->short_channel_id != 0) && (ln_status_get(pChannel) == LN_STATUS_NORMAL_OPE)) {
         //チャネルは開設している && normal operation
-        ln_db_route_skip_t rskip = ln_db_route_skip_search(pChannel->short_channel_id);
-        if ((rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK)) {
-            LOGD("  skip DB: %016" PRIx64 "\n", pChannel->short_channel_id);
-            return false;
-        }
-
-        if (memcmp(pChannel->peer_node_id, p_param_channel->p_payer, BTC_SZ_PUBKEY) == 0) {
-            M_DBGLOG("skip\n");
-            return false;
-        }
-
-        p_param_channel->p_result->node_num++;
-        p_param_channel->p_result->p_nodes = (nodes_t *)UTL_DBG_REALLOC(p_param_channel->p_result->p_nodes, sizeof(nodes_t) * p_param_channel->p_result->node_num);
-        p_param_channel->p_result->p_nodes[p_param_channel->p_result->node_num - 1].short_channel_id = pChannel->short_channel_id;
+        p_rt->local[pChannel->short_channel_id] = node_key(pChannel->peer_node_id);
 
-        nodes_t *p_nodes_result = &p_param_channel->p_result->p_nodes[p_param_channel->p_result->node_num - 1];
-        const uint8_t *p1, *p2;
-        direction(&p1, &p2, p_param_channel->p_payer, pChannel->peer_node_id);
-        memcpy(p_nodes_result->ninfo[0].node_id, p1, BTC_SZ_PUBKEY);
-        memcpy(p_nodes_result->ninfo[1].node_id, p2, BTC_SZ_PUBKEY);
-        for (int lp = 0; lp < 2; lp++) {
-            p_nodes_result->ninfo[lp].cltv_expiry_delta = 0;
-            p_nodes_result->ninfo[lp].htlc_minimum_msat = 0;
-            p_nodes_result->ninfo[lp].fee_base_msat = 0;
-            p_nodes_result->ninfo[lp].fee_prop_millionths = 0;
-            p_nodes_result->ninfo[lp].route_skip = rskip;
-        }
-
-        M_DBGLOGV("[channel]nodenum=%d\n",  p_param_channel->p_result->node_num);
         LOGD("[channel]short_channel_id: %016" PRIx64 "\n", pChannel->short_channel_id);
-        M_DBGLOGV("[channel]p_payer= ");
-        M_DBGDUMPV(p_param_channel->p_payer, BTC_SZ_PUBKEY);
         LOGD("[channel]pChannel->peer_node_id= ");
         DUMPD(pChannel->peer_node_id, BTC_SZ_PUBKEY);
     } else {
@@ -299,338 +616,293 @@ static bool comp_func_channel(ln_channel_t *pChannel, void *p_db_param, void *p_
 }
 
 
-//r-filedの追加
-static void add_r_field(
-        nodes_result_t *p_result,
-        const uint8_t *pPayeeId,
-        const ln_r_field_t *pAddRoute,
-        int AddNum)
+static void load_cnlanno(routing_graph_t &Rt, uint64_t ShortChannelId, char Type, uint32_t TimeStamp, const utl_buf_t *pBuf)
 {
-    //AddNum追加で確保しておく(少ない場合は後で減らす)
-    p_result->p_nodes = (nodes_t *)UTL_DBG_REALLOC(p_result->p_nodes, sizeof(nodes_t) * (p_result->node_num + AddNum));
-
-    int count = 0;
-    for (uint8_t lp = 0; lp < AddNum; lp++) {
-        nodes_t *p_nodes = &p_result->p_nodes[p_result->node_num + count];
-
-        ln_db_route_skip_t rskip = ln_db_route_skip_search(pAddRoute[lp].short_channel_id);
-        if ((rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK)) {
-            M_DBGLOG("skip DB: %016" PRIx64 "\n", pAddRoute[lp].short_channel_id);
-            continue;
+    switch (Type) {
+    case LN_DB_CNLANNO_ANNO:
+        {
+            uint64_t short_channel_id;
+            node_key_t node_id[2];
+            if (ln_get_ids_cnl_anno(&short_channel_id, node_id[0].data(), node_id[1].data(), pBuf->buf, pBuf->len)) {
+                graph_cnlanno(Rt, ShortChannelId, node_id[0], node_id[1]);
+            }
         }
-
-        // add_node(0) --> payee(1)
-        p_nodes->short_channel_id = pAddRoute[lp].short_channel_id;
-        const uint8_t *p1, *p2;
-        int dir = direction(&p1, &p2, pAddRoute[lp].node_id, pPayeeId);
-        memcpy(p_nodes->ninfo[0].node_id, p1, BTC_SZ_PUBKEY);
-        memcpy(p_nodes->ninfo[1].node_id, p2, BTC_SZ_PUBKEY);
-        p_nodes->ninfo[0].cltv_expiry_delta = M_CLTV_INIT;     //未設定
-        p_nodes->ninfo[1].cltv_expiry_delta = M_CLTV_INIT;     //未設定
-        p_nodes->ninfo[dir].fee_base_msat = pAddRoute[lp].fee_base_msat;
-        p_nodes->ninfo[dir].fee_prop_millionths = pAddRoute[lp].fee_prop_millionths;
-        p_nodes->ninfo[dir].cltv_expiry_delta = pAddRoute[lp].cltv_expiry_delta;
-        p_nodes->ninfo[dir].htlc_minimum_msat = 0;
-        p_nodes->ninfo[dir].route_skip = rskip;
-        count++;
-
-        M_DBGLOG("  [add]short_channel_id=%016" PRIx64 "\n", p_nodes->short_channel_id);
-        M_DBGLOG("  [add]  [1]");
-        M_DBGDUMP(p_nodes->ninfo[0].node_id, BTC_SZ_PUBKEY);
-        M_DBGLOG("  [add]  [2]");
-        M_DBGDUMP(p_nodes->ninfo[1].node_id, BTC_SZ_PUBKEY);
+        break;
+    case LN_DB_CNLANNO_UPD0:
+    case LN_DB_CNLANNO_UPD1:
+        {
+            ln_msg_channel_update_t upd;
+            if (!ln_channel_update_get_params(&upd, pBuf->buf, pBuf->len)) {
+                break;
+            }
+            if (upd.short_channel_id != ShortChannelId) {
+                M_DBGLOG("short_channel_id not match(%016" PRIx64 " !=%016" PRIx64 ")\n", ShortChannelId, upd.short_channel_id);
+                break;
+            }
+            chan_dir_t dir;
+            set_upd_param(&dir, &upd);
+            dir.timestamp = TimeStamp;
+            graph_cnlupd(Rt, ShortChannelId, Type - LN_DB_CNLANNO_UPD0, dir);
+        }
+        break;
+    default:
+        break;
     }
+}
 
-    p_result->node_num += count;
-    if (count != AddNum) {
-        //減らす
-        p_result->p_nodes = (nodes_t *)UTL_DBG_REALLOC(p_result->p_nodes, sizeof(nodes_t) * p_result->node_num);
-    }
+
+static void load_skip(uint64_t ShortChannelId, ln_db_route_skip_t Type, uint64_t Expiry, void *pParam)
+{
+    routing_graph_t *p_rt = (routing_graph_t *)pParam;
+    skip_t &skip = p_rt->skip[ShortChannelId];
+    skip.type = Type;
+    skip.expiry = Expiry;
 }
 
 
-/**
- * @param[in]       pPayerId            送金元node_id
+/** DBからgraph構築
+ *
+ * @param[out]      pRt         構築したgraph
  */
-static bool load_db(nodes_result_t *p_result, const uint8_t *pPayerId)
+static bool load_db(routing_graph_t *pRt)
 {
-    int ret;
-
     //channel
-    param_channel_t param_channel;
-
-    param_channel.p_result = p_result;
-    param_channel.p_payer = pPayerId;
-    ln_db_channel_search_readonly_nokey(comp_func_channel, &param_channel);
+    ln_db_channel_search_readonly_nokey(comp_func_channel, pRt);
+    LOGD("added local route: %" PRIu32 "\n", (uint32_t)pRt->local.size());
 
-    LOGD("added local route: %" PRIu32 "\n", p_result->node_num);
-    uint32_t prev_node_num = p_result->node_num;
+    //route skip
+    if (!ln_db_route_skip_load(load_skip, pRt)) {
+        LOGE("fail: route skip DB\n");
+        return false;
+    }
+    LOGD("added route skip: %" PRIu32 "\n", (uint32_t)pRt->skip.size());
 
     //channel_anno
-    void *p_cur;
-
-    ret = ln_db_anno_transaction();
-    if (!ret) {
+    if (!ln_db_anno_transaction()) {
         //channel_announcementを1回も受信せずにDBが存在しない場合もあるため、trueで返す
         LOGE("fail: no announce DB\n");
         return true;
     }
 
-    ret = ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO);
-    if (ret) {
+    void *p_cur;
+    if (ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO)) {
         uint64_t short_channel_id;
         char type;
+        uint32_t timestamp;
         utl_buf_t buf_cnl = UTL_BUF_INIT;
 
-        while ((ret = ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl))) {
-            ln_db_route_skip_t rskip = ln_db_route_skip_search(short_channel_id);
-            if ((rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK)) {
-                LOGE("  skip DB: %016" PRIx64 "\n", short_channel_id);
-                utl_buf_free(&buf_cnl);
-                continue;
-            }
-
-            dumpit_chan(p_result, type, &buf_cnl, rskip);
+        while (ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, &timestamp, &buf_cnl)) {
+            load_cnlanno(*pRt, short_channel_id, type, timestamp, &buf_cnl);
             utl_buf_free(&buf_cnl);
         }
+        ln_db_anno_cur_close(p_cur);
     } else {
         LOGE("fail: open\n");
     }
 
     ln_db_anno_commit(true);
 
-    LOGD("added announce route: %" PRIu32 "\n", p_result->node_num - prev_node_num);
+    LOGD("added announce route: %" PRIu32 "\n", (uint32_t)pRt->channels.size());
 
     return true;
 }
 
 
-static graph_t::vertex_descriptor ver_add(graph_t& GRoute, const uint8_t *pNodeId)
-{
-    graph_t::vertex_descriptor vtx = static_cast<graph_t::vertex_descriptor>(-1);
-    bool ret = false;
-
-    std::pair<graph_t::vertex_iterator, graph_t::vertex_iterator> ver_its = vertices(GRoute);
-    for (graph_t::vertex_iterator st = ver_its.first, et = ver_its.second; st != et; st++) {
-        if (memcmp(GRoute[*st].p_node, pNodeId, BTC_SZ_PUBKEY) == 0) {
-            ret = true;
-            vtx = *st;
-            break;
-        }
-    }
-    if (!ret) {
-        vtx = add_vertex(GRoute);
-        GRoute[vtx].p_node = pNodeId;
-    }
+/********************************************************************
+ * route search
+ ********************************************************************/
 
-    return vtx;
+/** 検索用の一時edge追加
+ *
+ * 自channel(payer <--> peer)とinvoiceのr field(add_node --> payee)。
+ * 検索終了時に#remove_temp_edges()で削除する。
+ */
+static void add_temp_edge(
+        routing_graph_t &Rt, std::vector<edge_descriptor> &TempEdges,
+        vertex_descriptor From, vertex_descriptor To, uint64_t ShortChannelId,
+        uint32_t FeeBase, uint32_t FeeProp, uint16_t CltvExpiryDelta, uint64_t HtlcMaxMsat)
+{
+    edge_descriptor eg;
+    bool inserted = false;
+    boost::tie(eg, inserted) = add_edge(From, To, Rt.graph);
+    Fee &fee = Rt.graph[eg];
+    fee.short_channel_id = ShortChannelId;
+    fee.fee_base_msat = FeeBase;
+    fee.fee_prop_millionths = FeeProp;
+    fee.cltv_expiry_delta = CltvExpiryDelta;
+    fee.htlc_minimum_msat = 0;
+    fee.htlc_maximum_msat = HtlcMaxMsat;
+    fee.weight = 0;
+    fee.skip = false;
+    TempEdges.push_back(eg);
 }
 
 
-lnerr_route_t ln_routing_calculate(
-    ln_routing_result_t *pResult, const uint8_t *pPayerId, const uint8_t *pPayeeId,
-    uint32_t CltvExpiry, uint64_t AmountMsat, uint8_t AddNum, const ln_r_field_t *pAddRoute)
+static void add_temp_edges(
+        routing_graph_t &Rt, std::vector<edge_descriptor> &TempEdges,
+        const uint8_t *pPayerId, const uint8_t *pPayeeId,
+        uint8_t AddNum, const ln_r_field_t *pAddRoute)
 {
-    pResult->num_hops = 0;
+    node_key_t payer = node_key(pPayerId);
 
-    nodes_result_t rt_res;
-    rt_res.node_num = 0;
-    rt_res.p_nodes = NULL;
-
-    if ((pPayerId == NULL) || (pPayeeId == NULL)) {
-        LOGE("fail: null input\n");
-        return LNROUTE_PARAM;
+    for (std::map<uint64_t, node_key_t>::const_iterator it = Rt.local.begin(); it != Rt.local.end(); it++) {
+        if (it->second == payer) {
+            M_DBGLOG("skip\n");
+            continue;
+        }
+        //送金可能額が分かっていれば、payer --> peerのhtlc_maximum_msatとして扱う
+        uint64_t payable = 0;
+        std::unordered_map<uint64_t, uint64_t>::const_iterator it_pay = Rt.payable.find(it->first);
+        if (it_pay != Rt.payable.end()) {
+            if (it_pay->second == 0) {
+                M_DBGLOG("no payable: %016" PRIx64 "\n", it->first);
+                continue;
+            }
+            payable = it_pay->second;
+        }
+        vertex_descriptor node1 = graph_vertex(Rt, payer);
+        vertex_descriptor node2 = graph_vertex(Rt, it->second);
+        add_temp_edge(Rt, TempEdges, node1, node2, it->first, 0, 0, 0, payable);
+        add_temp_edge(Rt, TempEdges, node2, node1, it->first, 0, 0, 0, 0);
     }
 
-    bool ret = load_db(&rt_res, pPayerId);
-    if (!ret) {
-        LOGE("fail: load_db\n");
-        return LNROUTE_LOADDB;
+    //r-field
+    for (uint8_t lp = 0; lp < AddNum; lp++) {
+        // add_node(0) --> payee(1)
+        vertex_descriptor node1 = graph_vertex(Rt, node_key(pAddRoute[lp].node_id));
+        vertex_descriptor node2 = graph_vertex(Rt, node_key(pPayeeId));
+        if (node1 == node2) {
+            continue;
+        }
+        add_temp_edge(Rt, TempEdges, node1, node2, pAddRoute[lp].short_channel_id,
+                    pAddRoute[lp].fee_base_msat, pAddRoute[lp].fee_prop_millionths, pAddRoute[lp].cltv_expiry_delta, 0);
+
+        M_DBGLOG("  [add]short_channel_id=%016" PRIx64 "\n", pAddRoute[lp].short_channel_id);
     }
+}
 
-    if (AddNum > 0) {
-        add_r_field(&rt_res, pPayeeId, pAddRoute, AddNum);
+
+static void remove_temp_edges(routing_graph_t &Rt, std::vector<edge_descriptor> &TempEdges)
+{
+    for (size_t lp = 0; lp < TempEdges.size(); lp++) {
+        remove_edge(TempEdges[lp], Rt.graph);
     }
-    LOGD("node_num: %d\n", rt_res.node_num);
+    TempEdges.clear();
+}
 
-    LOGD("start node_id : ");
-    DUMPD(pPayerId, BTC_SZ_PUBKEY);
-    LOGD("end node_id   : ");
-    DUMPD(pPayeeId, BTC_SZ_PUBKEY);
 
-    graph_t groute;
-
-    bool set_start = false;
-    bool set_goal = false;
-    graph_t::vertex_descriptor pnt_start = static_cast<graph_t::vertex_descriptor>(-1);
-    graph_t::vertex_descriptor pnt_goal = static_cast<graph_t::vertex_descriptor>(-1);
-
-    //Edge追加
-    for (uint32_t lp = 0; lp < rt_res.node_num; lp++) {
-        M_DBGLOGV("  short_channel_id=%016" PRIx64 "\n", rt_res.p_nodes[lp].short_channel_id);
-        M_DBGLOGV("    [1]");
-        M_DBGDUMPV(rt_res.p_nodes[lp].ninfo[0].node_id, BTC_SZ_PUBKEY);
-        M_DBGLOGV("    [2]");
-        M_DBGDUMPV(rt_res.p_nodes[lp].ninfo[1].node_id, BTC_SZ_PUBKEY);
-
-        graph_t::vertex_descriptor node1 = ver_add(groute, rt_res.p_nodes[lp].ninfo[0].node_id);
-        graph_t::vertex_descriptor node2 = ver_add(groute, rt_res.p_nodes[lp].ninfo[1].node_id);
-
-        if (!set_start) {
-            if (memcmp(rt_res.p_nodes[lp].ninfo[0].node_id, pPayerId, BTC_SZ_PUBKEY) == 0) {
-                pnt_start = node1;
-                set_start = true;
-            } else if (memcmp(rt_res.p_nodes[lp].ninfo[1].node_id, pPayerId, BTC_SZ_PUBKEY) == 0) {
-                pnt_start = node2;
-                set_start = true;
-            }
+/** edgeのweight(#ln_routing_cost_t)
+ */
+static uint64_t edge_cost(const routing_graph_t &Rt, const Fee &Edge, uint64_t AmountMsat, const ln_routing_cost_t &Cost, uint64_t Now)
+{
+    double weight = (double)edgefee(AmountMsat, Edge.fee_base_msat, Edge.fee_prop_millionths);
+    weight += (double)AmountMsat * Edge.cltv_expiry_delta * Cost.cltv_ppb / 1000000000.0;
+
+    double penalty = (double)Cost.fail_base_msat + (double)AmountMsat * Cost.fail_ppm / 1000000.0;
+    if (penalty > 0.0) {
+        //成功確率: 残高が一様分布とした容量不足 x 失敗履歴
+        double success = 1.0;
+        if (Cost.use_capacity && (Edge.htlc_maximum_msat != 0)) {
+            success = 1.0 - (double)AmountMsat / (double)Edge.htlc_maximum_msat;
         }
-        if (!set_goal) {
-            if (memcmp(rt_res.p_nodes[lp].ninfo[0].node_id, pPayeeId, BTC_SZ_PUBKEY) == 0) {
-                pnt_goal = node1;
-                set_goal = true;
-            } else if (memcmp(rt_res.p_nodes[lp].ninfo[1].node_id, pPayeeId, BTC_SZ_PUBKEY) == 0) {
-                pnt_goal = node2;
-                set_goal = true;
+        if (!Rt.fails.empty()) {
+            std::unordered_map<uint64_t, fail_t>::const_iterator it = Rt.fails.find(Edge.short_channel_id);
+            if (it != Rt.fails.end()) {
+                success /= 1.0 + fail_count(it->second, Now, Cost.fail_halflife);
             }
         }
+        weight += (1.0 - success) * penalty;
+    }
+    return (uint64_t)weight;
+}
 
-        if (node1 != node2) {
-            if (rt_res.p_nodes[lp].ninfo[0].cltv_expiry_delta != M_CLTV_INIT) {
-                //channel_update1
-                bool inserted = false;
-                graph_t::edge_descriptor e1;
 
-                boost::tie(e1, inserted) = add_edge(node1, node2, groute);
-                groute[e1].short_channel_id = rt_res.p_nodes[lp].short_channel_id;
-                groute[e1].fee_base_msat = rt_res.p_nodes[lp].ninfo[0].fee_base_msat;
-                groute[e1].fee_prop_millionths = rt_res.p_nodes[lp].ninfo[0].fee_prop_millionths;
-                groute[e1].cltv_expiry_delta = rt_res.p_nodes[lp].ninfo[0].cltv_expiry_delta;
-                groute[e1].node_id = rt_res.p_nodes[lp].ninfo[0].node_id;
+/** 支払額からedgeのweightを決め、route skipの内容を反映する
+ *
+ * payeeの額でもhtlc_maximum_msatを超えるedgeは除外する。
+ * 各edgeの転送額は下流のfeeを加えた額でpayeeの額以上になるため、ここでは下限として判定するだけで、
+ * htlc_minimum_msatを含めた判定は見つかった経路に対して#path_usable()で行う。
+ * route skipは常駐graphに保持している内容を参照する(DBは参照しない)。
+ * 有効期限を過ぎたentryは無視して削除する(DBからは#ln_db_route_skip_drop()で削除される)。
+ * pUsedがある場合(multi-path)、他のpartで使用済みの額を加えてもhtlc_maximum_msatを超えないedgeだけを通す。
+ * htlc_maximum_msatが不明なedgeは1partだけで使用する。
+ */
+static void set_weight(routing_graph_t &Rt, uint64_t AmountMsat, const ln_routing_cost_t &Cost,
+            const std::unordered_map<uint64_t, uint64_t> *pUsed)
+{
+    uint64_t now = (uint64_t)utl_time_time();
 
-                groute[e1].weight = edgefee(AmountMsat, groute[e1].fee_base_msat, groute[e1].fee_prop_millionths);
-                if (rt_res.p_nodes[lp].ninfo[0].route_skip == LN_DB_ROUTE_SKIP_WORK) {
-                    M_DBGLOG("HEAVY1: %016" PRIx64 "\n", groute[e1].short_channel_id);
-                    groute[e1].weight *= 100;
-                }
-            }
-            if (rt_res.p_nodes[lp].ninfo[1].cltv_expiry_delta != M_CLTV_INIT) {
-                //channel_update2
-                bool inserted = false;
-                graph_t::edge_descriptor e2;
-
-                boost::tie(e2, inserted) = add_edge(node2, node1, groute);
-                groute[e2].short_channel_id = rt_res.p_nodes[lp].short_channel_id;
-                groute[e2].fee_base_msat = rt_res.p_nodes[lp].ninfo[1].fee_base_msat;
-                groute[e2].fee_prop_millionths = rt_res.p_nodes[lp].ninfo[1].fee_prop_millionths;
-                groute[e2].cltv_expiry_delta = rt_res.p_nodes[lp].ninfo[1].cltv_expiry_delta;
-                groute[e2].node_id = rt_res.p_nodes[lp].ninfo[1].node_id;
-
-                groute[e2].weight = edgefee(AmountMsat, groute[e2].fee_base_msat, groute[e2].fee_prop_millionths);
-                if (rt_res.p_nodes[lp].ninfo[1].route_skip == LN_DB_ROUTE_SKIP_WORK) {
-                    M_DBGLOG("HEAVY2: %016" PRIx64 "\n", groute[e2].short_channel_id);
-                    groute[e2].weight *= 100;
-                }
+    graph_traits < graph_t >::edge_iterator ei, ei_end;
+    for (boost::tie(ei, ei_end) = edges(Rt.graph); ei != ei_end; ++ei) {
+        Fee &fee = Rt.graph[*ei];
+
+        if ((fee.htlc_maximum_msat != 0) && (AmountMsat > fee.htlc_maximum_msat)) {
+            M_DBGLOG("HTLC limit: %016" PRIx64 "\n", fee.short_channel_id);
+            fee.skip = true;
+            continue;
+        }
+        if ((pUsed != NULL) && !pUsed->empty()) {
+            std::unordered_map<uint64_t, uint64_t>::const_iterator it_used = pUsed->find(fee.short_channel_id);
+            if ((it_used != pUsed->end()) &&
+                    ((fee.htlc_maximum_msat == 0) || (it_used->second + AmountMsat > fee.htlc_maximum_msat))) {
+                M_DBGLOG("used: %016" PRIx64 "\n", fee.short_channel_id);
+                fee.skip = true;
+                continue;
             }
         }
-    }
-
-    //LOGD("pnt_start=%d, pnt_goal=%d\n", (int)pnt_start, (int)pnt_goal);
-    if (!set_start) {
-        LOGE("fail: no start node\n");
-        return LNROUTE_NOSTART;
-    }
-    if (!set_goal) {
-        LOGE("fail: no goal node\n");
-        return LNROUTE_NOGOAL;
-    }
-
-    std::vector<vertex_descriptor> pt(num_vertices(groute));     //parent
-    std::vector<uint64_t> dist(num_vertices(groute));
-    dijkstra_shortest_paths(groute, pnt_start,
-                weight_map(boost::get(&Fee::weight, groute)).
-                    predecessor_map(&pt[0]).
-                        distance_map(&dist[0]));
-
-    if (pt[pnt_goal] == pnt_goal) {
-        LOGE("fail: cannot find route\n");
-        UTL_DBG_FREE(rt_res.p_nodes);
-        return LNROUTE_NOTFOUND;
-    }
-
-    //逆順に入っているので、並べ直す
-    //ついでに、min_final_cltv_expiryを足す
-    std::deque<vertex_descriptor> route;        //std::vectorにはpush_front()がない
-    std::deque<uint64_t> msat;
-    std::deque<uint32_t> cltv;
-
-    CltvExpiry += M_SHADOW_ROUTE;
-
-    route.push_front(pnt_goal);
-    msat.push_front(AmountMsat);
-    cltv.push_front(CltvExpiry);
-
-    for (vertex_descriptor vtx = pnt_goal; vtx != pnt_start; vtx = pt[vtx]) {
-        bool found;
-        graph_t::edge_descriptor eg;
-        boost::tie(eg, found) = edge(pt[vtx], vtx, groute);
-        if (!found) {
-            LOGE("fail: not foooooooooound\n");
-            return LNROUTE_NOTFOUND;
+        fee.skip = false;
+        fee.weight = edge_cost(Rt, fee, AmountMsat, Cost, now);
+        if (Rt.skip.empty()) {
+            continue;
         }
 
-        route.push_front(pt[vtx]);
-        msat.push_front(AmountMsat);
-        cltv.push_front(CltvExpiry);
-
-        AmountMsat = AmountMsat + edgefee(AmountMsat, groute[eg].fee_base_msat, groute[eg].fee_prop_millionths);
-        CltvExpiry += groute[eg].cltv_expiry_delta;
+        std::unordered_map<uint64_t, skip_t>::iterator it = Rt.skip.find(fee.short_channel_id);
+        if (it == Rt.skip.end()) {
+            continue;
+        }
+        if (skip_expired(it->second, now)) {
+            Rt.skip.erase(it);
+            continue;
+        }
+        if (it->second.type == LN_DB_ROUTE_SKIP_WORK) {
+            M_DBGLOG("HEAVY: %016" PRIx64 "\n", fee.short_channel_id);
+            fee.weight *= 100;
+        } else {
+            fee.skip = true;
+        }
     }
+}
 
-    if (route.size() > LN_HOP_MAX + 1) {
-        //先頭に自ノードが入るため+1
-        LOGE("fail: too many hops\n");
-        UTL_DBG_FREE(rt_res.p_nodes);
-        return LNROUTE_TOOMANYHOP;
-    }
 
-    //戻り値の作成
-    pResult->num_hops = (uint8_t)route.size();
-    const uint8_t *p_next;
+/** u --> vのedgeのうち、weightが最小のもの
+ */
+static bool min_edge(const routing_graph_t &Rt, vertex_descriptor u, vertex_descriptor v, edge_descriptor *pEdge)
+{
+    bool found = false;
+    uint64_t weight = 0;
 
-    for (int lp = 0; lp < pResult->num_hops - 1; lp++) {
-        const uint8_t *p_now  = groute[route[lp]].p_node;
-        p_next = groute[route[lp + 1]].p_node;
-
-        const uint8_t *p_node_id1;
-        const uint8_t *p_node_id2;
-        direction(&p_node_id1, &p_node_id2, p_now, p_next);
-        uint64_t sci = 0;
-        for (uint32_t lp3 = 0; lp3 < rt_res.node_num; lp3++) {
-            if ( (memcmp(p_node_id1, rt_res.p_nodes[lp3].ninfo[0].node_id, BTC_SZ_PUBKEY) == 0) &&
-                 (memcmp(p_node_id2, rt_res.p_nodes[lp3].ninfo[1].node_id, BTC_SZ_PUBKEY) == 0) ) {
-                sci = rt_res.p_nodes[lp3].short_channel_id;
-                break;
-            }
+    out_edge_iterator ei, ei_end;
+    for (boost::tie(ei, ei_end) = out_edges(u, Rt.graph); ei != ei_end; ++ei) {
+        if (target(*ei, Rt.graph) != v) {
+            continue;
         }
-        if (sci == 0) {
-            LOGE("not match!\n");
-            return LNROUTE_NOTFOUND;
+        const Fee &fee = Rt.graph[*ei];
+        if (fee.skip) {
+            continue;
+        }
+        if (!found || (fee.weight < weight)) {
+            found = true;
+            weight = fee.weight;
+            *pEdge = *ei;
         }
-
-        pResult->hop_datain[lp].short_channel_id = sci;
-        pResult->hop_datain[lp].amt_to_forward = msat[lp];
-        pResult->hop_datain[lp].outgoing_cltv_value = cltv[lp];
-        memcpy(pResult->hop_datain[lp].pubkey, p_now, BTC_SZ_PUBKEY);
     }
+    return found;
+}
 
-    //最後
-    pResult->hop_datain[pResult->num_hops - 1].short_channel_id = 0;
-    pResult->hop_datain[pResult->num_hops - 1].amt_to_forward = msat[pResult->num_hops - 1];
-    pResult->hop_datain[pResult->num_hops - 1].outgoing_cltv_value = cltv[pResult->num_hops - 1];
-    memcpy(pResult->hop_datain[pResult->num_hops - 1].pubkey, p_next, BTC_SZ_PUBKEY);
 
 #ifdef M_GRAPHVIZ
+static void dump_graphviz(const routing_graph_t &Rt)
+{
     // http://www.boost.org/doc/libs/1_55_0/libs/graph/example/dijkstra-example.cpp
     std::ofstream dot_file("gossip.dot");
 
@@ -643,15 +915,15 @@ lnerr_route_t ln_routing_calculate(
              ;
 
     graph_traits < graph_t >::edge_iterator ei, ei_end;
-    for (boost::tie(ei, ei_end) = edges(groute); ei != ei_end; ++ei) {
+    for (boost::tie(ei, ei_end) = edges(Rt.graph); ei != ei_end; ++ei) {
         graph_traits < graph_t >::edge_descriptor e = *ei;
-        graph_traits < graph_t >::vertex_descriptor u = source(e, groute);
-        graph_traits < graph_t >::vertex_descriptor v = target(e, groute);
+        graph_traits < graph_t >::vertex_descriptor u = source(e, Rt.graph);
+        graph_traits < graph_t >::vertex_descriptor v = target(e, Rt.graph);
         if (u != v) {
             char node1[128] = "\"";
             char node2[128] = "\"";
-            const uint8_t *p_node1 = groute[u].p_node;
-            const uint8_t *p_node2 = groute[v].p_node;
+            const uint8_t *p_node1 = Rt.graph[u].node_id;
+            const uint8_t *p_node2 = Rt.graph[v].node_id;
             for (int lp = 0; lp < 6; lp++) {
                 char s[3];
                 sprintf(s, "%02x", p_node1[lp]);
@@ -666,13 +938,7 @@ lnerr_route_t ln_routing_calculate(
                 dot_file << node1 << " -> " << node2
                         << "["
                         << "label=\""
-                        << std::hex << groute[e].short_channel_id << std::dec
-                        //<< ","
-                        //<< groute[e].fee_base_msat
-                        //<< ","
-                        //<< groute[e].fee_prop_millionths
-                        //<< ","
-                        //<< groute[e].cltv_expiry_delta
+                        << std::hex << Rt.graph[e].short_channel_id << std::dec
                         << "\""
                         << ", color=\"black\""
                         << ", fontcolor=\"#804040\""
@@ -682,14 +948,748 @@ lnerr_route_t ln_routing_calculate(
         }
     }
     dot_file << "}";
+}
+#endif  //M_GRAPHVIZ
+
+
+/** 経路上のedgeを使用できるか
+ *
+ * #set_weight()で除外するedgeと同じ条件(HTLC制限とroute skip)で判定する。
+ */
+static bool edge_usable(const routing_graph_t &Rt, const Fee &Edge, uint64_t AmountMsat, uint64_t Now)
+{
+    if ((AmountMsat < Edge.htlc_minimum_msat) ||
+            ((Edge.htlc_maximum_msat != 0) && (AmountMsat > Edge.htlc_maximum_msat))) {
+        return false;
+    }
+    std::unordered_map<uint64_t, skip_t>::const_iterator it = Rt.skip.find(Edge.short_channel_id);
+    if ((it != Rt.skip.end()) && !skip_expired(it->second, Now) && (it->second.type != LN_DB_ROUTE_SKIP_WORK)) {
+        return false;
+    }
+    return true;
+}
+
+
+/** 経路の各edgeを、そのedgeで転送する額で使用できるか
+ *
+ * payeeから逆順にfeeを加算し(#route_result()と同じ)、各edgeの額で#edge_usable()を判定する。
+ * pUsedがある場合(multi-path)、他のpartで使用済みの額を加えてhtlc_maximum_msatと比較する。
+ *
+ * @param[out]  pFail   使用できないedgeのPath上の位置
+ */
+static bool path_usable(const routing_graph_t &Rt, const std::vector<edge_descriptor> &Path,
+            uint64_t AmountMsat, const std::unordered_map<uint64_t, uint64_t> *pUsed, uint64_t Now, size_t *pFail)
+{
+    for (int lp = (int)Path.size() - 1; lp >= 0; lp--) {
+        const Fee &fee = Rt.graph[Path[lp]];
+        bool usable = edge_usable(Rt, fee, AmountMsat, Now);
+        if (usable && (pUsed != NULL) && !pUsed->empty()) {
+            std::unordered_map<uint64_t, uint64_t>::const_iterator it_used = pUsed->find(fee.short_channel_id);
+            if ((it_used != pUsed->end()) &&
+                    ((fee.htlc_maximum_msat == 0) || (it_used->second + AmountMsat > fee.htlc_maximum_msat))) {
+                usable = false;
+            }
+        }
+        if (!usable) {
+            M_DBGLOG("unusable: %016" PRIx64 ", amount=%" PRIu64 "\n", fee.short_channel_id, AmountMsat);
+            *pFail = (size_t)lp;
+            return false;
+        }
+        AmountMsat = AmountMsat + edgefee(AmountMsat, fee.fee_base_msat, fee.fee_prop_millionths);
+    }
+    return true;
+}
+
+
+/** edge列から戻り値を作成する
+ *
+ * payeeから逆順にfeeとcltv_expiry_deltaを加算する。
+ * ついでに、min_final_cltv_expiryにshadow routeを足す。
+ */
+static lnerr_route_t route_result(
+    const routing_graph_t &Rt, ln_routing_result_t *pResult,
+    const std::vector<edge_descriptor> &Path, uint32_t CltvExpiry, uint64_t AmountMsat)
+{
+    if (Path.size() > LN_HOP_MAX) {
+        //hop数は先頭の自ノードを含めてedge数+1
+        LOGE("fail: too many hops\n");
+        return LNROUTE_TOOMANYHOP;
+    }
+
+    CltvExpiry += M_SHADOW_ROUTE;
+
+    //最後
+    pResult->num_hops = (uint8_t)(Path.size() + 1);
+    ln_hop_datain_t *p_last = &pResult->hop_datain[pResult->num_hops - 1];
+    p_last->short_channel_id = 0;
+    p_last->amt_to_forward = AmountMsat;
+    p_last->outgoing_cltv_value = CltvExpiry;
+    memcpy(p_last->pubkey, Rt.graph[target(Path.back(), Rt.graph)].node_id, BTC_SZ_PUBKEY);
+
+    for (int lp = (int)Path.size() - 1; lp >= 0; lp--) {
+        const Fee &fee = Rt.graph[Path[lp]];
+        pResult->hop_datain[lp].short_channel_id = fee.short_channel_id;
+        pResult->hop_datain[lp].amt_to_forward = AmountMsat;
+        pResult->hop_datain[lp].outgoing_cltv_value = CltvExpiry;
+        memcpy(pResult->hop_datain[lp].pubkey, Rt.graph[source(Path[lp], Rt.graph)].node_id, BTC_SZ_PUBKEY);
+
+        AmountMsat = AmountMsat + edgefee(AmountMsat, fee.fee_base_msat, fee.fee_prop_millionths);
+        CltvExpiry += fee.cltv_expiry_delta;
+    }
+    return LNROUTE_OK;
+}
+
+
+static lnerr_route_t search_route(
+    routing_graph_t &Rt,
+    ln_routing_result_t *pResult, const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_cost_t &Cost,
+    const std::unordered_map<uint64_t, uint64_t> *pUsed)
+{
+    LOGD("start node_id : ");
+    DUMPD(pPayerId, BTC_SZ_PUBKEY);
+    LOGD("end node_id   : ");
+    DUMPD(pPayeeId, BTC_SZ_PUBKEY);
+
+    vertex_descriptor pnt_start;
+    vertex_descriptor pnt_goal;
+    if (!graph_find_vertex(Rt, pPayerId, &pnt_start)) {
+        LOGE("fail: no start node\n");
+        return LNROUTE_NOSTART;
+    }
+    if (!graph_find_vertex(Rt, pPayeeId, &pnt_goal)) {
+        LOGE("fail: no goal node\n");
+        return LNROUTE_NOGOAL;
+    }
+
+    set_weight(Rt, AmountMsat, Cost, pUsed);
+
+    //見つかった経路を各edgeの転送額で判定し、使用できないedgeがあれば除外して検索し直す
+    uint64_t now = (uint64_t)utl_time_time();
+    std::vector<edge_descriptor> path;
+    for (;;) {
+        fgraph_t fgroute(Rt.graph, edge_enabled_t(&Rt.graph));
+        std::vector<vertex_descriptor> pt(num_vertices(Rt.graph));     //parent
+        std::vector<uint64_t> dist(num_vertices(Rt.graph));
+        dijkstra_shortest_paths(fgroute, pnt_start,
+                    weight_map(boost::get(&Fee::weight, Rt.graph)).
+                        predecessor_map(&pt[0]).
+                            distance_map(&dist[0]));
+
+        if (pt[pnt_goal] == pnt_goal) {
+            LOGE("fail: cannot find route\n");
+            return LNROUTE_NOTFOUND;
+        }
+
+        //逆順に入っているので、並べ直す
+        path.clear();
+        for (vertex_descriptor vtx = pnt_goal; vtx != pnt_start; vtx = pt[vtx]) {
+            edge_descriptor eg;
+            if (!min_edge(Rt, pt[vtx], vtx, &eg)) {
+                LOGE("fail: not foooooooooound\n");
+                return LNROUTE_NOTFOUND;
+            }
+            path.push_back(eg);
+        }
+        std::reverse(path.begin(), path.end());
+
+        size_t fail;
+        if (path_usable(Rt, path, AmountMsat, pUsed, now, &fail)) {
+            break;
+        }
+        Rt.graph[path[fail]].skip = true;
+    }
+
+    lnerr_route_t ret = route_result(Rt, pResult, path, CltvExpiry, AmountMsat);
+    if (ret != LNROUTE_OK) {
+        return ret;
+    }
+
+#ifdef M_GRAPHVIZ
+    dump_graphviz(Rt);
 #endif  //M_GRAPHVIZ
 
-    UTL_DBG_FREE(rt_res.p_nodes);
+    return LNROUTE_OK;
+}
+
+
+/** 経路候補(#search_candidates())
+ */
+struct candidate_t {
+    uint64_t                        cost;       ///< 最短経路からのweightの増分
+    size_t                          index;      ///< 最短経路から外れるedgeの位置
+    edge_descriptor                 edge;       ///< 最短経路から外れるedge
+};
+
+
+static bool cmp_candidate(const candidate_t &Cand1, const candidate_t &Cand2)
+{
+    return Cand1.cost < Cand2.cost;
+}
+
+
+/** 最短経路と、1か所だけ外れる経路を検索する
+ *
+ * payeeを起点に逆向きのgraphでDijkstra法を1回だけ行い、全nodeからpayeeまでの最短経路(shortest path tree)を得る。
+ * 最短経路上のnode uから別のedge(u --> v)に外れてvからはtreeをたどる経路は、
+ * weight(u --> v) + dist(v) - dist(u)だけ最短経路より重い。
+ * この増分の小さい順に、loopしない経路をK個まで返す。
+ */
+static lnerr_route_t search_candidates(
+    routing_graph_t &Rt, ln_routing_result_t *pResults, uint8_t *pNum, uint8_t K,
+    const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat, const ln_routing_cost_t &Cost,
+    const std::vector<edge_descriptor> &TempEdges, const uint64_t *pExclude, uint8_t ExcludeNum)
+{
+    vertex_descriptor pnt_start;
+    vertex_descriptor pnt_goal;
+    if (!graph_find_vertex(Rt, pPayerId, &pnt_start)) {
+        LOGE("fail: no start node\n");
+        return LNROUTE_NOSTART;
+    }
+    if (!graph_find_vertex(Rt, pPayeeId, &pnt_goal)) {
+        LOGE("fail: no goal node\n");
+        return LNROUTE_NOGOAL;
+    }
+
+    set_weight(Rt, AmountMsat, Cost, NULL);
+    for (uint8_t lp = 0; lp < ExcludeNum; lp++) {
+        std::map<uint64_t, chan_t>::iterator it = Rt.channels.find(pExclude[lp]);
+        if (it != Rt.channels.end()) {
+            for (int dir = 0; dir < 2; dir++) {
+                if (it->second.dir[dir].has_edge) {
+                    Rt.graph[it->second.dir[dir].edge].skip = true;
+                }
+            }
+        }
+        for (size_t lp2 = 0; lp2 < TempEdges.size(); lp2++) {
+            if (Rt.graph[TempEdges[lp2]].short_channel_id == pExclude[lp]) {
+                Rt.graph[TempEdges[lp2]].skip = true;
+            }
+        }
+    }
+
+    //payerに戻るedgeは使わない
+    //  fee 0の自channel(peer --> payer)を通ると、peerからのtreeがpayerを経由してしまい候補がloopになる
+    graph_traits < graph_t >::in_edge_iterator ie, ie_end;
+    for (boost::tie(ie, ie_end) = in_edges(pnt_start, Rt.graph); ie != ie_end; ++ie) {
+        Rt.graph[*ie].skip = true;
+    }
+
+    //最短経路
+    //  見つかった経路を各edgeの転送額で判定し、使用できないedgeがあれば除外して検索し直す
+    uint64_t now = (uint64_t)utl_time_time();
+    std::vector<vertex_descriptor> nt(num_vertices(Rt.graph));     //next(payee方向)
+    std::vector<uint64_t> dist(num_vertices(Rt.graph));
+    std::vector<edge_descriptor> path;
+    std::vector<vertex_descriptor> vtxs;
+    for (;;) {
+        fgraph_t fgroute(Rt.graph, edge_enabled_t(&Rt.graph));
+        reverse_graph<fgraph_t> rgroute(fgroute);
+        dijkstra_shortest_paths(rgroute, pnt_goal,
+                    weight_map(boost::get(&Fee::weight, rgroute)).
+                        predecessor_map(&nt[0]).
+                            distance_map(&dist[0]));
+
+        if (nt[pnt_start] == pnt_start) {
+            LOGE("fail: cannot find route\n");
+            return LNROUTE_NOTFOUND;
+        }
+
+        path.clear();
+        vtxs.clear();
+        for (vertex_descriptor vtx = pnt_start; vtx != pnt_goal; vtx = nt[vtx]) {
+            edge_descriptor eg;
+            if (!min_edge(Rt, vtx, nt[vtx], &eg)) {
+                LOGE("fail: not foooooooooound\n");
+                return LNROUTE_NOTFOUND;
+            }
+            vtxs.push_back(vtx);
+            path.push_back(eg);
+        }
+
+        size_t fail;
+        if (path_usable(Rt, path, AmountMsat, NULL, now, &fail)) {
+            break;
+        }
+        Rt.graph[path[fail]].skip = true;
+    }
+    lnerr_route_t ret = route_result(Rt, &pResults[0], path, CltvExpiry, AmountMsat);
+    if (ret != LNROUTE_OK) {
+        return ret;
+    }
+    *pNum = 1;
+
+    //最短経路から1か所だけ外れる経路
+    std::vector<candidate_t> cands;
+    for (size_t lp = 0; (K > 1) && (lp < vtxs.size()); lp++) {
+        out_edge_iterator ei, ei_end;
+        for (boost::tie(ei, ei_end) = out_edges(vtxs[lp], Rt.graph); ei != ei_end; ++ei) {
+            const Fee &fee = Rt.graph[*ei];
+            vertex_descriptor v = target(*ei, Rt.graph);
+            if (fee.skip || (*ei == path[lp])) {
+                continue;
+            }
+            if ((v != pnt_goal) && (nt[v] == v)) {
+                //payeeに届かない
+                continue;
+            }
+            candidate_t cand;
+            cand.cost = fee.weight + dist[v] - dist[vtxs[lp]];
+            cand.index = lp;
+            cand.edge = *ei;
+            cands.push_back(cand);
+        }
+    }
+    std::sort(cands.begin(), cands.end(), cmp_candidate);
+
+    std::vector<edge_descriptor> alt;
+    for (size_t lp = 0; (lp < cands.size()) && (*pNum < K); lp++) {
+        alt.assign(path.begin(), path.begin() + cands[lp].index);
+        alt.push_back(cands[lp].edge);
+
+        bool loop = false;
+        for (vertex_descriptor vtx = target(cands[lp].edge, Rt.graph); vtx != pnt_goal; vtx = nt[vtx]) {
+            if ((alt.size() > LN_HOP_MAX) ||
+                    (std::find(vtxs.begin(), vtxs.begin() + cands[lp].index + 1, vtx) != vtxs.begin() + cands[lp].index + 1)) {
+                loop = true;
+                break;
+            }
+            edge_descriptor eg;
+            if (!min_edge(Rt, vtx, nt[vtx], &eg)) {
+                loop = true;
+                break;
+            }
+            alt.push_back(eg);
+        }
+        size_t fail;
+        if (loop || !path_usable(Rt, alt, AmountMsat, NULL, now, &fail)) {
+            continue;
+        }
+        if (route_result(Rt, &pResults[*pNum], alt, CltvExpiry, AmountMsat) == LNROUTE_OK) {
+            (*pNum)++;
+        }
+    }
+    LOGD("candidates: %d\n", *pNum);
 
     return LNROUTE_OK;
 }
 
 
+/** 常駐graphを構築してからmMuxRoutingをlockする
+ *
+ * @retval  false   構築できない(lockしていない)
+ */
+static bool routing_lock(void)
+{
+    pthread_mutex_lock(&mMuxRouting);
+    bool init = (mpRouting != NULL);
+    pthread_mutex_unlock(&mMuxRouting);
+    if (!init) {
+        //常駐graphを使わないアプリ(routing等)は初回に構築する
+        if (!ln_routing_init()) {
+            LOGE("fail: load_db\n");
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&mMuxRouting);
+    if (mpRouting == NULL) {
+        pthread_mutex_unlock(&mMuxRouting);
+        LOGE("fail: not initialized\n");
+        return false;
+    }
+    return true;
+}
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool ln_routing_init(void)
+{
+    pthread_mutex_lock(&mMuxInit);
+
+    pthread_mutex_lock(&mMuxRouting);
+    mBuilding = true;
+    mPendingOps.clear();
+    pthread_mutex_unlock(&mMuxRouting);
+
+    //DB読込みはmMuxRoutingの外で行う
+    routing_graph_t *p_rt = new routing_graph_t;
+    bool ret = load_db(p_rt);
+
+    pthread_mutex_lock(&mMuxRouting);
+    if (ret) {
+        //構築中に受けた更新を反映してから切り替える
+        for (size_t lp = 0; lp < mPendingOps.size(); lp++) {
+            graph_apply(*p_rt, mPendingOps[lp]);
+        }
+        std::swap(mpRouting, p_rt);
+    }
+    mPendingOps.clear();
+    mBuilding = false;
+    if (mpRouting != NULL) {
+        LOGD("routing graph: vertices=%" PRIu32 ", edges=%" PRIu32 "\n",
+                    (uint32_t)num_vertices(mpRouting->graph), (uint32_t)num_edges(mpRouting->graph));
+    }
+    pthread_mutex_unlock(&mMuxRouting);
+
+    delete p_rt;
+
+    pthread_mutex_unlock(&mMuxInit);
+
+    if (!ret) {
+        LOGE("fail: load_db\n");
+    }
+    return ret;
+}
+
+
+void ln_routing_term(void)
+{
+    pthread_mutex_lock(&mMuxRouting);
+    delete mpRouting;
+    mpRouting = NULL;
+    pthread_mutex_unlock(&mMuxRouting);
+}
+
+
+void ln_routing_cnlanno_update(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2)
+{
+    routing_op_t op;
+    const uint8_t *p1, *p2;
+
+    //node_id_1 < node_id_2
+    direction(&p1, &p2, pNodeId1, pNodeId2);
+    op.type = routing_op_t::OP_CNLANNO;
+    op.short_channel_id = ShortChannelId;
+    op.node_id[0] = node_key(p1);
+    op.node_id[1] = node_key(p2);
+    routing_apply(op);
+}
+
+
+void ln_routing_cnlupd_update(const ln_msg_channel_update_t *pUpd)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_CNLUPD;
+    op.short_channel_id = pUpd->short_channel_id;
+    op.dir = pUpd->channel_flags & LN_CNLUPD_CHFLAGS_DIRECTION;
+    set_upd_param(&op.upd, pUpd);
+    routing_apply(op);
+}
+
+
+void ln_routing_cnlanno_del(uint64_t ShortChannelId)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_CNLANNO_DEL;
+    op.short_channel_id = ShortChannelId;
+    routing_apply(op);
+}
+
+
+void ln_routing_cnlupd_del(uint64_t ShortChannelId, int Dir)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_CNLUPD_DEL;
+    op.short_channel_id = ShortChannelId;
+    op.dir = Dir & LN_CNLUPD_CHFLAGS_DIRECTION;
+    routing_apply(op);
+}
+
+
+void ln_routing_channel_add(uint64_t ShortChannelId, const uint8_t *pPeerNodeId)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_LOCAL_ADD;
+    op.short_channel_id = ShortChannelId;
+    op.node_id[0] = node_key(pPeerNodeId);
+    routing_apply(op);
+}
+
+
+void ln_routing_channel_del(uint64_t ShortChannelId)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_LOCAL_DEL;
+    op.short_channel_id = ShortChannelId;
+    routing_apply(op);
+}
+
+
+void ln_routing_channel_payable(uint64_t ShortChannelId, uint64_t PayableMsat)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_LOCAL_PAYABLE;
+    op.short_channel_id = ShortChannelId;
+    op.msat = PayableMsat;
+    routing_apply(op);
+}
+
+
+void ln_routing_skip_add(uint64_t ShortChannelId, bool bTemp, uint64_t Expiry)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_SKIP_ADD;
+    op.short_channel_id = ShortChannelId;
+    op.skip.type = (bTemp) ? LN_DB_ROUTE_SKIP_TEMP : LN_DB_ROUTE_SKIP_PERM;
+    op.skip.expiry = Expiry;
+    routing_apply(op);
+}
+
+
+void ln_routing_skip_work(bool bWork)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_SKIP_WORK;
+    op.flag = bWork;
+    routing_apply(op);
+}
+
+
+void ln_routing_skip_drop(bool bTemp)
+{
+    routing_op_t op;
+
+    op.type = routing_op_t::OP_SKIP_DROP;
+    op.flag = bTemp;
+    routing_apply(op);
+}
+
+
+bool ln_routing_profile_set(ln_routing_profile_t Profile, const ln_routing_cost_t *pCost)
+{
+    if ((Profile < 0) || (Profile >= LN_ROUTING_PROFILE_MAX)) {
+        LOGE("fail: invalid profile\n");
+        return false;
+    }
+    pthread_mutex_lock(&mMuxRouting);
+    mCost[Profile] = *pCost;
+    pthread_mutex_unlock(&mMuxRouting);
+    return true;
+}
+
+
+bool ln_routing_profile_get(ln_routing_cost_t *pCost, ln_routing_profile_t Profile)
+{
+    if ((Profile < 0) || (Profile >= LN_ROUTING_PROFILE_MAX)) {
+        LOGE("fail: invalid profile\n");
+        return false;
+    }
+    pthread_mutex_lock(&mMuxRouting);
+    *pCost = mCost[Profile];
+    pthread_mutex_unlock(&mMuxRouting);
+    return true;
+}
+
+
+bool ln_routing_profile_from_str(ln_routing_profile_t *pProfile, const char *pName)
+{
+    for (int lp = 0; lp < LN_ROUTING_PROFILE_MAX; lp++) {
+        if (strcmp(pName, M_PROFILE_NAME[lp]) == 0) {
+            *pProfile = (ln_routing_profile_t)lp;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char *ln_routing_profile_str(ln_routing_profile_t Profile)
+{
+    if ((Profile < 0) || (Profile >= LN_ROUTING_PROFILE_MAX)) {
+        return "unknown";
+    }
+    return M_PROFILE_NAME[Profile];
+}
+
+
+lnerr_route_t ln_routing_calculate(
+    ln_routing_result_t *pResult, const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat, uint8_t AddNum, const ln_r_field_t *pAddRoute,
+    ln_routing_profile_t Profile)
+{
+    uint8_t num;
+    return ln_routing_calculate_mpp(pResult, &num, 1, pPayerId, pPayeeId,
+                CltvExpiry, AmountMsat, AddNum, pAddRoute, Profile);
+}
+
+
+lnerr_route_t ln_routing_calculate_mpp(
+    ln_routing_result_t *pResults, uint8_t *pNum, uint8_t MaxParts,
+    const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat, uint8_t AddNum, const ln_r_field_t *pAddRoute,
+    ln_routing_profile_t Profile)
+{
+    pResults[0].num_hops = 0;
+    *pNum = 0;
+
+    if ((pPayerId == NULL) || (pPayeeId == NULL) || (MaxParts == 0)) {
+        LOGE("fail: null input\n");
+        return LNROUTE_PARAM;
+    }
+    if ((Profile < 0) || (Profile >= LN_ROUTING_PROFILE_MAX)) {
+        LOGE("fail: invalid profile\n");
+        return LNROUTE_PARAM;
+    }
+
+    if (!routing_lock()) {
+        return LNROUTE_LOADDB;
+    }
+
+    std::vector<edge_descriptor> temp_edges;
+    add_temp_edges(*mpRouting, temp_edges, pPayerId, pPayeeId, AddNum, pAddRoute);
+    LOGD("node_num: %" PRIu32 ", edge_num: %" PRIu32 "\n",
+                (uint32_t)num_vertices(mpRouting->graph), (uint32_t)num_edges(mpRouting->graph));
+
+    LOGD("profile: %s\n", M_PROFILE_NAME[Profile]);
+
+    //1経路で見つからなければ、分割数を増やして等分した額でそれぞれ検索する
+    //  先に見つかったpartが使ったchannelは、残りのpartで容量を差し引く
+    lnerr_route_t ret = LNROUTE_NOTFOUND;
+    std::unordered_map<uint64_t, uint64_t> used;
+    for (uint8_t parts = 1; parts <= MaxParts; parts++) {
+        used.clear();
+        for (uint8_t lp = 0; lp < parts; lp++) {
+            uint64_t amount = AmountMsat / parts;
+            if (lp == parts - 1) {
+                amount += AmountMsat % parts;
+            }
+            ret = search_route(*mpRouting, &pResults[lp], pPayerId, pPayeeId,
+                        CltvExpiry, amount, mCost[Profile], &used);
+            if (ret != LNROUTE_OK) {
+                break;
+            }
+            for (int hop = 0; hop < pResults[lp].num_hops - 1; hop++) {
+                used[pResults[lp].hop_datain[hop].short_channel_id] += pResults[lp].hop_datain[hop].amt_to_forward;
+            }
+        }
+        if (ret == LNROUTE_OK) {
+            LOGD("parts: %d\n", parts);
+            *pNum = parts;
+            break;
+        }
+        if (ret != LNROUTE_NOTFOUND) {
+            break;
+        }
+    }
+
+    remove_temp_edges(*mpRouting, temp_edges);
+    pthread_mutex_unlock(&mMuxRouting);
+
+    return ret;
+}
+
+
+lnerr_route_t ln_routing_calculate_k(
+    ln_routing_result_t *pResults, uint8_t *pNum, uint8_t K,
+    const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat, uint8_t AddNum, const ln_r_field_t *pAddRoute,
+    const uint64_t *pExclude, uint8_t ExcludeNum, ln_routing_profile_t Profile)
+{
+    pResults[0].num_hops = 0;
+    *pNum = 0;
+
+    if ((pPayerId == NULL) || (pPayeeId == NULL) || (K == 0)) {
+        LOGE("fail: null input\n");
+        return LNROUTE_PARAM;
+    }
+    if ((Profile < 0) || (Profile >= LN_ROUTING_PROFILE_MAX)) {
+        LOGE("fail: invalid profile\n");
+        return LNROUTE_PARAM;
+    }
+
+    if (!routing_lock()) {
+        return LNROUTE_LOADDB;
+    }
+
+    std::vector<edge_descriptor> temp_edges;
+    add_temp_edges(*mpRouting, temp_edges, pPayerId, pPayeeId, AddNum, pAddRoute);
+    LOGD("profile: %s, exclude: %d\n", M_PROFILE_NAME[Profile], ExcludeNum);
+
+    lnerr_route_t ret = search_candidates(*mpRouting, pResults, pNum, K, pPayerId, pPayeeId,
+                CltvExpiry, AmountMsat, mCost[Profile], temp_edges, pExclude, ExcludeNum);
+
+    remove_temp_edges(*mpRouting, temp_edges);
+    pthread_mutex_unlock(&mMuxRouting);
+
+    return ret;
+}
+
+
+lnerr_route_t ln_routing_reprice(
+    ln_routing_result_t *pResult, uint32_t CltvExpiry, uint64_t AmountMsat,
+    uint8_t AddNum, const ln_r_field_t *pAddRoute)
+{
+    if (pResult->num_hops < 2) {
+        LOGE("fail: no route\n");
+        return LNROUTE_PARAM;
+    }
+
+    if (!routing_lock()) {
+        return LNROUTE_LOADDB;
+    }
+
+    const uint8_t *p_payer = pResult->hop_datain[0].pubkey;
+    const uint8_t *p_payee = pResult->hop_datain[pResult->num_hops - 1].pubkey;
+    std::vector<edge_descriptor> temp_edges;
+    add_temp_edges(*mpRouting, temp_edges, p_payer, p_payee, AddNum, pAddRoute);
+
+    //同じnode間・同じshort_channel_idのedgeを現在のgraphから探す
+    lnerr_route_t ret = LNROUTE_OK;
+    std::vector<edge_descriptor> path;
+    for (int lp = 0; lp < pResult->num_hops - 1; lp++) {
+        vertex_descriptor u;
+        vertex_descriptor v;
+        if (!graph_find_vertex(*mpRouting, pResult->hop_datain[lp].pubkey, &u) ||
+                !graph_find_vertex(*mpRouting, pResult->hop_datain[lp + 1].pubkey, &v)) {
+            ret = LNROUTE_NOTFOUND;
+            break;
+        }
+        bool found = false;
+        out_edge_iterator ei, ei_end;
+        for (boost::tie(ei, ei_end) = out_edges(u, mpRouting->graph); ei != ei_end; ++ei) {
+            const Fee &fee = mpRouting->graph[*ei];
+            if ((target(*ei, mpRouting->graph) == v) &&
+                    (fee.short_channel_id == pResult->hop_datain[lp].short_channel_id)) {
+                path.push_back(*ei);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            M_DBGLOG("not found: %016" PRIx64 "\n", pResult->hop_datain[lp].short_channel_id);
+            ret = LNROUTE_NOTFOUND;
+            break;
+        }
+    }
+    //各edgeは、payeeから逆順に求めたそのedgeの転送額で判定する
+    size_t fail;
+    if ((ret == LNROUTE_OK) && !path_usable(*mpRouting, path, AmountMsat, NULL, (uint64_t)utl_time_time(), &fail)) {
+        ret = LNROUTE_NOTFOUND;
+    }
+    if (ret == LNROUTE_OK) {
+        ret = route_result(*mpRouting, pResult, path, CltvExpiry, AmountMsat);
+    }
+
+    remove_temp_edges(*mpRouting, temp_edges);
+    pthread_mutex_unlock(&mMuxRouting);
+
+    return ret;
+}
+
+
 void ln_routing_clear_skipdb(void)
 {
     bool bret;
@@ -31,6 +31,7 @@
 #include "ln_err.h"
 #include "ln_onion.h"
 #include "ln_invoice.h"
+#include "ln_msg_anno.h"
 
 
 #ifdef __cplusplus
@@ -50,10 +51,178 @@ typedef struct {
 } ln_routing_result_t;
 
 
+/** @enum       ln_routing_profile_t
+ *  @brief      edge cost profile(#ln_routing_calculate())
+ */
+typedef enum {
+    LN_ROUTING_PROFILE_FEE,             ///< feeのみ(従来と同じ)
+    LN_ROUTING_PROFILE_BALANCED,        ///< fee + CLTV + 失敗確率
+    LN_ROUTING_PROFILE_RELIABLE,        ///< 失敗確率を重視
+    LN_ROUTING_PROFILE_MAX,
+} ln_routing_profile_t;
+
+
+/** @struct     ln_routing_cost_t
+ *  @brief      edge cost parameter
+ *
+ *  支払額amountに対するedgeのweight[msat]は次のとおり。
+ *      fee + amount * cltv_expiry_delta * cltv_ppb / 10^9 + P(fail) * (fail_base_msat + amount * fail_ppm / 10^6)
+ *
+ *  P(fail)は、htlc_maximum_msatを容量とみなした残高不足の確率と、route skipに登録された失敗履歴から見積もる。
+ *  失敗履歴はfail_halflife[sec]ごとに半減する。
+ *  htlc_minimum_msat/htlc_maximum_msatを満たさないedgeはprofileにかかわらず除外する。
+ */
+typedef struct {
+    uint32_t            cltv_ppb;           ///< 1blockあたりのHTLC拘束コスト[ppb]
+    uint64_t            fail_base_msat;     ///< 失敗1回あたりのコスト[msat]
+    uint32_t            fail_ppm;           ///< 失敗1回あたりのコスト[ppm]
+    uint32_t            fail_halflife;      ///< 失敗履歴の半減期[sec]
+    bool                use_capacity;       ///< true: htlc_maximum_msatから残高不足の確率を見積もる
+} ln_routing_cost_t;
+
+
 /********************************************************************
  * prototypes
  ********************************************************************/
 
+/** routing graph初期化
+ *
+ * DBからrouting graphを構築し、以降は常駐させる。
+ * 構築後は下記の更新関数で差分を反映し、#ln_routing_calculate()は常駐graphに対して検索する。
+ * 未初期化のまま#ln_routing_calculate()を呼んだ場合は、その時点で構築する。
+ *
+ * @retval  true    成功
+ */
+bool ln_routing_init(void);
+
+
+/** routing graph解放
+ *
+ */
+void ln_routing_term(void);
+
+
+/** channel_announcement反映
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   pNodeId1
+ * @param[in]   pNodeId2
+ */
+void ln_routing_cnlanno_update(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2);
+
+
+/** channel_update反映
+ *
+ * 保持しているchannel_updateより古いtimestampの場合は無視する。
+ *
+ * @param[in]   pUpd
+ */
+void ln_routing_cnlupd_update(const ln_msg_channel_update_t *pUpd);
+
+
+/** channel_announcement削除
+ *
+ * @param[in]   ShortChannelId
+ */
+void ln_routing_cnlanno_del(uint64_t ShortChannelId);
+
+
+/** channel_update削除
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   Dir             channel_updateのdirection
+ */
+void ln_routing_cnlupd_del(uint64_t ShortChannelId, int Dir);
+
+
+/** 自channel追加(normal operation開始)
+ *
+ * announcementの有無にかかわらず、送金元からの経路として使用する。
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   pPeerNodeId
+ */
+void ln_routing_channel_add(uint64_t ShortChannelId, const uint8_t *pPeerNodeId);
+
+
+/** 自channel削除(close開始)
+ *
+ * @param[in]   ShortChannelId
+ */
+void ln_routing_channel_del(uint64_t ShortChannelId);
+
+
+/** 自channelの送金可能額反映
+ *
+ * 送金元からpeerへのedgeのhtlc_maximum_msatとして扱う。
+ * 0の場合は検索候補から外す。
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   PayableMsat     #ln_local_payable_msat()
+ */
+void ln_routing_channel_payable(uint64_t ShortChannelId, uint64_t PayableMsat);
+
+
+/** route skip登録反映(#ln_db_route_skip_save())
+ *
+ * 失敗履歴(#ln_routing_cost_t)にも加える。
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   bTemp           true:一時的なskip
+ * @param[in]   Expiry          有効期限(epoch time, 0:期限なし)
+ */
+void ln_routing_skip_add(uint64_t ShortChannelId, bool bTemp, uint64_t Expiry);
+
+
+/** route skip TEMP <--> WORK反映(#ln_db_route_skip_work())
+ *
+ * @param[in]   bWork           true:TEMP-->WORK / false:WORK-->TEMP
+ */
+void ln_routing_skip_work(bool bWork);
+
+
+/** route skip削除反映(#ln_db_route_skip_drop())
+ *
+ * @param[in]   bTemp           true:一時的なskipと期限切れのみ削除 / false:全削除
+ */
+void ln_routing_skip_drop(bool bTemp);
+
+
+/** edge cost profile設定
+ *
+ * @param[in]   Profile
+ * @param[in]   pCost
+ * @retval  true    成功
+ */
+bool ln_routing_profile_set(ln_routing_profile_t Profile, const ln_routing_cost_t *pCost);
+
+
+/** edge cost profile取得
+ *
+ * @param[out]  pCost
+ * @param[in]   Profile
+ * @retval  true    成功
+ */
+bool ln_routing_profile_get(ln_routing_cost_t *pCost, ln_routing_profile_t Profile);
+
+
+/** edge cost profile名 --> profile
+ *
+ * @param[out]  pProfile
+ * @param[in]   pName           "fee", "balanced", "reliable"
+ * @retval  true    成功
+ */
+bool ln_routing_profile_from_str(ln_routing_profile_t *pProfile, const char *pName);
+
+
+/** edge cost profile --> profile名
+ *
+ * @param[in]   Profile
+ * @return  profile名(不明な場合は"unknown")
+ */
+const char *ln_routing_profile_str(ln_routing_profile_t Profile);
+
+
 /** 支払いルート作成
  *
  * @param[out]  pResult
@@ -63,6 +232,7 @@ typedef struct {
  * @param[in]   AmountMsat
  * @param[in]   AddNum          追加route数(invoiceのr fieldを想定)
  * @param[in]   pAddRoute       追加route(invoiceのr fieldを想定)
+ * @param[in]   Profile         edge cost profile
  * @return  LNERR_ROUTE_xxx
  */
 lnerr_route_t ln_routing_calculate(
@@ -72,6 +242,95 @@ lnerr_route_t ln_routing_calculate(
         uint32_t CltvExpiry,
         uint64_t AmountMsat,
         uint8_t AddNum,
+        const ln_r_field_t *pAddRoute,
+        ln_routing_profile_t Profile);
+
+
+/** 支払いルート作成(multi-path)
+ *
+ * 1経路で支払えない場合、最大MaxParts個に等分した額でそれぞれ経路を検索する。
+ * 同じchannelを複数のpartで使う場合はhtlc_maximum_msatの範囲内に限る。
+ *
+ * @param[out]  pResults        MaxParts個の配列
+ * @param[out]  pNum            pResultsの有効数
+ * @param[in]   MaxParts        最大分割数(1: #ln_routing_calculate()と同じ)
+ * @param[in]   pPayerId
+ * @param[in]   pPayeeId
+ * @param[in]   CltvExpiry
+ * @param[in]   AmountMsat      全partの合計
+ * @param[in]   AddNum          追加route数(invoiceのr fieldを想定)
+ * @param[in]   pAddRoute       追加route(invoiceのr fieldを想定)
+ * @param[in]   Profile         edge cost profile
+ * @return  LNERR_ROUTE_xxx
+ */
+lnerr_route_t ln_routing_calculate_mpp(
+        ln_routing_result_t *pResults,
+        uint8_t *pNum,
+        uint8_t MaxParts,
+        const uint8_t *pPayerId,
+        const uint8_t *pPayeeId,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
+        const ln_r_field_t *pAddRoute,
+        ln_routing_profile_t Profile);
+
+
+/** 支払いルート候補作成
+ *
+ * 最短経路と、最短経路から1か所だけ外れる経路(外れた先からpayeeまでは最短)を、
+ * 最短経路からのcost増分が小さい順に最大K個返す。
+ * 検索はpayeeを起点にした1回だけで、#ln_routing_calculate()と同程度の時間で済む。
+ * retryで使う候補を先に作っておくことを想定している(#ln_routing_reprice())。
+ *
+ * @param[out]  pResults        K個の配列(先頭が最短経路)
+ * @param[out]  pNum            pResultsの有効数
+ * @param[in]   K               最大候補数
+ * @param[in]   pPayerId
+ * @param[in]   pPayeeId
+ * @param[in]   CltvExpiry
+ * @param[in]   AmountMsat
+ * @param[in]   AddNum          追加route数(invoiceのr fieldを想定)
+ * @param[in]   pAddRoute       追加route(invoiceのr fieldを想定)
+ * @param[in]   pExclude        使用しないshort_channel_id(NULL可)
+ * @param[in]   ExcludeNum      pExcludeの数
+ * @param[in]   Profile         edge cost profile
+ * @return  LNERR_ROUTE_xxx
+ */
+lnerr_route_t ln_routing_calculate_k(
+        ln_routing_result_t *pResults,
+        uint8_t *pNum,
+        uint8_t K,
+        const uint8_t *pPayerId,
+        const uint8_t *pPayeeId,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
+        const ln_r_field_t *pAddRoute,
+        const uint64_t *pExclude,
+        uint8_t ExcludeNum,
+        ln_routing_profile_t Profile);
+
+
+/** 支払いルート再計算
+ *
+ * 作成済みのrouteと同じchannelを通る前提で、現在のchannel_updateからamountとCLTVを計算し直す。
+ * 経路検索は行わない。
+ * 使用できないchannel(削除済み、route skip登録済み、HTLC制限外)がある場合は失敗する。
+ * HTLC制限は、payeeから逆順にfeeを加算した各channelの転送額で判定する。
+ *
+ * @param[in,out]   pResult     #ln_routing_calculate()などで作成したroute
+ * @param[in]       CltvExpiry
+ * @param[in]       AmountMsat
+ * @param[in]       AddNum          追加route数(invoiceのr fieldを想定)
+ * @param[in]       pAddRoute       追加route(invoiceのr fieldを想定)
+ * @return  LNERR_ROUTE_xxx(使用できないchannelがある場合はLNROUTE_NOTFOUND)
+ */
+lnerr_route_t ln_routing_reprice(
+        ln_routing_result_t *pResult,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
         const ln_r_field_t *pAddRoute);
 
 
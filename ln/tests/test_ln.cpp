@@ -11,6 +11,7 @@ extern "C" {
 #include "../../utl/utl_log.c"
 #include "../../utl/utl_dbg.c"
 #include "../../utl/utl_buf.c"
+#include "../../utl/utl_arena.c"
 #include "../../utl/utl_push.c"
 #include "../../utl/utl_time.c"
 #include "../../utl/utl_int.c"
@@ -27,6 +28,7 @@ extern "C" {
 #include "../../btc/btc_tx.c"
 #include "../../btc/btc_tx_buf.c"
 #include "../../btc/btc_crypto.c"
+#include "../../btc/btc_chachapoly.c"
 #include "../../btc/segwit_addr.c"
 #include "../../btc/btc_segwit_addr.c"
 #include "../../btc/btc_test_util.c"
@@ -64,7 +66,9 @@ extern "C" {
 // FAKE_VALUE_FUNC(bool, ln_db_channel_search_readonly, ln_db_func_cmp_t, void *);
 // FAKE_VALUE_FUNC(bool, ln_db_payment_hash_save, const uint8_t*, const uint8_t*, ln_commit_tx_output_type_t, uint32_t);
 // FAKE_VALUE_FUNC(bool, ln_db_preimage_search, ln_db_func_preimage_t, void*);
+// FAKE_VALUE_FUNC(bool, ln_db_preimage_search_hash, ln_db_preimage_t *, const uint8_t *, bool);
 // FAKE_VALUE_FUNC(bool, ln_db_preimage_set_expiry, void *, uint32_t);
+FAKE_VOID_FUNC(ln_db_channel_save_reset, ln_channel_t *);
 
 // FAKE_VALUE_FUNC(bool, ln_msg_open_channel_write, utl_buf_t *, const ln_open_channel_t *);
 // FAKE_VALUE_FUNC(bool, ln_msg_open_channel_read, ln_open_channel_t*, const uint8_t*, uint16_t);
@@ -94,6 +98,7 @@ protected:
         // RESET_FAKE(ln_db_channel_search_readonly)
         // RESET_FAKE(ln_db_payment_hash_save)
         // RESET_FAKE(ln_db_preimage_search)
+        // RESET_FAKE(ln_db_preimage_search_hash)
         // RESET_FAKE(ln_db_preimage_set_expiry)
         // RESET_FAKE(ln_msg_open_channel_read)
         // RESET_FAKE(ln_msg_accept_channel_write)
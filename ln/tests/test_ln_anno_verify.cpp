@@ -0,0 +1,379 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <unistd.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_push.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+
+#undef LOG_TAG
+#include "../../btc/btc.c"
+#include "../../btc/btc_buf.c"
+#include "../../btc/btc_keys.c"
+#include "../../btc/btc_sig.c"
+#include "../../btc/btc_crypto.c"
+
+#undef LOG_TAG
+#include "ln_msg_anno.c"
+#include "ln_anno_verify.c"
+#include "ln.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+////////////////////////////////////////////////////////////////////////
+
+namespace LN_DUMMY {
+    const int STORE_MAX = 64;
+
+    uint8_t node_priv[2][BTC_SZ_PRIVKEY];
+    uint8_t node_id[2][BTC_SZ_PUBKEY];
+    uint8_t btc_priv[2][BTC_SZ_PRIVKEY];
+    uint8_t btc_key[2][BTC_SZ_PUBKEY];
+    uint8_t chain_hash[BTC_SZ_HASH256];
+    uint8_t send_id[BTC_SZ_PUBKEY];
+
+    //p_store
+    int store_num;
+    uint16_t store_type[STORE_MAX];
+    uint64_t store_short_channel_id[STORE_MAX];
+    bool store_send_id[STORE_MAX];
+
+    volatile bool store_hold;       //trueの間、storeで待つ
+
+    //p_node_id
+    bool db_found;
+    int db_called;
+
+    void store(uint16_t Type, const uint8_t *pData, uint16_t Len, const uint8_t *pSendId)
+    {
+        while (store_hold) {
+            usleep(1000);
+        }
+        uint64_t short_channel_id = 0;
+        if (Type == MSGTYPE_CHANNEL_ANNOUNCEMENT) {
+            ln_msg_channel_announcement_t msg;
+            if (ln_msg_channel_announcement_read(&msg, pData, Len)) {
+                short_channel_id = msg.short_channel_id;
+            }
+        } else if (Type == MSGTYPE_CHANNEL_UPDATE) {
+            ln_msg_channel_update_t msg;
+            if (ln_msg_channel_update_read(&msg, pData, Len)) {
+                short_channel_id = msg.short_channel_id;
+            }
+        }
+        if (store_num < STORE_MAX) {
+            store_type[store_num] = Type;
+            store_short_channel_id[store_num] = short_channel_id;
+            store_send_id[store_num] = (pSendId != NULL) && (memcmp(pSendId, send_id, BTC_SZ_PUBKEY) == 0);
+        }
+        store_num++;
+    }
+
+    bool node_id_from_db(uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir)
+    {
+        (void)ShortChannelId;
+        db_called++;
+        if (!db_found) return false;
+        memcpy(pNodeId, node_id[Dir], BTC_SZ_PUBKEY);
+        return true;
+    }
+
+    const ln_anno_verify_func_t FUNC = { node_id_from_db, store };
+}
+
+
+////////////////////////////////////////////////////////////////////////
+
+class ln: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+        ASSERT_TRUE(btc_rng_init());
+        for (int lp = 0; lp < 2; lp++) {
+            CreateKey(LN_DUMMY::node_priv[lp], LN_DUMMY::node_id[lp]);
+            CreateKey(LN_DUMMY::btc_priv[lp], LN_DUMMY::btc_key[lp]);
+        }
+        ASSERT_TRUE(btc_rng_big_rand(LN_DUMMY::chain_hash, sizeof(LN_DUMMY::chain_hash)));
+        ASSERT_TRUE(btc_rng_big_rand(LN_DUMMY::send_id, sizeof(LN_DUMMY::send_id)));
+        LN_DUMMY::store_num = 0;
+        LN_DUMMY::store_hold = false;
+        LN_DUMMY::db_found = false;
+        LN_DUMMY::db_called = 0;
+    }
+
+    virtual void TearDown() {
+        ln_anno_verify_stop();
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+        btc_rng_free();
+    }
+
+public:
+    static void CreateKey(uint8_t *pPriv, uint8_t *pPub)
+    {
+        do {
+            btc_rng_rand(pPriv, BTC_SZ_PRIVKEY);
+        } while (!btc_keys_check_priv(pPriv));
+        btc_keys_priv2pub(pPub, pPriv);
+    }
+    static void Sign(uint8_t *pSig, const uint8_t *pData, uint32_t Len, uint16_t Offset, const uint8_t *pPriv)
+    {
+        uint8_t hash[BTC_SZ_HASH256];
+        btc_md_hash256(hash, pData + Offset, Len - Offset);
+        btc_sig_sign_rs(pSig, hash, pPriv);
+    }
+    static void CreateChannelAnnouncement(utl_buf_t *pBuf, uint64_t ShortChannelId, bool bValid)
+    {
+        uint8_t dummy_signature[LN_SZ_SIGNATURE];
+        memset(dummy_signature, 0xcc, sizeof(dummy_signature));
+        ln_msg_channel_announcement_t msg;
+        msg.p_node_signature_1 = dummy_signature;
+        msg.p_node_signature_2 = dummy_signature;
+        msg.p_bitcoin_signature_1 = dummy_signature;
+        msg.p_bitcoin_signature_2 = dummy_signature;
+        msg.len = 0;
+        msg.p_features = NULL;
+        msg.p_chain_hash = LN_DUMMY::chain_hash;
+        msg.short_channel_id = ShortChannelId;
+        msg.p_node_id_1 = LN_DUMMY::node_id[0];
+        msg.p_node_id_2 = LN_DUMMY::node_id[1];
+        msg.p_bitcoin_key_1 = LN_DUMMY::btc_key[0];
+        msg.p_bitcoin_key_2 = LN_DUMMY::btc_key[1];
+        ASSERT_TRUE(ln_msg_channel_announcement_write(pBuf, &msg));
+
+        const uint16_t offset = sizeof(uint16_t) + LN_SZ_SIGNATURE * 4;
+        uint8_t *p_sig = pBuf->buf + sizeof(uint16_t);
+        Sign(p_sig, pBuf->buf, pBuf->len, offset, LN_DUMMY::node_priv[0]);
+        Sign(p_sig + LN_SZ_SIGNATURE, pBuf->buf, pBuf->len, offset, LN_DUMMY::node_priv[1]);
+        Sign(p_sig + LN_SZ_SIGNATURE * 2, pBuf->buf, pBuf->len, offset, LN_DUMMY::btc_priv[0]);
+        //bitcoin_signature_2だけ不正にする
+        Sign(p_sig + LN_SZ_SIGNATURE * 3, pBuf->buf, pBuf->len, offset, LN_DUMMY::btc_priv[bValid ? 1 : 0]);
+    }
+    static void CreateChannelUpdate(utl_buf_t *pBuf, uint64_t ShortChannelId, uint8_t Dir, const uint8_t *pPriv)
+    {
+        uint8_t dummy_signature[LN_SZ_SIGNATURE];
+        memset(dummy_signature, 0xcc, sizeof(dummy_signature));
+        ln_msg_channel_update_t msg;
+        msg.p_signature = dummy_signature;
+        msg.p_chain_hash = LN_DUMMY::chain_hash;
+        msg.short_channel_id = ShortChannelId;
+        msg.timestamp = 1000;
+        msg.message_flags = 0;
+        msg.channel_flags = Dir;
+        msg.cltv_expiry_delta = 40;
+        msg.htlc_minimum_msat = 1000;
+        msg.fee_base_msat = 1;
+        msg.fee_proportional_millionths = 100;
+        msg.htlc_maximum_msat = 0;
+        ASSERT_TRUE(ln_msg_channel_update_write(pBuf, &msg));
+        Sign(pBuf->buf + sizeof(uint16_t), pBuf->buf, pBuf->len, sizeof(uint16_t) + LN_SZ_SIGNATURE, pPriv);
+    }
+    static void CreateNodeAnnouncement(utl_buf_t *pBuf, const uint8_t *pPriv)
+    {
+        uint8_t dummy_signature[LN_SZ_SIGNATURE];
+        memset(dummy_signature, 0xcc, sizeof(dummy_signature));
+        uint8_t rgb_color[LN_SZ_RGB_COLOR] = { 1, 2, 3 };
+        uint8_t alias[LN_SZ_ALIAS_STR];
+        memset(alias, 0, sizeof(alias));
+        strcpy((char *)alias, "node");
+        ln_msg_node_announcement_t msg;
+        msg.p_signature = dummy_signature;
+        msg.flen = 0;
+        msg.p_features = NULL;
+        msg.timestamp = 1000;
+        msg.p_node_id = LN_DUMMY::node_id[0];
+        msg.p_rgb_color = rgb_color;
+        msg.p_alias = alias;
+        msg.addrlen = 0;
+        msg.p_addresses = NULL;
+        ASSERT_TRUE(ln_msg_node_announcement_write(pBuf, &msg));
+        Sign(pBuf->buf + sizeof(uint16_t), pBuf->buf, pBuf->len, sizeof(uint16_t) + LN_SZ_SIGNATURE, pPriv);
+    }
+    static bool Push(const utl_buf_t *pBuf, const uint8_t *pNodeId = NULL)
+    {
+        uint16_t type = utl_int_pack_u16be(pBuf->buf);
+        return ln_anno_verify_push(type, pBuf->buf, (uint16_t)pBuf->len, LN_DUMMY::send_id, pNodeId);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln, not_started)
+{
+    utl_buf_t buf = UTL_BUF_INIT;
+    CreateNodeAnnouncement(&buf, LN_DUMMY::node_priv[0]);
+
+    //開始前は呼び出し元で検証・保存する
+    ASSERT_FALSE(Push(&buf));
+    ASSERT_EQ(0, LN_DUMMY::store_num);
+
+    ASSERT_FALSE(ln_anno_verify_start(0, &LN_DUMMY::FUNC));
+    ASSERT_FALSE(ln_anno_verify_start(LN_ANNO_VERIFY_WORKERS_MAX + 1, &LN_DUMMY::FUNC));
+    ASSERT_TRUE(ln_anno_verify_start(2, &LN_DUMMY::FUNC));
+    ASSERT_FALSE(ln_anno_verify_start(2, &LN_DUMMY::FUNC));
+    ln_anno_verify_stop();
+
+    ASSERT_FALSE(Push(&buf));
+    utl_buf_free(&buf);
+}
+
+
+TEST_F(ln, store_in_order)
+{
+    utl_buf_t anno = UTL_BUF_INIT;
+    utl_buf_t upd0 = UTL_BUF_INIT;
+    utl_buf_t upd1 = UTL_BUF_INIT;
+    utl_buf_t node = UTL_BUF_INIT;
+    CreateChannelAnnouncement(&anno, 0x123, true);
+    CreateChannelUpdate(&upd0, 0x123, 0, LN_DUMMY::node_priv[0]);
+    CreateChannelUpdate(&upd1, 0x123, 1, LN_DUMMY::node_priv[1]);
+    CreateNodeAnnouncement(&node, LN_DUMMY::node_priv[0]);
+
+    ASSERT_TRUE(ln_anno_verify_start(4, &LN_DUMMY::FUNC));
+    const int LOOP = 10;
+    for (int lp = 0; lp < LOOP; lp++) {
+        ASSERT_TRUE(Push(&anno));
+        ASSERT_TRUE(Push(&upd0));
+        ASSERT_TRUE(Push(&upd1));
+        ASSERT_TRUE(Push(&node));
+    }
+    ln_anno_verify_flush();
+
+    ASSERT_EQ(LOOP * 4, LN_DUMMY::store_num);
+    for (int lp = 0; lp < LOOP * 4; lp += 4) {
+        ASSERT_EQ(MSGTYPE_CHANNEL_ANNOUNCEMENT, LN_DUMMY::store_type[lp]);
+        ASSERT_EQ(MSGTYPE_CHANNEL_UPDATE, LN_DUMMY::store_type[lp + 1]);
+        ASSERT_EQ(MSGTYPE_CHANNEL_UPDATE, LN_DUMMY::store_type[lp + 2]);
+        ASSERT_EQ(MSGTYPE_NODE_ANNOUNCEMENT, LN_DUMMY::store_type[lp + 3]);
+        ASSERT_EQ(0x123, LN_DUMMY::store_short_channel_id[lp]);
+        ASSERT_TRUE(LN_DUMMY::store_send_id[lp]);
+    }
+
+    utl_buf_free(&anno);
+    utl_buf_free(&upd0);
+    utl_buf_free(&upd1);
+    utl_buf_free(&node);
+}
+
+
+TEST_F(ln, drop_invalid)
+{
+    utl_buf_t anno_ng = UTL_BUF_INIT;
+    utl_buf_t anno_ok = UTL_BUF_INIT;
+    utl_buf_t upd_ng = UTL_BUF_INIT;
+    utl_buf_t node_ng = UTL_BUF_INIT;
+    CreateChannelAnnouncement(&anno_ng, 0x111, false);
+    CreateChannelAnnouncement(&anno_ok, 0x222, true);
+    CreateChannelUpdate(&upd_ng, 0x222, 0, LN_DUMMY::node_priv[1]);    //dir=0をnode_id_2で署名
+    CreateNodeAnnouncement(&node_ng, LN_DUMMY::node_priv[1]);
+
+    ASSERT_TRUE(ln_anno_verify_start(1, &LN_DUMMY::FUNC));
+    ASSERT_TRUE(Push(&anno_ng));
+    ASSERT_TRUE(Push(&anno_ok));
+    ASSERT_TRUE(Push(&upd_ng));
+    ASSERT_TRUE(Push(&node_ng));
+    ln_anno_verify_flush();
+
+    ASSERT_EQ(1, LN_DUMMY::store_num);
+    ASSERT_EQ(MSGTYPE_CHANNEL_ANNOUNCEMENT, LN_DUMMY::store_type[0]);
+    ASSERT_EQ(0x222, LN_DUMMY::store_short_channel_id[0]);
+
+    utl_buf_free(&anno_ng);
+    utl_buf_free(&anno_ok);
+    utl_buf_free(&upd_ng);
+    utl_buf_free(&node_ng);
+}
+
+
+TEST_F(ln, update_node_id)
+{
+    utl_buf_t upd0 = UTL_BUF_INIT;
+    utl_buf_t upd1 = UTL_BUF_INIT;
+    CreateChannelUpdate(&upd0, 0x333, 0, LN_DUMMY::node_priv[0]);
+    CreateChannelUpdate(&upd1, 0x333, 1, LN_DUMMY::node_priv[1]);
+
+    ASSERT_TRUE(ln_anno_verify_start(2, &LN_DUMMY::FUNC));
+
+    //channel_announcementが見つからない: 検証せずに保存
+    ASSERT_TRUE(Push(&upd0));
+    ln_anno_verify_flush();
+    ASSERT_EQ(1, LN_DUMMY::store_num);
+    ASSERT_EQ(1, LN_DUMMY::db_called);
+
+    //push時のnode_id(自channel)
+    ASSERT_TRUE(Push(&upd0, LN_DUMMY::node_id[0]));
+    ASSERT_TRUE(Push(&upd1, LN_DUMMY::node_id[0]));
+    ln_anno_verify_flush();
+    ASSERT_EQ(2, LN_DUMMY::store_num);
+
+    //保存済みchannel_announcementはpush時のnode_idより優先する
+    LN_DUMMY::db_found = true;
+    ASSERT_TRUE(Push(&upd0, LN_DUMMY::node_id[1]));
+    ASSERT_TRUE(Push(&upd1, LN_DUMMY::node_id[0]));
+    ln_anno_verify_flush();
+    ASSERT_EQ(4, LN_DUMMY::store_num);
+
+    utl_buf_free(&upd0);
+    utl_buf_free(&upd1);
+}
+
+
+TEST_F(ln, stop_drains_queue)
+{
+    utl_buf_t anno = UTL_BUF_INIT;
+    CreateChannelAnnouncement(&anno, 0x444, true);
+
+    ASSERT_TRUE(ln_anno_verify_start(3, &LN_DUMMY::FUNC));
+    const int NUM = LN_ANNO_VERIFY_BATCH_MAX + 10;
+    for (int lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(Push(&anno));
+    }
+    ln_anno_verify_stop();
+    ASSERT_EQ(NUM, LN_DUMMY::store_num);
+
+    utl_buf_free(&anno);
+}
+
+
+TEST_F(ln, busy)
+{
+    utl_buf_t anno = UTL_BUF_INIT;
+    CreateChannelAnnouncement(&anno, 0x555, true);
+
+    ASSERT_TRUE(ln_anno_verify_start(2, &LN_DUMMY::FUNC));
+    ASSERT_FALSE(ln_anno_verify_is_busy());
+
+    //dispatcherを保存で止めて、queueを溜める
+    LN_DUMMY::store_hold = true;
+    ASSERT_TRUE(Push(&anno));
+    for (int lp = 0; lp < 1000 && LN_DUMMY::store_num == 0 && mInFlight == 0; lp++) {
+        usleep(1000);
+    }
+    for (int lp = 0; lp < LN_ANNO_VERIFY_QUEUE_MAX - 1; lp++) {
+        ASSERT_TRUE(Push(&anno));
+        ASSERT_FALSE(ln_anno_verify_is_busy());
+    }
+    //busyでも待たずにqueueに積む
+    ASSERT_TRUE(Push(&anno));
+    ASSERT_TRUE(ln_anno_verify_is_busy());
+    ASSERT_TRUE(Push(&anno));
+    ASSERT_TRUE(ln_anno_verify_is_busy());
+
+    LN_DUMMY::store_hold = false;
+    ln_anno_verify_flush();
+    ASSERT_FALSE(ln_anno_verify_is_busy());
+    ASSERT_EQ(LN_ANNO_VERIFY_QUEUE_MAX + 2, LN_DUMMY::store_num);
+
+    utl_buf_free(&anno);
+}
@@ -12,6 +12,7 @@ extern "C" {
 #include "../../utl/utl_log.c"
 #include "../../utl/utl_dbg.c"
 #include "../../utl/utl_buf.c"
+#include "../../utl/utl_arena.c"
 #include "../../utl/utl_push.c"
 #include "../../utl/utl_time.c"
 #include "../../utl/utl_int.c"
@@ -12,6 +12,7 @@ extern "C" {
 #include "../../utl/utl_log.c"
 #include "../../utl/utl_dbg.c"
 #include "../../utl/utl_buf.c"
+#include "../../utl/utl_arena.c"
 #include "../../utl/utl_push.c"
 #include "../../utl/utl_time.c"
 #include "../../utl/utl_int.c"
@@ -28,6 +29,7 @@ extern "C" {
 #include "../../btc/btc_tx.c"
 #include "../../btc/btc_tx_buf.c"
 #include "../../btc/btc_crypto.c"
+#include "../../btc/btc_chachapoly.c"
 #include "../../btc/segwit_addr.c"
 #include "../../btc/btc_segwit_addr.c"
 #include "../../btc/btc_test_util.c"
@@ -0,0 +1,187 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <pthread.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+
+#undef LOG_TAG
+#include "ln_crypto_pool.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+////////////////////////////////////////////////////////////////////////
+
+namespace LN_DUMMY {
+    const int JOB_MAX = 500;
+
+    typedef struct {
+        int         idx;
+        bool        fail;
+        uint32_t    out;
+        int         called;
+    } job_t;
+
+    bool job(void *pJob)
+    {
+        job_t *p_job = (job_t *)pJob;
+        p_job->called++;
+        //indexから決まる値を返す(処理順に依らないことの確認用)
+        uint32_t v = (uint32_t)p_job->idx;
+        for (int lp = 0; lp < 1000; lp++) {
+            v = v * 1103515245 + 12345;
+        }
+        p_job->out = v;
+        return !p_job->fail;
+    }
+
+    uint32_t expect(int Idx)
+    {
+        uint32_t v = (uint32_t)Idx;
+        for (int lp = 0; lp < 1000; lp++) {
+            v = v * 1103515245 + 12345;
+        }
+        return v;
+    }
+
+    void init_jobs(job_t *pJobs, int Num)
+    {
+        for (int lp = 0; lp < Num; lp++) {
+            pJobs[lp].idx = lp;
+            pJobs[lp].fail = false;
+            pJobs[lp].out = 0;
+            pJobs[lp].called = 0;
+        }
+    }
+
+    void *thread_run(void *pArg)
+    {
+        job_t *p_jobs = (job_t *)pArg;
+        bool ret = ln_crypto_pool_run(job, p_jobs, sizeof(job_t), JOB_MAX);
+        return ret ? pArg : NULL;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+
+class ln: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+    }
+
+    virtual void TearDown() {
+        ln_crypto_pool_stop();
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln, start_param)
+{
+    ASSERT_FALSE(ln_crypto_pool_start(0));
+    ASSERT_FALSE(ln_crypto_pool_start(LN_CRYPTO_POOL_WORKERS_MAX + 1));
+    ASSERT_TRUE(ln_crypto_pool_start(1));
+    ASSERT_FALSE(ln_crypto_pool_start(1));
+    ln_crypto_pool_stop();
+    ASSERT_TRUE(ln_crypto_pool_start(LN_CRYPTO_POOL_WORKERS_MAX));
+}
+
+
+//startしていなければ呼び出し元threadで順に処理する
+TEST_F(ln, run_inline)
+{
+    static LN_DUMMY::job_t jobs[LN_DUMMY::JOB_MAX];
+
+    LN_DUMMY::init_jobs(jobs, LN_DUMMY::JOB_MAX);
+    ASSERT_TRUE(ln_crypto_pool_run(LN_DUMMY::job, jobs, sizeof(jobs[0]), LN_DUMMY::JOB_MAX));
+    for (int lp = 0; lp < LN_DUMMY::JOB_MAX; lp++) {
+        ASSERT_EQ(1, jobs[lp].called);
+        ASSERT_EQ(LN_DUMMY::expect(lp), jobs[lp].out);
+    }
+
+    //失敗したら以降は処理しない
+    LN_DUMMY::init_jobs(jobs, LN_DUMMY::JOB_MAX);
+    jobs[10].fail = true;
+    ASSERT_FALSE(ln_crypto_pool_run(LN_DUMMY::job, jobs, sizeof(jobs[0]), LN_DUMMY::JOB_MAX));
+    ASSERT_EQ(1, jobs[10].called);
+    ASSERT_EQ(0, jobs[11].called);
+
+    ASSERT_TRUE(ln_crypto_pool_run(LN_DUMMY::job, jobs, sizeof(jobs[0]), 0));
+}
+
+
+TEST_F(ln, run_workers)
+{
+    static LN_DUMMY::job_t jobs[LN_DUMMY::JOB_MAX];
+
+    ASSERT_TRUE(ln_crypto_pool_start(4));
+
+    LN_DUMMY::init_jobs(jobs, LN_DUMMY::JOB_MAX);
+    ASSERT_TRUE(ln_crypto_pool_run(LN_DUMMY::job, jobs, sizeof(jobs[0]), LN_DUMMY::JOB_MAX));
+    for (int lp = 0; lp < LN_DUMMY::JOB_MAX; lp++) {
+        ASSERT_EQ(1, jobs[lp].called);
+        ASSERT_EQ(LN_DUMMY::expect(lp), jobs[lp].out);
+    }
+
+    //どのjobが失敗しても全体を失敗にする
+    const int FAILS[] = { 0, 1, LN_DUMMY::JOB_MAX / 2, LN_DUMMY::JOB_MAX - 1 };
+    for (size_t lp = 0; lp < ARRAY_SIZE(FAILS); lp++) {
+        LN_DUMMY::init_jobs(jobs, LN_DUMMY::JOB_MAX);
+        jobs[FAILS[lp]].fail = true;
+        ASSERT_FALSE(ln_crypto_pool_run(LN_DUMMY::job, jobs, sizeof(jobs[0]), LN_DUMMY::JOB_MAX));
+        ASSERT_EQ(1, jobs[FAILS[lp]].called);
+        for (int lp2 = 0; lp2 < LN_DUMMY::JOB_MAX; lp2++) {
+            ASSERT_GE(1, jobs[lp2].called);
+        }
+    }
+}
+
+
+//複数threadから同時に呼び出す
+TEST_F(ln, run_concurrent)
+{
+    const int THREADS = 4;
+    static LN_DUMMY::job_t jobs[THREADS][LN_DUMMY::JOB_MAX];
+    pthread_t th[THREADS];
+
+    ASSERT_TRUE(ln_crypto_pool_start(3));
+
+    for (int lp = 0; lp < THREADS; lp++) {
+        LN_DUMMY::init_jobs(jobs[lp], LN_DUMMY::JOB_MAX);
+    }
+    jobs[2][100].fail = true;
+    for (int lp = 0; lp < THREADS; lp++) {
+        pthread_create(&th[lp], NULL, LN_DUMMY::thread_run, jobs[lp]);
+    }
+    for (int lp = 0; lp < THREADS; lp++) {
+        void *p_ret;
+        pthread_join(th[lp], &p_ret);
+        if (lp == 2) {
+            ASSERT_TRUE(p_ret == NULL);
+            continue;
+        }
+        ASSERT_TRUE(p_ret == jobs[lp]);
+        for (int lp2 = 0; lp2 < LN_DUMMY::JOB_MAX; lp2++) {
+            ASSERT_EQ(1, jobs[lp][lp2].called);
+            ASSERT_EQ(LN_DUMMY::expect(lp2), jobs[lp][lp2].out);
+        }
+    }
+}
@@ -11,6 +11,7 @@ extern "C" {
 #include "../../utl/utl_log.c"
 #include "../../utl/utl_dbg.c"
 #include "../../utl/utl_buf.c"
+#include "../../utl/utl_arena.c"
 #include "../../utl/utl_push.c"
 #include "../../utl/utl_time.c"
 #include "../../utl/utl_int.c"
@@ -26,6 +27,7 @@ extern "C" {
 #include "../../btc/btc_tx.c"
 #include "../../btc/btc_tx_buf.c"
 #include "../../btc/btc_crypto.c"
+#include "../../btc/btc_chachapoly.c"
 #include "../../btc/segwit_addr.c"
 #include "../../btc/btc_segwit_addr.c"
 #include "../../btc/btc_test_util.c"
@@ -68,8 +70,10 @@ FAKE_VALUE_FUNC(bool, ln_db_channel_search_readonly, ln_db_func_cmp_t, void *);
 FAKE_VALUE_FUNC(bool, ln_db_channel_search_readonly_nokey, ln_db_func_cmp_t, void *);
 FAKE_VALUE_FUNC(bool, ln_db_payment_hash_save, const uint8_t*, const uint8_t*, ln_commit_tx_output_type_t, uint32_t);
 FAKE_VALUE_FUNC(bool, ln_db_preimage_search, ln_db_func_preimage_t, void*);
+FAKE_VALUE_FUNC(bool, ln_db_preimage_search_hash, ln_db_preimage_t *, const uint8_t *, bool);
 FAKE_VALUE_FUNC(bool, ln_db_preimage_set_expiry, void *, uint32_t);
 FAKE_VALUE_FUNC(bool, ln_db_forward_add_htlc_save, const ln_db_forward_t *);
+FAKE_VOID_FUNC(ln_db_channel_save_reset, ln_channel_t *);
 
 FAKE_VALUE_FUNC(bool, ln_msg_open_channel_write, utl_buf_t *, const ln_msg_open_channel_t *);
 FAKE_VALUE_FUNC(bool, ln_msg_open_channel_read, ln_msg_open_channel_t*, const uint8_t*, uint16_t);
@@ -100,8 +104,10 @@ protected:
         RESET_FAKE(ln_db_channel_search_readonly_nokey)
         RESET_FAKE(ln_db_payment_hash_save)
         RESET_FAKE(ln_db_preimage_search)
+        RESET_FAKE(ln_db_preimage_search_hash)
         RESET_FAKE(ln_db_preimage_set_expiry)
         RESET_FAKE(ln_db_forward_add_htlc_save)
+        RESET_FAKE(ln_db_channel_save_reset)
         RESET_FAKE(ln_msg_open_channel_read)
         RESET_FAKE(ln_msg_accept_channel_write)
         RESET_FAKE(ln_msg_accept_channel_read)
@@ -431,11 +437,7 @@ TEST_F(ln, update_add_htlc_recv1)
 {
     class dummy {
     public:
-        static bool ln_db_preimage_cur_open(void **ppCur) {
-            return true;
-        }
-        static bool ln_db_preimage_cur_get(void *pCur, bool *pDetect, ln_db_preimage_t *pPreimage) {
-            *pDetect = true;
+        static bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash, bool bNoExpire) {
             pPreimage->amount_msat = LN_UPDATE_ADD_HTLC_A::AMOUNT_MSAT;
             memcpy(pPreimage->preimage, LN_UPDATE_ADD_HTLC_A::PREIMAGE, LN_SZ_PREIMAGE);
             pPreimage->creation_time = 1538375408;
@@ -450,8 +452,7 @@ TEST_F(ln, update_add_htlc_recv1)
             }
         }
     };
-    ln_db_preimage_cur_open_fake.custom_fake = dummy::ln_db_preimage_cur_open;
-    ln_db_preimage_cur_get_fake.custom_fake = dummy::ln_db_preimage_cur_get;
+    ln_db_preimage_search_hash_fake.custom_fake = dummy::ln_db_preimage_search_hash;
 
 
     ln_channel_t channel;
@@ -501,11 +502,7 @@ TEST_F(ln, update_add_htlc_recv2)
 {
     class dummy {
     public:
-        static bool ln_db_preimage_cur_open(void **ppCur) {
-            return true;
-        }
-        static bool ln_db_preimage_cur_get(void *pCur, bool *pDetect, ln_db_preimage_t *pPreimage) {
-            *pDetect = true;
+        static bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash, bool bNoExpire) {
             pPreimage->amount_msat = LN_UPDATE_ADD_HTLC_A::AMOUNT_MSAT;
             memcpy(pPreimage->preimage, LN_UPDATE_ADD_HTLC_A::PREIMAGE, LN_SZ_PREIMAGE);
             pPreimage->creation_time = 1538375408;
@@ -521,8 +518,7 @@ TEST_F(ln, update_add_htlc_recv2)
             }
         }
     };
-    ln_db_preimage_cur_open_fake.custom_fake = dummy::ln_db_preimage_cur_open;
-    ln_db_preimage_cur_get_fake.custom_fake = dummy::ln_db_preimage_cur_get;
+    ln_db_preimage_search_hash_fake.custom_fake = dummy::ln_db_preimage_search_hash;
 
 
     ln_channel_t channel;
@@ -572,11 +568,11 @@ TEST_F(ln, update_add_htlc_recv3)
 {
     class dummy {
     public:
-        static bool ln_db_preimage_cur_open(void **ppCur) {
+        static bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash, bool bNoExpire) {
             return false;
         }
     };
-    ln_db_preimage_cur_open_fake.custom_fake = dummy::ln_db_preimage_cur_open;
+    ln_db_preimage_search_hash_fake.custom_fake = dummy::ln_db_preimage_search_hash;
 
 
     ln_channel_t channel;
@@ -11,6 +11,7 @@ extern "C" {
 #include "../../utl/utl_log.c"
 #include "../../utl/utl_dbg.c"
 #include "../../utl/utl_buf.c"
+#include "../../utl/utl_arena.c"
 #include "../../utl/utl_push.c"
 //#include "../../utl/utl_time.c"
 #include "../../utl/utl_int.c"
@@ -26,6 +27,7 @@ extern "C" {
 #include "../../btc/btc_tx.c"
 #include "../../btc/btc_tx_buf.c"
 #include "../../btc/btc_crypto.c"
+#include "../../btc/btc_chachapoly.c"
 #include "../../btc/segwit_addr.c"
 #include "../../btc/btc_segwit_addr.c"
 #include "../../btc/btc_test_util.c"
@@ -63,10 +65,14 @@ FAKE_VALUE_FUNC(bool, ln_db_channel_search, ln_db_func_cmp_t, void *);
 FAKE_VALUE_FUNC(bool, ln_db_channel_search_readonly, ln_db_func_cmp_t, void *);
 FAKE_VALUE_FUNC(bool, ln_db_payment_hash_save, const uint8_t*, const uint8_t*, ln_commit_tx_output_type_t, uint32_t);
 FAKE_VALUE_FUNC(bool, ln_db_preimage_search, ln_db_func_preimage_t, void*);
+FAKE_VALUE_FUNC(bool, ln_db_preimage_search_hash, ln_db_preimage_t *, const uint8_t *, bool);
 FAKE_VALUE_FUNC(bool, ln_db_preimage_set_expiry, void *, uint32_t);
 FAKE_VALUE_FUNC(bool, ln_db_cnlupd_need_to_prune, uint64_t , uint32_t );
 FAKE_VALUE_FUNC(bool, ln_db_cnlupd_save, const utl_buf_t *, const ln_msg_channel_update_t *, const uint8_t *);
 FAKE_VALUE_FUNC(bool, ln_db_cnlanno_load, utl_buf_t *, uint64_t );
+FAKE_VOID_FUNC(ln_db_channel_save_reset, ln_channel_t *);
+FAKE_VOID_FUNC(ln_routing_cnlanno_update, uint64_t, const uint8_t *, const uint8_t *);
+FAKE_VOID_FUNC(ln_routing_cnlupd_update, const ln_msg_channel_update_t *);
 
 FAKE_VALUE_FUNC(time_t, utl_time_time);
 FAKE_VALUE_FUNC(const char *, utl_time_str_time, char *);
@@ -240,10 +246,14 @@ protected:
         RESET_FAKE(ln_db_channel_search_readonly)
         RESET_FAKE(ln_db_payment_hash_save)
         RESET_FAKE(ln_db_preimage_search)
+        RESET_FAKE(ln_db_preimage_search_hash)
         RESET_FAKE(ln_db_preimage_set_expiry)
         RESET_FAKE(ln_db_cnlupd_need_to_prune)
         RESET_FAKE(ln_db_cnlupd_save)
         RESET_FAKE(ln_db_cnlanno_load)
+        RESET_FAKE(ln_db_channel_save_reset)
+        RESET_FAKE(ln_routing_cnlanno_update)
+        RESET_FAKE(ln_routing_cnlupd_update)
 
         RESET_FAKE(ln_msg_channel_update_read)
         RESET_FAKE(ln_msg_channel_update_verify)
@@ -0,0 +1,856 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#undef LOG_TAG
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+}
+
+#undef LOG_TAG
+extern "C" {
+#include "ln_payment.c"
+}
+#include "ln_routing.cpp"
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, ln_db_channel_search_readonly_nokey, ln_db_func_cmp_t, void *);
+FAKE_VALUE_FUNC(bool, ln_db_route_skip_load, ln_db_func_route_skip_t, void *);
+FAKE_VALUE_FUNC(bool, ln_db_route_skip_work, bool);
+FAKE_VALUE_FUNC(bool, ln_db_route_skip_drop, bool);
+FAKE_VALUE_FUNC(bool, ln_db_anno_transaction);
+FAKE_VOID_FUNC(ln_db_anno_commit, bool);
+FAKE_VALUE_FUNC(bool, ln_db_anno_cur_open, void **, ln_db_cur_t);
+FAKE_VOID_FUNC(ln_db_anno_cur_close, void *);
+FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_get, void *, uint64_t *, char *, uint32_t *, utl_buf_t *);
+FAKE_VALUE_FUNC(ln_status_t, ln_status_get, const ln_channel_t *);
+FAKE_VALUE_FUNC(bool, ln_get_ids_cnl_anno, uint64_t *, uint8_t *, uint8_t *, const uint8_t *, uint16_t);
+FAKE_VALUE_FUNC(bool, ln_channel_update_get_params, ln_msg_channel_update_t *, const uint8_t *, uint16_t);
+FAKE_VALUE_FUNC(time_t, utl_time_time);
+FAKE_VALUE_FUNC(const char *, utl_time_str_time, char *);
+FAKE_VALUE_FUNC(const char *, utl_time_fmt, char *, time_t );
+FAKE_VALUE_FUNC(bool, btc_rng_rand, uint8_t *, uint16_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_get_new_payment_id, uint64_t *);
+FAKE_VALUE_FUNC(bool, ln_db_payment_shared_secrets_save, uint64_t, const uint8_t *, uint32_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_shared_secrets_del, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_route_save, uint64_t, const uint8_t *, uint32_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_route_load, utl_buf_t *, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_route_del, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_invoice_save, uint64_t, const uint8_t *, uint32_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_invoice_load, utl_buf_t *, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_info_save, uint64_t, const ln_payment_info_t *);
+FAKE_VALUE_FUNC(bool, ln_db_payment_info_load, ln_payment_info_t *, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_part_save, uint64_t, const ln_payment_part_t *);
+FAKE_VALUE_FUNC(bool, ln_db_payment_part_load, ln_payment_part_t *, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_del_all, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_payment_part_cur_open, void **);
+FAKE_VOID_FUNC(ln_db_payment_part_cur_close, void *, bool);
+FAKE_VALUE_FUNC(bool, ln_db_payment_part_cur_get, void *, uint64_t *, ln_payment_part_t *);
+FAKE_VALUE_FUNC(bool, ln_db_route_skip_save, uint64_t, bool, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_invoice_decode_2, ln_invoice_t **, const char *, uint32_t);
+FAKE_VOID_FUNC(ln_invoice_decode_free, ln_invoice_t *);
+FAKE_VALUE_FUNC(uint64_t, ln_local_payable_msat, const ln_channel_t *);
+FAKE_VALUE_FUNC(const uint8_t *, ln_node_get_id);
+FAKE_VALUE_FUNC(bool, ln_onion_create_packet, uint8_t *, utl_buf_t *, const ln_hop_datain_t *, int, uint64_t, const uint8_t *, const uint8_t *, int);
+FAKE_VALUE_FUNC(bool, ln_set_add_htlc_send_origin, uint64_t, uint64_t, uint64_t, uint64_t, const uint8_t *, uint32_t, const uint8_t *);
+
+
+////////////////////////////////////////////////////////////////////////
+
+namespace LN_DUMMY {
+    //node_idは2byte目だけ変える(大小関係 = 2byte目)
+    enum {
+        PAYER = 0x02,
+        NODE_A,
+        NODE_B,
+        NODE_C,
+        PAYEE,
+    };
+
+    void node_id(uint8_t *pNodeId, uint8_t Node)
+    {
+        memset(pNodeId, 0x11, BTC_SZ_PUBKEY);
+        pNodeId[0] = 0x02;
+        pNodeId[1] = Node;
+    }
+
+    //Node1 <--> Node2を両方向同じparameterで追加する
+    void add_channel(uint64_t ShortChannelId, uint8_t Node1, uint8_t Node2,
+                uint32_t FeeBase, uint64_t HtlcMaxMsat)
+    {
+        uint8_t node1[BTC_SZ_PUBKEY];
+        uint8_t node2[BTC_SZ_PUBKEY];
+        node_id(node1, Node1);
+        node_id(node2, Node2);
+        ln_routing_cnlanno_update(ShortChannelId, node1, node2);
+
+        for (int dir = 0; dir < 2; dir++) {
+            ln_msg_channel_update_t upd;
+            memset(&upd, 0, sizeof(upd));
+            upd.short_channel_id = ShortChannelId;
+            upd.timestamp = 1000;
+            upd.channel_flags = (uint8_t)dir;
+            upd.cltv_expiry_delta = 40;
+            upd.htlc_minimum_msat = 0;
+            upd.fee_base_msat = FeeBase;
+            upd.fee_proportional_millionths = 0;
+            upd.htlc_maximum_msat = HtlcMaxMsat;
+            ln_routing_cnlupd_update(&upd);
+        }
+    }
+
+    //payer --> Peer
+    void add_local(uint64_t ShortChannelId, uint8_t Peer, uint64_t PayableMsat)
+    {
+        uint8_t peer[BTC_SZ_PUBKEY];
+        node_id(peer, Peer);
+        ln_routing_channel_add(ShortChannelId, peer);
+        ln_routing_channel_payable(ShortChannelId, PayableMsat);
+    }
+
+    //経路がpayerからpayeeまでつながっていて、payeeへの額がAmountMsatか
+    bool route_valid(const ln_routing_result_t *pResult, uint64_t AmountMsat)
+    {
+        uint8_t payer[BTC_SZ_PUBKEY];
+        uint8_t payee[BTC_SZ_PUBKEY];
+        node_id(payer, PAYER);
+        node_id(payee, PAYEE);
+
+        if (pResult->num_hops < 2) {
+            return false;
+        }
+        if ((memcmp(pResult->hop_datain[0].pubkey, payer, BTC_SZ_PUBKEY) != 0) ||
+                (memcmp(pResult->hop_datain[pResult->num_hops - 1].pubkey, payee, BTC_SZ_PUBKEY) != 0)) {
+            return false;
+        }
+        for (int lp = 1; lp < pResult->num_hops; lp++) {
+            if (pResult->hop_datain[lp - 1].amt_to_forward < pResult->hop_datain[lp].amt_to_forward) {
+                return false;
+            }
+        }
+        return pResult->hop_datain[pResult->num_hops - 1].amt_to_forward == AmountMsat;
+    }
+
+    //経路がShortChannelIdを通るか
+    bool route_has(const ln_routing_result_t *pResult, uint64_t ShortChannelId)
+    {
+        for (int lp = 0; lp < pResult->num_hops - 1; lp++) {
+            if (pResult->hop_datain[lp].short_channel_id == ShortChannelId) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //announcement DB
+    struct anno_rec_t {
+        uint64_t                short_channel_id;
+        char                    type;
+        std::vector<uint8_t>    data;
+    };
+    std::vector<anno_rec_t> anno_db;
+    size_t anno_cur;
+
+    //channel_announcementとchannel_update(両方向)をDBに追加する
+    void db_channel(uint64_t ShortChannelId, uint8_t Node1, uint8_t Node2,
+                uint32_t FeeBase, uint64_t HtlcMaxMsat)
+    {
+        anno_rec_t rec;
+        rec.short_channel_id = ShortChannelId;
+        rec.type = LN_DB_CNLANNO_ANNO;
+        rec.data.resize(BTC_SZ_PUBKEY * 2);
+        node_id(&rec.data[0], Node1);
+        node_id(&rec.data[BTC_SZ_PUBKEY], Node2);
+        anno_db.push_back(rec);
+
+        for (int dir = 0; dir < 2; dir++) {
+            ln_msg_channel_update_t upd;
+            memset(&upd, 0, sizeof(upd));
+            upd.short_channel_id = ShortChannelId;
+            upd.timestamp = 1000;
+            upd.channel_flags = (uint8_t)dir;
+            upd.cltv_expiry_delta = 40;
+            upd.fee_base_msat = FeeBase;
+            upd.htlc_maximum_msat = HtlcMaxMsat;
+            rec.type = (char)(LN_DB_CNLANNO_UPD0 + dir);
+            rec.data.assign((const uint8_t *)&upd, (const uint8_t *)&upd + sizeof(upd));
+            anno_db.push_back(rec);
+        }
+    }
+
+    bool anno_transaction(void)
+    {
+        anno_cur = 0;
+        return !anno_db.empty();
+    }
+
+    bool anno_cur_open(void **ppCur, ln_db_cur_t Type)
+    {
+        *ppCur = &anno_cur;
+        return true;
+    }
+
+    bool cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf)
+    {
+        if (anno_cur >= anno_db.size()) {
+            return false;
+        }
+        const anno_rec_t &rec = anno_db[anno_cur++];
+        *pShortChannelId = rec.short_channel_id;
+        *pType = rec.type;
+        *pTimeStamp = 1000;
+        return utl_buf_alloccopy(pBuf, rec.data.data(), (uint32_t)rec.data.size());
+    }
+
+    bool get_ids_cnl_anno(uint64_t *pShortChannelId, uint8_t *pNodeId1, uint8_t *pNodeId2, const uint8_t *pData, uint16_t Len)
+    {
+        memcpy(pNodeId1, pData, BTC_SZ_PUBKEY);
+        memcpy(pNodeId2, pData + BTC_SZ_PUBKEY, BTC_SZ_PUBKEY);
+        return true;
+    }
+
+    bool channel_update_get_params(ln_msg_channel_update_t *pUpd, const uint8_t *pData, uint16_t Len)
+    {
+        memcpy(pUpd, pData, sizeof(ln_msg_channel_update_t));
+        return true;
+    }
+
+    //DBから再構築する
+    bool reload(void)
+    {
+        ln_routing_term();
+        ln_db_anno_transaction_fake.custom_fake = anno_transaction;
+        ln_db_anno_cur_open_fake.custom_fake = anno_cur_open;
+        ln_db_cnlanno_cur_get_fake.custom_fake = cnlanno_cur_get;
+        ln_get_ids_cnl_anno_fake.custom_fake = get_ids_cnl_anno;
+        ln_channel_update_get_params_fake.custom_fake = channel_update_get_params;
+        return ln_routing_init();
+    }
+
+    void invoice_free(ln_invoice_t *pInvoice)
+    {
+        UTL_DBG_FREE(pInvoice);
+    }
+
+    //r fieldなしのinvoiceを持つretry context
+    retry_ctx_t *retry_ctx(uint64_t PaymentId)
+    {
+        retry_ctx_t *p_ctx = (retry_ctx_t *)UTL_DBG_MALLOC(sizeof(retry_ctx_t));
+        memset(p_ctx, 0, sizeof(retry_ctx_t));
+        p_ctx->payment_id = PaymentId;
+        p_ctx->p_invoice = (ln_invoice_t *)UTL_DBG_MALLOC(sizeof(ln_invoice_t));
+        memset(p_ctx->p_invoice, 0, sizeof(ln_invoice_t));
+        p_ctx->amount_msat = 100000;
+        return p_ctx;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////
+
+class ln: public testing::Test {
+protected:
+    virtual void SetUp() {
+        RESET_FAKE(ln_db_channel_search_readonly_nokey)
+        RESET_FAKE(ln_db_route_skip_load)
+        RESET_FAKE(ln_db_route_skip_work)
+        RESET_FAKE(ln_db_route_skip_drop)
+        RESET_FAKE(ln_db_anno_transaction)
+        RESET_FAKE(ln_db_anno_commit)
+        RESET_FAKE(ln_db_anno_cur_open)
+        RESET_FAKE(ln_db_anno_cur_close)
+        RESET_FAKE(ln_db_cnlanno_cur_get)
+        RESET_FAKE(ln_status_get)
+        RESET_FAKE(ln_get_ids_cnl_anno)
+        RESET_FAKE(ln_channel_update_get_params)
+        RESET_FAKE(utl_time_time)
+        RESET_FAKE(ln_invoice_decode_free)
+
+        //DBは空
+        ln_db_route_skip_load_fake.return_val = true;
+        ln_db_anno_transaction_fake.return_val = false;
+        utl_time_time_fake.return_val = 1000;
+        ln_invoice_decode_free_fake.custom_fake = LN_DUMMY::invoice_free;
+
+        LN_DUMMY::anno_db.clear();
+
+        utl_dbg_malloc_cnt_reset();
+        ASSERT_TRUE(ln_routing_init());
+    }
+
+    virtual void TearDown() {
+        ln_routing_term();
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+//htlc_maximum_msatが支払額より小さいedgeは使わない
+TEST_F(ln, routing_htlc_maximum)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t result;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    //payer --> A --> payee: feeは安いがhtlc_maximum_msat=100,000
+    //payer --> A --> C --> payee: feeは高いがhtlc_maximum_msatは十分
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::PAYEE, 1, 100000);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 10000000);
+    LN_DUMMY::add_channel(0x400, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+
+    //htlc_maximum_msat以下: feeが安い方
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 50000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(3, result.num_hops);
+    ASSERT_EQ(0x100U, result.hop_datain[0].short_channel_id);
+    ASSERT_EQ(0x200U, result.hop_datain[1].short_channel_id);
+
+    //htlc_maximum_msatを超える: どのprofileでも0x200は通らない
+    for (int profile = 0; profile < LN_ROUTING_PROFILE_MAX; profile++) {
+        ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 500000, 0, NULL, (ln_routing_profile_t)profile));
+        ASSERT_EQ(4, result.num_hops);
+        ASSERT_EQ(0x100U, result.hop_datain[0].short_channel_id);
+        ASSERT_EQ(0x300U, result.hop_datain[1].short_channel_id);
+        ASSERT_EQ(0x400U, result.hop_datain[2].short_channel_id);
+    }
+
+    //どの経路でも運べない
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_calculate(&result, payer, payee, 9, 20000000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+}
+
+
+//payeeへのchannelが1本でも、htlc_maximum_msatの範囲で複数partが共有できる
+TEST_F(ln, routing_mpp_shared_edge)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t results[4];
+    uint8_t num;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    //payer --> A --> C --> payee
+    //payer --> B --> C --> payee
+    //  payer --> A/Bは600,000msatずつしか送れない
+    //  C --> payeeはhtlc_maximum_msat=2,000,000
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 600000);
+    LN_DUMMY::add_local(0x101, LN_DUMMY::NODE_B, 600000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 600000);
+    LN_DUMMY::add_channel(0x201, LN_DUMMY::NODE_B, LN_DUMMY::NODE_C, 1000, 600000);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 2000000);
+
+    //1経路では送れない
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_calculate(results, payer, payee, 9, 1000000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate_mpp(results, &num, 4, payer, payee, 9, 1000000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(2, num);
+    uint64_t total = 0;
+    for (int lp = 0; lp < num; lp++) {
+        ASSERT_EQ(4, results[lp].num_hops);
+        ASSERT_EQ(0x300U, results[lp].hop_datain[2].short_channel_id);
+        total += results[lp].hop_datain[3].amt_to_forward;
+    }
+    ASSERT_EQ(1000000U, total);
+    //先頭のchannelは別々
+    ASSERT_NE(results[0].hop_datain[0].short_channel_id, results[1].hop_datain[0].short_channel_id);
+
+    //共有するedgeのhtlc_maximum_msatを超える場合は見つからない
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 600000);
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_calculate_mpp(results, &num, 4, payer, payee, 9, 1000000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+}
+
+
+//reprice: HTLC制限は各channelの転送額(payeeの額 + 下流のfee)で判定する
+TEST_F(ln, routing_reprice_hop_amount)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t result;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    //payer --> A --> C --> payee
+    //  A --> Cはhtlc_maximum_msat=100,500、C --> payeeのfeeは1,000msat
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 100500);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 90000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(4, result.num_hops);
+    ASSERT_EQ(91000U, result.hop_datain[1].amt_to_forward);
+
+    //A --> Cの転送額は99,500msat
+    ASSERT_EQ(LNROUTE_OK, ln_routing_reprice(&result, 9, 98500, 0, NULL));
+    ASSERT_EQ(99500U, result.hop_datain[1].amt_to_forward);
+    ASSERT_EQ(98500U, result.hop_datain[2].amt_to_forward);
+
+    //payeeの額(100,000msat)はhtlc_maximum_msat以下だが、A --> Cの転送額(101,000msat)は超える
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_reprice(&result, 9, 100000, 0, NULL));
+}
+
+
+//検索: HTLC制限は各channelの転送額(payeeの額 + 下流のfee)で判定する
+TEST_F(ln, routing_hop_amount)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t results[4];
+    uint8_t num;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    //payer --> A --> C --> payee: feeは安いがA --> Cはhtlc_maximum_msat=100,500
+    //payer --> A --> B --> payee: feeは高いがhtlc_maximum_msatは十分
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1, 100500);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+    LN_DUMMY::add_channel(0x201, LN_DUMMY::NODE_A, LN_DUMMY::NODE_B, 1000, 10000000);
+    LN_DUMMY::add_channel(0x301, LN_DUMMY::NODE_B, LN_DUMMY::PAYEE, 1000, 10000000);
+
+    //A --> Cの転送額は99,500msat
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(results, payer, payee, 9, 98500, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(4, results[0].num_hops);
+    ASSERT_EQ(0x200U, results[0].hop_datain[1].short_channel_id);
+
+    //payeeの額(100,000msat)はhtlc_maximum_msat以下だが、A --> Cの転送額(101,000msat)は超える
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(results, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(4, results[0].num_hops);
+    ASSERT_EQ(0x201U, results[0].hop_datain[1].short_channel_id);
+    ASSERT_EQ(0x301U, results[0].hop_datain[2].short_channel_id);
+
+    //候補にもA --> Cを通る経路は入らない
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate_k(results, &num, 4, payer, payee, 9, 100000, 0, NULL, NULL, 0, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(1, num);
+    ASSERT_EQ(0x201U, results[0].hop_datain[1].short_channel_id);
+}
+
+
+//K個の候補は互いに異なり、それぞれpayeeまでつながっている
+TEST_F(ln, routing_calculate_k)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t results[4];
+    uint8_t num;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    //payer --> A --> payee
+    //payer --> A --> C --> payee
+    //payer --> B --> payee
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+    LN_DUMMY::add_local(0x101, LN_DUMMY::NODE_B, 100000000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::PAYEE, 1, 10000000);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 10000000);
+    LN_DUMMY::add_channel(0x400, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+    LN_DUMMY::add_channel(0x201, LN_DUMMY::NODE_B, LN_DUMMY::PAYEE, 500, 10000000);
+
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate_k(results, &num, 4, payer, payee, 9, 100000, 0, NULL, NULL, 0, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(3, num);
+
+    //先頭は最短経路
+    ASSERT_EQ(3, results[0].num_hops);
+    ASSERT_EQ(0x100U, results[0].hop_datain[0].short_channel_id);
+    ASSERT_EQ(0x200U, results[0].hop_datain[1].short_channel_id);
+    for (int lp = 0; lp < num; lp++) {
+        ASSERT_TRUE(LN_DUMMY::route_valid(&results[lp], 100000));
+        for (int lp2 = 0; lp2 < lp; lp2++) {
+            bool same = (results[lp].num_hops == results[lp2].num_hops);
+            for (int hop = 0; same && (hop < results[lp].num_hops - 1); hop++) {
+                same = (results[lp].hop_datain[hop].short_channel_id == results[lp2].hop_datain[hop].short_channel_id);
+            }
+            ASSERT_FALSE(same);
+        }
+
+        //候補はそのまま再計算できる
+        ln_routing_result_t result;
+        memcpy(&result, &results[lp], sizeof(result));
+        ASSERT_EQ(LNROUTE_OK, ln_routing_reprice(&result, 9, 100000, 0, NULL));
+        ASSERT_EQ(0, memcmp(&result, &results[lp], sizeof(result)));
+    }
+
+    //1個だけ
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate_k(results, &num, 1, payer, payee, 9, 100000, 0, NULL, NULL, 0, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(1, num);
+    ASSERT_EQ(0x200U, results[0].hop_datain[1].short_channel_id);
+}
+
+
+//除外したchannelは候補に入らない
+TEST_F(ln, routing_calculate_k_exclude)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t results[4];
+    uint8_t num;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+    LN_DUMMY::add_local(0x101, LN_DUMMY::NODE_B, 100000000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::PAYEE, 1, 10000000);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 10000000);
+    LN_DUMMY::add_channel(0x400, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+    LN_DUMMY::add_channel(0x201, LN_DUMMY::NODE_B, LN_DUMMY::PAYEE, 500, 10000000);
+
+    //announceされたchannel
+    const uint64_t EXCLUDE1[] = { 0x200 };
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate_k(results, &num, 4, payer, payee, 9, 100000, 0, NULL, EXCLUDE1, 1, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(2, num);
+    for (int lp = 0; lp < num; lp++) {
+        ASSERT_TRUE(LN_DUMMY::route_valid(&results[lp], 100000));
+        ASSERT_FALSE(LN_DUMMY::route_has(&results[lp], 0x200));
+    }
+    ASSERT_EQ(0x201U, results[0].hop_datain[1].short_channel_id);
+
+    //自channel(一時edge)
+    const uint64_t EXCLUDE2[] = { 0x101, 0x400 };
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate_k(results, &num, 4, payer, payee, 9, 100000, 0, NULL, EXCLUDE2, 2, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(1, num);
+    ASSERT_EQ(0x100U, results[0].hop_datain[0].short_channel_id);
+    ASSERT_EQ(0x200U, results[0].hop_datain[1].short_channel_id);
+
+    //全部除外
+    const uint64_t EXCLUDE3[] = { 0x200, 0x201, 0x400 };
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_calculate_k(results, &num, 4, payer, payee, 9, 100000, 0, NULL, EXCLUDE3, 3, LN_ROUTING_PROFILE_FEE));
+}
+
+
+//reprice: 削除・route skip・HTLC制限外のchannelがあれば失敗する
+TEST_F(ln, routing_reprice_unusable)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t route;
+    ln_routing_result_t result;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 1000000);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 1000000);
+
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&route, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(4, route.num_hops);
+
+    //額とCLTVは計算し直す
+    memcpy(&result, &route, sizeof(result));
+    ASSERT_EQ(LNROUTE_OK, ln_routing_reprice(&result, 19, 200000, 0, NULL));
+    ASSERT_EQ(200000U, result.hop_datain[3].amt_to_forward);
+    ASSERT_EQ(201000U, result.hop_datain[1].amt_to_forward);
+    ASSERT_EQ(route.hop_datain[3].outgoing_cltv_value + 10, result.hop_datain[3].outgoing_cltv_value);
+
+    //HTLC制限外
+    memcpy(&result, &route, sizeof(result));
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_reprice(&result, 9, 2000000, 0, NULL));
+
+    //route skip
+    ln_routing_skip_add(0x300, true, 0);
+    memcpy(&result, &route, sizeof(result));
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_reprice(&result, 9, 100000, 0, NULL));
+    //WORKは重くなるだけで使える
+    ln_routing_skip_work(true);
+    memcpy(&result, &route, sizeof(result));
+    ASSERT_EQ(LNROUTE_OK, ln_routing_reprice(&result, 9, 100000, 0, NULL));
+    ln_routing_skip_drop(false);
+
+    //channel削除
+    ln_routing_cnlanno_del(0x200);
+    memcpy(&result, &route, sizeof(result));
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_reprice(&result, 9, 100000, 0, NULL));
+
+    //自channel削除
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 1000000);
+    memcpy(&result, &route, sizeof(result));
+    ASSERT_EQ(LNROUTE_OK, ln_routing_reprice(&result, 9, 100000, 0, NULL));
+    ln_routing_channel_del(0x100);
+    memcpy(&result, &route, sizeof(result));
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_reprice(&result, 9, 100000, 0, NULL));
+}
+
+
+//retry contextはM_RETRY_CTX_MAXを超えると古いものから解放する
+TEST_F(ln, payment_retry_ctx_evict)
+{
+    //同じpayment_idは置き換え
+    ctx_checkin(LN_DUMMY::retry_ctx(1));
+    ctx_checkin(LN_DUMMY::retry_ctx(1));
+    ASSERT_EQ(1, mRetryCtxNum);
+    ASSERT_EQ(1U, ln_invoice_decode_free_fake.call_count);
+
+    for (uint64_t id = 2; id <= M_RETRY_CTX_MAX; id++) {
+        ctx_checkin(LN_DUMMY::retry_ctx(id));
+    }
+    ASSERT_EQ(M_RETRY_CTX_MAX, mRetryCtxNum);
+    ASSERT_EQ(1U, ln_invoice_decode_free_fake.call_count);
+
+    //1を使うと新しくなり、次に追い出されるのは2
+    retry_ctx_t *p_ctx = ctx_checkout(1);
+    ASSERT_TRUE(p_ctx != NULL);
+    ASSERT_EQ(M_RETRY_CTX_MAX - 1, mRetryCtxNum);
+    ctx_checkin(p_ctx);
+    ctx_checkin(LN_DUMMY::retry_ctx(M_RETRY_CTX_MAX + 1));
+    ASSERT_EQ(M_RETRY_CTX_MAX, mRetryCtxNum);
+    ASSERT_EQ(2U, ln_invoice_decode_free_fake.call_count);
+    ASSERT_TRUE(ctx_checkout(2) == NULL);
+
+    //partのcontextは失敗したchannelを引き継ぎ、候補は引き継がない
+    p_ctx = ctx_checkout(1);
+    ASSERT_TRUE(p_ctx != NULL);
+    ctx_exclude(p_ctx, 0x200);
+    p_ctx->cand_num = 1;
+    retry_ctx_t *p_part = ctx_dup(p_ctx, 100, 50000);
+    ASSERT_TRUE(p_part != NULL);
+    ASSERT_EQ(100U, p_part->payment_id);
+    ASSERT_EQ(50000U, p_part->amount_msat);
+    ASSERT_EQ(0, p_part->cand_num);
+    ASSERT_EQ(1, p_part->exclude_num);
+    ASSERT_EQ(0x200U, p_part->exclude[0]);
+    ASSERT_TRUE(p_part->p_invoice != p_ctx->p_invoice);
+    ctx_free(p_part);
+    ctx_free(p_ctx);
+
+    for (uint64_t id = 3; id <= M_RETRY_CTX_MAX + 1; id++) {
+        p_ctx = ctx_checkout(id);
+        ASSERT_TRUE(p_ctx != NULL);
+        ctx_free(p_ctx);
+    }
+    ASSERT_EQ(0, mRetryCtxNum);
+    ASSERT_EQ(0, utl_dbg_malloc_cnt());
+}
+
+
+//DBから構築したgraphに、後から受信したchannel_updateや削除が反映される
+TEST_F(ln, routing_load_update)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t result;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    //payer --> A --> payee
+    //payer --> A --> C --> payee
+    LN_DUMMY::db_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::PAYEE, 1, 10000000);
+    LN_DUMMY::db_channel(0x300, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 10000000);
+    LN_DUMMY::db_channel(0x400, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+    ASSERT_TRUE(LN_DUMMY::reload());
+    ASSERT_EQ(3U, mpRouting->channels.size());
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(3, result.num_hops);
+    ASSERT_EQ(0x200U, result.hop_datain[1].short_channel_id);
+
+    //A --> payee(dir0)のfeeが上がる
+    ln_msg_channel_update_t upd;
+    memset(&upd, 0, sizeof(upd));
+    upd.short_channel_id = 0x200;
+    upd.timestamp = 1001;
+    upd.channel_flags = 0;
+    upd.cltv_expiry_delta = 40;
+    upd.fee_base_msat = 5000;
+    upd.htlc_maximum_msat = 10000000;
+    ln_routing_cnlupd_update(&upd);
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(4, result.num_hops);
+    ASSERT_EQ(0x300U, result.hop_datain[1].short_channel_id);
+    ASSERT_EQ(0x400U, result.hop_datain[2].short_channel_id);
+
+    //古いchannel_updateは反映しない
+    upd.timestamp = 999;
+    upd.fee_base_msat = 1;
+    ln_routing_cnlupd_update(&upd);
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(0x300U, result.hop_datain[1].short_channel_id);
+
+    //C --> payeeのchannel削除
+    ln_routing_cnlanno_del(0x400);
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(3, result.num_hops);
+    ASSERT_EQ(0x200U, result.hop_datain[1].short_channel_id);
+    ASSERT_EQ(105000U, result.hop_datain[0].amt_to_forward);
+
+    //A --> payee(dir0)のchannel_update削除
+    ln_routing_cnlupd_del(0x200, 0);
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+}
+
+
+namespace LN_DUMMY {
+    //DB読込み中(load_db())に受信した更新
+    void anno_commit_update(bool bCommit)
+    {
+        ln_routing_cnlanno_del(0x200);
+        add_channel(0x300, NODE_A, NODE_C, 1000, 10000000);
+        add_channel(0x400, NODE_C, PAYEE, 1000, 10000000);
+    }
+}
+
+
+//構築中に受けた更新は、構築後のgraphに反映される
+TEST_F(ln, routing_load_pending)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t result;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    LN_DUMMY::db_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::PAYEE, 1, 10000000);
+    ln_db_anno_commit_fake.custom_fake = LN_DUMMY::anno_commit_update;
+    ASSERT_TRUE(LN_DUMMY::reload());
+    ln_db_anno_commit_fake.custom_fake = NULL;
+    ASSERT_FALSE(mBuilding);
+    ASSERT_TRUE(mPendingOps.empty());
+    ASSERT_EQ(2U, mpRouting->channels.size());
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(4, result.num_hops);
+    ASSERT_EQ(0x300U, result.hop_datain[1].short_channel_id);
+    ASSERT_EQ(0x400U, result.hop_datain[2].short_channel_id);
+}
+
+
+//route skipは有効期限を過ぎると使えるようになる
+TEST_F(ln, routing_skip_expiry)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t result;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+    LN_DUMMY::add_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::PAYEE, 1, 10000000);
+    LN_DUMMY::add_channel(0x300, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 10000000);
+    LN_DUMMY::add_channel(0x400, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+
+    //0x200は2000まで、0x400は期限なし
+    ln_routing_skip_add(0x200, true, 2000);
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(0x300U, result.hop_datain[1].short_channel_id);
+    ln_routing_skip_add(0x400, false, 0);
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+
+    //期限直前
+    utl_time_time_fake.return_val = 1999;
+    ASSERT_EQ(LNROUTE_NOTFOUND, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(2U, mpRouting->skip.size());
+
+    //期限切れ: entryも削除される
+    utl_time_time_fake.return_val = 2000;
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(0x200U, result.hop_datain[1].short_channel_id);
+    ASSERT_EQ(1U, mpRouting->skip.size());
+    ASSERT_TRUE(mpRouting->skip.find(0x400) != mpRouting->skip.end());
+
+    //一時的なskipだけ削除: PERMは残る
+    ln_routing_skip_add(0x200, true, 0);
+    ln_routing_skip_drop(true);
+    ASSERT_EQ(1U, mpRouting->skip.size());
+    ASSERT_TRUE(mpRouting->skip.find(0x400) != mpRouting->skip.end());
+}
+
+
+namespace LN_DUMMY {
+    //route skip DB
+    std::map<uint64_t, skip_t> skip_db;
+
+    bool route_skip_load(ln_db_func_route_skip_t pFunc, void *pParam)
+    {
+        uint64_t now = (uint64_t)utl_time_time();
+        for (std::map<uint64_t, skip_t>::const_iterator it = skip_db.begin(); it != skip_db.end(); ++it) {
+            if (!skip_expired(it->second, now)) {
+                (*pFunc)(it->first, it->second.type, it->second.expiry, pParam);
+            }
+        }
+        return true;
+    }
+
+    //ln_db_lmdb.cと同じく、DBから削除できたらgraphに反映する
+    bool route_skip_drop(bool bTemp)
+    {
+        if (!bTemp) {
+            skip_db.clear();
+        }
+        ln_routing_skip_drop(bTemp);
+        return true;
+    }
+
+    bool route_skip_drop_fail(bool bTemp)
+    {
+        return false;
+    }
+}
+
+
+//DBから読み込んだroute skipと、route skip DB削除
+TEST_F(ln, routing_clear_skipdb)
+{
+    uint8_t payer[BTC_SZ_PUBKEY];
+    uint8_t payee[BTC_SZ_PUBKEY];
+    ln_routing_result_t result;
+
+    LN_DUMMY::node_id(payer, LN_DUMMY::PAYER);
+    LN_DUMMY::node_id(payee, LN_DUMMY::PAYEE);
+
+    LN_DUMMY::db_channel(0x200, LN_DUMMY::NODE_A, LN_DUMMY::PAYEE, 1, 10000000);
+    LN_DUMMY::db_channel(0x300, LN_DUMMY::NODE_A, LN_DUMMY::NODE_C, 1000, 10000000);
+    LN_DUMMY::db_channel(0x400, LN_DUMMY::NODE_C, LN_DUMMY::PAYEE, 1000, 10000000);
+
+    //期限切れのentryは読み込まない
+    LN_DUMMY::skip_db.clear();
+    LN_DUMMY::skip_db[0x200].type = LN_DB_ROUTE_SKIP_PERM;
+    LN_DUMMY::skip_db[0x200].expiry = 0;
+    LN_DUMMY::skip_db[0x400].type = LN_DB_ROUTE_SKIP_TEMP;
+    LN_DUMMY::skip_db[0x400].expiry = 1000;
+    ln_db_route_skip_load_fake.custom_fake = LN_DUMMY::route_skip_load;
+    ASSERT_TRUE(LN_DUMMY::reload());
+    ASSERT_EQ(1U, mpRouting->skip.size());
+    LN_DUMMY::add_local(0x100, LN_DUMMY::NODE_A, 100000000);
+
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(0x300U, result.hop_datain[1].short_channel_id);
+
+    //DBから削除できなければgraphもそのまま
+    ln_db_route_skip_drop_fake.custom_fake = LN_DUMMY::route_skip_drop_fail;
+    ln_routing_clear_skipdb();
+    ASSERT_FALSE(ln_db_route_skip_drop_fake.arg0_val);
+    ASSERT_EQ(1U, mpRouting->skip.size());
+
+    //DBとgraphの両方から削除される
+    ln_db_route_skip_drop_fake.custom_fake = LN_DUMMY::route_skip_drop;
+    ln_routing_clear_skipdb();
+    ASSERT_TRUE(LN_DUMMY::skip_db.empty());
+    ASSERT_TRUE(mpRouting->skip.empty());
+    ASSERT_EQ(LNROUTE_OK, ln_routing_calculate(&result, payer, payee, 9, 100000, 0, NULL, LN_ROUTING_PROFILE_FEE));
+    ASSERT_EQ(0x200U, result.hop_datain[1].short_channel_id);
+
+    //再構築しても同じ
+    ASSERT_TRUE(LN_DUMMY::reload());
+    ASSERT_TRUE(mpRouting->skip.empty());
+}
@@ -114,7 +114,7 @@ TEST_F(onion, testvector)
         hop_datain[lp].outgoing_cltv_value = 0;
         memcpy(hop_datain[lp].pubkey, PUB[lp], BTC_SZ_PUBKEY);
     }
-    bool ret = ln_onion_create_packet(packet, NULL, hop_datain, 5, SESSIONKEY, ASSOC, sizeof(ASSOC));
+    bool ret = ln_onion_create_packet(packet, NULL, hop_datain, 5, 0, SESSIONKEY, ASSOC, sizeof(ASSOC));
     ASSERT_TRUE(ret);
 
     const uint8_t SHDSECRET[] = {
@@ -1061,7 +1061,7 @@ TEST_F(onion, testvector_failure_resolve_api)
     }
     utl_buf_t shared_secrets = UTL_BUF_INIT;
 
-    bool ret = ln_onion_create_packet(packet, &shared_secrets, hop_datain, 5, SESSIONKEY, ASSOC, sizeof(ASSOC));
+    bool ret = ln_onion_create_packet(packet, &shared_secrets, hop_datain, 5, 0, SESSIONKEY, ASSOC, sizeof(ASSOC));
     ASSERT_TRUE(ret);
     ASSERT_EQ(5 * BTC_SZ_PRIVKEY, shared_secrets.len);
 
@@ -1146,7 +1146,7 @@ TEST_F(onion, test1)
 
     uint8_t pub[BTC_SZ_PUBKEY];
     btc_keys_priv2pub(pub, session_key);
-    bool ret = ln_onion_create_packet(packet, NULL, datain, 1, session_key, NULL, 0);
+    bool ret = ln_onion_create_packet(packet, NULL, datain, 1, 0, session_key, NULL, 0);
     ASSERT_TRUE(ret);
 
     const uint8_t PACKET[] = {
@@ -1361,7 +1361,7 @@ TEST_F(onion, test2)
         btc_keys_priv2pub(datain[lp].pubkey, onion_privkey[lp]);
     }
 
-    bool ret = ln_onion_create_packet(packet, NULL, datain, 20, session_key, NULL, 0);
+    bool ret = ln_onion_create_packet(packet, NULL, datain, 20, 0, session_key, NULL, 0);
     ASSERT_TRUE(ret);
 
     const uint8_t PACKET[] = {
@@ -1585,7 +1585,7 @@ TEST_F(onion, test3)
         btc_keys_priv2pub(datain[lp].pubkey, onion_privkey[lp]);
     }
 
-    bool ret = ln_onion_create_packet(packet, NULL, datain, 20, session_key, NULL, 0);
+    bool ret = ln_onion_create_packet(packet, NULL, datain, 20, 0, session_key, NULL, 0);
     ASSERT_TRUE(ret);
 
     ln_hop_dataout_t dataout;
@@ -1635,7 +1635,7 @@ TEST_F(onion, test4)
 
     const uint8_t ASSOC[] = { 'A', 'b', 'C', 'd', 'E' };
 
-    bool ret = ln_onion_create_packet(packet, NULL, datain, 20, session_key, ASSOC, sizeof(ASSOC));
+    bool ret = ln_onion_create_packet(packet, NULL, datain, 20, 0, session_key, ASSOC, sizeof(ASSOC));
     ASSERT_TRUE(ret);
 
     ln_hop_dataout_t dataout;
@@ -1658,3 +1658,51 @@ TEST_F(onion, test4)
     }
 }
 
+
+
+//multi-path paymentの合計額は最終hopだけに入る
+TEST_F(onion, test_total_msat)
+{
+    uint8_t session_key[BTC_SZ_PRIVKEY];
+    uint8_t onion_privkey[3][BTC_SZ_PRIVKEY];
+    ln_hop_datain_t datain[3];
+    uint8_t packet[LN_SZ_ONION_ROUTE];
+
+    memset(session_key, 'A', sizeof(session_key));
+    for (int lp = 0; lp < ARRAY_SIZE(datain); lp++) {
+        datain[lp].short_channel_id = (lp == ARRAY_SIZE(datain) - 1) ? 0 : (uint64_t)(lp + 1);
+        datain[lp].amt_to_forward = 500000;
+        datain[lp].outgoing_cltv_value = 100;
+        memset(onion_privkey[lp], lp + 1, BTC_SZ_PRIVKEY);
+        btc_keys_priv2pub(datain[lp].pubkey, onion_privkey[lp]);
+    }
+
+    const uint8_t ASSOC[] = { 'A', 'b', 'C', 'd', 'E' };
+
+    for (int mpp = 0; mpp < 2; mpp++) {
+        const uint64_t TOTAL = (mpp) ? 1000000 : 0;
+        bool ret = ln_onion_create_packet(packet, NULL, datain, 3, TOTAL, session_key, ASSOC, sizeof(ASSOC));
+        ASSERT_TRUE(ret);
+
+        ln_hop_dataout_t dataout;
+        for (int lp = 0; lp < 3; lp++) {
+            ln_node_setkey(onion_privkey[lp]);
+            utl_buf_t buf_rsn = UTL_BUF_INIT;
+            utl_push_t push_rsn;
+            utl_push_init(&push_rsn, &buf_rsn, 0);
+            ret = ln_onion_read_packet(packet, &dataout, NULL, &push_rsn, packet, ASSOC, sizeof(ASSOC));
+            ASSERT_TRUE(ret);
+            ASSERT_EQ(datain[lp].short_channel_id, dataout.short_channel_id);
+            ASSERT_EQ(datain[lp].amt_to_forward, dataout.amt_to_forward);
+            utl_buf_free(&buf_rsn);
+
+            if (lp == 2) {
+                ASSERT_TRUE(dataout.b_exit);
+                ASSERT_EQ(TOTAL, dataout.total_msat);
+            } else {
+                ASSERT_TRUE(!dataout.b_exit);
+                ASSERT_EQ(0U, dataout.total_msat);
+            }
+        }
+    }
+}
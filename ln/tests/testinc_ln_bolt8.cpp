@@ -1433,6 +1433,8 @@ TEST_F(bolt8test, enc_dec)
     memcpy(noise_dec.recv_ctx.ck, CK, sizeof(CK));
     noise_dec.send_ctx.nonce = 0;
     noise_dec.recv_ctx.nonce = 0;
+    ln_noise_cipher_init(&noise);
+    ln_noise_cipher_init(&noise_dec);
 
     utl_buf_t bufin = UTL_BUF_INIT;
     utl_buf_t buf = UTL_BUF_INIT;
@@ -1661,3 +1663,166 @@ TEST_F(bolt8test, enc_dec)
 
     utl_buf_free(&bufin);
 }
+
+
+TEST_F(bolt8test, enc_dec_arena)
+{
+    bool ret;
+    ln_noise_t noise;
+    ln_noise_t noise_dec;
+
+    const uint8_t SK[] = {
+        0x96, 0x9a, 0xb3, 0x1b, 0x4d, 0x28, 0x8c, 0xed,
+        0xf6, 0x21, 0x88, 0x39, 0xb2, 0x7a, 0x3e, 0x21,
+        0x40, 0x82, 0x70, 0x47, 0xf2, 0xc0, 0xf0, 0x1b,
+        0xf5, 0xc0, 0x44, 0x35, 0xd4, 0x35, 0x11, 0xa9,
+    };
+    const uint8_t RK[] = {
+        0xbb, 0x90, 0x20, 0xb8, 0x96, 0x5f, 0x4d, 0xf0,
+        0x47, 0xe0, 0x7f, 0x95, 0x5f, 0x3c, 0x4b, 0x88,
+        0x41, 0x89, 0x84, 0xaa, 0xdc, 0x5c, 0xdb, 0x35,
+        0x09, 0x6b, 0x9e, 0xa8, 0xfa, 0x5c, 0x34, 0x42,
+    };
+    const uint8_t CK[] = {
+        0x91, 0x92, 0x19, 0xdb, 0xb2, 0x92, 0x0a, 0xfa,
+        0x8d, 0xb8, 0x0f, 0x9a, 0x51, 0x78, 0x7a, 0x84,
+        0x0b, 0xcf, 0x11, 0x1e, 0xd8, 0xd5, 0x88, 0xca,
+        0xf9, 0xab, 0x4b, 0xe7, 0x16, 0xe4, 0x2b, 0x01,
+    };
+    const uint8_t OUTPUT0[] = {
+        0xcf, 0x2b, 0x30, 0xdd, 0xf0, 0xcf, 0x3f, 0x80,
+        0xe7, 0xc3, 0x5a, 0x6e, 0x67, 0x30, 0xb5, 0x9f,
+        0xe8, 0x02, 0x47, 0x31, 0x80, 0xf3, 0x96, 0xd8,
+        0x8a, 0x8f, 0xb0, 0xdb, 0x8c, 0xbc, 0xf2, 0x5d,
+        0x2f, 0x21, 0x4c, 0xf9, 0xea, 0x1d, 0x95,
+    };
+
+    memcpy(noise.send_ctx.key, SK, sizeof(SK));
+    memcpy(noise.send_ctx.ck, CK, sizeof(CK));
+    noise.send_ctx.nonce = 0;
+    memcpy(noise_dec.recv_ctx.key, SK, sizeof(SK));
+    memcpy(noise_dec.recv_ctx.ck, CK, sizeof(CK));
+    noise_dec.recv_ctx.nonce = 0;
+    ln_noise_cipher_init(&noise);
+    ln_noise_cipher_init(&noise_dec);
+
+    utl_arena_t arena;
+    utl_arena_init(&arena, 0);
+
+    utl_buf_t bufin = UTL_BUF_INIT;
+    utl_buf_t buf = UTL_BUF_INIT;
+    utl_buf_t buf_dec = UTL_BUF_INIT;
+    uint16_t len;
+
+    utl_buf_alloccopy(&bufin, (const uint8_t *)"hello", 5);
+
+    for (int lp = 0; lp < 1001; lp++) {
+        ret = ln_noise_enc_arena(&noise, &buf, &bufin, &arena);
+        ASSERT_TRUE(ret);
+        ASSERT_EQ(LN_SZ_NOISE_ENC(5), buf.len);
+        if (lp == 0) {
+            ASSERT_EQ(sizeof(OUTPUT0), buf.len);
+            ASSERT_EQ(0, memcmp(OUTPUT0, buf.buf, sizeof(OUTPUT0)));
+        }
+
+        //dec
+        len = ln_noise_dec_len(&noise_dec, buf.buf, LN_SZ_NOISE_HEADER);
+        ASSERT_EQ(5 + 16, len);
+        ASSERT_TRUE(utl_arena_buf_alloccopy(&arena, &buf_dec, buf.buf + LN_SZ_NOISE_HEADER, len));
+        ret = ln_noise_dec_msg(&noise_dec, &buf_dec);
+        ASSERT_TRUE(ret);
+        ASSERT_EQ(5, buf_dec.len);
+        ASSERT_EQ(0, memcmp(buf_dec.buf, "hello", 5));
+
+        //1message分をまとめて解放
+        utl_arena_reset(&arena);
+    }
+    //chunkは再利用している
+    ASSERT_EQ(1, arena.chunk_cnt);
+    ASSERT_EQ(1001 * 2, arena.alloc_cnt);
+
+    utl_arena_free(&arena);
+    utl_buf_free(&bufin);
+}
+
+
+TEST_F(bolt8test, enc_dec_inplace)
+{
+    bool ret;
+    ln_noise_t noise;
+    ln_noise_t noise_dec;
+
+    const uint8_t SK[] = {
+        0x96, 0x9a, 0xb3, 0x1b, 0x4d, 0x28, 0x8c, 0xed,
+        0xf6, 0x21, 0x88, 0x39, 0xb2, 0x7a, 0x3e, 0x21,
+        0x40, 0x82, 0x70, 0x47, 0xf2, 0xc0, 0xf0, 0x1b,
+        0xf5, 0xc0, 0x44, 0x35, 0xd4, 0x35, 0x11, 0xa9,
+    };
+    const uint8_t CK[] = {
+        0x91, 0x92, 0x19, 0xdb, 0xb2, 0x92, 0x0a, 0xfa,
+        0x8d, 0xb8, 0x0f, 0x9a, 0x51, 0x78, 0x7a, 0x84,
+        0x0b, 0xcf, 0x11, 0x1e, 0xd8, 0xd5, 0x88, 0xca,
+        0xf9, 0xab, 0x4b, 0xe7, 0x16, 0xe4, 0x2b, 0x01,
+    };
+    const uint8_t OUTPUT0[] = {
+        0xcf, 0x2b, 0x30, 0xdd, 0xf0, 0xcf, 0x3f, 0x80,
+        0xe7, 0xc3, 0x5a, 0x6e, 0x67, 0x30, 0xb5, 0x9f,
+        0xe8, 0x02, 0x47, 0x31, 0x80, 0xf3, 0x96, 0xd8,
+        0x8a, 0x8f, 0xb0, 0xdb, 0x8c, 0xbc, 0xf2, 0x5d,
+        0x2f, 0x21, 0x4c, 0xf9, 0xea, 0x1d, 0x95,
+    };
+    const uint8_t OUTPUT1000[] = {
+        0x4a, 0x2f, 0x3c, 0xc3, 0xb5, 0xe7, 0x8d, 0xdb,
+        0x83, 0xdc, 0xb4, 0x26, 0xd9, 0x86, 0x3d, 0x9d,
+        0x9a, 0x72, 0x3b, 0x03, 0x37, 0xc8, 0x9d, 0xd0,
+        0xb0, 0x05, 0xd8, 0x9f, 0x8d, 0x3c, 0x05, 0xc5,
+        0x2b, 0x76, 0xb2, 0x9b, 0x74, 0x0f, 0x09,
+    };
+    const uint8_t OUTPUT1001[] = {
+        0x2e, 0xcd, 0x8c, 0x8a, 0x56, 0x29, 0xd0, 0xd0,
+        0x2a, 0xb4, 0x57, 0xa0, 0xfd, 0xd0, 0xf7, 0xb9,
+        0x0a, 0x19, 0x2c, 0xd4, 0x6b, 0xe5, 0xec, 0xb6,
+        0xca, 0x57, 0x0b, 0xfc, 0x5e, 0x26, 0x83, 0x38,
+        0xb1, 0xa1, 0x6c, 0xf4, 0xef, 0x2d, 0x36,
+    };
+
+    memset(&noise, 0, sizeof(noise));
+    memset(&noise_dec, 0, sizeof(noise_dec));
+    memcpy(noise.send_ctx.key, SK, sizeof(SK));
+    memcpy(noise.send_ctx.ck, CK, sizeof(CK));
+    memcpy(noise_dec.recv_ctx.key, SK, sizeof(SK));
+    memcpy(noise_dec.recv_ctx.ck, CK, sizeof(CK));
+    ln_noise_cipher_init(&noise);
+    ln_noise_cipher_init(&noise_dec);
+
+    uint8_t data[LN_SZ_NOISE_ENC(5)];
+    utl_buf_t buf_dec;
+    uint16_t len;
+
+    for (int lp = 0; lp < 1002; lp++) {
+        //平文はheaderの後ろに置く
+        memcpy(data + LN_SZ_NOISE_HEADER, "hello", 5);
+        ret = ln_noise_enc_inplace(&noise, data, 5);
+        ASSERT_TRUE(ret);
+        if (lp == 0) {
+            ASSERT_EQ(0, memcmp(OUTPUT0, data, sizeof(OUTPUT0)));
+        } else if (lp == 1000) {
+            ASSERT_EQ(0, memcmp(OUTPUT1000, data, sizeof(OUTPUT1000)));
+        } else if (lp == 1001) {
+            ASSERT_EQ(0, memcmp(OUTPUT1001, data, sizeof(OUTPUT1001)));
+        }
+
+        //dec
+        len = ln_noise_dec_len(&noise_dec, data, LN_SZ_NOISE_HEADER);
+        ASSERT_EQ(5 + 16, len);
+        buf_dec.buf = data + LN_SZ_NOISE_HEADER;
+        buf_dec.len = len;
+        ret = ln_noise_dec_msg(&noise_dec, &buf_dec);
+        ASSERT_TRUE(ret);
+        ASSERT_EQ(5, buf_dec.len);
+        ASSERT_EQ(0, memcmp(buf_dec.buf, "hello", 5));
+    }
+    //key rotationは1000 nonce毎(1message = 2 nonce)
+    ASSERT_EQ(4, noise.send_ctx.nonce);
+    ASSERT_EQ(4, noise_dec.recv_ctx.nonce);
+}
@@ -321,7 +321,7 @@ static void print_help(void)
     fprintf(stderr, "\t\t--listinvoice : list created invoices\n");
     fprintf(stderr, "\t\t--removeinvoice PAYMENT_HASH or ALL : erase payment_hash\n");
     fprintf(stderr, "\tPAYMENT:\n");
-    fprintf(stderr, "\t\t--sendpayment BOLT#11_INVOICE[,ADDITIONAL AMOUNT_MSAT] : payment(don't put a space before or after the comma)\n");
+    fprintf(stderr, "\t\t--sendpayment BOLT#11_INVOICE[,ADDITIONAL AMOUNT_MSAT[,PROFILE[,MAX_PARTS]]] : payment(don't put a space before or after the comma)\n");
     fprintf(stderr, "\t\t--listpayment : list payments\n");
     fprintf(stderr, "\t\t--removepayment PAYMENT_ID : remove a payment from the payment list\n");
     fprintf(stderr, "\n");
@@ -1115,6 +1115,8 @@ static void routepay(int *pOption)
 {
     const char *invoice = strtok(optarg, ",");
     const char *add_amount_str = strtok(NULL, ",");
+    const char *profile_str = strtok(NULL, ",");
+    const char *max_parts_str = strtok(NULL, ",");
 
     uint64_t add_amount_msat = 0;
     if (add_amount_str != NULL) {
@@ -1128,7 +1130,37 @@ static void routepay(int *pOption)
         }
     }
 
-    if (*pOption != M_OPTIONS_ERR) {
+    int max_parts = 1;
+    if ((*pOption != M_OPTIONS_ERR) && (max_parts_str != NULL)) {
+        //multi-path paymentの最大分割数(payeeがptarmiganの場合だけ指定する)
+        max_parts = (int)strtol(max_parts_str, NULL, 10);
+        if (max_parts < 1) {
+            sprintf(mErrStr, "invalid max parts");
+            *pOption = M_OPTIONS_ERR;
+        }
+    }
+
+    if ((*pOption != M_OPTIONS_ERR) && (max_parts_str != NULL)) {
+        snprintf(mBuf, BUFFER_SIZE,
+            "{"
+                M_STR("method", "routepay") M_NEXT
+                M_QQ("params") ":[ "
+                    //bolt11, add_amount_msat, profile, max_parts
+                    M_QQ("%s") ",%" PRIu64 "," M_QQ("%s") ",%d]}",
+                invoice, add_amount_msat, profile_str, max_parts);
+
+        *pOption = M_OPTIONS_EXEC;
+    } else if ((*pOption != M_OPTIONS_ERR) && (profile_str != NULL)) {
+        snprintf(mBuf, BUFFER_SIZE,
+            "{"
+                M_STR("method", "routepay") M_NEXT
+                M_QQ("params") ":[ "
+                    //bolt11, add_amount_msat, profile
+                    M_QQ("%s") ",%" PRIu64 "," M_QQ("%s") "]}",
+                invoice, add_amount_msat, profile_str);
+
+        *pOption = M_OPTIONS_EXEC;
+    } else if (*pOption != M_OPTIONS_ERR) {
         snprintf(mBuf, BUFFER_SIZE,
             "{"
                 M_STR("method", "routepay") M_NEXT
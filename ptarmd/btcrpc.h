@@ -95,6 +95,16 @@ bool btcrpc_get_short_channel_param(const uint8_t *pPeerId, int32_t *pBHeight, i
 bool btcrpc_gettxid_from_short_channel(uint8_t *pTxid, int BHeight, int BIndex);
 
 
+/** [bitcoin IF]get raw block
+ *
+ * @param[out]  pBlock      raw block(after using, clear with `utl_buf_free()`)
+ * @param[in]   BHeight     block height
+ * @retval  true        success
+ * @retval  false       not supported or bitcoind error
+ */
+bool btcrpc_getrawblock(utl_buf_t *pBlock, int BHeight);
+
+
 /** [bitcoin IF]search outpoint matched transaction from blocks
  *
  * @param[out]  pTx         transaction
@@ -165,6 +175,20 @@ bool btcrpc_is_tx_broadcasted(const uint8_t *pTxid);
 bool btcrpc_check_unspent(const uint8_t *pPeerId, bool *pUnspent, uint64_t *pSat, const uint8_t *pTxid, uint32_t VIndex);
 
 
+/** [bitcoin IF]vout unspent確認(scriptPubKey取得)
+ *
+ * #btcrpc_check_unspent()と異なり、transactionの存在確認は行わない(block内のTXID用)。
+ *
+ * @param[out]  pUnspent        (success)true:unspent
+ * @param[out]  pScriptPubKey   [bitcoind](success and unspent)scriptPubKey(after using, clear with `utl_buf_free()`)
+ *                              [SPV]not set
+ * @param[in]   pTxid
+ * @param[in]   VIndex
+ * @retval  true        success
+ */
+bool btcrpc_gettxout(bool *pUnspent, utl_buf_t *pScriptPubKey, const uint8_t *pTxid, uint32_t VIndex);
+
+
 /** [bitcoin IF]getnewaddress
  *
  * @param[out]  pAddr       address
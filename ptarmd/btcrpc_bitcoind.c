@@ -32,6 +32,8 @@
 #include "utl_str.h"
 #include "utl_push.h"
 
+#include "btc_block.h"
+
 #include "btcrpc.h"
 
 
@@ -42,6 +44,10 @@
 #define TXJSON_SIZE     (1024)              //rawtx JSON-RPC送信用バッファ
 #define BUFFER_SIZE     (256 * 1024)        //JSON-RPCレスポンスバッファの初期サイズ
 
+#define M_RPC_POOL_NUM      (4)             ///< 同時に実行できるRPC数(keep-aliveで接続を保持する)
+#define M_RPC_BATCH_NUM     (200)           ///< batch requestで1回に送信するRPC数
+#define M_RPC_BATCH_ITEM    (160)           ///< batch request 1RPCあたりのバッファサイズ
+
 #define M_RPCHEADER         "\"jsonrpc\": \"1.0\", \"id\": \"ptarmdrpc\""
 #define M_NEXT              ","
 #define M_QQ(str)           "\"" str "\""
@@ -66,18 +72,58 @@ typedef struct {
 } write_result_t;
 
 
+/** @struct search_outpoint_t
+ *  @brief  #search_outpoint_cb()のパラメータ
+ */
+typedef struct {
+    btc_tx_t            *p_tx;          ///< [out]一致したtransaction
+    const uint8_t       *p_txid;        ///< [in]検索するTXID
+    uint32_t            vindex;         ///< [in]検索するvout index
+    bool                result;         ///< [out]true:一致した
+} search_outpoint_t;
+
+
+/** @struct search_vout_t
+ *  @brief  #search_vout_cb()のパラメータ
+ */
+typedef struct {
+    utl_push_t          *p_push;        ///< [out]一致したtransaction(btc_tx_tの配列)
+    const utl_buf_t     *p_vout;        ///< [in]検索するvout(utl_buf_tの配列)
+    int                 vout_num;       ///< [in]p_voutの要素数
+    bool                result;         ///< [out]true:1つ以上一致した
+} search_vout_t;
+
+
+/** @struct rpc_conn_t
+ *  @brief  keep-alive接続
+ */
+typedef struct {
+    CURL                *p_curl;
+    struct curl_slist   *p_headers;
+    bool                used;
+} rpc_conn_t;
+
+
 /**************************************************************************
  * prototypes
  **************************************************************************/
 
+static bool getblockhash(char *pBlockHash, int BHeight);
 static bool getblocktx(json_t **ppRoot, json_t **ppJsonTx, char **ppBufJson, int BHeight);
+static bool getblockraw(utl_buf_t *pBlock, int BHeight);
 static bool getrawtx(json_t **ppRoot, json_t **ppResult, char **ppJson, const uint8_t *pTxid);
 static bool getrawtxstr(btc_tx_t *pTx, const char *txid);
+static bool getrawtx_batch(btc_tx_t *pTxs, bool *pFound, json_t *pTxids, size_t Start, size_t Num);
 static bool signrawtx(btc_tx_t *pTx, const uint8_t *pData, uint32_t Len, uint64_t Amount, int* pCode);
 static bool signrawtx_with_wallet(btc_tx_t *pTx, const uint8_t *pData, size_t Len, uint64_t Amount);
 static bool gettxout(bool *pUnspent, uint64_t *pSat, const uint8_t *pTxid, uint32_t VIndex);
 static bool search_outpoint(btc_tx_t *pTx, int BHeight, const uint8_t *pTxid, uint32_t VIndex);
+static bool search_outpoint_cb(const btc_tx_view_t *pView, uint32_t Index, void *pParam);
+static bool search_outpoint_txs(btc_tx_t *pTx, int BHeight, const uint8_t *pTxid, uint32_t VIndex);
 static bool search_vout_block(utl_buf_t *pTxBuf, int BHeight, const utl_buf_t *pVout);
+static bool search_vout_cb(const btc_tx_view_t *pView, uint32_t Index, void *pParam);
+static bool search_vout_block_txs(utl_buf_t *pTxBuf, int BHeight, const utl_buf_t *pVout);
+static void search_vout_free(utl_buf_t *pTxBuf);
 static bool getversion(int64_t *pVersion);
 
 static size_t write_response(void *ptr, size_t size, size_t nmemb, void *stream);
@@ -86,7 +132,7 @@ static bool signrawtransaction_rpc(json_t **ppRoot, json_t **ppResult, char **pp
 static bool signrawtransactionwithwallet_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pTransaction);
 static bool sendrawtransaction_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pTransaction);
 static bool gettxout_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pTxid, int idx);
-static bool getblock_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pBlock);
+static bool getblock_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pBlock, int Verbosity);
 static bool getblockhash_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, int BHeight);
 static bool getblockcount_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson);
 static bool getnewaddress_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson);
@@ -94,6 +140,11 @@ static bool estimatefee_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, i
 static bool getnetworkinfo_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson);
 //static bool dumpprivkey_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pAddr);
 static bool rpc_proc(json_t **ppRoot, json_t **ppResult, char **ppJson, char *pData);
+static bool rpc_batch_proc(json_t **ppRoot, char **ppJson, const char *pData);
+static bool rpc_post(char **ppJson, const char *pData);
+static bool rpc_conn_init(rpc_conn_t *pConn);
+static rpc_conn_t *rpc_conn_get(void);
+static void rpc_conn_release(rpc_conn_t *pConn);
 static int error_result(json_t *p_root);
 
 
@@ -104,7 +155,8 @@ static int error_result(json_t *p_root);
 static char             mRpcUrl[SZ_RPC_URL + 1 + 5 + 2];
 static char             mRpcUserPwd[SZ_RPC_USER + 1 + SZ_RPC_PASSWD + 1];
 static pthread_mutex_t  mMux;
-static CURL             *mCurl;
+static pthread_cond_t   mCond;
+static rpc_conn_t       mRpcConn[M_RPC_POOL_NUM];
 
 static const char *M_RESULT         =   "result";
 static const char *M_CONFIRMATIONS  =   "confirmations";
@@ -112,11 +164,13 @@ static const char *M_HEX            =   "hex";
 static const char *M_BLOCKHASH      =   "blockhash";
 static const char *M_HEIGHT         =   "height";
 static const char *M_VALUE          =   "value";
+static const char *M_SCRIPTPUBKEY   =   "scriptPubKey";
 static const char *M_TX             =   "tx";
 static const char *M_ERROR          =   "error";
 static const char *M_MESSAGE        =   "message";
 static const char *M_CODE           =   "code";
 static const char *M_FEERATE        =   "feerate";
+static const char *M_ID             =   "id";
 
 
 /**************************************************************************
@@ -126,12 +180,8 @@ static const char *M_FEERATE        =   "feerate";
 bool btcrpc_init(const rpc_conf_t *pRpcConf)
 {
     pthread_mutex_init(&mMux, NULL);
+    pthread_cond_init(&mCond, NULL);
     curl_global_init(CURL_GLOBAL_ALL);
-    mCurl = curl_easy_init();
-    if (mCurl == NULL) {
-        LOGD("fatal: cannot init curl\n");
-        return false;
-    }
 
     sprintf(mRpcUrl, "%s:%d", pRpcConf->rpcurl, pRpcConf->rpcport);
     sprintf(mRpcUserPwd, "%s:%s", pRpcConf->rpcuser, pRpcConf->rpcpasswd);
@@ -140,6 +190,13 @@ bool btcrpc_init(const rpc_conf_t *pRpcConf)
     LOGD("RpcUserPwd=%s\n", mRpcUserPwd);
 #endif //M_DBG_SHOWRPC
 
+    for (int lp = 0; lp < M_RPC_POOL_NUM; lp++) {
+        if (!rpc_conn_init(&mRpcConn[lp])) {
+            LOGD("fatal: cannot init curl\n");
+            return false;
+        }
+    }
+
     int64_t version = -1;
     bool ret = getversion(&version);
     if (ret) {
@@ -183,9 +240,16 @@ LABEL_EXIT:
 
 void btcrpc_term(void)
 {
-    curl_easy_cleanup(mCurl);
-    mCurl = NULL;
+    for (int lp = 0; lp < M_RPC_POOL_NUM; lp++) {
+        if (mRpcConn[lp].p_curl != NULL) {
+            curl_easy_cleanup(mRpcConn[lp].p_curl);
+            mRpcConn[lp].p_curl = NULL;
+        }
+        curl_slist_free_all(mRpcConn[lp].p_headers);
+        mRpcConn[lp].p_headers = NULL;
+    }
     curl_global_cleanup();
+    pthread_cond_destroy(&mCond);
     pthread_mutex_destroy(&mMux);
 }
 
@@ -316,7 +380,7 @@ bool btcrpc_get_short_channel_param(const uint8_t *pPeerId, int32_t *pBHeight, i
     }
     UTL_DBG_FREE(p_json);
 
-    ret = getblock_rpc(&p_root, &p_result, &p_json, blockhash);
+    ret = getblock_rpc(&p_root, &p_result, &p_json, blockhash, 1);
     if (ret) {
         json_t *p_height;
         json_t *p_tx;
@@ -391,6 +455,13 @@ bool btcrpc_gettxid_from_short_channel(uint8_t *pTxid, int BHeight, int BIndex)
 }
 
 
+//bitcoindのみ
+bool btcrpc_getrawblock(utl_buf_t *pBlock, int BHeight)
+{
+    return getblockraw(pBlock, BHeight);
+}
+
+
 bool btcrpc_search_outpoint(btc_tx_t *pTx, uint32_t Blks, const uint8_t *pTxid, uint32_t VIndex)
 {
     if (Blks == 0) {
@@ -525,6 +596,47 @@ bool btcrpc_check_unspent(
 }
 
 
+bool btcrpc_gettxout(bool *pUnspent, utl_buf_t *pScriptPubKey, const uint8_t *pTxid, uint32_t VIndex)
+{
+    bool ret;
+    char *p_json = NULL;
+    char txid[BTC_SZ_TXID * 2 + 1];
+    json_t *p_root = NULL;
+    json_t *p_result;
+
+    *pUnspent = false;
+    utl_buf_init(pScriptPubKey);
+
+    //TXIDはBE/LE変換
+    utl_str_bin2str_rev(txid, pTxid, BTC_SZ_TXID);
+
+    ret = gettxout_rpc(&p_root, &p_result, &p_json, txid, VIndex);
+    if (ret) {
+        //使用済みの場合はresultがnull
+        json_t *p_spk = json_object_get(p_result, M_SCRIPTPUBKEY);
+        json_t *p_hex = (p_spk != NULL) ? json_object_get(p_spk, M_HEX) : NULL;
+        if (json_is_string(p_hex)) {
+            const char *p_str = (const char *)json_string_value(p_hex);
+            uint32_t len = (uint32_t)strlen(p_str) / 2;
+            if (utl_buf_alloc(pScriptPubKey, len) && utl_str_str2bin(pScriptPubKey->buf, len, p_str)) {
+                *pUnspent = true;
+            } else {
+                utl_buf_free(pScriptPubKey);
+                ret = false;
+            }
+        }
+    } else {
+        LOGE("fail: gettxout_rpc()\n");
+    }
+    if (p_root != NULL) {
+        json_decref(p_root);
+    }
+    UTL_DBG_FREE(p_json);
+
+    return ret;
+}
+
+
 bool btcrpc_getnewaddress(char pAddr[BTC_SZ_ADDR_STR_MAX + 1])
 {
     bool result = false;
@@ -642,39 +754,54 @@ bool btcrpc_empty_wallet(uint8_t *pTxid, const char *pAddr)
  * private functions
  **************************************************************************/
 
-static bool getblocktx(json_t **ppRoot, json_t **ppJsonTx, char **ppBufJson, int BHeight)
+/** ブロック高→ブロックハッシュ
+ *
+ * @param[out]  pBlockHash  ブロックハッシュ文字列(BTC_SZ_HASH256 * 2 + 1)
+ * @param[in]   BHeight     block height
+ */
+static bool getblockhash(char *pBlockHash, int BHeight)
 {
     bool ret;
     json_t *p_root = NULL;
     json_t *p_result;
-    json_t *p_height;
     char *p_json = NULL;
-    char blockhash[BTC_SZ_HASH256 * 2 + 1];
-
-    *ppJsonTx = NULL;
-    *ppRoot = NULL;
 
-    //ブロック高→ブロックハッシュ
     ret = getblockhash_rpc(&p_root, &p_result, &p_json, BHeight);
     if (!ret) {
         LOGE("fail: getblockhash_rpc\n");
         return false;
     }
-    if (json_is_string(p_result)) {
-        strcpy(blockhash, (const char *)json_string_value(p_result));
+    const char *p_hash = (const char *)json_string_value(p_result);
+    if ((p_hash != NULL) && (strlen(p_hash) == BTC_SZ_HASH256 * 2)) {
+        strcpy(pBlockHash, p_hash);
     } else {
         LOGD("error: M_RESULT\n");
-        blockhash[0] = '\0';
+        pBlockHash[0] = '\0';
     }
     json_decref(p_root);
     UTL_DBG_FREE(p_json);
-    if (blockhash[0] == '\0') {
+
+    return pBlockHash[0] != '\0';
+}
+
+
+static bool getblocktx(json_t **ppRoot, json_t **ppJsonTx, char **ppBufJson, int BHeight)
+{
+    bool ret;
+    json_t *p_result;
+    json_t *p_height;
+    char blockhash[BTC_SZ_HASH256 * 2 + 1];
+
+    *ppJsonTx = NULL;
+    *ppRoot = NULL;
+
+    //ブロック高→ブロックハッシュ
+    if (!getblockhash(blockhash, BHeight)) {
         return false;
     }
 
-
     //ブロックハッシュ→TXIDs
-    ret = getblock_rpc(ppRoot, &p_result, ppBufJson, blockhash);
+    ret = getblock_rpc(ppRoot, &p_result, ppBufJson, blockhash, 1);
     if (!ret) {
         LOGE("fail: getblock_rpc\n");
         return false;
@@ -698,6 +825,58 @@ static bool getblocktx(json_t **ppRoot, json_t **ppJsonTx, char **ppBufJson, int
 }
 
 
+/** raw block取得(getblock verbosity=0)
+ *
+ * 1回のRPCでblock内の全transactionを取得する。
+ *
+ * @param[out]  pBlock      raw block(成功時、utl_buf_free()すること)
+ * @param[in]   BHeight     block height
+ */
+static bool getblockraw(utl_buf_t *pBlock, int BHeight)
+{
+    bool ret = false;
+    json_t *p_root = NULL;
+    json_t *p_result;
+    char *p_json = NULL;
+    char blockhash[BTC_SZ_HASH256 * 2 + 1];
+
+    utl_buf_init(pBlock);
+
+    //ブロック高→ブロックハッシュ
+    if (!getblockhash(blockhash, BHeight)) {
+        return false;
+    }
+
+    //ブロックハッシュ→raw block
+    if (!getblock_rpc(&p_root, &p_result, &p_json, blockhash, 0)) {
+        LOGE("fail: getblock_rpc\n");
+        return false;
+    }
+    const char *str_hex = (const char *)json_string_value(p_result);
+    if (!str_hex) {
+        LOGD("error: M_RESULT\n");
+        goto LABEL_EXIT;
+    }
+    uint32_t len = strlen(str_hex);
+    if ((len & 1) || (len == 0)) {
+        LOGD("error: len\n");
+        goto LABEL_EXIT;
+    }
+    len >>= 1;
+    if (!utl_buf_alloc(pBlock, len)) goto LABEL_EXIT;
+    if (!utl_str_str2bin(pBlock->buf, len, str_hex)) {
+        utl_buf_free(pBlock);
+        goto LABEL_EXIT;
+    }
+    ret = true;
+
+LABEL_EXIT:
+    json_decref(p_root);
+    UTL_DBG_FREE(p_json);
+    return ret;
+}
+
+
 static bool getrawtx(json_t **ppRoot, json_t **ppResult, char **ppJson, const uint8_t *pTxid)
 {
     char txid[BTC_SZ_TXID * 2 + 1];
@@ -757,6 +936,78 @@ LABEL_EXIT:
 }
 
 
+/** getrawtransaction(batch request)
+ *
+ * pTxids[Start]からNum個をまとめて取得する。
+ *
+ * @param[out]  pTxs        取得したtransaction(Num個)
+ * @param[out]  pFound      true: pTxs[n]取得成功(Num個)
+ * @param[in]   pTxids      TXID文字列のJSON配列
+ * @param[in]   Start       pTxidsの開始index
+ * @param[in]   Num         取得数(#M_RPC_BATCH_NUM以下)
+ * @retval  true    RPC成功(個々のtransactionはpFoundで判定する)
+ */
+static bool getrawtx_batch(btc_tx_t *pTxs, bool *pFound, json_t *pTxids, size_t Start, size_t Num)
+{
+    bool result = false;
+    size_t len = 16 + M_RPC_BATCH_ITEM * Num;
+    char *p_data = (char *)UTL_DBG_MALLOC(len);
+    size_t pos = 0;
+
+    for (size_t lp = 0; lp < Num; lp++) {
+        btc_tx_init(&pTxs[lp]);
+        pFound[lp] = false;
+    }
+
+    p_data[pos++] = '[';
+    for (size_t lp = 0; lp < Num; lp++) {
+        const char *p_txid = (const char *)json_string_value(json_array_get(pTxids, Start + lp));
+        pos += snprintf(p_data + pos, len - pos,
+            "%s{"
+                M_QQ("jsonrpc") ":" M_QQ("1.0") M_NEXT
+                M_QQ("id") ":%d" M_NEXT
+                M_1("method", "getrawtransaction") M_NEXT
+                M_QQ("params") ":[" M_QQ("%s") ", false]"
+            "}", (lp == 0) ? "" : M_NEXT, (int)lp, (p_txid != NULL) ? p_txid : "");
+    }
+    p_data[pos++] = ']';
+    p_data[pos] = '\0';
+
+    char *p_json = NULL;
+    json_t *p_root = NULL;
+    if (rpc_batch_proc(&p_root, &p_json, p_data)) {
+        //応答の順序は保証されないため、idで対応付ける
+        size_t index;
+        json_t *p_value;
+        json_array_foreach(p_root, index, p_value) {
+            json_t *p_id = json_object_get(p_value, M_ID);
+            const char *str_hex = (const char *)json_string_value(json_object_get(p_value, M_RESULT));
+            if (!json_is_integer(p_id) || (str_hex == NULL)) {
+                continue;
+            }
+            size_t idx = (size_t)json_integer_value(p_id);
+            uint32_t len_hex = strlen(str_hex);
+            if ((idx >= Num) || pFound[idx] || (len_hex & 1)) {
+                continue;
+            }
+            len_hex >>= 1;
+            uint8_t *p_hex = (uint8_t *)UTL_DBG_MALLOC(len_hex);
+            utl_str_str2bin(p_hex, len_hex, str_hex);
+            pFound[idx] = btc_tx_read(&pTxs[idx], p_hex, len_hex);
+            UTL_DBG_FREE(p_hex);
+        }
+        json_decref(p_root);
+        result = true;
+    } else {
+        LOGE("fail: rpc_batch_proc\n");
+    }
+    UTL_DBG_FREE(p_json);
+    UTL_DBG_FREE(p_data);
+
+    return result;
+}
+
+
 static bool signrawtx(btc_tx_t *pTx, const uint8_t *pData, uint32_t Len, uint64_t Amount, int* pCode)
 {
     (void)Amount;
@@ -893,6 +1144,9 @@ LABEL_EXIT:
 
 
 /** [bitcoin rpc]blockからvin[0]のoutpointが一致するトランザクションを検索
+ *
+ * raw blockを1回で取得して全transactionを検索する。
+ * raw blockを取得できなかった場合は、#search_outpoint_txs()で検索する。
  *
  * @param[out]  pTx         トランザクション情報
  * @param[in]   BHeight     block height
@@ -901,9 +1155,66 @@ LABEL_EXIT:
  * @retval  true        検索成功
  * @note
  *      - 検索するvinはvin_cnt==1のみ
- *      - 内部処理(getrawtransaction)に失敗した場合でも、処理を継続する
  */
 static bool search_outpoint(btc_tx_t *pTx, int BHeight, const uint8_t *pTxid, uint32_t VIndex)
+{
+    utl_buf_t block = UTL_BUF_INIT;
+
+    if (getblockraw(&block, BHeight)) {
+        search_outpoint_t param;
+        param.p_tx = pTx;
+        param.p_txid = pTxid;
+        param.vindex = VIndex;
+        param.result = false;
+        bool ret = btc_block_read_tx_views(block.buf, block.len, search_outpoint_cb, &param);
+        utl_buf_free(&block);
+        if (ret) {
+            return param.result;
+        }
+        LOGE("fail: read block(height=%d)\n", BHeight);
+    }
+
+    return search_outpoint_txs(pTx, BHeight, pTxid, VIndex);
+}
+
+
+/** #search_outpoint()のcallback
+ *
+ * 一致したtransactionだけ#btc_tx_t に変換する。
+ */
+static bool search_outpoint_cb(const btc_tx_view_t *pView, uint32_t Index, void *pParam)
+{
+    (void)Index;
+    search_outpoint_t *p_param = (search_outpoint_t *)pParam;
+
+    if (pView->vin_cnt != 1) {
+        return true;
+    }
+    btc_tx_view_vin_t vin;
+    uint32_t pos = pView->vin_pos;
+    btc_tx_view_vin(pView, &vin, &pos);
+    if ( (memcmp(pView->p_data + vin.txid_pos, p_param->p_txid, BTC_SZ_TXID) == 0) &&
+         (vin.index == p_param->vindex) ) {
+        //一致
+        p_param->result = btc_tx_view_to_tx(p_param->p_tx, pView);
+        return false;
+    }
+    return true;
+}
+
+
+/** [bitcoin rpc]blockからvin[0]のoutpointが一致するトランザクションを検索(transaction毎に取得)
+ *
+ * @param[out]  pTx         トランザクション情報
+ * @param[in]   BHeight     block height
+ * @param[in]   pTxid       検索するTXID
+ * @param[in]   VIndex      vout index
+ * @retval  true        検索成功
+ * @note
+ *      - 検索するvinはvin_cnt==1のみ
+ *      - 内部処理(getrawtransaction)に失敗した場合でも、処理を継続する
+ */
+static bool search_outpoint_txs(btc_tx_t *pTx, int BHeight, const uint8_t *pTxid, uint32_t VIndex)
 {
     bool result = false;
     bool ret;
@@ -913,29 +1224,31 @@ static bool search_outpoint(btc_tx_t *pTx, int BHeight, const uint8_t *pTxid, ui
 
     ret = getblocktx(&p_root, &p_tx, &p_json, BHeight);
     if (ret) {
-        //検索
-        size_t index = 0;
-        json_t *p_value = NULL;
-        char txid[BTC_SZ_TXID * 2 + 1] = "";
-
-        json_array_foreach(p_tx, index, p_value) {
-            strcpy(txid, (const char *)json_string_value(p_value));
-            btc_tx_t tx = BTC_TX_INIT;
-
-            ret = getrawtxstr(&tx, txid);
-            //LOGD("txid=%s\n", txid);
-            if ( ret &&
-                 (tx.vin_cnt == 1) &&
-                 (memcmp(tx.vin[0].txid, pTxid, BTC_SZ_TXID) == 0) &&
-                 (tx.vin[0].index == VIndex) ) {
-                //一致
-                memcpy(pTx, &tx, sizeof(btc_tx_t));
-                btc_tx_init(&tx);     //freeさせない
-                result = true;
-                break;
+        //検索(getrawtransactionはM_RPC_BATCH_NUMずつまとめて要求する)
+        size_t tx_num = json_array_size(p_tx);
+        btc_tx_t *p_txs = (btc_tx_t *)UTL_DBG_MALLOC(sizeof(btc_tx_t) * M_RPC_BATCH_NUM);
+        bool found[M_RPC_BATCH_NUM];
+
+        for (size_t start = 0; (start < tx_num) && !result; start += M_RPC_BATCH_NUM) {
+            size_t num = (tx_num - start < M_RPC_BATCH_NUM) ? tx_num - start : M_RPC_BATCH_NUM;
+            if (!getrawtx_batch(p_txs, found, p_tx, start, num)) {
+                //取得に失敗しても、処理を継続する
+                continue;
+            }
+            for (size_t lp = 0; lp < num; lp++) {
+                if ( !result && found[lp] &&
+                     (p_txs[lp].vin_cnt == 1) &&
+                     (memcmp(p_txs[lp].vin[0].txid, pTxid, BTC_SZ_TXID) == 0) &&
+                     (p_txs[lp].vin[0].index == VIndex) ) {
+                    //一致
+                    memcpy(pTx, &p_txs[lp], sizeof(btc_tx_t));
+                    btc_tx_init(&p_txs[lp]);     //freeさせない
+                    result = true;
+                }
+                btc_tx_free(&p_txs[lp]);
             }
-            btc_tx_free(&tx);
         }
+        UTL_DBG_FREE(p_txs);
     } else {
         LOGE("fail: getblock_rpc\n");
     }
@@ -949,6 +1262,10 @@ static bool search_outpoint(btc_tx_t *pTx, int BHeight, const uint8_t *pTxid, ui
 
 
 /** [bitcoin rpc]blockからvoutが一致するtransactionを検索
+ *
+ * raw blockを1回で取得し、全transactionと全voutを1回の走査で比較する。
+ * raw blockを取得できなかった場合は、#search_vout_block_txs()で検索する。
+ *
  * @param[out]  pTxBuf      トランザクション情報(btc_tx_tの配列を保存する)
  * @param[in]   BHeight     block height
  * @param[in]   pVout       vout(utl_buf_tの配列)
@@ -957,9 +1274,87 @@ static bool search_outpoint(btc_tx_t *pTx, int BHeight, const uint8_t *pTxid, ui
  *      - pTxBufの扱いに注意すること
  *          - 成功時、btc_tx_tが複数入っている可能性がある(個数は、pTxBuf->len / sizeof(btc_tx_t))
  *          - クリアする場合、各btc_tx_tをクリア後、utl_buf_tをクリアすること
- *      - 内部処理(getrawtransaction)に失敗した場合でも、処理を継続する
  */
 static bool search_vout_block(utl_buf_t *pTxBuf, int BHeight, const utl_buf_t *pVout)
+{
+    utl_buf_t block = UTL_BUF_INIT;
+
+    if (getblockraw(&block, BHeight)) {
+        utl_push_t push;
+        search_vout_t param;
+        utl_push_init(&push, pTxBuf, 0);
+        param.p_push = &push;
+        param.p_vout = pVout;
+        param.vout_num = pVout->len / sizeof(utl_buf_t);
+        param.result = false;
+        bool ret = btc_block_read_tx_views(block.buf, block.len, search_vout_cb, &param);
+        utl_buf_free(&block);
+        if (ret) {
+            return param.result;
+        }
+        LOGE("fail: read block(height=%d)\n", BHeight);
+        search_vout_free(pTxBuf);
+    }
+
+    return search_vout_block_txs(pTxBuf, BHeight, pVout);
+}
+
+
+/** #search_vout_block()のcallback
+ *
+ * 一致したtransactionだけ#btc_tx_t に変換する。
+ */
+static bool search_vout_cb(const btc_tx_view_t *pView, uint32_t Index, void *pParam)
+{
+    search_vout_t *p_param = (search_vout_t *)pParam;
+
+    //#search_vout_block_txs()と同じく、vout[0]で比較する
+    if (pView->vout_cnt == 0) {
+        return true;
+    }
+    btc_tx_view_vout_t vout;
+    uint32_t pos = pView->vout_pos;
+    btc_tx_view_vout(pView, &vout, &pos);
+    for (int lp = 0; lp < p_param->vout_num; lp++) {
+        if ( (vout.script_len == p_param->p_vout[lp].len) &&
+             (memcmp(pView->p_data + vout.script_pos, p_param->p_vout[lp].buf, vout.script_len) == 0) ) {
+            //一致
+            LOGD("match: block tx[%" PRIu32 "]\n", Index);
+            btc_tx_t tx = BTC_TX_INIT;
+            if (btc_tx_view_to_tx(&tx, pView)) {
+                utl_push_data(p_param->p_push, &tx, sizeof(btc_tx_t));
+                p_param->result = true;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+
+/** #search_vout_block()の検索結果を解放する
+ *
+ */
+static void search_vout_free(utl_buf_t *pTxBuf)
+{
+    btc_tx_t *p_txs = (btc_tx_t *)pTxBuf->buf;
+    for (uint32_t lp = 0; lp < pTxBuf->len / sizeof(btc_tx_t); lp++) {
+        btc_tx_free(&p_txs[lp]);
+    }
+    utl_buf_free(pTxBuf);
+}
+
+
+/** [bitcoin rpc]blockからvoutが一致するtransactionを検索(transaction毎に取得)
+ * @param[out]  pTxBuf      トランザクション情報(btc_tx_tの配列を保存する)
+ * @param[in]   BHeight     block height
+ * @param[in]   pVout       vout(utl_buf_tの配列)
+ * @retval  true        検索成功(1つでも見つかった)
+ * @note
+ *      - #search_vout_block()を参照
+ *      - 内部処理(getrawtransaction)に失敗した場合でも、処理を継続する
+ */
+static bool search_vout_block_txs(utl_buf_t *pTxBuf, int BHeight, const utl_buf_t *pVout)
 {
     bool result = false;
     bool ret;
@@ -971,35 +1366,41 @@ static bool search_vout_block(utl_buf_t *pTxBuf, int BHeight, const utl_buf_t *p
 
     ret = getblocktx(&p_root, &p_tx, &p_json, BHeight);
     if (ret) {
-        //検索
+        //検索(getrawtransactionはM_RPC_BATCH_NUMずつまとめて要求する)
         utl_push_t push;
         utl_push_init(&push, pTxBuf, 0);
-        size_t index = 0;
-        json_t *p_value = NULL;
-        char txid[BTC_SZ_TXID * 2 + 1] = "";
-
-        json_array_foreach(p_tx, index, p_value) {
-            strcpy(txid, (const char *)json_string_value(p_value));
-            btc_tx_t tx = BTC_TX_INIT;
-
-            ret = getrawtxstr(&tx, txid);
-            if (ret) {
-                for (uint32_t lp = 0; lp < tx.vout_cnt; lp++) {
+        size_t tx_num = json_array_size(p_tx);
+        btc_tx_t *p_txs = (btc_tx_t *)UTL_DBG_MALLOC(sizeof(btc_tx_t) * M_RPC_BATCH_NUM);
+        bool found[M_RPC_BATCH_NUM];
+
+        for (size_t start = 0; start < tx_num; start += M_RPC_BATCH_NUM) {
+            size_t num = (tx_num - start < M_RPC_BATCH_NUM) ? tx_num - start : M_RPC_BATCH_NUM;
+            if (!getrawtx_batch(p_txs, found, p_tx, start, num)) {
+                //取得に失敗しても、処理を継続する
+                continue;
+            }
+            for (size_t idx = 0; idx < num; idx++) {
+                btc_tx_t *p_tx_one = &p_txs[idx];
+                if (!found[idx]) {
+                    continue;
+                }
+                for (uint32_t lp = 0; lp < p_tx_one->vout_cnt; lp++) {
                     for (int lp2 = 0; lp2 < vout_num; lp2++) {
-                        if (utl_buf_equal(&tx.vout[0].script, &pVout[lp2])) {
+                        if (utl_buf_equal(&p_tx_one->vout[0].script, &pVout[lp2])) {
                             //一致
-                            LOGD("match: %s\n", txid);
-                            utl_push_data(&push, &tx, sizeof(btc_tx_t));
+                            LOGD("match: %s\n", (const char *)json_string_value(json_array_get(p_tx, start + idx)));
+                            utl_push_data(&push, p_tx_one, sizeof(btc_tx_t));
                             LOGD("len=%u\n", pTxBuf->len);
-                            btc_tx_init(&tx);     //freeさせない
+                            btc_tx_init(p_tx_one);     //freeさせない
                             result = true;
                             break;
                         }
                     }
                 }
-                btc_tx_free(&tx);
+                btc_tx_free(p_tx_one);
             }
         }
+        UTL_DBG_FREE(p_txs);
     } else {
         LOGE("fail: getblock_rpc\n");
     }
@@ -1198,7 +1599,11 @@ static bool gettxout_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, cons
 }
 
 
-static bool getblock_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pBlock)
+/** [cURL]getblock
+ *
+ * @param[in]   Verbosity   0:raw block(hex文字列), 1:block情報(TXIDの配列)
+ */
+static bool getblock_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, const char *pBlock, int Verbosity)
 {
     char data[512];
     snprintf(data, sizeof(data),
@@ -1208,8 +1613,8 @@ static bool getblock_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson, cons
 
             ///////////////////////////////////////////
             M_1("method", "getblock") M_NEXT
-            M_QQ("params") ":[" M_QQ("%s") "]"
-        "}", pBlock);
+            M_QQ("params") ":[" M_QQ("%s") ", %d]"
+        "}", pBlock, Verbosity);
 
     bool ret = rpc_proc(ppRoot, ppResult, ppJson, data);
 
@@ -1351,23 +1756,92 @@ static bool getnetworkinfo_rpc(json_t **ppRoot, json_t **ppResult, char **ppJson
  * @retval  true    成功
  */
 static bool rpc_proc(json_t **ppRoot, json_t **ppResult, char **ppJson, char *pData)
+{
+    bool ret = false;
+
+    if (rpc_post(ppJson, pData)) {
+        json_error_t error;
+
+        *ppRoot = json_loads(*ppJson, 0, &error);
+        if (*ppRoot != NULL) {
+            //これ以降は終了時に json_decref()で参照を減らすこと
+            *ppResult = json_object_get(*ppRoot, M_RESULT);
+            if (*ppResult != NULL) {
+                ret = true;
+            } else {
+                LOGE("fail: object_get [%s]\n", *ppJson);
+                json_decref(*ppRoot);
+                *ppRoot = NULL;
+            }
+        } else {
+            LOGD("error: on line %d,%d: %s[%s]\n", error.line, error.column, error.text, *ppJson);
+        }
+    }
+    if (!ret) {
+        UTL_DBG_FREE(*ppJson);
+    }
+
+    return ret;
+}
+
+
+/** JSON-RPC処理(batch request)
+ *
+ * @param[out]  ppRoot      応答のJSON配列(成功時、json_decref()すること)
+ * @param[out]  ppJson      応答文字列(UTL_DBG_FREE()すること)
+ * @param[in]   pData       要求のJSON配列
+ * @retval  true    成功
+ * @note
+ *      - 応答の順序は要求と一致しないことがあるため、"id"で対応付けること
+ */
+static bool rpc_batch_proc(json_t **ppRoot, char **ppJson, const char *pData)
+{
+    bool ret = false;
+
+    *ppRoot = NULL;
+    if (rpc_post(ppJson, pData)) {
+        json_error_t error;
+
+        *ppRoot = json_loads(*ppJson, 0, &error);
+        if (*ppRoot != NULL) {
+            if (json_is_array(*ppRoot)) {
+                ret = true;
+            } else {
+                LOGE("fail: not array [%s]\n", *ppJson);
+                json_decref(*ppRoot);
+                *ppRoot = NULL;
+            }
+        } else {
+            LOGD("error: on line %d,%d: %s\n", error.line, error.column, error.text);
+        }
+    }
+    if (!ret) {
+        UTL_DBG_FREE(*ppJson);
+    }
+
+    return ret;
+}
+
+
+/** HTTP POST
+ *
+ * 空いている接続を使って送信する。
+ * 全接続が使用中の場合は、解放されるまで待つ。
+ *
+ * @param[out]  ppJson      応答文字列(UTL_DBG_FREE()すること)
+ * @param[in]   pData       要求
+ * @retval  true    成功
+ */
+static bool rpc_post(char **ppJson, const char *pData)
 {
 #ifdef M_DBG_SHOWRPC
     LOGD("%s\n", pData);
 #endif //M_DBG_SHOWRPC
 
-    bool ret = false;
-    pthread_mutex_lock(&mMux);
+    rpc_conn_t *p_conn = rpc_conn_get();
 
-    struct curl_slist *headers = curl_slist_append(NULL, "content-type: text/plain;");
-    curl_easy_setopt(mCurl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(mCurl, CURLOPT_URL, mRpcUrl);
-    curl_easy_setopt(mCurl, CURLOPT_POSTFIELDSIZE, (long)strlen(pData));
-    curl_easy_setopt(mCurl, CURLOPT_POSTFIELDS, pData);
-    curl_easy_setopt(mCurl, CURLOPT_USERPWD, mRpcUserPwd);
-    curl_easy_setopt(mCurl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
-    curl_easy_setopt(mCurl, CURLOPT_NOSIGNAL, 1);
-    curl_easy_setopt(mCurl, CURLOPT_FORBID_REUSE, 1L);
+    curl_easy_setopt(p_conn->p_curl, CURLOPT_POSTFIELDSIZE, (long)strlen(pData));
+    curl_easy_setopt(p_conn->p_curl, CURLOPT_POSTFIELDS, pData);
 
     //取得データはメモリに持つ
     write_result_t result;
@@ -1375,43 +1849,75 @@ static bool rpc_proc(json_t **ppRoot, json_t **ppResult, char **ppJson, char *pD
     *ppJson = (char *)UTL_DBG_MALLOC(result.sz);
     result.pp_data = ppJson;
     result.pos = 0;
-    curl_easy_setopt(mCurl, CURLOPT_WRITEFUNCTION, write_response);
-    curl_easy_setopt(mCurl, CURLOPT_WRITEDATA, &result);
+    **ppJson = '\0';
+    curl_easy_setopt(p_conn->p_curl, CURLOPT_WRITEDATA, &result);
 
     CURLcode retval;
-    retval = curl_easy_perform(mCurl);
+    retval = curl_easy_perform(p_conn->p_curl);
     if (retval != CURLE_OK) {
         LOGD("curl err: %d(%s)\n", retval, curl_easy_strerror(retval));
     }
-    curl_slist_free_all(headers);
 
-    pthread_mutex_unlock(&mMux);
+    rpc_conn_release(p_conn);
 
-    if (retval == CURLE_OK) {
-        json_error_t error;
+    return retval == CURLE_OK;
+}
 
-        *ppRoot = json_loads(*ppJson, 0, &error);
-        if (*ppRoot != NULL) {
-            //これ以降は終了時に json_decref()で参照を減らすこと
-            *ppResult = json_object_get(*ppRoot, M_RESULT);
-            if (*ppResult != NULL) {
-                ret = true;
-            } else {
-                LOGE("fail: object_get [%s]\n", *ppJson);
-                json_decref(*ppRoot);
-                *ppRoot = NULL;
+
+/** keep-alive接続初期化
+ *
+ * 要求ごとに変わらない設定はここで行う。
+ */
+static bool rpc_conn_init(rpc_conn_t *pConn)
+{
+    pConn->used = false;
+    pConn->p_curl = curl_easy_init();
+    if (pConn->p_curl == NULL) {
+        return false;
+    }
+    pConn->p_headers = curl_slist_append(NULL, "content-type: text/plain;");
+
+    curl_easy_setopt(pConn->p_curl, CURLOPT_HTTPHEADER, pConn->p_headers);
+    curl_easy_setopt(pConn->p_curl, CURLOPT_URL, mRpcUrl);
+    curl_easy_setopt(pConn->p_curl, CURLOPT_USERPWD, mRpcUserPwd);
+    curl_easy_setopt(pConn->p_curl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
+    curl_easy_setopt(pConn->p_curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(pConn->p_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(pConn->p_curl, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(pConn->p_curl, CURLOPT_WRITEFUNCTION, write_response);
+    return true;
+}
+
+
+static rpc_conn_t *rpc_conn_get(void)
+{
+    rpc_conn_t *p_conn = NULL;
+
+    pthread_mutex_lock(&mMux);
+    while (p_conn == NULL) {
+        for (int lp = 0; lp < M_RPC_POOL_NUM; lp++) {
+            if (!mRpcConn[lp].used) {
+                p_conn = &mRpcConn[lp];
+                p_conn->used = true;
+                break;
             }
-        } else {
-            LOGD("error: on line %d,%d: %s[%s]\n", error.line, error.column, error.text, *ppJson);
         }
-        if (!ret) {
-            UTL_DBG_FREE(*ppJson);
+        if (p_conn == NULL) {
+            pthread_cond_wait(&mCond, &mMux);
         }
-    } else {
-        LOGE("curl err: %d\n", retval);
     }
+    pthread_mutex_unlock(&mMux);
 
-    return ret;
+    return p_conn;
+}
+
+
+static void rpc_conn_release(rpc_conn_t *pConn)
+{
+    pthread_mutex_lock(&mMux);
+    pConn->used = false;
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mMux);
 }
 
 
@@ -474,6 +474,15 @@ bool btcrpc_gettxid_from_short_channel(uint8_t *pTxid, int BHeight, int BIndex)
 }
 
 
+//SPVではblock全体を取得しない
+bool btcrpc_getrawblock(utl_buf_t *pBlock, int BHeight)
+{
+    (void)BHeight;
+    utl_buf_init(pBlock);
+    return false;
+}
+
+
 bool btcrpc_search_outpoint(btc_tx_t *pTx, uint32_t Blks, const uint8_t *pTxid, uint32_t VIndex)
 {
     if (utl_mem_is_all_zero(pTxid, BTC_SZ_TXID)) {
@@ -621,6 +630,14 @@ bool btcrpc_check_unspent(const uint8_t *pPeerId, bool *pUnspent, uint64_t *pSat
 }
 
 
+bool btcrpc_gettxout(bool *pUnspent, utl_buf_t *pScriptPubKey, const uint8_t *pTxid, uint32_t VIndex)
+{
+    //scriptPubKeyは取得しない
+    utl_buf_init(pScriptPubKey);
+    return btcrpc_check_unspent(NULL, pUnspent, NULL, pTxid, VIndex);
+}
+
+
 bool btcrpc_getnewaddress(char pAddr[BTC_SZ_ADDR_STR_MAX + 1])
 {
     LOGD_BTCTRACE("\n");
@@ -49,6 +49,7 @@
 #include "lnapp_manager.h"
 #include "monitoring.h"
 #include "wallet.h"
+#include "scid_cache.h"
 #include "cmd_json.h"
 
 #ifdef DEVELOPER_MODE
@@ -402,6 +403,17 @@ static cJSON *cmd_getinfo(jrpc_context *ctx, cJSON *params, cJSON *id)
     } else {
         LOGE("fail getblockcount()\n");
     }
+
+    //short_channel_id UTXO cache
+    scid_cache_counter_t counter;
+    scid_cache_counter(&counter);
+    cJSON *result_scid = cJSON_CreateObject();
+    cJSON_AddNumber64ToObject(result_scid, "hit", counter.hit);
+    cJSON_AddNumber64ToObject(result_scid, "miss", counter.miss);
+    cJSON_AddNumber64ToObject(result_scid, "rpc", counter.rpc);
+    cJSON_AddNumber64ToObject(result_scid, "spent", counter.spent);
+    cJSON_AddItemToObject(result_scid, "count", cJSON_CreateNumber(counter.count));
+    cJSON_AddItemToObject(result, "scid_cache", result_scid);
 #endif
 
     //peer info
@@ -1057,6 +1069,8 @@ static cJSON *cmd_routepay(jrpc_context *ctx, cJSON *params, cJSON *id)
     int         index = 0;
     char        *p_invoice = NULL;
     uint64_t    add_amount_msat = 0;
+    ln_routing_profile_t profile = LN_ROUTING_PROFILE_FEE;
+    uint8_t     max_parts = 1;
 
     if (params == NULL) {
         err = RPCERR_PARSE;
@@ -1079,6 +1093,30 @@ static cJSON *cmd_routepay(jrpc_context *ctx, cJSON *params, cJSON *id)
         goto LABEL_ERROR;
     }
 
+    //edge cost profile(省略時はfee)
+    json = cJSON_GetArrayItem(params, index++);
+    if (json && (json->type == cJSON_String)) {
+        if (!ln_routing_profile_from_str(&profile, json->valuestring)) {
+            LOGE("fail: invalid routing profile\n");
+            err = RPCERR_PARSE;
+            goto LABEL_ERROR;
+        }
+    }
+    LOGD("routing profile: %s\n", ln_routing_profile_str(profile));
+
+    //multi-path paymentの最大分割数(省略時は分割しない)
+    //  分割したpartはptarmiganのpayeeしか受け付けないため、指定された場合だけ分割する
+    json = cJSON_GetArrayItem(params, index++);
+    if (json && (json->type == cJSON_Number)) {
+        if ((json->valueint < 1) || (json->valueint > LN_PAYMENT_PARTS_MAX)) {
+            LOGE("fail: invalid max_parts\n");
+            err = RPCERR_PARSE;
+            goto LABEL_ERROR;
+        }
+        max_parts = (uint8_t)json->valueint;
+    }
+    LOGD("max_parts: %d\n", max_parts);
+
     if (!monitor_btc_getblockcount(&block_count)) {
         err = RPCERR_BLOCKCHAIN;
         goto LABEL_ERROR;
@@ -1091,7 +1129,7 @@ static cJSON *cmd_routepay(jrpc_context *ctx, cJSON *params, cJSON *id)
     ln_payment_route_t  route;
     err = payment_error_to_rpc_error(
         ln_payment_start_invoice(
-            &payment_id, &route, p_invoice, add_amount_msat, M_RETRY_COUNT_MAX, false, block_count));
+            &payment_id, &route, p_invoice, add_amount_msat, M_RETRY_COUNT_MAX, false, block_count, profile, max_parts));
     if (err) {
         LOGE("fail: ???\n");
         goto LABEL_ERROR;
@@ -24,16 +24,20 @@
  *  @brief  channel処理
  *  @note   <pre>
  *                +-----------------------------------------------+
- *      p2p--->   | channel thread                                |
+ *      p2p--->   | peer I/O engine(peer_engine.c)                |
  *                |                                               |
  *                +--+-------+-------------------+----------------+
- *            create |       | create            | create
+ *              READ |       | TICK              | NOTIFY
  *                   v       v                   v
  *      +-------------+     +-------------+     +-------------+
- *      | recv thread |     | poll thread |     | anno thread |
- *      |             |     |             |     |             |
+ *      | recv_proc   |     | tick_proc   |     | idle proc   |
+ *      | channel_proc|     | (poll, anno)|     | (forward)   |
  *      +-------------+     +-------------+     +-------------+
  * </pre>
+ *
+ *  peerごとにthreadは作らず、engineのworker threadから#channel_cb()が呼ばれる。
+ *  init/channel_reestablish/funding_locked交換は受信を待たずに戻り、
+ *  受信やtickのたびに#channel_proc()で続きを行う。
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +49,7 @@
 #include <stdbool.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <poll.h>
 #include <sys/stat.h>
@@ -74,6 +79,7 @@
 #include "ln_anno.h"
 #include "ln_noise.h"
 #include "ln_msg.h"
+#include "ln_gossip.h"
 
 #include "ptarmd.h"
 #include "cmd_json.h"
@@ -85,6 +91,8 @@
 #include "btcrpc.h"
 #include "ln_db.h"
 #include "monitoring.h"
+#include "peer_engine.h"
+#include "scid_cache.h"
 
 
 /**************************************************************************
@@ -96,8 +104,6 @@
 #define M_WAIT_ANNO_SEC         (1)         //監視スレッドでのannounce処理間隔[sec]
 #define M_WAIT_ANNO_LONG_SEC    (30)        //監視スレッドでのannounce処理間隔(長めに空ける)[sec]
 #define M_WAIT_RECV_TO_MSEC     (50)        //socket受信待ちタイムアウト[msec]
-#define M_WAIT_RECV_MSG_MSEC    (500)       //message受信監視周期[msec]
-#define M_WAIT_RECV_THREAD_MSEC (100)       //recv_thread開始待ち[msec]
 #define M_WAIT_RESPONSE_MSEC    (10000)     //受信待ち[msec]
 #define M_WAIT_CHANREEST_MSEC   (3600000)   //channel_reestablish受信待ち[msec]
 
@@ -108,8 +114,18 @@
 #define M_FLAGRECV_FUNDINGLOCKED    (0x08)  ///< receive funding locked
 #define M_FLAGRECV_END              (0x80)  ///< 初期化完了
 
+//lnapp_conf_t.phase
+#define M_PHASE_START               (0)     ///< init未送信
+#define M_PHASE_INIT                (1)     ///< init受信待ち
+#define M_PHASE_REESTABLISH         (2)     ///< channel_reestablish受信待ち
+#define M_PHASE_FUNDINGLOCKED       (3)     ///< funding_locked受信待ち
+#define M_PHASE_NORMAL              (4)     ///< 初期化完了
+
 #define M_ANNO_UNIT             (10)        ///< 1回のanno_proc()での処理単位
+#define M_ANNO_SEND_PENDING     (65536)     ///< 送信待ちがこれ以上あればanno_proc()で送信しない[byte]
+#define M_RECV_UNIT             (16)        ///< 1回のrecv_proc()で処理するmessage数
 #define M_RECVIDLE_RETRY_MAX    (5)         ///< 受信アイドル時キュー処理のリトライ最大
+#define M_ARENA_CHUNK_SIZE      (4096)      ///< rx/tx arenaのchunkサイズ(update_add_htlcが入ればよい)
 
 #define M_PING_CNT              (M_WAIT_PING_SEC / M_WAIT_POLL_SEC)
 #define M_MISSING_PONG          (60)        ///< not ping reply
@@ -142,32 +158,44 @@ static ln_anno_param_t        mAnnoParam;       ///< announcementパラメータ
  * prototypes
  ********************************************************************/
 
+static bool channel_cb(void *pArg, uint32_t Events);
+static bool channel_origin_cb(void *pArg, uint32_t Events);
+static void channel_proc(lnapp_conf_t *p_conf);
+static void channel_end(lnapp_conf_t *p_conf);
+static void tick_proc(lnapp_conf_t *p_conf);
+
 static bool wait_peer_connected(lnapp_conf_t *p_conf);
 static bool noise_handshake(lnapp_conf_t *p_conf);
 static bool set_short_channel_id(lnapp_conf_t *p_conf);
+static void phase_set(lnapp_conf_t *p_conf, int Phase, uint32_t ToMsec);
 static bool exchange_init(lnapp_conf_t *p_conf);
+static bool exchange_init_recv(lnapp_conf_t *p_conf);
 static bool exchange_reestablish(lnapp_conf_t *p_conf);
 static bool exchange_funding_locked(lnapp_conf_t *p_conf);
+static bool funding_locked_send(lnapp_conf_t *p_conf);
+static void funding_locked_recv(lnapp_conf_t *p_conf);
+static void channel_inited(lnapp_conf_t *p_conf);
 static bool send_open_channel(lnapp_conf_t *p_conf, const funding_conf_t *pFundingConf);
 
-static void *thread_recv_start(void *pArg);
+static void recv_proc(lnapp_conf_t *p_conf);
+static void recv_resume(lnapp_conf_t *p_conf);
+static int recv_msg(lnapp_conf_t *p_conf);
+static int recv_error(lnapp_conf_t *p_conf, ssize_t Result);
+static bool recv_msg_proc(lnapp_conf_t *p_conf);
 static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uint32_t ToMsec);
+static void recv_idle_proc(lnapp_conf_t *p_conf);
 
-static void *thread_poll_start(void *pArg);
+static void poll_proc(lnapp_conf_t *p_conf);
 static void poll_ping(lnapp_conf_t *p_conf);
 static void poll_funding_wait(lnapp_conf_t *p_conf);
 static void poll_normal_operating(lnapp_conf_t *p_conf);
 static void send_cnlupd_before_announce(lnapp_conf_t *p_conf);
 static bool send_announcement_signatures(lnapp_conf_t *p_conf);
 
-static void *thread_anno_start(void *pArg);
+static void anno_tick(lnapp_conf_t *p_conf, time_t Now);
 static bool anno_proc(lnapp_conf_t *p_conf);
-static bool anno_send(
-    lnapp_conf_t *p_conf, uint64_t short_channel_id, const utl_buf_t *p_buf_cnl,
-    void *p_cur_cnl, void *p_cur_node, void *p_cur_infocnl, void *p_cur_infonode);
+static bool anno_send(lnapp_conf_t *p_conf, const ln_gossip_entry_t *p_entry);
 static bool anno_prev_check(uint64_t short_channel_id, uint32_t timestamp);
-static bool anno_send_cnl(lnapp_conf_t *p_conf, uint64_t short_channel_id, char type, void *p_cur_infocnl, const utl_buf_t *p_buf_cnl);
-static bool anno_send_node(lnapp_conf_t *p_conf, void *p_cur_node, void *p_cur_infonode, const utl_buf_t *p_buf_cnl);
 
 static void load_channel_settings(lnapp_conf_t *p_conf);
 static void load_announce_settings(void);
@@ -194,8 +222,7 @@ void lnapp_global_init(void)
 }
 
 
-void lnapp_conf_init(
-    lnapp_conf_t *pAppConf, const uint8_t *pPeerNodeId, void *(*pThreadChannelStart)(void *pArg))
+void lnapp_conf_init(lnapp_conf_t *pAppConf, const uint8_t *pPeerNodeId, bool bOrigin)
 {
     memset(pAppConf, 0x00, sizeof(lnapp_conf_t));
 
@@ -204,15 +231,14 @@ void lnapp_conf_init(
     pAppConf->ref_counter = 0;
     ln_init(&pAppConf->channel, &mAnnoParam, pPeerNodeId, lnapp_notify_cb, pAppConf);
 
-    pthread_cond_init(&pAppConf->cond, NULL);
     pthread_mutex_init(&pAppConf->mux_th, NULL);
     pthread_mutex_t mux_conf = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
     memcpy(&pAppConf->mux_conf, &mux_conf, sizeof(mux_conf));
     pthread_mutex_init(&pAppConf->mux_send, NULL);
+    pAppConf->origin = bOrigin;
+    pAppConf->sock = -1;
 
     load_channel_settings(pAppConf);
-
-    pAppConf->p_thread_channel_start = pThreadChannelStart;
 }
 
 
@@ -220,12 +246,12 @@ void lnapp_conf_term(lnapp_conf_t *pAppConf)
 {
     ln_term(&pAppConf->channel);
 
-    pthread_cond_destroy(&pAppConf->cond);
     pthread_mutex_destroy(&pAppConf->mux_th);
     pthread_mutex_destroy(&pAppConf->mux_conf);
     pthread_mutex_destroy(&pAppConf->mux_send);
 
     memset(pAppConf, 0x00, sizeof(lnapp_conf_t));
+    pAppConf->sock = -1;
 }
 
 
@@ -243,15 +269,31 @@ void lnapp_conf_start(
     pAppConf->active = true;
     pAppConf->flag_recv = 0;
     pAppConf->ping_counter = 1;   //send soon
+    pAppConf->phase = M_PHASE_START;
+    pAppConf->phase_limit = 0;
+    pAppConf->tick_sec = 0;
+    pAppConf->poll_next = utl_time_time() + M_WAIT_POLL_SEC;
+
+    pAppConf->rx_head_len = 0;
+    utl_buf_init(&pAppConf->rx_body);
+    pAppConf->rx_body_len = 0;
+    utl_arena_init(&pAppConf->rx_arena, M_ARENA_CHUNK_SIZE);
+    utl_arena_init(&pAppConf->tx_arena, M_ARENA_CHUNK_SIZE);
+    pAppConf->rx_pause = false;
+    utl_buf_init(&pAppConf->tx_buf);
+    pAppConf->tx_len = 0;
+    pAppConf->tx_pos = 0;
 
     pAppConf->funding_waiting = false;
+    pAppConf->funding_locked_wait = false;
     pAppConf->funding_confirm = 0;
 
-    pAppConf->last_anno_cnl = 0;
+    pAppConf->gossip_cursor = LN_GOSSIP_CURSOR_INIT;
     pAppConf->annosig_send_req = false;
     pAppConf->annodb_updated = false;
     pAppConf->annodb_cont = false;
     pAppConf->annodb_stamp = 0;
+    pAppConf->anno_next = utl_time_time() + M_WAIT_ANNO_SEC;
 
     pAppConf->feerate_per_kw = 0;
 
@@ -275,6 +317,14 @@ void lnapp_conf_stop(lnapp_conf_t *pAppConf)
         UTL_DBG_FREE(p_bak);
     }
 
+    utl_buf_init(&pAppConf->rx_body);
+    utl_arena_free(&pAppConf->rx_arena);
+    pthread_mutex_lock(&pAppConf->mux_send);
+    utl_arena_free(&pAppConf->tx_arena);
+    utl_buf_free(&pAppConf->tx_buf);
+    pAppConf->tx_len = 0;
+    pAppConf->tx_pos = 0;
+    pthread_mutex_unlock(&pAppConf->mux_send);
     UTL_DBG_FREE(pAppConf->p_errstr);
 }
 
@@ -284,7 +334,7 @@ bool lnapp_handshake(peer_conn_handshake_t *pConnHandshake)
     bool ret = false;
 
     lnapp_conf_t conf; //dummy
-    lnapp_conf_init(&conf, pConnHandshake->conn.node_id, NULL);
+    lnapp_conf_init(&conf, pConnHandshake->conn.node_id, false);
     ln_init(&conf.channel, NULL, NULL, NULL, NULL);
 
     conf.active = true;
@@ -329,11 +379,29 @@ LABEL_EXIT:
 void lnapp_start(lnapp_conf_t *pAppConf)
 {
     pthread_mutex_lock(&pAppConf->mux_th);
-    if (pAppConf->th) {
+    if (peer_engine_is_added(&pAppConf->engine)) {
         LOGE("fail: ???\n");
     } else {
         pAppConf->active = true;
-        pthread_create(&pAppConf->th, NULL, pAppConf->p_thread_channel_start, pAppConf);
+        bool ret;
+        if (pAppConf->origin) {
+            ret = peer_engine_add(&pAppConf->engine, -1, channel_origin_cb, pAppConf);
+        } else {
+            //受信はengineのepollで待つため、readでブロックしないようにする
+            int flags = fcntl(pAppConf->sock, F_GETFL);
+            fcntl(pAppConf->sock, F_SETFL, flags | O_NONBLOCK);
+            ret = peer_engine_add(&pAppConf->engine, pAppConf->sock, channel_cb, pAppConf);
+        }
+        if (!ret) {
+            LOGE("fail: peer_engine_add\n");
+            pAppConf->active = false;
+            if (pAppConf->sock >= 0) {
+                close(pAppConf->sock);
+                pAppConf->sock = -1;
+            }
+            lnapp_conf_stop(pAppConf);
+            lnapp_manager_free_node_ref(pAppConf);
+        }
     }
     pthread_mutex_unlock(&pAppConf->mux_th);
 }
@@ -343,12 +411,12 @@ void lnapp_stop(lnapp_conf_t *pAppConf)
 {
     LOGD("$$$ stop\n");
     pthread_mutex_lock(&pAppConf->mux_conf);
-    if (pAppConf->th) {
+    if (peer_engine_is_added(&pAppConf->engine)) {
         LOGD("stop lnapp: sock=%d\n", pAppConf->sock);
         fprintf(stderr, "stop: ");
         utl_dbg_dump(stderr, pAppConf->node_id, BTC_SZ_PUBKEY, true);
         pAppConf->active = false;
-        pthread_cond_signal(&pAppConf->cond);
+        peer_engine_notify(&pAppConf->engine);
         char str_sci[LN_SZ_SHORT_CHANNEL_ID_STR + 1];
         ln_short_channel_id_string(str_sci, ln_short_channel_id(&pAppConf->channel));
         LOGD("=========================================\n");
@@ -361,13 +429,12 @@ void lnapp_stop(lnapp_conf_t *pAppConf)
     }
     pthread_mutex_unlock(&pAppConf->mux_conf);
 
-    //wait for the thread to finish
+    //wait for the engine to call channel_end()
 
     pthread_mutex_lock(&pAppConf->mux_th);
-    if (pAppConf->th) {
-        pthread_join(pAppConf->th, NULL);
+    if (peer_engine_is_added(&pAppConf->engine)) {
+        peer_engine_wait(&pAppConf->engine);
         LOGD("join: lnapp\n");
-        pAppConf->th = 0;
     }
     pthread_mutex_unlock(&pAppConf->mux_th);
 }
@@ -496,6 +563,12 @@ void lnapp_set_feerate(lnapp_conf_t *pAppConf, uint32_t FeeratePerKw)
  * その他
  *******************************************/
 
+void lnapp_notify_forward(lnapp_conf_t *pAppConf)
+{
+    peer_engine_notify(&pAppConf->engine);
+}
+
+
 bool lnapp_match_short_channel_id(const lnapp_conf_t *pAppConf, uint64_t short_channel_id)
 {
     if (!pAppConf->active) {
@@ -605,201 +678,166 @@ bool lnapp_is_inited(const lnapp_conf_t *pAppConf)
 
 
 /********************************************************************
- * [THREAD]channel
+ * [ENGINE]channel
  ********************************************************************/
 
-/** channel thread entry point
+/** channel callback(#peer_engine_cb_t)
  *
  * @param[in,out]   pArg    lnapp_conf_t*
+ * @param[in]       Events  PEER_ENGINE_EV_xxx
+ * @retval  false   channel終了(engineから登録解除される)
  */
-void *lnapp_thread_channel_start(void *pArg)
+static bool channel_cb(void *pArg, uint32_t Events)
 {
-    bool    ret;
-    int     retval;
-    bool    b_channelreestablished = false;
-
     lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
-    ln_channel_t *p_channel = &p_conf->channel;
-
-    LOGD("[THREAD]ln_channel_t initialize\n");
 
-    pthread_t   th_recv;        //peer受信
-    pthread_t   th_poll;        //トランザクション監視
-    pthread_t   th_anno;        //announce
-
-    p_conf->feerate_per_kw = ln_feerate_per_kw(p_channel);
-
-    ln_status_t stat = ln_status_get(p_channel);
-
-    //peer受信スレッド
-    pthread_create(&th_recv, NULL, &thread_recv_start, p_conf);
-
-    //監視スレッド
-    pthread_create(&th_poll, NULL, &thread_poll_start, p_conf);
-
-    //announceスレッド
-    pthread_create(&th_anno, NULL, &thread_anno_start, p_conf);
-
-    //BOLTメッセージ
-    //  以下のパターンがあり得る
-    //      - チャネル関係にないnode_idと接続した
-    //          init交換
-    //      - チャネル関係にある相手と接続した
-    //          init交換
-    //          channel_reestablish交換
-    //          (funding_locked交換)
-
-    //init送受信
-    ret = exchange_init(p_conf);
-    if (ret) {
-        LOGD("exchange: init\n");
-    } else {
-        LOGE("fail: exchange init\n");
-        goto LABEL_JOIN;
+    if (p_conf->active && (p_conf->phase == M_PHASE_START)) {
+        //相手のinitより先に送信する
+        channel_proc(p_conf);
     }
-    p_conf->flag_recv |= M_FLAGRECV_INIT_EXCHANGED;
-
-    //送金先
-    if (ln_shutdown_scriptpk_local(p_channel)->len == 0) {
-        utl_buf_t buf = UTL_BUF_INIT;
-        ret = getnewaddress(&buf);
-        if (!ret) {
-            LOGE("fail: create address\n");
-            goto LABEL_JOIN;
+    if (p_conf->active && (Events & PEER_ENGINE_EV_WRITE)) {
+        if (!lnapp_send_peer_flush(p_conf)) {
+            lnapp_stop_threads(p_conf);
         }
-        ln_shutdown_set_vout_addr(p_channel, &buf);
-        utl_buf_free(&buf);
+    }
+    if (p_conf->active && (Events & PEER_ENGINE_EV_TICK)) {
+        recv_resume(p_conf);
+    }
+    if (p_conf->active && (Events & PEER_ENGINE_EV_READ) && !p_conf->rx_pause) {
+        recv_proc(p_conf);
+    }
+    if (p_conf->active) {
+        //timeout check
+        channel_proc(p_conf);
+    }
+    if (p_conf->active && (Events & (PEER_ENGINE_EV_NOTIFY | PEER_ENGINE_EV_TICK))) {
+        //forward DB追加通知、または受信アイドル
+        recv_idle_proc(p_conf);
+    }
+    if (p_conf->active && (Events & PEER_ENGINE_EV_TICK)) {
+        tick_proc(p_conf);
+    }
+    if (p_conf->active) {
+        return true;
     }
 
-    // Establishチェック
-    if (stat >= LN_STATUS_ESTABLISH) {
-        // DBにchannel_id登録済み
-        // →funding_txは展開されている
-        LOGD("have channel\n");
+    channel_end(p_conf);
+    return false;
+}
 
-        if (!ln_status_is_closing(p_channel)) {
-            if (stat == LN_STATUS_NORMAL_OPE) {
-                // funding_txはブロックに入ってminimum_depth以上経過している
-                LOGD("$$$ Established\n");
-                ln_establish_free(p_channel);
-            } else {
-                // funding_txはminimum_depth未満
-                LOGD("$$$ funding_tx in mempool\n");
-                TXIDD(ln_funding_info_txid(&p_channel->funding_info));
 
-                p_conf->funding_waiting = true;
-            }
+/** origin node callback(#peer_engine_cb_t)
+ *
+ * @param[in,out]   pArg    lnapp_conf_t*
+ * @param[in]       Events  PEER_ENGINE_EV_xxx
+ * @retval  false   終了(engineから登録解除される)
+ */
+static bool channel_origin_cb(void *pArg, uint32_t Events)
+{
+    (void)Events;
 
-            ln_node_addr_t conn_addr;
-            ret = utl_addr_ipv4_str2bin(conn_addr.addr, p_conf->conn_str);
-            if (ret) {
-                conn_addr.type = LN_ADDR_DESC_TYPE_IPV4;
-                conn_addr.port = p_conf->conn_port;
-                ln_last_connected_addr_set(p_channel, &conn_addr);
-            }
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
 
-            ln_channel_reestablish_before(p_channel);
-            b_channelreestablished = exchange_reestablish(p_conf);
-            if (b_channelreestablished) {
-                LOGD("exchange: channel_reestablish\n");
-            } else {
-                LOGE("fail: exchange channel_reestablish\n");
-                goto LABEL_JOIN;
-            }
-        } else {
-            const char *p_str = ln_status_string(p_channel);
-            LOGD("$$$ now closing: %s\n", p_str);
-        }
-    } else {
-        // channel_idはDB未登録
-        // →ユーザの指示待ち
-        LOGD("no channel_id\n");
+    if (p_conf->active) {
+        pthread_mutex_lock(&p_conf->mux_conf);
+        ln_idle_proc_origin(&p_conf->channel);
+        pthread_mutex_unlock(&p_conf->mux_conf);
+        return true;
     }
 
-    if (!p_conf->active) {
-        LOGE("fail: loop ended: %016" PRIx64 "\n", ln_short_channel_id(p_channel));
-        goto LABEL_JOIN;
-    }
+    lnapp_conf_stop(p_conf);
+    lnapp_manager_free_node_ref(p_conf);
+    LOGD("[exit]lnapp origin\n");
+    return false;
+}
 
-    //force send ping
-    poll_ping(p_conf);
 
-    if (ln_funding_locked_needs(p_channel)) {
-        //funding_locked交換
+/** 接続シーケンス
+ *
+ * BOLTメッセージ
+ *  以下のパターンがあり得る
+ *      - チャネル関係にないnode_idと接続した
+ *          init交換
+ *      - チャネル関係にある相手と接続した
+ *          init交換
+ *          channel_reestablish交換
+ *          (funding_locked交換)
+ *
+ * 受信待ちの場合は何もせずに戻る。
+ * message受信後とtickごとに呼び出され、受信済みであれば次の処理を行う。
+ */
+static void channel_proc(lnapp_conf_t *p_conf)
+{
+    bool ret;
+
+    if (p_conf->phase_limit && (utl_time_time() > p_conf->phase_limit)) {
+        LOGE("fail: timeout(phase=%d)\n", p_conf->phase);
+        lnapp_stop_threads(p_conf);
+        return;
+    }
+
+    switch (p_conf->phase) {
+    case M_PHASE_START:
+        ret = exchange_init(p_conf);
+        break;
+    case M_PHASE_INIT:
+        if ((p_conf->flag_recv & M_FLAGRECV_INIT) == 0) return;
+        ret = exchange_init_recv(p_conf);
+        break;
+    case M_PHASE_REESTABLISH:
+        if ((p_conf->flag_recv & M_FLAGRECV_REESTABLISH) == 0) return;
+        LOGD("exchange: channel_reestablish\n");
         ret = exchange_funding_locked(p_conf);
+        break;
+    case M_PHASE_FUNDINGLOCKED:
+        if ((p_conf->flag_recv & M_FLAGRECV_FUNDINGLOCKED) == 0) return;
+        funding_locked_recv(p_conf);
+        channel_inited(p_conf);
+        ret = true;
+        break;
+    default:
+        //funding_tx確定後のfunding_locked交換(#poll_funding_wait())
+        if (!p_conf->funding_locked_wait) return;
+        if ((p_conf->flag_recv & M_FLAGRECV_FUNDINGLOCKED) == 0) return;
+        funding_locked_recv(p_conf);
+        p_conf->funding_locked_wait = false;
+
+        // send `channel_update` for private/before publish channel
+        send_cnlupd_before_announce(p_conf);
+
+        char close_addr[BTC_SZ_ADDR_STR_MAX + 1];
+        ret = btc_keys_spk2addr(close_addr, ln_shutdown_scriptpk_local(&p_conf->channel));
         if (!ret) {
-            LOGE("fail: exchange funding_locked\n");
-            goto LABEL_JOIN;
+            utl_str_bin2str(close_addr,
+                    ln_shutdown_scriptpk_local(&p_conf->channel)->buf,
+                    ln_shutdown_scriptpk_local(&p_conf->channel)->len);
         }
-    }
-
-    p_conf->annosig_send_req = ln_open_channel_announce(p_channel);
-
-    //初期化完了
-    LOGD("*** message inited ***\n");
-    p_conf->flag_recv |= M_FLAGRECV_END;
 
-    // send `channel_update` for private/before publish channel
-    send_cnlupd_before_announce(p_conf);
+        char str_sci[LN_SZ_SHORT_CHANNEL_ID_STR + 1];
+        ln_short_channel_id_string(str_sci, ln_short_channel_id(&p_conf->channel));
+        ptarmd_eventlog(ln_channel_id(&p_conf->channel),
+                "funding_locked: short_channel_id=%s, close_addr=%s",
+                str_sci, close_addr);
 
-#ifdef USE_GQUERY
-    ret = ln_query_channel_range_send(p_channel, 0, UINT32_MAX);
-    if (ret) {
-        (void)ln_gossip_timestamp_filter_send(p_channel);
-    } else {
-        LOGE("fail: ln_query_channel_range_send\n");
+        p_conf->funding_waiting = false;
+        ret = true;
+        break;
     }
-#endif  //USE_GQUERY
-
-    {
-        // method: connected
-        // $1: short_channel_id
-        // $2: node_id
-        // $3: peer_id
-        // $4: recieved_localfeatures
-        char str_sci[LN_SZ_SHORT_CHANNEL_ID_STR + 1];
-        ln_short_channel_id_string(str_sci, ln_short_channel_id(p_channel));
-        char node_id[BTC_SZ_PUBKEY * 2 + 1];
-        utl_str_bin2str(node_id, ln_node_get_id(), BTC_SZ_PUBKEY);
-        char peer_id[BTC_SZ_PUBKEY * 2 + 1];
-        utl_str_bin2str(peer_id, p_conf->node_id, BTC_SZ_PUBKEY);
-        char param[M_SZ_SCRIPT_PARAM];
-        snprintf(param, sizeof(param), "%s %s "
-                    "%s %d",
-                    str_sci, node_id,
-                    peer_id,
-                    p_channel->lfeature_remote);
-        ptarmd_call_script(PTARMD_EVT_CONNECTED, param);
-
-        FILE *fp = fopen(FNAME_CONN_LOG, "a");
-        if (fp) {
-            char time[UTL_SZ_TIME_FMT_STR + 1];
-            fprintf(fp, "[%s]OK: %s@%s:%" PRIu16 "\n", utl_time_str_time(time), peer_id, p_conf->conn_str, p_conf->conn_port);
-            fclose(fp);
-        }
+    if (!ret) {
+        lnapp_stop_threads(p_conf);
     }
+}
 
-    pthread_mutex_lock(&p_conf->mux_conf);
-    while (p_conf->active) {
-        LOGD("loop...\n");
-
-        //mainloop待ち合わせ(*2)
-        pthread_cond_wait(&p_conf->cond, &p_conf->mux_conf);
-    }
-    pthread_mutex_unlock(&p_conf->mux_conf);
 
-LABEL_JOIN:
-    LOGD("stop threads...\n");
-    pthread_join(th_recv, NULL);
-    pthread_join(th_poll, NULL);
-    pthread_join(th_anno, NULL);
-    LOGD("join: recv, poll, anno\n");
+/** channel終了処理
+ *
+ * socketはengineがcloseする。
+ */
+static void channel_end(lnapp_conf_t *p_conf)
+{
+    ln_channel_t *p_channel = &p_conf->channel;
 
-    LOGD("close sock=%d...\n", p_conf->sock);
-    retval = close(p_conf->sock);
-    if (retval < 0) {
-        LOGD("socket close: %s", strerror(errno));
-    }
+    ln_gossip_request_clear(ln_remote_node_id(p_channel));
 
     LOGD("$$$ stop channel[%016" PRIx64 "]\n", ln_short_channel_id(p_channel));
 
@@ -828,32 +866,29 @@ LABEL_JOIN:
 
     lnapp_manager_free_node_ref(p_conf);
 
-    LOGD("[exit]lnapp thread\n");
-    return NULL;
+    LOGD("[exit]lnapp\n");
 }
 
 
-/** channel thread entry point
+/** 周期処理
  *
- * @param[in,out]   pArg    lnapp_conf_t*
+ * 1秒に1回、poll処理(M_WAIT_POLL_SEC間隔)とannounce処理を行う。
  */
-void *lnapp_thread_channel_origin_start(void *pArg)
+static void tick_proc(lnapp_conf_t *p_conf)
 {
-    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
-
-    LOGD("\n");
-
-    while (p_conf->active) {
-        pthread_mutex_lock(&p_conf->mux_conf);
-        ln_idle_proc_origin(&p_conf->channel);
-        pthread_mutex_unlock(&p_conf->mux_conf);
-        utl_thread_msleep(M_WAIT_RECV_TO_MSEC); //XXX: we should use `pthread_cond_wait`
+    time_t now = utl_time_time();
+    if (now == p_conf->tick_sec) {
+        return;
     }
+    p_conf->tick_sec = now;
 
-    lnapp_conf_stop(p_conf);
-    lnapp_manager_free_node_ref(p_conf);
-    LOGD("[exit]lnapp origin thread\n");
-    return NULL;
+    if (now >= p_conf->poll_next) {
+        p_conf->poll_next = now + M_WAIT_POLL_SEC;
+        poll_proc(p_conf);
+    }
+    if (p_conf->active) {
+        anno_tick(p_conf, now);
+    }
 }
 
 
@@ -1038,12 +1073,28 @@ static bool set_short_channel_id(lnapp_conf_t *p_conf)
 }
 
 
-/** init交換
+/** 接続シーケンスの状態設定
+ *
+ * @param[in]   Phase       M_PHASE_xxx
+ * @param[in]   ToMsec      受信待ちタイムアウト[msec](0:タイムアウト無し)
+ */
+static void phase_set(lnapp_conf_t *p_conf, int Phase, uint32_t ToMsec)
+{
+    p_conf->phase = Phase;
+    p_conf->phase_limit = (ToMsec) ? utl_time_time() + ToMsec / 1000 : 0;
+}
+
+
+/** init送信
  *
- * @retval  true    init交換完了
+ * @retval  true    init送信完了(#M_PHASE_INITで受信を待つ)
  */
 static bool exchange_init(lnapp_conf_t *p_conf)
 {
+    LOGD("[ENGINE]ln_channel_t initialize\n");
+
+    p_conf->feerate_per_kw = ln_feerate_per_kw(&p_conf->channel);
+
     if (!ln_init_send(&p_conf->channel, p_conf->routesync == PTARMD_ROUTESYNC_INIT, true)) {
         LOGE("fail: create\n");
         return false;
@@ -1051,41 +1102,100 @@ static bool exchange_init(lnapp_conf_t *p_conf)
 
     //コールバックでのINIT受信通知待ち
     LOGD("wait: init\n");
-    uint32_t count = M_WAIT_RESPONSE_MSEC / M_WAIT_RECV_MSG_MSEC;
-    while (p_conf->active && (count > 0) && ((p_conf->flag_recv & M_FLAGRECV_INIT) == 0)) {
-        utl_thread_msleep(M_WAIT_RECV_MSG_MSEC);
-        count--;
-    }
-    LOGD("loop:%d, count:%d, flag_recv=%02x\n", p_conf->active, count, p_conf->flag_recv);
+    phase_set(p_conf, M_PHASE_INIT, M_WAIT_RESPONSE_MSEC);
+    return true;
+}
 
-    if (ln_announcement_is_gossip_query(&p_conf->channel)) {
+
+/** init受信後の処理
+ *
+ * channelがあればchannel_reestablishを送信する。
+ *
+ * @retval  true    成功
+ */
+static bool exchange_init_recv(lnapp_conf_t *p_conf)
+{
+    ln_channel_t *p_channel = &p_conf->channel;
+
+    LOGD("exchange: init\n");
+    if (ln_announcement_is_gossip_query(p_channel)) {
         LOGD("$$$ gossip_queries\n");
 
         //未送信のものはすべて送信するか、今までのものは全部送信しないのか -> 後者を採用
-        ln_db_annoinfos_add_node_id(p_conf->node_id);
+        p_conf->gossip_cursor = ln_gossip_tail();
     } else {
-        bool del_sendinfo = ln_need_init_routing_sync(&p_conf->channel);
+        bool init_sync = ln_need_init_routing_sync(p_channel);
         LOGD("$$$ initial_routing_sync local=%s, remote=%s\n",
             ((p_conf->routesync == PTARMD_ROUTESYNC_INIT) ? "YES" : "no"),
-            (del_sendinfo) ? "YES" : "no");
-        if (del_sendinfo) {
+            (init_sync) ? "YES" : "no");
+        if (init_sync) {
             //send all range
-
-            //annoinfo情報削除(node_id指定, short_channel_idすべて)
-            LOGD("remove announcement sent info\n");
-            ln_db_annoinfos_del_node_id(p_conf->node_id, NULL, 0);
+            LOGD("send from the beginning of gossip log\n");
+            p_conf->gossip_cursor = LN_GOSSIP_CURSOR_INIT;
         } else {
             //only new received
-            ln_db_annoinfos_add_node_id(p_conf->node_id);
+            p_conf->gossip_cursor = ln_gossip_tail();
+        }
+    }
+    p_conf->flag_recv |= M_FLAGRECV_INIT_EXCHANGED;
+
+    //送金先
+    if (ln_shutdown_scriptpk_local(p_channel)->len == 0) {
+        utl_buf_t buf = UTL_BUF_INIT;
+        if (!getnewaddress(&buf)) {
+            LOGE("fail: create address\n");
+            return false;
+        }
+        ln_shutdown_set_vout_addr(p_channel, &buf);
+        utl_buf_free(&buf);
+    }
+
+    // Establishチェック
+    ln_status_t stat = ln_status_get(p_channel);
+    if (stat >= LN_STATUS_ESTABLISH) {
+        // DBにchannel_id登録済み
+        // →funding_txは展開されている
+        LOGD("have channel\n");
+
+        if (!ln_status_is_closing(p_channel)) {
+            if (stat == LN_STATUS_NORMAL_OPE) {
+                // funding_txはブロックに入ってminimum_depth以上経過している
+                LOGD("$$$ Established\n");
+                ln_establish_free(p_channel);
+            } else {
+                // funding_txはminimum_depth未満
+                LOGD("$$$ funding_tx in mempool\n");
+                TXIDD(ln_funding_info_txid(&p_channel->funding_info));
+
+                p_conf->funding_waiting = true;
+            }
+
+            ln_node_addr_t conn_addr;
+            if (utl_addr_ipv4_str2bin(conn_addr.addr, p_conf->conn_str)) {
+                conn_addr.type = LN_ADDR_DESC_TYPE_IPV4;
+                conn_addr.port = p_conf->conn_port;
+                ln_last_connected_addr_set(p_channel, &conn_addr);
+            }
+
+            ln_channel_reestablish_before(p_channel);
+            return exchange_reestablish(p_conf);
+        } else {
+            const char *p_str = ln_status_string(p_channel);
+            LOGD("$$$ now closing: %s\n", p_str);
         }
+    } else {
+        // channel_idはDB未登録
+        // →ユーザの指示待ち
+        LOGD("no channel_id\n");
     }
-    return p_conf->active && ((p_conf->flag_recv & M_FLAGRECV_INIT) != 0);
+
+    return exchange_funding_locked(p_conf);
 }
 
 
-/** channel_reestablish交換
+/** channel_reestablish送信
  *
- * @retval  true    channel_reestablish交換完了
+ * @retval  true    channel_reestablish送信完了(#M_PHASE_REESTABLISHで受信を待つ)
  */
 static bool exchange_reestablish(lnapp_conf_t *p_conf)
 {
@@ -1099,32 +1209,63 @@ static bool exchange_reestablish(lnapp_conf_t *p_conf)
 
     //コールバックでのchannel_reestablish受信通知待ち
     LOGD("wait: channel_reestablish\n");
-    uint32_t count = M_WAIT_CHANREEST_MSEC / M_WAIT_RECV_MSG_MSEC;
-    while (p_conf->active && (count > 0) && ((p_conf->flag_recv & M_FLAGRECV_REESTABLISH) == 0)) {
-        utl_thread_msleep(M_WAIT_RECV_MSG_MSEC);
-        count--;
-    }
-    LOGD("loop:%d, count:%d, flag_recv=%02x\n", p_conf->active, count, p_conf->flag_recv);
-    return p_conf->active && ((p_conf->flag_recv & M_FLAGRECV_REESTABLISH) != 0);
+    phase_set(p_conf, M_PHASE_REESTABLISH, M_WAIT_CHANREEST_MSEC);
+    return true;
 }
 
 
-/** funding_locked交換
+/** init/channel_reestablish交換後の処理
+ *
+ * 必要であればfunding_lockedを送信し、不要であれば初期化を完了する。
  *
- * @retval  true    funding_locked交換完了
+ * @retval  true    成功
  */
 static bool exchange_funding_locked(lnapp_conf_t *p_conf)
+{
+    if (!p_conf->active) {
+        LOGE("fail: loop ended: %016" PRIx64 "\n", ln_short_channel_id(&p_conf->channel));
+        return false;
+    }
+
+    //force send ping
+    poll_ping(p_conf);
+
+    if (ln_funding_locked_needs(&p_conf->channel)) {
+        //funding_locked交換
+        if (!funding_locked_send(p_conf)) {
+            LOGE("fail: exchange funding_locked\n");
+            return false;
+        }
+        phase_set(p_conf, M_PHASE_FUNDINGLOCKED, 0);
+        return true;
+    }
+
+    channel_inited(p_conf);
+    return true;
+}
+
+
+/** funding_locked送信
+ *
+ * @retval  true    送信完了(コールバックでのfunding_locked受信通知を待つ)
+ */
+static bool funding_locked_send(lnapp_conf_t *p_conf)
 {
     if (!ln_funding_locked_send(&p_conf->channel)) {
         LOGE("fail: send\n");
         return false;
     }
 
-    //コールバックでのfunding_locked受信通知待ち
     LOGD("wait: funding_locked\n");
-    while (p_conf->active && ((p_conf->flag_recv & M_FLAGRECV_FUNDINGLOCKED) == 0)) {
-        utl_thread_msleep(M_WAIT_RECV_MSG_MSEC);
-    }
+    return true;
+}
+
+
+/** funding_locked受信後の処理
+ *
+ */
+static void funding_locked_recv(lnapp_conf_t *p_conf)
+{
     LOGD("exchange: funding_locked\n");
 
     //set short_channel_id
@@ -1151,18 +1292,69 @@ static bool exchange_funding_locked(lnapp_conf_t *p_conf)
                 total_amount,
                 txidstr);
     ptarmd_call_script(PTARMD_EVT_ESTABLISHED, param);
-
-    return true;
 }
 
 
-/** open_channel送信
+/** 接続シーケンス完了
  *
  */
-static bool send_open_channel(lnapp_conf_t *p_conf, const funding_conf_t *pFundingConf)
+static void channel_inited(lnapp_conf_t *p_conf)
 {
-    ln_fundin_t fundin;
-    utl_buf_init(&fundin.change_spk);
+    ln_channel_t *p_channel = &p_conf->channel;
+
+    p_conf->annosig_send_req = ln_open_channel_announce(p_channel);
+
+    //初期化完了
+    LOGD("*** message inited ***\n");
+    p_conf->flag_recv |= M_FLAGRECV_END;
+    phase_set(p_conf, M_PHASE_NORMAL, 0);
+
+    // send `channel_update` for private/before publish channel
+    send_cnlupd_before_announce(p_conf);
+
+#ifdef USE_GQUERY
+    if (ln_query_channel_range_send(p_channel, 0, UINT32_MAX)) {
+        (void)ln_gossip_timestamp_filter_send(p_channel);
+    } else {
+        LOGE("fail: ln_query_channel_range_send\n");
+    }
+#endif  //USE_GQUERY
+
+    // method: connected
+    // $1: short_channel_id
+    // $2: node_id
+    // $3: peer_id
+    // $4: recieved_localfeatures
+    char str_sci[LN_SZ_SHORT_CHANNEL_ID_STR + 1];
+    ln_short_channel_id_string(str_sci, ln_short_channel_id(p_channel));
+    char node_id[BTC_SZ_PUBKEY * 2 + 1];
+    utl_str_bin2str(node_id, ln_node_get_id(), BTC_SZ_PUBKEY);
+    char peer_id[BTC_SZ_PUBKEY * 2 + 1];
+    utl_str_bin2str(peer_id, p_conf->node_id, BTC_SZ_PUBKEY);
+    char param[M_SZ_SCRIPT_PARAM];
+    snprintf(param, sizeof(param), "%s %s "
+                "%s %d",
+                str_sci, node_id,
+                peer_id,
+                p_channel->lfeature_remote);
+    ptarmd_call_script(PTARMD_EVT_CONNECTED, param);
+
+    FILE *fp = fopen(FNAME_CONN_LOG, "a");
+    if (fp) {
+        char time[UTL_SZ_TIME_FMT_STR + 1];
+        fprintf(fp, "[%s]OK: %s@%s:%" PRIu16 "\n", utl_time_str_time(time), peer_id, p_conf->conn_str, p_conf->conn_port);
+        fclose(fp);
+    }
+}
+
+
+/** open_channel送信
+ *
+ */
+static bool send_open_channel(lnapp_conf_t *p_conf, const funding_conf_t *pFundingConf)
+{
+    ln_fundin_t fundin;
+    utl_buf_init(&fundin.change_spk);
 
     //Establish開始
     LOGD("  funding_sat: %" PRIu64 "\n", pFundingConf->funding_sat);
@@ -1235,108 +1427,175 @@ static bool send_open_channel(lnapp_conf_t *p_conf, const funding_conf_t *pFundi
 
 
 /********************************************************************
- * [THREAD]receive
+ * [ENGINE]receive
  ********************************************************************/
 
-/** receive thread entry point
+/** socket受信処理
  *
- * @param[in,out]   pArg    lnapp_conf_t*
+ * 受信できた分だけmessageを処理する。
+ * 1回の呼び出しで処理するのはM_RECV_UNITまでとし、残りはengineが再度呼び出す。
+ * announcement署名検証queueが混んでいる場合はworkerを待たせず、
+ * #recv_resume()で再開するまでsocketの受信監視を止める。
  */
-static void *thread_recv_start(void *pArg)
+static void recv_proc(lnapp_conf_t *p_conf)
 {
-    utl_buf_t buf_recv = UTL_BUF_INIT;
-    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
-
-    LOGD("[THREAD]recv initialize: %d\n", p_conf->active);
-
-    //init受信待ちの準備時間を設ける
-    utl_thread_msleep(M_WAIT_RECV_THREAD_MSEC);
-
-    while (p_conf->active) {
-        uint8_t head[LN_SZ_NOISE_HEADER];
-        uint16_t len = recv_peer(p_conf, head, LN_SZ_NOISE_HEADER, 0);
-        if (len == 0) {
-            //disconnected
-            LOGD("DISC: loop end\n");
+    for (int lp = 0; lp < M_RECV_UNIT; lp++) {
+        if (ln_anno_is_busy()) {
+            LOGD("pause: verify queue busy\n");
+            p_conf->rx_pause = true;
+            peer_engine_read_pause(&p_conf->engine, true);
             break;
         }
-        if (len != LN_SZ_NOISE_HEADER) {
-            LOGE("fail: ???\n");
+        int ret = recv_msg(p_conf);
+        if (ret < 0) {
+            lnapp_stop_threads(p_conf);
             break;
         }
-
-        len = ln_noise_dec_len(&p_conf->noise, head, len);
-
-        utl_buf_free(&buf_recv);
-        utl_buf_alloc(&buf_recv, len);
-        uint16_t len_msg = recv_peer(p_conf, buf_recv.buf, len, M_WAIT_RESPONSE_MSEC);
-        if (len_msg == 0) {
-            //disconnected
-            LOGD("DISC: loop end\n");
+        if (ret == 0) {
+            //受信途中
             break;
         }
-        if (len_msg != len) {
-            LOGE("fail: ???\n");
+        if (!recv_msg_proc(p_conf)) {
+            lnapp_stop_threads(p_conf);
             break;
         }
-
-        buf_recv.len = len;
-        if (!ln_noise_dec_msg(&p_conf->noise, &buf_recv)) {
-            LOGD("DECODE: loop end\n");
+        channel_proc(p_conf);
+        if (!p_conf->active) {
             break;
         }
+    }
+}
+
 
-        uint16_t type = utl_int_pack_u16be(buf_recv.buf);
-        LOGD("[RECV]type=%04x(%s): sock=%d, Len=%d\n", type, ln_msg_name(type), p_conf->sock, buf_recv.len);
+/** 受信再開(tickごと)
+ *
+ * announcement署名検証queueが空いたら、#recv_proc()で止めた受信監視を再開する。
+ */
+static void recv_resume(lnapp_conf_t *p_conf)
+{
+    if (p_conf->rx_pause && !ln_anno_is_busy()) {
+        LOGD("resume\n");
+        p_conf->rx_pause = false;
+        peer_engine_read_pause(&p_conf->engine, false);
+    }
+}
 
-        pthread_mutex_lock(&p_conf->mux_conf); //lock
 
-        if (ln_status_is_closing(&p_conf->channel)) {
-            LOGD("???\n");
-            pthread_mutex_unlock(&p_conf->mux_conf); //unlock
-            break;
+/** noise message受信
+ *
+ * socketはnon-blockingで、受信途中のheader/bodyはlnapp_conf_tに保持する。
+ *
+ * @retval  1       p_conf->rx_bodyにdecode済みmessageあり
+ * @retval  0       受信途中
+ * @retval  -1      切断またはエラー
+ */
+static int recv_msg(lnapp_conf_t *p_conf)
+{
+    ssize_t n;
+
+    if (p_conf->rx_head_len < LN_SZ_NOISE_HEADER) {
+        n = read(p_conf->sock,
+                p_conf->rx_head + p_conf->rx_head_len, LN_SZ_NOISE_HEADER - p_conf->rx_head_len);
+        if (n <= 0) {
+            return recv_error(p_conf, n);
         }
-        if (!ln_recv(&p_conf->channel, buf_recv.buf, buf_recv.len)) {
-            LOGD("DISC: fail recv message\n");
-            lnapp_close_channel_force(p_conf);
-            pthread_mutex_unlock(&p_conf->mux_conf); //unlock
-            break;
+        p_conf->rx_head_len += (uint16_t)n;
+        if (p_conf->rx_head_len < LN_SZ_NOISE_HEADER) {
+            return 0;
         }
 
-        if (type == MSGTYPE_INIT) {
-            LOGD("$$$ init exchange...\n");
-            uint32_t count = M_WAIT_RESPONSE_MSEC / M_WAIT_RECV_MSG_MSEC;
-            uint32_t lp;
-            for (lp = 0; lp < count; lp++) {
-                if (!p_conf->active) break;
-                if (p_conf->flag_recv & M_FLAGRECV_INIT_EXCHANGED) {
-                    LOGD("$$$ init exchanged\n");
-                    break;
-                }
-                utl_thread_msleep(M_WAIT_RECV_MSG_MSEC);
-            }
-            if (count == lp) {
-                LOGE("fail: init exchange timeout\n");
-                pthread_mutex_unlock(&p_conf->mux_conf); //unlock
-                break;
-            }
+        uint32_t len = ln_noise_dec_len(&p_conf->noise, p_conf->rx_head, LN_SZ_NOISE_HEADER);
+        if (len == 0) {
+            LOGE("fail: noise header\n");
+            return -1;
+        }
+        utl_arena_reset(&p_conf->rx_arena);
+        if (!utl_arena_buf_alloc(&p_conf->rx_arena, &p_conf->rx_body, len)) {
+            LOGE("fail: alloc\n");
+            return -1;
         }
+        p_conf->rx_body_len = 0;
+    }
+
+    n = read(p_conf->sock,
+            p_conf->rx_body.buf + p_conf->rx_body_len, p_conf->rx_body.len - p_conf->rx_body_len);
+    if (n <= 0) {
+        return recv_error(p_conf, n);
+    }
+    p_conf->rx_body_len += (uint32_t)n;
+    if (p_conf->rx_body_len < p_conf->rx_body.len) {
+        return 0;
+    }
+
+    p_conf->rx_head_len = 0;
+    if (!ln_noise_dec_msg(&p_conf->noise, &p_conf->rx_body)) {
+        LOGD("DECODE: loop end\n");
+        return -1;
+    }
+    return 1;
+}
+
+
+/** read()結果の判定
+ *
+ * @param[in]   Result      read()の戻り値(0以下)
+ * @retval  0       受信データなし
+ * @retval  -1      切断またはエラー
+ */
+static int recv_error(lnapp_conf_t *p_conf, ssize_t Result)
+{
+    if (Result == 0) {
+        //disconnected
+        LOGD("DISC: loop end\n");
+        return -1;
+    }
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+        return 0;
+    }
+    LOGE("fail: %s(%016" PRIx64 ")\n", strerror(errno), ln_short_channel_id(&p_conf->channel));
+    return -1;
+}
+
 
-        pthread_mutex_unlock(&p_conf->mux_conf); //unlock
+/** 受信message処理
+ *
+ * @retval  false   channel終了
+ */
+static bool recv_msg_proc(lnapp_conf_t *p_conf)
+{
+    bool ret = false;
+    utl_buf_t *p_buf = &p_conf->rx_body;
+
+    uint16_t type = utl_int_pack_u16be(p_buf->buf);
+    LOGD("[RECV]type=%04x(%s): sock=%d, Len=%d\n", type, ln_msg_name(type), p_conf->sock, p_buf->len);
+
+    pthread_mutex_lock(&p_conf->mux_conf); //lock
+
+    if (ln_status_is_closing(&p_conf->channel)) {
+        LOGD("???\n");
+        goto LABEL_EXIT;
+    }
+    if (!ln_recv(&p_conf->channel, p_buf->buf, p_buf->len)) {
+        LOGD("DISC: fail recv message\n");
+        lnapp_close_channel_force(p_conf);
+        goto LABEL_EXIT;
     }
+    ret = true;
 
-    lnapp_stop_threads(p_conf);
-    utl_buf_free(&buf_recv);
-    LOGD("[exit]recv thread\n");
-    return NULL;
+LABEL_EXIT:
+    pthread_mutex_unlock(&p_conf->mux_conf); //unlock
+    //1message分をまとめて解放
+    utl_buf_init(p_buf);
+    utl_arena_reset(&p_conf->rx_arena);
+    return ret;
 }
 
 
-/** 受信処理
+/** 受信処理(同期)
  *
  * @param[in]   ToMsec      受信タイムアウト(0の場合、タイムアウト無し)
  * @note
- *      - called by #thread_recv_start(), #noise_handshake()
+ *      - called by #noise_handshake()
  */
 static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uint32_t ToMsec)
 {
@@ -1349,20 +1608,13 @@ static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uin
     while (p_conf->active && (Len > 0)) {
         fds.fd = p_conf->sock;
         fds.events = POLLIN;
+        fds.revents = 0;
         int polr = poll(&fds, 1, M_WAIT_RECV_TO_MSEC);
         if (polr < 0) {
             LOGD("poll: %s\n", strerror(errno));
             break;
         } else if (polr == 0) {
             //timeout
-
-            pthread_mutex_lock(&p_conf->mux_conf);
-            if ((p_conf->flag_recv & M_FLAGRECV_END) == M_FLAGRECV_END &&
-                !ln_status_is_closing(&p_conf->channel)) {
-                ln_idle_proc(&p_conf->channel, p_conf->feerate_per_kw);
-            }
-            pthread_mutex_unlock(&p_conf->mux_conf);
-
             if (ToMsec > 0) {
                 ToMsec--;
                 if (ToMsec == 0) {
@@ -1371,20 +1623,18 @@ static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uin
                 }
             }
         } else {
-            if (fds.revents & POLLIN) {
-                ssize_t n = read(p_conf->sock, pBuf, Len);
-                if (n > 0) {
-                    Len -= n;
-                    len += n;
-                    pBuf += n;
-                } else if (n == 0) {
-                    LOGE("fail: timeout(len=%d, reqLen=%d)\n", len, Len);
-                    break;
-                } else {
-                    LOGE("fail: %s(%016" PRIx64 ")\n", strerror(errno), ln_short_channel_id(&p_conf->channel));
-                    len = 0;
-                    break;
-                }
+            ssize_t n = read(p_conf->sock, pBuf, Len);
+            if (n > 0) {
+                Len -= n;
+                len += n;
+                pBuf += n;
+            } else if (n == 0) {
+                LOGE("fail: timeout(len=%d, reqLen=%d)\n", len, Len);
+                break;
+            } else if ((errno != EAGAIN) && (errno != EINTR)) {
+                LOGE("fail: %s(%016" PRIx64 ")\n", strerror(errno), ln_short_channel_id(&p_conf->channel));
+                len = 0;
+                break;
             }
         }
     }
@@ -1393,86 +1643,82 @@ static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uin
 }
 
 
+/** 受信アイドル処理
+ *
+ * init/channel_reestablish交換後、Normal Operationの処理を進める。
+ */
+static void recv_idle_proc(lnapp_conf_t *p_conf)
+{
+    pthread_mutex_lock(&p_conf->mux_conf);
+    if ((p_conf->flag_recv & M_FLAGRECV_END) == M_FLAGRECV_END &&
+        !ln_status_is_closing(&p_conf->channel)) {
+        ln_idle_proc(&p_conf->channel, p_conf->feerate_per_kw);
+    }
+    pthread_mutex_unlock(&p_conf->mux_conf);
+}
+
+
 /********************************************************************
  * [THREAD]polling
  ********************************************************************/
 
-/** polling thread entry point
+/** polling処理(M_WAIT_POLL_SEC間隔)
  *
- * @param[in,out]   pArg    lnapp_conf_t*
+ * @param[in,out]   p_conf  lnapp情報
  */
-static void *thread_poll_start(void *pArg)
+static void poll_proc(lnapp_conf_t *p_conf)
 {
-    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
-
-    LOGD("[THREAD]poll initialize: %d\n", p_conf->active);
-
-    while (p_conf->active) {
-        //ループ解除まで時間が長くなるので、短くチェックする
-        for (int lp = 0; lp < M_WAIT_POLL_SEC; lp++) {
-            sleep(1);
-            if (!p_conf->active) {
-                break;
-            }
-        }
-
-        if ((p_conf->flag_recv & M_FLAGRECV_INIT) == 0) {
-            //まだ接続していない
-            continue;
-        }
+    if ((p_conf->flag_recv & M_FLAGRECV_INIT) == 0) {
+        //まだ接続していない
+        return;
+    }
 
-        poll_ping(p_conf);
+    poll_ping(p_conf);
 
-        if (ln_status_get(&p_conf->channel) < LN_STATUS_ESTABLISH) {
-            //fundingしていない
-            continue;
-        }
+    if (ln_status_get(&p_conf->channel) < LN_STATUS_ESTABLISH) {
+        //fundingしていない
+        return;
+    }
 
-        uint32_t bak_conf = p_conf->funding_confirm;
-        bool b_get = btcrpc_get_confirmations(&p_conf->funding_confirm, ln_funding_info_txid(&p_conf->channel.funding_info));
-        if (b_get) {
-            if (bak_conf != p_conf->funding_confirm) {
-                const uint8_t *oldhash = ln_funding_blockhash(&p_conf->channel);
-                if (utl_mem_is_all_zero(oldhash, BTC_SZ_HASH256)) {
-                    int32_t bheight = 0;
-                    int32_t bindex = 0;
-                    uint8_t mined_hash[BTC_SZ_HASH256];
-                    bool ret = btcrpc_get_short_channel_param(
-                        ln_remote_node_id(&p_conf->channel), &bheight, &bindex, mined_hash, ln_funding_info_txid(&p_conf->channel.funding_info));
-                    if (ret) {
-                        //mined block hash
-                        ln_funding_blockhash_set(&p_conf->channel, mined_hash);
-                    }
+    uint32_t bak_conf = p_conf->funding_confirm;
+    bool b_get = btcrpc_get_confirmations(&p_conf->funding_confirm, ln_funding_info_txid(&p_conf->channel.funding_info));
+    if (b_get) {
+        if (bak_conf != p_conf->funding_confirm) {
+            const uint8_t *oldhash = ln_funding_blockhash(&p_conf->channel);
+            if (utl_mem_is_all_zero(oldhash, BTC_SZ_HASH256)) {
+                int32_t bheight = 0;
+                int32_t bindex = 0;
+                uint8_t mined_hash[BTC_SZ_HASH256];
+                bool ret = btcrpc_get_short_channel_param(
+                    ln_remote_node_id(&p_conf->channel), &bheight, &bindex, mined_hash, ln_funding_info_txid(&p_conf->channel.funding_info));
+                if (ret) {
+                    //mined block hash
+                    ln_funding_blockhash_set(&p_conf->channel, mined_hash);
                 }
-
-                LOGD2("***********************************\n");
-                LOGD2("* CONFIRMATION: %d\n", p_conf->funding_confirm);
-                LOGD2("*    funding_txid: ");
-                TXIDD(ln_funding_info_txid(&p_conf->channel.funding_info));
-                LOGD2("***********************************\n");
             }
-        } else {
-            //LOGD("funding_tx not detect: ");
-            //TXIDD(ln_funding_info_txid(&p_conf->channel));
-        }
 
-        //funding_tx
-        if (p_conf->funding_waiting) {
-            //funding_tx確定待ち(確定後はEstablishシーケンスの続きを行う)
-            poll_funding_wait(p_conf);
-        } else {
-            //Normal Operation中
-            poll_normal_operating(p_conf);
-        }
-
-        if (!send_announcement_signatures(p_conf)) {
-            break;
+            LOGD2("***********************************\n");
+            LOGD2("* CONFIRMATION: %d\n", p_conf->funding_confirm);
+            LOGD2("*    funding_txid: ");
+            TXIDD(ln_funding_info_txid(&p_conf->channel.funding_info));
+            LOGD2("***********************************\n");
         }
+    } else {
+        //LOGD("funding_tx not detect: ");
+        //TXIDD(ln_funding_info_txid(&p_conf->channel));
     }
 
-    LOGD("[exit]poll thread\n");
+    //funding_tx
+    if (p_conf->funding_waiting) {
+        //funding_tx確定待ち(確定後はEstablishシーケンスの続きを行う)
+        poll_funding_wait(p_conf);
+    } else {
+        //Normal Operation中
+        poll_normal_operating(p_conf);
+    }
 
-    return NULL;
+    //失敗時はlnapp_stop_threads()済み
+    (void)send_announcement_signatures(p_conf);
 }
 
 
@@ -1527,39 +1773,30 @@ static void poll_ping(lnapp_conf_t *p_conf)
 }
 
 
-//funding_tx確定待ち
+/** funding_tx確定待ち
+ *
+ * 確定後にfunding_lockedを送信し、受信後の処理は#channel_proc()で行う。
+ */
 static void poll_funding_wait(lnapp_conf_t *p_conf)
 {
     //DBGTRACE_BEGIN
 
+    if (p_conf->funding_locked_wait) {
+        //funding_locked受信待ち
+        return;
+    }
     if (p_conf->funding_confirm >= ln_funding_info_minimum_depth(&p_conf->channel.funding_info)) {
         LOGD("confirmation OK: %d\n", p_conf->funding_confirm);
         //funding_tx確定
         bool ret = set_short_channel_id(p_conf);
         if (ret) {
-            ret = exchange_funding_locked(p_conf);
-            assert(ret);
-
-            // send `channel_update` for private/before publish channel
-            send_cnlupd_before_announce(p_conf);
-
-            char close_addr[BTC_SZ_ADDR_STR_MAX + 1];
-            ret = btc_keys_spk2addr(close_addr, ln_shutdown_scriptpk_local(&p_conf->channel));
-            if (!ret) {
-                utl_str_bin2str(close_addr,
-                        ln_shutdown_scriptpk_local(&p_conf->channel)->buf,
-                        ln_shutdown_scriptpk_local(&p_conf->channel)->len);
-            }
-
-            char str_sci[LN_SZ_SHORT_CHANNEL_ID_STR + 1];
-            ln_short_channel_id_string(str_sci, ln_short_channel_id(&p_conf->channel));
-            ptarmd_eventlog(ln_channel_id(&p_conf->channel),
-                    "funding_locked: short_channel_id=%s, close_addr=%s",
-                    str_sci, close_addr);
-
-            p_conf->funding_waiting = false;
+            ret = funding_locked_send(p_conf);
+        }
+        if (ret) {
+            p_conf->funding_locked_wait = true;
         } else {
-            LOGE("fail: set_short_channel_id()\n");
+            LOGE("fail: funding_locked\n");
+            lnapp_stop_threads(p_conf);
         }
     } else {
         LOGD("confirmation waiting...: %d/%d\n",
@@ -1627,355 +1864,164 @@ static void send_cnlupd_before_announce(lnapp_conf_t *p_conf)
 
 
 /********************************************************************
- * announceスレッド
+ * announce
  ********************************************************************/
 
-/** announceスレッド開始
+/** announce周期処理
  *
- * @param[in,out]   pArg    lnapp_conf_t*
+ * 他peerから受信したannouncementがある場合やannodbが更新された場合は、
+ * 待ち時間を過ぎていなくても送信する。
+ *
+ * @param[in,out]   p_conf  lnapp情報
+ * @param[in]       Now     現在時刻
  */
-static void *thread_anno_start(void *pArg)
+static void anno_tick(lnapp_conf_t *p_conf, time_t Now)
 {
-    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
-    int slp = M_WAIT_ANNO_SEC;
-
-    LOGD("[THREAD]anno initialize: %d\n", p_conf->active);
-
-    while (p_conf->active) {
-        //ループ解除まで時間が長くなるので、短くチェックする
-        for (int lp = 0; lp < slp; lp++) {
-            sleep(1);
-            if (!p_conf->active) {
-                break;
-            }
-            if (p_conf->annodb_updated) {
-                break;
-            }
-        }
-
-        if ((p_conf->flag_recv & M_FLAGRECV_END) == 0) {
-            //まだ接続完了していない
-            continue;
-        }
-        time_t now = utl_time_time();
-        if (p_conf->annodb_updated && p_conf->annodb_cont && (now - p_conf->annodb_stamp < LNAPP_WAIT_ANNO_HYSTER_SEC)) {
-            LOGD("skip\n");
-            continue;
-        }
+    if ((Now < p_conf->anno_next) &&
+        !p_conf->annodb_updated &&
+        (p_conf->gossip_cursor >= ln_gossip_tail())) {
+        return;
+    }
+    if ((p_conf->flag_recv & M_FLAGRECV_END) == 0) {
+        //まだ接続完了していない
+        return;
+    }
+    if (p_conf->annodb_updated && p_conf->annodb_cont && (Now - p_conf->annodb_stamp < LNAPP_WAIT_ANNO_HYSTER_SEC)) {
+        LOGD("skip\n");
+        return;
+    }
 
-        bool retcnl = anno_proc(p_conf);
-        if (retcnl) {
-            //channel_listの最後まで見終わった
-            if (p_conf->annodb_updated) {
-                //annodb was updated, so anno_proc() will be done again.
-                // since updating annodb may have been in the middle of anno_proc().
-                p_conf->annodb_updated = false;
-                slp = M_WAIT_ANNO_SEC;
-            } else {
-                //次までを長くあける
-                slp = M_WAIT_ANNO_LONG_SEC;
-            }
+    int slp = M_WAIT_ANNO_SEC;
+    bool retcnl = anno_proc(p_conf);
+    if (retcnl) {
+        //channel_listの最後まで見終わった
+        if (p_conf->annodb_updated) {
+            //annodb was updated, so anno_proc() will be done again.
+            // since updating annodb may have been in the middle of anno_proc().
+            p_conf->annodb_updated = false;
         } else {
-            //channel_listの途中-->すぐに続きを行う
-            slp = M_WAIT_ANNO_SEC;
+            //次までを長くあける
+            slp = M_WAIT_ANNO_LONG_SEC;
         }
     }
-
-    LOGD("[exit]anno thread\n");
-
-    return NULL;
+    //channel_listの途中はM_WAIT_ANNO_SEC後に続きを行う
+    p_conf->anno_next = Now + slp;
 }
 
 
 /** channel_announcement/channel_update/node_announcement送信
  *
- * 接続先へ未送信のchannel_announcement/channel_updateを送信する。
- * 一度にすべて送信するとDBのロック期間が長くなるため、
- * 最大M_ANNO_UNITパケットまで送信を行い、残りは次回呼び出しに行う。
+ * gossip logのcursor以降のannouncementを接続先へ送信する。
+ * 一度にすべて送信すると他の送信が遅れるため、
+ * 最大M_ANNO_UNITのchannel_announcementまで送信を行い、残りは次回呼び出しに行う。
+ * 送信待ちがM_ANNO_SEND_PENDING以上ある場合も次回呼び出しに回す。
  *
  * @param[in,out]   p_conf  lnapp情報
- * @retval  true    リストの最後まで終わった
+ * @retval  true    logの最後まで終わった
  */
 static bool anno_proc(lnapp_conf_t *p_conf)
 {
-    bool ret;
+    bool ret = true;
     int anno_cnt = 0;
-    uint64_t short_channel_id = 0;
-    void *p_cur_cnl = NULL;         //channel
-    void *p_cur_node = NULL;        //node_announcement
-    void *p_cur_infocnl = NULL;     //channel送信済みDB
-    void *p_cur_infonode = NULL;    //node_announcement送信済みDB
-
-    LOGD("BEGIN: last=%" PRIx64 "\n", p_conf->last_anno_cnl);
-
-    ret = ln_db_anno_transaction();
-    if (!ret) {
-        LOGE("fail\n");
-        goto LABEL_EXIT;
-    }
-
-    LOGD("BEGIN 2(locked): last=%" PRIx64 "\n", p_conf->last_anno_cnl);
-
-    ret = ln_db_anno_cur_open(&p_cur_cnl, LN_DB_CUR_CNLANNO);
-    if (!ret) {
-        LOGE("fail\n");
-        goto LABEL_EXIT;
-    }
-    ret = ln_db_anno_cur_open(&p_cur_node, LN_DB_CUR_NODEANNO);
-    if (!ret) {
-        LOGE("fail\n");
-        goto LABEL_EXIT;
-    }
-    ret = ln_db_anno_cur_open(&p_cur_infocnl, LN_DB_CUR_CNLANNO_INFO);
-    if (!ret) {
-        LOGE("fail\n");
-        goto LABEL_EXIT;
-    }
-    ret = ln_db_anno_cur_open(&p_cur_infonode, LN_DB_CUR_NODEANNO_INFO);
-    if (!ret) {
-        LOGE("fail\n");
-        goto LABEL_EXIT;
-    }
+    ln_gossip_entry_t entry;
 
-    //これ以降、short_channel_id に 0以外の値が入っている状態で LABEL_EXITに到達すると、
-    //  そのshort_channel_idに関する channel_announcement, channel_update は削除される。
+    LOGD("BEGIN: cursor=%" PRIu64 "\n", p_conf->gossip_cursor);
 
     while (p_conf->active) {
-        char type;
-        uint32_t timestamp;
-        utl_buf_t buf_cnl = UTL_BUF_INIT;
-
-        ret = ln_db_cnlanno_cur_get(p_cur_cnl, &short_channel_id, &type, &timestamp, &buf_cnl);
-        if (!ret) {
-            //次回は最初から検索する
-            LOGD("annolist end\n");
-            p_conf->last_anno_cnl = 0;
-            utl_buf_free(&buf_cnl);
+        if (lnapp_send_peer_pending(p_conf) >= M_ANNO_SEND_PENDING) {
+            //peerの受信が追いついていないので、送信待ちが減ってから続きを送る
+            LOGD("annolist wait send\n");
+            ret = false;
             break;
         }
-        if (type != LN_DB_CNLANNO_ANNO) {
-            //BOLT#7: Pruning the Network View
-            if ((type == LN_DB_CNLANNO_UPD0) || (type == LN_DB_CNLANNO_UPD1)) {
-                uint64_t now = (uint64_t)utl_time_time();
-                if (ln_db_cnlupd_need_to_prune(now, timestamp)) {
-                    ln_db_cnlanno_cur_del(p_cur_cnl);
-                }
-            }
-            //LOGD("continue1: %" PRIx64 ":%c\n", short_channel_id, type);
-            utl_buf_free(&buf_cnl);
-            continue;
-        }
-        if (p_conf->last_anno_cnl != 0) {
-            //前回の続きであれば、次のshort_channel_idになるまで進める
-            if (p_conf->last_anno_cnl == short_channel_id) {
-                //1回だけ多く回すと、次回はここをスルーする
-                //LOGD("match\n");
-                p_conf->last_anno_cnl = 0;
-            }
-            utl_buf_free(&buf_cnl);
-            continue;
-        }
-
-        //buf_cnlにはshort_channel_idのchannel_announcement packetが入っている
-
-        bool unspent = check_unspent_short_channel_id(short_channel_id);
-        if (!unspent) {
-            //SPENTであれば削除
-            LOGD("pre_chan: delete all channel %016" PRIx64 "\n", short_channel_id);
-            utl_buf_free(&buf_cnl);
-            goto LABEL_EXIT;
+        if (!ln_gossip_next(&entry, &p_conf->gossip_cursor, ln_remote_node_id(&p_conf->channel))) {
+            LOGD("annolist end\n");
+            break;
         }
-
-        ret = anno_send(p_conf, short_channel_id, &buf_cnl, p_cur_cnl, p_cur_node, p_cur_infocnl, p_cur_infonode);
-        utl_buf_free(&buf_cnl);
-        if (ret) {
+        if (anno_send(p_conf, &entry) && (entry.type == LN_GOSSIP_TYPE_CNLANNO)) {
             anno_cnt++;
-            if (anno_cnt > M_ANNO_UNIT) {
-                LOGD("annolist next\n");
-                p_conf->last_anno_cnl = short_channel_id;
-                break;
-            }
         }
-    }
-    short_channel_id = 0;
-
-LABEL_EXIT:
-    if (p_cur_infonode != NULL) {
-        ln_db_anno_cur_close(p_cur_infonode);
-    }
-    if (p_cur_infocnl != NULL) {
-        ln_db_anno_cur_close(p_cur_infocnl);
-    }
-    if (p_cur_node != NULL) {
-        ln_db_anno_cur_close(p_cur_node);
-    }
-    if (p_cur_cnl != NULL) {
-        ln_db_anno_cur_close(p_cur_cnl);
-    }
-
-    ln_db_anno_commit(true);
-    if (short_channel_id != 0) {
-        (void)ln_db_cnlanno_del(short_channel_id);
+        utl_buf_free(&entry.buf);
+        if (anno_cnt >= M_ANNO_UNIT) {
+            LOGD("annolist next\n");
+            ret = false;
+            break;
+        }
     }
 
-    LOGD("END: %016" PRIx64 "\n", p_conf->last_anno_cnl);
-    return p_conf->last_anno_cnl == 0;
+    LOGD("END: cursor=%" PRIu64 "\n", p_conf->gossip_cursor);
+    return ret;
 }
 
 
-/** send announcements
- *  channel_announcement, channel_update(dir=0,1), node_announcement(0,1)
+/** send announcement
+ *  channel_announcement, channel_update(dir=0,1), node_announcement
  *
  * @param[in]   p_conf
- * @param[in]   short_channel_id
- * @param[in]   p_buf_cnl               channel_announcement packet
- * @param[in]   p_cur_cnl               DB
- * @param[in]   p_cur_node              DB
- * @param[in]   p_cur_infocnl           DB
- * @param[in]   p_cur_infonode          DB
+ * @param[in]   p_entry                 gossip log entry
  * @retval  true    sent announcement
  * @retval  false   not send
  */
-static bool anno_send(
-    lnapp_conf_t *p_conf,
-    uint64_t short_channel_id,
-    const utl_buf_t *p_buf_cnl,
-    void *p_cur_cnl,
-    void *p_cur_node,
-    void *p_cur_infocnl,
-    void *p_cur_infonode)
+static bool anno_send(lnapp_conf_t *p_conf, const ln_gossip_entry_t *p_entry)
 {
-    char type;
-    uint32_t timestamp;
-    int cnt_upd = 0;
-    utl_buf_t buf_upd[2] = { UTL_BUF_INIT, UTL_BUF_INIT };  //channel_update(dir=0,1)
-    for (size_t lp = 0; lp < ARRAY_SIZE(buf_upd); lp++) {
-        uint64_t sci;
-        bool ret = ln_db_cnlanno_cur_get(p_cur_cnl, &sci, &type, &timestamp, &buf_upd[lp]);
-        if (ret && (sci == short_channel_id) && (type == (char)(LN_DB_CNLANNO_UPD0 + lp))) {
-            ret = anno_prev_check(short_channel_id, timestamp);
-            if (ret) {
-                cnt_upd++;
-            } else {
-                LOGD("pre_upd: delete channel_update %016" PRIx64 " %c\n", short_channel_id, type);
-                //channel_updateをDBから削除
-                ln_db_cnlanno_cur_del(p_cur_cnl);
-                utl_buf_free(&buf_upd[lp]);
-            }
-        } else if (!ret) {
-            LOGD("annolist end\n");
-            p_conf->last_anno_cnl = 0;
-            break;
-        } else {
-            //LOGD("back\n");
-            ret = ln_db_cnlanno_cur_back(p_cur_cnl);
-            utl_buf_free(&buf_upd[lp]);
+    switch (p_entry->type) {
+    case LN_GOSSIP_TYPE_CNLANNO:
+        if (!check_unspent_short_channel_id(p_entry->short_channel_id)) {
+            //SPENTであれば削除
+            LOGD("pre_chan: delete all channel %016" PRIx64 "\n", p_entry->short_channel_id);
+            (void)ln_db_cnlanno_del(p_entry->short_channel_id);
+            return false;
         }
-    }
-    if (cnt_upd > 0) {
-        //channel_announcement
-        anno_send_cnl(p_conf, short_channel_id, LN_DB_CNLANNO_ANNO, p_cur_infocnl, p_buf_cnl);
-
-        //channel_update
-        for (size_t lp = 0; lp < ARRAY_SIZE(buf_upd); lp++) {
-            if (buf_upd[lp].len > 0) {
-                anno_send_cnl(p_conf, short_channel_id, LN_DB_CNLANNO_UPD0 + lp, p_cur_infocnl, &buf_upd[lp]);
-            } else {
-                LOGD("skip: type=%c\n", LN_DB_CNLANNO_UPD0 + lp);
-            }
+        LOGD("send channel_announcement: %016" PRIx64 "\n", p_entry->short_channel_id);
+        break;
+    case LN_GOSSIP_TYPE_CNLUPD0:
+    case LN_GOSSIP_TYPE_CNLUPD1:
+        if (!anno_prev_check(p_entry->short_channel_id, p_entry->timestamp)) {
+            //channel_updateをDBから削除
+            LOGD("pre_upd: delete channel_update %016" PRIx64 " %d\n", p_entry->short_channel_id, p_entry->type);
+            (void)ln_db_cnlupd_del(p_entry->short_channel_id, (uint8_t)(p_entry->type - LN_GOSSIP_TYPE_CNLUPD0));
+            return false;
         }
-
-        //node_announcement
-        anno_send_node(p_conf, p_cur_node, p_cur_infonode, p_buf_cnl);
-    } else {
-        LOGD("skip channel: %" PRIx64 "\n", short_channel_id);
-    }
-    for (size_t lp = 0; lp < ARRAY_SIZE(buf_upd); lp++) {
-        utl_buf_free(&buf_upd[lp]);
+        LOGD("send channel_update: %016" PRIx64 " %d\n", p_entry->short_channel_id, p_entry->type);
+        break;
+    default:
+        LOGD("send node_announcement\n");
+        break;
     }
-
-    return cnt_upd > 0;
+    /*ignore*/lnapp_send_peer_noise(p_conf, &p_entry->buf);
+    return true;
 }
 
 
 /** channel_update事前チェック
  *
  * @param[in]       short_channel_id        target short_channel_id
- * @param[in]       timestamp               channel_announcement saved time
+ * @param[in]       timestamp               channel_update timestamp
  * @retval  true        nothing to do
  * @retval  false       channel_updateを削除してよい
  */
 static bool anno_prev_check(uint64_t short_channel_id, uint32_t timestamp)
 {
-    bool ret = true;
-
-    if (ln_db_channel_owned_check(short_channel_id)) {
-        return true;
-    }
-
     //BOLT#7: Pruning the Network View
     uint64_t now = (uint64_t)utl_time_time();
-    if (ln_db_cnlupd_need_to_prune(now, timestamp)) {
-        //古いため送信しない
-        char time[UTL_SZ_TIME_FMT_STR + 1];
-        LOGD("older channel_update: prune(%016" PRIx64 "): %s(now=%" PRIu32 ", tm=%" PRIu32 ")\n", short_channel_id, utl_time_fmt(time, timestamp), now, timestamp);
-        ret = false;
+    if (!ln_db_cnlupd_need_to_prune(now, timestamp)) {
+        return true;
     }
 
-    return ret;
-}
-
-
-/**
- *
- * @return  送信数
- */
-static bool anno_send_cnl(lnapp_conf_t *p_conf, uint64_t short_channel_id, char type, void *p_cur_infocnl, const utl_buf_t *p_buf_cnl)
-{
-    bool chk = ln_db_cnlanno_info_search_node_id(p_cur_infocnl, short_channel_id, type, ln_remote_node_id(&p_conf->channel));
-    if (!chk) {
-        LOGD("send channel_%c: %016" PRIx64 "\n", type, short_channel_id);
-        /*ignore*/lnapp_send_peer_noise(p_conf, p_buf_cnl);
-        ln_db_cnlanno_info_add_node_id(p_cur_infocnl, short_channel_id, type, false, ln_remote_node_id(&p_conf->channel));
-        chk = true;
-    } else {
-        //LOGD("CHAN already sent: short_channel_id=%016" PRIx64 ", type:%c\n", short_channel_id, type);
+    if (!ln_db_anno_transaction()) {
+        LOGE("fail\n");
+        return true;
     }
-    return chk;
-}
-
-
-/**
- *
- * @return  送信数
- */
-static bool anno_send_node(lnapp_conf_t *p_conf, void *p_cur_node, void *p_cur_infonode, const utl_buf_t *p_buf_cnl)
-{
-    uint64_t short_channel_id;
-    uint8_t node[2][BTC_SZ_PUBKEY];
-    bool ret = ln_get_ids_cnl_anno(&short_channel_id, node[0], node[1], p_buf_cnl->buf, p_buf_cnl->len);
-    if (!ret) {
-        return false;
+    bool owned = ln_db_channel_owned_check(short_channel_id);
+    ln_db_anno_commit(false);
+    if (owned) {
+        return true;
     }
 
-    utl_buf_t buf_node = UTL_BUF_INIT;
-
-    for (int lp = 0; lp < 2; lp++) {
-        ret = ln_db_nodeanno_info_search_node_id(p_cur_infonode, node[lp], ln_remote_node_id(&p_conf->channel));
-        if (!ret) {
-            ret = ln_db_nodeanno_cur_load(p_cur_node, &buf_node, NULL, node[lp]);
-            if (ret) {
-                LOGD("send node_anno(%d): ", lp);
-                DUMPD(node[lp], BTC_SZ_PUBKEY);
-                /*ignore*/lnapp_send_peer_noise(p_conf, &buf_node);
-                utl_buf_free(&buf_node);
-                ln_db_nodeanno_info_add_node_id(p_cur_infonode, node[lp], false, ln_remote_node_id(&p_conf->channel));
-            }
-        } else {
-            //LOGD("NODE already sent: short_channel_id=%016" PRIx64 ", node%d\n", short_channel_id, lp);
-        }
-    }
-    return true;
+    //古いため送信しない
+    char time[UTL_SZ_TIME_FMT_STR + 1];
+    LOGD("older channel_update: prune(%016" PRIx64 "): %s(now=%" PRIu64 ", tm=%" PRIu32 ")\n", short_channel_id, utl_time_fmt(time, timestamp), now, timestamp);
+    return false;
 }
 
 
@@ -2032,28 +2078,13 @@ static bool getnewaddress(utl_buf_t *pBuf)
  * @retval  true    funding_tx未使用
  * @note
  *      - close済みのchannelについてはannouncementしない方がよいのでは無いかと考えて行っている処理。
+ *      - 結果はshort_channel_id UTXO cacheに保持し、blockで更新する(#scid_cache_unspent())。
  *      - SPVでは処理負荷が重たいため、やらない。
  */
 static bool check_unspent_short_channel_id(uint64_t ShortChannelId)
 {
 #ifdef USE_BITCOIND
-    bool ret;
-    uint32_t bheight;
-    uint32_t bindex;
-    uint32_t vindex;
-    bool unspent;
-    uint8_t txid[BTC_SZ_TXID];
-
-    ln_short_channel_id_get_param(&bheight, &bindex, &vindex, ShortChannelId);
-    ret = btcrpc_gettxid_from_short_channel(txid, bheight, bindex);
-    if (ret) {
-        ret = btcrpc_check_unspent(NULL, &unspent, NULL, txid, vindex);
-    }
-    if (!(ret && unspent)) {
-        LOGD("already spent : %016" PRIx64 "(height=%" PRIu32 ", bindex=%" PRIu32 ", txindex=%" PRIu32 ")\n", ShortChannelId, bheight, bindex, vindex);
-    }
-
-    return ret && unspent;
+    return scid_cache_unspent(ShortChannelId);
 #else
     (void)ShortChannelId;
 
@@ -30,6 +30,8 @@
 
 #include "ptarmd.h"
 #include "conf.h"
+#include "peer_engine.h"
+#include "utl_arena.h"
 
 
 #ifdef __cplusplus
@@ -67,10 +69,11 @@ typedef struct lnapp_conf_t {
     uint32_t            ref_counter;
     ln_channel_t        channel;                ///< channelのコンテキスト
 
-    pthread_cond_t      cond;                   ///< threadの待ち合わせ
-    pthread_mutex_t     mux_th;                 ///< thread
+    pthread_mutex_t     mux_th;                 ///< engine登録/解除
     pthread_mutex_t     mux_conf;               ///< conf
-    pthread_mutex_t     mux_send;               ///< socket送信中のmutex
+    pthread_mutex_t     mux_send;               ///< socket送信中/送信待ちのmutex
+    bool                origin;                 ///< true:origin/final node(socketなし)
+    peer_engine_handle_t    engine;             ///< peer I/O engine登録情報
 
     //XXX: start param
     bool                initiator;                  ///< true:Noise Protocol handshakeのinitiator
@@ -84,15 +87,32 @@ typedef struct lnapp_conf_t {
     volatile bool       active;                 ///< true:channel動作中
     volatile uint8_t    flag_recv;              ///< 受信フラグ(M_FLAGRECV_xxx)
     int                 ping_counter;           ///< 無送受信時にping送信するカウンタ(カウントアップ)
+    int                 phase;                  ///< 接続シーケンスの状態(M_PHASE_xxx)
+    time_t              phase_limit;            ///< phaseのタイムアウト時刻(0:無し)
+    time_t              tick_sec;               ///< 秒単位の周期処理を最後に行った時刻
+    time_t              poll_next;              ///< 次にpoll処理を行う時刻
+
+    uint8_t             rx_head[LN_SZ_NOISE_HEADER];    ///< 受信中のnoise header
+    uint16_t            rx_head_len;                    ///< rx_headの受信済み長
+    utl_buf_t           rx_body;                        ///< 受信中のnoise body(len:受信予定長, rx_arenaから確保)
+    uint32_t            rx_body_len;                    ///< rx_bodyの受信済み長
+    utl_arena_t         rx_arena;                       ///< 受信messageのメモリ確保元(1message処理毎にreset)
+    utl_arena_t         tx_arena;                       ///< 送信messageのメモリ確保元(mux_send中のみ使用)
+    bool                rx_pause;                       ///< true:announcement検証待ちのため受信停止中
+    utl_buf_t           tx_buf;                         ///< 送信待ち(暗号化済み, mux_send中のみ使用)
+    uint32_t            tx_len;                         ///< tx_bufの有効長
+    uint32_t            tx_pos;                         ///< tx_bufの送信済み位置
 
     bool                funding_waiting;        ///< true:funding_txの安定待ち
+    bool                funding_locked_wait;    ///< true:funding_locked受信待ち
     uint32_t            funding_confirm;        ///< funding_txのconfirmation数
 
-    uint64_t            last_anno_cnl;          ///< [#send_channel_anno()]最後にannouncementしたchannel
+    uint64_t            gossip_cursor;          ///< [#anno_proc()]次に送信するgossip logのseq
     bool                annosig_send_req;       ///< true: open_channel.announce_channel=1 and announcement_signatures not send
     bool                annodb_updated;         ///< true: flag to notify annodb update
     bool                annodb_cont;            ///< true: announcement連続送信中
     time_t              annodb_stamp;           ///< last annodb_updated change time
+    time_t              anno_next;              ///< 次にanno_proc()を行う時刻
 
     uint32_t            feerate_per_kw;
 
@@ -100,10 +120,6 @@ typedef struct lnapp_conf_t {
 
     int                 err;                    ///< last error
     char                *p_errstr;              ///< last error string(UTL_DBG_MALLOC)
-
-    //XXX: create and join
-    pthread_t           th;                     ///< pthread id
-    void *              (*p_thread_channel_start)(void *pArg);
 } lnapp_conf_t;
 
 
@@ -117,8 +133,7 @@ void lnapp_global_init(void);
 bool lnapp_handshake(peer_conn_handshake_t *pConnHandshake);
 
 
-void lnapp_conf_init(
-    lnapp_conf_t *pAppConf, const uint8_t *pPeerNodeId, void *(*pThreadChannelStart)(void *pArg));
+void lnapp_conf_init(lnapp_conf_t *pAppConf, const uint8_t *pPeerNodeId, bool bOrigin);
 void lnapp_conf_term(lnapp_conf_t *pAppConf);
 void lnapp_conf_start(
     lnapp_conf_t *pAppConf, bool Initiator, int Sock, const char *pConnStr, uint16_t ConnPort,
@@ -128,12 +143,14 @@ void lnapp_conf_stop(lnapp_conf_t *pAppConf);
 
 /** [lnapp]開始
  *
+ * peer I/O engineに登録する。以降の処理はengineのworker threadで行う。
  */
 void lnapp_start(lnapp_conf_t *pAppConf);
 
 
 /** [lnapp]停止
  *
+ * engineから登録解除されるまで待つ。
  */
 void lnapp_stop(lnapp_conf_t *pAppConf);
 
@@ -187,6 +204,13 @@ void lnapp_set_feerate(lnapp_conf_t *pAppConf, uint32_t FeeratePerKw);
  * その他
  *******************************************/
 
+/** [lnapp]forward DB追加通知
+ *
+ * engineのtickを待たず、すぐにforward処理をさせる。
+ */
+void lnapp_notify_forward(lnapp_conf_t *pAppConf);
+
+
 /** [lnapp]short_channel_idに対応するlnappか
  *
  */
@@ -233,19 +257,6 @@ bool lnapp_is_connected(const lnapp_conf_t *pAppConf);
 bool lnapp_is_inited(const lnapp_conf_t *pAppConf);
 
 
-/** channel thread entry point
- *
- * @param[in,out]   pArg    lnapp_conf_t*
- */
-void *lnapp_thread_channel_start(void *pArg);
-
-
-/** channel thread entry point
- *
- * @param[in,out]   pArg    lnapp_conf_t*
- */
-void *lnapp_thread_channel_origin_start(void *pArg);
-
 
 #ifdef __cplusplus
 }
@@ -705,7 +705,8 @@ static void cbsub_fail_originnode(lnapp_conf_t *pConf, ln_cb_param_start_bwd_del
                 strcpy(suggest, "invalid");
             }
             if (short_channel_id != 0) {
-                ln_db_route_skip_save(short_channel_id, btemp);
+                ln_db_route_skip_save(short_channel_id, btemp,
+                    (btemp) ? (uint64_t)utl_time_time() + LN_DB_ROUTE_SKIP_TEMP_SEC : 0);
                 ln_short_channel_id_string(suggest, short_channel_id);
                 pCbParam->ret = true;
             }
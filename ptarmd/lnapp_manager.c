@@ -22,19 +22,33 @@
 #define LOG_TAG     "lnapp_manager"
 #include "utl_log.h"
 
+#include "utl_dbg.h"
+
 #include "ln_db.h"
 
 #include "lnapp.h"
 #include "lnapp_manager.h"
+#include "peer_engine.h"
+
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define M_ENGINE_WORKERS        (4)         ///< peer engineのworker thread数
+#define M_ENGINE_TICK_MSEC      (100)       ///< peer engineの周期処理間隔[msec]
 
 
 /********************************************************************
  * static variables
  ********************************************************************/
 
-static lnapp_conf_t     mAppConf[MAX_CHANNELS + 1];
-    //the additional one is for handling origin/final node itself.
+static lnapp_conf_t     **mppAppConf;
+static int              mAppConfNum;
+    //MaxPeers + 1: the additional one is for handling origin/final node itself.
     //  treat as a dummy channel as node_id=0 and short_channel_id=0.
+    //  each slot is allocated on first use and reused until lnapp_manager_term().
+    //  (peer engine handles must not be freed while the engine is running)
 pthread_mutex_t         mMuxAppconf = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 const uint8_t           mNodeIdOrigin[BTC_SZ_PUBKEY] = {0};
 
@@ -43,6 +57,7 @@ const uint8_t           mNodeIdOrigin[BTC_SZ_PUBKEY] = {0};
  * prototypes
  ********************************************************************/
 
+static lnapp_conf_t *slot_get(int Idx);
 static bool load_channel(ln_channel_t *pChannel, void *pDbParam, void *pParam);
 
 
@@ -50,25 +65,51 @@ static bool load_channel(ln_channel_t *pChannel, void *pDbParam, void *pParam);
  * public functions
  ********************************************************************/
 
-void lnapp_manager_init(void)
+bool lnapp_manager_init(int MaxPeers)
 {
-    memset(&mAppConf, 0x00, sizeof(mAppConf));
+    if (MaxPeers <= 0) {
+        LOGE("fail: max peers(%d)\n", MaxPeers);
+        return false;
+    }
+    mAppConfNum = MaxPeers + 1;
+    mppAppConf = (lnapp_conf_t **)UTL_DBG_CALLOC(mAppConfNum, sizeof(lnapp_conf_t *));
+    if (!mppAppConf) {
+        LOGE("fail: alloc\n");
+        return false;
+    }
+    if (!peer_engine_init(M_ENGINE_WORKERS, M_ENGINE_TICK_MSEC)) {
+        LOGE("fail: peer engine\n");
+        UTL_DBG_FREE(mppAppConf);
+        mAppConfNum = 0;
+        return false;
+    }
+    LOGD("max peers: %d\n", MaxPeers);
     int idx = 1; //skip origin node
     ln_db_channel_search_cont(load_channel, &idx); //XXX: error check
+    return true;
 }
 
 
 void lnapp_manager_term(void)
 {
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!mAppConf[lp].enabled) continue;
-        lnapp_stop(&mAppConf[lp]);
-        lnapp_conf_term(&mAppConf[lp]);
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        if (!mppAppConf[lp] || !mppAppConf[lp]->enabled) continue;
+        lnapp_stop(mppAppConf[lp]);
     }
+    peer_engine_term();
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        if (!mppAppConf[lp]) continue;
+        if (mppAppConf[lp]->enabled) {
+            lnapp_conf_term(mppAppConf[lp]);
+        }
+        UTL_DBG_FREE(mppAppConf[lp]);
+    }
+    UTL_DBG_FREE(mppAppConf);
+    mAppConfNum = 0;
 }
 
 
-bool lnapp_manager_start_origin_node(void *(*pThreadChannelStart)(void *pArg))
+bool lnapp_manager_start_origin_node(void)
 {
     LOGD("\n");
     if (!ln_db_forward_add_htlc_create(0)) {
@@ -79,7 +120,7 @@ bool lnapp_manager_start_origin_node(void *(*pThreadChannelStart)(void *pArg))
         LOGE("fail: ???\n");
         return false;
     }
-    lnapp_conf_t *p_conf = lnapp_manager_get_new_node(mNodeIdOrigin, pThreadChannelStart);
+    lnapp_conf_t *p_conf = lnapp_manager_get_new_node(mNodeIdOrigin);
     assert(p_conf);
     lnapp_start(p_conf);
     LOGD("\n");
@@ -91,10 +132,10 @@ lnapp_conf_t *lnapp_manager_get_node(const uint8_t *pNodeId)
 {
     pthread_mutex_lock(&mMuxAppconf);
     lnapp_conf_t *p_conf = NULL;
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!mAppConf[lp].enabled) continue;
-        if (memcmp(mAppConf[lp].node_id, pNodeId, BTC_SZ_PUBKEY)) continue;
-        p_conf = &mAppConf[lp];
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        if (!mppAppConf[lp] || !mppAppConf[lp]->enabled) continue;
+        if (memcmp(mppAppConf[lp]->node_id, pNodeId, BTC_SZ_PUBKEY)) continue;
+        p_conf = mppAppConf[lp];
         p_conf->ref_counter++;
         LOGD("ref_counter++: [%p] %u -> %u\n", p_conf, p_conf->ref_counter - 1, p_conf->ref_counter);
         break;
@@ -107,8 +148,9 @@ lnapp_conf_t *lnapp_manager_get_node(const uint8_t *pNodeId)
 void lnapp_manager_each_node(void (*pCallback)(lnapp_conf_t *pConf, void *pParam), void *pParam)
 {
     pthread_mutex_lock(&mMuxAppconf);
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        lnapp_conf_t *p_conf = &mAppConf[lp];
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        lnapp_conf_t *p_conf = mppAppConf[lp];
+        if (!p_conf) continue;
         if (!memcmp(p_conf->node_id, mNodeIdOrigin, BTC_SZ_PUBKEY)) continue; //skip origin node
         if (!p_conf->enabled) continue;
         p_conf->ref_counter++;
@@ -123,27 +165,30 @@ void lnapp_manager_each_node(void (*pCallback)(lnapp_conf_t *pConf, void *pParam
 }
 
 
-lnapp_conf_t *lnapp_manager_get_new_node(
-    const uint8_t *pNodeId, void *(*pThreadChannelStart)(void *pArg))
+lnapp_conf_t *lnapp_manager_get_new_node(const uint8_t *pNodeId)
 {
     pthread_mutex_lock(&mMuxAppconf);
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!mAppConf[lp].enabled) continue;
-        if (memcmp(mAppConf[lp].node_id, pNodeId, BTC_SZ_PUBKEY)) continue;
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        if (!mppAppConf[lp] || !mppAppConf[lp]->enabled) continue;
+        if (memcmp(mppAppConf[lp]->node_id, pNodeId, BTC_SZ_PUBKEY)) continue;
         LOGE("fail: always exists\n");
         pthread_mutex_unlock(&mMuxAppconf);
         return NULL;
     }
     lnapp_conf_t *p_conf = NULL;
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (mAppConf[lp].enabled) continue;
-        p_conf = &mAppConf[lp];
-        lnapp_conf_init(p_conf, pNodeId, pThreadChannelStart);
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        if (mppAppConf[lp] && mppAppConf[lp]->enabled) continue;
+        p_conf = slot_get(lp);
+        if (!p_conf) break;
+        lnapp_conf_init(p_conf, pNodeId, !memcmp(pNodeId, mNodeIdOrigin, BTC_SZ_PUBKEY));
         p_conf->ref_counter++;
         LOGD("ref_counter++: [%p] %u -> %u\n", p_conf, p_conf->ref_counter - 1, p_conf->ref_counter);
         break;
     }
     pthread_mutex_unlock(&mMuxAppconf);
+    if (!p_conf) {
+        LOGE("fail: no empty slot(max peers=%d)\n", mAppConfNum - 1);
+    }
     return p_conf;
 }
 
@@ -171,21 +216,45 @@ void lnapp_manager_term_node(const uint8_t *pNodeId)
 void lnapp_manager_prune_node()
 {
     pthread_mutex_lock(&mMuxAppconf);
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!memcmp(mAppConf[lp].node_id, mNodeIdOrigin, BTC_SZ_PUBKEY)) continue; //skip origin node
-        if (!mAppConf[lp].enabled) continue;
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        lnapp_conf_t *p_conf = mppAppConf[lp];
+        if (!p_conf) continue;
+        if (!memcmp(p_conf->node_id, mNodeIdOrigin, BTC_SZ_PUBKEY)) continue; //skip origin node
+        if (!p_conf->enabled) continue;
         //no lock required
-        if (ln_status_get(&mAppConf[lp].channel) < LN_STATUS_ESTABLISH) {
+        if (ln_status_get(&p_conf->channel) < LN_STATUS_ESTABLISH) {
             ;
-        } else if (ln_status_get(&mAppConf[lp].channel) == LN_STATUS_CLOSED) {
-            lnapp_stop(&mAppConf[lp]);
+        } else if (ln_status_get(&p_conf->channel) == LN_STATUS_CLOSED) {
+            lnapp_stop(p_conf);
         } else {
             continue;
         }
-        if (mAppConf[lp].ref_counter) continue;
+        if (p_conf->ref_counter) continue;
+        if (peer_engine_is_added(&p_conf->engine)) continue; //callback終了待ち
         LOGD("prune node: ");
-        DUMPD(mAppConf[lp].node_id, BTC_SZ_PUBKEY);
-        lnapp_conf_term(&mAppConf[lp]);
+        DUMPD(p_conf->node_id, BTC_SZ_PUBKEY);
+        lnapp_conf_term(p_conf);
+    }
+    pthread_mutex_unlock(&mMuxAppconf);
+}
+
+
+/** forward DB追加通知(#ln_forward_notify_t)
+ *
+ * @param[in]   ShortChannelId      転送先short_channel_id(0:origin/final node)
+ */
+void lnapp_manager_notify_forward(uint64_t ShortChannelId)
+{
+    pthread_mutex_lock(&mMuxAppconf);
+    for (int lp = 0; lp < mAppConfNum; lp++) {
+        if (!mppAppConf[lp] || !mppAppConf[lp]->enabled) continue;
+        if (ShortChannelId) {
+            if (!lnapp_match_short_channel_id(mppAppConf[lp], ShortChannelId)) continue;
+        } else {
+            if (memcmp(mppAppConf[lp]->node_id, mNodeIdOrigin, BTC_SZ_PUBKEY)) continue;
+        }
+        lnapp_notify_forward(mppAppConf[lp]);
+        break;
     }
     pthread_mutex_unlock(&mMuxAppconf);
 }
@@ -195,19 +264,44 @@ void lnapp_manager_prune_node()
  * private functions
  ********************************************************************/
 
+/** slot取得
+ *
+ * 未使用のslotはここで確保する。
+ *
+ * @param[in]   Idx     slot index
+ * @return  lnapp_conf_t(確保失敗時はNULL)
+ */
+static lnapp_conf_t *slot_get(int Idx)
+{
+    if (!mppAppConf[Idx]) {
+        mppAppConf[Idx] = (lnapp_conf_t *)UTL_DBG_CALLOC(1, sizeof(lnapp_conf_t));
+        if (!mppAppConf[Idx]) {
+            LOGE("fail: alloc\n");
+            return NULL;
+        }
+        mppAppConf[Idx]->sock = -1;
+    }
+    return mppAppConf[Idx];
+}
+
+
 static bool load_channel(ln_channel_t *pChannel, void *pDbParam, void *pParam)
 {
     (void)pDbParam;
 
     int *p_idx = (int *)pParam;
 
-    if (*p_idx >= (int)ARRAY_SIZE(mAppConf)) {
-        assert(0);
+    if (*p_idx >= mAppConfNum) {
+        LOGE("fail: too many channels in DB(max peers=%d)\n", mAppConfNum - 1);
         return false;
     }
 
-    ln_channel_t *p_channel = &mAppConf[*p_idx].channel;
-    lnapp_conf_init(&mAppConf[*p_idx], pChannel->peer_node_id, lnapp_thread_channel_start);
+    lnapp_conf_t *p_conf = slot_get(*p_idx);
+    if (!p_conf) {
+        return false;
+    }
+    ln_channel_t *p_channel = &p_conf->channel;
+    lnapp_conf_init(p_conf, pChannel->peer_node_id, false);
     ln_db_copy_channel(p_channel, pChannel);
     if (p_channel->short_channel_id) {
         ln_db_cnlanno_load(&p_channel->cnl_anno, p_channel->short_channel_id);
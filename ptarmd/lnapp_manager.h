@@ -37,15 +37,15 @@ extern "C" {
  * prototypes
  ********************************************************************/
 
-void lnapp_manager_init(void);
+bool lnapp_manager_init(int MaxPeers);
 void lnapp_manager_term(void);
-bool lnapp_manager_start_origin_node(void *(*pThreadChannelStart)(void *pArg));
+bool lnapp_manager_start_origin_node(void);
 lnapp_conf_t *lnapp_manager_get_node(const uint8_t *pNodeId);
 void lnapp_manager_each_node(void (*pCallback)(lnapp_conf_t *pConf, void *pParam), void *pParam);
-lnapp_conf_t *lnapp_manager_get_new_node(
-    const uint8_t *pNodeId, void *(*pThreadChannelStart)(void *pArg));
+lnapp_conf_t *lnapp_manager_get_new_node(const uint8_t *pNodeId);
 void lnapp_manager_free_node_ref(lnapp_conf_t *pConf);
 void lnapp_manager_prune_node();
+void lnapp_manager_notify_forward(uint64_t ShortChannelId);
 
 
 #ifdef __cplusplus
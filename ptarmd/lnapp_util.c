@@ -60,7 +60,15 @@
  ********************************************************************/
 
 #define M_WAIT_SEND_TO_MSEC     (500)       //socket送信待ちタイムアウト[msec]
-#define M_WAIT_SEND_WAIT_MSEC   (100)       //socket送信で一度に送信できなかった場合の待ち時間[msec]
+#define M_SEND_QUEUE_MAX        (4 * 1024 * 1024)   //peer送信待ちの上限[byte](超えたら切断)
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static bool send_nonblock(lnapp_conf_t *p_conf, const uint8_t *pData, uint32_t Len, uint32_t *pSent);
+static bool send_queue_add(lnapp_conf_t *p_conf, const uint8_t *pData, uint32_t Len);
 
 
 /********************************************************************
@@ -74,8 +82,8 @@ void lnapp_stop_threads(lnapp_conf_t *p_conf)
     pthread_mutex_lock(&p_conf->mux_conf);
     if (p_conf->active) {
         p_conf->active = false;
-        //mainloop待ち合わせ解除(*2)
-        pthread_cond_signal(&p_conf->cond);
+        //engineのcallbackで終了処理を行う
+        peer_engine_notify(&p_conf->engine);
         char str_sci[LN_SZ_SHORT_CHANNEL_ID_STR + 1];
         ln_short_channel_id_string(str_sci, ln_short_channel_id(&p_conf->channel));
         LOGD("=========================================\n");
@@ -103,15 +111,16 @@ bool lnapp_send_peer_raw(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
             LOGE("fail poll: %s\n", strerror(errno));
             break;
         }
-        ssize_t sz = write(p_conf->sock, pBuf->buf, len);
+        ssize_t sz = write(p_conf->sock, pBuf->buf + pBuf->len - len, len);
         if (sz < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+                //socketはnon-blocking
+                continue;
+            }
             LOGE("fail write: %s\n", strerror(errno));
             break;
         }
         len -= sz;
-        if (len > 0) {
-            utl_thread_msleep(M_WAIT_SEND_WAIT_MSEC);
-        }
     }
 
     return len == 0;
@@ -127,43 +136,65 @@ bool lnapp_send_peer_noise(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
     pthread_mutex_lock(&p_conf->mux_send); //lock mux_send
 
     utl_buf_t buf_enc = UTL_BUF_INIT;
-    struct pollfd fds;
-    ssize_t len = -1;
+    uint32_t sent = 0;
 
-    bool ret = ln_noise_enc(&p_conf->noise, &buf_enc, pBuf);
+    //buf_encはtx_arenaから確保し、送信後にまとめて解放する
+    bool ret = ln_noise_enc_arena(&p_conf->noise, &buf_enc, pBuf, &p_conf->tx_arena);
     if (!ret) {
         LOGE("fail: noise encode\n");
-        goto LABEL_ERROR;
+        goto LABEL_EXIT;
     }
 
-    len = buf_enc.len;
-    while ((p_conf->active) && (len > 0)) {
-        fds.fd = p_conf->sock;
-        fds.events = POLLOUT;
-        int polr = poll(&fds, 1, M_WAIT_SEND_TO_MSEC);
-        if (polr <= 0) {
-            LOGE("fail: poll %s\n", strerror(errno));
-            goto LABEL_ERROR;
-        }
-        ssize_t sz = write(p_conf->sock, buf_enc.buf, len);
-        if (sz < 0) {
-            LOGE("fail: write %s\n", strerror(errno));
-            goto LABEL_ERROR;
+    if (p_conf->tx_len == p_conf->tx_pos) {
+        //送信待ちがなければ、送れるだけ直接送る
+        ret = send_nonblock(p_conf, buf_enc.buf, buf_enc.len, &sent);
+        if (!ret) {
+            goto LABEL_EXIT;
         }
-        len -= sz;
-        if (len > 0) {
-            utl_thread_msleep(M_WAIT_SEND_WAIT_MSEC);
+    }
+    if (sent < buf_enc.len) {
+        //残りは送信待ちに積み、送信可能になったらlnapp_send_peer_flush()で送る
+        ret = send_queue_add(p_conf, buf_enc.buf + sent, buf_enc.len - sent);
+        if (ret) {
+            peer_engine_write_wait(&p_conf->engine, true);
         }
     }
 
-    pthread_mutex_unlock(&p_conf->mux_send);
-    utl_buf_free(&buf_enc);
-    return true;
+LABEL_EXIT:
+    utl_arena_reset(&p_conf->tx_arena);
+    pthread_mutex_unlock(&p_conf->mux_send); //unlock mux_send
+    return ret;
+}
+
+
+//peer送信待ちの送信
+bool lnapp_send_peer_flush(lnapp_conf_t *p_conf)
+{
+    pthread_mutex_lock(&p_conf->mux_send); //lock mux_send
+
+    uint32_t sent = 0;
+    bool ret = send_nonblock(p_conf, p_conf->tx_buf.buf + p_conf->tx_pos, p_conf->tx_len - p_conf->tx_pos, &sent);
+    if (ret) {
+        p_conf->tx_pos += sent;
+        if (p_conf->tx_pos == p_conf->tx_len) {
+            p_conf->tx_pos = 0;
+            p_conf->tx_len = 0;
+            peer_engine_write_wait(&p_conf->engine, false);
+        }
+    }
 
-LABEL_ERROR:
     pthread_mutex_unlock(&p_conf->mux_send); //unlock mux_send
-    utl_buf_free(&buf_enc);
-    return false;
+    return ret;
+}
+
+
+//peer送信待ちのサイズ
+uint32_t lnapp_send_peer_pending(lnapp_conf_t *p_conf)
+{
+    pthread_mutex_lock(&p_conf->mux_send);
+    uint32_t len = p_conf->tx_len - p_conf->tx_pos;
+    pthread_mutex_unlock(&p_conf->mux_send);
+    return len;
 }
 
 
@@ -202,3 +233,72 @@ void lnapp_set_last_error(lnapp_conf_t *p_conf, int Err, const char *pErrStr)
 }
 
 
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** socket送信(待たない)
+ *
+ * @param[in]   pData       送信データ
+ * @param[in]   Len         pData長
+ * @param[out]  pSent       送信できた長さ
+ * @retval  false   socketエラー
+ * @note
+ *      - mux_send lock済みで呼び出すこと
+ */
+static bool send_nonblock(lnapp_conf_t *p_conf, const uint8_t *pData, uint32_t Len, uint32_t *pSent)
+{
+    *pSent = 0;
+    while ((p_conf->active) && (*pSent < Len)) {
+        ssize_t sz = write(p_conf->sock, pData + *pSent, Len - *pSent);
+        if (sz < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                //socketはnon-blocking: 残りは送信可能になってから送る
+                break;
+            }
+            LOGE("fail: write %s\n", strerror(errno));
+            return false;
+        }
+        *pSent += (uint32_t)sz;
+    }
+    return true;
+}
+
+
+/** 送信待ちに追加
+ *
+ * 送信済みの分を詰めてから末尾に追加する。
+ *
+ * @retval  false   #M_SEND_QUEUE_MAXを超える(peerが受信していない)またはメモリ確保失敗
+ * @note
+ *      - mux_send lock済みで呼び出すこと
+ */
+static bool send_queue_add(lnapp_conf_t *p_conf, const uint8_t *pData, uint32_t Len)
+{
+    uint32_t remain = p_conf->tx_len - p_conf->tx_pos;
+    if (remain + Len > M_SEND_QUEUE_MAX) {
+        LOGE("fail: send queue full(%" PRIu32 " + %" PRIu32 ")\n", remain, Len);
+        return false;
+    }
+    if (p_conf->tx_pos > 0) {
+        memmove(p_conf->tx_buf.buf, p_conf->tx_buf.buf + p_conf->tx_pos, remain);
+        p_conf->tx_pos = 0;
+        p_conf->tx_len = remain;
+    }
+    if (p_conf->tx_buf.len < remain + Len) {
+        uint32_t size = p_conf->tx_buf.len * 2;
+        if (size < remain + Len) {
+            size = remain + Len;
+        }
+        if (!utl_buf_realloc(&p_conf->tx_buf, size)) {
+            LOGE("fail: alloc\n");
+            return false;
+        }
+    }
+    memcpy(p_conf->tx_buf.buf + p_conf->tx_len, pData, Len);
+    p_conf->tx_len += Len;
+    return true;
+}
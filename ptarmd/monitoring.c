@@ -32,6 +32,7 @@
 
 #define LOG_TAG     "monitoring"
 #include "utl_log.h"
+#include "utl_mem.h"
 
 #include "ln_msg_anno.h"
 #include "ln_wallet.h"
@@ -42,6 +43,8 @@
 #include "lnapp_manager.h"
 #include "btcrpc.h"
 #include "cmd_json.h"
+#include "watch.h"
+#include "scid_cache.h"
 #include "monitoring.h"
 
 
@@ -64,6 +67,10 @@
 
 #define M_SZ_SCRIPT_PARAM       (512)
 
+//watch index
+#define M_WATCH_BLOCKS_MAX      (6)         ///< 1周期で反映するblock数上限(超えた場合はchannel毎にbitcoindで確認する)
+#define M_OFFSET_PREV_BLOCKHASH (4)         ///< block header: prev_block
+
 
 /**************************************************************************
  * typedefs
@@ -73,6 +80,8 @@ typedef struct {
     //global
     uint32_t    feerate_per_kw;         ///< feerate_per_kw
     int32_t     height;                 ///< current block height
+    bool        watch_synced;           ///< true:watch indexに最新blockまで反映している
+    bool        new_block;              ///< true:前回の監視からblockが増えた
 
     //work: each channel
     uint32_t    confm;                  ///< funding_tx confirmation
@@ -87,6 +96,8 @@ typedef struct monchanlist_t {
 
     uint8_t     channel_id[LN_SZ_CHANNEL_ID];   // monitoring channel_id
     uint32_t    last_check_confm;               // last confirmation btcrpc_search_outpoint()
+    uint8_t     revoked_txid[BTC_SZ_TXID];      // revoked transaction(watch index)
+    uint32_t    revoked_vout_cnt;               // revoked transaction vout count(0: not watching)
 } monchanlist_t;
 LIST_HEAD(monchanlisthead_t, monchanlist_t);
 
@@ -100,6 +111,8 @@ static bool                 mDisableAutoConn;           ///< true:channelのあ
 static uint32_t             mFeeratePerKw;              ///< 0:estimate fee / !0:use this value
 static monparam_t           mMonParam;
 static struct monchanlisthead_t mMonChanListHead;
+static int32_t              mWatchHeight;               ///< watch indexに反映したblock height
+static uint8_t              mWatchHash[BTC_SZ_HASH256]; ///< mWatchHeightのblock hash
 
 
 /********************************************************************
@@ -134,6 +147,12 @@ static void set_wallet_data(ln_db_wallet_t *pWlt, const btc_tx_t *pTx);
 static uint32_t get_latest_feerate_kw(void);
 static bool update_btc_values(void);
 
+static void update_watch(void);
+static void watch_spent(const watch_outpoint_t *pWatch, const btc_tx_view_t *pView, void *pParam);
+static bool check_unspent(const ln_channel_t *pChannel, bool *pUnspent, const uint8_t *pTxid, uint32_t Index, watch_type_t Type);
+static uint32_t funding_confirm(const ln_channel_t *pChannel, const monparam_t *pParam);
+static bool revoked_unspent(const ln_channel_t *pChannel);
+
 static bool monchanlist_search(monchanlist_t **ppList, const uint8_t *pChannelId, bool bRemove);
 static void monchanlist_add(monchanlist_t *pList);
 
@@ -148,6 +167,9 @@ void *monitor_start(void *pArg)
 
     LOGD("[THREAD]monitor initialize\n");
 
+    if (!watch_init()) {
+        LOGE("fail: watch_init\n");
+    }
     update_btc_values();
 
     //wait for accept user command before reconnect
@@ -164,6 +186,7 @@ void *monitor_start(void *pArg)
         if (!(lp % M_WAIT_MON_SEC)) {
             LOGD("$$$----begin\n");
             if (update_btc_values()) {
+                update_watch();
                 lnapp_manager_each_node(monfunc_2, &mMonParam);
             }
             LOGD("$$$----end\n");
@@ -177,6 +200,7 @@ void *monitor_start(void *pArg)
         sleep(1);
     }
     LOGD("[exit]monitor thread\n");
+    watch_term();
     ptarmd_stop();
 
     return NULL;
@@ -259,6 +283,10 @@ bool monitor_close_unilateral_local(ln_channel_t *pChannel, void *pDbParam)
                 ln_db_wallet_t wlt = LN_DB_WALLET_INIT(LN_DB_WALLET_TYPE_TO_LOCAL);
                 set_wallet_data(&wlt, p_tx);
                 ln_db_wallet_save(&wlt);
+
+                //使用されたらwalletから削除する(#watch_spent())
+                (void)watch_add(p_tx->vin[0].txid, p_tx->vin[0].index,
+                            ln_channel_id(pChannel), WATCH_TYPE_TO_LOCAL, WATCH_STAT_UNKNOWN);
             }
             continue;
         case LN_CLOSE_IDX_TO_REMOTE:
@@ -288,10 +316,10 @@ bool monitor_close_unilateral_local(ln_channel_t *pChannel, void *pDbParam)
 
         //check each close_dat.p_tx[] INPUT is broadcasted
         bool unspent;
-        bool ret = btcrpc_check_unspent(
-                            ln_remote_node_id(pChannel),
-                            &unspent, NULL,
-                            p_tx->vin[0].txid, p_tx->vin[0].index);
+        bool ret = check_unspent(
+                            pChannel, &unspent,
+                            p_tx->vin[0].txid, p_tx->vin[0].index,
+                            (lp == LN_CLOSE_IDX_COMMIT) ? WATCH_TYPE_FUNDING : WATCH_TYPE_HTLC);
         if (!ret) {
             LOGE("fail: check unspent\n");
             del = false;
@@ -399,22 +427,26 @@ static bool monfunc(lnapp_conf_t *pConf, void *pDbParam, void *pParam)
     monparam_t      *p_param = (monparam_t *)pParam;
     ln_channel_t    *p_channel = &pConf->channel;
 
-    p_param->confm = 0;
-    (void)btcrpc_get_confirmations(&p_param->confm, ln_funding_info_txid(&p_channel->funding_info));
-
     bool del = false;
 
     bool unspent = true;
     if (ln_status_is_closing(p_channel)) {
+        if (p_param->watch_synced && !p_param->new_block) {
+            //blockが増えていなければ、close処理で確認する状態も変わらない
+            return false;
+        }
         unspent = false;
     } else {
-        if (!btcrpc_check_unspent(
-            ln_remote_node_id(p_channel), &unspent, NULL,
+        //watch indexで未使用と分かっていれば、bitcoindに問い合わせない
+        if (!check_unspent(
+            p_channel, &unspent,
             ln_funding_info_txid(&p_channel->funding_info),
-            ln_funding_info_txindex(&p_channel->funding_info))) {
+            ln_funding_info_txindex(&p_channel->funding_info),
+            WATCH_TYPE_FUNDING)) {
             unspent = true;
         }
     }
+    p_param->confm = funding_confirm(p_channel, p_param);
 
     if (unspent) {
         del = funding_unspent(pConf, p_param, pDbParam);
@@ -445,6 +477,7 @@ static bool monfunc(lnapp_conf_t *pConf, void *pDbParam, void *pParam)
             DUMPD(ln_channel_id(p_channel), LN_SZ_CHANNEL_ID);
         }
         btcrpc_del_channel(ln_remote_node_id(p_channel));
+        watch_del_channel(ln_channel_id(p_channel));
 
         // method: dbclosed
         // $1: short_channel_id
@@ -549,6 +582,7 @@ static bool funding_spent(lnapp_conf_t *pConf, monparam_t *pParam, void *pDbPara
             p_list = (monchanlist_t *)UTL_DBG_MALLOC(sizeof(monchanlist_t));
             memcpy(p_list->channel_id, ln_channel_id(p_channel), LN_SZ_CHANNEL_ID);
             p_list->last_check_confm = 0;
+            p_list->revoked_vout_cnt = 0;
             monchanlist_add(p_list);
         }
         btc_tx_t *p_tx = NULL;
@@ -852,8 +886,8 @@ static bool close_unilateral_remote(ln_channel_t *pChannel, void *pDbParam)
                 } else if (p_tx->vin[0].wit_item_cnt > 0) {
                     //INPUT spent check
                     bool unspent;
-                    bool ret = btcrpc_check_unspent(ln_remote_node_id(pChannel), &unspent, NULL,
-                                    p_tx->vin[0].txid, p_tx->vin[0].index);
+                    bool ret = check_unspent(pChannel, &unspent,
+                                    p_tx->vin[0].txid, p_tx->vin[0].index, WATCH_TYPE_HTLC);
                     if (ret && !unspent) {
                         LOGD("already spent\n");
                         ln_db_wallet_del(p_tx->vin[0].txid, p_tx->vin[0].index);
@@ -920,9 +954,9 @@ static void close_unilateral_remote_offered(ln_channel_t *pChannel, bool *pDel,
     if (!p_htlc) return;
 
     bool unspent;
-    if (btcrpc_check_unspent(
-        ln_remote_node_id(pChannel), &unspent, NULL, pCloseDat->p_tx[lp].vin[0].txid,
-        pCloseDat->p_tx[lp].vin[0].index)) {
+    if (check_unspent(
+        pChannel, &unspent, pCloseDat->p_tx[lp].vin[0].txid,
+        pCloseDat->p_tx[lp].vin[0].index, WATCH_TYPE_HTLC)) {
         if (!unspent) {
             LOGD("already spent\n");
             ln_db_wallet_del(pCloseDat->p_tx[lp].vin[0].txid, pCloseDat->p_tx[lp].vin[0].index);
@@ -1015,6 +1049,15 @@ static bool close_revoked_first(ln_channel_t *pChannel, btc_tx_t *pTx, uint32_t
 
     ptarmd_eventlog(ln_channel_id(pChannel), "close: ugly way");
 
+    //HTLC outputをwatch indexに登録し、使用されるまで#close_revoked_after()の検索を省略する
+    uint8_t revoked_txid[BTC_SZ_TXID];
+    btc_tx_txid(pTx, revoked_txid);
+    monchanlist_t *p_list = NULL;
+    if (monchanlist_search(&p_list, ln_channel_id(pChannel), false)) {
+        memcpy(p_list->revoked_txid, revoked_txid, BTC_SZ_TXID);
+        p_list->revoked_vout_cnt = pTx->vout_cnt;
+    }
+
     for (uint32_t lp = 0; lp < pTx->vout_cnt; lp++) {
         const utl_buf_t *p_vout = ln_revoked_vout(pChannel);
 
@@ -1043,6 +1086,9 @@ static bool close_revoked_first(ln_channel_t *pChannel, btc_tx_t *pTx, uint32_t
                 if (utl_buf_equal(&pTx->vout[lp].script, &p_vout[lp2])) {
                     LOGD("[%u]HTLC vout[%d] !\n", lp, lp2);
 
+                    bool unspent;
+                    (void)check_unspent(pChannel, &unspent, revoked_txid, lp, WATCH_TYPE_REVOKED);
+
                     ret = close_revoked_htlc(pChannel, pTx, lp, lp2);
                     if (ret) {
                         del = ln_revoked_cnt_dec(pChannel);
@@ -1072,7 +1118,12 @@ static bool close_revoked_after(ln_channel_t *pChannel, uint32_t confm, void *pD
 {
     bool del = false;
 
-    if (confm != ln_revoked_confm(pChannel)) {
+    if ((confm != ln_revoked_confm(pChannel)) && revoked_unspent(pChannel)) {
+        //HTLC outputが使用されていないので、HTLC Timeout/Success Txは存在しない
+        ln_set_revoked_confm(pChannel, confm);
+        ln_db_revoked_tx_save(pChannel, false, pDbParam);
+        LOGD("HTLC outputs unspent: %u, revoked_cnt=%d\n", confm, ln_revoked_cnt(pChannel));
+    } else if (confm != ln_revoked_confm(pChannel)) {
         //HTLC Timeout/Success Txのvoutと一致するトランザクションを検索
         utl_buf_t txbuf = UTL_BUF_INIT;
         const utl_buf_t *p_vout = ln_revoked_vout(pChannel);
@@ -1288,6 +1339,158 @@ static bool update_btc_values(void)
 }
 
 
+/** watch indexに新しいblockを反映する
+ *
+ * 前回反映したblockから連続している場合だけ、増えたblockのvinを照合する。
+ * short_channel_id UTXO cacheのoutputもwatch indexに登録されているので、blockの走査は1回だけ行う。
+ * 連続していない(reorg, 取得失敗, blockが増えすぎた)場合は全outpointを未確認に戻し、
+ * 現在のblockから反映し直す(未確認のoutpointはbitcoindで確認する)。
+ */
+static void update_watch(void)
+{
+    mMonParam.new_block = (mMonParam.height != mWatchHeight);
+    if (!mMonParam.new_block) {
+        return;
+    }
+
+    bool ret = mMonParam.watch_synced &&
+                (mMonParam.height > mWatchHeight) &&
+                (mMonParam.height - mWatchHeight <= M_WATCH_BLOCKS_MAX);
+    for (int32_t height = mWatchHeight + 1; ret && (height <= mMonParam.height); height++) {
+        utl_buf_t block = UTL_BUF_INIT;
+        ret = btcrpc_getrawblock(&block, height);
+        if (ret) {
+            ret = (block.len >= BTC_SZ_BLOCK_HEADER) &&
+                    (memcmp(block.buf + M_OFFSET_PREV_BLOCKHASH, mWatchHash, BTC_SZ_HASH256) == 0);
+        }
+        if (ret) {
+            btc_md_hash256(mWatchHash, block.buf, BTC_SZ_BLOCK_HEADER);
+            //先に連続性を確認してから、使用されたoutputを反映する(#watch_spent())
+            (void)scid_cache_block(block.buf, block.len, height);
+            ret = watch_block(block.buf, block.len, watch_spent, NULL);
+        }
+        utl_buf_free(&block);
+    }
+    if (!ret) {
+        if (mMonParam.watch_synced) {
+            LOGD("watch index resync: %" PRId32 " --> %" PRId32 "\n", mWatchHeight, mMonParam.height);
+        }
+        watch_reset_stat();
+        scid_cache_resync();
+
+        utl_buf_t block = UTL_BUF_INIT;
+        mMonParam.watch_synced = btcrpc_getrawblock(&block, mMonParam.height) &&
+                                    (block.len >= BTC_SZ_BLOCK_HEADER);
+        if (mMonParam.watch_synced) {
+            btc_md_hash256(mWatchHash, block.buf, BTC_SZ_BLOCK_HEADER);
+            //short_channel_id UTXO cacheはこのblockから反映し直す
+            (void)scid_cache_block(block.buf, block.len, mMonParam.height);
+        }
+        utl_buf_free(&block);
+    }
+    mWatchHeight = mMonParam.height;
+}
+
+
+/** watch indexのoutpointがblockで使用された
+ *
+ */
+static void watch_spent(const watch_outpoint_t *pWatch, const btc_tx_view_t *pView, void *pParam)
+{
+    (void)pView; (void)pParam;
+
+    if (pWatch->type == WATCH_TYPE_SCID) {
+        scid_cache_spent(pWatch->short_channel_id);
+        return;
+    }
+    LOGD("spent: type=%d, channel_id=", pWatch->type);
+    DUMPD(pWatch->channel_id, LN_SZ_CHANNEL_ID);
+    if (pWatch->type == WATCH_TYPE_TO_LOCAL) {
+        //to_localは#ln_wallet_*()で使用済み
+        (void)ln_db_wallet_del(pWatch->txid, pWatch->index);
+        watch_del(pWatch->txid, pWatch->index);
+    }
+}
+
+
+/** outpointの未使用確認
+ *
+ * watch indexで未使用と分かっている場合はbitcoindに問い合わせない。
+ * 問い合わせた結果はwatch indexに登録する。
+ *
+ * @param[in]   pChannel
+ * @param[out]  pUnspent    true:未使用
+ * @param[in]   pTxid       outpointのTXID
+ * @param[in]   Index       outpointのindex
+ * @param[in]   Type        #watch_type_t
+ * @retval  true    確認成功
+ */
+static bool check_unspent(const ln_channel_t *pChannel, bool *pUnspent, const uint8_t *pTxid, uint32_t Index, watch_type_t Type)
+{
+    if (mMonParam.watch_synced && (watch_get(pTxid, Index) == WATCH_STAT_UNSPENT)) {
+        *pUnspent = true;
+        return true;
+    }
+
+    bool ret = btcrpc_check_unspent(ln_remote_node_id(pChannel), pUnspent, NULL, pTxid, Index);
+    if (ret && mMonParam.watch_synced && !utl_mem_is_all_zero(pTxid, BTC_SZ_TXID)) {
+        (void)watch_add(pTxid, Index, ln_channel_id(pChannel), Type,
+                    (*pUnspent) ? WATCH_STAT_UNSPENT : WATCH_STAT_SPENT);
+    }
+    return ret;
+}
+
+
+/** funding_txのconfirmation取得
+ *
+ * short_channel_idが決まっていれば、block heightから計算する。
+ */
+static uint32_t funding_confirm(const ln_channel_t *pChannel, const monparam_t *pParam)
+{
+    uint32_t confm = 0;
+    uint64_t short_channel_id = ln_short_channel_id(pChannel);
+    if (pParam->watch_synced && (short_channel_id != 0)) {
+        uint32_t bheight;
+        uint32_t bindex;
+        uint32_t vindex;
+        ln_short_channel_id_get_param(&bheight, &bindex, &vindex, short_channel_id);
+        if ((int32_t)bheight <= pParam->height) {
+            confm = (uint32_t)(pParam->height - (int32_t)bheight + 1);
+        }
+    } else {
+        (void)btcrpc_get_confirmations(&confm, ln_funding_info_txid(&pChannel->funding_info));
+    }
+    return confm;
+}
+
+
+/** revoked transactionのHTLC outputが全て未使用か
+ *
+ * @retval  true    watch indexで全て未使用(HTLC Timeout/Success Txは存在しない)
+ */
+static bool revoked_unspent(const ln_channel_t *pChannel)
+{
+    if (!mMonParam.watch_synced) {
+        return false;
+    }
+    monchanlist_t *p_list = NULL;
+    if (!monchanlist_search(&p_list, ln_channel_id(pChannel), false)) {
+        return false;
+    }
+
+    uint32_t cnt = 0;
+    for (uint32_t lp = 0; lp < p_list->revoked_vout_cnt; lp++) {
+        watch_stat_t stat = watch_get(p_list->revoked_txid, lp);
+        if (stat == WATCH_STAT_UNSPENT) {
+            cnt++;
+        } else if (stat != WATCH_STAT_NONE) {
+            return false;
+        }
+    }
+    return cnt > 0;
+}
+
+
 static bool monchanlist_search(monchanlist_t **ppList, const uint8_t *pChannelId, bool bRemove)
 {
     bool detect = false;
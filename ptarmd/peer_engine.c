@@ -0,0 +1,505 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   peer_engine.c
+ *  @brief  peer I/O engine
+ *  @note   <pre>
+ *                +-----------+    queue    +------------------+
+ *      socket--->| io thread |------------>| worker thread[N] |---> callback
+ *      tick----->|  (epoll)  |             |                  |
+ *                +-----------+             +------------------+
+ * </pre>
+ *
+ *  socketはEPOLLONESHOTで登録し、callback終了後に再登録する。
+ *  そのため、同じhandleのsocket受信が複数のworkerで同時に処理されることはない。
+ *  監視するeventはread_pause, write_waitから決め、変化がなければ再登録しない。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/queue.h>
+
+#define LOG_TAG     "peer_engine"
+#include "utl_log.h"
+#include "utl_dbg.h"
+
+#include "peer_engine.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_EPOLL_EVENTS          (64)        ///< 1回のepoll_wait()で取得するevent数
+#define M_EPOLL_READ            (EPOLLIN | EPOLLRDHUP)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+LIST_HEAD(handlelist_t, peer_engine_handle_t);
+TAILQ_HEAD(handlequeue_t, peer_engine_handle_t);
+
+
+/********************************************************************
+ * static variables
+ ********************************************************************/
+
+static volatile bool        mActive;
+static int                  mEpollFd = -1;
+static int                  mWakeFd = -1;           ///< eventfd: io thread停止通知
+static uint32_t             mTickMsec;
+
+static pthread_t            mThIo;
+static pthread_t            *mpThWorkers;
+static int                  mWorkers;
+
+static pthread_mutex_t      mMux = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       mCondWork = PTHREAD_COND_INITIALIZER;   ///< queue追加
+static pthread_cond_t       mCondDone = PTHREAD_COND_INITIALIZER;   ///< 登録解除
+static struct handlelist_t  mHandles;
+static struct handlequeue_t mQueue;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static void *thread_io_start(void *pArg);
+static void *thread_worker_start(void *pArg);
+static void enqueue(peer_engine_handle_t *pHandle, uint32_t Events);
+static void rearm(peer_engine_handle_t *pHandle);
+static void remove_handle(peer_engine_handle_t *pHandle);
+static uint64_t now_msec(void);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool peer_engine_init(int Workers, uint32_t TickMsec)
+{
+    LIST_INIT(&mHandles);
+    TAILQ_INIT(&mQueue);
+    mTickMsec = TickMsec;
+
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        LOGE("fail: epoll_create1: %s\n", strerror(errno));
+        return false;
+    }
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mWakeFd < 0) {
+        LOGE("fail: eventfd: %s\n", strerror(errno));
+        goto LABEL_ERROR;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;         //NULL: mWakeFd
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev) != 0) {
+        LOGE("fail: epoll_ctl: %s\n", strerror(errno));
+        goto LABEL_ERROR;
+    }
+
+    mActive = true;
+    mpThWorkers = (pthread_t *)UTL_DBG_MALLOC(sizeof(pthread_t) * Workers);
+    for (mWorkers = 0; mWorkers < Workers; mWorkers++) {
+        if (pthread_create(&mpThWorkers[mWorkers], NULL, thread_worker_start, NULL) != 0) {
+            LOGE("fail: pthread_create\n");
+            break;
+        }
+    }
+    if (mWorkers == 0) {
+        goto LABEL_ERROR;
+    }
+    if (pthread_create(&mThIo, NULL, thread_io_start, NULL) != 0) {
+        LOGE("fail: pthread_create\n");
+        goto LABEL_ERROR;
+    }
+    LOGD("workers=%d, tick=%" PRIu32 "msec\n", mWorkers, mTickMsec);
+    return true;
+
+LABEL_ERROR:
+    pthread_mutex_lock(&mMux);
+    mActive = false;
+    pthread_cond_broadcast(&mCondWork);
+    pthread_mutex_unlock(&mMux);
+    for (int lp = 0; lp < mWorkers; lp++) {
+        pthread_join(mpThWorkers[lp], NULL);
+    }
+    UTL_DBG_FREE(mpThWorkers);
+    mWorkers = 0;
+    if (mWakeFd >= 0) {
+        close(mWakeFd);
+        mWakeFd = -1;
+    }
+    close(mEpollFd);
+    mEpollFd = -1;
+    return false;
+}
+
+
+void peer_engine_term(void)
+{
+    if (mEpollFd < 0) return;
+
+    pthread_mutex_lock(&mMux);
+    mActive = false;
+    pthread_cond_broadcast(&mCondWork);
+    pthread_mutex_unlock(&mMux);
+
+    uint64_t val = 1;
+    if (write(mWakeFd, &val, sizeof(val)) != sizeof(val)) {
+        LOGE("fail: eventfd write: %s\n", strerror(errno));
+    }
+    pthread_join(mThIo, NULL);
+    for (int lp = 0; lp < mWorkers; lp++) {
+        pthread_join(mpThWorkers[lp], NULL);
+    }
+    UTL_DBG_FREE(mpThWorkers);
+    mWorkers = 0;
+    LOGD("join: io, workers\n");
+
+    pthread_mutex_lock(&mMux);
+    while (!LIST_EMPTY(&mHandles)) {
+        peer_engine_handle_t *p = LIST_FIRST(&mHandles);
+        LOGD("discard: fd=%d\n", p->fd);
+        if (p->queued) {
+            TAILQ_REMOVE(&mQueue, p, queue);
+            p->queued = false;
+        }
+        remove_handle(p);
+    }
+    pthread_mutex_unlock(&mMux);
+
+    close(mWakeFd);
+    mWakeFd = -1;
+    close(mEpollFd);
+    mEpollFd = -1;
+}
+
+
+bool peer_engine_add(peer_engine_handle_t *pHandle, int Fd, peer_engine_cb_t pCb, void *pArg)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMux);
+    if (!mActive) {
+        LOGE("fail: not started\n");
+        goto LABEL_EXIT;
+    }
+    if (pHandle->added) {
+        LOGE("fail: already added\n");
+        goto LABEL_EXIT;
+    }
+    pHandle->fd = Fd;
+    pHandle->p_cb = pCb;
+    pHandle->p_arg = pArg;
+    pHandle->events = 0;
+    pHandle->queued = false;
+    pHandle->busy = false;
+    pHandle->armed = 0;
+    pHandle->read_pause = false;
+    pHandle->write_wait = false;
+    if (Fd >= 0) {
+        struct epoll_event ev;
+        ev.events = M_EPOLL_READ | EPOLLONESHOT;
+        ev.data.ptr = pHandle;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, Fd, &ev) != 0) {
+            LOGE("fail: epoll_ctl(fd=%d): %s\n", Fd, strerror(errno));
+            goto LABEL_EXIT;
+        }
+        pHandle->armed = M_EPOLL_READ;
+    }
+    pHandle->added = true;
+    LIST_INSERT_HEAD(&mHandles, pHandle, list);
+    enqueue(pHandle, PEER_ENGINE_EV_NOTIFY);
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+void peer_engine_notify(peer_engine_handle_t *pHandle)
+{
+    pthread_mutex_lock(&mMux);
+    if (pHandle->added) {
+        enqueue(pHandle, PEER_ENGINE_EV_NOTIFY);
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void peer_engine_read_pause(peer_engine_handle_t *pHandle, bool bPause)
+{
+    pthread_mutex_lock(&mMux);
+    if (pHandle->added && (pHandle->read_pause != bPause)) {
+        LOGD("fd=%d: %s\n", pHandle->fd, bPause ? "pause" : "resume");
+        pHandle->read_pause = bPause;
+        if (!pHandle->busy) {
+            //callback実行中はcallback終了後に反映する
+            rearm(pHandle);
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void peer_engine_write_wait(peer_engine_handle_t *pHandle, bool bWait)
+{
+    pthread_mutex_lock(&mMux);
+    if (pHandle->added && (pHandle->write_wait != bWait)) {
+        pHandle->write_wait = bWait;
+        if (!pHandle->busy) {
+            //callback実行中はcallback終了後に反映する
+            rearm(pHandle);
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+void peer_engine_wait(peer_engine_handle_t *pHandle)
+{
+    pthread_mutex_lock(&mMux);
+    while (pHandle->added) {
+        if (pHandle->busy && pthread_equal(pHandle->th_busy, pthread_self())) {
+            LOGE("fail: wait in own callback\n");
+            break;
+        }
+        pthread_cond_wait(&mCondDone, &mMux);
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+bool peer_engine_is_added(peer_engine_handle_t *pHandle)
+{
+    pthread_mutex_lock(&mMux);
+    bool ret = pHandle->added;
+    pthread_mutex_unlock(&mMux);
+    return ret;
+}
+
+
+/********************************************************************
+ * [THREAD]io
+ ********************************************************************/
+
+/** io thread entry point
+ *
+ * socketの受信とtickをqueueに積むだけで、callbackは呼ばない。
+ */
+static void *thread_io_start(void *pArg)
+{
+    (void)pArg;
+
+    struct epoll_event events[M_EPOLL_EVENTS];
+    uint64_t next_tick = now_msec() + mTickMsec;
+
+    LOGD("[THREAD]io initialize\n");
+
+    while (mActive) {
+        uint64_t now = now_msec();
+        int timeout = (next_tick > now) ? (int)(next_tick - now) : 0;
+        int num = epoll_wait(mEpollFd, events, M_EPOLL_EVENTS, timeout);
+        if (num < 0) {
+            if (errno == EINTR) continue;
+            LOGE("fail: epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&mMux);
+        for (int lp = 0; lp < num; lp++) {
+            peer_engine_handle_t *p = (peer_engine_handle_t *)events[lp].data.ptr;
+            if (p == NULL) {
+                uint64_t val;
+                (void)read(mWakeFd, &val, sizeof(val));
+                continue;
+            }
+            //epoll_wait()後に登録解除されている場合がある
+            if (!p->added) continue;
+            p->armed = 0;
+            uint32_t ev = 0;
+            if (events[lp].events & EPOLLOUT) {
+                ev |= PEER_ENGINE_EV_WRITE;
+            }
+            if (events[lp].events & ~EPOLLOUT) {
+                //EPOLLIN, EPOLLRDHUP, EPOLLHUP, EPOLLERR
+                ev |= PEER_ENGINE_EV_READ;
+            }
+            enqueue(p, ev);
+        }
+        if (now_msec() >= next_tick) {
+            peer_engine_handle_t *p;
+            LIST_FOREACH(p, &mHandles, list) {
+                enqueue(p, PEER_ENGINE_EV_TICK);
+            }
+            next_tick += mTickMsec;
+            if (next_tick < now_msec()) {
+                //処理が間に合っていないため、tickをまとめる
+                next_tick = now_msec() + mTickMsec;
+            }
+        }
+        pthread_mutex_unlock(&mMux);
+    }
+
+    LOGD("[exit]io thread\n");
+    return NULL;
+}
+
+
+/********************************************************************
+ * [THREAD]worker
+ ********************************************************************/
+
+/** worker thread entry point
+ *
+ */
+static void *thread_worker_start(void *pArg)
+{
+    (void)pArg;
+
+    LOGD("[THREAD]worker initialize\n");
+
+    pthread_mutex_lock(&mMux);
+    while (mActive) {
+        peer_engine_handle_t *p = TAILQ_FIRST(&mQueue);
+        if (p == NULL) {
+            pthread_cond_wait(&mCondWork, &mMux);
+            continue;
+        }
+        TAILQ_REMOVE(&mQueue, p, queue);
+        p->queued = false;
+        uint32_t events = p->events;
+        p->events = 0;
+        p->busy = true;
+        p->th_busy = pthread_self();
+        pthread_mutex_unlock(&mMux);
+
+        bool keep = p->p_cb(p->p_arg, events);
+
+        pthread_mutex_lock(&mMux);
+        p->busy = false;
+        if (!keep) {
+            remove_handle(p);
+            continue;
+        }
+        rearm(p);
+        if (p->events) {
+            //callback実行中に発生したevent
+            TAILQ_INSERT_TAIL(&mQueue, p, queue);
+            p->queued = true;
+            pthread_cond_signal(&mCondWork);
+        }
+    }
+    pthread_mutex_unlock(&mMux);
+
+    LOGD("[exit]worker thread\n");
+    return NULL;
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** event追加(mMux lock済みで呼び出すこと)
+ *
+ * callback実行中はeventを貯めるだけで、callback終了後にqueueへ積む。
+ */
+static void enqueue(peer_engine_handle_t *pHandle, uint32_t Events)
+{
+    pHandle->events |= Events;
+    if (pHandle->busy || pHandle->queued) return;
+    TAILQ_INSERT_TAIL(&mQueue, pHandle, queue);
+    pHandle->queued = true;
+    pthread_cond_signal(&mCondWork);
+}
+
+
+/** EPOLLONESHOTの再登録(mMux lock済みで呼び出すこと)
+ *
+ * read_pause, write_waitから監視するeventを決める。監視中のeventと同じなら何もしない。
+ */
+static void rearm(peer_engine_handle_t *pHandle)
+{
+    if (pHandle->fd < 0) return;
+
+    uint32_t want = 0;
+    if (!pHandle->read_pause) {
+        want |= M_EPOLL_READ;
+    }
+    if (pHandle->write_wait) {
+        want |= EPOLLOUT;
+    }
+    if (want == pHandle->armed) return;
+
+    struct epoll_event ev;
+    //want==0: EPOLLERR/EPOLLHUPは止められないが、ONESHOTなので通知は1回だけ
+    ev.events = want | EPOLLONESHOT;
+    ev.data.ptr = pHandle;
+    pHandle->armed = want;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, pHandle->fd, &ev) != 0) {
+        LOGE("fail: epoll_ctl(fd=%d): %s\n", pHandle->fd, strerror(errno));
+    }
+}
+
+
+/** 登録解除(mMux lock済みで呼び出すこと)
+ *
+ * 登録時のsocketはここでcloseする。
+ */
+static void remove_handle(peer_engine_handle_t *pHandle)
+{
+    if (pHandle->fd >= 0) {
+        (void)epoll_ctl(mEpollFd, EPOLL_CTL_DEL, pHandle->fd, NULL);
+        LOGD("close fd=%d\n", pHandle->fd);
+        if (close(pHandle->fd) != 0) {
+            LOGE("fail: close: %s\n", strerror(errno));
+        }
+        pHandle->fd = -1;
+    }
+    LIST_REMOVE(pHandle, list);
+    pHandle->added = false;
+    pHandle->events = 0;
+    pthread_cond_broadcast(&mCondDone);
+}
+
+
+static uint64_t now_msec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,181 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   peer_engine.h
+ *  @brief  peer I/O engine
+ *
+ *  全peerのsocketを1つのepollで監視し、固定数のworker threadでcallbackを呼び出す。
+ *      - 同じhandleのcallbackは、同時に1つのworkerからしか呼ばれない。
+ *      - callback実行中に発生したeventは、callback終了後にまとめて通知する。
+ *      - 登録中の全handleに対し、周期的に#PEER_ENGINE_EV_TICKを通知する。
+ *      - 登録したsocketは登録解除時にengineがcloseする。
+ *      - #peer_engine_read_pause()で、socketの受信監視だけを止められる。
+ *      - #peer_engine_write_wait()中は、socketが送信可能になると#PEER_ENGINE_EV_WRITEを通知する。
+ */
+#ifndef PEER_ENGINE_H__
+#define PEER_ENGINE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define PEER_ENGINE_EV_READ     (0x01)      ///< socket受信可能(切断, エラーを含む)
+#define PEER_ENGINE_EV_NOTIFY   (0x02)      ///< #peer_engine_notify()
+#define PEER_ENGINE_EV_TICK     (0x04)      ///< 周期処理
+#define PEER_ENGINE_EV_WRITE    (0x08)      ///< socket送信可能(#peer_engine_write_wait()中のみ)
+
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** callback
+ *
+ * @param[in,out]   pArg        #peer_engine_add()のpArg
+ * @param[in]       Events      PEER_ENGINE_EV_xxxの組合せ
+ * @retval  true    登録を継続する
+ * @retval  false   登録を解除する(以降、callbackは呼ばれない)
+ */
+typedef bool (*peer_engine_cb_t)(void *pArg, uint32_t Events);
+
+
+/** @struct peer_engine_handle_t
+ *  @brief  engine登録情報(呼び出し元が保持し、#peer_engine_term()まで解放しないこと)
+ */
+typedef struct peer_engine_handle_t {
+    LIST_ENTRY(peer_engine_handle_t)    list;       ///< 登録中handle
+    TAILQ_ENTRY(peer_engine_handle_t)   queue;      ///< 実行待ちhandle
+
+    int                 fd;                         ///< 監視するsocket(-1:監視しない)
+    peer_engine_cb_t    p_cb;
+    void                *p_arg;
+
+    uint32_t            events;                     ///< 未通知のevent
+    bool                added;                      ///< true:登録中
+    uint32_t            armed;                      ///< epollで監視中のevent(0:監視していない)
+    bool                read_pause;                 ///< true:socket受信監視停止要求
+    bool                write_wait;                 ///< true:socket送信可能待ち
+    bool                queued;                     ///< true:実行待ち
+    bool                busy;                       ///< true:callback実行中
+    pthread_t           th_busy;                    ///< callbackを実行しているworker
+} peer_engine_handle_t;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** [peer_engine]開始
+ *
+ * @param[in]   Workers         worker thread数
+ * @param[in]   TickMsec        #PEER_ENGINE_EV_TICKの周期[msec]
+ * @retval  true    成功
+ */
+bool peer_engine_init(int Workers, uint32_t TickMsec);
+
+
+/** [peer_engine]停止
+ *
+ * 登録中のhandleはcallbackを呼ばずに破棄する(socketはcloseする)。
+ */
+void peer_engine_term(void);
+
+
+/** [peer_engine]handle登録
+ *
+ * 登録直後に#PEER_ENGINE_EV_NOTIFYでcallbackを呼び出す。
+ *
+ * @param[out]  pHandle
+ * @param[in]   Fd              監視するsocket(-1:socketを監視しない)。登録に成功した場合、解除時にcloseする。
+ * @param[in]   pCb             callback
+ * @param[in]   pArg            callbackの引数
+ * @retval  true    成功
+ */
+bool peer_engine_add(peer_engine_handle_t *pHandle, int Fd, peer_engine_cb_t pCb, void *pArg);
+
+
+/** [peer_engine]callback呼び出し要求
+ *
+ * #PEER_ENGINE_EV_NOTIFYでcallbackを呼び出す。
+ * どのthreadから呼び出してもよい(callback内からも可)。
+ *
+ * @param[in,out]   pHandle
+ */
+void peer_engine_notify(peer_engine_handle_t *pHandle);
+
+
+/** [peer_engine]socket受信監視の停止/再開
+ *
+ * 停止中は#PEER_ENGINE_EV_READを通知しない(切断も再開後に通知する)。
+ * #PEER_ENGINE_EV_NOTIFY, #PEER_ENGINE_EV_TICKは停止中も通知する。
+ * どのthreadから呼び出してもよい(callback内からも可)。
+ *
+ * @param[in,out]   pHandle
+ * @param[in]       bPause      true:停止, false:再開
+ */
+void peer_engine_read_pause(peer_engine_handle_t *pHandle, bool bPause);
+
+
+/** [peer_engine]socket送信可能待ちの開始/終了
+ *
+ * 開始中は、socketが送信可能になるたびに#PEER_ENGINE_EV_WRITEでcallbackを呼び出す。
+ * 送信し終わったら終了すること。
+ * どのthreadから呼び出してもよい(callback内からも可)。
+ *
+ * @param[in,out]   pHandle
+ * @param[in]       bWait       true:開始, false:終了
+ */
+void peer_engine_write_wait(peer_engine_handle_t *pHandle, bool bWait);
+
+
+/** [peer_engine]登録解除待ち
+ *
+ * callbackがfalseを返して登録解除されるまで待つ。
+ * 自handleのcallback内から呼び出した場合は待たずに戻る。
+ *
+ * @param[in]   pHandle
+ */
+void peer_engine_wait(peer_engine_handle_t *pHandle);
+
+
+/** [peer_engine]登録中か
+ *
+ * @param[in]   pHandle
+ * @retval  true    登録中
+ */
+bool peer_engine_is_added(peer_engine_handle_t *pHandle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PEER_ENGINE_H__ */
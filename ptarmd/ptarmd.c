@@ -63,6 +63,10 @@
 #include "btc_crypto.h"
 
 #include "ln_setupctl.h"
+#include "ln_routing.h"
+#include "ln_gossip.h"
+#include "ln_anno.h"
+#include "ln_crypto_pool.h"
 
 #include "ptarmd.h"
 #include "btcrpc.h"
@@ -70,6 +74,7 @@
 #include "lnapp.h"
 #include "lnapp_manager.h"
 #include "monitoring.h"
+#include "scid_cache.h"
 #include "cmd_json.h"
 
 
@@ -78,6 +83,8 @@
  **************************************************************************/
 
 #define M_SCRIPT_DIR            "script"
+#define M_ANNO_WORKERS_MAX      (8)         ///< announcement署名検証thread数上限
+#define M_CRYPTO_WORKERS_MAX    (8)         ///< HTLC署名・検証thread数上限
 
 
 /********************************************************************
@@ -160,7 +167,7 @@ static char gExecPath[PATH_MAX];
  * entry point
  ********************************************************************/
 
-int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode)
+int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode, int MaxPeers)
 {
     bool bret;
 
@@ -195,9 +202,44 @@ int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode)
     load_channel_settings();
     btcrpc_set_creationhash(ln_creationhash_get());
     set_channels();
+    if (!ln_routing_init()) {
+        fprintf(stderr, "fail: routing init\n");
+        return -2;
+    }
+    if (!ln_gossip_init()) {
+        fprintf(stderr, "fail: gossip init\n");
+        return -2;
+    }
+    //受信threadを止めないよう、announcementの署名検証は別threadで行う
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int anno_workers = (cpus > 1) ? (int)cpus - 1 : 1;
+    if (anno_workers > M_ANNO_WORKERS_MAX) {
+        anno_workers = M_ANNO_WORKERS_MAX;
+    }
+    if (!ln_anno_init(anno_workers)) {
+        fprintf(stderr, "fail: anno init\n");
+        return -2;
+    }
+    //commitment_signedのHTLC署名・検証は呼び出し元threadも処理するため、(CPU数 - 1)個
+    int crypto_workers = (cpus > 1) ? (int)cpus - 1 : 1;
+    if (crypto_workers > M_CRYPTO_WORKERS_MAX) {
+        crypto_workers = M_CRYPTO_WORKERS_MAX;
+    }
+    if (!ln_crypto_pool_start(crypto_workers)) {
+        fprintf(stderr, "fail: crypto pool start\n");
+        return -2;
+    }
+    if (!scid_cache_init(FNAME_SCID_CACHE)) {
+        fprintf(stderr, "fail: scid cache init\n");
+        return -2;
+    }
     lnapp_global_init();
-    lnapp_manager_init();
-    if (!lnapp_manager_start_origin_node(lnapp_thread_channel_origin_start)) {
+    if (!lnapp_manager_init(MaxPeers)) {
+        fprintf(stderr, "fail: lnapp manager init\n");
+        return -2;
+    }
+    ln_forward_notify_set(lnapp_manager_notify_forward);
+    if (!lnapp_manager_start_origin_node()) {
         return -3;
     }
 
@@ -246,6 +288,11 @@ int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode)
             "ptarmd end: total_msat=%" PRIu64 "\n", total_amount);
 
     lnapp_manager_term();
+    scid_cache_term();
+    ln_anno_term();
+    ln_crypto_pool_stop();
+    ln_gossip_term();
+    ln_routing_term();
     ln_db_term();
 
     return 0;
@@ -73,6 +73,7 @@ extern "C" {
 #define FNAME_EVENT_LOG             FNAME_LOGDIR "/event.log"
 #define FNAME_CHANNEL_LOG           FNAME_LOGDIR "/chan_%s.log"
 #define FNAME_FMT_NODECONF          "ptarm_nodeinfo.conf"
+#define FNAME_SCID_CACHE            "scid_cache.dat"
 
 #define FNAME_INVOICEDIR            "invoices"
 #define FNAME_INVOICE_LOG           FNAME_INVOICEDIR "/invoice_%s.log"
@@ -299,8 +300,11 @@ typedef struct lnapp_conf_t lnapp_conf_t;
 
 /** start
  *
+ * @param[in]   RpcPort     ptarmcli受信port(0:node port + 1)
+ * @param[in]   pNode       node情報
+ * @param[in]   MaxPeers    同時に扱うpeer数の上限
  */
-int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode);
+int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode, int MaxPeers);
 
 
 /** stop all threads
@@ -32,6 +32,8 @@
 #include "utl_addr.h"
 #include "utl_net.h"
 
+#include "btc_chachapoly.h"
+
 #include "ptarmd.h"
 #include "conf.h"
 #include "btcrpc.h"
@@ -76,6 +78,7 @@ int main(int argc, char *argv[])
     ln_node_t node = LN_NODE_INIT;
     int opt;
     uint16_t my_rpcport = 0;
+    int max_peers = MAX_CHANNELS;
 
     const struct option OPTIONS[] = {
         { "network", required_argument, NULL, 'N' },
@@ -90,6 +93,7 @@ int main(int argc, char *argv[])
         { "rpcport", required_argument, NULL, 'P' },
         { "version", no_argument, NULL, 'v' },
         { "clear_channel_db", no_argument, NULL, '\x10' },
+        { "max_peers", required_argument, NULL, '\x11' },
         { "help", no_argument, NULL, 'h' },
         { 0, 0, 0, 0 }
     };
@@ -224,6 +228,14 @@ int main(int argc, char *argv[])
                 printf("canceled.\n");
             }
             return 0;
+        case '\x11':
+            //max_peers
+            max_peers = atoi(optarg);
+            if (max_peers <= 0) {
+                fprintf(stderr, "fail: invalid max_peers(%s).\n", optarg);
+                return -1;
+            }
+            break;
         default:
             break;
         }
@@ -246,6 +258,9 @@ int main(int argc, char *argv[])
         fprintf(stderr, "fail: btc_init()\n");
         return -1;
     }
+    //BOLT#8/onionで使うChaCha20-Poly1305の実装をCPUに合わせて選択する
+    btc_chachapoly_init();
+    LOGD("chachapoly backend: %s\n", btc_chachapoly_backend_str(btc_chachapoly_backend()));
 
     //O'REILLY Japan: BINARY HACKS #52
     sigset_t ss;
@@ -274,7 +289,8 @@ int main(int argc, char *argv[])
         goto LABEL_EXIT;
     }
 
-    ptarmd_start(my_rpcport, &node);
+    ln_db_set_max_channels((uint32_t)max_peers);
+    ptarmd_start(my_rpcport, &node, max_peers);
 
     btcrpc_term();
 
@@ -302,6 +318,7 @@ LABEL_EXIT:
     fprintf(stderr, "\t\t--datadir DIR_PATH : working directory(default: current)\n");
     fprintf(stderr, "\t\t--color RRGGBB : node color(default: 000000)\n");
     fprintf(stderr, "\t\t--rpcport PORT : JSON-RPC port(default: node port+1)\n");
+    fprintf(stderr, "\t\t--max_peers NUM : max number of peers(default: %d)\n", MAX_CHANNELS);
     return -1;
 }
 
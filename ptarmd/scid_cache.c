@@ -0,0 +1,516 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   scid_cache.c
+ *  @brief  short_channel_id UTXO cache
+ *
+ *  short_channel_idをkeyにしたopen addressing(linear probing)のhash tableを持つ。
+ *  blockのvinとの照合は#watchの表で行い(#WATCH_TYPE_SCID)、#scid_cache_spent()で通知を受ける。
+ *  entryは削除しない(使用済みは#SCID_CACHE_STAT_SPENTのまま残し、fileには保存しない)。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define LOG_TAG     "scid_cache"
+#include "utl_log.h"
+#include "utl_dbg.h"
+#include "utl_buf.h"
+
+#include "btc_crypto.h"
+
+#include "ln.h"
+
+#include "btcrpc.h"
+#include "scid_cache.h"
+#include "watch.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CAPACITY_MIN          (1024)      ///< table初期サイズ(2のべき乗)
+#define M_FILE_MAGIC            (0x44494353)    ///< "SCID"
+#define M_FILE_VERSION          (1)
+#define M_OFFSET_PREV_BLOCKHASH (4)         ///< block header: prev_block
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct file_header_t
+ *  @brief  保存fileのheader(後ろにentryがcount個続く)
+ */
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    int32_t     height;                     ///< 最後に反映したblock height
+    uint8_t     hash[BTC_SZ_HASH256];       ///< heightのblock hash
+    uint32_t    count;
+} file_header_t;
+
+
+/********************************************************************
+ * static variables
+ ********************************************************************/
+
+static pthread_mutex_t      mMuxTable = PTHREAD_MUTEX_INITIALIZER;
+static scid_cache_entry_t   *mpTable;           ///< short_channel_id(0:未使用slot)
+static uint32_t             mCapacity;          ///< table size(2のべき乗)
+static char                 *mpFile;
+
+static int32_t              mHeight;            ///< 最後に反映したblock height
+static uint8_t              mHash[BTC_SZ_HASH256];  ///< mHeightのblock hash
+static bool                 mSynced = true;     ///< false:fileから読み込んでからblockを反映していない
+static uint32_t             mGeneration;        ///< blockを反映するたびに増やす
+static scid_cache_counter_t mCounter;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static uint32_t scid_home(uint64_t ShortChannelId);
+static scid_cache_entry_t *scid_search(uint64_t ShortChannelId);
+static bool table_alloc(uint32_t Capacity);
+static bool entry_add(const scid_cache_entry_t *pEntry);
+static void reset_stat(void);
+static void file_load(void);
+static void file_save(void);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool scid_cache_init(const char *pFile)
+{
+    bool ret;
+
+    pthread_mutex_lock(&mMuxTable);
+    ret = watch_init() && ((mpTable != NULL) || table_alloc(M_CAPACITY_MIN));
+    if (ret && (pFile != NULL) && (mpFile == NULL)) {
+        mpFile = (char *)UTL_DBG_MALLOC(strlen(pFile) + 1);
+        strcpy(mpFile, pFile);
+        file_load();
+    }
+    pthread_mutex_unlock(&mMuxTable);
+    return ret;
+}
+
+
+void scid_cache_term(void)
+{
+    pthread_mutex_lock(&mMuxTable);
+    if (mpFile != NULL) {
+        file_save();
+        UTL_DBG_FREE(mpFile);
+    }
+    LOGD("hit=%" PRIu64 ", miss=%" PRIu64 ", rpc=%" PRIu64 ", spent=%" PRIu64 ", count=%" PRIu32 "\n",
+            mCounter.hit, mCounter.miss, mCounter.rpc, mCounter.spent, mCounter.count);
+    UTL_DBG_FREE(mpTable);
+    mCapacity = 0;
+    mHeight = 0;
+    memset(mHash, 0, sizeof(mHash));
+    mSynced = true;
+    memset(&mCounter, 0, sizeof(mCounter));
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+bool scid_cache_unspent(uint64_t ShortChannelId)
+{
+    bool ret;
+    scid_cache_entry_t entry;
+    uint32_t generation;
+    uint32_t bheight;
+    uint32_t bindex;
+    uint32_t vindex;
+    uint32_t rpc = 0;
+    bool unspent = false;
+    utl_buf_t script = UTL_BUF_INIT;
+
+    pthread_mutex_lock(&mMuxTable);
+    if (mpTable == NULL) {
+        pthread_mutex_unlock(&mMuxTable);
+        LOGE("fail: not initialized\n");
+        return false;
+    }
+    const scid_cache_entry_t *p_entry = scid_search(ShortChannelId);
+    bool found = (p_entry->short_channel_id != 0);
+    if (found) {
+        memcpy(&entry, p_entry, sizeof(entry));
+        //読み込んだ未使用entryは、blockを反映するまで信用しない
+        if ((entry.stat == SCID_CACHE_STAT_UNSPENT) && !mSynced) {
+            entry.stat = SCID_CACHE_STAT_UNKNOWN;
+        }
+    }
+    if (found && (entry.stat != SCID_CACHE_STAT_UNKNOWN)) {
+        mCounter.hit++;
+        pthread_mutex_unlock(&mMuxTable);
+        return entry.stat == SCID_CACHE_STAT_UNSPENT;
+    }
+    mCounter.miss++;
+    generation = mGeneration;
+    pthread_mutex_unlock(&mMuxTable);
+
+    ln_short_channel_id_get_param(&bheight, &bindex, &vindex, ShortChannelId);
+    if (!found) {
+        memset(&entry, 0, sizeof(entry));
+        entry.short_channel_id = ShortChannelId;
+        rpc++;
+        ret = btcrpc_gettxid_from_short_channel(entry.txid, bheight, bindex);
+        if (!ret) {
+            LOGD("fail: get txid(%016" PRIx64 ")\n", ShortChannelId);
+            goto LABEL_EXIT;
+        }
+    }
+
+    rpc++;
+    ret = btcrpc_gettxout(&unspent, &script, entry.txid, vindex);
+    if (!ret) {
+        LOGD("fail: gettxout(%016" PRIx64 ")\n", ShortChannelId);
+        goto LABEL_EXIT;
+    }
+    entry.stat = (uint8_t)(unspent ? SCID_CACHE_STAT_UNSPENT : SCID_CACHE_STAT_SPENT);
+    if ((script.len > 0) && (script.len <= SCID_CACHE_SZ_SCRIPT)) {
+        memcpy(entry.script, script.buf, script.len);
+        entry.script_len = (uint8_t)script.len;
+    }
+
+LABEL_EXIT:
+    utl_buf_free(&script);
+    pthread_mutex_lock(&mMuxTable);
+    mCounter.rpc += rpc;
+    if (ret && (mpTable != NULL)) {
+        if (mGeneration != generation) {
+            //問い合わせ中に反映したblockで使用されたかもしれない
+            entry.stat = SCID_CACHE_STAT_UNKNOWN;
+        }
+        (void)entry_add(&entry);
+    }
+    pthread_mutex_unlock(&mMuxTable);
+
+    if (!(ret && unspent)) {
+        LOGD("already spent : %016" PRIx64 "(height=%" PRIu32 ", bindex=%" PRIu32 ", txindex=%" PRIu32 ")\n", ShortChannelId, bheight, bindex, vindex);
+        return false;
+    }
+    return true;
+}
+
+
+bool scid_cache_get(scid_cache_entry_t *pEntry, uint64_t ShortChannelId)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMuxTable);
+    if ((mpTable != NULL) && (ShortChannelId != 0)) {
+        const scid_cache_entry_t *p_entry = scid_search(ShortChannelId);
+        ret = (p_entry->short_channel_id != 0);
+        if (ret) {
+            memcpy(pEntry, p_entry, sizeof(scid_cache_entry_t));
+        }
+    }
+    pthread_mutex_unlock(&mMuxTable);
+    return ret;
+}
+
+
+bool scid_cache_block(const uint8_t *pBlock, uint32_t Len, int32_t Height)
+{
+    bool ret = true;
+    uint8_t hash[BTC_SZ_HASH256];
+
+    if (Len < BTC_SZ_BLOCK_HEADER) {
+        LOGE("fail: block length\n");
+        return false;
+    }
+    btc_md_hash256(hash, pBlock, BTC_SZ_BLOCK_HEADER);
+
+    pthread_mutex_lock(&mMuxTable);
+    if (mpTable == NULL) {
+        LOGE("fail: not initialized\n");
+        ret = false;
+        goto LABEL_EXIT;
+    }
+    if ((Height == mHeight) && (memcmp(hash, mHash, BTC_SZ_HASH256) == 0)) {
+        //反映済み
+        mSynced = true;
+        goto LABEL_EXIT;
+    }
+    if ( (mHeight == 0) || (Height != mHeight + 1) ||
+         (memcmp(pBlock + M_OFFSET_PREV_BLOCKHASH, mHash, BTC_SZ_HASH256) != 0) ) {
+        LOGD("resync: %" PRId32 " --> %" PRId32 "\n", mHeight, Height);
+        reset_stat();
+    }
+    mGeneration++;
+    mHeight = Height;
+    memcpy(mHash, hash, BTC_SZ_HASH256);
+    mSynced = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&mMuxTable);
+    return ret;
+}
+
+
+void scid_cache_spent(uint64_t ShortChannelId)
+{
+    pthread_mutex_lock(&mMuxTable);
+    if ((mpTable != NULL) && (ShortChannelId != 0)) {
+        scid_cache_entry_t *p_entry = scid_search(ShortChannelId);
+        if ( (p_entry->short_channel_id != 0) &&
+             (p_entry->stat != SCID_CACHE_STAT_SPENT) ) {
+            LOGD("spent: %016" PRIx64 "\n", ShortChannelId);
+            p_entry->stat = SCID_CACHE_STAT_SPENT;
+            mCounter.spent++;
+        }
+    }
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+void scid_cache_resync(void)
+{
+    pthread_mutex_lock(&mMuxTable);
+    if (mpTable != NULL) {
+        reset_stat();
+    }
+    mHeight = 0;
+    memset(mHash, 0, sizeof(mHash));
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+int32_t scid_cache_height(void)
+{
+    pthread_mutex_lock(&mMuxTable);
+    int32_t height = mHeight;
+    pthread_mutex_unlock(&mMuxTable);
+    return height;
+}
+
+
+void scid_cache_counter(scid_cache_counter_t *pCounter)
+{
+    pthread_mutex_lock(&mMuxTable);
+    memcpy(pCounter, &mCounter, sizeof(scid_cache_counter_t));
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+static uint32_t scid_home(uint64_t ShortChannelId)
+{
+    uint64_t key = ShortChannelId * 0x9e3779b97f4a7c15ULL;
+    key ^= key >> 32;
+    return (uint32_t)key & (mCapacity - 1);
+}
+
+
+/** short_channel_id slot検索
+ *
+ * @return      一致したslot, または登録するslot(short_channel_id==0)
+ */
+static scid_cache_entry_t *scid_search(uint64_t ShortChannelId)
+{
+    uint32_t slot = scid_home(ShortChannelId);
+    for (;;) {
+        scid_cache_entry_t *p_entry = &mpTable[slot];
+        if ((p_entry->short_channel_id == 0) || (p_entry->short_channel_id == ShortChannelId)) {
+            return p_entry;
+        }
+        slot = (slot + 1) & (mCapacity - 1);
+    }
+}
+
+
+/** table確保(登録済みのentryは再配置する)
+ *
+ */
+static bool table_alloc(uint32_t Capacity)
+{
+    scid_cache_entry_t *p_old = mpTable;
+    uint32_t old_capacity = mCapacity;
+
+    mpTable = (scid_cache_entry_t *)UTL_DBG_MALLOC(sizeof(scid_cache_entry_t) * Capacity);
+    if (mpTable == NULL) {
+        LOGE("fail: malloc(capacity=%" PRIu32 ")\n", Capacity);
+        mpTable = p_old;
+        return false;
+    }
+    memset(mpTable, 0, sizeof(scid_cache_entry_t) * Capacity);
+    mCapacity = Capacity;
+    for (uint32_t lp = 0; lp < old_capacity; lp++) {
+        if (p_old[lp].short_channel_id != 0) {
+            scid_cache_entry_t *p_entry = scid_search(p_old[lp].short_channel_id);
+            memcpy(p_entry, &p_old[lp], sizeof(scid_cache_entry_t));
+        }
+    }
+    UTL_DBG_FREE(p_old);
+    LOGD("capacity=%" PRIu32 ", count=%" PRIu32 "\n", mCapacity, mCounter.count);
+    return true;
+}
+
+
+/** entry登録(登録済みなら上書き)
+ *
+ * 新規entryはfunding_txのoutputを#watch_add_scid()で監視に登録する。
+ * 監視できないentryは使用されても検出できないので登録しない。
+ */
+static bool entry_add(const scid_cache_entry_t *pEntry)
+{
+    scid_cache_entry_t *p_entry = scid_search(pEntry->short_channel_id);
+    if (p_entry->short_channel_id != 0) {
+        memcpy(p_entry, pEntry, sizeof(scid_cache_entry_t));
+        return true;
+    }
+
+    //使用率が1/2を超える場合は拡張する
+    if ((mCounter.count + 1) * 2 > mCapacity) {
+        if (!table_alloc(mCapacity * 2)) {
+            return false;
+        }
+        p_entry = scid_search(pEntry->short_channel_id);
+    }
+
+    uint32_t bheight;
+    uint32_t bindex;
+    uint32_t vindex;
+    ln_short_channel_id_get_param(&bheight, &bindex, &vindex, pEntry->short_channel_id);
+    if (!watch_add_scid(pEntry->txid, vindex, pEntry->short_channel_id)) {
+        return false;
+    }
+    memcpy(p_entry, pEntry, sizeof(scid_cache_entry_t));
+    mCounter.count++;
+    return true;
+}
+
+
+/** 全entryを未確認に戻す
+ *
+ */
+static void reset_stat(void)
+{
+    for (uint32_t lp = 0; lp < mCapacity; lp++) {
+        mpTable[lp].stat = SCID_CACHE_STAT_UNKNOWN;
+    }
+}
+
+
+/** file読み込み(mMuxTable lock中)
+ *
+ * 読み込んだentryは、次に反映するblockが保存時のblockから連続していれば未使用のまま使う。
+ */
+static void file_load(void)
+{
+    FILE *fp = fopen(mpFile, "rb");
+    if (fp == NULL) {
+        LOGD("no cache file: %s\n", mpFile);
+        return;
+    }
+
+    file_header_t header;
+    if ( (fread(&header, sizeof(header), 1, fp) != 1) ||
+         (header.magic != M_FILE_MAGIC) || (header.version != M_FILE_VERSION) ) {
+        LOGE("fail: invalid cache file: %s\n", mpFile);
+        fclose(fp);
+        return;
+    }
+    for (uint32_t lp = 0; lp < header.count; lp++) {
+        scid_cache_entry_t entry;
+        if (fread(&entry, sizeof(entry), 1, fp) != 1) {
+            LOGE("fail: read entry(%" PRIu32 "/%" PRIu32 ")\n", lp, header.count);
+            break;
+        }
+        if ((entry.short_channel_id == 0) || (entry.script_len > SCID_CACHE_SZ_SCRIPT)) {
+            continue;
+        }
+        if (!entry_add(&entry)) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    mHeight = header.height;
+    memcpy(mHash, header.hash, BTC_SZ_HASH256);
+    mSynced = false;
+    LOGD("load: height=%" PRId32 ", count=%" PRIu32 "\n", mHeight, mCounter.count);
+}
+
+
+/** file保存(mMuxTable lock中)
+ *
+ * 使用済みのentryは保存しない。
+ */
+static void file_save(void)
+{
+    char *fname_tmp = (char *)UTL_DBG_MALLOC(strlen(mpFile) + sizeof(".tmp"));
+    sprintf(fname_tmp, "%s.tmp", mpFile);
+
+    FILE *fp = fopen(fname_tmp, "wb");
+    if (fp == NULL) {
+        LOGE("fail: open %s\n", fname_tmp);
+        UTL_DBG_FREE(fname_tmp);
+        return;
+    }
+
+    file_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = M_FILE_MAGIC;
+    header.version = M_FILE_VERSION;
+    header.height = mHeight;
+    memcpy(header.hash, mHash, BTC_SZ_HASH256);
+    bool ret = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    for (uint32_t lp = 0; ret && (lp < mCapacity); lp++) {
+        if ( (mpTable[lp].short_channel_id != 0) &&
+             (mpTable[lp].stat != SCID_CACHE_STAT_SPENT) ) {
+            ret = (fwrite(&mpTable[lp], sizeof(scid_cache_entry_t), 1, fp) == 1);
+            header.count++;
+        }
+    }
+    if (ret) {
+        ret = (fseek(fp, 0, SEEK_SET) == 0) &&
+                (fwrite(&header, sizeof(header), 1, fp) == 1);
+    }
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
+    if (ret) {
+        ret = (rename(fname_tmp, mpFile) == 0);
+    }
+    if (ret) {
+        LOGD("save: height=%" PRId32 ", count=%" PRIu32 "\n", mHeight, header.count);
+    } else {
+        LOGE("fail: save %s\n", mpFile);
+        remove(fname_tmp);
+    }
+    UTL_DBG_FREE(fname_tmp);
+}
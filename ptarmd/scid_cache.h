@@ -0,0 +1,184 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   scid_cache.h
+ *  @brief  short_channel_id UTXO cache
+ *
+ *  short_channel_idごとにfunding_txのTXID, scriptPubKey, 未使用/使用済みを保持し、
+ *  announcementを中継する前の未使用確認をbitcoindに問い合わせずに返す。
+ *      - 状態はblockで更新する(時間では破棄しない)。
+ *        #scid_cache_block()で前回のblockから連続していない場合は、全entryを#SCID_CACHE_STAT_UNKNOWNに戻す。
+ *      - funding_txのoutputは#watch_add_scid()で#watchに登録し、blockのvinとの照合は#watch_block()で1回だけ行う。
+ *        同じblockで#scid_cache_block()を先に呼び、#WATCH_TYPE_SCIDの検出を#scid_cache_spent()に渡すこと。
+ *      - #SCID_CACHE_STAT_UNKNOWNのentryは、TXIDを使ってgettxoutだけで確認し直す。
+ *      - #scid_cache_term()でfileに保存し、#scid_cache_init()で読み込む(使用済みのentryは保存しない)。
+ *      - 全関数はthread safe。
+ */
+#ifndef SCID_CACHE_H__
+#define SCID_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define SCID_CACHE_SZ_SCRIPT    (34)        ///< 保持するscriptPubKey長上限(P2WSH)
+
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** @enum   scid_cache_stat_t
+ *  @brief  funding_txのoutputの状態
+ */
+typedef enum {
+    SCID_CACHE_STAT_UNKNOWN,        ///< 未確認(bitcoindで確認する)
+    SCID_CACHE_STAT_UNSPENT,        ///< 未使用
+    SCID_CACHE_STAT_SPENT,          ///< 使用済み
+} scid_cache_stat_t;
+
+
+/** @struct scid_cache_entry_t
+ *  @brief  short_channel_idのfunding_tx output
+ */
+typedef struct {
+    uint64_t        short_channel_id;
+    uint8_t         txid[BTC_SZ_TXID];                  ///< funding_txのTXID
+    uint8_t         script[SCID_CACHE_SZ_SCRIPT];       ///< outputのscriptPubKey
+    uint8_t         script_len;                         ///< 0:未取得
+    uint8_t         stat;                               ///< #scid_cache_stat_t
+} scid_cache_entry_t;
+
+
+/** @struct scid_cache_counter_t
+ *  @brief  #scid_cache_unspent()の集計
+ */
+typedef struct {
+    uint64_t        hit;            ///< bitcoindに問い合わせなかった
+    uint64_t        miss;           ///< bitcoindに問い合わせた
+    uint64_t        rpc;            ///< bitcoind RPC回数
+    uint64_t        spent;          ///< blockで使用済みにしたentry数
+    uint32_t        count;          ///< 登録数
+} scid_cache_counter_t;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** [scid_cache]初期化
+ *
+ * pFileがあれば読み込む(読み込めなくてもエラーにしない)。
+ *
+ * @param[in]   pFile       保存file(NULL:保存しない)
+ * @retval  true    成功
+ */
+bool scid_cache_init(const char *pFile);
+
+
+/** [scid_cache]終了
+ *
+ * #scid_cache_init()のpFileに保存する。
+ */
+void scid_cache_term(void);
+
+
+/** [scid_cache]funding_txのoutputが未使用か
+ *
+ * #SCID_CACHE_STAT_UNSPENT, #SCID_CACHE_STAT_SPENTのentryはそのまま返す。
+ * 未登録の場合はblockからTXIDを取得してgettxoutで、
+ * #SCID_CACHE_STAT_UNKNOWNの場合はgettxoutだけで確認し、結果を登録する。
+ *
+ * @param[in]   ShortChannelId  short_channel_id
+ * @retval  true    未使用
+ * @retval  false   使用済み、またはbitcoindで確認できなかった
+ */
+bool scid_cache_unspent(uint64_t ShortChannelId);
+
+
+/** [scid_cache]entry取得
+ *
+ * @param[out]  pEntry          entry
+ * @param[in]   ShortChannelId  short_channel_id
+ * @retval  true    登録済み
+ */
+bool scid_cache_get(scid_cache_entry_t *pEntry, uint64_t ShortChannelId);
+
+
+/** [scid_cache]blockの反映開始
+ *
+ * 前回のblock(Height - 1)から連続していなければ、全entryを#SCID_CACHE_STAT_UNKNOWNにする。
+ * 反映済みのblockは無視する。
+ * 使用されたoutputは、この後の#watch_block()から#scid_cache_spent()で反映する。
+ *
+ * @param[in]   pBlock      raw block(block headerだけ使用する)
+ * @param[in]   Len         pBlock長
+ * @param[in]   Height      block height
+ * @retval  true    成功
+ */
+bool scid_cache_block(const uint8_t *pBlock, uint32_t Len, int32_t Height);
+
+
+/** [scid_cache]funding_txのoutputが使用された
+ *
+ * #watch_block()で#WATCH_TYPE_SCIDのoutpointを検出したときに呼び出す。
+ *
+ * @param[in]   ShortChannelId  short_channel_id
+ */
+void scid_cache_spent(uint64_t ShortChannelId);
+
+
+/** [scid_cache]全entryを#SCID_CACHE_STAT_UNKNOWNにする
+ *
+ * blockの照合に失敗した場合に呼び出す。次の#scid_cache_block()は連続していないものとして扱う。
+ */
+void scid_cache_resync(void);
+
+
+/** [scid_cache]最後に反映したblock height
+ *
+ * @return      block height(0:未反映)
+ */
+int32_t scid_cache_height(void);
+
+
+/** [scid_cache]集計取得
+ *
+ * @param[out]  pCounter    集計
+ */
+void scid_cache_counter(scid_cache_counter_t *pCounter);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCID_CACHE_H__ */
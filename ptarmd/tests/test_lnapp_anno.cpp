@@ -10,6 +10,7 @@ extern "C" {
 #include "../../utl/utl_log.c"
 #include "../../utl/utl_dbg.c"
 #include "../../utl/utl_buf.c"
+#include "../../utl/utl_arena.c"
 #include "../../utl/utl_push.c"
 #include "../../utl/utl_addr.c"
 #include "../../utl/utl_time.c"
@@ -33,41 +34,37 @@ FAKE_VOID_FUNC(ln_node_term);
 FAKE_VALUE_FUNC(const uint8_t *,ln_remote_node_id, const ln_channel_t *);
 FAKE_VALUE_FUNC(uint64_t, ln_short_channel_id, const ln_channel_t *);
 FAKE_VALUE_FUNC(const char *, ln_msg_name, uint16_t );
-FAKE_VALUE_FUNC(bool, ln_noise_enc, ln_noise_t *, utl_buf_t *, const utl_buf_t *);
+FAKE_VALUE_FUNC(bool, ln_noise_enc_arena, ln_noise_t *, utl_buf_t *, const utl_buf_t *, utl_arena_t *);
 FAKE_VALUE_FUNC(bool, ln_get_ids_cnl_anno, uint64_t *, uint8_t *, uint8_t *, const uint8_t *, uint16_t );
 FAKE_VOID_FUNC(ln_short_channel_id_get_param, uint32_t *, uint32_t *, uint32_t *, uint64_t );
 FAKE_VOID_FUNC(ln_short_channel_id_string, char *, uint64_t );
 
 FAKE_VALUE_FUNC(bool, ln_db_channel_owned_check, uint64_t);
 FAKE_VALUE_FUNC(bool, ln_db_cnlupd_need_to_prune, uint64_t , uint32_t );
-FAKE_VALUE_FUNC(bool, ln_db_cnlanno_info_search_node_id, void *, uint64_t , char , const uint8_t *);
-FAKE_VALUE_FUNC(bool, ln_db_cnlanno_info_add_node_id, void *, uint64_t , char , bool , const uint8_t *);
-FAKE_VALUE_FUNC(bool, ln_db_nodeanno_cur_load, void *, utl_buf_t *, uint32_t *, const uint8_t *);
-FAKE_VALUE_FUNC(bool, ln_db_nodeanno_info_search_node_id, void *, const uint8_t *, const uint8_t *);
-FAKE_VALUE_FUNC(bool, ln_db_nodeanno_info_add_node_id, void *, const uint8_t *, bool , const uint8_t *);
-FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_get, void *, uint64_t *, char *, uint32_t *, utl_buf_t *);
-FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_back, void *);
-FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_del, void *);
 FAKE_VALUE_FUNC(bool, ln_db_anno_transaction);
 FAKE_VOID_FUNC(ln_db_anno_commit, bool);
-FAKE_VALUE_FUNC(bool, ln_db_anno_cur_open, void **, ln_db_cur_t );
-FAKE_VOID_FUNC(ln_db_anno_cur_close, void *);
 FAKE_VALUE_FUNC(bool, ln_db_cnlanno_del, uint64_t );
+FAKE_VALUE_FUNC(bool, ln_db_cnlupd_del, uint64_t , uint8_t );
+
+FAKE_VALUE_FUNC(bool, ln_gossip_next, ln_gossip_entry_t *, uint64_t *, const uint8_t *);
+FAKE_VALUE_FUNC(uint64_t, ln_gossip_tail);
+FAKE_VOID_FUNC(ln_gossip_request_clear, const uint8_t *);
 
-FAKE_VALUE_FUNC(bool, btcrpc_gettxid_from_short_channel, uint8_t *, int , int );
 FAKE_VALUE_FUNC(bool, btcrpc_check_unspent, const uint8_t *, bool *, uint64_t *, const uint8_t *, uint32_t );
 
+FAKE_VALUE_FUNC(bool, scid_cache_unspent, uint64_t );
+
+FAKE_VOID_FUNC(peer_engine_write_wait, peer_engine_handle_t *, bool );
+
 
 ////////////////////////////////////////////////////////////////////////
 namespace dummy {
     const char *ln_msg_name(uint16_t Type) {
         return "";
     }
-    
-    bool ln_db_nodeanno_cur_load(void *pCur, utl_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8_t *pNodeId) {
-        pNodeAnno->len = sizeof(uint16_t);
-        pNodeAnno->buf = (uint8_t *)UTL_DBG_MALLOC(pNodeAnno->len);
-        memset(pNodeAnno->buf, 0, pNodeAnno->len);
+
+    bool btcrpc_check_unspent(const uint8_t *pPeerId, bool *pUnspent, uint64_t *pSat, const uint8_t *pTxid, uint32_t VIndex) {
+        *pUnspent = true;
         return true;
     }
 
@@ -84,22 +81,22 @@ protected:
         RESET_FAKE(ln_remote_node_id);
         RESET_FAKE(ln_short_channel_id);
         RESET_FAKE(ln_msg_name);
-        RESET_FAKE(ln_noise_enc);
+        RESET_FAKE(ln_noise_enc_arena);
         RESET_FAKE(ln_get_ids_cnl_anno);
         RESET_FAKE(ln_db_channel_owned_check);
         RESET_FAKE(ln_db_cnlupd_need_to_prune);
-        RESET_FAKE(ln_db_cnlanno_info_search_node_id);
-        RESET_FAKE(ln_db_cnlanno_info_add_node_id);
-        RESET_FAKE(ln_db_nodeanno_cur_load);
-        RESET_FAKE(ln_db_nodeanno_info_search_node_id);
-        RESET_FAKE(ln_db_nodeanno_info_add_node_id);
-        RESET_FAKE(ln_db_cnlanno_cur_get);
-        RESET_FAKE(ln_db_cnlanno_cur_back);
-        RESET_FAKE(ln_db_cnlanno_cur_del);
+        RESET_FAKE(ln_db_anno_transaction);
+        RESET_FAKE(ln_db_anno_commit);
+        RESET_FAKE(ln_db_cnlanno_del);
+        RESET_FAKE(ln_db_cnlupd_del);
+        RESET_FAKE(ln_gossip_next);
+        RESET_FAKE(btcrpc_check_unspent);
+        RESET_FAKE(scid_cache_unspent);
+        RESET_FAKE(peer_engine_write_wait);
         
         ln_msg_name_fake.custom_fake = dummy::ln_msg_name;
-        ln_noise_enc_fake.return_val = false;
-        ln_db_nodeanno_cur_load_fake.custom_fake = dummy::ln_db_nodeanno_cur_load;
+        ln_noise_enc_arena_fake.return_val = false;
+        btcrpc_check_unspent_fake.custom_fake = dummy::btcrpc_check_unspent;
     }
 
     virtual void TearDown() {
@@ -108,6 +105,15 @@ protected:
     }
 
 public:
+    static void EntrySet(ln_gossip_entry_t *pEntry, ln_gossip_type_t Type)
+    {
+        pEntry->type = Type;
+        pEntry->short_channel_id = 0;
+        pEntry->timestamp = 0;
+        pEntry->buf.len = sizeof(uint16_t);
+        pEntry->buf.buf = (uint8_t *)UTL_DBG_MALLOC(pEntry->buf.len);
+        memset(pEntry->buf.buf, 0, pEntry->buf.len);
+    }
     static void DumpBin(const uint8_t *pData, uint16_t Len)
     {
         for (uint16_t lp = 0; lp < Len; lp++) {
@@ -134,332 +140,197 @@ public:
 
 TEST_F(lnapp, prev_check_ok1)
 {
-    ln_db_channel_owned_check_fake.return_val = true;
-    
+    ln_db_cnlupd_need_to_prune_fake.return_val = false;
+
     bool ret = anno_prev_check(0, 0);
     ASSERT_TRUE(ret);
+    ASSERT_EQ(0, ln_db_anno_transaction_fake.call_count);
 }
 
 
 TEST_F(lnapp, prev_check_ok2)
 {
-    ln_db_channel_owned_check_fake.return_val = false;
-    ln_db_cnlupd_need_to_prune_fake.return_val = false;
+    ln_db_cnlupd_need_to_prune_fake.return_val = true;
+    ln_db_anno_transaction_fake.return_val = true;
+    ln_db_channel_owned_check_fake.return_val = true;
 
     bool ret = anno_prev_check(0, 0);
     ASSERT_TRUE(ret);
+    ASSERT_EQ(1, ln_db_anno_commit_fake.call_count);
 }
 
 
 TEST_F(lnapp, prev_check_ng)
 {
-    ln_db_channel_owned_check_fake.return_val = false;
     ln_db_cnlupd_need_to_prune_fake.return_val = true;
+    ln_db_anno_transaction_fake.return_val = true;
+    ln_db_channel_owned_check_fake.return_val = false;
 
     bool ret = anno_prev_check(0, 0);
     ASSERT_FALSE(ret);
+    ASSERT_EQ(1, ln_db_anno_commit_fake.call_count);
 }
 
 
-TEST_F(lnapp, send_cnl_ok1)
+TEST_F(lnapp, send_cnlanno_ok)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
+    uint16_t msg = 0;
+    ln_gossip_entry_t entry = { LN_GOSSIP_TYPE_CNLANNO, 0, 0, { (uint8_t *)&msg, sizeof(msg) } };
+
+    scid_cache_unspent_fake.return_val = true;
 
-    ln_db_cnlanno_info_search_node_id_fake.return_val = true;
-    
-    bool ret = anno_send_cnl(&conf, 0, 0, NULL, NULL);
+    bool ret = anno_send(&conf, &entry);
     ASSERT_TRUE(ret);
+    ASSERT_EQ(0, ln_db_cnlanno_del_fake.call_count);
 }
 
 
-TEST_F(lnapp, send_cnl_ok2)
+TEST_F(lnapp, send_cnlanno_spent)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
     uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
+    ln_gossip_entry_t entry = { LN_GOSSIP_TYPE_CNLANNO, 0, 0, { (uint8_t *)&msg, sizeof(msg) } };
 
-    ln_db_cnlanno_info_search_node_id_fake.return_val = false;
-    
-    bool ret = anno_send_cnl(&conf, 0, 0, NULL, &buf);
-    ASSERT_TRUE(ret);
+    //funding_txが使用済み
+    scid_cache_unspent_fake.return_val = false;
+
+    bool ret = anno_send(&conf, &entry);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(1, ln_db_cnlanno_del_fake.call_count);
 }
 
 
-TEST_F(lnapp, send_node_ok1)
+TEST_F(lnapp, send_cnlupd_ok)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
     uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-
-    ln_get_ids_cnl_anno_fake.return_val = true;
-    bool seq[] = { true, true };
-    ln_db_nodeanno_info_search_node_id_fake.return_val_seq = seq;
-    ln_db_nodeanno_info_search_node_id_fake.return_val_seq_len = ARRAY_SIZE(seq);
-    
-    bool ret = anno_send_node(&conf, 0, 0, &buf);
-    ASSERT_TRUE(ret);
-}
+    ln_gossip_entry_t entry = { LN_GOSSIP_TYPE_CNLUPD1, 0, 0, { (uint8_t *)&msg, sizeof(msg) } };
 
+    ln_db_cnlupd_need_to_prune_fake.return_val = false;
 
-TEST_F(lnapp, send_node_ok2)
-{
-    lnapp_conf_t conf;
-    memset(&conf, 0, sizeof(conf));
-    uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-
-    ln_get_ids_cnl_anno_fake.return_val = true;
-    bool seq[] = { true, false };
-    ln_db_nodeanno_info_search_node_id_fake.return_val_seq = seq;
-    ln_db_nodeanno_info_search_node_id_fake.return_val_seq_len = ARRAY_SIZE(seq);
-    
-    bool ret = anno_send_node(&conf, 0, 0, &buf);
+    bool ret = anno_send(&conf, &entry);
     ASSERT_TRUE(ret);
+    ASSERT_EQ(0, ln_db_cnlupd_del_fake.call_count);
 }
 
 
-TEST_F(lnapp, send_node_ng)
+TEST_F(lnapp, send_cnlupd_prune)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
     uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
+    ln_gossip_entry_t entry = { LN_GOSSIP_TYPE_CNLUPD1, 0, 0, { (uint8_t *)&msg, sizeof(msg) } };
+
+    //fail anno_prev_check()
+    ln_db_cnlupd_need_to_prune_fake.return_val = true;
+    ln_db_anno_transaction_fake.return_val = true;
+    ln_db_channel_owned_check_fake.return_val = false;
 
-    ln_get_ids_cnl_anno_fake.return_val = false;
-    
-    bool ret = anno_send_node(&conf, 0, 0, &buf);
+    bool ret = anno_send(&conf, &entry);
     ASSERT_FALSE(ret);
+    ASSERT_EQ(1, ln_db_cnlupd_del_fake.call_count);
+    ASSERT_EQ(1, ln_db_cnlupd_del_fake.arg1_val);
 }
 
 
-TEST_F(lnapp, send_ok1)
+TEST_F(lnapp, send_nodeanno)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
     uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-    
-    ln_db_channel_owned_check_fake.return_val = true;
-    struct local {
-        static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-            *pShortChannelId = 0;
-            *pType = (char)(LN_DB_CNLANNO_UPD0 + ln_db_cnlanno_cur_get_fake.call_count - 1);
-            pBuf->len = sizeof(uint16_t);
-            pBuf->buf = (uint8_t *)UTL_DBG_MALLOC(pBuf->len);
-            memset(pBuf->buf, 0, pBuf->len);
-            return true;
-        }
-    };
-    ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
+    ln_gossip_entry_t entry = { LN_GOSSIP_TYPE_NODEANNO, 0, 0, { (uint8_t *)&msg, sizeof(msg) } };
 
-    bool ret = anno_send(&conf, 0, &buf, NULL, NULL, NULL, NULL);
+    bool ret = anno_send(&conf, &entry);
     ASSERT_TRUE(ret);
 }
 
 
-TEST_F(lnapp, send_ok2)
+TEST_F(lnapp, proc_ok1)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
-    uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-    
-    ln_db_channel_owned_check_fake.return_val = true;
+    conf.active = true;
+
+    scid_cache_unspent_fake.return_val = true;
+    ln_db_cnlupd_need_to_prune_fake.return_val = false;
+
     struct local {
-        static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-            if (ln_db_cnlanno_cur_get_fake.call_count == 1) {
-                //skip B
-                *pShortChannelId = 0;
-                *pType = (char)(LN_DB_CNLANNO_UPD0 + ln_db_cnlanno_cur_get_fake.call_count - 1);
-                pBuf->len = sizeof(uint16_t);
-                pBuf->buf = (uint8_t *)UTL_DBG_MALLOC(pBuf->len);
-                memset(pBuf->buf, 0, pBuf->len);
-                return true;
-            } else {
+        static bool ln_gossip_next(ln_gossip_entry_t *pEntry, uint64_t *pCursor, const uint8_t *pPeerId) {
+            switch (ln_gossip_next_fake.call_count) {
+            case 1:
+                EntrySet(pEntry, LN_GOSSIP_TYPE_CNLANNO);
+                break;
+            case 2:
+                EntrySet(pEntry, LN_GOSSIP_TYPE_CNLUPD0);
+                break;
+            case 3:
+                EntrySet(pEntry, LN_GOSSIP_TYPE_CNLUPD1);
+                break;
+            case 4:
+                EntrySet(pEntry, LN_GOSSIP_TYPE_NODEANNO);
+                break;
+            default:
+                utl_buf_init(&pEntry->buf);
                 return false;
             }
+            (*pCursor)++;
+            return true;
         }
     };
-    ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
+    ln_gossip_next_fake.custom_fake = local::ln_gossip_next;
 
-    bool ret = anno_send(&conf, 0, &buf, NULL, NULL, NULL, NULL);
+    bool ret = anno_proc(&conf);
     ASSERT_TRUE(ret);
+    ASSERT_EQ(5, ln_gossip_next_fake.call_count);
+    ASSERT_EQ(4, conf.gossip_cursor);
 }
 
 
-//最初のln_db_cnlanno_cur_get()で失敗した場合は、channel_update無しと同じ
-// TEST_F(lnapp, send_ok3)
-// {
-//     lnapp_conf_t conf;
-//     memset(&conf, 0, sizeof(conf));
-//     uint16_t msg = 0;
-//     utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-    
-//     ln_db_channel_owned_check_fake.return_val = true;
-//     struct local {
-//         static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-//             if (ln_db_cnlanno_cur_get_fake.call_count == 2) {
-//                 //skip B
-//                 *pShortChannelId = 0;
-//                 *pType = (char)(LN_DB_CNLANNO_UPD0 + ln_db_cnlanno_cur_get_fake.call_count - 1);
-//                 pBuf->len = sizeof(uint16_t);
-//                 pBuf->buf = (uint8_t *)UTL_DBG_MALLOC(pBuf->len);
-//                 memset(pBuf->buf, 0, pBuf->len);
-//                 return true;
-//             } else {
-//                 return false;
-//             }
-//         }
-//     };
-//     ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
-
-//     bool ret = anno_send(&conf, 0, &buf, NULL, NULL, NULL, NULL);
-//     ASSERT_TRUE(ret);
-// }
-
-
-TEST_F(lnapp, send_ng1)
+TEST_F(lnapp, proc_unit)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
-    uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-    
-    ln_db_channel_owned_check_fake.return_val = true;
-    struct local {
-        static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-            //no channel_update
-            return false;
-        }
-    };
-    ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
-
-    bool ret = anno_send(&conf, 0, &buf, NULL, NULL, NULL, NULL);
-    ASSERT_FALSE(ret);
-}
-
-
-TEST_F(lnapp, send_ng2)
-{
-    lnapp_conf_t conf;
-    memset(&conf, 0, sizeof(conf));
-    uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-    
-    ln_db_channel_owned_check_fake.return_val = true;
-    struct local {
-        static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-            //different short_channel_id
-            *pShortChannelId = 1;
-            *pType = (char)(LN_DB_CNLANNO_UPD0 + ln_db_cnlanno_cur_get_fake.call_count - 1);
-            pBuf->len = sizeof(uint16_t);
-            pBuf->buf = (uint8_t *)UTL_DBG_MALLOC(pBuf->len);
-            memset(pBuf->buf, 0, pBuf->len);
-            return true;
-        }
-    };
-    ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
-
-    bool ret = anno_send(&conf, 0, &buf, NULL, NULL, NULL, NULL);
-    ASSERT_FALSE(ret);
-}
+    conf.active = true;
 
+    scid_cache_unspent_fake.return_val = true;
 
-TEST_F(lnapp, send_ng3)
-{
-    lnapp_conf_t conf;
-    memset(&conf, 0, sizeof(conf));
-    uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-    
-    ln_db_channel_owned_check_fake.return_val = true;
     struct local {
-        static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-            //not channel_update
-            *pShortChannelId = 0;
-            *pType = LN_DB_CNLANNO_ANNO;
-            pBuf->len = sizeof(uint16_t);
-            pBuf->buf = (uint8_t *)UTL_DBG_MALLOC(pBuf->len);
-            memset(pBuf->buf, 0, pBuf->len);
+        static bool ln_gossip_next(ln_gossip_entry_t *pEntry, uint64_t *pCursor, const uint8_t *pPeerId) {
+            EntrySet(pEntry, LN_GOSSIP_TYPE_CNLANNO);
+            (*pCursor)++;
             return true;
         }
     };
-    ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
+    ln_gossip_next_fake.custom_fake = local::ln_gossip_next;
 
-    bool ret = anno_send(&conf, 0, &buf, NULL, NULL, NULL, NULL);
+    //M_ANNO_UNITのchannel_announcementを送信したら中断する
+    bool ret = anno_proc(&conf);
     ASSERT_FALSE(ret);
+    ASSERT_EQ(M_ANNO_UNIT, ln_gossip_next_fake.call_count);
+    ASSERT_EQ(M_ANNO_UNIT, conf.gossip_cursor);
 }
 
 
-TEST_F(lnapp, send_ng4)
-{
-    lnapp_conf_t conf;
-    memset(&conf, 0, sizeof(conf));
-    uint16_t msg = 0;
-    utl_buf_t buf = { (uint8_t *)&msg, sizeof(msg) };
-    
-    //fail anno_prev_check()
-    ln_db_channel_owned_check_fake.return_val = false;
-    struct local {
-        static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-            *pShortChannelId = 0;
-            *pType = (char)(LN_DB_CNLANNO_UPD0 + ln_db_cnlanno_cur_get_fake.call_count - 1);
-            pBuf->len = sizeof(uint16_t);
-            pBuf->buf = (uint8_t *)UTL_DBG_MALLOC(pBuf->len);
-            memset(pBuf->buf, 0, pBuf->len);
-            return true;
-        }
-    };
-    ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
-
-    bool ret = anno_send(&conf, 0, &buf, NULL, NULL, NULL, NULL);
-    ASSERT_TRUE(ret);
-}
-
-
-TEST_F(lnapp, proc_ok1)
+TEST_F(lnapp, proc_send_pending)
 {
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
     conf.active = true;
 
-    ln_db_anno_transaction_fake.return_val = true;
-    ln_db_anno_cur_open_fake.return_val = true;
-    ln_db_cnlanno_del_fake.return_val = true;
-    btcrpc_gettxid_from_short_channel_fake.return_val = true;
-    btcrpc_check_unspent_fake.return_val = true;
-    
-    ln_db_channel_owned_check_fake.return_val = true;
-    struct local {
-        static bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf) {
-            switch (ln_db_cnlanno_cur_get_fake.call_count) {
-            case 1:
-                //channel_announcement
-                *pType = LN_DB_CNLANNO_ANNO;
-                break;
-            case 2:
-                //channel_update dir=0
-                *pType = LN_DB_CNLANNO_UPD0;
-                break;
-            case 3:
-                //channel_update dir=1
-                *pType = LN_DB_CNLANNO_UPD1;
-                break;
-            default:
-                return false;
-            }
-            *pShortChannelId = 0;
-            pBuf->len = sizeof(uint16_t);
-            pBuf->buf = (uint8_t *)UTL_DBG_MALLOC(pBuf->len);
-            memset(pBuf->buf, 0, pBuf->len);
-            return true;
-        }
-    };
-    ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
-
+    //送信待ちが多い間は送信しない
+    conf.tx_len = M_ANNO_SEND_PENDING;
     bool ret = anno_proc(&conf);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(0, ln_gossip_next_fake.call_count);
+    ASSERT_EQ(0, conf.gossip_cursor);
+
+    //送信待ちが減れば再開する
+    conf.tx_pos = 1;
+    ret = anno_proc(&conf);
     ASSERT_TRUE(ret);
+    ASSERT_EQ(1, ln_gossip_next_fake.call_count);
 }
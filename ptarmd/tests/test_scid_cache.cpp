@@ -0,0 +1,334 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <unistd.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_thread.c"
+#undef LOG_TAG
+#include "../../utl/utl_log.c"
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_mem.c"
+#include "../../utl/utl_str.c"
+//評価対象本体
+#undef LOG_TAG
+#include "scid_cache.c"
+}
+
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, watch_init);
+FAKE_VALUE_FUNC(bool, watch_add_scid, const uint8_t *, uint32_t, uint64_t);
+FAKE_VOID_FUNC(btc_md_hash256, uint8_t *, const uint8_t *, uint16_t);
+FAKE_VOID_FUNC(ln_short_channel_id_get_param, uint32_t *, uint32_t *, uint32_t *, uint64_t);
+FAKE_VALUE_FUNC(bool, btcrpc_gettxid_from_short_channel, uint8_t *, int, int);
+FAKE_VALUE_FUNC(bool, btcrpc_gettxout, bool *, utl_buf_t *, const uint8_t *, uint32_t);
+
+
+////////////////////////////////////////////////////////////////////////
+namespace dummy {
+    const uint32_t OFFSET_MERKLE = 36;
+
+    //block hashはmerkle rootの位置に置く
+    void btc_md_hash256(uint8_t *pHash256, const uint8_t *pData, uint16_t Len) {
+        memcpy(pHash256, pData + OFFSET_MERKLE, BTC_SZ_HASH256);
+    }
+
+    void ln_short_channel_id_get_param(uint32_t *pHeight, uint32_t *pBIndex, uint32_t *pVIndex, uint64_t ShortChannelId) {
+        *pHeight = (uint32_t)(ShortChannelId >> 40);
+        *pBIndex = (uint32_t)(ShortChannelId >> 16) & 0xffffff;
+        *pVIndex = (uint32_t)ShortChannelId & 0xffff;
+    }
+
+    //TXIDはblock heightとblock indexから作る
+    bool btcrpc_gettxid_from_short_channel(uint8_t *pTxid, int BHeight, int BIndex) {
+        memset(pTxid, 0, BTC_SZ_TXID);
+        memcpy(pTxid, &BHeight, sizeof(BHeight));
+        memcpy(pTxid + sizeof(BHeight), &BIndex, sizeof(BIndex));
+        return true;
+    }
+
+    //登録したTXID(呼び出し元のbufferは残らない)
+    uint8_t watch_txid[BTC_SZ_TXID];
+    bool watch_add_scid(const uint8_t *pTxid, uint32_t Index, uint64_t ShortChannelId) {
+        memcpy(watch_txid, pTxid, BTC_SZ_TXID);
+        return watch_add_scid_fake.return_val;
+    }
+
+    bool unspent;
+    bool btcrpc_gettxout(bool *pUnspent, utl_buf_t *pScriptPubKey, const uint8_t *pTxid, uint32_t VIndex) {
+        *pUnspent = unspent;
+        utl_buf_init(pScriptPubKey);
+        if (unspent) {
+            utl_buf_alloc(pScriptPubKey, 34);
+            memset(pScriptPubKey->buf, 0xaa, 34);
+            pScriptPubKey->buf[0] = 0x00;
+            pScriptPubKey->buf[1] = 0x20;
+        }
+        return true;
+    }
+}
+////////////////////////////////////////////////////////////////////////
+
+class scid_cache: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+        RESET_FAKE(watch_init);
+        RESET_FAKE(watch_add_scid);
+        RESET_FAKE(btc_md_hash256);
+        RESET_FAKE(ln_short_channel_id_get_param);
+        RESET_FAKE(btcrpc_gettxid_from_short_channel);
+        RESET_FAKE(btcrpc_gettxout);
+        watch_init_fake.return_val = true;
+        watch_add_scid_fake.return_val = true;
+        watch_add_scid_fake.custom_fake = dummy::watch_add_scid;
+        btc_md_hash256_fake.custom_fake = dummy::btc_md_hash256;
+        ln_short_channel_id_get_param_fake.custom_fake = dummy::ln_short_channel_id_get_param;
+        btcrpc_gettxid_from_short_channel_fake.custom_fake = dummy::btcrpc_gettxid_from_short_channel;
+        btcrpc_gettxout_fake.custom_fake = dummy::btcrpc_gettxout;
+        dummy::unspent = true;
+        ASSERT_TRUE(scid_cache_init(NULL));
+    }
+
+    virtual void TearDown() {
+        scid_cache_term();
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    static uint64_t make_scid(uint32_t Height, uint32_t BIndex, uint32_t VIndex) {
+        return ((uint64_t)Height << 40) | ((uint64_t)BIndex << 16) | VIndex;
+    }
+
+    //block hashは先頭byteをHeightにする
+    uint8_t mBlock[BTC_SZ_BLOCK_HEADER];
+    static const uint32_t mBlockLen = BTC_SZ_BLOCK_HEADER;
+    void make_block(uint32_t Height, uint32_t PrevHeight) {
+        memset(mBlock, 0, sizeof(mBlock));
+        mBlock[M_OFFSET_PREV_BLOCKHASH] = (uint8_t)PrevHeight;
+        mBlock[dummy::OFFSET_MERKLE] = (uint8_t)Height;
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(scid_cache, cold_warm)
+{
+    uint64_t scid = make_scid(500000, 10, 1);
+    scid_cache_counter_t counter;
+    scid_cache_entry_t entry;
+
+    ASSERT_FALSE(scid_cache_get(&entry, scid));
+    ASSERT_TRUE(scid_cache_unspent(scid));
+    ASSERT_EQ(1, btcrpc_gettxid_from_short_channel_fake.call_count);
+    ASSERT_EQ(1, btcrpc_gettxout_fake.call_count);
+
+    ASSERT_TRUE(scid_cache_get(&entry, scid));
+    ASSERT_EQ(SCID_CACHE_STAT_UNSPENT, entry.stat);
+    ASSERT_EQ(34, entry.script_len);
+    ASSERT_EQ(0x20, entry.script[1]);
+
+    //funding_txのoutputをwatch indexに登録する
+    ASSERT_EQ(1, watch_add_scid_fake.call_count);
+    ASSERT_EQ(0, memcmp(entry.txid, dummy::watch_txid, BTC_SZ_TXID));
+    ASSERT_EQ(1, watch_add_scid_fake.arg1_val);
+    ASSERT_EQ(scid, watch_add_scid_fake.arg2_val);
+
+    //2回目以降はbitcoindに問い合わせない
+    ASSERT_TRUE(scid_cache_unspent(scid));
+    ASSERT_TRUE(scid_cache_unspent(scid));
+    ASSERT_EQ(1, btcrpc_gettxid_from_short_channel_fake.call_count);
+    ASSERT_EQ(1, btcrpc_gettxout_fake.call_count);
+
+    scid_cache_counter(&counter);
+    ASSERT_EQ(2, counter.hit);
+    ASSERT_EQ(1, counter.miss);
+    ASSERT_EQ(2, counter.rpc);
+    ASSERT_EQ(1, counter.count);
+    ASSERT_EQ(1, watch_add_scid_fake.call_count);
+}
+
+
+TEST_F(scid_cache, watch_fail)
+{
+    uint64_t scid = make_scid(500000, 10, 1);
+    scid_cache_entry_t entry;
+
+    //watch indexに登録できなければ使用を検出できないので登録しない
+    watch_add_scid_fake.return_val = false;
+    ASSERT_TRUE(scid_cache_unspent(scid));
+    ASSERT_FALSE(scid_cache_get(&entry, scid));
+
+    watch_add_scid_fake.return_val = true;
+    ASSERT_TRUE(scid_cache_unspent(scid));
+    ASSERT_TRUE(scid_cache_get(&entry, scid));
+    ASSERT_EQ(2, btcrpc_gettxout_fake.call_count);
+}
+
+
+TEST_F(scid_cache, spent_rpc)
+{
+    uint64_t scid = make_scid(500000, 10, 1);
+    scid_cache_entry_t entry;
+
+    dummy::unspent = false;
+    ASSERT_FALSE(scid_cache_unspent(scid));
+    ASSERT_FALSE(scid_cache_unspent(scid));
+    ASSERT_EQ(1, btcrpc_gettxout_fake.call_count);
+    ASSERT_TRUE(scid_cache_get(&entry, scid));
+    ASSERT_EQ(SCID_CACHE_STAT_SPENT, entry.stat);
+    ASSERT_EQ(0, entry.script_len);
+}
+
+
+TEST_F(scid_cache, rpc_fail)
+{
+    uint64_t scid = make_scid(500000, 10, 1);
+    scid_cache_entry_t entry;
+    scid_cache_counter_t counter;
+
+    //失敗は登録しない
+    btcrpc_gettxid_from_short_channel_fake.custom_fake = NULL;
+    btcrpc_gettxid_from_short_channel_fake.return_val = false;
+    ASSERT_FALSE(scid_cache_unspent(scid));
+    ASSERT_EQ(0, btcrpc_gettxout_fake.call_count);
+    ASSERT_FALSE(scid_cache_get(&entry, scid));
+
+    btcrpc_gettxid_from_short_channel_fake.custom_fake = dummy::btcrpc_gettxid_from_short_channel;
+    ASSERT_TRUE(scid_cache_unspent(scid));
+    scid_cache_counter(&counter);
+    ASSERT_EQ(0, counter.hit);
+    ASSERT_EQ(2, counter.miss);
+    ASSERT_EQ(3, counter.rpc);
+}
+
+
+TEST_F(scid_cache, block)
+{
+    uint64_t scid1 = make_scid(500000, 10, 1);
+    uint64_t scid2 = make_scid(500000, 11, 0);
+    scid_cache_counter_t counter;
+
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_TRUE(scid_cache_unspent(scid2));
+    ASSERT_EQ(2, btcrpc_gettxout_fake.call_count);
+
+    //最初のblockは連続していないので未確認に戻す(TXIDは再取得しない)
+    make_block(100, 99);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 100));
+    ASSERT_EQ(100, scid_cache_height());
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_TRUE(scid_cache_unspent(scid2));
+    ASSERT_EQ(2, btcrpc_gettxid_from_short_channel_fake.call_count);
+    ASSERT_EQ(4, btcrpc_gettxout_fake.call_count);
+
+    //連続したblockで使用された(#watch_block()から通知される)
+    make_block(101, 100);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 101));
+    scid_cache_spent(scid1);
+    scid_cache_spent(make_scid(500000, 12, 0));     //未登録
+    ASSERT_FALSE(scid_cache_unspent(scid1));
+    ASSERT_TRUE(scid_cache_unspent(scid2));
+    ASSERT_EQ(4, btcrpc_gettxout_fake.call_count);
+
+    //反映済みのblockは無視する
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 101));
+    scid_cache_spent(scid1);
+    scid_cache_counter(&counter);
+    ASSERT_EQ(1, counter.spent);
+
+    //reorgでは全entryを未確認に戻す
+    make_block(102, 77);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 102));
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_TRUE(scid_cache_unspent(scid2));
+    ASSERT_EQ(6, btcrpc_gettxout_fake.call_count);
+
+    //照合に失敗したら、次のblockは連続していても未確認に戻す
+    scid_cache_resync();
+    ASSERT_EQ(0, scid_cache_height());
+    make_block(103, 102);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 103));
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_EQ(7, btcrpc_gettxout_fake.call_count);
+}
+
+
+TEST_F(scid_cache, grow)
+{
+    const uint32_t NUM = 5000;
+
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(scid_cache_unspent(make_scid(400000 + lp / 100, lp % 100, lp & 0x03)));
+    }
+    ASSERT_LE(NUM * 2, mCapacity);
+
+    make_block(100, 99);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 100));
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(scid_cache_unspent(make_scid(400000 + lp / 100, lp % 100, lp & 0x03)));
+    }
+
+    make_block(101, 100);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 101));
+    scid_cache_spent(make_scid(400000 + 4321 / 100, 4321 % 100, 4321 & 0x03));
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        ASSERT_EQ(lp != 4321, scid_cache_unspent(make_scid(400000 + lp / 100, lp % 100, lp & 0x03)));
+    }
+    ASSERT_EQ(NUM * 2, btcrpc_gettxout_fake.call_count);
+    ASSERT_EQ(NUM, btcrpc_gettxid_from_short_channel_fake.call_count);
+    ASSERT_EQ(NUM, watch_add_scid_fake.call_count);
+}
+
+
+TEST_F(scid_cache, file)
+{
+    char fname[] = "/tmp/test_scid_cacheXXXXXX";
+    int fd = mkstemp(fname);
+    ASSERT_NE(-1, fd);
+    close(fd);
+    unlink(fname);
+
+    uint64_t scid1 = make_scid(500000, 10, 1);
+    uint64_t scid2 = make_scid(500000, 11, 0);
+    scid_cache_entry_t entry;
+
+    scid_cache_term();
+    ASSERT_TRUE(scid_cache_init(fname));
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_TRUE(scid_cache_unspent(scid2));
+    make_block(100, 99);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 100));
+    scid_cache_spent(scid2);
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_FALSE(scid_cache_unspent(scid2));
+    scid_cache_term();
+    ASSERT_EQ(0, utl_dbg_malloc_cnt());
+
+    //使用済みは保存しない
+    RESET_FAKE(btcrpc_gettxout);
+    btcrpc_gettxout_fake.custom_fake = dummy::btcrpc_gettxout;
+    ASSERT_TRUE(scid_cache_init(fname));
+    ASSERT_EQ(100, scid_cache_height());
+    ASSERT_TRUE(scid_cache_get(&entry, scid1));
+    ASSERT_FALSE(scid_cache_get(&entry, scid2));
+
+    //保存時のblockを確認するまでは未使用でも問い合わせる
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_EQ(1, btcrpc_gettxout_fake.call_count);
+    ASSERT_TRUE(scid_cache_block(mBlock, mBlockLen, 100));
+    ASSERT_TRUE(scid_cache_unspent(scid1));
+    ASSERT_EQ(1, btcrpc_gettxout_fake.call_count);
+
+    unlink(fname);
+}
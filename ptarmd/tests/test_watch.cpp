@@ -0,0 +1,229 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_thread.c"
+#undef LOG_TAG
+#include "../../utl/utl_log.c"
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_mem.c"
+#include "../../utl/utl_str.c"
+//評価対象本体
+#undef LOG_TAG
+#include "watch.c"
+}
+
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, btc_block_read_tx_views, const uint8_t *, uint32_t, btc_block_tx_view_func_t, void *);
+FAKE_VOID_FUNC(btc_tx_view_vin, const btc_tx_view_t *, btc_tx_view_vin_t *, uint32_t *);
+
+
+////////////////////////////////////////////////////////////////////////
+namespace dummy {
+    //pDataをvinのTXID(index=0)の並びとして扱う
+    bool btc_block_read_tx_views(const uint8_t *pData, uint32_t Len, btc_block_tx_view_func_t pFunc, void *pParam) {
+        for (uint32_t lp = 0; lp < Len / BTC_SZ_TXID; lp++) {
+            btc_tx_view_t view;
+            memset(&view, 0, sizeof(view));
+            view.p_data = pData + lp * BTC_SZ_TXID;
+            view.len = BTC_SZ_TXID;
+            view.vin_cnt = 1;
+            view.vin_pos = 0;
+            if (!(*pFunc)(&view, lp, pParam)) {
+                break;
+            }
+        }
+        return true;
+    }
+    void btc_tx_view_vin(const btc_tx_view_t *pView, btc_tx_view_vin_t *pVin, uint32_t *pPos) {
+        memset(pVin, 0, sizeof(btc_tx_view_vin_t));
+        pVin->txid_pos = *pPos;
+        *pPos += BTC_SZ_TXID;
+    }
+
+    int spent_cnt;
+    watch_outpoint_t spent;
+    void spent_cb(const watch_outpoint_t *pWatch, const btc_tx_view_t *pView, void *pParam) {
+        spent_cnt++;
+        memcpy(&spent, pWatch, sizeof(spent));
+    }
+}
+////////////////////////////////////////////////////////////////////////
+
+class watch: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+        RESET_FAKE(btc_block_read_tx_views);
+        RESET_FAKE(btc_tx_view_vin);
+        btc_block_read_tx_views_fake.custom_fake = dummy::btc_block_read_tx_views;
+        btc_tx_view_vin_fake.custom_fake = dummy::btc_tx_view_vin;
+        dummy::spent_cnt = 0;
+        ASSERT_TRUE(watch_init());
+    }
+
+    virtual void TearDown() {
+        watch_term();
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    //先頭8byteが同じTXIDは同じslotから探索する
+    static void make_txid(uint8_t *pTxid, uint32_t Seed, uint8_t Tail) {
+        memset(pTxid, 0, BTC_SZ_TXID);
+        memcpy(pTxid, &Seed, sizeof(Seed));
+        pTxid[BTC_SZ_TXID - 1] = Tail;
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(watch, add_get)
+{
+    uint8_t txid[BTC_SZ_TXID];
+    uint8_t channel_id[LN_SZ_CHANNEL_ID] = { 0x01 };
+
+    make_txid(txid, 1, 0);
+    ASSERT_EQ(WATCH_STAT_NONE, watch_get(txid, 0));
+    ASSERT_TRUE(watch_add(txid, 0, channel_id, WATCH_TYPE_FUNDING, WATCH_STAT_UNSPENT));
+    ASSERT_EQ(WATCH_STAT_UNSPENT, watch_get(txid, 0));
+    ASSERT_EQ(WATCH_STAT_NONE, watch_get(txid, 1));
+    ASSERT_EQ(1, watch_count());
+
+    //UNKNOWNでは更新しない
+    ASSERT_TRUE(watch_add(txid, 0, channel_id, WATCH_TYPE_FUNDING, WATCH_STAT_UNKNOWN));
+    ASSERT_EQ(WATCH_STAT_UNSPENT, watch_get(txid, 0));
+    ASSERT_TRUE(watch_add(txid, 0, channel_id, WATCH_TYPE_FUNDING, WATCH_STAT_SPENT));
+    ASSERT_EQ(WATCH_STAT_SPENT, watch_get(txid, 0));
+    ASSERT_EQ(1, watch_count());
+
+    watch_reset_stat();
+    ASSERT_EQ(WATCH_STAT_UNKNOWN, watch_get(txid, 0));
+
+    watch_del(txid, 0);
+    ASSERT_EQ(WATCH_STAT_NONE, watch_get(txid, 0));
+    ASSERT_EQ(0, watch_count());
+}
+
+
+TEST_F(watch, del_collision)
+{
+    uint8_t txid[4][BTC_SZ_TXID];
+    uint8_t channel_id[LN_SZ_CHANNEL_ID] = { 0x01 };
+
+    //同じslotに並べる
+    for (int lp = 0; lp < 4; lp++) {
+        make_txid(txid[lp], 5, lp);
+        ASSERT_TRUE(watch_add(txid[lp], 0, channel_id, WATCH_TYPE_HTLC, WATCH_STAT_UNSPENT));
+    }
+    watch_del(txid[1], 0);
+    ASSERT_EQ(WATCH_STAT_UNSPENT, watch_get(txid[0], 0));
+    ASSERT_EQ(WATCH_STAT_NONE, watch_get(txid[1], 0));
+    ASSERT_EQ(WATCH_STAT_UNSPENT, watch_get(txid[2], 0));
+    ASSERT_EQ(WATCH_STAT_UNSPENT, watch_get(txid[3], 0));
+    ASSERT_EQ(3, watch_count());
+}
+
+
+TEST_F(watch, grow)
+{
+    uint8_t txid[BTC_SZ_TXID];
+    uint8_t channel_id[LN_SZ_CHANNEL_ID] = { 0x01 };
+    const uint32_t NUM = 5000;
+
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        make_txid(txid, lp, 0);
+        ASSERT_TRUE(watch_add(txid, lp & 0x03, channel_id, WATCH_TYPE_HTLC, WATCH_STAT_UNSPENT));
+    }
+    ASSERT_EQ(NUM, watch_count());
+    ASSERT_LE(NUM * 2, mCapacity);
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        make_txid(txid, lp, 0);
+        ASSERT_EQ(WATCH_STAT_UNSPENT, watch_get(txid, lp & 0x03));
+    }
+}
+
+
+TEST_F(watch, del_channel)
+{
+    uint8_t txid[BTC_SZ_TXID];
+    uint8_t channel_id1[LN_SZ_CHANNEL_ID] = { 0x01 };
+    uint8_t channel_id2[LN_SZ_CHANNEL_ID] = { 0x02 };
+
+    for (uint32_t lp = 0; lp < 100; lp++) {
+        make_txid(txid, lp / 4, lp);
+        ASSERT_TRUE(watch_add(txid, 0, (lp & 1) ? channel_id1 : channel_id2, WATCH_TYPE_HTLC, WATCH_STAT_UNSPENT));
+    }
+    //short_channel_idのoutpointはchannel_idが0でも削除しない
+    uint8_t channel_id0[LN_SZ_CHANNEL_ID] = { 0 };
+    make_txid(txid, 0, 0xff);
+    ASSERT_TRUE(watch_add_scid(txid, 0, 0x123456));
+
+    watch_del_channel(channel_id1);
+    ASSERT_EQ(51, watch_count());
+    for (uint32_t lp = 0; lp < 100; lp++) {
+        make_txid(txid, lp / 4, lp);
+        ASSERT_EQ((lp & 1) ? WATCH_STAT_NONE : WATCH_STAT_UNSPENT, watch_get(txid, 0));
+    }
+    watch_del_channel(channel_id0);
+    make_txid(txid, 0, 0xff);
+    ASSERT_EQ(WATCH_STAT_UNKNOWN, watch_get(txid, 0));
+}
+
+
+TEST_F(watch, block)
+{
+    uint8_t block[BTC_SZ_TXID * 3] = { 0 };
+    uint8_t channel_id[LN_SZ_CHANNEL_ID] = { 0x01 };
+
+    //未登録なら照合しない
+    ASSERT_TRUE(watch_block(block, sizeof(block), dummy::spent_cb, NULL));
+    ASSERT_EQ(0, btc_block_read_tx_views_fake.call_count);
+
+    for (int lp = 0; lp < 3; lp++) {
+        make_txid(block + lp * BTC_SZ_TXID, 100 + lp, 0);
+    }
+    ASSERT_TRUE(watch_add(block + BTC_SZ_TXID, 0, channel_id, WATCH_TYPE_TO_LOCAL, WATCH_STAT_UNKNOWN));
+    ASSERT_TRUE(watch_add(block + BTC_SZ_TXID, 1, channel_id, WATCH_TYPE_HTLC, WATCH_STAT_UNSPENT));
+
+    ASSERT_TRUE(watch_block(block, sizeof(block), dummy::spent_cb, NULL));
+    ASSERT_EQ(1, btc_block_read_tx_views_fake.call_count);
+    ASSERT_EQ(1, dummy::spent_cnt);
+    ASSERT_EQ(WATCH_TYPE_TO_LOCAL, dummy::spent.type);
+    ASSERT_EQ(0, memcmp(channel_id, dummy::spent.channel_id, LN_SZ_CHANNEL_ID));
+    ASSERT_EQ(WATCH_STAT_SPENT, watch_get(block + BTC_SZ_TXID, 0));
+    ASSERT_EQ(WATCH_STAT_UNSPENT, watch_get(block + BTC_SZ_TXID, 1));
+}
+
+
+TEST_F(watch, block_scid)
+{
+    uint8_t block[BTC_SZ_TXID * 2] = { 0 };
+    uint8_t channel_id[LN_SZ_CHANNEL_ID] = { 0x01 };
+
+    for (int lp = 0; lp < 2; lp++) {
+        make_txid(block + lp * BTC_SZ_TXID, 200 + lp, 0);
+    }
+    ASSERT_TRUE(watch_add_scid(block, 0, 0x123456));
+    //登録済みなら変更しない
+    ASSERT_TRUE(watch_add(block, 0, channel_id, WATCH_TYPE_FUNDING, WATCH_STAT_UNSPENT));
+    ASSERT_TRUE(watch_add_scid(block, 0, 0x999999));
+    ASSERT_EQ(1, watch_count());
+
+    ASSERT_TRUE(watch_block(block, sizeof(block), dummy::spent_cb, NULL));
+    ASSERT_EQ(1, dummy::spent_cnt);
+    ASSERT_EQ(WATCH_TYPE_SCID, dummy::spent.type);
+    ASSERT_EQ(0x123456, dummy::spent.short_channel_id);
+    ASSERT_EQ(WATCH_STAT_SPENT, watch_get(block, 0));
+}
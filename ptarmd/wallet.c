@@ -98,6 +98,14 @@ bool wallet_from_ptarm(char **ppResult, uint64_t *pAmount, bool bToSend, const c
     }
 
     //署名
+    //  hashPrevouts/hashSequence/hashOutputsは全vinで共通なので先に計算しておく
+    btc_sw_sighash_ctx_t sighash_ctx;
+    ret = btc_sw_sighash_ctx_init(&sighash_ctx, &wallet.tx);
+    if (!ret) {
+        *ppResult = UTL_DBG_STRDUP("fail: btc_sw_sighash_ctx_init");
+        LOGD("%s\n", *ppResult);
+        goto LABEL_EXIT;
+    }
     for (uint32_t lp = 0; lp < wallet.tx.vin_cnt; lp++) {
         btc_vin_t *p_vin = &wallet.tx.vin[lp];
         const uint8_t *p = p_vin->witness[0].buf;
@@ -119,11 +127,11 @@ bool wallet_from_ptarm(char **ppResult, uint64_t *pAmount, bool bToSend, const c
         switch (type) {
         case LN_DB_WALLET_TYPE_TO_REMOTE:
             btc_script_p2wpkh_create_scriptcode(&script_code, p_vin->witness[1].buf);
-            ret = btc_sw_sighash(&wallet.tx, txhash, lp, amount, &script_code);
+            ret = btc_sw_sighash_ctx_calc(&sighash_ctx, txhash, lp, amount, &script_code);
             break;
         case LN_DB_WALLET_TYPE_TO_LOCAL:
         case LN_DB_WALLET_TYPE_HTLC_OUTPUT:
-            ret = btc_sw_sighash_p2wsh_wit(&wallet.tx, txhash, lp, amount,
+            ret = btc_sw_sighash_ctx_calc_p2wsh_wit(&sighash_ctx, txhash, lp, amount,
                                                 &p_vin->witness[p_vin->wit_item_cnt-1]);
             break;
         default:
@@ -132,7 +140,7 @@ bool wallet_from_ptarm(char **ppResult, uint64_t *pAmount, bool bToSend, const c
         if (ret) {
             ret = btc_sig_sign(&sigbuf, txhash, p_secret);
         } else {
-            LOGE("fail: btc_sw_sighash_p2wsh_wit()\n");
+            LOGE("fail: sighash\n");
         }
         if (ret) {
             //wit[0]: signature
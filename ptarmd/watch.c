@@ -0,0 +1,378 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   watch.c
+ *  @brief  outpoint watch index
+ *
+ *  TXID+indexをkeyにしたopen addressing(linear probing)のhash table。
+ *  TXIDはhash値なので、先頭8byteとindexを混ぜるだけでslotを決める。
+ *  削除はtombstoneを使わず、後続のentryを詰める(backward shift)。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define LOG_TAG     "watch"
+#include "utl_log.h"
+#include "utl_dbg.h"
+
+#include "btc_block.h"
+
+#include "watch.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_CAPACITY_MIN          (1024)      ///< table初期サイズ(2のべき乗)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct block_param_t
+ *  @brief  #block_tx_view_cb()のパラメータ
+ */
+typedef struct {
+    watch_spent_cb_t    p_cb;
+    void                *p_param;
+} block_param_t;
+
+
+/********************************************************************
+ * static variables
+ ********************************************************************/
+
+static pthread_mutex_t      mMuxTable = PTHREAD_MUTEX_INITIALIZER;
+static watch_outpoint_t     *mpTable;
+static uint32_t             mCapacity;          ///< table size(2のべき乗)
+static uint32_t             mCount;             ///< 登録数
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static uint32_t slot_home(const uint8_t *pTxid, uint32_t Index);
+static watch_outpoint_t *slot_search(const uint8_t *pTxid, uint32_t Index);
+static bool table_alloc(uint32_t Capacity);
+static bool slot_add(const uint8_t *pTxid, uint32_t Index, const watch_outpoint_t *pWatch);
+static void slot_remove(uint32_t Slot);
+static bool block_tx_view_cb(const btc_tx_view_t *pView, uint32_t Index, void *pParam);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool watch_init(void)
+{
+    pthread_mutex_lock(&mMuxTable);
+    bool ret = (mpTable != NULL) || table_alloc(M_CAPACITY_MIN);
+    pthread_mutex_unlock(&mMuxTable);
+    return ret;
+}
+
+
+void watch_term(void)
+{
+    pthread_mutex_lock(&mMuxTable);
+    UTL_DBG_FREE(mpTable);
+    mCapacity = 0;
+    mCount = 0;
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+bool watch_add(const uint8_t *pTxid, uint32_t Index, const uint8_t *pChannelId, watch_type_t Type, watch_stat_t Stat)
+{
+    watch_outpoint_t watch;
+    memset(&watch, 0, sizeof(watch));
+    memcpy(watch.channel_id, pChannelId, LN_SZ_CHANNEL_ID);
+    watch.type = (uint8_t)Type;
+    watch.stat = (uint8_t)Stat;
+
+    pthread_mutex_lock(&mMuxTable);
+    bool ret = slot_add(pTxid, Index, &watch);
+    pthread_mutex_unlock(&mMuxTable);
+    return ret;
+}
+
+
+bool watch_add_scid(const uint8_t *pTxid, uint32_t Index, uint64_t ShortChannelId)
+{
+    watch_outpoint_t watch;
+    memset(&watch, 0, sizeof(watch));
+    watch.short_channel_id = ShortChannelId;
+    watch.type = WATCH_TYPE_SCID;
+    watch.stat = WATCH_STAT_UNKNOWN;
+
+    pthread_mutex_lock(&mMuxTable);
+    bool ret = slot_add(pTxid, Index, &watch);
+    pthread_mutex_unlock(&mMuxTable);
+    return ret;
+}
+
+
+void watch_del(const uint8_t *pTxid, uint32_t Index)
+{
+    pthread_mutex_lock(&mMuxTable);
+    if (mpTable != NULL) {
+        watch_outpoint_t *p_watch = slot_search(pTxid, Index);
+        if (p_watch->used) {
+            slot_remove(p_watch - mpTable);
+        }
+    }
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+void watch_del_channel(const uint8_t *pChannelId)
+{
+    pthread_mutex_lock(&mMuxTable);
+    uint32_t lp = 0;
+    while (lp < mCapacity) {
+        if ( mpTable[lp].used && (mpTable[lp].type != WATCH_TYPE_SCID) &&
+             (memcmp(mpTable[lp].channel_id, pChannelId, LN_SZ_CHANNEL_ID) == 0) ) {
+            //後続のentryが詰められるので、同じslotをもう一度確認する
+            slot_remove(lp);
+        } else {
+            lp++;
+        }
+    }
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+watch_stat_t watch_get(const uint8_t *pTxid, uint32_t Index)
+{
+    watch_stat_t stat = WATCH_STAT_NONE;
+
+    pthread_mutex_lock(&mMuxTable);
+    if (mpTable != NULL) {
+        const watch_outpoint_t *p_watch = slot_search(pTxid, Index);
+        if (p_watch->used) {
+            stat = (watch_stat_t)p_watch->stat;
+        }
+    }
+    pthread_mutex_unlock(&mMuxTable);
+    return stat;
+}
+
+
+void watch_reset_stat(void)
+{
+    pthread_mutex_lock(&mMuxTable);
+    for (uint32_t lp = 0; lp < mCapacity; lp++) {
+        mpTable[lp].stat = WATCH_STAT_UNKNOWN;
+    }
+    pthread_mutex_unlock(&mMuxTable);
+}
+
+
+uint32_t watch_count(void)
+{
+    pthread_mutex_lock(&mMuxTable);
+    uint32_t count = mCount;
+    pthread_mutex_unlock(&mMuxTable);
+    return count;
+}
+
+
+bool watch_block(const uint8_t *pBlock, uint32_t Len, watch_spent_cb_t pCb, void *pParam)
+{
+    if (watch_count() == 0) {
+        //照合不要
+        return true;
+    }
+
+    block_param_t param;
+    param.p_cb = pCb;
+    param.p_param = pParam;
+    return btc_block_read_tx_views(pBlock, Len, block_tx_view_cb, &param);
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+static uint32_t slot_home(const uint8_t *pTxid, uint32_t Index)
+{
+    uint64_t key;
+    memcpy(&key, pTxid, sizeof(key));
+    key ^= (uint64_t)Index * 0x9e3779b97f4a7c15ULL;
+    key ^= key >> 32;
+    return (uint32_t)key & (mCapacity - 1);
+}
+
+
+/** slot検索
+ *
+ * @return      一致したslot, または登録するslot(used==false)
+ */
+static watch_outpoint_t *slot_search(const uint8_t *pTxid, uint32_t Index)
+{
+    uint32_t slot = slot_home(pTxid, Index);
+    for (;;) {
+        watch_outpoint_t *p_watch = &mpTable[slot];
+        if (!p_watch->used) {
+            return p_watch;
+        }
+        if ( (p_watch->index == Index) &&
+             (memcmp(p_watch->txid, pTxid, BTC_SZ_TXID) == 0) ) {
+            return p_watch;
+        }
+        slot = (slot + 1) & (mCapacity - 1);
+    }
+}
+
+
+/** table確保(登録済みのentryは再配置する)
+ *
+ */
+static bool table_alloc(uint32_t Capacity)
+{
+    watch_outpoint_t *p_old = mpTable;
+    uint32_t old_capacity = mCapacity;
+
+    mpTable = (watch_outpoint_t *)UTL_DBG_MALLOC(sizeof(watch_outpoint_t) * Capacity);
+    if (mpTable == NULL) {
+        LOGE("fail: malloc(capacity=%" PRIu32 ")\n", Capacity);
+        mpTable = p_old;
+        return false;
+    }
+    memset(mpTable, 0, sizeof(watch_outpoint_t) * Capacity);
+    mCapacity = Capacity;
+    for (uint32_t lp = 0; lp < old_capacity; lp++) {
+        if (p_old[lp].used) {
+            watch_outpoint_t *p_watch = slot_search(p_old[lp].txid, p_old[lp].index);
+            memcpy(p_watch, &p_old[lp], sizeof(watch_outpoint_t));
+        }
+    }
+    UTL_DBG_FREE(p_old);
+    LOGD("capacity=%" PRIu32 ", count=%" PRIu32 "\n", mCapacity, mCount);
+    return true;
+}
+
+
+/** slot登録(mMuxTable lock中)
+ *
+ * 登録済みの場合、channel_id, type, short_channel_idは変更せずstatだけ更新する(#WATCH_STAT_UNKNOWNは更新しない)。
+ *
+ * @param[in]   pWatch      登録内容(txid, index, usedは使用しない)
+ */
+static bool slot_add(const uint8_t *pTxid, uint32_t Index, const watch_outpoint_t *pWatch)
+{
+    if (mpTable == NULL) {
+        LOGE("fail: not initialized\n");
+        return false;
+    }
+    watch_outpoint_t *p_watch = slot_search(pTxid, Index);
+    if (p_watch->used) {
+        if (pWatch->stat != WATCH_STAT_UNKNOWN) {
+            p_watch->stat = pWatch->stat;
+        }
+        return true;
+    }
+
+    //使用率が1/2を超える場合は拡張する
+    if ((mCount + 1) * 2 > mCapacity) {
+        if (!table_alloc(mCapacity * 2)) {
+            return false;
+        }
+        p_watch = slot_search(pTxid, Index);
+    }
+    memcpy(p_watch, pWatch, sizeof(watch_outpoint_t));
+    memcpy(p_watch->txid, pTxid, BTC_SZ_TXID);
+    p_watch->index = Index;
+    p_watch->used = true;
+    mCount++;
+    return true;
+}
+
+
+/** slot削除(backward shift)
+ *
+ * 削除したslotより後ろで、本来のslotが削除位置以前のentryを前に詰める。
+ */
+static void slot_remove(uint32_t Slot)
+{
+    uint32_t mask = mCapacity - 1;
+    uint32_t hole = Slot;
+    uint32_t slot = Slot;
+
+    for (;;) {
+        slot = (slot + 1) & mask;
+        if (!mpTable[slot].used) {
+            break;
+        }
+        uint32_t home = slot_home(mpTable[slot].txid, mpTable[slot].index);
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            memcpy(&mpTable[hole], &mpTable[slot], sizeof(watch_outpoint_t));
+            hole = slot;
+        }
+    }
+    mpTable[hole].used = false;
+    mCount--;
+}
+
+
+/** #watch_block()のcallback
+ *
+ * vinのoutpointをraw block上で直接照合する(#btc_tx_t には変換しない)。
+ */
+static bool block_tx_view_cb(const btc_tx_view_t *pView, uint32_t Index, void *pParam)
+{
+    (void)Index;
+    block_param_t *p_param = (block_param_t *)pParam;
+    uint32_t pos = pView->vin_pos;
+
+    for (uint32_t lp = 0; lp < pView->vin_cnt; lp++) {
+        btc_tx_view_vin_t vin;
+        watch_outpoint_t watch;
+
+        btc_tx_view_vin(pView, &vin, &pos);
+        pthread_mutex_lock(&mMuxTable);
+        watch_outpoint_t *p_watch = slot_search(pView->p_data + vin.txid_pos, vin.index);
+        bool detect = p_watch->used;
+        if (detect) {
+            p_watch->stat = WATCH_STAT_SPENT;
+            memcpy(&watch, p_watch, sizeof(watch));
+        }
+        pthread_mutex_unlock(&mMuxTable);
+
+        if (detect) {
+            LOGD("spent: type=%d, index=%" PRIu32 ", txid=", watch.type, watch.index);
+            TXIDD(watch.txid);
+            if (p_param->p_cb != NULL) {
+                (*p_param->p_cb)(&watch, pView, p_param->p_param);
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,196 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   watch.h
+ *  @brief  outpoint watch index
+ *
+ *  監視するoutpoint(funding, to_local, HTLC, revoked, #scid_cacheのfunding)をTXID+indexで登録し、
+ *  新しいblockの全vinを1回走査するだけで使用されたoutpointを検出する。
+ *      - #WATCH_STAT_UNSPENTは、登録後に#watch_block()で全blockを連続して走査している間だけ有効。
+ *        blockを取りこぼした場合は#watch_reset_stat()で全outpointを#WATCH_STAT_UNKNOWNに戻すこと。
+ *      - 全関数はthread safe。
+ */
+#ifndef WATCH_H__
+#define WATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc_tx.h"
+#include "btc_tx_view.h"
+#include "ln.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** @enum   watch_type_t
+ *  @brief  監視するoutpointの種類
+ */
+typedef enum {
+    WATCH_TYPE_FUNDING,             ///< funding_txのoutput
+    WATCH_TYPE_TO_LOCAL,            ///< commit_txのto_local output
+    WATCH_TYPE_HTLC,                ///< commit_txのHTLC output
+    WATCH_TYPE_REVOKED,             ///< revoked transactionのoutput
+    WATCH_TYPE_SCID,                ///< #scid_cacheに登録したfunding_txのoutput(channel_idなし)
+} watch_type_t;
+
+
+/** @enum   watch_stat_t
+ *  @brief  outpointの状態
+ */
+typedef enum {
+    WATCH_STAT_NONE,                ///< 未登録
+    WATCH_STAT_UNKNOWN,             ///< 登録済み(未確認)
+    WATCH_STAT_UNSPENT,             ///< 未使用
+    WATCH_STAT_SPENT,               ///< blockで使用された
+} watch_stat_t;
+
+
+/** @struct watch_outpoint_t
+ *  @brief  監視outpoint
+ */
+typedef struct {
+    uint8_t         txid[BTC_SZ_TXID];
+    uint32_t        index;
+    uint8_t         channel_id[LN_SZ_CHANNEL_ID];   ///< 監視しているchannel(#WATCH_TYPE_SCIDは0)
+    uint64_t        short_channel_id;               ///< #WATCH_TYPE_SCIDのみ
+    uint8_t         type;                           ///< #watch_type_t
+    uint8_t         stat;                           ///< #watch_stat_t
+    bool            used;                           ///< true:使用中のslot
+} watch_outpoint_t;
+
+
+/** #watch_block()で使用されたoutpointを検出したときのcallback
+ *
+ * @param[in]       pWatch      使用されたoutpoint
+ * @param[in]       pView       使用したtransaction(callback内でのみ有効)
+ * @param[in,out]   pParam      #watch_block()のpParam
+ */
+typedef void (*watch_spent_cb_t)(const watch_outpoint_t *pWatch, const btc_tx_view_t *pView, void *pParam);
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** [watch]初期化
+ *
+ * @retval  true    成功
+ */
+bool watch_init(void);
+
+
+/** [watch]終了
+ *
+ */
+void watch_term(void);
+
+
+/** [watch]outpoint登録
+ *
+ * 登録済みの場合、pChannelId, Typeは変更せずStatだけ更新する(#WATCH_STAT_UNKNOWNは更新しない)。
+ *
+ * @param[in]   pTxid       outpointのTXID
+ * @param[in]   Index       outpointのindex
+ * @param[in]   pChannelId  監視するchannel_id
+ * @param[in]   Type        #watch_type_t
+ * @param[in]   Stat        #watch_stat_t
+ * @retval  true    成功
+ */
+bool watch_add(const uint8_t *pTxid, uint32_t Index, const uint8_t *pChannelId, watch_type_t Type, watch_stat_t Stat);
+
+
+/** [watch]short_channel_idのfunding_tx output登録
+ *
+ * #WATCH_TYPE_SCID, #WATCH_STAT_UNKNOWNで登録する。登録済みの場合は何もしない。
+ *
+ * @param[in]   pTxid           funding_txのTXID
+ * @param[in]   Index           funding_txのoutput index
+ * @param[in]   ShortChannelId  short_channel_id
+ * @retval  true    成功
+ */
+bool watch_add_scid(const uint8_t *pTxid, uint32_t Index, uint64_t ShortChannelId);
+
+
+/** [watch]outpoint削除
+ *
+ * @param[in]   pTxid       outpointのTXID
+ * @param[in]   Index       outpointのindex
+ */
+void watch_del(const uint8_t *pTxid, uint32_t Index);
+
+
+/** [watch]channelのoutpointを全削除
+ *
+ * #WATCH_TYPE_SCIDのoutpointは削除しない。
+ *
+ * @param[in]   pChannelId  channel_id
+ */
+void watch_del_channel(const uint8_t *pChannelId);
+
+
+/** [watch]outpointの状態取得
+ *
+ * @param[in]   pTxid       outpointのTXID
+ * @param[in]   Index       outpointのindex
+ * @return      #watch_stat_t(未登録:#WATCH_STAT_NONE)
+ */
+watch_stat_t watch_get(const uint8_t *pTxid, uint32_t Index);
+
+
+/** [watch]全outpointを#WATCH_STAT_UNKNOWNにする
+ *
+ */
+void watch_reset_stat(void);
+
+
+/** [watch]登録数
+ *
+ * @return      登録しているoutpoint数
+ */
+uint32_t watch_count(void);
+
+
+/** [watch]raw blockの全vinを照合
+ *
+ * 一致したoutpointは#WATCH_STAT_SPENTにし、pCbを呼び出す。
+ *
+ * @param[in]       pBlock      raw block
+ * @param[in]       Len         pBlock長
+ * @param[in]       pCb         callback(NULL可)
+ * @param[in,out]   pParam      callbackのパラメータ
+ * @retval  true    成功
+ * @retval  false   block解析失敗(一致したoutpointは#WATCH_STAT_SPENTになっている可能性がある)
+ */
+bool watch_block(const uint8_t *pBlock, uint32_t Len, watch_spent_cb_t pCb, void *pParam);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WATCH_H__ */
@@ -86,11 +86,12 @@ int main(int argc, char* argv[])
     uint64_t amtmsat = 0;
     bool output_json = false;
     char *payment_hash = NULL;
+    ln_routing_profile_t profile = LN_ROUTING_PROFILE_FEE;
     ln_lmdb_set_home_dir(".");
 
     int opt;
     int options = 0;
-    while ((opt = getopt(argc, argv, "hd:s:r:a:e:p:jc")) != -1) {
+    while ((opt = getopt(argc, argv, "hd:s:r:a:e:p:m:jc")) != -1) {
         switch (opt) {
         case 'd':
             //db directory
@@ -131,6 +132,13 @@ int main(int argc, char* argv[])
             //payment_hash
             payment_hash = UTL_DBG_STRDUP(optarg);
             break;
+        case 'm':
+            //edge cost profile
+            if (!ln_routing_profile_from_str(&profile, optarg)) {
+                fprintf(fp_err, "invalid arg: profile\n");
+                return -1;
+            }
+            break;
         case 'j':
             //JSON
             output_json = true;
@@ -149,13 +157,14 @@ int main(int argc, char* argv[])
 
     if ((options == 0) || (options & OPT_HELP)) {
         fprintf(fp_err, "usage:");
-        fprintf(fp_err, "\t%s -s PAYER_NODEID -r PAYEE_NODEID [-d DB_DIR] [-a AMOUNT_MSAT] [-e MIN_FINAL_CLTV_EXPIRY] [-p PAYMENT_HASH] [-j] [-c]\n", argv[0]);
+        fprintf(fp_err, "\t%s -s PAYER_NODEID -r PAYEE_NODEID [-d DB_DIR] [-a AMOUNT_MSAT] [-e MIN_FINAL_CLTV_EXPIRY] [-p PAYMENT_HASH] [-m PROFILE] [-j] [-c]\n", argv[0]);
         fprintf(fp_err, "\t\t-s : sender(payer) node_id\n");
         fprintf(fp_err, "\t\t-r : receiver(payee) node_id\n");
         fprintf(fp_err, "\t\t-d : db directory\n");
         fprintf(fp_err, "\t\t-a : amount_msat\n");
         fprintf(fp_err, "\t\t-e : min_final_cltv_expiry\n");
         fprintf(fp_err, "\t\t-p : payment_hash\n");
+        fprintf(fp_err, "\t\t-m : edge cost profile(fee, balanced, reliable)\n");
         fprintf(fp_err, "\t\t-j : output JSON format(default: CSV format)\n");
         fprintf(fp_err, "\t\t-c : clear routing skip channel list\n");
         return -1;
@@ -233,7 +242,7 @@ int main(int argc, char* argv[])
     if ((options & OPT_CLEARSDB) == 0) {
         ln_routing_result_t result;
         lnerr_route_t rerr = ln_routing_calculate(&result, send_node_id,
-                    recv_node_id, cltv_expiry, amtmsat, 0, NULL);
+                    recv_node_id, cltv_expiry, amtmsat, 0, NULL, profile);
         if (rerr == LNROUTE_OK) {
             //pay.conf形式の出力
             if (payment_hash == NULL) {
@@ -923,19 +923,28 @@ static void dumpit_route_skip(MDB_txn *txn, MDB_dbi dbi)
             printf(INDENT2 "[" M_QQ("%s (%016" PRIx64 ")") ",", str_sci, short_channel_id);
             if (data.mv_size == 0) {
                 printf(M_QQ("perm") "]");
-            } else if (data.mv_size == 1) {
+            } else if ((data.mv_size == 1) || (data.mv_size == LN_DB_ROUTE_SKIP_SZ_EXPIRY)) {
                 const uint8_t *p_data = (const uint8_t *)data.mv_data;
                 switch (p_data[0]) {
                 case LN_DB_ROUTE_SKIP_TEMP:
-                    printf(M_QQ("temp") "]");
+                    printf(M_QQ("temp"));
+                    break;
+                case LN_DB_ROUTE_SKIP_PERM:
+                    printf(M_QQ("perm"));
                     break;
                 case LN_DB_ROUTE_SKIP_WORK:
-                    printf(M_QQ("work") "]");
+                    printf(M_QQ("work"));
                     break;
                 default:
-                    printf(M_QQ("unknown") "]");
+                    printf(M_QQ("unknown"));
                     break;
                 }
+                if (data.mv_size == LN_DB_ROUTE_SKIP_SZ_EXPIRY) {
+                    uint64_t expiry;
+                    memcpy(&expiry, p_data + sizeof(uint8_t), sizeof(expiry));
+                    printf(",%" PRIu64, expiry);
+                }
+                printf("]");
             } else {
                 printf(M_QQ("unknown") "]");
             }
@@ -1120,6 +1129,8 @@ static void dbs_cursor_node(ln_lmdb_db_type_t db_type, MDB_txn *txn, MDB_dbi dbi
     case LN_LMDB_DB_TYPE_PREIMAGE:
         dumpit_preimage(txn, dbi2);
         break;
+    case LN_LMDB_DB_TYPE_PREIMAGE_HASH:
+        break;
     case LN_LMDB_DB_TYPE_PAYMENT_HASH:
         break;
     default:
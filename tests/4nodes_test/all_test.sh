@@ -220,6 +220,14 @@ check_live
 check_log
 check_amount
 
+echo mpp start
+./example_st_mpp.sh
+sleep 5 # XXX: TODO
+echo mpp end
+
+check_live
+check_log
+
 echo st5 start
 ./example_st5.sh
 sleep 5 # XXX: TODO
@@ -0,0 +1,65 @@
+#!/bin/bash -ue
+#
+# HTLC forwarding benchmark(3 nodes)
+#
+#   node_4444 --> node_3333 --> node_5555
+#
+# example_st1.sh - example_st3.sh でチャネルを開いた後に実行する。
+# 送金を1つずつ行い、payeeの残高が増えるまでの時間を1回のlatencyとする。
+#
+#   usage: ./bench_st4hops.sh [count] [amount_msat]
+
+COUNT=${1:-100}
+AMOUNT=${2:-10000}
+PAY_BEGIN=4444
+PAY_END=5555
+HOPS=2
+
+PAYER_PORT=$(( ${PAY_BEGIN} + 1 ))
+PAYEE_PORT=$(( ${PAY_END} + 1 ))
+
+amount() {
+    echo `./ptarmcli -l $1 | jq -e '.result.total_local_msat'`
+}
+
+now_usec() {
+    echo $(( `date +%s%N` / 1000 ))
+}
+
+LATFILE=`mktemp`
+trap "rm -f ${LATFILE}" EXIT
+
+echo "--------------------------------------------"
+echo "bench: ${COUNT} payments, node_${PAY_BEGIN} --> node_3333 --> node_${PAY_END}"
+echo "--------------------------------------------"
+
+BEGIN=`now_usec`
+for i in `seq 1 ${COUNT}`
+do
+    msat_before=`amount ${PAYEE_PORT}`
+    INVOICE=`./ptarmcli -i ${AMOUNT} ${PAYEE_PORT} | jq -r '.result.bolt11'`
+
+    START=`now_usec`
+    ./ptarmcli -r ${INVOICE} ${PAYER_PORT} > /dev/null
+    while :
+    do
+        msat_after=`amount ${PAYEE_PORT}`
+        if [ ${msat_after} -ne ${msat_before} ]; then
+            break
+        fi
+        if [ $(( `now_usec` - ${START} )) -gt 30000000 ]; then
+            echo "fail: payment timeout(${i})"
+            exit 1
+        fi
+    done
+    echo $(( `now_usec` - ${START} )) >> ${LATFILE}
+done
+END=`now_usec`
+
+ELAPSED=$(( ${END} - ${BEGIN} ))
+P50=`sort -n ${LATFILE} | awk '{ a[NR] = $1 } END { print a[int(NR * 0.50) > 0 ? int(NR * 0.50) : 1] }'`
+P99=`sort -n ${LATFILE} | awk '{ a[NR] = $1 } END { print a[int(NR * 0.99) > 0 ? int(NR * 0.99) : 1] }'`
+echo "payments=${COUNT} elapsed=${ELAPSED}us"
+awk -v n=${COUNT} -v h=${HOPS} -v t=${ELAPSED} \
+    'BEGIN { printf("payments/s=%.2f hops/s=%.2f\n", n * 1000000 / t, n * h * 1000000 / t) }'
+echo "latency p50=${P50}us p99=${P99}us"
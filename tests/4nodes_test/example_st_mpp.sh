@@ -0,0 +1,83 @@
+#!/bin/bash -ue
+# multi-path payment
+#   example_st3.sh の後、node_4444からnode_5555へチャネルを追加し、
+#   どちらのチャネルでも1経路では送金できない額をnode_4444からnode_5555へ送金する。
+#   送金は node_4444 --> node_5555 と node_4444 --> node_3333 --> node_5555 に分割される。
+#
+#  +-----------+             +-----------+
+#  | node_4444 +-------------+ node_3333 |
+#  |    FUNDER |             |    fundee |
+#  +-----+-----+             +-----+-----+
+#        |                         |
+#        |                   +-----+-----+             +-----------+
+#        +-------------------+ node_5555 +-------------+ node_6666 |
+#                            |           |             |    FUNDER |
+#                            +-----------+             +-----------+
+#
+# fund-test-in.sh では 3mBTCを相手に渡すため、node_4444の各チャネルで送金できるのは3mBTC未満になる。
+AMOUNT=400000000
+
+amount() {
+    echo `./ptarmcli -l $1 | jq -e '.result.total_local_msat'`
+}
+
+# connect
+./ptarmcli -c conf/peer5555.conf 4445
+sleep 1
+
+# node_4444からnode_5555へチャネルを開く。
+./fund-test-in.sh > node_4444/fund4444_5555.conf
+sleep 1
+./ptarmcli -c conf/peer5555.conf -f node_4444/fund4444_5555.conf 4445
+
+# 少し待つ
+echo wait...
+sleep 2
+
+# mining
+bitcoin-cli -conf=`pwd`/regtest.conf -datadir=`pwd` generate 6
+
+while :
+do
+    CHN4=`./showdb -c -d node_4444 | jq '.[]|length'`
+    CHN5=`./showdb -c -d node_5555 | jq '.[]|length'`
+    echo CHAN4=$CHN4 CHAN5=$CHN5
+
+    if [ "$CHN4" -eq 12 ] && [ "$CHN5" -eq 12 ]; then
+        break
+    fi
+    sleep 3
+done
+
+msat4=`amount 4445`
+msat5=`amount 5556`
+echo msat4=${msat4} msat5=${msat5}
+
+echo "--------------------------------------------"
+echo "PAY large: 4444 --> 5555 / 4444 --> 3333 --> 5555"
+echo "--------------------------------------------"
+./example_st4pay_r.sh 4444 5555 $AMOUNT
+
+# 全partが揃うまで待つ
+for i in `seq 1 30`
+do
+    msat5_after=`amount 5556`
+    if [ $(( msat5_after - msat5 )) -eq $AMOUNT ]; then
+        break
+    fi
+    sleep 2
+done
+msat4_after=`amount 4445`
+msat5_after=`amount 5556`
+echo msat4=${msat4_after} msat5=${msat5_after}
+if [ $(( msat5_after - msat5 )) -ne $AMOUNT ]; then
+    echo invalid amount5: $(( msat5_after - msat5 )) != $AMOUNT
+    exit 1
+fi
+if [ $(( msat4 - msat4_after )) -lt $AMOUNT ]; then
+    echo invalid amount4: $(( msat4 - msat4_after )) \< $AMOUNT
+    exit 1
+fi
+
+# 追加したチャネルを閉じる(example_st5.shでmining)
+./ptarmcli -c conf/peer5555.conf -x 4445
@@ -9,6 +9,7 @@ extern "C" {
 #include "utl_thread.c"
 #include "utl_dbg.c"
 #include "utl_buf.c"
+#include "utl_arena.c"
 #include "utl_push.c"
 #undef LOG_TAG
 #include "utl_log.c"
@@ -43,6 +44,7 @@ TEST_F(utl, first)
 
 #include "testinc_addr.cpp"
 #include "testinc_buf.cpp"
+#include "testinc_arena.cpp"
 #include "testinc_jsonrpc.cpp"
 #include "testinc_net.cpp"
 #include "testinc_opts.cpp"
@@ -51,4 +53,5 @@ TEST_F(utl, first)
 #include "testinc_time.cpp"
 #include "testinc_int.cpp"
 #include "testinc_queue.cpp"
+#include "testinc_log.cpp"
 
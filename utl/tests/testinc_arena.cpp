@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//FAKE_VALUE_FUNC(int, external_function, int);
+
+////////////////////////////////////////////////////////////////////////
+
+class arena: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //RESET_FAKE(external_function)
+        utl_dbg_malloc_cnt_reset();
+    }
+
+    virtual void TearDown() {
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    static void DumpBin(const uint8_t *pData, uint16_t Len)
+    {
+        for (uint16_t lp = 0; lp < Len; lp++) {
+            printf("%02x", pData[lp]);
+        }
+        printf("\n");
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(arena, init)
+{
+    utl_arena_t arena;
+
+    utl_arena_init(&arena, 0);
+    ASSERT_EQ(UTL_ARENA_CHUNK_DEFAULT, arena.chunk_size);
+    ASSERT_TRUE(arena.p_head == NULL);
+    ASSERT_EQ(0, utl_dbg_malloc_cnt());
+
+    utl_arena_init(&arena, 100);
+    ASSERT_EQ(100, arena.chunk_size);
+    utl_arena_free(&arena);
+}
+
+
+TEST_F(arena, alloc)
+{
+    utl_arena_t arena;
+
+    utl_arena_init(&arena, 64);
+
+    uint8_t *p1 = (uint8_t *)utl_arena_alloc(&arena, 1);
+    uint8_t *p2 = (uint8_t *)utl_arena_alloc(&arena, 9);
+    uint8_t *p3 = (uint8_t *)utl_arena_alloc(&arena, 16);
+    ASSERT_TRUE(p1 != NULL);
+    ASSERT_EQ(0, (uintptr_t)p1 % UTL_ARENA_ALIGN);
+    ASSERT_EQ(p1 + 8, p2);
+    ASSERT_EQ(p2 + 16, p3);
+    ASSERT_EQ(1, utl_dbg_malloc_cnt());
+    ASSERT_EQ(1, arena.chunk_cnt);
+
+    //chunkの残り(24byte)に入らない
+    uint8_t *p4 = (uint8_t *)utl_arena_alloc(&arena, 32);
+    ASSERT_TRUE(p4 != NULL);
+    ASSERT_EQ(2, utl_dbg_malloc_cnt());
+
+    //chunkサイズより大きい
+    uint8_t *p5 = (uint8_t *)utl_arena_alloc(&arena, 1000);
+    ASSERT_TRUE(p5 != NULL);
+    memset(p5, 0xcc, 1000);
+    ASSERT_EQ(3, utl_dbg_malloc_cnt());
+    ASSERT_EQ(5, arena.alloc_cnt);
+    ASSERT_EQ(3, arena.chunk_cnt);
+
+    utl_arena_free(&arena);
+}
+
+
+TEST_F(arena, reset)
+{
+    utl_arena_t arena;
+
+    utl_arena_init(&arena, 64);
+
+    uint8_t *p1 = (uint8_t *)utl_arena_alloc(&arena, 48);
+    uint8_t *p2 = (uint8_t *)utl_arena_alloc(&arena, 1000);
+    ASSERT_EQ(2, utl_dbg_malloc_cnt());
+
+    //chunkは再利用する
+    for (int lp = 0; lp < 10; lp++) {
+        utl_arena_reset(&arena);
+        ASSERT_EQ(p1, utl_arena_alloc(&arena, 48));
+        ASSERT_EQ(p2, utl_arena_alloc(&arena, 1000));
+        ASSERT_EQ(2, utl_dbg_malloc_cnt());
+    }
+    ASSERT_EQ(2, arena.chunk_cnt);
+
+    //小さいものは先頭chunkから割り当てる
+    utl_arena_reset(&arena);
+    ASSERT_EQ(p1, utl_arena_alloc(&arena, 8));
+    ASSERT_EQ(p2, utl_arena_alloc(&arena, 100));
+    ASSERT_EQ(2, utl_dbg_malloc_cnt());
+
+    utl_arena_free(&arena);
+    ASSERT_EQ(0, utl_dbg_malloc_cnt());
+
+    //free後も使用できる
+    ASSERT_TRUE(utl_arena_alloc(&arena, 8) != NULL);
+    utl_arena_free(&arena);
+}
+
+
+TEST_F(arena, buf)
+{
+    utl_arena_t arena;
+    utl_buf_t buf = UTL_BUF_INIT;
+    const uint8_t DATA[] = { 1, 2, 3, 4, 5 };
+
+    utl_arena_init(&arena, 0);
+
+    ASSERT_TRUE(utl_arena_buf_alloc(&arena, &buf, 10));
+    ASSERT_EQ(10, buf.len);
+    ASSERT_TRUE(buf.buf != NULL);
+
+    ASSERT_TRUE(utl_arena_buf_alloccopy(&arena, &buf, DATA, sizeof(DATA)));
+    ASSERT_EQ(sizeof(DATA), buf.len);
+    ASSERT_EQ(0, memcmp(DATA, buf.buf, sizeof(DATA)));
+
+    ASSERT_TRUE(utl_arena_buf_alloccopy(&arena, &buf, DATA, 0));
+    ASSERT_EQ(0, buf.len);
+    ASSERT_TRUE(buf.buf == NULL);
+
+    ASSERT_EQ(1, utl_dbg_malloc_cnt());
+    utl_arena_reset(&arena);
+    utl_arena_free(&arena);
+}
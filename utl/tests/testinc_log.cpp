@@ -0,0 +1,235 @@
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+//FAKE_VALUE_FUNC(int, external_function, int);
+
+////////////////////////////////////////////////////////////////////////
+
+class log: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //RESET_FAKE(external_function)
+        utl_dbg_malloc_cnt_reset();
+        strcpy(mDir, "/tmp/utl_log_XXXXXX");
+        ASSERT_TRUE(getcwd(mCwd, sizeof(mCwd)) != NULL);
+        ASSERT_TRUE(mkdtemp(mDir) != NULL);
+        ASSERT_EQ(0, chdir(mDir));
+    }
+
+    virtual void TearDown() {
+        for (int lp = -1; lp < UTL_LOG_MAX; lp++) {
+            remove(FileName(lp).c_str());
+        }
+        rmdir(UTL_LOG_DIR);
+        ASSERT_EQ(0, chdir(mCwd));
+        rmdir(mDir);
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    char mDir[32];
+    char mCwd[256];
+
+    static std::string FileName(int Index)
+    {
+        char fname[64];
+        if (Index < 0) {
+            snprintf(fname, sizeof(fname), "%s", UTL_LOG_NAME);
+        } else {
+            snprintf(fname, sizeof(fname), "%s.%d", UTL_LOG_NAME, Index);
+        }
+        return fname;
+    }
+
+    //"line=<thread>:<num>"を含む行を数える(rotationしたfileを含む)
+    static int CountLines(int Threads, int Lines)
+    {
+        int cnt = 0;
+        for (int lp = -1; lp < UTL_LOG_MAX; lp++) {
+            FILE *fp = fopen(FileName(lp).c_str(), "r");
+            if (fp == NULL) {
+                continue;
+            }
+            char buf[256];
+            while (fgets(buf, sizeof(buf), fp) != NULL) {
+                const char *p = strstr(buf, "line=");
+                int th;
+                int num;
+                if ((p != NULL) && (sscanf(p, "line=%d:%d", &th, &num) == 2) &&
+                    (th < Threads) && (num < Lines)) {
+                    cnt++;
+                }
+            }
+            fclose(fp);
+        }
+        return cnt;
+    }
+
+    struct WriterParam {
+        int     index;
+        int     lines;
+    };
+
+    static void *Writer(void *pArg)
+    {
+        const WriterParam *p_param = (const WriterParam *)pArg;
+        for (int lp = 0; lp < p_param->lines; lp++) {
+            LOGD("line=%d:%d %s\n", p_param->index, lp, "0123456789abcdef0123456789abcdef");
+        }
+        return NULL;
+    }
+
+    struct StoppedParam {
+        WriterParam         writer;
+        pthread_barrier_t   *p_barrier;
+    };
+
+    //書き込み後、mainの指示を待ってから終了する
+    static void *WriterWait(void *pArg)
+    {
+        StoppedParam *p_param = (StoppedParam *)pArg;
+        Writer(&p_param->writer);
+        pthread_barrier_wait(p_param->p_barrier);
+        pthread_barrier_wait(p_param->p_barrier);
+        return NULL;
+    }
+
+    //writer threadだけ止める(utl_log_term()でjoinした直後の状態)
+    static void StopWriter()
+    {
+        __atomic_store_n(&mStop, true, __ATOMIC_RELEASE);
+        wake_writer();
+        pthread_join(mWriter, NULL);
+    }
+
+    static int CountRings()
+    {
+        int cnt = 0;
+        pthread_mutex_lock(&mMuxRing);
+        for (log_ring_t *p_ring = mpRingList; p_ring != NULL; p_ring = p_ring->p_next) {
+            cnt++;
+        }
+        pthread_mutex_unlock(&mMuxRing);
+        return cnt;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(log, term_flush)
+{
+    const int THREADS = 8;
+    const int LINES = 2000;
+    pthread_t th[THREADS];
+    WriterParam param[THREADS];
+
+    ASSERT_TRUE(utl_log_init());
+    for (int lp = 0; lp < THREADS; lp++) {
+        param[lp].index = lp;
+        param[lp].lines = LINES;
+        pthread_create(&th[lp], NULL, Writer, &param[lp]);
+    }
+    for (int lp = 0; lp < THREADS; lp++) {
+        pthread_join(th[lp], NULL);
+    }
+    //writer threadが書き込む前に終了しても、全行が出力される
+    utl_log_term();
+
+    ASSERT_EQ(THREADS * LINES, CountLines(THREADS, LINES));
+}
+
+
+TEST_F(log, long_line)
+{
+    //hex文字列がring bufferの1/2を超える
+    const int LEN = M_SZ_RING / 4 + 1;
+    uint8_t *p_data = (uint8_t *)UTL_DBG_MALLOC(LEN);
+    memset(p_data, 0xa5, LEN);
+
+    ASSERT_TRUE(utl_log_init());
+    LOGD("line=0:0 short\n");
+    DUMPD(p_data, LEN);
+    LOGD("line=0:1 short\n");
+    utl_log_term();
+    UTL_DBG_FREE(p_data);
+
+    //順番が入れ替わらない
+    FILE *fp = fopen(UTL_LOG_NAME, "r");
+    ASSERT_TRUE(fp != NULL);
+    char *p_buf = (char *)malloc(LEN * 2 + 256);
+    int line = 0;
+    while (fgets(p_buf, LEN * 2 + 256, fp) != NULL) {
+        if (strstr(p_buf, "line=0:0") != NULL) {
+            ASSERT_EQ(0, line);
+            line++;
+        } else if (strncmp(p_buf, "a5a5", 4) == 0) {
+            ASSERT_EQ(1, line);
+            ASSERT_EQ((size_t)(LEN * 2 + 1), strlen(p_buf));
+            line++;
+        } else if (strstr(p_buf, "line=0:1") != NULL) {
+            ASSERT_EQ(2, line);
+            line++;
+        }
+    }
+    free(p_buf);
+    fclose(fp);
+    ASSERT_EQ(3, line);
+}
+
+
+TEST_F(log, rotation)
+{
+    const int LINES = UTL_LOG_SIZE_LIMIT / 64;
+    WriterParam param = { 0, LINES };
+
+    ASSERT_TRUE(utl_log_init());
+    Writer(&param);
+    utl_log_term();
+
+    struct stat buf;
+    ASSERT_EQ(0, stat(FileName(0).c_str(), &buf));
+    ASSERT_GE(buf.st_size, UTL_LOG_SIZE_LIMIT);
+    ASSERT_EQ(LINES, CountLines(1, LINES));
+}
+
+
+TEST_F(log, writer_stopped)
+{
+    const int LINES_CLOSE = 100;        //ring bufferに収まる
+    const int LINES_FULL = 2000;        //ring bufferに収まらない
+    pthread_barrier_t barrier;
+    pthread_t th;
+
+    ASSERT_TRUE(utl_log_init());
+    StopWriter();
+    int rings = CountRings();
+
+    //未出力のring bufferを持ったthreadが、writer thread停止後に終了する
+    StoppedParam param0 = { { 0, LINES_CLOSE }, &barrier };
+    pthread_barrier_init(&barrier, NULL, 2);
+    pthread_create(&th, NULL, WriterWait, &param0);
+    pthread_barrier_wait(&barrier);
+    __atomic_store_n(&mAsync, false, __ATOMIC_SEQ_CST);
+    pthread_barrier_wait(&barrier);
+    pthread_join(th, NULL);
+    pthread_barrier_destroy(&barrier);
+    ASSERT_EQ(rings, CountRings());
+
+    //ring bufferの空きを待っている間にwriter threadが停止する
+    __atomic_store_n(&mAsync, true, __ATOMIC_SEQ_CST);
+    StoppedParam param1 = { { 1, LINES_FULL }, &barrier };
+    pthread_barrier_init(&barrier, NULL, 2);
+    pthread_create(&th, NULL, WriterWait, &param1);
+    usleep(50 * 1000);
+    __atomic_store_n(&mAsync, false, __ATOMIC_SEQ_CST);
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    pthread_join(th, NULL);
+    pthread_barrier_destroy(&barrier);
+    ASSERT_EQ(rings, CountRings());
+
+    utl_log_term();
+
+    ASSERT_EQ(LINES_CLOSE, CountLines(1, LINES_CLOSE));
+    ASSERT_EQ(LINES_CLOSE + LINES_FULL, CountLines(2, LINES_FULL));
+}
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+
+#include "utl_local.h"
+#include "utl_dbg.h"
+#include "utl_arena.h"
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+/** @struct utl_arena_chunk_t
+ *  @brief  arena chunk
+ */
+typedef struct utl_arena_chunk_t {
+    struct utl_arena_chunk_t    *p_next;
+    uint32_t                    size;           ///< dataサイズ
+    uint32_t                    used;           ///< data使用済みサイズ
+    uint64_t                    data[];         ///< 割当て領域(UTL_ARENA_ALIGN境界)
+} utl_arena_chunk_t;
+
+
+/**************************************************************************
+ * public functions
+ **************************************************************************/
+
+void utl_arena_init(utl_arena_t *pArena, uint32_t ChunkSize)
+{
+    memset(pArena, 0x00, sizeof(utl_arena_t));
+    pArena->chunk_size = (ChunkSize != 0) ? ChunkSize : UTL_ARENA_CHUNK_DEFAULT;
+}
+
+
+void utl_arena_free(utl_arena_t *pArena)
+{
+    utl_arena_chunk_t *p_chunk = pArena->p_head;
+    while (p_chunk) {
+        utl_arena_chunk_t *p_next = p_chunk->p_next;
+        UTL_DBG_FREE(p_chunk);
+        p_chunk = p_next;
+    }
+    pArena->p_head = NULL;
+    pArena->p_cur = NULL;
+}
+
+
+void *utl_arena_alloc(utl_arena_t *pArena, uint32_t Size)
+{
+    if (Size == 0) {
+        Size = 1;
+    }
+    if (Size > UINT32_MAX - UTL_ARENA_ALIGN) {
+        return NULL;
+    }
+    uint32_t size = (Size + UTL_ARENA_ALIGN - 1) & ~(uint32_t)(UTL_ARENA_ALIGN - 1);
+
+    //p_cur以降のchunkは、resetで空になっているか新規に追加したもの
+    utl_arena_chunk_t *p_prev = NULL;
+    for (utl_arena_chunk_t *p_chunk = pArena->p_cur; p_chunk; p_chunk = p_chunk->p_next) {
+        if (p_chunk->size - p_chunk->used >= size) {
+            void *p = (uint8_t *)p_chunk->data + p_chunk->used;
+            p_chunk->used += size;
+            pArena->p_cur = p_chunk;
+            pArena->alloc_cnt++;
+            return p;
+        }
+        p_prev = p_chunk;
+    }
+
+    uint32_t chunk_size = (size > pArena->chunk_size) ? size : pArena->chunk_size;
+    utl_arena_chunk_t *p_chunk = (utl_arena_chunk_t *)UTL_DBG_MALLOC(sizeof(utl_arena_chunk_t) + chunk_size);
+    if (!p_chunk) {
+        return NULL;
+    }
+    p_chunk->p_next = NULL;
+    p_chunk->size = chunk_size;
+    p_chunk->used = size;
+    if (p_prev) {
+        p_prev->p_next = p_chunk;
+    } else {
+        pArena->p_head = p_chunk;
+    }
+    pArena->p_cur = p_chunk;
+    pArena->alloc_cnt++;
+    pArena->chunk_cnt++;
+    return p_chunk->data;
+}
+
+
+void utl_arena_reset(utl_arena_t *pArena)
+{
+    for (utl_arena_chunk_t *p_chunk = pArena->p_head; p_chunk; p_chunk = p_chunk->p_next) {
+#ifdef PTARM_DEBUG
+        memset(p_chunk->data, 0, p_chunk->used);
+#endif  //PTARM_DEBUG
+        p_chunk->used = 0;
+    }
+    pArena->p_cur = pArena->p_head;
+}
+
+
+bool utl_arena_buf_alloc(utl_arena_t *pArena, utl_buf_t *pBuf, uint32_t Size)
+{
+    pBuf->len = Size;
+    pBuf->buf = (uint8_t *)utl_arena_alloc(pArena, Size);
+    return pBuf->buf != NULL;
+}
+
+
+bool utl_arena_buf_alloccopy(utl_arena_t *pArena, utl_buf_t *pBuf, const uint8_t *pData, uint32_t Len)
+{
+    if (Len > 0) {
+        if (!utl_arena_buf_alloc(pArena, pBuf, Len)) return false;
+        memcpy(pBuf->buf, pData, Len);
+    } else {
+        utl_buf_init(pBuf);
+    }
+    return true;
+}
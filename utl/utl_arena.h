@@ -0,0 +1,150 @@
+/*
+ *  Copyright (C) 2017, Nayuta, Inc. All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/**
+ * @file    utl_arena.h
+ * @brief   utl_arena
+ *
+ * 1メッセージの処理中だけ使用するメモリを確保し、処理後に #utl_arena_reset()でまとめて解放する。
+ * 解放したchunkは次のメッセージで再利用するため、定常状態ではmalloc/freeが発生しない。
+ */
+#ifndef UTL_ARENA_H__
+#define UTL_ARENA_H__
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "utl_buf.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif  //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define UTL_ARENA_CHUNK_DEFAULT     (4096)      ///< chunkサイズ(default)
+#define UTL_ARENA_ALIGN             (8)         ///< 割当てのalignment
+
+
+/**************************************************************************
+ * types
+ **************************************************************************/
+
+struct utl_arena_chunk_t;
+
+
+/** @struct utl_arena_t
+ *  @brief  arena
+ *
+ */
+typedef struct utl_arena_t {
+    struct utl_arena_chunk_t    *p_head;        ///< chunkリスト
+    struct utl_arena_chunk_t    *p_cur;         ///< 割当て中のchunk
+    uint32_t                    chunk_size;     ///< 新規chunkの最小サイズ
+    uint32_t                    alloc_cnt;      ///< [統計]#utl_arena_alloc()回数
+    uint32_t                    chunk_cnt;      ///< [統計]chunk確保(malloc)回数
+} utl_arena_t;
+
+
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+/** #utl_arena_t 初期化
+ *
+ * @param[out]      pArena      処理対象
+ * @param[in]       ChunkSize   新規chunkの最小サイズ(0の場合は #UTL_ARENA_CHUNK_DEFAULT)
+ * @note
+ *      - chunkは最初の #utl_arena_alloc()で確保する
+ */
+void utl_arena_init(utl_arena_t *pArena, uint32_t ChunkSize);
+
+
+/** #utl_arena_t のメモリ解放
+ *
+ * 全chunkを解放する。
+ *
+ * @param[in,out]   pArena      処理対象
+ */
+void utl_arena_free(utl_arena_t *pArena);
+
+
+/** #utl_arena_t からのメモリ確保
+ *
+ * 空きのあるchunkから割り当て、足りなければchunkを追加する。
+ * Sizeがchunkサイズを超える場合は、Size分のchunkを追加する。
+ *
+ * @param[in,out]   pArena      処理対象
+ * @param[in]       Size        確保するメモリサイズ
+ * @return          確保したアドレス(失敗時はNULL)
+ * @note
+ *      - 確保したメモリは個別に解放できない(#utl_arena_reset()で一括解放する)
+ */
+void *utl_arena_alloc(utl_arena_t *pArena, uint32_t Size);
+
+
+/** #utl_arena_t の一括解放
+ *
+ * #utl_arena_alloc()で確保したメモリを全て解放する。
+ * chunkは保持し、次の #utl_arena_alloc()で再利用する。
+ *
+ * @param[in,out]   pArena      処理対象
+ */
+void utl_arena_reset(utl_arena_t *pArena);
+
+
+/** #utl_buf_t へのメモリ確保(arena)
+ *
+ * @param[in,out]   pArena      確保元
+ * @param[out]      pBuf        処理対象
+ * @param[in]       Size        確保するメモリサイズ
+ * @return          true        success
+ *
+ * @attention
+ *      - pBufは #utl_buf_free()しないこと(#utl_arena_reset()で解放される)
+ */
+bool utl_arena_buf_alloc(utl_arena_t *pArena, utl_buf_t *pBuf, uint32_t Size);
+
+
+/** #utl_buf_t へのメモリ確保(arena)及びデータコピー
+ *
+ * @param[in,out]   pArena      確保元
+ * @param[out]      pBuf        処理対象
+ * @param[in]       pData       対象データ
+ * @param[in]       Len         pData長
+ * @return          true        success
+ *
+ * @attention
+ *      - pBufは #utl_buf_free()しないこと(#utl_arena_reset()で解放される)
+ */
+bool utl_arena_buf_alloccopy(utl_arena_t *pArena, utl_buf_t *pBuf, const uint8_t *pData, uint32_t Len);
+
+
+#ifdef __cplusplus
+}
+#endif  //__cplusplus
+
+#endif /* UTL_ARENA_H__ */
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -19,14 +20,48 @@
 
 #define FNAME_MAX       (50)
 
+#define M_SZ_LINE       (1024)              ///< stackで書式化する1行の長さ(超える場合はmalloc)
+#define M_SZ_RING       (64 * 1024)         ///< thread毎のring buffer(2のべき乗)
+#define M_WRITER_WAIT   (10)                ///< writer threadの待ち時間[msec]
+
+
+/** @struct log_ring_t
+ *  @brief  thread毎のring buffer
+ *
+ *  書込みは所有threadだけ、読込みはwriter threadだけが行う(single producer/single consumer)。
+ *  head, tailは増加し続けるcounterで、使用量はhead - tail。
+ */
+typedef struct log_ring_t {
+    struct log_ring_t   *p_next;
+    uint32_t            head;               ///< 書込み位置(所有thread)
+    uint32_t            tail;               ///< 読込み位置(writer thread)
+    bool                closed;             ///< true:所有threadが終了した
+    int                 tid;
+    time_t              time;               ///< time_strの時刻
+    char                time_str[UTL_SZ_TIME_FMT_STR + 1];
+    char                buf[M_SZ_RING];
+} log_ring_t;
+
 
 static inline int tid(void) {
     return (int)syscall(SYS_gettid);
 }
 
 
-static pthread_mutex_t  mMux;
+static pthread_mutex_t  mMux = PTHREAD_MUTEX_INITIALIZER;   ///< mFp
 static FILE             *mFp;
+static bool             mAsync;             ///< true:writer threadで書き込む(file出力のみ, __atomicでアクセス)
+static uint32_t         mSize;              ///< log file size
+
+static pthread_mutex_t  mMuxRing = PTHREAD_MUTEX_INITIALIZER;   ///< mpRingList
+static log_ring_t       *mpRingList;
+static pthread_key_t    mRingKey;
+static pthread_once_t   mRingKeyOnce = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t  mMuxWake = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   mCondWake = PTHREAD_COND_INITIALIZER;
+static pthread_t        mWriter;
+static bool             mStop;              ///< writer thread停止要求(__atomicでアクセス)
 
 //UTL_LOG_PRI_xxx
 //  Error
@@ -36,6 +71,21 @@ static FILE             *mFp;
 static const char M_MARK[] = "EIDV";
 
 
+static bool init(FILE *pFp, bool Async);
+static void exit_handler(void);
+static void ring_key_create(void);
+static void ring_close(void *pArg);
+static log_ring_t *ring_get(void);
+static void ring_write(log_ring_t *pRing, const char *pLine, uint32_t Len);
+static void ring_write_sync(log_ring_t *pRing, const char *pLine, uint32_t Len);
+static uint32_t ring_flush(log_ring_t *pRing);
+static void *writer_thread(void *pArg);
+static uint32_t writer_drain(void);
+static void wake_writer(void);
+static void write_file(const char *pData, uint32_t Len);
+static void rotate(void);
+
+
 bool utl_log_init(void)
 {
     if (mFp != NULL) {
@@ -44,16 +94,14 @@ bool utl_log_init(void)
 
     mkdir(UTL_LOG_DIR, 0755);
 
-    mFp = fopen(UTL_LOG_NAME, "a");
-    if (mFp == NULL) {
+    FILE *fp = fopen(UTL_LOG_NAME, "a");
+    if (fp == NULL) {
         return false;
     }
+    struct stat buf;
+    mSize = (stat(UTL_LOG_NAME, &buf) == 0) ? (uint32_t)buf.st_size : 0;
 
-    pthread_mutex_init(&mMux, NULL);
-
-    utl_log_write(UTL_LOG_PRI_INFO, __FILE__, __LINE__, 1, "UTL_LOG", "INIT", "=== UTL_LOG START ===\n");
-
-    return true;
+    return init(fp, true);
 }
 
 
@@ -63,13 +111,8 @@ bool utl_log_init_stderr(void)
         return true;
     }
 
-    mFp = stderr;
-
-    pthread_mutex_init(&mMux, NULL);
-
-    utl_log_write(UTL_LOG_PRI_INFO, __FILE__, __LINE__, 1, "UTL_LOG", "INIT", "=== UTL_LOG START ===\n");
-
-    return true;
+    //consoleは他の出力と順番が入れ替わらないよう、呼び出したthreadで書き込む
+    return init(stderr, false);
 }
 
 
@@ -79,13 +122,7 @@ bool utl_log_init_stdout(void)
         return true;
     }
 
-    mFp = stdout;
-
-    pthread_mutex_init(&mMux, NULL);
-
-    utl_log_write(UTL_LOG_PRI_INFO, __FILE__, __LINE__, 1, "UTL_LOG", "INIT", "=== UTL_LOG START ===\n");
-
-    return true;
+    return init(stdout, false);
 }
 
 
@@ -93,8 +130,19 @@ void utl_log_term(void)
 {
     if (mFp != NULL) {
         LOGD("stop: logging\n");
+        if (__atomic_load_n(&mAsync, __ATOMIC_ACQUIRE)) {
+            //未出力のlogを全て書き込んでから終了する
+            __atomic_store_n(&mStop, true, __ATOMIC_RELEASE);
+            wake_writer();
+            pthread_join(mWriter, NULL);
+            __atomic_store_n(&mAsync, false, __ATOMIC_SEQ_CST);
+        }
+        //writer threadの最後の読込み後にring bufferへ書き込まれた分
+        writer_drain();
+        pthread_mutex_lock(&mMux);
         fclose(mFp);
         mFp = NULL;
+        pthread_mutex_unlock(&mMux);
     }
 }
 
@@ -105,42 +153,69 @@ void utl_log_write(int Pri, const char* pFname, int Line, int Flag, const char *
         return;
     }
 
-    pthread_mutex_lock(&mMux);
+    log_ring_t *p_ring = ring_get();
+    char line[M_SZ_LINE];
+    char *p_line = line;
+    int len = 0;
 
-    //write log
-    va_list ap;
-
-    va_start(ap, pFmt);
+    //format
     if (Flag) {
-        char time[UTL_SZ_TIME_FMT_STR + 1];
-        fprintf(mFp, "%s(%5d)[%c/%s][%s:%d:%s]", utl_time_str_time(time), (int)tid(), M_MARK[Pri - 1], pTag, pFname, Line, pFunc);
+        char time_str[UTL_SZ_TIME_FMT_STR + 1];
+        const char *p_time;
+        int thread_id;
+        if (p_ring != NULL) {
+            //同じ秒の間は書式化した時刻を再利用する
+            time_t now = utl_time_time();
+            if (now != p_ring->time) {
+                utl_time_fmt(p_ring->time_str, now);
+                p_ring->time = now;
+            }
+            p_time = p_ring->time_str;
+            thread_id = p_ring->tid;
+        } else {
+            p_time = utl_time_str_time(time_str);
+            thread_id = tid();
+        }
+        len = snprintf(line, sizeof(line), "%s(%5d)[%c/%s][%s:%d:%s]", p_time, thread_id, M_MARK[Pri - 1], pTag, pFname, Line, pFunc);
+        if (len >= (int)sizeof(line)) {
+            len = sizeof(line) - 1;
+        }
     }
-    vfprintf(mFp, pFmt, ap);
+    va_list ap;
+    va_start(ap, pFmt);
+    int msg_len = vsnprintf(line + len, sizeof(line) - len, pFmt, ap);
     va_end(ap);
-
-    fflush(mFp);
-
-    //log rotation
-    struct stat buf;
-    int retval = stat(UTL_LOG_NAME, &buf);
-    if ((retval == 0) && (buf.st_size >= UTL_LOG_SIZE_LIMIT)) {
-        fclose(mFp);
-
-        char fname1[FNAME_MAX];
-        char fname2[FNAME_MAX];
-        sprintf(fname1, "%s.%d", UTL_LOG_NAME, UTL_LOG_MAX - 1);
-        remove(fname1);
-        for (int lp = UTL_LOG_MAX - 1; lp > 0; lp--) {
-            sprintf(fname1, "%s.%d", UTL_LOG_NAME, lp);        //after
-            sprintf(fname2, "%s.%d", UTL_LOG_NAME, lp - 1);    //before
-            rename(fname2, fname1);
+    if (msg_len < 0) {
+        return;
+    }
+    if (len + msg_len >= (int)sizeof(line)) {
+        //長い行(DUMP等)
+        p_line = (char *)malloc(len + msg_len + 1);
+        if (p_line == NULL) {
+            return;
         }
-        rename(UTL_LOG_NAME, fname2);
+        memcpy(p_line, line, len);
+        va_start(ap, pFmt);
+        vsnprintf(p_line + len, msg_len + 1, pFmt, ap);
+        va_end(ap);
+    }
+    len += msg_len;
 
-        mFp = fopen(UTL_LOG_NAME, "a");
+    //write log
+    if (__atomic_load_n(&mAsync, __ATOMIC_ACQUIRE) && (p_ring != NULL)) {
+        ring_write(p_ring, p_line, (uint32_t)len);
+    } else {
+        pthread_mutex_lock(&mMux);
+        if (mFp != NULL) {
+            write_file(p_line, (uint32_t)len);
+            fflush(mFp);
+        }
+        pthread_mutex_unlock(&mMux);
     }
 
-    pthread_mutex_unlock(&mMux);
+    if (p_line != line) {
+        free(p_line);
+    }
 }
 
 
@@ -160,3 +235,312 @@ void utl_log_dump_rev(int Pri, const char* pFname, int Line, int Flag, const cha
     utl_log_write(Pri, pFname, Line, Flag, pTag, pFunc, "%s\n", p_str);
     UTL_DBG_FREE(p_str);
 }
+
+
+static bool init(FILE *pFp, bool Async)
+{
+    pthread_once(&mRingKeyOnce, ring_key_create);
+
+    mFp = pFp;
+    __atomic_store_n(&mStop, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&mAsync, false, __ATOMIC_RELEASE);
+    if (Async) {
+        if (pthread_create(&mWriter, NULL, writer_thread, NULL) == 0) {
+            __atomic_store_n(&mAsync, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    utl_log_write(UTL_LOG_PRI_INFO, __FILE__, __LINE__, 1, "UTL_LOG", "INIT", "=== UTL_LOG START ===\n");
+
+    return true;
+}
+
+
+/** exit()時に未出力のlogを書き込む
+ *
+ */
+static void exit_handler(void)
+{
+    if (__atomic_load_n(&mAsync, __ATOMIC_ACQUIRE)) {
+        utl_log_term();
+    }
+}
+
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&mRingKey, ring_close);
+    atexit(exit_handler);
+}
+
+
+/** thread終了
+ *
+ * ring bufferはwriter threadが出力し終わってから解放する。
+ * writer threadがいない場合は、未出力分をここで書き込んでから解放する。
+ */
+static void ring_close(void *pArg)
+{
+    log_ring_t *p_ring = (log_ring_t *)pArg;
+
+    pthread_mutex_lock(&mMuxRing);
+    if (!__atomic_load_n(&mAsync, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&mMux);
+        ring_flush(p_ring);
+        pthread_mutex_unlock(&mMux);
+
+        log_ring_t **pp_ring = &mpRingList;
+        while (*pp_ring != p_ring) {
+            pp_ring = &(*pp_ring)->p_next;
+        }
+        *pp_ring = p_ring->p_next;
+        free(p_ring);
+    } else {
+        __atomic_store_n(&p_ring->closed, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mMuxRing);
+}
+
+
+/** 呼び出したthreadのring buffer取得
+ *
+ * @return      ring buffer(確保できない場合はNULL)
+ */
+static log_ring_t *ring_get(void)
+{
+    log_ring_t *p_ring = (log_ring_t *)pthread_getspecific(mRingKey);
+    if (p_ring != NULL) {
+        return p_ring;
+    }
+
+    //UTL_DBG_MALLOC()の計数対象外(thread終了後にwriter threadが解放する)
+    p_ring = (log_ring_t *)malloc(sizeof(log_ring_t));
+    if (p_ring == NULL) {
+        return NULL;
+    }
+    p_ring->head = 0;
+    p_ring->tail = 0;
+    p_ring->closed = false;
+    p_ring->tid = tid();
+    p_ring->time = 0;
+    pthread_setspecific(mRingKey, p_ring);
+
+    pthread_mutex_lock(&mMuxRing);
+    p_ring->p_next = mpRingList;
+    mpRingList = p_ring;
+    pthread_mutex_unlock(&mMuxRing);
+
+    return p_ring;
+}
+
+
+/** ring bufferに1行書き込む
+ *
+ * 空きがなければwriter threadが読み込むまで待つ(破棄しない)。
+ * writer threadが停止していれば、呼び出したthreadで書き込む。
+ */
+static void ring_write(log_ring_t *pRing, const char *pLine, uint32_t Len)
+{
+    uint32_t head = pRing->head;
+
+    if (Len > M_SZ_RING / 2) {
+        //ring bufferに入らない行は、自threadの出力済みを待って直接書き込む
+        while (__atomic_load_n(&pRing->tail, __ATOMIC_ACQUIRE) != head) {
+            if (!__atomic_load_n(&mAsync, __ATOMIC_ACQUIRE)) {
+                //writer thread停止済み
+                break;
+            }
+            wake_writer();
+            usleep(1000);
+        }
+        ring_write_sync(pRing, pLine, Len);
+        return;
+    }
+
+    while (M_SZ_RING - (head - __atomic_load_n(&pRing->tail, __ATOMIC_ACQUIRE)) < Len) {
+        if (!__atomic_load_n(&mAsync, __ATOMIC_ACQUIRE)) {
+            ring_write_sync(pRing, pLine, Len);
+            return;
+        }
+        wake_writer();
+        usleep(1000);
+    }
+    uint32_t pos = head & (M_SZ_RING - 1);
+    uint32_t len1 = M_SZ_RING - pos;
+    if (len1 >= Len) {
+        memcpy(pRing->buf + pos, pLine, Len);
+    } else {
+        memcpy(pRing->buf + pos, pLine, len1);
+        memcpy(pRing->buf, pLine + len1, Len - len1);
+    }
+    __atomic_store_n(&pRing->head, head + Len, __ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&mAsync, __ATOMIC_SEQ_CST)) {
+        //書き込み中にwriter threadが停止した(#utl_log_term()の読込みと重なっても二重には書かない)
+        ring_write_sync(pRing, NULL, 0);
+        return;
+    }
+    if (head + Len - __atomic_load_n(&pRing->tail, __ATOMIC_RELAXED) > M_SZ_RING / 2) {
+        wake_writer();
+    }
+}
+
+
+/** 自threadのring bufferの未出力分と1行を、呼び出したthreadで書き込む
+ *
+ * @param[in]   pLine   追加で書き込む行(NULL:ring bufferのみ)
+ */
+static void ring_write_sync(log_ring_t *pRing, const char *pLine, uint32_t Len)
+{
+    pthread_mutex_lock(&mMux);
+    if (mFp != NULL) {
+        ring_flush(pRing);
+        if (pLine != NULL) {
+            write_file(pLine, Len);
+        }
+        fflush(mFp);
+    }
+    pthread_mutex_unlock(&mMux);
+}
+
+
+/** ring bufferの未出力分を書き込む(mMuxをlockして呼び出す)
+ *
+ * @return      書き込んだサイズ
+ */
+static uint32_t ring_flush(log_ring_t *pRing)
+{
+    uint32_t head = __atomic_load_n(&pRing->head, __ATOMIC_SEQ_CST);
+    uint32_t tail = pRing->tail;
+    uint32_t len = head - tail;
+    if ((len == 0) || (mFp == NULL)) {
+        return 0;
+    }
+
+    uint32_t pos = tail & (M_SZ_RING - 1);
+    uint32_t len1 = M_SZ_RING - pos;
+    if (len1 >= len) {
+        write_file(pRing->buf + pos, len);
+    } else {
+        write_file(pRing->buf + pos, len1);
+        write_file(pRing->buf, len - len1);
+    }
+    __atomic_store_n(&pRing->tail, head, __ATOMIC_RELEASE);
+    return len;
+}
+
+
+/** writer thread
+ *
+ * 全threadのring bufferをまとめて書き込み、log rotationもここで行う。
+ */
+static void *writer_thread(void *pArg)
+{
+    (void)pArg;
+
+    for (;;) {
+        bool stop = __atomic_load_n(&mStop, __ATOMIC_ACQUIRE);
+        if (writer_drain() > 0) {
+            continue;
+        }
+        if (stop) {
+            //停止要求後に全ring bufferが空になった
+            break;
+        }
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += M_WRITER_WAIT * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&mMuxWake);
+        if (!__atomic_load_n(&mStop, __ATOMIC_ACQUIRE)) {
+            pthread_cond_timedwait(&mCondWake, &mMuxWake, &ts);
+        }
+        pthread_mutex_unlock(&mMuxWake);
+    }
+
+    return NULL;
+}
+
+
+/** 全ring bufferを書き込む
+ *
+ * @return      書き込んだサイズ
+ */
+static uint32_t writer_drain(void)
+{
+    uint32_t total = 0;
+
+    pthread_mutex_lock(&mMuxRing);
+    pthread_mutex_lock(&mMux);
+    log_ring_t **pp_ring = &mpRingList;
+    while (*pp_ring != NULL) {
+        log_ring_t *p_ring = *pp_ring;
+        //closedを先に読む(closed後はheadが増えない)
+        bool closed = __atomic_load_n(&p_ring->closed, __ATOMIC_ACQUIRE);
+        total += ring_flush(p_ring);
+        if (closed) {
+            *pp_ring = p_ring->p_next;
+            free(p_ring);
+            continue;
+        }
+        pp_ring = &p_ring->p_next;
+    }
+    if ((total > 0) && (mFp != NULL)) {
+        fflush(mFp);
+    }
+    pthread_mutex_unlock(&mMux);
+    pthread_mutex_unlock(&mMuxRing);
+
+    return total;
+}
+
+
+static void wake_writer(void)
+{
+    pthread_mutex_lock(&mMuxWake);
+    pthread_cond_signal(&mCondWake);
+    pthread_mutex_unlock(&mMuxWake);
+}
+
+
+/** mFpに書き込む(mMuxをlockして呼び出す)
+ *
+ * ring bufferの折り返しで1行が分かれて書き込まれるため、rotationは行末でのみ行う。
+ */
+static void write_file(const char *pData, uint32_t Len)
+{
+    fwrite(pData, 1, Len, mFp);
+    if (__atomic_load_n(&mAsync, __ATOMIC_RELAXED)) {
+        mSize += Len;
+        if ((mSize >= UTL_LOG_SIZE_LIMIT) && (Len > 0) && (pData[Len - 1] == '\n')) {
+            rotate();
+        }
+    }
+}
+
+
+/** log rotation(mMuxをlockして呼び出す)
+ *
+ */
+static void rotate(void)
+{
+    fclose(mFp);
+
+    char fname1[FNAME_MAX];
+    char fname2[FNAME_MAX];
+    sprintf(fname1, "%s.%d", UTL_LOG_NAME, UTL_LOG_MAX - 1);
+    remove(fname1);
+    for (int lp = UTL_LOG_MAX - 1; lp > 0; lp--) {
+        sprintf(fname1, "%s.%d", UTL_LOG_NAME, lp);        //after
+        sprintf(fname2, "%s.%d", UTL_LOG_NAME, lp - 1);    //before
+        rename(fname2, fname1);
+    }
+    rename(UTL_LOG_NAME, fname2);
+
+    mFp = fopen(UTL_LOG_NAME, "a");
+    mSize = 0;
+}